@@ -0,0 +1,235 @@
+/*
+ * trunk-decoder - IMBE basic operator check and benchmark
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Runs every inline basic operator (basic_op_inline.h) against the ETSI
+ * reference in basicop2.cc (basicop_ref::) on the edge values around
+ * zero, the shift limits and saturation, plus a long run of random
+ * operands, comparing results and the Overflow flag. Then times a
+ * multiply-accumulate loop through each, the shape of the vocoder's
+ * inner loops.
+ *
+ * Exits non-zero on the first mismatch.
+ *
+ * Usage: basicop-bench [random_cases]
+ */
+
+#include "imbe_vocoder/typedef.h"
+#include "imbe_vocoder/basic_op.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+namespace basicop_ref {
+Word16 add (Word16 var1, Word16 var2);
+Word16 sub (Word16 var1, Word16 var2);
+Word16 abs_s (Word16 var1);
+Word16 shl (Word16 var1, Word16 var2);
+Word16 shr (Word16 var1, Word16 var2);
+Word16 mult (Word16 var1, Word16 var2);
+Word32 L_mult (Word16 var1, Word16 var2);
+Word16 negate (Word16 var1);
+Word16 extract_h (Word32 L_var1);
+Word16 extract_l (Word32 L_var1);
+Word16 round (Word32 L_var1);
+Word32 L_mac (Word32 L_var3, Word16 var1, Word16 var2);
+Word32 L_msu (Word32 L_var3, Word16 var1, Word16 var2);
+Word32 L_add (Word32 L_var1, Word32 L_var2);
+Word32 L_sub (Word32 L_var1, Word32 L_var2);
+Word32 L_negate (Word32 L_var1);
+Word16 mult_r (Word16 var1, Word16 var2);
+Word32 L_shl (Word32 L_var1, Word16 var2);
+Word32 L_shr (Word32 L_var1, Word16 var2);
+Word16 shr_r (Word16 var1, Word16 var2);
+Word16 mac_r (Word32 L_var3, Word16 var1, Word16 var2);
+Word16 msu_r (Word32 L_var3, Word16 var1, Word16 var2);
+Word32 L_deposit_h (Word16 var1);
+Word32 L_deposit_l (Word16 var1);
+Word32 L_shr_r (Word32 L_var1, Word16 var2);
+Word32 L_abs (Word32 L_var1);
+Word16 norm_s (Word16 var1);
+Word16 norm_l (Word32 L_var1);
+}
+
+namespace {
+
+#if defined(__ARM_FEATURE_DSP) && !defined(__aarch64__)
+const bool CHECK_OVERFLOW = false;   // the qadd family leaves Overflow alone
+#else
+const bool CHECK_OVERFLOW = true;
+#endif
+
+uint64_t cases = 0;
+
+std::vector<Word16> edge_words() {
+    std::vector<Word16> words = {0, 1, -1, 2, -2, 15, 16, 17, -15, -16, -17, 31, 32, 33, -31, -32, -33,
+                                 0x3fff, 0x4000, -0x4000, -0x4001, 0x7ffe, 0x7fff, -0x7fff, -0x8000};
+    for (int bit = 0; bit < 15; bit++) {
+        words.push_back(static_cast<Word16>(1 << bit));
+        words.push_back(static_cast<Word16>(-(1 << bit)));
+        words.push_back(static_cast<Word16>((1 << bit) - 1));
+    }
+    return words;
+}
+
+std::vector<Word32> edge_longs() {
+    std::vector<Word32> longs = {0, 1, -1, 2, -2, 0x8000, 0x7fff, -0x8000, 0x3fffffff, 0x40000000,
+                                 -0x40000000, -0x40000001, MAX_32, MAX_32 - 1, MIN_32, MIN_32 + 1};
+    for (int bit = 0; bit < 31; bit++) {
+        longs.push_back(static_cast<Word32>(1u << bit));
+        longs.push_back(-static_cast<Word32>(1u << bit));
+        longs.push_back(static_cast<Word32>((1u << bit) - 1));
+    }
+    return longs;
+}
+
+template <typename R, typename Inline, typename Ref>
+bool same(const char* name, Inline fast, Ref ref, long a, long b, long c) {
+    cases++;
+    Overflow = 0;
+    R expected = ref();
+    Flag expected_overflow = Overflow;
+    Overflow = 0;
+    R got = fast();
+    Flag got_overflow = Overflow;
+    if (got == expected && (!CHECK_OVERFLOW || got_overflow == expected_overflow)) {
+        return true;
+    }
+    std::cerr << "MISMATCH " << name << "(" << a << ", " << b << ", " << c << "): inline " << got
+              << " overflow " << got_overflow << ", reference " << expected
+              << " overflow " << expected_overflow << std::endl;
+    return false;
+}
+
+#define CHECK16(op, a, b) \
+    if (!same<Word16>(#op, [&] { return op(a, b); }, [&] { return basicop_ref::op(a, b); }, a, b, 0)) return false
+#define CHECK32(op, r, a, b) \
+    if (!same<r>(#op, [&] { return op(a, b); }, [&] { return basicop_ref::op(a, b); }, a, b, 0)) return false
+#define CHECK1(op, r, a) \
+    if (!same<r>(#op, [&] { return op(a); }, [&] { return basicop_ref::op(a); }, a, 0, 0)) return false
+#define CHECK3(op, r, acc, a, b) \
+    if (!same<r>(#op, [&] { return op(acc, a, b); }, [&] { return basicop_ref::op(acc, a, b); }, acc, a, b)) return false
+
+bool check_words(Word16 a, Word16 b) {
+    CHECK16(add, a, b);
+    CHECK16(sub, a, b);
+    CHECK16(mult, a, b);
+    CHECK16(mult_r, a, b);
+    CHECK32(L_mult, Word32, a, b);
+    CHECK16(shl, a, b);
+    CHECK16(shr, a, b);
+    CHECK16(shr_r, a, b);
+    CHECK1(abs_s, Word16, a);
+    CHECK1(negate, Word16, a);
+    CHECK1(norm_s, Word16, a);
+    CHECK1(L_deposit_h, Word32, a);
+    CHECK1(L_deposit_l, Word32, a);
+    return true;
+}
+
+bool check_longs(Word32 x, Word32 y, Word16 a, Word16 b) {
+    CHECK32(L_add, Word32, x, y);
+    CHECK32(L_sub, Word32, x, y);
+    CHECK32(L_shl, Word32, x, a);
+    CHECK32(L_shr, Word32, x, a);
+    CHECK32(L_shr_r, Word32, x, a);
+    CHECK3(L_mac, Word32, x, a, b);
+    CHECK3(L_msu, Word32, x, a, b);
+    CHECK3(mac_r, Word16, x, a, b);
+    CHECK3(msu_r, Word16, x, a, b);
+    CHECK1(L_negate, Word32, x);
+    CHECK1(L_abs, Word32, x);
+    CHECK1(norm_l, Word16, x);
+    CHECK1(extract_h, Word16, x);
+    CHECK1(extract_l, Word16, x);
+    CHECK1(round, Word16, x);
+    return true;
+}
+
+// Shift counts past the operand width, where the reference clamps
+Word16 shift_count(uint32_t seed) {
+    return static_cast<Word16>(static_cast<int>(seed % 81) - 40);
+}
+
+template <typename Mac>
+double time_mac(const std::vector<Word16>& a, const std::vector<Word16>& b, int passes, Word32& sum, Mac mac) {
+    auto start = std::chrono::steady_clock::now();
+    Word32 acc = 0;
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < a.size(); i++) {
+            acc = mac(acc, a[i], b[i]);
+        }
+        acc = acc >> 4;
+    }
+    sum = acc;
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    long random_cases = argc > 1 ? std::atol(argv[1]) : 20000000;
+
+    std::vector<Word16> words = edge_words();
+    std::vector<Word32> longs = edge_longs();
+    for (Word16 a : words) {
+        for (Word16 b : words) {
+            if (!check_words(a, b)) {
+                return 1;
+            }
+        }
+    }
+    for (Word32 x : longs) {
+        for (Word32 y : longs) {
+            for (Word16 a : words) {
+                if (!check_longs(x, y, a, words[(a & 0xff) % words.size()])) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    uint32_t seed = 0x25c0ffee;
+    auto next = [&seed] {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+    for (long i = 0; i < random_cases; i++) {
+        Word16 a = static_cast<Word16>(next());
+        Word16 b = static_cast<Word16>(next());
+        Word32 x = static_cast<Word32>(next());
+        Word32 y = static_cast<Word32>(next());
+        if (!check_words(a, b) || !check_words(a, shift_count(next())) ||
+            !check_longs(x, y, a, b) || !check_longs(x, y, shift_count(next()), b)) {
+            return 1;
+        }
+    }
+    std::cout << "basic operators: " << cases << " cases bit-exact with the reference"
+              << (CHECK_OVERFLOW ? "" : " (Overflow not compared)") << std::endl;
+
+    std::vector<Word16> va(4096);
+    std::vector<Word16> vb(4096);
+    for (size_t i = 0; i < va.size(); i++) {
+        va[i] = static_cast<Word16>(next());
+        vb[i] = static_cast<Word16>(next() >> 2);
+    }
+    const int passes = 20000;
+    Word32 inline_sum = 0;
+    Word32 ref_sum = 0;
+    double inline_s = time_mac(va, vb, passes, inline_sum,
+                               [](Word32 acc, Word16 a, Word16 b) { return L_mac(acc, a, b); });
+    double ref_s = time_mac(va, vb, passes, ref_sum,
+                            [](Word32 acc, Word16 a, Word16 b) { return basicop_ref::L_mac(acc, a, b); });
+    double macs = static_cast<double>(va.size()) * passes;
+    std::cout << std::fixed << std::setprecision(1)
+              << "L_mac inline:    " << macs / inline_s / 1e6 << " M/s\n"
+              << "L_mac reference: " << macs / ref_s / 1e6 << " M/s ("
+              << std::setprecision(2) << ref_s / inline_s << "x)\n";
+    return inline_sum == ref_sum ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+/*
+ * trunk-decoder - string-based DES-OFB keystream, the pre-SP-table path
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * P25DESDecrypt's keystream code before the key schedule cache and the
+ * SP tables, kept as the baseline DesKeystream is measured against. It
+ * is the OP25-derived string implementation: every prepare() expands the
+ * key into 16 round keys held as '0'/'1' strings, and every block runs
+ * through permute/xor_ on strings and back through hex. The old encrypt()
+ * was a placeholder that only XORed round keys in; it is completed here
+ * with the OP25 rounds (expansion, S-boxes, P), so the keystream is real
+ * DES and can be checked against the current one. Real rounds cost more
+ * than the placeholder's XORs did, so this is what a working string DES
+ * costs, not the placeholder.
+ */
+
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class StringDESKeystream {
+public:
+    uint8_t keystream[224];
+
+    void prepare(const uint8_t key[8], const uint8_t mi[9]) {
+        std::string key_bin = permute(hex2bin(byte_array_to_string(key)), keyp, 56);
+
+        std::vector<std::string> rkb(16);
+        std::string left = key_bin.substr(0, 28);
+        std::string right = key_bin.substr(28, 28);
+        for (int i = 0; i < 16; i++) {
+            left = shift_left(left, shift_table[i]);
+            right = shift_left(right, shift_table[i]);
+            rkb[i] = permute(left + right, key_comp, 48);
+        }
+
+        std::string iv = byte_array_to_string(mi);
+        for (int block = 0; block < 28; block++) {
+            std::string encrypted_iv = encrypt(iv, rkb);
+            uint8_t block_bytes[8];
+            string_to_byte_array(encrypted_iv, block_bytes);
+            for (int i = 0; i < 8; i++) {
+                keystream[block * 8 + i] = block_bytes[i];
+            }
+            iv = encrypted_iv;
+        }
+    }
+
+private:
+    static constexpr int initial_perm[64] = {
+        58, 50, 42, 34, 26, 18, 10, 2, 60, 52, 44, 36, 28, 20, 12, 4,
+        62, 54, 46, 38, 30, 22, 14, 6, 64, 56, 48, 40, 32, 24, 16, 8,
+        57, 49, 41, 33, 25, 17,  9, 1, 59, 51, 43, 35, 27, 19, 11, 3,
+        61, 53, 45, 37, 29, 21, 13, 5, 63, 55, 47, 39, 31, 23, 15, 7
+    };
+    static constexpr int final_perm[64] = {
+        40, 8, 48, 16, 56, 24, 64, 32, 39, 7, 47, 15, 55, 23, 63, 31,
+        38, 6, 46, 14, 54, 22, 62, 30, 37, 5, 45, 13, 53, 21, 61, 29,
+        36, 4, 44, 12, 52, 20, 60, 28, 35, 3, 43, 11, 51, 19, 59, 27,
+        34, 2, 42, 10, 50, 18, 58, 26, 33, 1, 41,  9, 49, 17, 57, 25
+    };
+    static constexpr int keyp[56] = {
+        57, 49, 41, 33, 25, 17, 9,  1, 58, 50, 42, 34, 26, 18,
+        10,  2, 59, 51, 43, 35, 27, 19, 11,  3, 60, 52, 44, 36,
+        63, 55, 47, 39, 31, 23, 15,  7, 62, 54, 46, 38, 30, 22,
+        14,  6, 61, 53, 45, 37, 29, 21, 13,  5, 28, 20, 12,  4
+    };
+    static constexpr int shift_table[16] = {
+        1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1
+    };
+    static constexpr int key_comp[48] = {
+        14, 17, 11, 24,  1,  5,  3, 28, 15,  6, 21, 10,
+        23, 19, 12,  4, 26,  8, 16,  7, 27, 20, 13,  2,
+        41, 52, 31, 37, 47, 55, 30, 40, 51, 45, 33, 48,
+        44, 49, 39, 56, 34, 53, 46, 42, 50, 36, 29, 32
+    };
+    static constexpr int exp_d[48] = {
+        32,  1,  2,  3,  4,  5,  4,  5,  6,  7,  8,  9,
+         8,  9, 10, 11, 12, 13, 12, 13, 14, 15, 16, 17,
+        16, 17, 18, 19, 20, 21, 20, 21, 22, 23, 24, 25,
+        24, 25, 26, 27, 28, 29, 28, 29, 30, 31, 32,  1
+    };
+    static constexpr int per[32] = {
+        16,  7, 20, 21, 29, 12, 28, 17,  1, 15, 23, 26,  5, 18, 31, 10,
+         2,  8, 24, 14, 32, 27,  3,  9, 19, 13, 30,  6, 22, 11,  4, 25
+    };
+    static constexpr uint8_t sbox[8][4][16] = {
+        { { 14, 4, 13, 1, 2, 15, 11, 8, 3, 10, 6, 12, 5, 9, 0, 7 },
+          { 0, 15, 7, 4, 14, 2, 13, 1, 10, 6, 12, 11, 9, 5, 3, 8 },
+          { 4, 1, 14, 8, 13, 6, 2, 11, 15, 12, 9, 7, 3, 10, 5, 0 },
+          { 15, 12, 8, 2, 4, 9, 1, 7, 5, 11, 3, 14, 10, 0, 6, 13 } },
+        { { 15, 1, 8, 14, 6, 11, 3, 4, 9, 7, 2, 13, 12, 0, 5, 10 },
+          { 3, 13, 4, 7, 15, 2, 8, 14, 12, 0, 1, 10, 6, 9, 11, 5 },
+          { 0, 14, 7, 11, 10, 4, 13, 1, 5, 8, 12, 6, 9, 3, 2, 15 },
+          { 13, 8, 10, 1, 3, 15, 4, 2, 11, 6, 7, 12, 0, 5, 14, 9 } },
+        { { 10, 0, 9, 14, 6, 3, 15, 5, 1, 13, 12, 7, 11, 4, 2, 8 },
+          { 13, 7, 0, 9, 3, 4, 6, 10, 2, 8, 5, 14, 12, 11, 15, 1 },
+          { 13, 6, 4, 9, 8, 15, 3, 0, 11, 1, 2, 12, 5, 10, 14, 7 },
+          { 1, 10, 13, 0, 6, 9, 8, 7, 4, 15, 14, 3, 11, 5, 2, 12 } },
+        { { 7, 13, 14, 3, 0, 6, 9, 10, 1, 2, 8, 5, 11, 12, 4, 15 },
+          { 13, 8, 11, 5, 6, 15, 0, 3, 4, 7, 2, 12, 1, 10, 14, 9 },
+          { 10, 6, 9, 0, 12, 11, 7, 13, 15, 1, 3, 14, 5, 2, 8, 4 },
+          { 3, 15, 0, 6, 10, 1, 13, 8, 9, 4, 5, 11, 12, 7, 2, 14 } },
+        { { 2, 12, 4, 1, 7, 10, 11, 6, 8, 5, 3, 15, 13, 0, 14, 9 },
+          { 14, 11, 2, 12, 4, 7, 13, 1, 5, 0, 15, 10, 3, 9, 8, 6 },
+          { 4, 2, 1, 11, 10, 13, 7, 8, 15, 9, 12, 5, 6, 3, 0, 14 },
+          { 11, 8, 12, 7, 1, 14, 2, 13, 6, 15, 0, 9, 10, 4, 5, 3 } },
+        { { 12, 1, 10, 15, 9, 2, 6, 8, 0, 13, 3, 4, 14, 7, 5, 11 },
+          { 10, 15, 4, 2, 7, 12, 9, 5, 6, 1, 13, 14, 0, 11, 3, 8 },
+          { 9, 14, 15, 5, 2, 8, 12, 3, 7, 0, 4, 10, 1, 13, 11, 6 },
+          { 4, 3, 2, 12, 9, 5, 15, 10, 11, 14, 1, 7, 6, 0, 8, 13 } },
+        { { 4, 11, 2, 14, 15, 0, 8, 13, 3, 12, 9, 7, 5, 10, 6, 1 },
+          { 13, 0, 11, 7, 4, 9, 1, 10, 14, 3, 5, 12, 2, 15, 8, 6 },
+          { 1, 4, 11, 13, 12, 3, 7, 14, 10, 15, 6, 8, 0, 5, 9, 2 },
+          { 6, 11, 13, 8, 1, 4, 10, 7, 9, 5, 0, 15, 14, 2, 3, 12 } },
+        { { 13, 2, 8, 4, 6, 15, 11, 1, 10, 9, 3, 14, 5, 0, 12, 7 },
+          { 1, 15, 13, 8, 10, 3, 7, 4, 12, 5, 6, 11, 0, 14, 9, 2 },
+          { 7, 11, 4, 1, 9, 12, 14, 2, 0, 6, 10, 13, 15, 3, 5, 8 },
+          { 2, 1, 14, 7, 4, 10, 8, 13, 15, 12, 9, 0, 3, 5, 6, 11 } }
+    };
+
+    static std::string hex2bin(const std::string& s) {
+        std::unordered_map<char, std::string> hex_to_bin = {
+            {'0',"0000"}, {'1',"0001"}, {'2',"0010"}, {'3',"0011"},
+            {'4',"0100"}, {'5',"0101"}, {'6',"0110"}, {'7',"0111"},
+            {'8',"1000"}, {'9',"1001"}, {'A',"1010"}, {'B',"1011"},
+            {'C',"1100"}, {'D',"1101"}, {'E',"1110"}, {'F',"1111"}
+        };
+        std::string bin = "";
+        for (char c : s) {
+            bin += hex_to_bin[static_cast<char>(std::toupper(c))];
+        }
+        return bin;
+    }
+
+    static std::string bin2hex(const std::string& s) {
+        std::unordered_map<std::string, char> bin_to_hex = {
+            {"0000",'0'}, {"0001",'1'}, {"0010",'2'}, {"0011",'3'},
+            {"0100",'4'}, {"0101",'5'}, {"0110",'6'}, {"0111",'7'},
+            {"1000",'8'}, {"1001",'9'}, {"1010",'A'}, {"1011",'B'},
+            {"1100",'C'}, {"1101",'D'}, {"1110",'E'}, {"1111",'F'}
+        };
+        std::string hex = "";
+        for (size_t i = 0; i < s.length(); i += 4) {
+            hex += bin_to_hex[s.substr(i, 4)];
+        }
+        return hex;
+    }
+
+    static std::string permute(const std::string& k, const int* arr, int n) {
+        std::string result = "";
+        for (int i = 0; i < n; i++) {
+            result += k[arr[i] - 1];
+        }
+        return result;
+    }
+
+    static std::string shift_left(const std::string& k, int shifts) {
+        return k.substr(shifts) + k.substr(0, shifts);
+    }
+
+    static std::string xor_(const std::string& a, const std::string& b) {
+        std::string result = "";
+        for (size_t i = 0; i < a.size(); i++) {
+            result += (a[i] == b[i]) ? '0' : '1';
+        }
+        return result;
+    }
+
+    static std::string encrypt(const std::string& pt_hex, const std::vector<std::string>& rkb) {
+        std::string pt = permute(hex2bin(pt_hex), initial_perm, 64);
+        std::string left = pt.substr(0, 32);
+        std::string right = pt.substr(32, 32);
+        for (int round = 0; round < 16; round++) {
+            std::string x = xor_(rkb[round], permute(right, exp_d, 48));
+            std::string op = "";
+            for (int i = 0; i < 8; i++) {
+                int row = 2 * (x[i * 6] - '0') + (x[i * 6 + 5] - '0');
+                int col = 8 * (x[i * 6 + 1] - '0') + 4 * (x[i * 6 + 2] - '0') +
+                          2 * (x[i * 6 + 3] - '0') + (x[i * 6 + 4] - '0');
+                int val = sbox[i][row][col];
+                op += static_cast<char>('0' + val / 8);
+                op += static_cast<char>('0' + val / 4 % 2);
+                op += static_cast<char>('0' + val / 2 % 2);
+                op += static_cast<char>('0' + val % 2);
+            }
+            left = xor_(permute(op, per, 32), left);
+            if (round != 15) {
+                std::swap(left, right);
+            }
+        }
+        return bin2hex(permute(left + right, final_perm, 64));
+    }
+
+    static std::string byte_array_to_string(const uint8_t array[8]) {
+        std::stringstream ss;
+        for (int i = 0; i < 8; i++) {
+            ss << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(array[i]);
+        }
+        return ss.str();
+    }
+
+    static void string_to_byte_array(const std::string& s, uint8_t array[8]) {
+        for (int i = 0; i < 8 && i * 2 < static_cast<int>(s.length()); i++) {
+            array[i] = static_cast<uint8_t>(std::stoul(s.substr(i * 2, 2), nullptr, 16));
+        }
+    }
+};
@@ -0,0 +1,588 @@
+/*
+ * trunk-decoder - end-to-end load generator
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Replays .p25 calls into a running node and reports what it sustained:
+ *
+ *   decode       multipart POST of each call to /api/v1/decode
+ *   call-upload  the same upload to the API input plugin's /api/call-upload
+ *   udp          P25C packets carrying TSBKs to P25_TSBK_UDP_Input
+ *
+ * Load is open-loop: request k is due at start + k / rate whether or not
+ * earlier ones have finished, and latency is measured from when it was
+ * due, so a node that falls behind shows it in the percentiles instead of
+ * quietly slowing the generator down. --rate 0 runs closed-loop, each
+ * connection sending as soon as its previous request completes.
+ *
+ * --sweep START,STEP,MAX repeats the run at increasing rates and stops at
+ * the first step the node cannot hold (errors above --max-errors, under
+ * 95% of the target rate answered, or p99 over --max-p99-ms); the last
+ * step it held is reported as the saturation point.
+ *
+ * Usage: trunk-decoder-load [options] FILE_OR_DIR...
+ *   --mode decode|call-upload|udp   (default decode)
+ *   --target http://HOST:PORT       API base URL (default http://127.0.0.1:3000)
+ *   --udp HOST:PORT                 UDP input (default 127.0.0.1:9999)
+ *   --rate N                        requests or packets per second (default 10)
+ *   --concurrency N                 connections / sending threads (default 4)
+ *   --duration S                    seconds per run (default 10)
+ *   --sweep START,STEP,MAX          find the saturation point
+ *   --max-errors F                  error share a sweep step may have (default 0.01)
+ *   --max-p99-ms MS                 p99 latency a sweep step may have (default 5000)
+ *   --token TOKEN                   Authorization: Bearer TOKEN
+ *   --stream NAME                   stream_name form field (default loadgen)
+ *   --json                          print the reports as JSON
+ */
+
+#include "latency_histogram.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::string mode = "decode";
+    std::string host = "127.0.0.1";
+    std::string port = "3000";
+    std::string udp_host = "127.0.0.1";
+    std::string udp_port = "9999";
+    double rate = 10.0;
+    int concurrency = 4;
+    double duration_s = 10.0;
+    double sweep_start = 0.0, sweep_step = 0.0, sweep_max = 0.0;
+    double max_errors = 0.01;
+    double max_p99_ms = 5000.0;
+    std::string token;
+    std::string stream = "loadgen";
+    bool json = false;
+    std::vector<std::string> inputs;
+};
+
+struct Report {
+    double target_rate;
+    double elapsed_s;
+    uint64_t sent = 0;
+    uint64_t ok = 0;
+    uint64_t rejected = 0;     // 429/503: admission control turned the job away
+    uint64_t failed = 0;       // other HTTP errors, connection and send failures
+    uint64_t bytes = 0;
+    LatencyHistogram::Summary latency{};
+
+    double achieved() const { return elapsed_s > 0 ? ok / elapsed_s : 0.0; }
+    // Requests answered one way or another, per second: whether the node kept up
+    double answered() const { return elapsed_s > 0 ? (ok + rejected + failed) / elapsed_s : 0.0; }
+    double error_rate() const { return sent ? double(rejected + failed) / sent : 0.0; }
+};
+
+// --- inputs -----------------------------------------------------------------
+
+struct Call {
+    std::string name;
+    std::string bytes;
+};
+
+std::vector<Call> load_calls(const std::vector<std::string>& inputs) {
+    std::vector<fs::path> paths;
+    for (const std::string& input : inputs) {
+        std::error_code ec;
+        if (fs::is_directory(input, ec)) {
+            for (const auto& entry : fs::recursive_directory_iterator(input, ec)) {
+                if (entry.is_regular_file() && entry.path().extension() == ".p25") {
+                    paths.push_back(entry.path());
+                }
+            }
+        } else {
+            paths.push_back(input);
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    std::vector<Call> calls;
+    for (const auto& path : paths) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            std::cerr << "[Load] Cannot read " << path << std::endl;
+            continue;
+        }
+        Call call;
+        call.name = path.filename().string();
+        call.bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        calls.push_back(std::move(call));
+    }
+    return calls;
+}
+
+// TSBK payloads (DUID 0x12 frames) from the calls, or made-up ones
+std::vector<std::string> tsbk_payloads(const std::vector<Call>& calls) {
+    std::vector<std::string> payloads;
+    for (const Call& call : calls) {
+        size_t pos = 0;
+        while (pos + 5 <= call.bytes.size()) {
+            uint8_t duid = call.bytes[pos];
+            size_t length = (uint8_t(call.bytes[pos + 3]) << 8) | uint8_t(call.bytes[pos + 4]);
+            if (pos + 5 + length > call.bytes.size()) {
+                break;
+            }
+            if (duid == 0x12 && length >= 8) {
+                payloads.push_back(call.bytes.substr(pos + 5, length));
+            }
+            pos += 5 + length;
+        }
+    }
+    if (payloads.empty()) {
+        uint32_t seed = 0x25c0ffee;
+        for (int i = 0; i < 256; i++) {
+            std::string tsbk(12, '\0');
+            tsbk[0] = static_cast<char>(i % 4 == 0 ? 0x00 : 0x3a);   // group voice grant / RFSS status
+            for (size_t j = 1; j < tsbk.size(); j++) {
+                seed = seed * 1103515245u + 12345u;
+                tsbk[j] = static_cast<char>(seed >> 16);
+            }
+            payloads.push_back(tsbk);
+        }
+    }
+    return payloads;
+}
+
+// --- HTTP -------------------------------------------------------------------
+
+std::string build_upload(const Options& options, const Call& call, int talkgroup) {
+    const std::string boundary = "----trunk-decoder-load-7d3f";
+    std::ostringstream metadata;
+    metadata << "{\"talkgroup\": " << talkgroup << ", \"short_name\": \"" << options.stream
+             << "\", \"start_time\": " << std::time(nullptr) << ", \"filename\": \"" << call.name << "\"}";
+
+    std::ostringstream body;
+    body << "--" << boundary << "\r\n"
+         << "Content-Disposition: form-data; name=\"metadata\"\r\n\r\n" << metadata.str() << "\r\n"
+         << "--" << boundary << "\r\n"
+         << "Content-Disposition: form-data; name=\"stream_name\"\r\n\r\n" << options.stream << "\r\n"
+         << "--" << boundary << "\r\n"
+         << "Content-Disposition: form-data; name=\"p25_file\"; filename=\"" << call.name << "\"\r\n"
+         << "Content-Type: application/octet-stream\r\n\r\n" << call.bytes << "\r\n"
+         << "--" << boundary << "--\r\n";
+    const std::string data = body.str();
+
+    std::ostringstream request;
+    request << "POST " << (options.mode == "call-upload" ? "/api/call-upload" : "/api/v1/decode") << " HTTP/1.1\r\n"
+            << "Host: " << options.host << ":" << options.port << "\r\n"
+            << "User-Agent: trunk-decoder-load\r\n"
+            << "Content-Type: multipart/form-data; boundary=" << boundary << "\r\n"
+            << "Content-Length: " << data.size() << "\r\n";
+    if (!options.token.empty()) {
+        request << "Authorization: Bearer " << options.token << "\r\n";
+    }
+    request << "\r\n" << data;
+    return request.str();
+}
+
+int connect_to(const std::string& host, const std::string& port, int socktype) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd >= 0 && socktype == SOCK_STREAM) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct timeval timeout = {30, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    return fd;
+}
+
+bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// Read one response; returns the status code (0 on failure) and whether
+// the server kept the connection open
+int read_response(int fd, bool& keep_alive) {
+    std::string response;
+    char buffer[4096];
+    size_t header_end;
+    while ((header_end = response.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || response.size() > 65536) {
+            return 0;
+        }
+        response.append(buffer, n);
+    }
+    if (response.compare(0, 5, "HTTP/") != 0) {
+        return 0;
+    }
+    int status = std::atoi(response.c_str() + response.find(' ') + 1);
+
+    std::string headers = response.substr(0, header_end);
+    std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+    keep_alive = headers.find("connection: close") == std::string::npos;
+    size_t length_at = headers.find("content-length:");
+    if (length_at == std::string::npos) {
+        keep_alive = false;   // body runs to EOF
+        return status;
+    }
+    size_t remaining = std::strtoul(headers.c_str() + length_at + 15, nullptr, 10);
+    size_t have = response.size() - header_end - 4;
+    while (have < remaining) {
+        ssize_t n = recv(fd, buffer, std::min(sizeof(buffer), remaining - have), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            keep_alive = false;
+            return status;
+        }
+        have += n;
+    }
+    return status;
+}
+
+// --- runs -------------------------------------------------------------------
+
+struct Counters {
+    std::atomic<uint64_t> next{0};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> ok{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> bytes{0};
+    LatencyHistogram latency;
+};
+
+// Claim the next request index and wait until it is due; false once the run is over
+bool next_slot(Counters& counters, double rate, Clock::time_point start, Clock::time_point end,
+               Clock::time_point& due) {
+    uint64_t k = counters.next.fetch_add(1);
+    due = rate > 0 ? start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(k / rate))
+                   : Clock::now();
+    if (due >= end) {
+        return false;
+    }
+    std::this_thread::sleep_until(due);
+    return true;
+}
+
+void http_worker(const Options& options, const std::vector<std::string>& requests, double rate,
+                 Clock::time_point start, Clock::time_point end, Counters& counters) {
+    int fd = -1;
+    Clock::time_point due;
+    while (next_slot(counters, rate, start, end, due)) {
+        const std::string& request = requests[counters.sent.fetch_add(1) % requests.size()];
+        if (fd < 0) {
+            fd = connect_to(options.host, options.port, SOCK_STREAM);
+        }
+        bool keep_alive = false;
+        int status = 0;
+        if (fd >= 0 && send_all(fd, request)) {
+            status = read_response(fd, keep_alive);
+        }
+        if (status >= 200 && status < 300) {
+            counters.ok++;
+            counters.bytes += request.size();
+            counters.latency.record(Clock::now() - due);
+        } else if (status == 429 || status == 503) {
+            counters.rejected++;
+        } else {
+            counters.failed++;
+        }
+        if (!keep_alive && fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Same wire layout P25_TSBK_UDP_Input parses (host byte order, packed)
+std::string p25c_packet(const std::string& payload, uint32_t sequence) {
+    std::string packet(44 + payload.size(), '\0');
+    char* p = &packet[0];
+    uint32_t magic = 0x50323543, version = 1, system_id = 0x293, site_id = 1, sample_rate = 0;
+    uint64_t timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    double frequency = 851.0125e6;
+    uint16_t length = static_cast<uint16_t>(payload.size()), checksum = 0;
+    for (char c : payload) {
+        checksum ^= static_cast<uint8_t>(c);
+    }
+    memcpy(p, &magic, 4);
+    memcpy(p + 4, &version, 4);
+    memcpy(p + 8, &timestamp_us, 8);
+    memcpy(p + 16, &sequence, 4);
+    memcpy(p + 20, &system_id, 4);
+    memcpy(p + 24, &site_id, 4);
+    memcpy(p + 28, &frequency, 8);
+    memcpy(p + 36, &sample_rate, 4);
+    memcpy(p + 40, &length, 2);
+    memcpy(p + 42, &checksum, 2);
+    memcpy(p + 44, payload.data(), payload.size());
+    return packet;
+}
+
+void udp_worker(const Options& options, const std::vector<std::string>& payloads, double rate,
+                Clock::time_point start, Clock::time_point end, Counters& counters) {
+    int fd = connect_to(options.udp_host, options.udp_port, SOCK_DGRAM);
+    uint32_t sequence = 1;
+    Clock::time_point due;
+    while (next_slot(counters, rate, start, end, due)) {
+        const std::string& payload = payloads[counters.sent.fetch_add(1) % payloads.size()];
+        std::string packet = p25c_packet(payload, sequence++);
+        ssize_t n = fd >= 0 ? send(fd, packet.data(), packet.size(), 0) : -1;
+        if (n == static_cast<ssize_t>(packet.size())) {
+            counters.ok++;
+            counters.bytes += packet.size();
+            counters.latency.record(Clock::now() - due);
+        } else {
+            counters.failed++;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+Report run(const Options& options, const std::vector<std::string>& work, double rate) {
+    Counters counters;
+    int threads = std::max(1, options.concurrency);
+    Clock::time_point start = Clock::now() + std::chrono::milliseconds(50);
+    Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.duration_s));
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        if (options.mode == "udp") {
+            workers.emplace_back(udp_worker, std::cref(options), std::cref(work), rate, start, end, std::ref(counters));
+        } else {
+            workers.emplace_back(http_worker, std::cref(options), std::cref(work), rate, start, end, std::ref(counters));
+        }
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    Report report;
+    report.target_rate = rate;
+    report.elapsed_s = std::chrono::duration<double>(std::max(end, Clock::now()) - start).count();
+    report.sent = counters.sent;
+    report.ok = counters.ok;
+    report.rejected = counters.rejected;
+    report.failed = counters.failed;
+    report.bytes = counters.bytes;
+    report.latency = counters.latency.summary();
+    return report;
+}
+
+void print_report(const Options& options, const Report& r) {
+    if (options.json) {
+        std::cout << std::fixed << std::setprecision(2)
+                  << "{\"mode\": \"" << options.mode << "\", \"target_rate\": " << r.target_rate
+                  << ", \"achieved_rate\": " << r.achieved() << ", \"sent\": " << r.sent
+                  << ", \"ok\": " << r.ok << ", \"rejected\": " << r.rejected << ", \"failed\": " << r.failed
+                  << ", \"error_rate\": " << std::setprecision(4) << r.error_rate() << std::setprecision(2)
+                  << ", \"mbytes_per_sec\": " << r.bytes / r.elapsed_s / 1e6
+                  << ", \"latency_ms\": {\"mean\": " << r.latency.mean_ms << ", \"p50\": " << r.latency.p50_ms
+                  << ", \"p95\": " << r.latency.p95_ms << ", \"p99\": " << r.latency.p99_ms
+                  << ", \"max\": " << r.latency.max_ms << "}}" << std::endl;
+        return;
+    }
+    std::cout << std::fixed << std::setprecision(1)
+              << "rate " << std::setw(8) << (r.target_rate > 0 ? r.target_rate : 0.0) << "/s"
+              << "  achieved " << std::setw(8) << r.achieved() << "/s"
+              << "  sent " << r.sent << "  ok " << r.ok << "  rejected " << r.rejected << "  failed " << r.failed
+              << "  errors " << std::setprecision(2) << 100.0 * r.error_rate() << "%"
+              << "  latency ms p50 " << r.latency.p50_ms << " p95 " << r.latency.p95_ms
+              << " p99 " << r.latency.p99_ms << " max " << r.latency.max_ms << std::endl;
+}
+
+bool holds(const Options& options, const Report& r) {
+    return r.error_rate() <= options.max_errors && r.answered() >= 0.95 * r.target_rate &&
+           r.latency.p99_ms <= options.max_p99_ms;
+}
+
+bool split_host_port(const std::string& value, std::string& host, std::string& port) {
+    size_t colon = value.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == value.size()) {
+        return false;
+    }
+    host = value.substr(0, colon);
+    port = value.substr(colon + 1);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    return true;
+}
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--mode decode|call-upload|udp] [--target http://HOST:PORT]\n"
+              << "       [--udp HOST:PORT] [--rate N] [--concurrency N] [--duration S]\n"
+              << "       [--sweep START,STEP,MAX] [--max-errors F] [--max-p99-ms MS]\n"
+              << "       [--token TOKEN] [--stream NAME] [--json] FILE_OR_DIR..." << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--mode" && has_value) {
+            options.mode = argv[++i];
+        } else if (arg == "--target" && has_value) {
+            std::string target = argv[++i];
+            if (target.compare(0, 7, "http://") == 0) {
+                target = target.substr(7);
+            }
+            target = target.substr(0, target.find('/'));
+            if (!split_host_port(target, options.host, options.port)) {
+                options.host = target;
+                options.port = "80";
+            }
+        } else if (arg == "--udp" && has_value) {
+            if (!split_host_port(argv[++i], options.udp_host, options.udp_port)) {
+                std::cerr << "Error: --udp takes HOST:PORT" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--rate" && has_value) {
+            options.rate = std::atof(argv[++i]);
+        } else if (arg == "--concurrency" && has_value) {
+            options.concurrency = std::atoi(argv[++i]);
+        } else if (arg == "--duration" && has_value) {
+            options.duration_s = std::atof(argv[++i]);
+        } else if (arg == "--sweep" && has_value) {
+            if (std::sscanf(argv[++i], "%lf,%lf,%lf", &options.sweep_start, &options.sweep_step, &options.sweep_max) != 3 ||
+                options.sweep_start <= 0 || options.sweep_step <= 0) {
+                std::cerr << "Error: --sweep takes START,STEP,MAX" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--max-errors" && has_value) {
+            options.max_errors = std::atof(argv[++i]);
+        } else if (arg == "--max-p99-ms" && has_value) {
+            options.max_p99_ms = std::atof(argv[++i]);
+        } else if (arg == "--token" && has_value) {
+            options.token = argv[++i];
+        } else if (arg == "--stream" && has_value) {
+            options.stream = argv[++i];
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Error: Unknown option " << arg << std::endl;
+            usage(argv[0]);
+            return 1;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.mode != "decode" && options.mode != "call-upload" && options.mode != "udp") {
+        std::cerr << "Error: Unknown mode " << options.mode << std::endl;
+        return 1;
+    }
+
+    std::vector<Call> calls = load_calls(options.inputs);
+    std::vector<std::string> work;
+    if (options.mode == "udp") {
+        work = tsbk_payloads(calls);
+    } else {
+        if (calls.empty()) {
+            std::cerr << "Error: No .p25 calls to upload" << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+        // Requests are built up front so the generator's own cost stays flat
+        for (size_t i = 0; i < calls.size(); i++) {
+            work.push_back(build_upload(options, calls[i], 1000 + static_cast<int>(i % 50)));
+        }
+    }
+    if (!options.json) {
+        std::cerr << "[Load] " << options.mode << " to "
+                  << (options.mode == "udp" ? options.udp_host + ":" + options.udp_port
+                                            : options.host + ":" + options.port)
+                  << " with " << work.size() << (options.mode == "udp" ? " TSBK payloads" : " calls")
+                  << ", " << options.concurrency << " connections, " << options.duration_s << " s per run" << std::endl;
+    }
+
+    if (options.sweep_start <= 0) {
+        print_report(options, run(options, work, options.rate));
+        return 0;
+    }
+
+    double saturation = 0.0;
+    for (double rate = options.sweep_start; rate <= options.sweep_max + 1e-9; rate += options.sweep_step) {
+        Report report = run(options, work, rate);
+        print_report(options, report);
+        if (!holds(options, report)) {
+            break;
+        }
+        saturation = rate;
+    }
+    if (options.json) {
+        std::cout << "{\"saturation_rate\": " << saturation << "}" << std::endl;
+    } else if (saturation > 0) {
+        std::cout << "Saturation point: " << saturation << "/s (last rate held)" << std::endl;
+    } else {
+        std::cout << "Saturation point: below " << options.sweep_start << "/s" << std::endl;
+    }
+    return 0;
+}
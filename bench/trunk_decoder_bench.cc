@@ -0,0 +1,609 @@
+/*
+ * trunk-decoder - decode pipeline microbenchmarks
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * google-benchmark suite for each hot stage of a decode, run over every
+ * .p25 call in a corpus directory (bench/corpus by default):
+ *
+ *   ImbeDeinterleave     LDU body bits -> 144-bit codewords (bit_vector path)
+ *   ImbeHeaderDecode     PN/Golay/Hamming FEC of one codeword
+ *   ImbeLduDecodePacked  whole-LDU FEC straight from packed bytes
+ *   ImbeVocoderDecode    imbe_vocoder::imbe_decode, one frame at a time
+ *   VoiceSynth/0,1       VoiceSynth::decode per LDU, fixed / float backend
+ *   DesKeystream         DES-OFB keystream for one superframe
+ *   DesKeystreamString   the same with the string-based DES it replaced
+ *   AesKeystream         AES-256 keystream for one superframe
+ *   ReadFrame            P25FrameParser::read_frame over a whole call
+ *   DecodeToAudio        P25Decoder::decode_to_audio of a whole call
+ *
+ * Every benchmark reports a "frames" rate counter, in IMBE frames (20 ms of
+ * audio each), so stages can be compared with each other and with real time.
+ *
+ * Usage: trunk-decoder-bench [--corpus DIR] [--regression [FILE]]
+ *                            [--write-corpus DIR] [google-benchmark flags]
+ *
+ *   --regression   print one JSON document with frames_per_sec and
+ *                  ns_per_frame per benchmark (to FILE, or stdout), the
+ *                  shared yardstick for comparing builds
+ *   --write-corpus regenerate the checked-in synthetic calls into DIR
+ *
+ * The checked-in corpus is synthetic: a speech-like test signal encoded
+ * with imbe_vocoder and FEC encoded into LDUs, once clean and once with
+ * channel bit errors. Drop real captures into the directory next to them
+ * and they are benchmarked too.
+ */
+
+#include "p25_frame_parser.h"
+#include "p25_decoder.h"
+#include "p25_des_decrypt.h"
+#include "p25_aes_decrypt.h"
+#include "p25_reed_solomon.h"
+#include "des_string_baseline.h"
+#include "voice_synth.h"
+#include "imbe_vocoder/imbe_vocoder.h"
+#include "op25_imbe_frame.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const int FRAME_SAMPLES = 160;
+const int LDU_BYTES = 216;
+const int CODEWORDS_PER_LDU = 9;
+
+struct Call {
+    std::string name;
+    std::vector<uint8_t> bytes;      // the .p25 file
+    size_t voice_frames = 0;         // IMBE codewords in it
+};
+
+struct Ldu {
+    uint8_t duid;
+    uint8_t body[LDU_BYTES];
+};
+
+struct Corpus {
+    std::vector<Call> calls;
+    std::vector<Ldu> ldus;
+    std::vector<bit_vector> ldu_bits;
+    std::vector<voice_codeword> codewords;
+    std::vector<imbe_ldu_params> params;
+};
+
+std::string corpus_dir = TRUNK_DECODER_BENCH_CORPUS;
+
+// --- synthetic corpus -------------------------------------------------------
+
+// Voiced glides with a syllable-rate envelope, fricative noise and pauses
+std::vector<int16_t> speech_like_signal(double seconds, uint32_t seed) {
+    std::vector<int16_t> pcm(static_cast<size_t>(seconds * 8000));
+    double phase = 0.0;
+    for (size_t n = 0; n < pcm.size(); n++) {
+        double t = n / 8000.0;
+        double syllable = std::fmod(t, 0.25) / 0.25;
+        int word = static_cast<int>(t / 1.5) % 4;
+        double x = 0.0;
+        if (word != 3) {
+            double f0 = 130.0 + 50.0 * std::sin(2 * M_PI * 0.9 * t) + 20.0 * syllable;
+            phase += 2 * M_PI * f0 / 8000.0;
+            for (int h = 1; f0 * h < 3600.0; h++) {
+                // Two broad formant-ish humps
+                double f = f0 * h;
+                double gain = std::exp(-std::pow((f - 600.0) / 400.0, 2)) +
+                              0.5 * std::exp(-std::pow((f - 1800.0) / 600.0, 2)) + 0.05;
+                x += gain * std::cos(h * phase);
+            }
+            x *= 3000.0 * std::sin(M_PI * syllable);
+            if (syllable > 0.8) {
+                seed = seed * 1103515245u + 12345u;
+                x += (static_cast<int>(seed >> 16 & 0x7fff) - 16384) * 0.15;
+            }
+        }
+        pcm[n] = static_cast<int16_t>(std::max(-32767.0, std::min(32767.0, x)));
+    }
+    return pcm;
+}
+
+void put_frame(std::vector<uint8_t>& out, uint8_t duid, const uint8_t* data, size_t size) {
+    const uint16_t nac = 0x293;
+    out.push_back(duid);
+    out.push_back(nac >> 8);
+    out.push_back(nac & 0xff);
+    out.push_back(size >> 8);
+    out.push_back(size & 0xff);
+    out.insert(out.end(), data, data + size);
+}
+
+// LDU2 encryption sync: MI, ALGID and KID as 16 hexbits, RS(24,16,9)
+// parity, and each hexbit sent as Hamming(10,6,3) in the low speed bits
+void put_encryption_sync(bit_vector& body, uint8_t algorithm_id, uint16_t key_id, const uint8_t* mi) {
+    uint8_t hexbits[24] = {0};
+    for (int i = 0, j = 0; i < 9; i += 3, j += 4) {
+        uint32_t bits = static_cast<uint32_t>(mi[i]) << 16 | static_cast<uint32_t>(mi[i + 1]) << 8 | mi[i + 2];
+        for (int k = 0; k < 4; k++) {
+            hexbits[j + k] = (bits >> (18 - 6 * k)) & 0x3F;
+        }
+    }
+    uint32_t bits = static_cast<uint32_t>(algorithm_id) << 16 | key_id;
+    for (int k = 0; k < 4; k++) {
+        hexbits[12 + k] = (bits >> (18 - 6 * k)) & 0x3F;
+    }
+    P25ReedSolomon::encode(hexbits, 24, 8);
+    const uint16_t* position = imbe_ldu_ls_data_bits;
+    for (int i = 0; i < 24; i++) {
+        uint32_t word = static_cast<uint32_t>(hexbits[i]) << 4 | hmg1063EncTbl[hexbits[i]];
+        for (int b = 9; b >= 0; b--) {
+            body[*position++] = (word >> b) & 1;
+        }
+    }
+}
+
+// Encode pcm into an HDU, alternating LDU1/LDU2 and a TDU, flipping each
+// channel bit of the voice codewords with probability ber. LDU2s carry a
+// clear encryption sync (ALGID 0x80), sent without errors.
+std::vector<uint8_t> synthetic_call(const std::vector<int16_t>& pcm, double ber, uint32_t seed) {
+    std::vector<uint8_t> out;
+    uint8_t hdu[99] = {0};
+    put_frame(out, 0x00, hdu, sizeof(hdu));
+
+    imbe_vocoder encoder;
+    size_t frames = pcm.size() / FRAME_SAMPLES / CODEWORDS_PER_LDU * CODEWORDS_PER_LDU;
+    uint32_t ber_threshold = static_cast<uint32_t>(ber * 4294967295.0);
+    for (size_t f = 0, ldu = 0; f < frames; f += CODEWORDS_PER_LDU, ldu++) {
+        bit_vector body(LDU_BYTES * 8, false);
+        for (int i = 0; i < CODEWORDS_PER_LDU; i++) {
+            int16_t frame_vector[8];
+            int16_t snd[FRAME_SAMPLES];
+            std::copy(pcm.begin() + (f + i) * FRAME_SAMPLES, pcm.begin() + (f + i + 1) * FRAME_SAMPLES, snd);
+            encoder.imbe_encode(frame_vector, snd);
+
+            voice_codeword cw(voice_codeword_sz);
+            imbe_header_encode(cw, static_cast<uint16_t>(frame_vector[0]), static_cast<uint16_t>(frame_vector[1]),
+                               static_cast<uint16_t>(frame_vector[2]), static_cast<uint16_t>(frame_vector[3]),
+                               static_cast<uint16_t>(frame_vector[4]), static_cast<uint16_t>(frame_vector[5]),
+                               static_cast<uint16_t>(frame_vector[6]), static_cast<uint16_t>(frame_vector[7]) << 1);
+            for (size_t j = 0; j < voice_codeword_sz; j++) {
+                seed = seed * 1664525u + 1013904223u;
+                if (ber_threshold && seed < ber_threshold) {
+                    cw[j] = !cw[j];
+                }
+            }
+            imbe_interleave(body, cw, i);
+        }
+        if (ldu % 2 == 1) {
+            const uint8_t clear_mi[9] = {0};
+            put_encryption_sync(body, 0x80, 0, clear_mi);
+        }
+        uint8_t bytes[LDU_BYTES] = {0};
+        for (size_t b = 0; b < body.size(); b++) {
+            if (body[b]) {
+                bytes[b >> 3] |= 0x80 >> (b & 7);
+            }
+        }
+        put_frame(out, ldu % 2 == 0 ? 0x05 : 0x0A, bytes, sizeof(bytes));
+    }
+    put_frame(out, 0x03, nullptr, 0);
+    return out;
+}
+
+std::vector<Call> synthetic_corpus() {
+    std::vector<int16_t> pcm = speech_like_signal(30.0, 0x25c0ffee);
+    std::vector<Call> calls(2);
+    calls[0].name = "synthetic_clean.p25";
+    calls[0].bytes = synthetic_call(pcm, 0.0, 1);
+    calls[1].name = "synthetic_ber2.p25";
+    calls[1].bytes = synthetic_call(pcm, 0.02, 2);
+    return calls;
+}
+
+// --- corpus loading ---------------------------------------------------------
+
+std::vector<Call> load_calls(const std::string& dir) {
+    std::vector<Call> calls;
+    std::error_code ec;
+    std::vector<fs::path> paths;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".p25") {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    for (const auto& path : paths) {
+        std::ifstream in(path, std::ios::binary);
+        Call call;
+        call.name = path.filename().string();
+        call.bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        calls.push_back(std::move(call));
+    }
+    return calls;
+}
+
+const Corpus& corpus() {
+    static const Corpus loaded = [] {
+        Corpus c;
+        c.calls = load_calls(corpus_dir);
+        if (c.calls.empty()) {
+            std::cerr << "[Bench] No .p25 files in " << corpus_dir << ", using the synthetic corpus" << std::endl;
+            c.calls = synthetic_corpus();
+        }
+        for (Call& call : c.calls) {
+            P25FrameParser parser;
+            parser.open_buffer(call.bytes.data(), call.bytes.size());
+            P25Frame frame;
+            while (parser.read_frame(frame)) {
+                if (!frame.is_voice_frame || frame.payload_size() < LDU_BYTES) {
+                    continue;
+                }
+                Ldu ldu;
+                ldu.duid = frame.duid;
+                std::memcpy(ldu.body, frame.payload(), LDU_BYTES);
+                c.ldus.push_back(ldu);
+                call.voice_frames += CODEWORDS_PER_LDU;
+            }
+        }
+        for (const Ldu& ldu : c.ldus) {
+            bit_vector bits(LDU_BYTES * 8);
+            for (size_t b = 0; b < bits.size(); b++) {
+                bits[b] = ldu.body[b >> 3] & (0x80 >> (b & 7));
+            }
+            for (int i = 0; i < CODEWORDS_PER_LDU; i++) {
+                voice_codeword cw(voice_codeword_sz);
+                imbe_deinterleave(bits, cw, i);
+                c.codewords.push_back(cw);
+            }
+            c.ldu_bits.push_back(std::move(bits));
+            imbe_ldu_params p;
+            imbe_ldu_decode_packed(ldu.body, LDU_BYTES, p);
+            c.params.push_back(p);
+        }
+        return c;
+    }();
+    return loaded;
+}
+
+void set_frames(benchmark::State& state, size_t frames) {
+    state.counters["frames"] = benchmark::Counter(static_cast<double>(frames), benchmark::Counter::kIsRate);
+}
+
+bool require_voice(benchmark::State& state) {
+    if (corpus().ldus.empty()) {
+        state.SkipWithError("corpus has no voice frames");
+        return false;
+    }
+    return true;
+}
+
+// --- stage benchmarks -------------------------------------------------------
+
+void BM_ImbeDeinterleave(benchmark::State& state) {
+    if (!require_voice(state)) return;
+    const Corpus& c = corpus();
+    voice_codeword cw(voice_codeword_sz);
+    size_t next = 0, frames = 0;
+    for (auto _ : state) {
+        const bit_vector& bits = c.ldu_bits[next];
+        for (int i = 0; i < CODEWORDS_PER_LDU; i++) {
+            imbe_deinterleave(bits, cw, i);
+            benchmark::DoNotOptimize(cw);
+        }
+        next = next + 1 == c.ldu_bits.size() ? 0 : next + 1;
+        frames += CODEWORDS_PER_LDU;
+    }
+    set_frames(state, frames);
+}
+BENCHMARK(BM_ImbeDeinterleave);
+
+void BM_ImbeHeaderDecode(benchmark::State& state) {
+    if (!require_voice(state)) return;
+    const Corpus& c = corpus();
+    size_t next = 0, frames = 0;
+    for (auto _ : state) {
+        uint32_t u[8], E0, ET;
+        imbe_header_decode(c.codewords[next], u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7], E0, ET);
+        benchmark::DoNotOptimize(u);
+        benchmark::DoNotOptimize(ET);
+        next = next + 1 == c.codewords.size() ? 0 : next + 1;
+        frames++;
+    }
+    set_frames(state, frames);
+}
+BENCHMARK(BM_ImbeHeaderDecode);
+
+void BM_ImbeLduDecodePacked(benchmark::State& state) {
+    if (!require_voice(state)) return;
+    const Corpus& c = corpus();
+    imbe_ldu_params p;
+    size_t next = 0, frames = 0;
+    for (auto _ : state) {
+        imbe_ldu_decode_packed(c.ldus[next].body, LDU_BYTES, p);
+        benchmark::DoNotOptimize(p);
+        next = next + 1 == c.ldus.size() ? 0 : next + 1;
+        frames += CODEWORDS_PER_LDU;
+    }
+    set_frames(state, frames);
+}
+BENCHMARK(BM_ImbeLduDecodePacked);
+
+void BM_ImbeVocoderDecode(benchmark::State& state) {
+    if (!require_voice(state)) return;
+    const Corpus& c = corpus();
+    imbe_vocoder vocoder;
+    int16_t snd[FRAME_SAMPLES];
+    size_t ldu = 0, codeword = 0, frames = 0;
+    for (auto _ : state) {
+        const uint32_t* u = c.params[ldu].u[codeword];
+        int16_t frame_vector[8];
+        for (int j = 0; j < 8; j++) {
+            frame_vector[j] = u[j];
+        }
+        frame_vector[7] >>= 1;
+        vocoder.imbe_decode(frame_vector, snd);
+        benchmark::DoNotOptimize(snd);
+        if (++codeword == CODEWORDS_PER_LDU) {
+            codeword = 0;
+            ldu = ldu + 1 == c.params.size() ? 0 : ldu + 1;
+        }
+        frames++;
+    }
+    set_frames(state, frames);
+}
+BENCHMARK(BM_ImbeVocoderDecode);
+
+void BM_VoiceSynth(benchmark::State& state) {
+    if (!require_voice(state)) return;
+    const Corpus& c = corpus();
+    auto synth = VoiceSynth::create(state.range(0) ? VoiceSynth::FLOAT : VoiceSynth::FIXED_POINT);
+    state.SetLabel(VoiceSynth::backend_name(synth->backend()));
+    int16_t pcm[CODEWORDS_PER_LDU * FRAME_SAMPLES];
+    size_t next = 0, frames = 0;
+    for (auto _ : state) {
+        const imbe_ldu_params& p = c.params[next];
+        synth->decode(p.u, p.E0, p.ET, CODEWORDS_PER_LDU, pcm);
+        benchmark::DoNotOptimize(pcm);
+        next = next + 1 == c.params.size() ? 0 : next + 1;
+        frames += CODEWORDS_PER_LDU;
+    }
+    set_frames(state, frames);
+}
+BENCHMARK(BM_VoiceSynth)->Arg(0)->Arg(1);
+
+// One prepare() generates the keystream for a whole superframe (LDU1 + LDU2)
+template <typename Decrypt>
+void keystream_benchmark(benchmark::State& state, size_t key_bytes) {
+    Decrypt decrypt;
+    std::vector<uint8_t> key(key_bytes);
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = static_cast<uint8_t>(0x11 * (i + 1));
+    }
+    decrypt.add_key(1, key);
+    uint8_t mi[9] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x00};
+    size_t frames = 0;
+    for (auto _ : state) {
+        mi[7]++;
+        benchmark::DoNotOptimize(decrypt.prepare(1, mi));
+        frames += 2 * CODEWORDS_PER_LDU;
+    }
+    set_frames(state, frames);
+}
+
+void BM_DesKeystream(benchmark::State& state) {
+    keystream_benchmark<P25DESDecrypt>(state, 8);
+}
+BENCHMARK(BM_DesKeystream);
+
+// Baseline for DesKeystream: the old path expanded the key on every
+// prepare() and ran each block through string DES. Both build the same
+// superframe mask, and that is checked before timing.
+void BM_DesKeystreamString(benchmark::State& state) {
+    const uint8_t key[8] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+    uint8_t mi[9] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x00};
+    StringDESKeystream baseline;
+    uint8_t mask[P25_SUPERFRAME_BYTES];
+
+    P25DESDecrypt decrypt;
+    decrypt.add_key(1, std::vector<uint8_t>(key, key + 8));
+    decrypt.prepare(1, mi);
+    uint8_t expected[P25_SUPERFRAME_BYTES] = {};
+    decrypt.decrypt_superframe(expected);
+    baseline.prepare(key, mi);
+    p25_build_superframe_mask(baseline.keystream, 8 + 11, mask);
+    if (std::memcmp(mask, expected, sizeof(mask)) != 0) {
+        state.SkipWithError("string DES keystream differs from P25DESDecrypt");
+        return;
+    }
+
+    size_t frames = 0;
+    for (auto _ : state) {
+        mi[7]++;
+        baseline.prepare(key, mi);
+        p25_build_superframe_mask(baseline.keystream, 8 + 11, mask);
+        benchmark::DoNotOptimize(mask);
+        frames += 2 * CODEWORDS_PER_LDU;
+    }
+    set_frames(state, frames);
+}
+BENCHMARK(BM_DesKeystreamString);
+
+void BM_AesKeystream(benchmark::State& state) {
+    keystream_benchmark<P25AESDecrypt>(state, 32);
+}
+BENCHMARK(BM_AesKeystream);
+
+void BM_ReadFrame(benchmark::State& state) {
+    const Corpus& c = corpus();
+    P25FrameParser parser;
+    P25Frame frame;
+    size_t next = 0, frames = 0;
+    for (auto _ : state) {
+        const Call& call = c.calls[next];
+        parser.open_buffer(call.bytes.data(), call.bytes.size());
+        while (parser.read_frame(frame)) {
+            benchmark::DoNotOptimize(frame.payload());
+        }
+        next = next + 1 == c.calls.size() ? 0 : next + 1;
+        frames += call.voice_frames;
+    }
+    set_frames(state, frames);
+}
+BENCHMARK(BM_ReadFrame);
+
+void BM_DecodeToAudio(benchmark::State& state) {
+    const Corpus& c = corpus();
+    fs::path dir = fs::temp_directory_path() / ("trunk-decoder-bench-" + std::to_string(getpid()));
+    fs::create_directories(dir);
+    P25Decoder decoder;
+    size_t next = 0, frames = 0;
+    for (auto _ : state) {
+        const Call& call = c.calls[next];
+        decoder.reset();
+        decoder.open_p25_buffer(call.bytes.data(), call.bytes.size(), call.name);
+        if (!decoder.decode_to_audio((dir / "call").string())) {
+            state.SkipWithError("decode_to_audio failed");
+            break;
+        }
+        next = next + 1 == c.calls.size() ? 0 : next + 1;
+        frames += call.voice_frames;
+    }
+    set_frames(state, frames);
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+}
+BENCHMARK(BM_DecodeToAudio)->Unit(benchmark::kMillisecond);
+
+// --- regression report ------------------------------------------------------
+
+// Collects each benchmark's frame rate and writes one JSON document at the end
+class RegressionReporter : public benchmark::BenchmarkReporter {
+public:
+    explicit RegressionReporter(std::ostream& out) : out_(out) {}
+
+    bool ReportContext(const Context&) override { return true; }
+
+    void ReportRuns(const std::vector<Run>& runs) override {
+        for (const Run& run : runs) {
+            if (run.run_type != Run::RT_Iteration || run.error_occurred) {
+                continue;
+            }
+            auto frames = run.counters.find("frames");
+            if (frames == run.counters.end() || frames->second.value <= 0.0) {
+                continue;
+            }
+            std::ostringstream entry;
+            entry.setf(std::ios::fixed);
+            entry.precision(1);
+            entry << "    {\"name\": \"" << run.benchmark_name() << "\", "
+                  << "\"frames_per_sec\": " << frames->second.value << ", "
+                  << "\"ns_per_frame\": " << 1e9 / frames->second.value << "}";
+            entries_.push_back(entry.str());
+        }
+    }
+
+    void Finalize() override {
+        const Corpus& c = corpus();
+        size_t voice_frames = 0;
+        for (const Call& call : c.calls) {
+            voice_frames += call.voice_frames;
+        }
+        out_ << "{\n"
+             << "  \"corpus\": {\"calls\": " << c.calls.size() << ", \"voice_frames\": " << voice_frames << "},\n"
+             << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < entries_.size(); i++) {
+            out_ << entries_[i] << (i + 1 < entries_.size() ? ",\n" : "\n");
+        }
+        out_ << "  ]\n}" << std::endl;
+    }
+
+private:
+    std::ostream& out_;
+    std::vector<std::string> entries_;
+};
+
+int write_corpus(const std::string& dir) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    for (const Call& call : synthetic_corpus()) {
+        std::string path = (fs::path(dir) / call.name).string();
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(call.bytes.data()), call.bytes.size());
+        if (!out) {
+            std::cerr << "Error: Cannot write " << path << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << path << " (" << call.bytes.size() << " bytes)" << std::endl;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bool regression = false;
+    std::string regression_file;
+    std::vector<char*> args;
+    args.push_back(argv[0]);
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--corpus" && i + 1 < argc) {
+            corpus_dir = argv[++i];
+        } else if (arg == "--write-corpus" && i + 1 < argc) {
+            return write_corpus(argv[++i]);
+        } else if (arg == "--regression") {
+            regression = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                regression_file = argv[++i];
+            }
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    int bench_argc = static_cast<int>(args.size());
+    benchmark::Initialize(&bench_argc, args.data());
+    if (benchmark::ReportUnrecognizedArguments(bench_argc, args.data())) {
+        return 1;
+    }
+
+    if (!regression) {
+        benchmark::RunSpecifiedBenchmarks();
+        benchmark::Shutdown();
+        return 0;
+    }
+
+    // Keep the JSON clean: anything the decoders print goes to stderr meanwhile
+    std::ofstream file;
+    if (!regression_file.empty()) {
+        file.open(regression_file);
+        if (!file) {
+            std::cerr << "Error: Cannot write " << regression_file << std::endl;
+            return 1;
+        }
+    }
+    std::cout.flush();
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    std::ostringstream report;
+    RegressionReporter reporter(report);
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    std::cout.flush();
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    (file.is_open() ? static_cast<std::ostream&>(file) : std::cout) << report.str();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * trunk-decoder - IMBE vocoder backend benchmark
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Compares the VoiceSynth backends on the same codewords:
+ *
+ * - throughput: IMBE frames/sec through VoiceSynth::decode, one LDU (nine
+ *   frames) per call as P25Decoder does
+ * - quality: a synthetic test signal (voiced harmonic sweeps, noise bursts,
+ *   silence) is encoded with imbe_vocoder::imbe_encode, decoded by each
+ *   backend, aligned for the codec delay and scored by log-spectral
+ *   distance against the original, in dB (lower is better)
+ *
+ * Usage: vocoder-backend-bench [seconds_of_audio]
+ */
+
+#include "voice_synth.h"
+#include "imbe_vocoder/imbe_vocoder.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const int FRAME_SAMPLES = 160;
+const int LDU_FRAMES = 9;
+
+struct Codeword {
+    uint32_t u[8];
+};
+
+std::vector<int16_t> test_signal(size_t frames) {
+    std::vector<int16_t> pcm(frames * FRAME_SAMPLES);
+    uint32_t seed = 0x25c0ffee;
+    double phase = 0.0;
+    for (size_t n = 0; n < pcm.size(); n++) {
+        double t = n / 8000.0;
+        int segment = static_cast<int>(t / 0.5) % 4;
+        double x = 0.0;
+        if (segment < 2) {
+            // Voiced: a pitch gliding between 100 and 220 Hz, falling harmonics
+            double f0 = 160.0 + 60.0 * std::sin(2 * M_PI * 0.7 * t);
+            phase += 2 * M_PI * f0 / 8000.0;
+            for (int h = 1; f0 * h < 3600.0; h++) {
+                x += std::cos(h * phase) / h;
+            }
+            x *= 4000.0;
+        } else if (segment == 2) {
+            seed = seed * 1103515245u + 12345u;
+            x = (static_cast<int>(seed >> 16 & 0x7fff) - 16384) * 0.25;
+        }
+        pcm[n] = static_cast<int16_t>(std::max(-32767.0, std::min(32767.0, x)));
+    }
+    return pcm;
+}
+
+std::vector<Codeword> encode(const std::vector<int16_t>& pcm) {
+    imbe_vocoder encoder;
+    std::vector<Codeword> codewords(pcm.size() / FRAME_SAMPLES);
+    for (size_t i = 0; i < codewords.size(); i++) {
+        int16_t frame_vector[8];
+        int16_t snd[FRAME_SAMPLES];
+        std::copy(pcm.begin() + i * FRAME_SAMPLES, pcm.begin() + (i + 1) * FRAME_SAMPLES, snd);
+        encoder.imbe_encode(frame_vector, snd);
+        for (int j = 0; j < 8; j++) {
+            codewords[i].u[j] = static_cast<uint16_t>(frame_vector[j]);
+        }
+        // VoiceSynth takes u7 as the FEC decode leaves it
+        codewords[i].u[7] <<= 1;
+    }
+    return codewords;
+}
+
+std::vector<int16_t> decode(VoiceSynth& synth, const std::vector<Codeword>& codewords) {
+    std::vector<int16_t> out(codewords.size() * FRAME_SAMPLES);
+    uint32_t u[LDU_FRAMES][8], E0[LDU_FRAMES] = {0}, ET[LDU_FRAMES] = {0};
+    for (size_t i = 0; i + LDU_FRAMES <= codewords.size(); i += LDU_FRAMES) {
+        for (int k = 0; k < LDU_FRAMES; k++) {
+            std::copy(codewords[i + k].u, codewords[i + k].u + 8, u[k]);
+        }
+        synth.decode(u, E0, ET, LDU_FRAMES, &out[i * FRAME_SAMPLES]);
+    }
+    return out;
+}
+
+double frames_per_second(VoiceSynth::Backend backend, const std::vector<Codeword>& codewords, int passes) {
+    auto synth = VoiceSynth::create(backend);
+    volatile int64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++) {
+        std::vector<int16_t> out = decode(*synth, codewords);
+        sink = sink + out[out.size() / 2];
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return (codewords.size() / LDU_FRAMES * LDU_FRAMES) * passes / elapsed.count();
+}
+
+// 256-point power spectrum of a Hann-windowed frame, bins 0..128
+void power_spectrum(const int16_t* x, double* power) {
+    const int N = 256;
+    std::vector<double> re(N, 0.0), im(N, 0.0);
+    for (int n = 0; n < FRAME_SAMPLES; n++) {
+        re[n] = x[n] * (0.5 - 0.5 * std::cos(2 * M_PI * n / (FRAME_SAMPLES - 1)));
+    }
+    for (int i = 1, j = 0; i < N; i++) {
+        int bit = N >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    for (int len = 2; len <= N; len <<= 1) {
+        for (int i = 0; i < N; i += len) {
+            for (int k = 0; k < len / 2; k++) {
+                double wr = std::cos(-2 * M_PI * k / len), wi = std::sin(-2 * M_PI * k / len);
+                double tr = re[i + k + len / 2] * wr - im[i + k + len / 2] * wi;
+                double ti = re[i + k + len / 2] * wi + im[i + k + len / 2] * wr;
+                re[i + k + len / 2] = re[i + k] - tr;
+                im[i + k + len / 2] = im[i + k] - ti;
+                re[i + k] += tr;
+                im[i + k] += ti;
+            }
+        }
+    }
+    for (int k = 0; k <= N / 2; k++) {
+        power[k] = re[k] * re[k] + im[k] * im[k];
+    }
+}
+
+// Mean log-spectral distance over frames where the reference is not
+// silent, with the decoded audio delayed by lag samples
+double log_spectral_distance(const std::vector<int16_t>& ref, const std::vector<int16_t>& out, int lag) {
+    double total = 0.0;
+    int frames = 0;
+    double pr[129], po[129];
+    for (size_t start = 0; start + lag + FRAME_SAMPLES <= out.size(); start += FRAME_SAMPLES) {
+        double energy = 0.0;
+        for (int n = 0; n < FRAME_SAMPLES; n++) {
+            energy += double(ref[start + n]) * ref[start + n];
+        }
+        if (energy / FRAME_SAMPLES < 100.0 * 100.0) {
+            continue;
+        }
+        power_spectrum(&ref[start], pr);
+        power_spectrum(&out[start + lag], po);
+        double sum = 0.0;
+        for (int k = 1; k < 128; k++) {
+            double d = 10.0 * std::log10((pr[k] + 1e3) / (po[k] + 1e3));
+            sum += d * d;
+        }
+        total += std::sqrt(sum / 127);
+        frames++;
+    }
+    return frames ? total / frames : 0.0;
+}
+
+// Codec delay: synthesis phases are not the original's, so align on the
+// spectra rather than the waveform
+int best_lag(const std::vector<int16_t>& ref, const std::vector<int16_t>& out, double& distance) {
+    int best = 0;
+    distance = 1e300;
+    for (int lag = 0; lag <= 8 * FRAME_SAMPLES; lag += 8) {
+        double d = log_spectral_distance(ref, out, lag);
+        if (d < distance) {
+            distance = d;
+            best = lag;
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    double seconds = 20.0;
+    if (argc > 1) seconds = std::atof(argv[1]);
+    size_t frames = static_cast<size_t>(seconds * 50) / LDU_FRAMES * LDU_FRAMES;
+    if (frames < LDU_FRAMES) frames = LDU_FRAMES;
+
+    std::vector<int16_t> pcm = test_signal(frames);
+    std::vector<Codeword> codewords = encode(pcm);
+
+    const VoiceSynth::Backend backends[] = {VoiceSynth::FIXED_POINT, VoiceSynth::FLOAT};
+    std::cout << "backend   frames/sec  realtime_x  lag  lsd_db" << std::endl;
+    for (VoiceSynth::Backend backend : backends) {
+        double fps = frames_per_second(backend, codewords, 3);
+        auto synth = VoiceSynth::create(backend);
+        std::vector<int16_t> out = decode(*synth, codewords);
+        double lsd;
+        int lag = best_lag(pcm, out, lsd);
+        // One IMBE frame is 20 ms of audio
+        std::cout << std::left << std::setw(8) << VoiceSynth::backend_name(backend) << std::right
+                  << std::setw(12) << static_cast<uint64_t>(fps)
+                  << std::setw(12) << std::fixed << std::setprecision(1) << fps * 0.020
+                  << std::setw(5) << lag
+                  << std::setw(8) << std::setprecision(2) << lsd << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * trunk-decoder - IMBE vocoder thread scaling benchmark
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Decodes a fixed set of synthetic LDU codewords on 1..N threads, each
+ * thread owning its own imbe_vocoder (as JobManager workers do), and
+ * reports aggregate IMBE frames/sec and scaling relative to one thread.
+ *
+ * Usage: vocoder-thread-bench [max_threads] [frames_per_thread]
+ */
+
+#include "imbe_vocoder/imbe_vocoder.h"
+#include "op25_imbe_frame.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct FrameVector {
+    int16_t v[8];
+};
+
+std::vector<FrameVector> build_frames(size_t count) {
+    std::vector<FrameVector> frames;
+    frames.reserve(count);
+
+    // Deterministic pseudo-random LDU bodies run through the real header decode
+    uint32_t seed = 0x25c0ffee;
+    uint8_t ldu[216];
+    while (frames.size() < count) {
+        for (auto& b : ldu) {
+            seed = seed * 1103515245u + 12345u;
+            b = static_cast<uint8_t>(seed >> 16);
+        }
+        for (uint32_t i = 0; i < nof_voice_codewords && frames.size() < count; i++) {
+            uint32_t u[8], E0, ET;
+            if (!imbe_header_decode_packed(ldu, sizeof(ldu), i,
+                                           u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7], E0, ET)) {
+                continue;
+            }
+            FrameVector fv;
+            for (int j = 0; j < 8; j++) {
+                fv.v[j] = static_cast<int16_t>(u[j]);
+            }
+            fv.v[7] >>= 1;
+            frames.push_back(fv);
+        }
+    }
+    return frames;
+}
+
+double run(unsigned threads, const std::vector<FrameVector>& frames) {
+    std::atomic<bool> go{false};
+    std::atomic<int64_t> sink{0};
+    std::vector<std::thread> workers;
+
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            imbe_vocoder vocoder;
+            int16_t snd[160];
+            int64_t acc = 0;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (const auto& fv : frames) {
+                int16_t frame_vector[8];
+                std::copy(fv.v, fv.v + 8, frame_vector);
+                vocoder.imbe_decode(frame_vector, snd);
+                acc += snd[0];
+            }
+            sink += acc;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& w : workers) {
+        w.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return static_cast<double>(frames.size()) * threads / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    unsigned max_threads = std::thread::hardware_concurrency();
+    size_t frames_per_thread = 20000;
+    if (argc > 1) max_threads = static_cast<unsigned>(std::atoi(argv[1]));
+    if (argc > 2) frames_per_thread = static_cast<size_t>(std::atoll(argv[2]));
+    if (max_threads == 0) max_threads = 1;
+
+    auto frames = build_frames(frames_per_thread);
+
+    std::cout << "threads  frames/sec  realtime_x  scaling" << std::endl;
+    std::vector<unsigned> counts;
+    for (unsigned t = 1; t < max_threads; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(max_threads);
+
+    double single = 0.0;
+    for (unsigned t : counts) {
+        double fps = run(t, frames);
+        if (t == 1) single = fps;
+        // One IMBE frame is 20 ms of audio
+        std::cout << std::setw(7) << t
+                  << std::setw(12) << static_cast<uint64_t>(fps)
+                  << std::setw(12) << std::fixed << std::setprecision(1) << fps * 0.020
+                  << std::setw(9) << std::setprecision(2) << fps / single << std::endl;
+    }
+    return 0;
+}
@@ -25,8 +25,8 @@
  | $Id $
  |___________________________________________________________________________|
 */
-extern Flag Overflow;
-extern Flag Carry;
+extern thread_local Flag Overflow;
+extern thread_local Flag Carry;
 
 #define MAX_32 (Word32)0x7fffffffL
 #define MIN_32 (Word32)0x80000000L
@@ -40,6 +40,8 @@ extern Flag Carry;
  |___________________________________________________________________________|
 */
 
+#if defined(IMBE_BASICOP_REFERENCE) || (WMOPS)
+
 Word16 add (Word16 var1, Word16 var2);    /* Short add,           1   */
 Word16 sub (Word16 var1, Word16 var2);    /* Short sub,           1   */
 Word16 abs_s (Word16 var1);               /* Short abs,           1   */
@@ -53,14 +55,8 @@ Word16 extract_l (Word32 L_var1);         /* Extract low,         1   */
 Word16 round (Word32 L_var1);             /* Round,               1   */
 Word32 L_mac (Word32 L_var3, Word16 var1, Word16 var2);   /* Mac,  1  */
 Word32 L_msu (Word32 L_var3, Word16 var1, Word16 var2);   /* Msu,  1  */
-Word32 L_macNs (Word32 L_var3, Word16 var1, Word16 var2); /* Mac without
-                                                             sat, 1   */
-Word32 L_msuNs (Word32 L_var3, Word16 var1, Word16 var2); /* Msu without
-                                                             sat, 1   */
 Word32 L_add (Word32 L_var1, Word32 L_var2);    /* Long add,        2 */
 Word32 L_sub (Word32 L_var1, Word32 L_var2);    /* Long sub,        2 */
-Word32 L_add_c (Word32 L_var1, Word32 L_var2);  /* Long add with c, 2 */
-Word32 L_sub_c (Word32 L_var1, Word32 L_var2);  /* Long sub with c, 2 */
 Word32 L_negate (Word32 L_var1);                /* Long negate,     2 */
 Word16 mult_r (Word16 var1, Word16 var2);       /* Mult with round, 2 */
 Word32 L_shl (Word32 L_var1, Word16 var2);      /* Long shift left, 2 */
@@ -77,9 +73,22 @@ Word32 L_deposit_l (Word16 var1);        /* 16 bit var1 -> LSB,     2 */
 Word32 L_shr_r (Word32 L_var1, Word16 var2); /* Long shift right with
                                                 round,  3             */
 Word32 L_abs (Word32 L_var1);            /* Long abs,              3  */
-Word32 L_sat (Word32 L_var1);            /* Long saturation,       4  */
 Word16 norm_s (Word16 var1);             /* Short norm,           15  */
-Word16 div_s (Word16 var1, Word16 var2); /* Short division,       18  */
-Word16 norm_l (Word32 L_var1);           /* Long norm,            30  */   
+Word16 norm_l (Word32 L_var1);           /* Long norm,            30  */
+
+#else
 
+#include "basic_op_inline.h"
 
+#endif
+
+/* Carry and division operators, out of line in either build */
+
+Word32 L_macNs (Word32 L_var3, Word16 var1, Word16 var2); /* Mac without
+                                                             sat, 1   */
+Word32 L_msuNs (Word32 L_var3, Word16 var1, Word16 var2); /* Msu without
+                                                             sat, 1   */
+Word32 L_add_c (Word32 L_var1, Word32 L_var2);  /* Long add with c, 2 */
+Word32 L_sub_c (Word32 L_var1, Word32 L_var2);  /* Long sub with c, 2 */
+Word32 L_sat (Word32 L_var1);            /* Long saturation,       4  */
+Word16 div_s (Word16 var1, Word16 var2); /* Short division,       18  */
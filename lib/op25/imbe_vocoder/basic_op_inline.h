@@ -0,0 +1,336 @@
+/*
+ * Project 25 IMBE Encoder/Decoder Fixed-Point implementation
+ * Developed by Pavel Yazev E-mail: pyazev@gmail.com
+ * Version 1.0 (c) Copyright 2009
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * The software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#ifndef _BASIC_OP_INLINE
+#define _BASIC_OP_INLINE
+
+#if defined(__ARM_FEATURE_DSP) && !defined(__aarch64__)
+#include <arm_acle.h>
+#define BASIC_OP_ARM_DSP 1
+#endif
+
+//-----------------------------------------------------------------------------
+//	PURPOSE:
+//		Header versions of the basic operators, so the compiler can inline
+//		them into the vocoder loops instead of making a call per sample.
+//		Results are bit-exact with the ETSI reference in basicop2.cc, which
+//		stays built as basicop_ref:: for checking against (see
+//		bench/basicop_bench.cc); building with IMBE_BASICOP_REFERENCE uses
+//		it in place of these.
+//
+//		Overflow is still set wherever the reference sets it, except on
+//		32-bit ARM with the DSP extension: there L_add, L_sub, L_mult,
+//		L_mac and L_msu are single saturating instructions (qadd, qsub,
+//		qdadd, qdsub), which report saturation only in the Q flag. Nothing
+//		in the vocoder reads Overflow.
+//
+//		The carry operators (L_add_c, L_sub_c, L_macNs, L_msuNs, L_sat)
+//		and div_s stay out of line.
+//
+//-----------------------------------------------------------------------------
+
+inline Word16 extract_h (Word32 L_var1)
+{
+    return (Word16) (L_var1 >> 16);
+}
+
+inline Word16 extract_l (Word32 L_var1)
+{
+    return (Word16) L_var1;
+}
+
+inline Word32 L_deposit_h (Word16 var1)
+{
+    return (Word32) var1 << 16;
+}
+
+inline Word32 L_deposit_l (Word16 var1)
+{
+    return (Word32) var1;
+}
+
+inline Word16 add (Word16 var1, Word16 var2)
+{
+    Word16 var_out;
+
+    if (__builtin_add_overflow (var1, var2, &var_out))
+    {
+        Overflow = 1;
+        var_out = (var1 < 0) ? MIN_16 : MAX_16;
+    }
+    return var_out;
+}
+
+inline Word16 sub (Word16 var1, Word16 var2)
+{
+    Word16 var_out;
+
+    if (__builtin_sub_overflow (var1, var2, &var_out))
+    {
+        Overflow = 1;
+        var_out = (var1 < 0) ? MIN_16 : MAX_16;
+    }
+    return var_out;
+}
+
+inline Word16 abs_s (Word16 var1)
+{
+    if (var1 == MIN_16)
+        return MAX_16;
+    return (var1 < 0) ? (Word16) -var1 : var1;
+}
+
+inline Word16 negate (Word16 var1)
+{
+    return (var1 == MIN_16) ? MAX_16 : (Word16) -var1;
+}
+
+inline Word32 L_add (Word32 L_var1, Word32 L_var2)
+{
+#ifdef BASIC_OP_ARM_DSP
+    return __qadd (L_var1, L_var2);
+#else
+    Word32 L_var_out;
+
+    if (__builtin_add_overflow (L_var1, L_var2, &L_var_out))
+    {
+        Overflow = 1;
+        L_var_out = (L_var1 < 0) ? MIN_32 : MAX_32;
+    }
+    return L_var_out;
+#endif
+}
+
+inline Word32 L_sub (Word32 L_var1, Word32 L_var2)
+{
+#ifdef BASIC_OP_ARM_DSP
+    return __qsub (L_var1, L_var2);
+#else
+    Word32 L_var_out;
+
+    if (__builtin_sub_overflow (L_var1, L_var2, &L_var_out))
+    {
+        Overflow = 1;
+        L_var_out = (L_var1 < 0) ? MIN_32 : MAX_32;
+    }
+    return L_var_out;
+#endif
+}
+
+inline Word32 L_negate (Word32 L_var1)
+{
+    return (L_var1 == MIN_32) ? MAX_32 : -L_var1;
+}
+
+inline Word32 L_abs (Word32 L_var1)
+{
+    if (L_var1 == MIN_32)
+        return MAX_32;
+    return (L_var1 < 0) ? -L_var1 : L_var1;
+}
+
+// Only -32768 * -32768 leaves the range, in all three multiplies below
+inline Word32 L_mult (Word16 var1, Word16 var2)
+{
+    Word32 L_product = (Word32) var1 * (Word32) var2;
+
+#ifdef BASIC_OP_ARM_DSP
+    return __qadd (L_product, L_product);
+#else
+    if (L_product == (Word32) 0x40000000L)
+    {
+        Overflow = 1;
+        return MAX_32;
+    }
+    return L_product * 2;
+#endif
+}
+
+inline Word16 mult (Word16 var1, Word16 var2)
+{
+    Word32 L_product = ((Word32) var1 * (Word32) var2) >> 15;
+
+    if (L_product > MAX_16)
+    {
+        Overflow = 1;
+        return MAX_16;
+    }
+    return (Word16) L_product;
+}
+
+inline Word16 mult_r (Word16 var1, Word16 var2)
+{
+    Word32 L_product = ((Word32) var1 * (Word32) var2 + (Word32) 0x00004000L) >> 15;
+
+    if (L_product > MAX_16)
+    {
+        Overflow = 1;
+        return MAX_16;
+    }
+    return (Word16) L_product;
+}
+
+inline Word32 L_mac (Word32 L_var3, Word16 var1, Word16 var2)
+{
+#ifdef BASIC_OP_ARM_DSP
+    return __qadd (L_var3, __qadd ((Word32) var1 * var2, (Word32) var1 * var2));
+#else
+    return L_add (L_var3, L_mult (var1, var2));
+#endif
+}
+
+inline Word32 L_msu (Word32 L_var3, Word16 var1, Word16 var2)
+{
+#ifdef BASIC_OP_ARM_DSP
+    return __qsub (L_var3, __qadd ((Word32) var1 * var2, (Word32) var1 * var2));
+#else
+    return L_sub (L_var3, L_mult (var1, var2));
+#endif
+}
+
+inline Word16 round (Word32 L_var1)
+{
+    return extract_h (L_add (L_var1, (Word32) 0x00008000L));
+}
+
+inline Word16 mac_r (Word32 L_var3, Word16 var1, Word16 var2)
+{
+    return extract_h (L_add (L_mac (L_var3, var1, var2), (Word32) 0x00008000L));
+}
+
+inline Word16 msu_r (Word32 L_var3, Word16 var1, Word16 var2)
+{
+    return extract_h (L_add (L_msu (L_var3, var1, var2), (Word32) 0x00008000L));
+}
+
+// Arithmetic shifts of the sign-magnitude kind the reference spells out
+// as ~(~x >> n); every supported compiler shifts signed values that way.
+// Negative counts shift the other way, clamped at -16 and -32.
+inline Word16 shl (Word16 var1, Word16 var2);
+inline Word32 L_shl (Word32 L_var1, Word16 var2);
+
+inline Word16 shr (Word16 var1, Word16 var2)
+{
+    if (var2 < 0)
+        return shl (var1, (var2 < -16) ? 16 : (Word16) -var2);
+    if (var2 >= 15)
+        return (var1 < 0) ? -1 : 0;
+    return (Word16) (var1 >> var2);
+}
+
+inline Word16 shl (Word16 var1, Word16 var2)
+{
+    if (var2 < 0)
+        return shr (var1, (var2 < -16) ? 16 : (Word16) -var2);
+    if (var2 > 15)
+    {
+        if (var1 == 0)
+            return 0;
+        Overflow = 1;
+        return (var1 > 0) ? MAX_16 : MIN_16;
+    }
+    Word32 result = (Word32) var1 * ((Word32) 1 << var2);
+    if (result != (Word32) (Word16) result)
+    {
+        Overflow = 1;
+        return (var1 > 0) ? MAX_16 : MIN_16;
+    }
+    return (Word16) result;
+}
+
+inline Word32 L_shr (Word32 L_var1, Word16 var2)
+{
+    if (var2 < 0)
+        return L_shl (L_var1, (var2 < -32) ? 32 : (Word16) -var2);
+    if (var2 >= 31)
+        return (L_var1 < 0) ? -1 : 0;
+    return L_var1 >> var2;
+}
+
+inline Word32 L_shl (Word32 L_var1, Word16 var2)
+{
+    if (var2 <= 0)
+        return L_shr (L_var1, (var2 < -32) ? 32 : (Word16) -var2);
+    if (var2 > 31)
+    {
+        if (L_var1 == 0)
+            return 0;
+        Overflow = 1;
+        return (L_var1 > 0) ? MAX_32 : MIN_32;
+    }
+    if (L_var1 > (MAX_32 >> var2))
+    {
+        Overflow = 1;
+        return MAX_32;
+    }
+    if (L_var1 < (MIN_32 >> var2))
+    {
+        Overflow = 1;
+        return MIN_32;
+    }
+    return (Word32) ((unsigned int) L_var1 << var2);
+}
+
+inline Word16 shr_r (Word16 var1, Word16 var2)
+{
+    if (var2 > 15)
+        return 0;
+    Word16 var_out = shr (var1, var2);
+    if (var2 > 0 && (var1 & ((Word16) 1 << (var2 - 1))) != 0)
+        var_out++;
+    return var_out;
+}
+
+inline Word32 L_shr_r (Word32 L_var1, Word16 var2)
+{
+    if (var2 > 31)
+        return 0;
+    Word32 L_var_out = L_shr (L_var1, var2);
+    if (var2 > 0 && (L_var1 & ((Word32) 1 << (var2 - 1))) != 0)
+        L_var_out++;
+    return L_var_out;
+}
+
+// Left shifts that bring a nonzero value's top bit just under the sign
+// bit: the redundant sign bits, one less than the leading zeros of the
+// magnitude (taken as ~x for negative x)
+inline Word16 norm_s (Word16 var1)
+{
+    if (var1 == 0)
+        return 0;
+    if (var1 == (Word16) 0xffff)
+        return 15;
+    unsigned int bits = (unsigned int) (unsigned short) ((var1 < 0) ? ~var1 : var1);
+    return (Word16) (__builtin_clz (bits) - 17);
+}
+
+inline Word16 norm_l (Word32 L_var1)
+{
+    if (L_var1 == 0)
+        return 0;
+    if (L_var1 == (Word32) 0xffffffffL)
+        return 31;
+    unsigned int bits = (unsigned int) ((L_var1 < 0) ? ~L_var1 : L_var1);
+    return (Word16) (__builtin_clz (bits) - 1);
+}
+
+#endif
@@ -44,20 +44,56 @@ extern int currCounter;
 
 #endif
 
-/*___________________________________________________________________________
- |                                                                           |
- |   Local Functions                                                         |
- |___________________________________________________________________________|
-*/
-Word16 saturate (Word32 L_var1);
-
 /*___________________________________________________________________________
  |                                                                           |
  |   Constants and Globals                                                   |
  |___________________________________________________________________________|
 */
-Flag Overflow = 0;
-Flag Carry = 0;
+/* Per-thread so concurrent vocoder instances do not share (and bounce) one
+ * cache line; nothing in the decoder reads these across threads. */
+thread_local Flag Overflow = 0;
+thread_local Flag Carry = 0;
+
+/* The reference operators, bit-exact with ETSI. The decoder normally uses
+ * the inline versions from basic_op_inline.h; these are compared against
+ * them by bench/basicop_bench.cc and forwarded to below. */
+namespace basicop_ref {
+
+Word16 saturate (Word32 L_var1);
+Word16 add (Word16 var1, Word16 var2);
+Word16 sub (Word16 var1, Word16 var2);
+Word16 abs_s (Word16 var1);
+Word16 shl (Word16 var1, Word16 var2);
+Word16 shr (Word16 var1, Word16 var2);
+Word16 mult (Word16 var1, Word16 var2);
+Word32 L_mult (Word16 var1, Word16 var2);
+Word16 negate (Word16 var1);
+Word16 extract_h (Word32 L_var1);
+Word16 extract_l (Word32 L_var1);
+Word16 round (Word32 L_var1);
+Word32 L_mac (Word32 L_var3, Word16 var1, Word16 var2);
+Word32 L_msu (Word32 L_var3, Word16 var1, Word16 var2);
+Word32 L_macNs (Word32 L_var3, Word16 var1, Word16 var2);
+Word32 L_msuNs (Word32 L_var3, Word16 var1, Word16 var2);
+Word32 L_add (Word32 L_var1, Word32 L_var2);
+Word32 L_sub (Word32 L_var1, Word32 L_var2);
+Word32 L_add_c (Word32 L_var1, Word32 L_var2);
+Word32 L_sub_c (Word32 L_var1, Word32 L_var2);
+Word32 L_negate (Word32 L_var1);
+Word16 mult_r (Word16 var1, Word16 var2);
+Word32 L_shl (Word32 L_var1, Word16 var2);
+Word32 L_shr (Word32 L_var1, Word16 var2);
+Word16 shr_r (Word16 var1, Word16 var2);
+Word16 mac_r (Word32 L_var3, Word16 var1, Word16 var2);
+Word16 msu_r (Word32 L_var3, Word16 var1, Word16 var2);
+Word32 L_deposit_h (Word16 var1);
+Word32 L_deposit_l (Word16 var1);
+Word32 L_shr_r (Word32 L_var1, Word16 var2);
+Word32 L_abs (Word32 L_var1);
+Word32 L_sat (Word32 L_var1);
+Word16 norm_s (Word16 var1);
+Word16 div_s (Word16 var1, Word16 var2);
+Word16 norm_l (Word32 L_var1);
 
 /*___________________________________________________________________________
  |                                                                           |
@@ -2155,3 +2191,42 @@ Word16 norm_l (Word32 L_var1)
     return (var_out);
 }
 
+} // namespace basicop_ref
+
+#if defined(IMBE_BASICOP_REFERENCE) || (WMOPS)
+Word16 add (Word16 var1, Word16 var2) { return basicop_ref::add (var1, var2); }
+Word16 sub (Word16 var1, Word16 var2) { return basicop_ref::sub (var1, var2); }
+Word16 abs_s (Word16 var1) { return basicop_ref::abs_s (var1); }
+Word16 shl (Word16 var1, Word16 var2) { return basicop_ref::shl (var1, var2); }
+Word16 shr (Word16 var1, Word16 var2) { return basicop_ref::shr (var1, var2); }
+Word16 mult (Word16 var1, Word16 var2) { return basicop_ref::mult (var1, var2); }
+Word32 L_mult (Word16 var1, Word16 var2) { return basicop_ref::L_mult (var1, var2); }
+Word16 negate (Word16 var1) { return basicop_ref::negate (var1); }
+Word16 extract_h (Word32 L_var1) { return basicop_ref::extract_h (L_var1); }
+Word16 extract_l (Word32 L_var1) { return basicop_ref::extract_l (L_var1); }
+Word16 round (Word32 L_var1) { return basicop_ref::round (L_var1); }
+Word32 L_mac (Word32 L_var3, Word16 var1, Word16 var2) { return basicop_ref::L_mac (L_var3, var1, var2); }
+Word32 L_msu (Word32 L_var3, Word16 var1, Word16 var2) { return basicop_ref::L_msu (L_var3, var1, var2); }
+Word32 L_add (Word32 L_var1, Word32 L_var2) { return basicop_ref::L_add (L_var1, L_var2); }
+Word32 L_sub (Word32 L_var1, Word32 L_var2) { return basicop_ref::L_sub (L_var1, L_var2); }
+Word32 L_negate (Word32 L_var1) { return basicop_ref::L_negate (L_var1); }
+Word16 mult_r (Word16 var1, Word16 var2) { return basicop_ref::mult_r (var1, var2); }
+Word32 L_shl (Word32 L_var1, Word16 var2) { return basicop_ref::L_shl (L_var1, var2); }
+Word32 L_shr (Word32 L_var1, Word16 var2) { return basicop_ref::L_shr (L_var1, var2); }
+Word16 shr_r (Word16 var1, Word16 var2) { return basicop_ref::shr_r (var1, var2); }
+Word16 mac_r (Word32 L_var3, Word16 var1, Word16 var2) { return basicop_ref::mac_r (L_var3, var1, var2); }
+Word16 msu_r (Word32 L_var3, Word16 var1, Word16 var2) { return basicop_ref::msu_r (L_var3, var1, var2); }
+Word32 L_deposit_h (Word16 var1) { return basicop_ref::L_deposit_h (var1); }
+Word32 L_deposit_l (Word16 var1) { return basicop_ref::L_deposit_l (var1); }
+Word32 L_shr_r (Word32 L_var1, Word16 var2) { return basicop_ref::L_shr_r (L_var1, var2); }
+Word32 L_abs (Word32 L_var1) { return basicop_ref::L_abs (L_var1); }
+Word16 norm_s (Word16 var1) { return basicop_ref::norm_s (var1); }
+Word16 norm_l (Word32 L_var1) { return basicop_ref::norm_l (L_var1); }
+#endif
+
+Word32 L_macNs (Word32 L_var3, Word16 var1, Word16 var2) { return basicop_ref::L_macNs (L_var3, var1, var2); }
+Word32 L_msuNs (Word32 L_var3, Word16 var1, Word16 var2) { return basicop_ref::L_msuNs (L_var3, var1, var2); }
+Word32 L_add_c (Word32 L_var1, Word32 L_var2) { return basicop_ref::L_add_c (L_var1, L_var2); }
+Word32 L_sub_c (Word32 L_var1, Word32 L_var2) { return basicop_ref::L_sub_c (L_var1, L_var2); }
+Word32 L_sat (Word32 L_var1) { return basicop_ref::L_sat (L_var1); }
+Word16 div_s (Word16 var1, Word16 var2) { return basicop_ref::div_s (var1, var2); }
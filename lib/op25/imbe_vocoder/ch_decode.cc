@@ -25,6 +25,8 @@
 #include "basic_op.h"
 #include "ch_decode.h"
 #include "aux_sub.h"
+#include "harm_sub.h"
+#include <string.h>
 #include <iostream>
 
 
@@ -34,6 +36,7 @@ void decode_frame_vector(IMBE_PARAM *imbe_param, Word16 *frame_vector)
 	Word16 i, vec_num, tmp, tmp1, tmp2, bit_thr, shift;
 	Word16 *b_ptr, *ba_ptr, index0;
 	Word32 L_tmp;
+	const HARM_PATH *harm_path;
 
 	imbe_param->b_vec[0] = (shr(frame_vector[0], 4) & 0xFC) | (shr(frame_vector[7], 1) & 0x3);	
 
@@ -126,21 +129,30 @@ void decode_frame_vector(IMBE_PARAM *imbe_param, Word16 *frame_vector)
 		ba_ptr[i] = b_ptr[i] = 0;
 
 
-	// Unpack bit allocation table's item
-	get_bit_allocation(imbe_param->num_harms, imbe_param->bit_alloc);
-
-	index0 = 0;
-	bit_thr = (imbe_param->num_harms == 0xb)?9:ba_ptr[0];
-
-	while(index0 < BIT_STREAM_LEN - imbe_param->num_bands - 2)
-	{	
-		for(i = 0; i < imbe_param->num_harms - 1; i++)
-			if(bit_thr && bit_thr <= ba_ptr[i])
-				b_ptr[i] = (b_ptr[i] << 1) | bit_stream[index0++];		
-		bit_thr--;
-		if (bit_thr < 0) {
-			std::cout << "Weird Error - imploder malfunction" << std::endl;
-			break;
+	harm_path = get_harm_path(imbe_param->num_harms);
+	if(harm_path)
+	{
+		memcpy(imbe_param->bit_alloc, harm_path->bit_alloc, harm_path->bit_alloc_len * sizeof(Word16));
+		harm_path->rescan(b_ptr, ba_ptr, bit_stream, BIT_STREAM_LEN - imbe_param->num_bands - 2);
+	}
+	else
+	{
+		// Unpack bit allocation table's item
+		get_bit_allocation(imbe_param->num_harms, imbe_param->bit_alloc);
+
+		index0 = 0;
+		bit_thr = (imbe_param->num_harms == 0xb)?9:ba_ptr[0];
+
+		while(index0 < BIT_STREAM_LEN - imbe_param->num_bands - 2)
+		{	
+			for(i = 0; i < imbe_param->num_harms - 1; i++)
+				if(bit_thr && bit_thr <= ba_ptr[i])
+					b_ptr[i] = (b_ptr[i] << 1) | bit_stream[index0++];		
+			bit_thr--;
+			if (bit_thr < 0) {
+				std::cout << "Weird Error - imploder malfunction" << std::endl;
+				break;
+			}
 		}
 	}
 
@@ -154,6 +166,7 @@ void v_uv_decode(IMBE_PARAM *imbe_param)
 	Word16 num_harms;
 	Word16 num_bands;
 	Word16 vu_vec, *p_v_uv_dsn, mask, i, uv_cnt;
+	const HARM_PATH *harm_path;
 
 	num_harms = imbe_param->num_harms;
     num_bands = imbe_param->num_bands;
@@ -161,10 +174,23 @@ void v_uv_decode(IMBE_PARAM *imbe_param)
 
 	p_v_uv_dsn = imbe_param->v_uv_dsn;
 
-	mask = 1 << (num_bands - 1); 
-
 	v_zap(p_v_uv_dsn, NUM_HARMS_MAX);
 
+	harm_path = get_harm_path(num_harms);
+	if(harm_path && harm_path->num_bands == num_bands)
+	{
+		uv_cnt = 0;
+		for(i = 0; i < num_harms; i++)
+		{
+			p_v_uv_dsn[i] = (vu_vec >> harm_path->uv_shift[i]) & 1;
+			uv_cnt += p_v_uv_dsn[i] ^ 1;
+		}
+		imbe_param->l_uv = uv_cnt;
+		return;
+	}
+
+	mask = 1 << (num_bands - 1); 
+
 	i = 0; uv_cnt = 0;
 	while(num_harms--)
 	{
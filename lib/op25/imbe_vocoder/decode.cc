@@ -52,6 +52,18 @@ void imbe_vocoder::decode_init(IMBE_PARAM *imbe_param)
 }
 
 
+// Whether every amplitude in vec is at or below floor
+static bool sa_below(const Word16 *vec, Word16 n, Word16 floor)
+{
+	Word16 i;
+
+	for(i = 0; i < n; i++)
+		if(vec[i] > floor)
+			return false;
+	return true;
+}
+
+
 void imbe_vocoder::decode(IMBE_PARAM *imbe_param, Word16 *frame_vector, Word16 *snd)
 {
 	Word16 snd_tmp[FRAME];
@@ -60,6 +72,17 @@ void imbe_vocoder::decode(IMBE_PARAM *imbe_param, Word16 *frame_vector, Word16 *
 	decode_frame_vector(imbe_param, frame_vector);
 	v_uv_decode(imbe_param);
 	sa_decode(imbe_param);
+
+	// Both halves of the overlap are quiet: nothing audible to synthesise
+	if(silence_floor > 0 && sa_below(imbe_param->sa, imbe_param->num_harms, silence_floor) &&
+	   sa_below(sa_prev3, num_harms_prev3, silence_floor))
+	{
+		v_synt_skip(imbe_param);
+		uv_synt_skip();
+		v_zap(snd, FRAME);
+		return;
+	}
+
 	sa_enh(imbe_param);
 	v_synt(imbe_param, snd);
 	uv_synt(imbe_param, snd_tmp);
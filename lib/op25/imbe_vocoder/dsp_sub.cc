@@ -27,6 +27,7 @@
 #include "math_sub.h"
 #include "encode.h"
 #include "imbe_vocoder.h"
+#include "simd_sub.h"
 
 //-----------------------------------------------------------------------------
 //	PURPOSE:
@@ -64,16 +65,19 @@ void imbe_vocoder::idct(Word16 *in, Word16 m_lim, Word16 i_lim, Word16 *out)
 		angl_intl_2 = shl(angl_intl, 1);
 	}
 
+	const SYNT_KERNELS *kernels = get_synt_kernels();
+	Word16 cosv[NUM_HARMS_MAX];
+
 	angl_step = angl_intl;
 	for(i = 0; i < i_lim; i++)
 	{
-		sum = 0;
 		angl_acc = angl_step;
 		for(m = 1; m < m_lim; m++)
 		{
-			sum = L_add(sum, L_shr( L_mult(in[m], cos_fxp(angl_acc)), 7));
+			cosv[m] = cos_fxp(angl_acc);
 			angl_acc += angl_step;			
 		}
+		sum = (m_lim > 1) ? kernels->dot_shr7(&in[1], &cosv[1], m_lim - 1) : 0;
 		sum = L_add(sum, L_shr( L_deposit_h(in[0]), 8));
 		out[i] = extract_l(L_shr_r (sum, 8)); 
 		angl_step += angl_intl_2; 
@@ -144,24 +148,40 @@ void imbe_vocoder::dct(Word16 *in, Word16 m_lim, Word16 i_lim, Word16 *out)
 
 
 
-void imbe_vocoder::fft_init(void)
+// The twiddle factors never change, so they are computed once per process
+// (thread-safe static initialisation) and every instance points at them
+struct fft_tables
 {
-	Word16 i, fft_len2, shift, step, theta;
-
-	fft_len2 = shr(FFTLENGTH, 1);
-	shift    = norm_s(fft_len2);
-	step     = shl(2, shift);
-	theta    = 0;
+	Word16 wr[FFTLENGTH / 2 + 1];
+	Word16 wi[FFTLENGTH / 2 + 1];
 
-	for(i = 0; i <= fft_len2; i++) 
+	fft_tables()
 	{
-		wr_array[i] = cos_fxp(theta);    
-		wi_array[i] = sin_fxp(theta);    
-		if(i >= (fft_len2 - 1))
-			theta = ONE_Q15;
-		else
-			theta = add(theta, step);
+		Word16 i, fft_len2, shift, step, theta;
+
+		fft_len2 = shr(FFTLENGTH, 1);
+		shift    = norm_s(fft_len2);
+		step     = shl(2, shift);
+		theta    = 0;
+
+		for(i = 0; i <= fft_len2; i++) 
+		{
+			wr[i] = cos_fxp(theta);    
+			wi[i] = sin_fxp(theta);    
+			if(i >= (fft_len2 - 1))
+				theta = ONE_Q15;
+			else
+				theta = add(theta, step);
+		}
 	}
+};
+
+void imbe_vocoder::fft_init(void)
+{
+	static const fft_tables tables;
+
+	wr_array = tables.wr;
+	wi_array = tables.wi;
 }
 
 
@@ -0,0 +1,149 @@
+/*
+ * Project 25 IMBE Encoder/Decoder Fixed-Point implementation
+ * Developed by Pavel Yazev E-mail: pyazev@gmail.com
+ * Version 1.0 (c) Copyright 2009
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * The software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <utility>
+
+#include "typedef.h"
+#include "globals.h"
+#include "basic_op.h"
+#include "imbe.h"
+#include "aux_sub.h"
+#include "math_sub.h"
+#include "ch_decode.h"
+#include "harm_sub.h"
+
+#define NUM_HARM_PATHS (NUM_HARMS_MAX - NUM_HARMS_MIN + 1)
+
+
+template <int N>
+static void rescan_n(Word16 *b_ptr, const Word16 *ba_ptr, const Word16 *bit_stream, Word16 limit)
+{
+	Word16 index0 = 0;
+	Word16 bit_thr = (N == 0xb) ? 9 : ba_ptr[0];
+
+	while(index0 < limit)
+	{
+		for(int i = 0; i < N - 1; i++)
+			if(bit_thr && bit_thr <= ba_ptr[i])
+				b_ptr[i] = (b_ptr[i] << 1) | bit_stream[index0++];
+		bit_thr--;
+		if(bit_thr < 0)
+		{
+			std::cout << "Weird Error - imploder malfunction" << std::endl;
+			break;
+		}
+	}
+}
+
+// Every L_mac term is >= 0, so the running sum only ever saturates at
+// MAX_32 and stays there: the saturating chain equals the exact sum
+// clamped, which needs no ordering and vectorises
+template <int N>
+static Word32 magsq_n(const Word16 *vec)
+{
+	long long sum = 0;
+
+	for(int i = 0; i < N; i++)
+	{
+		long long sq = 2LL * vec[i] * vec[i];
+		sum += (sq > MAX_32) ? MAX_32 : sq;
+	}
+	return (sum > MAX_32) ? MAX_32 : (Word32)sum;
+}
+
+template <int N>
+static void sa_update_n(Word32 *sa_prev1, const Word32 *sa_tmp, Word32 sum, Word16 *sa)
+{
+	for(int i = 0; i < N; i++)
+		sa_prev1[i + 1] = L_sub(sa_tmp[i], sum);
+	for(int i = 0; i < N; i++)
+		sa[i] = Pow2(sa_prev1[i + 1]);
+}
+
+
+static void fill_harm_path(HARM_PATH *path, Word16 num_harms)
+{
+	Word16 i, group;
+
+	path->num_harms = num_harms;
+	if(num_harms <= 36)
+		path->num_bands = extract_h((UWord32)(num_harms + 2) * CNST_0_33_Q0_16);
+	else
+		path->num_bands = NUM_BANDS_MAX;
+
+	if(num_harms <= 15)
+		path->ro_coef = CNST_0_4_Q1_15;
+	else if(num_harms <= 24)
+		path->ro_coef = num_harms * CNST_0_03_Q1_15 - CNST_0_05_Q1_15;
+	else
+		path->ro_coef = CNST_0_7_Q1_15;
+
+	path->inv_sh = norm_s(num_harms);
+	path->inv = div_s(0x4000, num_harms << path->inv_sh);
+
+	memset(path->bit_alloc, 0, sizeof(path->bit_alloc));
+	get_bit_allocation(num_harms, path->bit_alloc);
+	path->bit_alloc_len = B_NUM;
+	if(((num_harms - 1 + 3) & ~3) > B_NUM)
+		path->bit_alloc_len = (num_harms - 1 + 3) & ~3;
+
+	for(i = 0; i < num_harms; i++)
+	{
+		group = i / 3;
+		if(group > path->num_bands - 1)
+			group = path->num_bands - 1;
+		path->uv_shift[i] = (UWord8)(path->num_bands - 1 - group);
+	}
+}
+
+template <int... I>
+static void fill_harm_kernels(HARM_PATH *paths, std::integer_sequence<int, I...>)
+{
+	((paths[I].rescan = rescan_n<I + NUM_HARMS_MIN>), ...);
+	((paths[I].magsq = magsq_n<I + NUM_HARMS_MIN>), ...);
+	((paths[I].sa_update = sa_update_n<I + NUM_HARMS_MIN>), ...);
+}
+
+static const HARM_PATH *build_harm_paths(void)
+{
+	const char *force = getenv("IMBE_HARM");
+	if(force && strcmp(force, "generic") == 0)
+		return NULL;
+
+	static HARM_PATH paths[NUM_HARM_PATHS];
+	for(Word16 i = 0; i < NUM_HARM_PATHS; i++)
+		fill_harm_path(&paths[i], i + NUM_HARMS_MIN);
+	fill_harm_kernels(paths, std::make_integer_sequence<int, NUM_HARM_PATHS>());
+	return paths;
+}
+
+const HARM_PATH *get_harm_path(Word16 num_harms)
+{
+	static const HARM_PATH *paths = build_harm_paths();
+
+	if(!paths || num_harms < NUM_HARMS_MIN || num_harms > NUM_HARMS_MAX)
+		return NULL;
+	return &paths[num_harms - NUM_HARMS_MIN];
+}
@@ -0,0 +1,78 @@
+/*
+ * Project 25 IMBE Encoder/Decoder Fixed-Point implementation
+ * Developed by Pavel Yazev E-mail: pyazev@gmail.com
+ * Version 1.0 (c) Copyright 2009
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * The software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+#ifndef _HARM_SUB
+#define _HARM_SUB
+
+#include "typedef.h"
+#include "imbe.h"
+
+//-----------------------------------------------------------------------------
+//	PURPOSE:
+//		Per-frame decode work that depends only on the harmonic count,
+//		done once per count instead of once per frame. For each of the
+//		48 counts (NUM_HARMS_MIN..NUM_HARMS_MAX) there is an entry with the
+//		count's constants and unpacked tables, and loops instantiated for
+//		that count, so the compiler can unroll and vectorise them. Every
+//		entry is bit-exact with the runtime-count code it replaces in
+//		ch_decode.cc, sa_decode.cc and sa_enh.cc. That code still runs
+//		when get_harm_path() returns NULL: for a count out of range, or
+//		when IMBE_HARM=generic is set in the environment.
+//
+//-----------------------------------------------------------------------------
+typedef struct
+{
+	Word16 num_harms;
+	Word16 num_bands;                  // fix((L+2)/3), at most NUM_BANDS_MAX
+	Word16 ro_coef;                    // sa_decode prediction coefficient, Q1.15
+	Word16 inv_sh;                     // norm_s(num_harms)
+	Word16 inv;                        // div_s(0x4000, num_harms << inv_sh)
+
+	// get_bit_allocation() output over a zeroed bit_alloc; the first
+	// bit_alloc_len entries are what decode_frame_vector() writes
+	Word16 bit_alloc_len;
+	Word16 bit_alloc[B_NUM + 4];
+
+	// Bit of b_vec[1] holding each harmonic's voiced/unvoiced decision
+	UWord8 uv_shift[NUM_HARMS_MAX];
+
+	// Priority rescanning: gather bit_stream into b_ptr[0..num_harms-2]
+	// in bit allocation order, stopping at limit bits
+	void   (*rescan)(Word16 *b_ptr, const Word16 *ba_ptr, const Word16 *bit_stream, Word16 limit);
+
+	// L_v_magsq(vec, num_harms)
+	Word32 (*magsq)(const Word16 *vec);
+
+	// sa_prev1[i + 1] = L_sub(sa_tmp[i], sum), sa[i] = Pow2(sa_prev1[i + 1]), i < num_harms
+	void   (*sa_update)(Word32 *sa_prev1, const Word32 *sa_tmp, Word32 sum, Word16 *sa);
+} HARM_PATH;
+
+
+//-----------------------------------------------------------------------------
+//	PURPOSE:
+//		Return the entry for num_harms, or NULL to use the generic code
+//
+//-----------------------------------------------------------------------------
+const HARM_PATH *get_harm_path(Word16 num_harms);
+
+#endif
@@ -6,14 +6,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <atomic>
 
 #include "imbe_vocoder.h"
 
-static bool already_printed = false;
+static std::atomic<bool> already_printed(false);
 
 void imbe_vocoder::clear() {
-	memset(wr_array, 0, sizeof(wr_array));
-	memset(wi_array, 0, sizeof(wi_array));
 	memset(pitch_est_buf, 0, sizeof(pitch_est_buf));
 	memset(pitch_ref_buf, 0, sizeof(pitch_ref_buf));
 	memset(pe_lpf_mem, 0, sizeof(pe_lpf_mem));
@@ -39,6 +38,8 @@ void imbe_vocoder::clear() {
 	dc_rmv_mem = 0;
 	
 	decode_init(&my_imbe_param);
+	// Leave the encoder side exactly as the constructor does
+	encode_init();
 }
 
 imbe_vocoder::imbe_vocoder (void) :
@@ -53,10 +54,11 @@ imbe_vocoder::imbe_vocoder (void) :
 	fund_freq_prev(0),
 	th_max(0),
 	dc_rmv_mem(0),
-	d_gain_adjust(0)
+	d_gain_adjust(0),
+	silence_floor(0)
 {
-	memset(wr_array, 0, sizeof(wr_array));
-	memset(wi_array, 0, sizeof(wi_array));
+	wr_array = NULL;
+	wi_array = NULL;
 	memset(pitch_est_buf, 0, sizeof(pitch_est_buf));
 	memset(pitch_ref_buf, 0, sizeof(pitch_ref_buf));
 	memset(pe_lpf_mem, 0, sizeof(pe_lpf_mem));
@@ -74,8 +76,7 @@ imbe_vocoder::imbe_vocoder (void) :
 	decode_init(&my_imbe_param);
 	encode_init();
 
-	if (!already_printed) {
-		already_printed = 1;
+	if (!already_printed.exchange(true)) {
 		fprintf(stderr,"Project 25 IMBE Encoder/Decoder Fixed-Point implementation\n");
 		fprintf(stderr,"Developed by Pavel Yazev E-mail: pyazev@gmail.com\n");
 		fprintf(stderr,"Version 1.0 (c) Copyright 2009\n");
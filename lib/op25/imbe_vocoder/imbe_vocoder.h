@@ -33,9 +33,24 @@ public:
 	void imbe_decode(int16_t *frame_vector, int16_t *snd) {
 		decode(&my_imbe_param, frame_vector, snd);
 	}
+	// imbe_decode_batch decodes n consecutive codewords (frames[i]) into
+	// n * FRAME contiguous samples at out, e.g. all 9 codewords of an LDU
+	void imbe_decode_batch(const int16_t (*frames)[8], size_t n, int16_t *out) {
+		Word16 frame_vector[8];
+		for (size_t i = 0; i < n; i++) {
+			memcpy(frame_vector, frames[i], sizeof(frame_vector));
+			decode(&my_imbe_param, frame_vector, out + i * FRAME);
+		}
+	}
 	// hack to enable ambe encoder read access to speech parameters
 	const IMBE_PARAM* param(void) {return &my_imbe_param;}
 	void set_gain_adjust(float gain_adjust) {d_gain_adjust = gain_adjust;}
+	// Frames whose spectral amplitudes, and the previous frame's, all stay
+	// at or below floor are decoded as silence: parameters are still
+	// decoded and kept as history, but synthesis is skipped and the 160
+	// samples are zeros. Such a pair would synthesise to a peak of about
+	// 5 * floor. 0 (the default) synthesises every frame.
+	void set_silence_floor(int16_t floor) {silence_floor = floor;}
 private:
 	IMBE_PARAM my_imbe_param;
 
@@ -54,14 +69,16 @@ private:
 	Word16 sa_prev3[NUM_HARMS_MAX];
 	Word32 th_max;
 	Word16 v_uv_dsn[NUM_BANDS_MAX];
-	Word16 wr_array[FFTLENGTH / 2 + 1];
-	Word16 wi_array[FFTLENGTH / 2 + 1];
+	// FFT twiddle factors, shared by all instances (see fft_init)
+	const Word16 *wr_array;
+	const Word16 *wi_array;
 	Word16 pitch_est_buf[PITCH_EST_BUF_SIZE];
 	Word16 pitch_ref_buf[PITCH_EST_BUF_SIZE];
 	Word32 dc_rmv_mem;
 	Cmplx16 fft_buf[FFTLENGTH];
 	Word16 pe_lpf_mem[PE_LPF_ORD];
 	float d_gain_adjust;
+	Word16 silence_floor;
 
 	/* member functions */
 	void idct(Word16 *in, Word16 m_lim, Word16 i_lim, Word16 *out);
@@ -82,6 +99,8 @@ private:
 	void uv_synt(IMBE_PARAM *imbe_param, Word16 *snd);
 	void v_synt_init(void);
 	void v_synt(IMBE_PARAM *imbe_param, Word16 *snd);
+	void v_synt_skip(IMBE_PARAM *imbe_param);
+	void uv_synt_skip(void);
 	void pitch_ref_init(void);
 	Word16 voiced_sa_calc(Word32 num, Word16 den);
 	Word16 unvoiced_sa_calc(Word32 num, Word16 den);
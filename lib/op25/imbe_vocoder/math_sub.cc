@@ -117,9 +117,9 @@ Word32 L_mpy_ls(Word32 L_var2, Word16 var1)
 }
 
 //-----------------------------------------------------------------------------
-// Table for routine cos_fxp()
+// Table for routine cos_fxp(), shared with the synthesis kernels
 //-----------------------------------------------------------------------------
-static const Word16 cos_table[129] =
+const Word16 cos_table[129] =
 { 
 	32767, 32766, 32758, 32746, 32729, 32706, 32679, 32647, 32610,
 	32568, 32522, 32470, 32413, 32352, 32286, 32214, 32138, 32058,
@@ -26,6 +26,9 @@
 #define X05_Q15       16384         // (0.5*(1<<15)) 
 #define ONE_Q15       32767         // ((1<<15)-1) 
 
+// cos(i * pi / 256) in Q1.15, i = 0..128: the first quadrant cos_fxp() interpolates
+extern const Word16 cos_table[129];
+
 //-----------------------------------------------------------------------------
 //	PURPOSE:
 //				Computes the cosine of x whose value is expressed in radians/PI.
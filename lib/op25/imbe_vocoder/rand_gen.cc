@@ -24,30 +24,27 @@
 #include "typedef.h"
 #include "basic_op.h"
 
-static UWord32 seed = 1;
-
-
 //-----------------------------------------------------------------------------
 //	PURPOSE:
 //				Generate pseudo-random numbers in range -1...1
 //
 //
 //  INPUT:
-//		None
+//		seed - generator state, one per vocoder instance
 //
 //	OUTPUT:
-//		None
+//		seed - advanced
 //
 //	RETURN:
 //		        Pseudo-random number in signed Q1.16 format
 //
 //-----------------------------------------------------------------------------
-Word16 rand_gen(void)
+Word16 rand_gen(UWord32 *seed)
 {
 	UWord32 hi, lo;
 
-	lo = 16807 * (seed & 0xFFFF);
-	hi = 16807 * (seed >> 16);
+	lo = 16807 * (*seed & 0xFFFF);
+	hi = 16807 * (*seed >> 16);
 
 	lo += (Word32)(hi & 0x7FFF) << 16;
 	lo += (hi >> 15);
@@ -55,7 +52,7 @@ Word16 rand_gen(void)
 	if(lo > 0x7FFFFFFF)
 		lo -= 0x7FFFFFFF;
 
-	seed = lo;
+	*seed = lo;
 
 	return (Word16)lo;
 }
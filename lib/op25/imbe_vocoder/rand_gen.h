@@ -30,15 +30,15 @@
 //
 //
 //  INPUT:
-//		None
+//		seed - generator state, one per vocoder instance
 //
 //	OUTPUT:
-//		None
+//		seed - advanced
 //
 //	RETURN:
 //		        Pseudo-random number in signed Q1.16 format
 //
 //-----------------------------------------------------------------------------
-Word16 rand_gen(void);
+Word16 rand_gen(UWord32 *seed);
 
 #endif
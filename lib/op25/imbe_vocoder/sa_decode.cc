@@ -33,6 +33,7 @@
 #include "math_sub.h"
 #include "encode.h"
 #include "imbe_vocoder.h"
+#include "harm_sub.h"
 
 
 
@@ -85,6 +86,7 @@ void imbe_vocoder::sa_decode(IMBE_PARAM *imbe_param)
 	UWord32 k_coef, k_acc;
 	Word32 sum, tmp_word32, sa_tmp[NUM_HARMS_MAX];
 	Word16 *sa;
+	const HARM_PATH *harm_path;
 
 	num_harms = imbe_param->num_harms;
 	index     = num_harms - NUM_HARMS_MIN;
@@ -145,7 +147,10 @@ void imbe_vocoder::sa_decode(IMBE_PARAM *imbe_param)
 		k_coef += (Word32)div_s(tmp << 9, num_harms << 9) << 9;
 	}
 
-	if(num_harms <= 15)
+	harm_path = get_harm_path(num_harms);
+	if(harm_path)
+		ro_coef = harm_path->ro_coef;
+	else if(num_harms <= 15)
 		ro_coef = CNST_0_4_Q1_15;
 	else if(num_harms <= 24)
 		ro_coef = num_harms * CNST_0_03_Q1_15 - CNST_0_05_Q1_15;
@@ -184,16 +189,29 @@ void imbe_vocoder::sa_decode(IMBE_PARAM *imbe_param)
 		k_acc += k_coef;
 	}
 
-	imbe_param->div_one_by_num_harm_sh = tmp = norm_s(num_harms);	
-	imbe_param->div_one_by_num_harm = tmp1 = div_s(0x4000, num_harms << tmp); // calculate 1/num_harms with scaling for better pricision
-	                                                                          // save result to use late  
+	if(harm_path)
+	{
+		imbe_param->div_one_by_num_harm_sh = tmp = harm_path->inv_sh;
+		imbe_param->div_one_by_num_harm = tmp1 = harm_path->inv;
+	}
+	else
+	{
+		imbe_param->div_one_by_num_harm_sh = tmp = norm_s(num_harms);	
+		imbe_param->div_one_by_num_harm = tmp1 = div_s(0x4000, num_harms << tmp); // calculate 1/num_harms with scaling for better pricision
+		                                                                          // save result to use late  
+	}
 
 	sum = L_shr(L_mpy_ls(L_mpy_ls(sum, ro_coef), tmp1), (14 - tmp));
 
-	for(i = 1; i <= num_harms; i++)
+	if(harm_path)
+		harm_path->sa_update(sa_prev1, sa_tmp, sum, sa);
+	else
 	{
-		sa_prev1[i] = L_sub(sa_tmp[i - 1], sum);
-		sa[i - 1] = Pow2(sa_prev1[i]);
+		for(i = 1; i <= num_harms; i++)
+		{
+			sa_prev1[i] = L_sub(sa_tmp[i - 1], sum);
+			sa[i - 1] = Pow2(sa_prev1[i]);
+		}
 	}
 
 	num_harms_prev1 = num_harms;
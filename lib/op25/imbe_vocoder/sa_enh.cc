@@ -26,9 +26,14 @@
 #include "aux_sub.h"
 #include "math_sub.h"
 #include "sa_enh.h"
+#include "harm_sub.h"
 
 
-
+// Energy of the amplitudes, through the table for this harmonic count when there is one
+static inline Word32 sa_magsq(const HARM_PATH *harm_path, Word16 *vec, Word16 n)
+{
+	return harm_path ? harm_path->magsq(vec) : L_v_magsq(vec, n);
+}
 
 //-----------------------------------------------------------------------------
 //	PURPOSE:
@@ -55,14 +60,16 @@ void sa_enh(IMBE_PARAM *imbe_param)
 	Word32 L_den, L_num, L_Rm0_2, L_Rm1_2, L_sum_Rm02_Rm12, L_sum_mod;
 	Word16 Rm0Rm1, nm1, nm2, tot_nm;
 	Word16 Rm0_s, Rm1_s;
+	const HARM_PATH *harm_path;
 
 	
 	sa       = imbe_param->sa;
 	num_harm = imbe_param->num_harms;
+	harm_path = get_harm_path(num_harm);
 
 	v_equ(sa_tmp, sa, num_harm);
 
-	Rm0 = L_v_magsq(sa, num_harm);
+	Rm0 = sa_magsq(harm_path, sa, num_harm);
 
 	if(Rm0 == 0)
 		return;
@@ -72,7 +79,7 @@ void sa_enh(IMBE_PARAM *imbe_param)
 	{
 		nm = 1;
 		v_equ_shr(sa_tmp, sa, nm, num_harm);
-		Rm0 = L_v_magsq(sa_tmp, num_harm);
+		Rm0 = sa_magsq(harm_path, sa_tmp, num_harm);
 	}
 	else
 	{
@@ -80,7 +87,7 @@ void sa_enh(IMBE_PARAM *imbe_param)
 		{
 			nm = -(nm >> 1);
 			v_equ_shr(sa_tmp, sa, nm, num_harm);
-			Rm0 = L_v_magsq(sa_tmp, num_harm);
+			Rm0 = sa_magsq(harm_path, sa_tmp, num_harm);
 		}
 	}
 	
@@ -187,7 +194,7 @@ void sa_enh(IMBE_PARAM *imbe_param)
 
     // Compute the correct scale factor
 	v_equ_shr(sa_tmp, sa, nm, num_harm);
-	L_sum_mod = L_v_magsq(sa_tmp, num_harm);
+	L_sum_mod = sa_magsq(harm_path, sa_tmp, num_harm);
 	if(L_sum_mod > Rm0)
 	{
 		tmp = div_s(extract_h(Rm0), extract_h(L_sum_mod));
@@ -0,0 +1,424 @@
+/*
+ * Project 25 IMBE Encoder/Decoder Fixed-Point implementation
+ * Developed by Pavel Yazev E-mail: pyazev@gmail.com
+ * Version 1.0 (c) Copyright 2009
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * The software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMBE_SIMD_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IMBE_SIMD_NEON 1
+#endif
+
+#include "typedef.h"
+#include "basic_op.h"
+#include "math_sub.h"
+#include "simd_sub.h"
+
+// Note on bit-exactness:
+//   L_mult(a, b) == 2*a*b except for a == b == MIN_16, where it saturates to
+//   MAX_32. With p = a*b (exact in 32 bits) that case is p == 0x40000000, so
+//     L_shr(L_mult(a, b), 1) == p - (p == 0x40000000)
+//     L_shr(L_mult(a, b), 7) == (p >> 6) - (p == 0x40000000)
+//   which the vector paths compute with a compare mask.
+//
+//   cos_fxp() never saturates: after folding into the first quadrant the
+//   index is at most 128, the interpolation step is at most 402 and mult()
+//   of it by the Q15 fraction is a plain arithmetic shift. The only
+//   saturating op is negate(MIN_16) on the input.
+
+//-----------------------------------------------------------------------------
+// Scalar reference
+//-----------------------------------------------------------------------------
+static void mac_shr1_scalar(Word32 *L_acc, const Word16 *cosv, Word16 amp, Word16 n)
+{
+	Word16 j;
+
+	for(j = 0; j < n; j++)
+		L_acc[j] = L_add(L_acc[j], L_shr(L_mult(amp, cosv[j]), 1));
+}
+
+static Word32 dot_shr7_scalar(const Word16 *a, const Word16 *b, Word16 n)
+{
+	Word32 sum = 0;
+	Word16 m;
+
+	for(m = 0; m < n; m++)
+		sum = L_add(sum, L_shr(L_mult(a[m], b[m]), 7));
+	return sum;
+}
+
+static void extract_h_vec_scalar(const Word32 *in, Word16 *out, Word16 n)
+{
+	Word16 j;
+
+	for(j = 0; j < n; j++)
+		out[j] = extract_h(in[j]);
+}
+
+// Phase of sample j; unsigned so the wraparound is defined
+static inline Word32 phase_at(Word32 ph, Word32 step, Word32 chirp_step, Word16 j)
+{
+	UWord32 chirp = (UWord32)(chirp_step >> 9) * (UWord32)j << 9;
+	chirp = (UWord32)((Word32)chirp >> 9) * (UWord32)j << 9;
+	return (Word32)((UWord32)ph + (UWord32)step * (UWord32)j + chirp);
+}
+
+static void cos_phase_scalar(Word16 *out, Word32 ph, Word32 step, Word32 chirp_step, Word16 n)
+{
+	Word16 j;
+
+	for(j = 0; j < n; j++)
+		out[j] = cos_fxp(extract_h(phase_at(ph, step, chirp_step, j)));
+}
+
+// cos_fxp() in plain integer arithmetic, see the note at the top
+static inline Word16 cos_q15(Word16 x)
+{
+	Word32 tx, index, m, ty;
+
+	tx = x < 0 ? (x == MIN_16 ? MAX_16 : -x) : x;
+	Word32 fold = tx > X05_Q15;
+	if(fold)
+		tx = ONE_Q15 - tx;
+	index = tx >> 7;
+	if(index == 128)
+		return 0;
+	m  = (tx - (index << 7)) << 8;
+	ty = cos_table[index] + ((m * (cos_table[index + 1] - cos_table[index])) >> 15);
+	return (Word16)(fold ? -ty : ty);
+}
+
+// For targets without a vector version
+__attribute__((unused))
+static void cos_phase_inline(Word16 *out, Word32 ph, Word32 step, Word32 chirp_step, Word16 n)
+{
+	Word16 j;
+
+	for(j = 0; j < n; j++)
+		out[j] = cos_q15((Word16)(phase_at(ph, step, chirp_step, j) >> 16));
+}
+
+static const SYNT_KERNELS kernels_scalar = {
+	"scalar", mac_shr1_scalar, dot_shr7_scalar, extract_h_vec_scalar, cos_phase_scalar
+};
+
+#if IMBE_SIMD_X86
+//-----------------------------------------------------------------------------
+// SSE2 (always available on x86-64)
+//-----------------------------------------------------------------------------
+
+// Exact 16x16 -> 32 bit products of 4 lanes
+static inline __m128i mul16_lo_sse2(__m128i a, __m128i b)
+{
+	return _mm_unpacklo_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b));
+}
+
+static inline __m128i mul16_hi_sse2(__m128i a, __m128i b)
+{
+	return _mm_unpackhi_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b));
+}
+
+// L_add() on 4 lanes
+static inline __m128i l_add_sse2(__m128i a, __m128i b)
+{
+	__m128i s   = _mm_add_epi32(a, b);
+	__m128i ovf = _mm_srai_epi32(_mm_andnot_si128(_mm_xor_si128(a, b), _mm_xor_si128(a, s)), 31);
+	__m128i sat = _mm_xor_si128(_mm_srai_epi32(a, 31), _mm_set1_epi32(MAX_32));
+	return _mm_or_si128(_mm_andnot_si128(ovf, s), _mm_and_si128(ovf, sat));
+}
+
+static void mac_shr1_sse2(Word32 *L_acc, const Word16 *cosv, Word16 amp, Word16 n)
+{
+	const __m128i va  = _mm_set1_epi16(amp);
+	const __m128i sat = _mm_set1_epi32(0x40000000);
+	Word16 j = 0;
+
+	for(; j + 8 <= n; j += 8)
+	{
+		__m128i c  = _mm_loadu_si128((const __m128i *)&cosv[j]);
+		__m128i p0 = mul16_lo_sse2(va, c);
+		__m128i p1 = mul16_hi_sse2(va, c);
+		p0 = _mm_add_epi32(p0, _mm_cmpeq_epi32(p0, sat));
+		p1 = _mm_add_epi32(p1, _mm_cmpeq_epi32(p1, sat));
+		__m128i a0 = _mm_loadu_si128((const __m128i *)&L_acc[j]);
+		__m128i a1 = _mm_loadu_si128((const __m128i *)&L_acc[j + 4]);
+		_mm_storeu_si128((__m128i *)&L_acc[j],     l_add_sse2(a0, p0));
+		_mm_storeu_si128((__m128i *)&L_acc[j + 4], l_add_sse2(a1, p1));
+	}
+	mac_shr1_scalar(&L_acc[j], &cosv[j], amp, n - j);
+}
+
+static Word32 dot_shr7_sse2(const Word16 *a, const Word16 *b, Word16 n)
+{
+	const __m128i sat = _mm_set1_epi32(0x40000000);
+	__m128i acc = _mm_setzero_si128();
+	Word32 lanes[4];
+	Word16 m = 0;
+
+	for(; m + 8 <= n; m += 8)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *)&a[m]);
+		__m128i vb = _mm_loadu_si128((const __m128i *)&b[m]);
+		__m128i p0 = mul16_lo_sse2(va, vb);
+		__m128i p1 = mul16_hi_sse2(va, vb);
+		acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_srai_epi32(p0, 6), _mm_cmpeq_epi32(p0, sat)));
+		acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_srai_epi32(p1, 6), _mm_cmpeq_epi32(p1, sat)));
+	}
+	if(m + 4 <= n)
+	{
+		__m128i va = _mm_loadl_epi64((const __m128i *)&a[m]);
+		__m128i vb = _mm_loadl_epi64((const __m128i *)&b[m]);
+		__m128i p0 = mul16_lo_sse2(va, vb);
+		acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_srai_epi32(p0, 6), _mm_cmpeq_epi32(p0, sat)));
+		m += 4;
+	}
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_shr7_scalar(&a[m], &b[m], n - m);
+}
+
+static void extract_h_vec_sse2(const Word32 *in, Word16 *out, Word16 n)
+{
+	Word16 j = 0;
+
+	for(; j + 8 <= n; j += 8)
+	{
+		__m128i v0 = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)&in[j]), 16);
+		__m128i v1 = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)&in[j + 4]), 16);
+		_mm_storeu_si128((__m128i *)&out[j], _mm_packs_epi32(v0, v1));
+	}
+	extract_h_vec_scalar(&in[j], &out[j], n - j);
+}
+
+// SSE2 has neither gathers nor 32-bit multiplies, so the table lookups stay scalar
+static const SYNT_KERNELS kernels_sse2 = {
+	"sse2", mac_shr1_sse2, dot_shr7_sse2, extract_h_vec_sse2, cos_phase_inline
+};
+
+//-----------------------------------------------------------------------------
+// AVX2 (runtime detected)
+//-----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static inline __m256i l_add_avx2(__m256i a, __m256i b)
+{
+	__m256i s   = _mm256_add_epi32(a, b);
+	__m256i ovf = _mm256_srai_epi32(_mm256_andnot_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(a, s)), 31);
+	__m256i sat = _mm256_xor_si256(_mm256_srai_epi32(a, 31), _mm256_set1_epi32(MAX_32));
+	return _mm256_blendv_epi8(s, sat, ovf);
+}
+
+__attribute__((target("avx2")))
+static void mac_shr1_avx2(Word32 *L_acc, const Word16 *cosv, Word16 amp, Word16 n)
+{
+	const __m256i va  = _mm256_set1_epi32(amp);
+	const __m256i sat = _mm256_set1_epi32(0x40000000);
+	Word16 j = 0;
+
+	for(; j + 8 <= n; j += 8)
+	{
+		__m256i c = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&cosv[j]));
+		__m256i p = _mm256_mullo_epi32(va, c);
+		p = _mm256_add_epi32(p, _mm256_cmpeq_epi32(p, sat));
+		__m256i acc = _mm256_loadu_si256((const __m256i *)&L_acc[j]);
+		_mm256_storeu_si256((__m256i *)&L_acc[j], l_add_avx2(acc, p));
+	}
+	mac_shr1_sse2(&L_acc[j], &cosv[j], amp, n - j);
+}
+
+__attribute__((target("avx2")))
+static Word32 dot_shr7_avx2(const Word16 *a, const Word16 *b, Word16 n)
+{
+	const __m256i sat = _mm256_set1_epi32(0x40000000);
+	__m256i acc = _mm256_setzero_si256();
+	Word32 lanes[8];
+	Word16 m = 0;
+
+	for(; m + 8 <= n; m += 8)
+	{
+		__m256i va = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&a[m]));
+		__m256i vb = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&b[m]));
+		__m256i p  = _mm256_mullo_epi32(va, vb);
+		acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_srai_epi32(p, 6), _mm256_cmpeq_epi32(p, sat)));
+	}
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7]
+	     + dot_shr7_sse2(&a[m], &b[m], n - m);
+}
+
+__attribute__((target("avx2")))
+static void extract_h_vec_avx2(const Word32 *in, Word16 *out, Word16 n)
+{
+	Word16 j = 0;
+
+	for(; j + 16 <= n; j += 16)
+	{
+		__m256i v0 = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&in[j]), 16);
+		__m256i v1 = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&in[j + 8]), 16);
+		// packs works per 128-bit lane; permute restores sample order
+		__m256i pk = _mm256_permute4x64_epi64(_mm256_packs_epi32(v0, v1), 0xD8);
+		_mm256_storeu_si256((__m256i *)&out[j], pk);
+	}
+	extract_h_vec_sse2(&in[j], &out[j], n - j);
+}
+
+__attribute__((target("avx2")))
+static void cos_phase_avx2(Word16 *out, Word32 ph, Word32 step, Word32 chirp_step, Word16 n)
+{
+	const __m256i lane  = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i vph   = _mm256_set1_epi32(ph);
+	const __m256i vstep = _mm256_set1_epi32(step);
+	const __m256i vchirp = _mm256_set1_epi32(chirp_step >> 9);
+	const __m256i half  = _mm256_set1_epi32(X05_Q15);
+	const __m256i one   = _mm256_set1_epi32(ONE_Q15);
+	const __m256i max16 = _mm256_set1_epi32(MAX_16);
+	const __m256i last  = _mm256_set1_epi32(127);
+	const __m256i end   = _mm256_set1_epi32(128);
+	Word16 j = 0;
+
+	for(; j + 8 <= n; j += 8)
+	{
+		__m256i vj = _mm256_add_epi32(_mm256_set1_epi32(j), lane);
+		__m256i chirp = _mm256_slli_epi32(_mm256_mullo_epi32(vchirp, vj), 9);
+		chirp = _mm256_slli_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(chirp, 9), vj), 9);
+		__m256i phase = _mm256_add_epi32(_mm256_add_epi32(vph, _mm256_mullo_epi32(vstep, vj)), chirp);
+
+		// extract_h, then negate() including its MIN_16 saturation
+		__m256i tx   = _mm256_min_epi32(_mm256_abs_epi32(_mm256_srai_epi32(phase, 16)), max16);
+		__m256i fold = _mm256_cmpgt_epi32(tx, half);
+		tx = _mm256_blendv_epi8(tx, _mm256_sub_epi32(one, tx), fold);
+		__m256i index = _mm256_srli_epi32(tx, 7);
+		__m256i m = _mm256_slli_epi32(_mm256_sub_epi32(tx, _mm256_slli_epi32(index, 7)), 8);
+
+		// One 32-bit gather at 16-bit scale fetches table[index] and table[index + 1];
+		// index 128 is clamped to stay inside the table and zeroed below
+		__m256i pair = _mm256_i32gather_epi32((const int *)cos_table, _mm256_min_epi32(index, last), 2);
+		__m256i lo = _mm256_srai_epi32(_mm256_slli_epi32(pair, 16), 16);
+		__m256i hi = _mm256_srai_epi32(pair, 16);
+		__m256i ty = _mm256_add_epi32(lo, _mm256_srai_epi32(_mm256_mullo_epi32(m, _mm256_sub_epi32(hi, lo)), 15));
+		ty = _mm256_blendv_epi8(ty, _mm256_sub_epi32(_mm256_setzero_si256(), ty), fold);
+		ty = _mm256_andnot_si256(_mm256_cmpeq_epi32(index, end), ty);
+
+		__m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(ty), _mm256_extracti128_si256(ty, 1));
+		_mm_storeu_si128((__m128i *)&out[j], packed);
+	}
+	for(; j < n; j++)
+		out[j] = cos_q15((Word16)(phase_at(ph, step, chirp_step, j) >> 16));
+}
+
+static const SYNT_KERNELS kernels_avx2 = {
+	"avx2", mac_shr1_avx2, dot_shr7_avx2, extract_h_vec_avx2, cos_phase_avx2
+};
+#endif // IMBE_SIMD_X86
+
+#if IMBE_SIMD_NEON
+//-----------------------------------------------------------------------------
+// NEON: vqdmull_s16 / vqaddq_s32 are exactly L_mult / L_add
+//-----------------------------------------------------------------------------
+static void mac_shr1_neon(Word32 *L_acc, const Word16 *cosv, Word16 amp, Word16 n)
+{
+	const int16x4_t va = vdup_n_s16(amp);
+	Word16 j = 0;
+
+	for(; j + 4 <= n; j += 4)
+	{
+		int32x4_t p = vshrq_n_s32(vqdmull_s16(va, vld1_s16(&cosv[j])), 1);
+		vst1q_s32(&L_acc[j], vqaddq_s32(vld1q_s32(&L_acc[j]), p));
+	}
+	mac_shr1_scalar(&L_acc[j], &cosv[j], amp, n - j);
+}
+
+static Word32 dot_shr7_neon(const Word16 *a, const Word16 *b, Word16 n)
+{
+	int32x4_t acc = vdupq_n_s32(0);
+	Word32 lanes[4];
+	Word16 m = 0;
+
+	for(; m + 4 <= n; m += 4)
+		acc = vaddq_s32(acc, vshrq_n_s32(vqdmull_s16(vld1_s16(&a[m]), vld1_s16(&b[m])), 7));
+	vst1q_s32(lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_shr7_scalar(&a[m], &b[m], n - m);
+}
+
+static void extract_h_vec_neon(const Word32 *in, Word16 *out, Word16 n)
+{
+	Word16 j = 0;
+
+	for(; j + 4 <= n; j += 4)
+		vst1_s16(&out[j], vshrn_n_s32(vld1q_s32(&in[j]), 16));
+	extract_h_vec_scalar(&in[j], &out[j], n - j);
+}
+
+static const SYNT_KERNELS kernels_neon = {
+	"neon", mac_shr1_neon, dot_shr7_neon, extract_h_vec_neon, cos_phase_inline
+};
+#endif // IMBE_SIMD_NEON
+
+
+static const SYNT_KERNELS *select_synt_kernels(void)
+{
+	const char *force = getenv("IMBE_SIMD");
+	if(force && strcmp(force, "scalar") == 0)
+		return &kernels_scalar;
+
+#if IMBE_SIMD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return &kernels_avx2;
+	if(__builtin_cpu_supports("sse2"))
+		return &kernels_sse2;
+#elif IMBE_SIMD_NEON
+	return &kernels_neon;
+#endif
+	return &kernels_scalar;
+}
+
+const SYNT_KERNELS *get_synt_kernels(void)
+{
+	static const SYNT_KERNELS *kernels = select_synt_kernels();
+	return kernels;
+}
+
+static const SYNT_KERNELS *const *build_synt_kernel_tables(void)
+{
+	static const SYNT_KERNELS *tables[4];
+	int n = 0;
+
+	tables[n++] = &kernels_scalar;
+#if IMBE_SIMD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2"))
+		tables[n++] = &kernels_sse2;
+	if(__builtin_cpu_supports("avx2"))
+		tables[n++] = &kernels_avx2;
+#elif IMBE_SIMD_NEON
+	tables[n++] = &kernels_neon;
+#endif
+	tables[n] = NULL;
+	return tables;
+}
+
+const SYNT_KERNELS *const *get_synt_kernel_tables(void)
+{
+	static const SYNT_KERNELS *const *tables = build_synt_kernel_tables();
+	return tables;
+}
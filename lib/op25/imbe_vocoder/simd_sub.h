@@ -0,0 +1,73 @@
+/*
+ * Project 25 IMBE Encoder/Decoder Fixed-Point implementation
+ * Developed by Pavel Yazev E-mail: pyazev@gmail.com
+ * Version 1.0 (c) Copyright 2009
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * The software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#ifndef _SIMD_SUB
+#define _SIMD_SUB
+
+#include "typedef.h"
+
+//-----------------------------------------------------------------------------
+//	PURPOSE:
+//		Vectorised synthesis kernels. Every implementation produces output
+//		bit-exact with the scalar basic-op reference; the best one for the
+//		running CPU (AVX2 / SSE2 / NEON / scalar) is picked on first use.
+//		Setting IMBE_SIMD=scalar in the environment forces the reference.
+//
+//-----------------------------------------------------------------------------
+typedef struct
+{
+	const char *name;
+
+	// L_acc[j] = L_add(L_acc[j], L_shr(L_mult(amp, cosv[j]), 1)), j < n
+	void   (*mac_shr1)(Word32 *L_acc, const Word16 *cosv, Word16 amp, Word16 n);
+
+	// Sum of L_shr(L_mult(a[m], b[m]), 7), m < n. Callers must keep
+	// n <= NUM_HARMS_MAX so the L_add chain cannot saturate.
+	Word32 (*dot_shr7)(const Word16 *a, const Word16 *b, Word16 n);
+
+	// out[j] = extract_h(in[j]), j < n
+	void   (*extract_h_vec)(const Word32 *in, Word16 *out, Word16 n);
+
+	// out[j] = cos_fxp(extract_h(ph + j * step + chirp(j))), j < n, where
+	// chirp(j) = ((((chirp_step >> 9) * j) << 9 >> 9) * j) << 9. All of it
+	// in wrapping 32-bit arithmetic, as v_synt's phase accumulators are.
+	void   (*cos_phase)(Word16 *out, Word32 ph, Word32 step, Word32 chirp_step, Word16 n);
+} SYNT_KERNELS;
+
+
+//-----------------------------------------------------------------------------
+//	PURPOSE:
+//		Return the kernel table selected for this CPU
+//
+//-----------------------------------------------------------------------------
+const SYNT_KERNELS *get_synt_kernels(void);
+
+
+//-----------------------------------------------------------------------------
+//	PURPOSE:
+//		Return every kernel table the running CPU can execute, scalar
+//		reference first, NULL terminated. Used by simd-kernel-check.
+//
+//-----------------------------------------------------------------------------
+const SYNT_KERNELS *const *get_synt_kernel_tables(void);
+
+#endif
@@ -86,8 +86,8 @@ void imbe_vocoder::uv_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 		{			
 			while(index_a < index_b)
 			{
-				Uw[index_a].re = mult(sa, rand_gen());
-				Uw[index_a].im = mult(sa, rand_gen());
+				Uw[index_a].re = mult(sa, rand_gen(&seed));
+				Uw[index_a].im = mult(sa, rand_gen(&seed));
 				//Uw[index_a].re = sa;
 				//Uw[index_a].im = sa;
 
@@ -145,3 +145,22 @@ void imbe_vocoder::uv_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 		uv_mem[i] = shl(Uw[index_aux++].re, 3);
 }
 
+
+//-----------------------------------------------------------------------------
+//	PURPOSE:
+//		Drop the overlap tail after a frame decoded as silence
+//
+//  INPUT:
+//		None
+//
+//	OUTPUT:
+//		None
+//
+//	RETURN:
+//		None
+//
+//-----------------------------------------------------------------------------
+void imbe_vocoder::uv_synt_skip(void)
+{
+	v_zap(uv_mem, 105);
+}
@@ -31,6 +31,7 @@
 #include "tbls.h"
 #include "encode.h"
 #include "imbe_vocoder.h"
+#include "simd_sub.h"
 
 
 
@@ -47,7 +48,7 @@ void imbe_vocoder::v_synt_init(void)
 
 	for(i = 0; i < NUM_HARMS_MAX; i++)
 	{
-		ph_mem[i] = L_deposit_h(rand_gen());
+		ph_mem[i] = L_deposit_h(rand_gen(&seed));
 		vu_dsn_prev[i] = 0;
 	}
 
@@ -59,11 +60,13 @@ void imbe_vocoder::v_synt_init(void)
 void imbe_vocoder::v_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 {
 	Word32 L_tmp, L_tmp1, fund_freq, L_snd[FRAME], L_ph_acc, L_ph_step;
-	Word32 L_ph_acc_aux, L_ph_step_prev, L_amp_acc, L_amp_step, L_ph_step_aux;
+	Word32 L_ph_step_prev, L_amp_acc, L_amp_step, L_ph_step_aux;
 	Word16 num_harms, i, j, *vu_dsn, *sa, *s_ptr, *s_ptr_aux, num_harms_max, num_harms_max_4;
 	UWord32 ph_mem_prev[NUM_HARMS_MAX], dph[NUM_HARMS_MAX];
 	Word16 num_harms_inv, num_harms_sh, num_uv;
 	Word16 freq_flag;
+	Word16 cosv[FRAME], cosv_aux[FRAME];
+	const SYNT_KERNELS *kernels = get_synt_kernels();
 
 
 	fund_freq = imbe_param->fund_freq;
@@ -108,11 +111,11 @@ void imbe_vocoder::v_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 		{
 			if(num_uv == num_harms)
 			{
-				dph[i] = L_deposit_h(rand_gen());				
+				dph[i] = L_deposit_h(rand_gen(&seed));				
 			}
 			else
 			{			
-				L_tmp = L_mult(rand_gen(), num_harms_inv); 
+				L_tmp = L_mult(rand_gen(&seed), num_harms_inv); 
 				dph[i] = L_shr(L_tmp, 15 - num_harms_sh) * num_uv;
 			}
 			ph_mem[i] += dph[i];
@@ -125,22 +128,15 @@ void imbe_vocoder::v_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 		{
 			s_ptr = (Word16 *)ws;
 			L_ph_acc = ph_mem[i] - (((L_ph_step >> 7) * 104) << 7);
+			kernels->cos_phase(&cosv[56], L_ph_acc, L_ph_step, 0, 159 - 56 + 1);
 			for(j = 56; j <= 104; j++)
 			{
 				L_tmp = L_mult(*s_ptr++, sa[i]);
-				L_tmp = L_mpy_ls(L_tmp, cos_fxp(extract_h(L_ph_acc)));
+				L_tmp = L_mpy_ls(L_tmp, cosv[j]);
 				L_tmp = L_shr(L_tmp, 1);
 				L_snd[j] = L_add(L_snd[j], L_tmp);
-				L_ph_acc += L_ph_step;
-			}
-
-			for(j = 105; j <= 159; j++)
-			{
-				L_tmp = L_mult(sa[i], cos_fxp(extract_h(L_ph_acc)));
-				L_tmp = L_shr(L_tmp, 1);
-				L_snd[j] = L_add(L_snd[j], L_tmp);
-				L_ph_acc += L_ph_step;
 			}
+			kernels->mac_shr1(&L_snd[105], &cosv[105], sa[i], 159 - 105 + 1);
 			continue;
 		}
 
@@ -148,23 +144,15 @@ void imbe_vocoder::v_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 		if(vu_dsn[i] == 0 && vu_dsn_prev[i] == 1)  // voiced => unvoiced
 		{
 			s_ptr = (Word16 *)&ws[48];
-			L_ph_acc = ph_mem_prev[i];
-
-			for(j = 0; j <= 55; j++)
-			{
-				L_tmp = L_mult(sa_prev3[i], cos_fxp(extract_h(L_ph_acc)));
-				L_tmp = L_shr(L_tmp, 1);
-				L_snd[j] = L_add(L_snd[j], L_tmp);
-				L_ph_acc += L_ph_step_prev;
-			}
+			kernels->cos_phase(&cosv[0], ph_mem_prev[i], L_ph_step_prev, 0, 104 + 1);
+			kernels->mac_shr1(&L_snd[0], &cosv[0], sa_prev3[i], 55 + 1);
 
 			for(j = 56; j <= 104; j++)
 			{
 				L_tmp = L_mult(*s_ptr--, sa_prev3[i]);
-				L_tmp = L_mpy_ls(L_tmp, cos_fxp(extract_h(L_ph_acc)));
+				L_tmp = L_mpy_ls(L_tmp, cosv[j]);
 				L_tmp = L_shr(L_tmp, 1);
 				L_snd[j] = L_add(L_snd[j], L_tmp);
-				L_ph_acc += L_ph_step_prev;
 			}
 			continue;
 		}
@@ -172,42 +160,27 @@ void imbe_vocoder::v_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 		if(i >=7 || freq_flag)
 		{
 			s_ptr_aux     = (Word16 *)&ws[48];
-			L_ph_acc_aux  = ph_mem_prev[i];
-
 			s_ptr    = (Word16 *)ws;
 			L_ph_acc = ph_mem[i] - (((L_ph_step >> 7) * 104) << 7);
 
-			for(j = 0; j <= 55; j++)
-			{
-				L_tmp = L_mult(sa_prev3[i], cos_fxp(extract_h(L_ph_acc_aux)));
-				L_tmp = L_shr(L_tmp, 1);
-				L_snd[j] = L_add(L_snd[j], L_tmp);
-				L_ph_acc_aux += L_ph_step_prev;
-			}
+			// Fading out the previous frame's harmonic over 0..104, fading in this one over 56..159
+			kernels->cos_phase(&cosv_aux[0], ph_mem_prev[i], L_ph_step_prev, 0, 104 + 1);
+			kernels->cos_phase(&cosv[56], L_ph_acc, L_ph_step, 0, 159 - 56 + 1);
+			kernels->mac_shr1(&L_snd[0], &cosv_aux[0], sa_prev3[i], 55 + 1);
 
 			for(j = 56; j <= 104; j++)
 			{
 				L_tmp = L_mult(*s_ptr_aux--, sa_prev3[i]);
-				L_tmp = L_mpy_ls(L_tmp, cos_fxp(extract_h(L_ph_acc_aux)));
+				L_tmp = L_mpy_ls(L_tmp, cosv_aux[j]);
 				L_tmp = L_shr(L_tmp, 1);
 				L_snd[j] = L_add(L_snd[j], L_tmp);
 
 				L_tmp = L_mult(*s_ptr++, sa[i]);
-				L_tmp = L_mpy_ls(L_tmp, cos_fxp(extract_h(L_ph_acc)));
+				L_tmp = L_mpy_ls(L_tmp, cosv[j]);
 				L_tmp = L_shr(L_tmp, 1);
 				L_snd[j] = L_add(L_snd[j], L_tmp);
-
-				L_ph_acc_aux += L_ph_step_prev;
-				L_ph_acc += L_ph_step;
-			}
-
-			for(j = 105; j <= 159; j++)
-			{
-				L_tmp = L_mult(sa[i], cos_fxp(extract_h(L_ph_acc)));
-				L_tmp = L_shr(L_tmp, 1);
-				L_snd[j] = L_add(L_snd[j], L_tmp);
-				L_ph_acc += L_ph_step;
 			}
+			kernels->mac_shr1(&L_snd[105], &cosv[105], sa[i], 159 - 105 + 1);
 			continue;
 		}
 	
@@ -218,26 +191,22 @@ void imbe_vocoder::v_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 		L_ph_step_aux = L_mpy_ls(L_shr(fund_freq - fund_freq_prev, 4 + 1), CNST_0_1_Q1_15);       // (fund_freq - fund_freq_prev)/(2*160)
 		L_ph_step_aux = ((L_ph_step_aux >> 7) * (i + 1)) << 7;
 
-		L_ph_acc = ph_mem_prev[i];
-
 		L_tmp1 = L_mpy_ls(L_shr(dph[i], 4), CNST_0_1_Q1_15);  // dph[i] / 160
-					
+
+		// Phase advances by L_ph_step_prev + L_tmp1 a sample, plus the quadratic
+		// term from L_ph_step_aux that sweeps the frequency to this frame's
+		kernels->cos_phase(cosv, ph_mem_prev[i], (Word32)((UWord32)L_ph_step_prev + (UWord32)L_tmp1),
+		                   L_ph_step_aux, FRAME);
 		for(j = 0; j < 160; j++)
 		{
-			L_ph_acc_aux = ((L_ph_step_aux >> 9) * j) << 9; 
-			L_ph_acc_aux = ((L_ph_acc_aux >> 9) * j) << 9; 
-
-			L_tmp = L_mpy_ls(L_amp_acc, cos_fxp(extract_h(L_ph_acc + L_ph_acc_aux)));			
+			L_tmp = L_mpy_ls(L_amp_acc, cosv[j]);
 			L_snd[j] = L_add(L_snd[j], L_tmp);
 
 			L_amp_acc = L_add(L_amp_acc, L_amp_step);
-			L_ph_acc += L_ph_step_prev;
-			L_ph_acc += L_tmp1;
 		}
 	}
 
-	for(i = 0; i < FRAME; i++)
-		*snd++ = extract_h(L_snd[i]);
+	kernels->extract_h_vec(L_snd, snd, FRAME);
 
 	v_zap(vu_dsn_prev, NUM_HARMS_MAX);
 	v_equ(vu_dsn_prev, imbe_param->v_uv_dsn, num_harms);
@@ -246,3 +215,30 @@ void imbe_vocoder::v_synt(IMBE_PARAM *imbe_param, Word16 *snd)
 	num_harms_prev3 = num_harms;
 	fund_freq_prev = fund_freq;
 }
+
+
+//-----------------------------------------------------------------------------
+//	PURPOSE:
+//		Take a frame decoded as silence as the previous frame for the next
+//		v_synt() call, as v_synt() would have, without synthesising it
+//
+//  INPUT:
+//		IMBE_PARAM *imbe_param - pointer to IMBE_PARAM structure with
+//                               valid num_harms, fund_freq, v_uv_dsn and sa
+//
+//	OUTPUT:
+//		None
+//
+//	RETURN:
+//		None
+//
+//-----------------------------------------------------------------------------
+void imbe_vocoder::v_synt_skip(IMBE_PARAM *imbe_param)
+{
+	v_zap(vu_dsn_prev, NUM_HARMS_MAX);
+	v_equ(vu_dsn_prev, imbe_param->v_uv_dsn, imbe_param->num_harms);
+	v_equ(sa_prev3, imbe_param->sa, imbe_param->num_harms);
+
+	num_harms_prev3 = imbe_param->num_harms;
+	fund_freq_prev = imbe_param->fund_freq;
+}
@@ -45,7 +45,7 @@ golay_23_encode(uint32_t code_word_in)
 }
 
 static inline uint32_t
-golay_23_syndrome(uint32_t pattern)
+golay_23_syndrome_slow(uint32_t pattern)
 {
    uint32_t aux = 0x400000;
    while(pattern & 0xFFFFF800) {
@@ -56,6 +56,28 @@ golay_23_syndrome(uint32_t pattern)
    }
    return  pattern;
 }
+
+/*
+ * The syndrome is the remainder modulo the generator, which is linear:
+ * the low 11 bits pass straight through and the upper 12 bits are reduced
+ * once per value into a table.
+ */
+struct golay_23_syndrome_table {
+   uint16_t hi[4096];
+
+   golay_23_syndrome_table() {
+      for(uint32_t i = 0; i < 4096; ++i) {
+         hi[i] = golay_23_syndrome_slow(i << 11);
+      }
+   }
+};
+
+static inline uint32_t
+golay_23_syndrome(uint32_t pattern)
+{
+   static const golay_23_syndrome_table table;
+   return table.hi[(pattern >> 11) & 0xFFF] ^ (pattern & 0x7FF);
+}
 /* APCO Golay(23,11,7) decoder.
  *
  * \param cw The 23-bit codeword to decode.
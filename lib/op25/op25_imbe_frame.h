@@ -288,6 +288,34 @@ pngen23(uint32_t& Pr)
    return  n;
 }
 
+/*
+ * The PN masks that whiten u1..u6 are seeded from u0 alone, so all six are
+ * generated once for each of the 4096 values of u0 instead of stepping the
+ * LCG 114 times per codeword.
+ */
+struct imbe_pn_mask_table {
+   uint32_t m[4096][6];   // m1..m3 23 bits, m4..m6 15 bits
+
+   imbe_pn_mask_table() {
+      for(uint32_t u0 = 0; u0 < 4096; ++u0) {
+         uint32_t pn = u0 << 4;
+         m[u0][0] = pngen23(pn);
+         m[u0][1] = pngen23(pn);
+         m[u0][2] = pngen23(pn);
+         m[u0][3] = pngen15(pn);
+         m[u0][4] = pngen15(pn);
+         m[u0][5] = pngen15(pn);
+      }
+   }
+};
+
+static inline const uint32_t*
+imbe_pn_masks(uint32_t u0)
+{
+   static const imbe_pn_mask_table table;
+   return table.m[u0 & 0xFFF];
+}
+
 /* APCO IMBE header decoder.
  *
  * extracts 88 bits of IMBE parameters given an input 144-bit frame
@@ -305,34 +333,28 @@ imbe_header_decode(const voice_codeword& cw, uint32_t& u0, uint32_t& u1, uint32_
    u0 = v0;
    E0 = errs;
 
-   uint32_t pn = u0 << 4;
-   uint32_t m1 = pngen23(pn);
-   uint32_t v1 = extract(cw, 23, 46) ^ m1;
+   const uint32_t* m = imbe_pn_masks(u0);
+   uint32_t v1 = extract(cw, 23, 46) ^ m[0];
    errs += golay_23_decode(v1);
    u1 = v1;
 
-   uint32_t m2 = pngen23(pn);
-   uint32_t v2 = extract(cw, 46, 69) ^ m2;
+   uint32_t v2 = extract(cw, 46, 69) ^ m[1];
    errs += golay_23_decode(v2);
    u2 = v2;
 
-   uint32_t m3 = pngen23(pn);
-   uint32_t v3 = extract(cw, 69, 92) ^ m3;
+   uint32_t v3 = extract(cw, 69, 92) ^ m[2];
    errs += golay_23_decode(v3);
    u3 = v3;
 
-   uint32_t m4 = pngen15(pn);
-   uint16_t v4 = extract(cw, 92, 107) ^ m4;
+   uint16_t v4 = extract(cw, 92, 107) ^ m[3];
    errs += hamming_15_decode(v4);
    u4 = v4;
 
-   uint32_t m5 = pngen15(pn);
-   uint16_t v5 = extract(cw, 107, 122) ^ m5;
+   uint16_t v5 = extract(cw, 107, 122) ^ m[4];
    errs += hamming_15_decode(v5);
    u5 = v5;
 
-   uint32_t m6 = pngen15(pn);
-   uint16_t v6 = extract(cw, 122, 137) ^ m6;
+   uint16_t v6 = extract(cw, 122, 137) ^ m[5];
    errs += hamming_15_decode(v6);
    u6 = v6;
 
@@ -440,6 +462,145 @@ imbe_interleave(bit_vector& frame_body, const voice_codeword& cw, uint32_t frame
       }
 }
 
+/*
+ * Packed-byte deinterleave path.
+ *
+ * voice_codeword_bits[][] holds bit ordinals into the LDU body; these tables
+ * pre-split each ordinal into a byte index and an MSB-first bit mask so the
+ * codeword fields can be gathered straight from raw frame bytes without
+ * building intermediate bit_vector / voice_codeword objects.
+ */
+struct imbe_bit_offset {
+   uint8_t byte;   // LDU bodies are 216 bytes (bit ordinals < 1728)
+   uint8_t mask;
+};
+
+struct imbe_bit_offset_table {
+   imbe_bit_offset off[nof_voice_codewords][voice_codeword_sz];
+   size_t min_frame_sz;   // bytes needed to cover every ordinal
+
+   imbe_bit_offset_table() : min_frame_sz(0) {
+      for(size_t i = 0; i < nof_voice_codewords; ++i) {
+         for(size_t j = 0; j < voice_codeword_sz; ++j) {
+            const uint16_t bit = voice_codeword_bits[i][j];
+            off[i][j].byte = bit >> 3;
+            off[i][j].mask = 0x80 >> (bit & 7);
+            if ((size_t)(bit >> 3) + 1 > min_frame_sz)
+               min_frame_sz = (bit >> 3) + 1;
+         }
+      }
+   }
+};
+
+static inline const imbe_bit_offset_table&
+imbe_bit_offsets()
+{
+   static const imbe_bit_offset_table table;
+   return table;
+}
+
+/*
+ * Gather codeword bits [begin,end) MSB-first, equivalent to
+ * extract(cw, begin, end) on a deinterleaved voice_codeword.
+ */
+static inline uint32_t
+imbe_gather_bits(const uint8_t* frame_body, const imbe_bit_offset* off, int begin, int end)
+{
+   uint32_t x = 0;
+   for(int i = begin; i < end; ++i) {
+      x = (x << 1) | ((frame_body[off[i].byte] & off[i].mask) ? 1 : 0);
+   }
+   return x;
+}
+
+/*
+ * Decode one codeword gathered through off[] into u[0..7]; returns the
+ * number of bits corrected (E0 is the share corrected in u0).
+ */
+static inline uint32_t
+imbe_codeword_decode_packed(const uint8_t* frame_body, const imbe_bit_offset* off, uint32_t* u, uint32_t& E0)
+{
+   uint32_t v0 = imbe_gather_bits(frame_body, off, 0, 23);
+   uint32_t errs = golay_23_decode(v0);
+   u[0] = v0;
+   E0 = errs;
+
+   const uint32_t* m = imbe_pn_masks(v0);
+   uint32_t v1 = imbe_gather_bits(frame_body, off, 23, 46) ^ m[0];
+   errs += golay_23_decode(v1);
+   u[1] = v1;
+
+   uint32_t v2 = imbe_gather_bits(frame_body, off, 46, 69) ^ m[1];
+   errs += golay_23_decode(v2);
+   u[2] = v2;
+
+   uint32_t v3 = imbe_gather_bits(frame_body, off, 69, 92) ^ m[2];
+   errs += golay_23_decode(v3);
+   u[3] = v3;
+
+   uint16_t v4 = imbe_gather_bits(frame_body, off, 92, 107) ^ m[3];
+   errs += hamming_15_decode(v4);
+   u[4] = v4;
+
+   uint16_t v5 = imbe_gather_bits(frame_body, off, 107, 122) ^ m[4];
+   errs += hamming_15_decode(v5);
+   u[5] = v5;
+
+   uint16_t v6 = imbe_gather_bits(frame_body, off, 122, 137) ^ m[5];
+   errs += hamming_15_decode(v6);
+   u[6] = v6;
+
+   u[7] = imbe_gather_bits(frame_body, off, 137, 144);
+   u[7] <<= 1; /* so that bit0 is free (see note about BOT bit */
+   return errs;
+}
+
+/* APCO IMBE header decoder, packed-byte variant.
+ *
+ * Deinterleaves codeword frame_nr directly from frame_sz raw LDU bytes and
+ * decodes it exactly as imbe_header_decode() would. Returns false (leaving
+ * the outputs untouched) if frame_body is too short to hold the codeword.
+ */
+static inline bool
+imbe_header_decode_packed(const uint8_t* frame_body, size_t frame_sz, uint32_t frame_nr, uint32_t& u0, uint32_t& u1, uint32_t& u2, uint32_t& u3, uint32_t& u4, uint32_t& u5, uint32_t& u6, uint32_t& u7, uint32_t& E0, uint32_t& ET)
+{
+   const imbe_bit_offset_table& table = imbe_bit_offsets();
+   if (frame_nr >= nof_voice_codewords || frame_sz < table.min_frame_sz)
+      return false;
+
+   uint32_t u[8];
+   ET = imbe_codeword_decode_packed(frame_body, table.off[frame_nr], u, E0);
+   u0 = u[0]; u1 = u[1]; u2 = u[2]; u3 = u[3];
+   u4 = u[4]; u5 = u[5]; u6 = u[6]; u7 = u[7];
+   return true;
+}
+
+/*
+ * All nine codewords of an LDU, decoded in one pass over the frame body.
+ * u[i][7] keeps the same <<1 as imbe_header_decode().
+ */
+struct imbe_ldu_params {
+   uint32_t u[nof_voice_codewords][8];
+   uint32_t E0[nof_voice_codewords];
+   uint32_t ET[nof_voice_codewords];
+   uint32_t corrected;   // bits corrected across the LDU
+};
+
+static inline bool
+imbe_ldu_decode_packed(const uint8_t* frame_body, size_t frame_sz, imbe_ldu_params& p)
+{
+   const imbe_bit_offset_table& table = imbe_bit_offsets();
+   if (frame_sz < table.min_frame_sz)
+      return false;
+
+   p.corrected = 0;
+   for(size_t i = 0; i < nof_voice_codewords; ++i) {
+      p.ET[i] = imbe_codeword_decode_packed(frame_body, table.off[i], p.u[i], p.E0[i]);
+      p.corrected += p.ET[i];
+   }
+   return true;
+}
+
 static inline void
 imbe_frame_unpack(uint8_t *A, uint32_t& u0, uint32_t& u1, uint32_t& u2, uint32_t& u3, uint32_t& u4, uint32_t& u5, uint32_t& u6, uint32_t& u7, uint32_t& E0, uint32_t& ET)
 {
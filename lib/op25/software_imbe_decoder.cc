@@ -729,6 +729,98 @@ static const float PhzNz[57] = {
 	0.068775, 0.520336, 2.339119, -0.808328, 1.332154, 2.929768, -0.338316, 0.022767, -1.063795
 };
 
+/*
+ * Twiddle and bit-reversal tables for the 128-point FFT behind both the
+ * unvoiced analysis and the 256-point real IFFT, built once instead of
+ * running cos/sin recurrences on every call.
+ */
+struct imbe_fft_tables {
+   int bitrev[128];
+   float wr[64], wi[64];     // exp(-j 2 pi k / 128)
+   float hr[129], hi[129];   // exp(-j pi k / 128), real-transform split
+
+   imbe_fft_tables() {
+      for(int i = 0; i < 128; i++) {
+         int r = 0;
+         for(int b = 0; b < 7; b++) {
+            r |= ((i >> b) & 1) << (6 - b);
+         }
+         bitrev[i] = r;
+      }
+      for(int k = 0; k < 64; k++) {
+         wr[k] = cos(2 * M_PI * k / 128);
+         wi[k] = -sin(2 * M_PI * k / 128);
+      }
+      for(int k = 0; k <= 128; k++) {
+         hr[k] = cos(M_PI * k / 128);
+         hi[k] = -sin(M_PI * k / 128);
+      }
+   }
+};
+
+static const imbe_fft_tables&
+fft_tables()
+{
+   static const imbe_fft_tables tables;
+   return tables;
+}
+
+/*
+ * out[en] += (amp + amp_step * (en - from)) * w(en) * cos(phase(en)) for
+ * en in [from, to], with phase(en) = phase0 + dphase * m + ddphase * m * m,
+ * m = en - from, and w(en) = window[en + window_offset] (1 if no window).
+ *
+ * Four phasors, one per lane, are rotated by complex multiplies rather than
+ * calling cos() per sample; the lane loops have no dependencies between
+ * lanes so the compiler can keep them in SIMD registers.
+ */
+static void
+add_harmonic(float* out, int from, int to, float amp, float amp_step,
+             double phase0, double dphase, double ddphase,
+             const float* window = NULL, int window_offset = 0)
+{
+   float zr[4], zi[4], rr[4], ri[4];
+   for(int l = 0; l < 4; l++) {
+      double p = phase0 + dphase * l + ddphase * l * l;
+      double d = 4 * dphase + ddphase * (8 * l + 16);
+      zr[l] = cos(p); zi[l] = sin(p);
+      rr[l] = cos(d); ri[l] = sin(d);
+   }
+   const float qr = cos(32 * ddphase), qi = sin(32 * ddphase);
+   const bool chirp = ddphase != 0;
+
+   int en = from;
+   for(; en + 3 <= to; en += 4) {
+      float a[4];
+      for(int l = 0; l < 4; l++) {
+         a[l] = (amp + amp_step * (en + l - from)) * zr[l];
+      }
+      if(window) {
+         for(int l = 0; l < 4; l++) {
+            a[l] *= window[en + l + window_offset];
+         }
+      }
+      for(int l = 0; l < 4; l++) {
+         out[en + l] += a[l];
+         float t = zr[l] * rr[l] - zi[l] * ri[l];
+         zi[l] = zr[l] * ri[l] + zi[l] * rr[l];
+         zr[l] = t;
+      }
+      if(chirp) {
+         for(int l = 0; l < 4; l++) {
+            float t = rr[l] * qr - ri[l] * qi;
+            ri[l] = rr[l] * qi + ri[l] * qr;
+            rr[l] = t;
+         }
+      }
+   }
+   for(; en <= to; en++) {
+      int m = en - from;
+      float w = window ? window[en + window_offset] : 1;
+      out[en] += (amp + amp_step * m) * w * cos(phase0 + dphase * m + ddphase * m * m);
+   }
+}
+
 software_imbe_decoder::software_imbe_decoder()
 {
    int i,j;
@@ -818,46 +910,30 @@ software_imbe_decoder::adaptive_smoothing(float SE, float ET)
 void
 software_imbe_decoder::fft(float REX[], float IMX[])
 {
-   int I;
-   int J;
-   int K;
-   int H;
-   int KpH;
-   int Ht2;
+   const imbe_fft_tables& t = fft_tables();
    float tmp_f;
-   float l_Ui, l_Uq, Theta, Si, Sq, Ti, Xi, Tq, Xq;
 
-   J = 64;
-   for(I = 1; I <= 126; I++) {
+   for(int I = 1; I < 127; I++) {
+      int J = t.bitrev[I];
 #define SWAP(x,y) tmp_f=x;x=y;y=tmp_f
       if(I < J) { SWAP(REX[J], REX[I]); SWAP(IMX[J], IMX[I]); }
 #undef SWAP
-      K = 64;
-      while(K <= J) { J = J - K; K = K / 2; }
-      J = J + K;
    }
 
-   H = 1;
-   for(I = 1; I <= 7; I++) {
-      Ht2 = H * 2; l_Ui = 1; l_Uq = 0;
-      Theta = M_PI / H; Si = cos(Theta); Sq = -sin(Theta);
-      for(J = 1; J <= H; J++) {
-         for(K = J - 1; K <= 127; K+=Ht2) {
-            KpH = K + H;
+   for(int H = 1, step = 64; H < 128; H *= 2, step /= 2) {
+      for(int J = 0; J < H; J++) {
+         const float l_Ui = t.wr[J * step], l_Uq = t.wi[J * step];
+         for(int K = J; K < 128; K += 2 * H) {
+            const int KpH = K + H;
 
-            Ti = REX[KpH] * l_Ui - IMX[KpH] * l_Uq; Xi = REX[K];
-            Tq = REX[KpH] * l_Uq + IMX[KpH] * l_Ui; Xq = IMX[K];
+            float Ti = REX[KpH] * l_Ui - IMX[KpH] * l_Uq, Xi = REX[K];
+            float Tq = REX[KpH] * l_Uq + IMX[KpH] * l_Ui, Xq = IMX[K];
 
             REX[KpH] = Xi - Ti; REX[K] = Xi + Ti;
             IMX[KpH] = Xq - Tq; IMX[K] = Xq + Tq;
          }
-         Ti = l_Ui;
-         l_Ui = Ti * Si - l_Uq * Sq;
-         l_Uq = Ti * Sq + l_Uq * Si;
       }
-      H = Ht2;
    }
-
 }
 
 void
@@ -1307,7 +1383,7 @@ software_imbe_decoder::enhance_spectral_amplitudes(float& SE)
 }
 
 void
-software_imbe_decoder::ifft(float FDi[], float FDq[], float TD[]) // ToDo: replace "real IFFT" with fftw3 IFFT proc!
+software_imbe_decoder::ifft(float FDi[], float FDq[], float TD[])
 {
 	//Inverse FFT:
 	//  transform 129-point freq domain(FDx) to 256-point time domain(TD)
@@ -1319,7 +1395,7 @@ software_imbe_decoder::ifft(float FDi[], float FDq[], float TD[]) // ToDo: repla
    int J;
    int K;
    int H;
-   float l_Ui, l_Uq, Si, Sq, Ti, Tq, Xi, Xq;
+   float l_Ui, l_Uq, Ti, Tq, Xi, Xq;
 
    for(I = 0; I <= 63; I++) {
       J = I + 64;    //64 to 127
@@ -1359,10 +1435,10 @@ software_imbe_decoder::ifft(float FDi[], float FDq[], float TD[]) // ToDo: repla
    FDi[0] = Ai[0]   ; //c (new)
    FDq[0] = 0       ; //d
 
-   l_Ui = 1; l_Uq = 0;
-   Si = cos(M_PI / 128); Sq = -sin(M_PI / 128);
+   const imbe_fft_tables& t = fft_tables();
    for(I = 0; I <= 127; I++) {
       J = I + 128  ;   //128 TO 255
+      l_Ui = t.hr[I]; l_Uq = t.hi[I];
 
       Ti = FDi[J] * l_Ui - FDq[J] * l_Uq; Xi = FDi[I];
       Tq = FDi[J] * l_Uq + FDq[J] * l_Ui; Xq = FDq[I];
@@ -1370,10 +1446,6 @@ software_imbe_decoder::ifft(float FDi[], float FDq[], float TD[]) // ToDo: repla
 
       TD[I + 128] =((Xi + Ti) -(Xq + Tq));
       TD[I      ] =((Xi - Ti) -(Xq - Tq));
-
-      Ti = l_Ui;
-      l_Ui = Ti * Si - l_Uq * Sq;
-      l_Uq = Ti * Sq + l_Uq * Si;
    }
 }
 
@@ -1505,6 +1577,31 @@ software_imbe_decoder::synth_unvoiced()
       u[en] = next_u(u[en-1]);
    }
 
+   // The spectrum of the windowed noise, Uw(m) = sum u(n) ws(n) e^(-j pi m n / 128)
+   // for n = -105..105, is one 256-point real DFT: fold n into 0..255, run
+   // it as a 128-point complex FFT of the even/odd samples and split.
+   float Xi[256], Xq[256];
+   {
+      const imbe_fft_tables& t = fft_tables();
+      float b[256] = {0};
+      for(en = 0; en < 211; en++) {
+         b[(en - 105) & 255] = u[en] * ws[en];
+      }
+      float Zi[128], Zq[128];
+      for(en = 0; en < 128; en++) {
+         Zi[en] = b[2 * en];
+         Zq[en] = b[2 * en + 1];
+      }
+      fft(Zi, Zq);
+      for(em = 0; em <= 128; em++) {
+         const int ec = (128 - em) & 127;
+         const float Er = .5 * (Zi[em & 127] + Zi[ec]), Eq = .5 * (Zq[em & 127] - Zq[ec]);
+         const float Or = .5 * (Zq[em & 127] + Zq[ec]), Oq = -.5 * (Zi[em & 127] - Zi[ec]);
+         Xi[em] = Er + t.hr[em] * Or - t.hi[em] * Oq;
+         Xq[em] = Eq + t.hr[em] * Oq + t.hi[em] * Or;
+      }
+   }
+
    ell = 0; bl =(int) ceilf(128 / M_PI *(ell + .5) * w0);
    for(em = 0; em <= bl - 1; em++) {
       Uwi[em] = 0; Uwq[em] = 0;
@@ -1521,13 +1618,8 @@ software_imbe_decoder::synth_unvoiced()
       } else {
          Luv = Luv + 1;
          for(em = al; em <= bl - 1; em++) {
-            Uwi[em] = 0;
-            Uwq[em] = 0;
-            for (en = 0; en < 211; en++) {
-               float exp = -0.0078125 * M_PI * em * (en - 105);
-               Uwi[em] = Uwi[em] + u[en] * ws[en] * cos(exp);
-               Uwq[em] = Uwq[em] + u[en] * ws[en] * sin(exp);
-            }
+            Uwi[em] = Xi[em];
+            Uwq[em] = Xq[em];
          }
          //precompute Tmp = <most of big hairy equation>
          Tmp = 0;
@@ -1629,31 +1721,19 @@ software_imbe_decoder::synth_voiced()
                THa = (Oldw0 * (float)ell + Dwl);
                THb = (w0 - Oldw0) * ell * .003125;
                Mb = .00625 *(MNew - MOld);
-               for(en = 0; en <= 159; en++) {
-                  sv[en] = sv[en] +(MOld + en * Mb) * cos(phi[ell][ Old] +(THa + THb * en) * en);
-               }
+               // sv(n) += (MOld + n Mb) cos(phi_old + THa n + THb n^2)
+               add_harmonic(sv, 0, 159, MOld, Mb, phi[ell][ Old], THa, THb);
             } else { // (coarse transition)
-               for(en = 0; en <= 55; en++) {
-                  sv[en] = sv[en] + ws[en+105] * MOld * cos(Oldw0 * en * ell + phi[ell] [ Old]);
-               }
-               for(en = 56; en <= 105; en++) {
-                  sv[en] = sv[en] + ws[en+105] * MOld * cos(Oldw0 * en * ell + phi[ell][ Old]);
-                  sv[en] = sv[en] + ws[en-55] * MNew * cos(w0 *(en - 160) * ell + phi[ell][ New]);
-               }
-               for(en = 106; en <= 159; en++) {
-                  sv[en] = sv[en] + ws[en-55] * MNew * cos(w0 *(en - 160) * ell + phi[ell][ New]);
-               }
+               // old component fades out over 0..105, new one in over 56..159
+               add_harmonic(sv, 0, 105, MOld, 0, phi[ell][ Old], Oldw0 * ell, 0, ws, 105);
+               add_harmonic(sv, 56, 159, MNew, 0, phi[ell][ New] - w0 * 104 * ell, w0 * ell, 0, ws, -55);
             }
          } else {
-            for(en = 56; en <= 159; en++) {
-               sv[en] = sv[en] + ws[en-55] * MNew * cos(w0 *(en - 160) * ell + phi[ell][ New]);
-            }
+            add_harmonic(sv, 56, 159, MNew, 0, phi[ell][ New] - w0 * 104 * ell, w0 * ell, 0, ws, -55);
          }
       } else {
          if( vee[ell][Old]) {
-            for(en = 0; en <= 105; en++) {
-               sv[en] = sv[en] + ws[en+105] * MOld * cos(Oldw0 * en * ell + phi[ell][ Old]);
-            }
+            add_harmonic(sv, 0, 105, MOld, 0, phi[ell][ Old], Oldw0 * ell, 0, ws, 105);
          }
       }
    }
@@ -3,9 +3,18 @@
  * Provides HTTP API endpoint to receive call data uploads
  * 
  * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Served by the core's HttpService: an epoll front end handing connections
+ * to a worker pool, with keep-alive, full bodies of any size (chunked or
+ * Content-Length) and multipart uploads parsed as they stream in, so many
+ * sites can upload at once. With ssl_cert and ssl_key it serves HTTPS,
+ * tuned by the "tls" object (see TlsOptions): returning sites resume their
+ * session instead of paying for a full handshake per upload.
  */
 
 #include "../src/plugin_api.h"
+#include "../src/http_service.h"
+#include "../src/temp_store.h"
 #include <iostream>
 #include <thread>
 #include <atomic>
@@ -13,11 +22,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
-#include <csignal>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
+#include <cstdio>
 #include <sstream>
 #include <map>
 
@@ -28,12 +33,16 @@ private:
     int listen_port_;
     std::string auth_token_;
     bool verbose_;
+    int worker_threads_;
+    size_t max_connections_;
+    int keep_alive_timeout_s_;
+    size_t upload_buffer_limit_;   // uploads up to this size stay in memory
+    std::string ssl_cert_;         // both set: serve HTTPS
+    std::string ssl_key_;
+    TlsOptions tls_options_;
     
-    // HTTP server
-    int socket_fd_;
-    struct sockaddr_in server_addr_;
-    
-    // Threading
+    // HTTP server; its event loop runs on server_thread_
+    std::unique_ptr<HttpService> server_;
     std::thread server_thread_;
     std::atomic<bool> running_;
     
@@ -55,7 +64,10 @@ public:
         listen_address_("0.0.0.0"), 
         listen_port_(3000),
         verbose_(false),
-        socket_fd_(-1),
+        worker_threads_(8),
+        max_connections_(256),
+        keep_alive_timeout_s_(15),
+        upload_buffer_limit_(16 * 1024 * 1024),
         running_(false),
         max_queue_size_(1000),
         requests_received_(0),
@@ -72,10 +84,7 @@ public:
             return -1;
         }
         
-        if (initialize_socket() != 0) {
-            set_state(Plugin_State::PLUGIN_ERROR);
-            return -1;
-        }
+        initialize_server();
         
         set_state(Plugin_State::PLUGIN_INITIALIZED);
         return 0;
@@ -86,8 +95,24 @@ public:
             return -1;
         }
         
+        // start() returns only when the server stops, or at once if it cannot listen
+        std::atomic<bool> exited(false);
+        server_thread_ = std::thread([this, &exited] {
+            server_->start();
+            exited = true;
+        });
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (!server_->is_running() && !exited && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        if (!server_->is_running()) {
+            std::cerr << "[API_Input] Failed to listen on " << listen_address_ << ":" << listen_port_ << std::endl;
+            server_->stop();
+            server_thread_.join();
+            set_state(Plugin_State::PLUGIN_ERROR);
+            return -1;
+        }
         running_ = true;
-        server_thread_ = std::thread(&API_Input::server_worker, this);
         
         set_state(Plugin_State::PLUGIN_RUNNING);
         
@@ -102,15 +127,11 @@ public:
     virtual int stop() override {
         if (running_) {
             running_ = false;
-            
+            server_->stop();
             if (server_thread_.joinable()) {
                 server_thread_.join();
             }
-            
-            if (socket_fd_ >= 0) {
-                close(socket_fd_);
-                socket_fd_ = -1;
-            }
+            queue_cv_.notify_all();
             
             set_state(Plugin_State::PLUGIN_STOPPED);
             
@@ -148,6 +169,25 @@ public:
             verbose_ = config_data["verbose"];
         }
         
+        worker_threads_ = config_data.value("worker_threads", worker_threads_);
+        max_connections_ = config_data.value("max_connections", max_connections_);
+        keep_alive_timeout_s_ = config_data.value("keep_alive_timeout", keep_alive_timeout_s_);
+        upload_buffer_limit_ = config_data.value("upload_buffer_limit", upload_buffer_limit_);
+        ssl_cert_ = config_data.value("ssl_cert", ssl_cert_);
+        ssl_key_ = config_data.value("ssl_key", ssl_key_);
+        if (config_data.contains("tls")) {
+            const json& tls = config_data["tls"];
+            tls_options_.session_tickets = tls.value("session_tickets", tls_options_.session_tickets);
+            tls_options_.session_cache_size = tls.value("session_cache_size", tls_options_.session_cache_size);
+            tls_options_.session_timeout_s = tls.value("session_timeout", tls_options_.session_timeout_s);
+            tls_options_.ktls = tls.value("ktls", tls_options_.ktls);
+            tls_options_.cipher_list = tls.value("cipher_list", tls_options_.cipher_list);
+            tls_options_.ciphersuites = tls.value("ciphersuites", tls_options_.ciphersuites);
+        }
+        if (config_data.contains("temp_storage")) {
+            TempStore::global().configure(TempPolicy::from_json(config_data["temp_storage"]));
+        }
+        
         return 0;
     }
     
@@ -170,7 +210,7 @@ public:
         return P25_TSBK_Data();
     }
     
-    virtual void set_data_callback(std::function<void(P25_TSBK_Data)> callback) override {
+    virtual void set_data_callback(std::function<void(const P25_TSBK_Data&)> callback) override {
         data_callback_ = callback;
     }
     
@@ -183,142 +223,109 @@ public:
         stats["requests_rejected"] = requests_rejected_.load();
         stats["queue_size"] = data_queue_.size();
         stats["auth_enabled"] = !auth_token_.empty();
+        if (server_) {
+            stats["open_connections"] = server_->open_connections();
+            stats["connections_accepted"] = server_->connections_accepted();
+            stats["connections_rejected"] = server_->connections_rejected();
+            if (!ssl_cert_.empty()) {
+                stats["tls_handshakes"] = server_->tls_handshakes();
+                stats["tls_resumed"] = server_->tls_resumed();
+            }
+        }
         return stats;
     }
     
 private:
-    int initialize_socket() {
-        socket_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-        if (socket_fd_ < 0) {
-            std::cerr << "[API_Input] Failed to create socket: " << strerror(errno) << std::endl;
-            return -1;
+    void initialize_server() {
+        server_.reset(new HttpService(listen_port_));
+        server_->set_bind_address(listen_address_);
+        server_->configure_server(worker_threads_, 128, max_connections_);
+        server_->configure_keep_alive(keep_alive_timeout_s_, 1000);
+        server_->set_upload_buffer_limit(upload_buffer_limit_);
+        server_->enable_debug(verbose_);
+        if (!ssl_cert_.empty() && !ssl_key_.empty()) {
+            server_->enable_tls(ssl_cert_, ssl_key_);
+            server_->configure_tls(tls_options_);
         }
         
-        // Allow address reuse
-        int reuse = 1;
-        if (setsockopt(socket_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
-            std::cerr << "[API_Input] Failed to set SO_REUSEADDR: " << strerror(errno) << std::endl;
-            close(socket_fd_);
-            socket_fd_ = -1;
-            return -1;
-        }
-        
-        // Bind to address
-        memset(&server_addr_, 0, sizeof(server_addr_));
-        server_addr_.sin_family = AF_INET;
-        server_addr_.sin_port = htons(listen_port_);
-        
-        if (inet_pton(AF_INET, listen_address_.c_str(), &server_addr_.sin_addr) <= 0) {
-            std::cerr << "[API_Input] Invalid IP address: " << listen_address_ << std::endl;
-            close(socket_fd_);
-            socket_fd_ = -1;
-            return -1;
-        }
-        
-        if (bind(socket_fd_, (struct sockaddr*)&server_addr_, sizeof(server_addr_)) < 0) {
-            std::cerr << "[API_Input] Failed to bind to " << listen_address_ 
-                      << ":" << listen_port_ << ": " << strerror(errno) << std::endl;
-            close(socket_fd_);
-            socket_fd_ = -1;
-            return -1;
-        }
-        
-        if (listen(socket_fd_, 10) < 0) {
-            std::cerr << "[API_Input] Failed to listen: " << strerror(errno) << std::endl;
-            close(socket_fd_);
-            socket_fd_ = -1;
-            return -1;
-        }
-        
-        return 0;
+        // Handlers run on the server's workers, several at once
+        server_->add_handler("/api/call-upload", [this](const HttpRequest& request, HttpResponse& response) {
+            handle_request(request, response, "POST", &API_Input::handle_call_upload);
+        });
+        server_->add_handler("/api/v1/decode", [this](const HttpRequest& request, HttpResponse& response) {
+            handle_request(request, response, "POST", &API_Input::handle_decode_request);
+        });
+        server_->add_handler("/api/status", [this](const HttpRequest& request, HttpResponse& response) {
+            handle_request(request, response, "GET", &API_Input::handle_status_request);
+        });
+        server_->add_handler("/", [this](const HttpRequest& request, HttpResponse& response) {
+            handle_request(request, response, "GET", &API_Input::handle_root_request);
+        });
     }
     
-    void server_worker() {
-        if (verbose_) {
-            std::cout << "[API_Input] HTTP server listening on " 
-                      << listen_address_ << ":" << listen_port_ << std::endl;
-        }
-        
-        while (running_) {
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            
-            int client_fd = accept(socket_fd_, (struct sockaddr*)&client_addr, &client_len);
-            if (client_fd < 0) {
-                if (running_) {
-                    std::cerr << "[API_Input] Accept error: " << strerror(errno) << std::endl;
-                }
-                continue;
-            }
-            
-            // Handle request in separate thread (for now, handle synchronously)
-            handle_request(client_fd);
-            close(client_fd);
-        }
-    }
+    typedef void (API_Input::*Endpoint)(const HttpRequest&, HttpResponse&);
     
-    void handle_request(int client_fd) {
+    void handle_request(const HttpRequest& request, HttpResponse& response, const char* method, Endpoint endpoint) {
         requests_received_++;
         
-        char buffer[8192];
-        ssize_t bytes_read = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
+        if (verbose_) {
+            std::cout << "[API_Input] Request: " << request.method << " " << request.path
+                      << " (" << request.body.size() << " bytes)" << std::endl;
+        }
         
-        if (bytes_read <= 0) {
+        if (request.method != method) {
+            response.status_code = 405;
+            response.set_text("Method Not Allowed");
             requests_rejected_++;
-            return;
+        } else if (!authorized(request)) {
+            response.status_code = 401;
+            response.set_json("{\"status\": \"error\", \"message\": \"Unauthorized\"}");
+            requests_rejected_++;
+        } else {
+            (this->*endpoint)(request, response);
         }
         
-        buffer[bytes_read] = '\0';
-        std::string request(buffer);
-        
-        if (verbose_) {
-            std::cout << "[API_Input] Received HTTP request: " << bytes_read << " bytes" << std::endl;
+        // Uploads past upload_buffer_limit were spooled to temp files
+        for (const auto& upload : request.file_uploads) {
+            TempStore::global().release(upload.second.temp_path);
         }
-        
-        // Parse HTTP request
-        std::istringstream request_stream(request);
-        std::string method, path, version;
-        request_stream >> method >> path >> version;
-        
-        if (verbose_) {
-            std::cout << "[API_Input] Request: " << method << " " << path << std::endl;
+    }
+    
+    bool authorized(const HttpRequest& request) const {
+        if (auth_token_.empty()) {
+            return true;
         }
-        
-        // Handle different endpoints
-        if (method == "POST" && path == "/api/call-upload") {
-            handle_call_upload(client_fd, request);
-        } else if (method == "POST" && path == "/api/v1/decode") {
-            handle_decode_request(client_fd, request);
-        } else if (method == "GET" && path == "/api/status") {
-            handle_status_request(client_fd);
-        } else if (method == "GET" && path == "/") {
-            // Root endpoint - show service info
-            json response;
-            response["service"] = "trunk-decoder API Input Plugin";
-            response["version"] = "1.0.0";
-            response["endpoints"] = {"/api/status", "/api/call-upload", "/api/v1/decode"};
-            std::string response_body = response.dump(2);
-            send_http_response(client_fd, 200, "OK", "application/json", response_body);
-            requests_processed_++;
-        } else {
-            send_http_response(client_fd, 404, "Not Found", "text/plain", "Not Found");
-            requests_rejected_++;
+        auto header = request.headers.find("Authorization");
+        if (header != request.headers.end() && header->second == "Bearer " + auth_token_) {
+            return true;
         }
+        auto field = request.form_data.find("api_key");
+        return field != request.form_data.end() && field->second == auth_token_;
+    }
+    
+    void handle_root_request(const HttpRequest& request, HttpResponse& response) {
+        // Root endpoint - show service info
+        json info;
+        info["service"] = "trunk-decoder API Input Plugin";
+        info["version"] = "1.0.0";
+        info["endpoints"] = {"/api/status", "/api/call-upload", "/api/v1/decode"};
+        response.set_json(info.dump(2));
+        requests_processed_++;
     }
     
-    void handle_call_upload(int client_fd, const std::string& request) {
+    void handle_call_upload(const HttpRequest& request, HttpResponse& response) {
         // For now, just acknowledge the upload
         // In a real implementation, we would parse the JSON call data
         // and create P25_TSBK_Data objects from it
         
-        json response;
-        response["status"] = "success";
-        response["message"] = "Call data received";
-        response["timestamp"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+        json reply;
+        reply["status"] = "success";
+        reply["message"] = "Call data received";
+        reply["bytes"] = request.body.size();
+        reply["timestamp"] = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::system_clock::now().time_since_epoch()).count();
         
-        std::string response_body = response.dump();
-        send_http_response(client_fd, 200, "OK", "application/json", response_body);
+        response.set_json(reply.dump());
         
         requests_processed_++;
         
@@ -327,7 +334,7 @@ private:
         }
     }
     
-    void handle_decode_request(int client_fd, const std::string& request) {
+    void handle_decode_request(const HttpRequest& request, HttpResponse& response) {
         // Handle trunk-recorder's /api/v1/decode requests
         // This is the main endpoint for receiving voice recordings from trunk-recorder
         
@@ -335,19 +342,25 @@ private:
             std::cout << "[API_Input] Processing decode request from trunk-recorder" << std::endl;
         }
         
-        // TODO: Parse the JSON request body to extract call data
-        // TODO: Extract audio file data and metadata
+        auto p25_file = request.file_uploads.find("p25_file");
+        if (p25_file == request.file_uploads.end()) {
+            response.status_code = 400;
+            response.set_json("{\"status\": \"error\", \"message\": \"No P25 file provided\"}");
+            requests_rejected_++;
+            return;
+        }
+        
         // TODO: Create P25_TSBK_Data objects from the call information
         
-        // For now, acknowledge the request
-        json response;
-        response["status"] = "success";
-        response["message"] = "Call decode request received";
-        response["timestamp"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+        json reply;
+        reply["status"] = "success";
+        reply["message"] = "Call decode request received";
+        reply["filename"] = p25_file->second.original_filename;
+        reply["has_metadata"] = request.form_data.count("metadata") > 0;
+        reply["timestamp"] = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::system_clock::now().time_since_epoch()).count();
         
-        std::string response_body = response.dump();
-        send_http_response(client_fd, 200, "OK", "application/json", response_body);
+        response.set_json(reply.dump());
         
         requests_processed_++;
         
@@ -356,27 +369,10 @@ private:
         }
     }
     
-    void handle_status_request(int client_fd) {
-        json status = get_stats();
-        std::string response_body = status.dump();
-        send_http_response(client_fd, 200, "OK", "application/json", response_body);
-        
+    void handle_status_request(const HttpRequest& request, HttpResponse& response) {
+        response.set_json(get_stats().dump());
         requests_processed_++;
     }
-    
-    void send_http_response(int client_fd, int status_code, const std::string& status_text,
-                           const std::string& content_type, const std::string& body) {
-        std::ostringstream response;
-        response << "HTTP/1.1 " << status_code << " " << status_text << "\r\n";
-        response << "Content-Type: " << content_type << "\r\n";
-        response << "Content-Length: " << body.length() << "\r\n";
-        response << "Connection: close\r\n";
-        response << "\r\n";
-        response << body;
-        
-        std::string response_str = response.str();
-        send(client_fd, response_str.c_str(), response_str.length(), 0);
-    }
 };
 
 // Plugin factory
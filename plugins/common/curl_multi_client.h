@@ -0,0 +1,406 @@
+/*
+ * Shared libcurl multi-handle client for uploader plugins
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * A few event-loop threads each drive one CURLM, so hundreds of uploads
+ * can be in flight without a thread apiece. Connections stay open in each
+ * multi handle's pool and are multiplexed over HTTP/2 where the server
+ * offers it (HTTP/1.1 keep-alive otherwise); DNS results and TLS sessions
+ * are shared between the loops through a CURLSH, so a new connection to a
+ * known host skips the lookup and the full handshake.
+ *
+ * submit() queues a request and returns at once; its completion callback
+ * runs on the loop thread that performed it, so it must be quick. A
+ * request may be delayed (retry backoff) without holding a thread.
+ */
+
+#pragma once
+
+#include <curl/curl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CurlMultiClient {
+public:
+    struct Part {
+        std::string name;
+        std::string value;       // field contents, unless data or file_path is set
+        std::shared_ptr<const std::vector<uint8_t>> data;  // streamed from memory, not copied
+        std::string file_path;   // streamed from disk
+        std::string filename;    // overrides the file's base name; set it for data parts
+        std::string content_type;
+    };
+
+    struct Result {
+        CURLcode curl_code;
+        long http_status;
+        std::string body;
+
+        bool ok() const { return curl_code == CURLE_OK && http_status >= 200 && http_status < 300; }
+        // A rejection will not change on a retry; timeouts and server errors might
+        bool retryable() const {
+            return curl_code != CURLE_OK || http_status >= 500 || http_status == 408 || http_status == 429;
+        }
+        std::string error() const {
+            return curl_code != CURLE_OK ? curl_easy_strerror(curl_code) : "HTTP " + std::to_string(http_status);
+        }
+    };
+
+    struct Request {
+        std::string url;
+        std::string method;                  // empty: POST when there is a body or parts, else GET
+        std::vector<std::string> headers;    // "Name: value"
+        std::string body;                    // posted as-is when parts is empty
+        std::vector<Part> parts;             // multipart/form-data
+        long timeout_seconds = 30;
+        bool verify_ssl = true;
+        std::chrono::steady_clock::time_point not_before;  // default: now
+        std::function<void(const Result&)> on_complete;
+    };
+
+    struct Options {
+        int loops = 2;
+        long max_connections_per_host = 8;   // each carries many HTTP/2 streams
+        long max_total_connections = 64;
+    };
+
+    CurlMultiClient() : CurlMultiClient(Options()) {}
+    explicit CurlMultiClient(const Options& options) : options_(options), running_(false),
+        submitted_(0), completed_(0), failed_(0), in_flight_(0) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        share_ = curl_share_init();
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &CurlMultiClient::share_lock);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &CurlMultiClient::share_unlock);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    ~CurlMultiClient() {
+        stop();
+        curl_share_cleanup(share_);
+        curl_global_cleanup();
+    }
+
+    CurlMultiClient(const CurlMultiClient&) = delete;
+    CurlMultiClient& operator=(const CurlMultiClient&) = delete;
+
+    void start() {
+        std::lock_guard<std::mutex> lifecycle(lifecycle_mutex_);
+        if (running_) {
+            return;
+        }
+        loops_.clear();
+        int count = options_.loops > 0 ? options_.loops : 1;
+        for (int i = 0; i < count; i++) {
+            std::unique_ptr<Loop> loop(new Loop);
+            loop->multi = curl_multi_init();
+            curl_multi_setopt(loop->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+            curl_multi_setopt(loop->multi, CURLMOPT_MAX_HOST_CONNECTIONS, options_.max_connections_per_host);
+            curl_multi_setopt(loop->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, options_.max_total_connections);
+            loops_.push_back(std::move(loop));
+        }
+        running_ = true;
+        for (auto& loop : loops_) {
+            loop->thread = std::thread(&CurlMultiClient::run, this, loop.get());
+        }
+    }
+
+    // Requests still queued or in flight complete with CURLE_ABORTED_BY_CALLBACK
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lifecycle(lifecycle_mutex_);
+            if (!running_) {
+                return;
+            }
+            running_ = false;
+            for (auto& loop : loops_) {
+                curl_multi_wakeup(loop->multi);
+            }
+        }
+        // Completion callbacks may still call submit(), which now refuses
+        for (auto& loop : loops_) {
+            if (loop->thread.joinable()) {
+                loop->thread.join();
+            }
+            curl_multi_cleanup(loop->multi);
+            loop->multi = nullptr;
+        }
+    }
+
+    // False once stopped; the callback is not called then
+    bool submit(Request request) {
+        std::lock_guard<std::mutex> lifecycle(lifecycle_mutex_);
+        if (!running_) {
+            return false;
+        }
+        // Spread by host so each host's requests share one loop's connections
+        Loop& loop = *loops_[std::hash<std::string>()(host_of(request.url)) % loops_.size()];
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            loop.incoming.push_back(std::move(request));
+        }
+        submitted_++;
+        curl_multi_wakeup(loop.multi);
+        return true;
+    }
+
+    uint64_t submitted() const { return submitted_.load(); }
+    uint64_t completed() const { return completed_.load(); }
+    uint64_t failed() const { return failed_.load(); }
+    int in_flight() const { return in_flight_.load(); }
+
+private:
+    struct Transfer {
+        Request request;
+        CURL* easy = nullptr;
+        curl_slist* headers = nullptr;
+        curl_mime* mime = nullptr;
+        Result result{CURLE_OK, 0, {}};
+    };
+
+    struct Loop {
+        CURLM* multi = nullptr;
+        std::thread thread;
+        std::mutex mutex;
+        std::vector<Request> incoming;       // guarded by mutex
+        std::vector<Request> delayed;        // loop thread only
+        std::map<CURL*, std::unique_ptr<Transfer>> active;
+        std::vector<CURL*> idle;             // reset handles, kept for reuse
+    };
+
+    static std::string host_of(const std::string& url) {
+        size_t start = url.find("://");
+        start = start == std::string::npos ? 0 : start + 3;
+        size_t end = url.find_first_of("/?#", start);
+        return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    }
+
+    static size_t write_callback(char* data, size_t size, size_t nmemb, void* userdata) {
+        static_cast<std::string*>(userdata)->append(data, size * nmemb);
+        return size * nmemb;
+    }
+
+    struct BufferCursor {
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        size_t offset;
+    };
+
+    static size_t buffer_read(char* buffer, size_t size, size_t nitems, void* arg) {
+        BufferCursor* cursor = static_cast<BufferCursor*>(arg);
+        size_t count = std::min(size * nitems, cursor->data->size() - cursor->offset);
+        std::copy(cursor->data->begin() + cursor->offset, cursor->data->begin() + cursor->offset + count, buffer);
+        cursor->offset += count;
+        return count;
+    }
+
+    // Rewound when a request is resent, e.g. after a redirect or on a new connection
+    static int buffer_seek(void* arg, curl_off_t offset, int origin) {
+        BufferCursor* cursor = static_cast<BufferCursor*>(arg);
+        if (origin != SEEK_SET || offset < 0 || static_cast<size_t>(offset) > cursor->data->size()) {
+            return CURL_SEEKFUNC_CANTSEEK;
+        }
+        cursor->offset = static_cast<size_t>(offset);
+        return CURL_SEEKFUNC_OK;
+    }
+
+    static void buffer_free(void* arg) {
+        delete static_cast<BufferCursor*>(arg);
+    }
+
+    static void share_lock(CURL*, curl_lock_data data, curl_lock_access, void* userdata) {
+        static_cast<CurlMultiClient*>(userdata)->share_mutexes_[data % SHARE_LOCKS].lock();
+    }
+
+    static void share_unlock(CURL*, curl_lock_data data, void* userdata) {
+        static_cast<CurlMultiClient*>(userdata)->share_mutexes_[data % SHARE_LOCKS].unlock();
+    }
+
+    void begin(Loop& loop, Request request) {
+        std::unique_ptr<Transfer> transfer(new Transfer);
+        transfer->request = std::move(request);
+        const Request& req = transfer->request;
+
+        CURL* easy;
+        if (!loop.idle.empty()) {
+            easy = loop.idle.back();
+            loop.idle.pop_back();
+        } else {
+            easy = curl_easy_init();
+        }
+        transfer->easy = easy;
+
+        curl_easy_setopt(easy, CURLOPT_URL, req.url.c_str());
+        curl_easy_setopt(easy, CURLOPT_SHARE, share_);
+        curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);   // wait to multiplex rather than open another connection
+        curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT, req.timeout_seconds);
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, &CurlMultiClient::write_callback);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, &transfer->result.body);
+        curl_easy_setopt(easy, CURLOPT_PRIVATE, transfer.get());
+        if (!req.verify_ssl) {
+            curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, 0L);
+        }
+        for (const auto& header : req.headers) {
+            transfer->headers = curl_slist_append(transfer->headers, header.c_str());
+        }
+        if (transfer->headers) {
+            curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer->headers);
+        }
+
+        if (!req.parts.empty()) {
+            transfer->mime = curl_mime_init(easy);
+            for (const Part& part : req.parts) {
+                curl_mimepart* mime_part = curl_mime_addpart(transfer->mime);
+                curl_mime_name(mime_part, part.name.c_str());
+                if (part.data) {
+                    // The cursor holds a reference, so the buffer outlives the transfer
+                    curl_mime_data_cb(mime_part, static_cast<curl_off_t>(part.data->size()),
+                                      &CurlMultiClient::buffer_read, &CurlMultiClient::buffer_seek,
+                                      &CurlMultiClient::buffer_free, new BufferCursor{part.data, 0});
+                } else if (!part.file_path.empty()) {
+                    curl_mime_filedata(mime_part, part.file_path.c_str());
+                } else {
+                    curl_mime_data(mime_part, part.value.data(), part.value.size());
+                }
+                if (!part.filename.empty()) {
+                    curl_mime_filename(mime_part, part.filename.c_str());
+                }
+                if (!part.content_type.empty()) {
+                    curl_mime_type(mime_part, part.content_type.c_str());
+                }
+            }
+            curl_easy_setopt(easy, CURLOPT_MIMEPOST, transfer->mime);
+        } else if (!req.body.empty() || req.method == "POST") {
+            curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, static_cast<long>(req.body.size()));
+            curl_easy_setopt(easy, CURLOPT_POSTFIELDS, req.body.data());
+        }
+        if (!req.method.empty() && req.method != "GET" && req.method != "POST") {
+            curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, req.method.c_str());
+        }
+
+        curl_multi_add_handle(loop.multi, easy);
+        loop.active[easy] = std::move(transfer);
+        in_flight_++;
+    }
+
+    void finish(Loop& loop, CURL* easy, CURLcode code) {
+        auto it = loop.active.find(easy);
+        if (it == loop.active.end()) {
+            return;
+        }
+        std::unique_ptr<Transfer> transfer = std::move(it->second);
+        loop.active.erase(it);
+        curl_multi_remove_handle(loop.multi, easy);
+
+        transfer->result.curl_code = code;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &transfer->result.http_status);
+        curl_slist_free_all(transfer->headers);
+        curl_mime_free(transfer->mime);
+        curl_easy_reset(easy);
+        loop.idle.push_back(easy);
+
+        in_flight_--;
+        if (transfer->result.ok()) {
+            completed_++;
+        } else {
+            failed_++;
+        }
+        if (transfer->request.on_complete) {
+            transfer->request.on_complete(transfer->result);
+        }
+    }
+
+    void run(Loop* loop) {
+        while (running_) {
+            std::vector<Request> incoming;
+            {
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                incoming.swap(loop->incoming);
+            }
+            auto now = std::chrono::steady_clock::now();
+            for (auto& request : incoming) {
+                if (request.not_before > now) {
+                    loop->delayed.push_back(std::move(request));
+                } else {
+                    begin(*loop, std::move(request));
+                }
+            }
+            // Delayed requests that have come due; note when the next one does
+            int wait_ms = 1000;
+            for (size_t i = 0; i < loop->delayed.size();) {
+                if (loop->delayed[i].not_before <= now) {
+                    Request request = std::move(loop->delayed[i]);
+                    loop->delayed.erase(loop->delayed.begin() + i);
+                    begin(*loop, std::move(request));
+                    continue;
+                }
+                auto due_ms = std::chrono::duration_cast<std::chrono::milliseconds>(loop->delayed[i].not_before - now).count();
+                wait_ms = std::min<int>(wait_ms, static_cast<int>(due_ms) + 1);
+                i++;
+            }
+
+            int running_handles = 0;
+            curl_multi_perform(loop->multi, &running_handles);
+            CURLMsg* message;
+            int queued = 0;
+            while ((message = curl_multi_info_read(loop->multi, &queued))) {
+                if (message->msg == CURLMSG_DONE) {
+                    finish(*loop, message->easy_handle, message->data.result);
+                }
+            }
+            // Returns early on socket activity, curl's own timers or curl_multi_wakeup()
+            curl_multi_poll(loop->multi, nullptr, 0, wait_ms, nullptr);
+        }
+
+        // Fail whatever is left so callers can release their state
+        while (!loop->active.empty()) {
+            finish(*loop, loop->active.begin()->first, CURLE_ABORTED_BY_CALLBACK);
+        }
+        std::vector<Request> abandoned;
+        {
+            std::lock_guard<std::mutex> lock(loop->mutex);
+            abandoned.swap(loop->incoming);
+        }
+        abandoned.insert(abandoned.end(), std::make_move_iterator(loop->delayed.begin()),
+                         std::make_move_iterator(loop->delayed.end()));
+        loop->delayed.clear();
+        for (auto& request : abandoned) {
+            failed_++;
+            if (request.on_complete) {
+                request.on_complete(Result{CURLE_ABORTED_BY_CALLBACK, 0, {}});
+            }
+        }
+        for (CURL* easy : loop->idle) {
+            curl_easy_cleanup(easy);
+        }
+        loop->idle.clear();
+    }
+
+    static constexpr int SHARE_LOCKS = CURL_LOCK_DATA_LAST;
+
+    Options options_;
+    std::mutex lifecycle_mutex_;   // start/stop against submit; never held while curl works
+    std::atomic<bool> running_;
+    std::vector<std::unique_ptr<Loop>> loops_;
+    CURLSH* share_;
+    std::mutex share_mutexes_[SHARE_LOCKS];
+    std::atomic<uint64_t> submitted_;
+    std::atomic<uint64_t> completed_;
+    std::atomic<uint64_t> failed_;
+    std::atomic<int> in_flight_;
+};
@@ -0,0 +1,122 @@
+/*
+ * P25 shared-memory feed
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * When trunk-recorder runs on the same host, its control channel packets
+ * can skip the loopback UDP socket: it writes them into a ShmRing in POSIX
+ * shared memory that the P25 TSBK shared-memory input plugin reads. The
+ * plugin creates the ring (DEFAULT_NAME unless configured) and keeps it
+ * across restarts; trunk-recorder links nothing of ours and only needs
+ * this header, shm_ring.h and p25c_packet.h.
+ *
+ * Records are FRAME, one P25C packet exactly as it would go out over UDP,
+ * and CALL_START / CALL_END, a CallBoundary. Writing costs a copy into the
+ * mapping and no syscall, except a futex wake when the reader has gone to
+ * sleep on an empty ring. When the ring is full the write fails and the
+ * record is counted as dropped; the writer never waits for the reader.
+ */
+
+#pragma once
+
+#include "../../src/shm_ring.h"
+#include "p25c_packet.h"
+#include <time.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace p25_shm {
+
+const char DEFAULT_NAME[] = "/trunk-decoder-p25";
+
+enum RecordType : uint32_t {
+    FRAME = 1,        // a P25C packet
+    CALL_START = 2,   // a CallBoundary
+    CALL_END = 3,
+};
+
+struct CallBoundary {
+    enum Flags : uint32_t { ENCRYPTED = 1, EMERGENCY = 2 };
+
+    int64_t talkgroup;
+    int64_t source_id;
+    int64_t call_num;
+    int64_t time;       // start or stop time, Unix seconds
+    double frequency;
+    uint32_t flags;
+    uint32_t reserved;
+};
+static_assert(sizeof(CallBoundary) == 48, "CallBoundary is shared between processes; keep its layout fixed");
+
+} // namespace p25_shm
+
+// The trunk-recorder side. Safe to call from several threads; the ring has
+// one producer, so writes are serialised with a lock held for one memcpy.
+class P25ShmFeedWriter {
+public:
+    explicit P25ShmFeedWriter(const std::string& name = p25_shm::DEFAULT_NAME)
+        : name_(name), next_open_s_(0), written_(0), dropped_(0) {}
+
+    // One control channel message; false if it was dropped (ring full, or
+    // no reader has created the ring yet)
+    bool write_frame(const P25_TSBK_Data& packet, const uint8_t* tsbk, uint16_t length) {
+        uint8_t header[p25c::HEADER_SIZE];
+        p25c::write_header(packet, tsbk, length, header);
+        ShmRing::Piece pieces[2] = {{header, sizeof(header)}, {tsbk, length}};
+        return write(p25_shm::FRAME, pieces, 2);
+    }
+
+    bool call_start(const p25_shm::CallBoundary& call) {
+        ShmRing::Piece piece = {&call, sizeof(call)};
+        return write(p25_shm::CALL_START, &piece, 1);
+    }
+
+    bool call_end(const p25_shm::CallBoundary& call) {
+        ShmRing::Piece piece = {&call, sizeof(call)};
+        return write(p25_shm::CALL_END, &piece, 1);
+    }
+
+    bool connected() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ring_.valid();
+    }
+    uint64_t written() const { return written_.load(); }
+    uint64_t dropped() const { return dropped_.load(); }
+
+private:
+    bool write(uint32_t type, const ShmRing::Piece* pieces, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!ring_.valid() && !reopen()) {
+            dropped_++;
+            return false;
+        }
+        if (!ring_.try_write(type, pieces, count)) {
+            dropped_++;
+            return false;
+        }
+        ring_.wake_reader();
+        written_++;
+        return true;
+    }
+
+    // At most once a second, so a missing reader costs a clock read per
+    // record rather than an shm_open()
+    bool reopen() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        if (now.tv_sec < next_open_s_) {
+            return false;
+        }
+        next_open_s_ = now.tv_sec + 1;
+        return ring_.open_named(name_.c_str(), 0, false);
+    }
+
+    std::string name_;
+    std::mutex mutex_;
+    ShmRing ring_;
+    time_t next_open_s_;
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> dropped_;
+};
@@ -0,0 +1,95 @@
+/*
+ * P25C control channel packets
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * The packet trunk-recorder sends for each control channel message, over
+ * UDP or through the shared-memory feed: a fixed 44-byte header in host
+ * byte order (magic "P25C", version, timestamp, sequence, system, site,
+ * frequency, sample rate, payload length, XOR checksum) followed by the
+ * raw TSBK bytes.
+ */
+
+#pragma once
+
+#include "../../src/plugin_api.h"
+#include <cstdint>
+#include <cstring>
+
+namespace p25c {
+
+const uint32_t MAGIC = 0x50323543;  // "P25C"
+const uint32_t VERSION = 1;
+const size_t HEADER_SIZE = 44;
+
+// Shortest packet accepted; a little over the header, as the UDP input has always required
+const size_t MIN_PACKET = sizeof(uint32_t) * 8 + sizeof(uint16_t) * 2 + sizeof(uint64_t) + sizeof(double);
+
+enum Result { OK, TOO_SHORT, BAD_MAGIC, BAD_LENGTH, BAD_CHECKSUM };
+
+inline uint16_t checksum(const uint8_t* data, size_t length) {
+    uint16_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum ^= data[i];
+    }
+    return sum;
+}
+
+// Header fields into packet and the TSBK bytes' start into payload (its
+// length is packet.data_length); tsbk_data and the local fields are left
+// to the caller. A zero checksum is never checked.
+inline Result parse(const uint8_t* data, size_t length, bool validate_checksum, P25_TSBK_Data& packet,
+                    const uint8_t*& payload) {
+    if (length < MIN_PACKET) {
+        return TOO_SHORT;
+    }
+    size_t offset = 0;
+    auto take = [&](void* field, size_t size) {
+        memcpy(field, data + offset, size);
+        offset += size;
+    };
+    take(&packet.magic, sizeof(packet.magic));
+    if (packet.magic != MAGIC) {
+        return BAD_MAGIC;
+    }
+    take(&packet.version, sizeof(packet.version));
+    take(&packet.timestamp_us, sizeof(packet.timestamp_us));
+    take(&packet.sequence_number, sizeof(packet.sequence_number));
+    take(&packet.system_id, sizeof(packet.system_id));
+    take(&packet.site_id, sizeof(packet.site_id));
+    take(&packet.frequency, sizeof(packet.frequency));
+    take(&packet.sample_rate, sizeof(packet.sample_rate));
+    take(&packet.data_length, sizeof(packet.data_length));
+    take(&packet.checksum, sizeof(packet.checksum));
+    if (offset + packet.data_length > length) {
+        return BAD_LENGTH;
+    }
+    payload = data + offset;
+    if (validate_checksum && packet.checksum != 0 && checksum(payload, packet.data_length) != packet.checksum) {
+        return BAD_CHECKSUM;
+    }
+    return OK;
+}
+
+// The header for packet's fields and a payload of length bytes, checksum included
+inline void write_header(const P25_TSBK_Data& packet, const uint8_t* payload, uint16_t length,
+                         uint8_t (&out)[HEADER_SIZE]) {
+    size_t offset = 0;
+    auto put = [&](const void* field, size_t size) {
+        memcpy(out + offset, field, size);
+        offset += size;
+    };
+    uint16_t sum = checksum(payload, length);
+    put(&MAGIC, sizeof(MAGIC));
+    put(&VERSION, sizeof(VERSION));
+    put(&packet.timestamp_us, sizeof(packet.timestamp_us));
+    put(&packet.sequence_number, sizeof(packet.sequence_number));
+    put(&packet.system_id, sizeof(packet.system_id));
+    put(&packet.site_id, sizeof(packet.site_id));
+    put(&packet.frequency, sizeof(packet.frequency));
+    put(&packet.sample_rate, sizeof(packet.sample_rate));
+    put(&length, sizeof(length));
+    put(&sum, sizeof(sum));
+}
+
+} // namespace p25c
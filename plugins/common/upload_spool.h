@@ -0,0 +1,611 @@
+/*
+ * Durable retry log for uploader plugins
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Uploads that still fail once a plugin's own retries run out are
+ * appended to a memory-mapped log file instead of being dropped, and
+ * replayed through the plugin's CurlMultiClient when the endpoint comes
+ * back. The log survives restarts; only a small index (offset, attempts,
+ * next attempt) stays in memory, so a long outage costs disk, up to
+ * max_bytes, rather than heap.
+ *
+ * An entry is a sequence of requests sent one after another, e.g. a
+ * call's metadata POST followed by its audio. Payloads are CBOR with file
+ * parts read in at add() time, so a spooled upload does not depend on the
+ * files still being there. Records carry a checksum; recovery stops at
+ * the first torn one. Completed records are marked in place and the file
+ * is compacted once dead records make room for a new one.
+ *
+ * Replay: every failure puts the spool in outage mode, where one probe is
+ * sent per backoff interval (doubling to max_backoff). The first success
+ * opens it up to replay_batch requests in flight, started no faster than
+ * replay_rate per second, so a recovering server is not hit with the whole
+ * backlog at once. Entries also back off individually, so one upload the
+ * server keeps failing does not hold up the rest.
+ */
+
+#pragma once
+
+#include "curl_multi_client.h"
+#include <nlohmann/json.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class UploadSpool {
+public:
+    struct Options {
+        std::string path;                 // log file, created if missing
+        size_t max_bytes;                 // adds that would grow past this are refused
+        size_t replay_batch;              // replayed entries in flight at once
+        double replay_rate;               // replayed entries started per second
+        std::chrono::seconds min_backoff;
+        std::chrono::seconds max_backoff;
+
+        Options() : max_bytes(size_t(1) << 30), replay_batch(16), replay_rate(10.0),
+                    min_backoff(5), max_backoff(300) {}
+    };
+
+    struct Stats {
+        size_t pending;       // entries waiting for replay
+        size_t file_bytes;
+        uint64_t spooled;     // entries added since open
+        uint64_t replayed;    // entries delivered
+        uint64_t rejected;    // entries the server refused for good, dropped
+        uint64_t refused;     // adds refused: spool full or unreadable file
+        bool backlogged;
+    };
+
+    UploadSpool(CurlMultiClient& client, const Options& options)
+        : client_(client), options_(options), fd_(-1), map_(nullptr), mapped_size_(0),
+          write_offset_(FILE_HEADER), live_bytes_(0), next_id_(1), in_flight_(0),
+          healthy_(true), probe_at_ms_(0), outage_backoff_(options.min_backoff),
+          tokens_(0.0), stopping_(false), spooled_(0), replayed_(0), rejected_(0), refused_(0) {}
+
+    // Waits for replays still in flight; stop the client first, which
+    // completes them, or let them finish
+    ~UploadSpool() {
+        stop();
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return in_flight_ == 0; });
+        unmap();
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    UploadSpool(const UploadSpool&) = delete;
+    UploadSpool& operator=(const UploadSpool&) = delete;
+
+    // Creates the log or recovers pending entries from it
+    bool open() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fd_ = ::open(options_.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            std::cerr << "[UploadSpool] Cannot open " << options_.path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0) {
+            return false;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        if (size < FILE_HEADER) {
+            if (!reset_file()) {
+                return false;
+            }
+        } else if (!map(size) || memcmp(map_, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+            std::cerr << "[UploadSpool] " << options_.path << " is not a spool file" << std::endl;
+            return false;
+        } else {
+            recover();
+        }
+        if (!entries_.empty()) {
+            std::cout << "[UploadSpool] Recovered " << entries_.size() << " pending uploads from "
+                      << options_.path << std::endl;
+        }
+        return true;
+    }
+
+    void start() {
+        stopping_ = false;
+        thread_ = std::thread(&UploadSpool::replay_loop, this);
+    }
+
+    // Stops starting replays; entries in flight finish on the client
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    // Spools requests to be sent in order; false if the spool is full or a
+    // file part cannot be read. Blocks on a synchronous flush of the record.
+    bool add(const std::vector<CurlMultiClient::Request>& requests) {
+        std::vector<uint8_t> payload;
+        if (!encode(requests, payload)) {
+            refused_++;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (fd_ < 0 || append(payload, 0, 0) == 0) {
+            refused_++;
+            return false;
+        }
+        spooled_++;
+        wake_.notify_all();
+        return true;
+    }
+
+    // The endpoint was last seen failing and uploads are waiting: send new
+    // ones straight here rather than through the live retry path
+    bool backlogged() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !healthy_ && !entries_.empty();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats;
+        stats.pending = entries_.size();
+        stats.file_bytes = mapped_size_;
+        stats.spooled = spooled_;
+        stats.replayed = replayed_;
+        stats.rejected = rejected_;
+        stats.refused = refused_;
+        stats.backlogged = !healthy_ && !entries_.empty();
+        return stats;
+    }
+
+private:
+    static constexpr char FILE_MAGIC[8] = {'T', 'D', 'S', 'P', 'O', 'O', 'L', '1'};
+    static constexpr size_t FILE_HEADER = 64;
+    static constexpr size_t GROW_STEP = size_t(1) << 20;
+    static constexpr uint32_t RECORD_MAGIC = 0x4c505344;
+    enum : uint8_t { PENDING = 1, DONE = 2 };
+
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t length;           // payload bytes, before padding
+        uint32_t checksum;         // FNV-1a of the payload
+        uint8_t state;
+        uint8_t reserved[3];
+        uint32_t attempts;
+        uint32_t reserved2;
+        int64_t next_attempt_ms;   // system clock; survives restarts
+    };
+    static_assert(sizeof(RecordHeader) == 32, "spool record header layout");
+
+    struct Entry {
+        size_t offset;
+        uint32_t length;
+        uint32_t attempts;
+        int64_t next_attempt_ms;
+        bool in_flight;
+    };
+
+    static size_t record_size(size_t length) {
+        return sizeof(RecordHeader) + ((length + 7) & ~size_t(7));
+    }
+
+    static uint32_t checksum(const uint8_t* data, size_t length) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < length; i++) {
+            hash = (hash ^ data[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    static int64_t now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    RecordHeader* header_at(size_t offset) {
+        return reinterpret_cast<RecordHeader*>(static_cast<uint8_t*>(map_) + offset);
+    }
+
+    bool map(size_t size) {
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapped == MAP_FAILED) {
+            std::cerr << "[UploadSpool] mmap failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        map_ = mapped;
+        mapped_size_ = size;
+        return true;
+    }
+
+    void unmap() {
+        if (map_) {
+            munmap(map_, mapped_size_);
+            map_ = nullptr;
+            mapped_size_ = 0;
+        }
+    }
+
+    // Empty log of GROW_STEP zeroed bytes
+    bool reset_file() {
+        unmap();
+        if (ftruncate(fd_, 0) != 0 || ftruncate(fd_, GROW_STEP) != 0 || !map(GROW_STEP)) {
+            std::cerr << "[UploadSpool] Cannot size " << options_.path << std::endl;
+            return false;
+        }
+        memcpy(map_, FILE_MAGIC, sizeof(FILE_MAGIC));
+        msync(map_, FILE_HEADER, MS_SYNC);
+        write_offset_ = FILE_HEADER;
+        live_bytes_ = 0;
+        return true;
+    }
+
+    void recover() {
+        size_t offset = FILE_HEADER;
+        while (offset + sizeof(RecordHeader) <= mapped_size_) {
+            RecordHeader* header = header_at(offset);
+            if (header->magic != RECORD_MAGIC || offset + record_size(header->length) > mapped_size_ ||
+                checksum(reinterpret_cast<uint8_t*>(header + 1), header->length) != header->checksum) {
+                break;
+            }
+            if (header->state == PENDING) {
+                entries_[next_id_++] = Entry{offset, header->length, header->attempts,
+                                             header->next_attempt_ms, false};
+                live_bytes_ += record_size(header->length);
+            }
+            offset += record_size(header->length);
+        }
+        write_offset_ = offset;
+    }
+
+    // Returns the new entry's id, or 0 when it does not fit
+    uint64_t append(const std::vector<uint8_t>& payload, uint32_t attempts, int64_t next_attempt_ms) {
+        size_t need = record_size(payload.size());
+        if (write_offset_ + need > mapped_size_ && !make_room(need)) {
+            std::cerr << "[UploadSpool] " << options_.path << " is full, dropping upload" << std::endl;
+            return 0;
+        }
+        RecordHeader* header = header_at(write_offset_);
+        memcpy(header + 1, payload.data(), payload.size());
+        header->length = static_cast<uint32_t>(payload.size());
+        header->checksum = checksum(payload.data(), payload.size());
+        header->state = PENDING;
+        header->attempts = attempts;
+        header->next_attempt_ms = next_attempt_ms;
+        header->magic = RECORD_MAGIC;
+        sync_range(write_offset_, need, MS_SYNC);
+
+        uint64_t id = next_id_++;
+        entries_[id] = Entry{write_offset_, header->length, attempts, next_attempt_ms, false};
+        write_offset_ += need;
+        live_bytes_ += need;
+        return id;
+    }
+
+    void sync_range(size_t offset, size_t length, int flags) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t start = offset & ~(page - 1);
+        msync(static_cast<uint8_t*>(map_) + start, offset + length - start, flags);
+    }
+
+    // Compacts away done records, then grows the file, within max_bytes
+    bool make_room(size_t need) {
+        size_t used = write_offset_ - FILE_HEADER;
+        if (live_bytes_ < used && FILE_HEADER + live_bytes_ + need <= mapped_size_) {
+            return compact();
+        }
+        size_t required = FILE_HEADER + live_bytes_ + need;
+        if (required > options_.max_bytes) {
+            return false;
+        }
+        if (live_bytes_ < used && !compact()) {
+            return false;
+        }
+        size_t size = std::min(options_.max_bytes, std::max(mapped_size_ * 2, required + GROW_STEP));
+        unmap();
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0 || !map(size)) {
+            std::cerr << "[UploadSpool] Cannot grow " << options_.path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Rewrites the pending records, in order, to a new file swapped in by rename
+    bool compact() {
+        std::string temp_path = options_.path + ".tmp";
+        int temp_fd = ::open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (temp_fd < 0) {
+            return false;
+        }
+        std::vector<uint8_t> image(FILE_HEADER, 0);
+        memcpy(image.data(), FILE_MAGIC, sizeof(FILE_MAGIC));
+        std::map<uint64_t, size_t> moved;
+        for (const auto& entry : entries_) {
+            moved[entry.first] = image.size();
+            const uint8_t* record = static_cast<const uint8_t*>(map_) + entry.second.offset;
+            image.insert(image.end(), record, record + record_size(entry.second.length));
+        }
+        size_t size = std::max(mapped_size_, image.size());
+        bool ok = ::write(temp_fd, image.data(), image.size()) == static_cast<ssize_t>(image.size()) &&
+                  ftruncate(temp_fd, static_cast<off_t>(size)) == 0 && fsync(temp_fd) == 0 &&
+                  rename(temp_path.c_str(), options_.path.c_str()) == 0;
+        if (!ok) {
+            ::close(temp_fd);
+            unlink(temp_path.c_str());
+            return false;
+        }
+        unmap();
+        ::close(fd_);
+        fd_ = temp_fd;
+        if (!map(size)) {
+            return false;
+        }
+        for (auto& entry : entries_) {
+            entry.second.offset = moved[entry.first];
+        }
+        write_offset_ = image.size();
+        return true;
+    }
+
+    void mark_done(uint64_t id) {
+        auto it = entries_.find(id);
+        if (it == entries_.end()) {
+            return;
+        }
+        header_at(it->second.offset)->state = DONE;
+        sync_range(it->second.offset, sizeof(RecordHeader), MS_ASYNC);
+        live_bytes_ -= record_size(it->second.length);
+        entries_.erase(it);
+        if (entries_.empty()) {
+            reset_file();
+        }
+    }
+
+    std::chrono::seconds entry_backoff(uint32_t attempts) const {
+        std::chrono::seconds backoff = options_.min_backoff;
+        for (uint32_t i = 1; i < attempts && backoff < options_.max_backoff; i++) {
+            backoff *= 2;
+        }
+        return std::min(backoff, options_.max_backoff);
+    }
+
+    typedef std::shared_ptr<std::vector<CurlMultiClient::Request>> RequestList;
+
+    void replay_loop() {
+        auto last_refill = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            auto now = std::chrono::steady_clock::now();
+            double capacity = static_cast<double>(std::max<size_t>(options_.replay_batch, 1));
+            tokens_ = std::min(capacity, tokens_ + options_.replay_rate *
+                               std::chrono::duration<double>(now - last_refill).count());
+            last_refill = now;
+
+            int64_t wall_ms = now_ms();
+            // One probe at a time while the endpoint is down
+            size_t limit = healthy_ ? options_.replay_batch : (wall_ms >= probe_at_ms_ ? 1 : 0);
+            std::vector<std::pair<uint64_t, RequestList>> batch;
+            for (auto it = entries_.begin(); it != entries_.end() && in_flight_ < limit && tokens_ >= 1.0;) {
+                uint64_t id = it->first;
+                Entry& entry = it->second;
+                ++it;  // claim() may drop the entry
+                if (!entry.in_flight && entry.next_attempt_ms <= wall_ms) {
+                    RequestList requests = claim(id, entry);
+                    if (requests) {
+                        batch.emplace_back(id, requests);
+                    }
+                }
+            }
+            if (!batch.empty()) {
+                // Submitting outside the lock: a refused submit completes at once
+                lock.unlock();
+                for (auto& replay : batch) {
+                    send(replay.first, replay.second, 0);
+                }
+                lock.lock();
+                continue;
+            }
+            wake_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+    }
+
+    // Marks an entry in flight and decodes it; called with mutex_ held
+    RequestList claim(uint64_t id, Entry& entry) {
+        const uint8_t* payload = reinterpret_cast<const uint8_t*>(header_at(entry.offset) + 1);
+        RequestList requests = std::make_shared<std::vector<CurlMultiClient::Request>>();
+        if (checksum(payload, entry.length) != header_at(entry.offset)->checksum ||
+            !decode(payload, entry.length, *requests) || requests->empty()) {
+            std::cerr << "[UploadSpool] Dropping unreadable record in " << options_.path << std::endl;
+            rejected_++;
+            mark_done(id);
+            return nullptr;
+        }
+        entry.in_flight = true;
+        in_flight_++;
+        tokens_ -= 1.0;
+        return requests;
+    }
+
+    void send(uint64_t id, RequestList requests, size_t index) {
+        CurlMultiClient::Request request = (*requests)[index];
+        request.on_complete = [this, id, requests, index](const CurlMultiClient::Result& result) {
+            if (result.ok() && index + 1 < requests->size()) {
+                send(id, requests, index + 1);
+                return;
+            }
+            finished(id, *requests, result.ok() ? requests->size() : index, result);
+        };
+        if (!client_.submit(std::move(request))) {
+            finished(id, *requests, index, CurlMultiClient::Result{CURLE_ABORTED_BY_CALLBACK, 0, ""});
+        }
+    }
+
+    // sent: how many of the entry's requests went through
+    void finished(uint64_t id, const std::vector<CurlMultiClient::Request>& requests, size_t sent,
+                  const CurlMultiClient::Result& result) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        in_flight_--;
+        auto it = entries_.find(id);
+        if (it == entries_.end()) {
+            idle_.notify_all();
+            return;
+        }
+        it->second.in_flight = false;
+        uint32_t attempts = it->second.attempts + 1;
+
+        if (sent == requests.size()) {
+            replayed_++;
+            healthy_ = true;
+            outage_backoff_ = options_.min_backoff;
+            mark_done(id);
+        } else if (!result.retryable()) {
+            std::cerr << "[UploadSpool] " << requests[sent].url << " refused spooled upload: "
+                      << result.error() << std::endl;
+            rejected_++;
+            mark_done(id);
+        } else {
+            int64_t next_attempt_ms = now_ms() + std::chrono::duration_cast<std::chrono::milliseconds>(
+                entry_backoff(attempts)).count();
+            if (sent > 0) {
+                // Keep only what is left so delivered requests are not repeated
+                std::vector<CurlMultiClient::Request> rest(requests.begin() + sent, requests.end());
+                std::vector<uint8_t> payload;
+                mark_done(id);
+                if (encode(rest, payload)) {
+                    append(payload, attempts, next_attempt_ms);
+                }
+            } else {
+                RecordHeader* header = header_at(it->second.offset);
+                header->attempts = it->second.attempts = attempts;
+                header->next_attempt_ms = it->second.next_attempt_ms = next_attempt_ms;
+            }
+            if (healthy_ || now_ms() >= probe_at_ms_) {
+                probe_at_ms_ = now_ms() + std::chrono::duration_cast<std::chrono::milliseconds>(outage_backoff_).count();
+                outage_backoff_ = std::min(outage_backoff_ * 2, options_.max_backoff);
+            }
+            healthy_ = false;
+        }
+        idle_.notify_all();
+        wake_.notify_all();
+    }
+
+    static bool encode(const std::vector<CurlMultiClient::Request>& requests, std::vector<uint8_t>& out) {
+        nlohmann::json doc = nlohmann::json::array();
+        for (const auto& request : requests) {
+            nlohmann::json entry;
+            entry["url"] = request.url;
+            entry["method"] = request.method;
+            entry["headers"] = request.headers;
+            entry["body"] = request.body;
+            entry["timeout"] = request.timeout_seconds;
+            entry["verify_ssl"] = request.verify_ssl;
+            entry["parts"] = nlohmann::json::array();
+            for (const auto& part : request.parts) {
+                nlohmann::json spooled_part;
+                spooled_part["name"] = part.name;
+                spooled_part["content_type"] = part.content_type;
+                spooled_part["filename"] = part.filename;
+                if (part.data) {
+                    spooled_part["data"] = nlohmann::json::binary(std::vector<uint8_t>(*part.data));
+                } else if (!part.file_path.empty()) {
+                    std::ifstream file(part.file_path, std::ios::binary);
+                    if (!file) {
+                        std::cerr << "[UploadSpool] Cannot read " << part.file_path << std::endl;
+                        return false;
+                    }
+                    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                    spooled_part["data"] = nlohmann::json::binary(std::move(bytes));
+                    if (part.filename.empty()) {
+                        size_t slash = part.file_path.find_last_of('/');
+                        spooled_part["filename"] = slash == std::string::npos ? part.file_path : part.file_path.substr(slash + 1);
+                    }
+                } else {
+                    spooled_part["value"] = part.value;
+                }
+                entry["parts"].push_back(spooled_part);
+            }
+            doc.push_back(entry);
+        }
+        out = nlohmann::json::to_cbor(doc);
+        return true;
+    }
+
+    static bool decode(const uint8_t* data, size_t length, std::vector<CurlMultiClient::Request>& requests) {
+        nlohmann::json doc = nlohmann::json::from_cbor(data, data + length, true, false);
+        if (!doc.is_array()) {
+            return false;
+        }
+        for (const auto& entry : doc) {
+            CurlMultiClient::Request request;
+            request.url = entry.value("url", "");
+            request.method = entry.value("method", "");
+            request.headers = entry.value("headers", std::vector<std::string>());
+            request.body = entry.value("body", "");
+            request.timeout_seconds = entry.value("timeout", 30L);
+            request.verify_ssl = entry.value("verify_ssl", true);
+            for (const auto& spooled_part : entry.value("parts", nlohmann::json::array())) {
+                CurlMultiClient::Part part;
+                part.name = spooled_part.value("name", "");
+                part.content_type = spooled_part.value("content_type", "");
+                part.filename = spooled_part.value("filename", "");
+                if (spooled_part.contains("data") && spooled_part["data"].is_binary()) {
+                    part.data = std::make_shared<const std::vector<uint8_t>>(spooled_part["data"].get_binary());
+                } else {
+                    part.value = spooled_part.value("value", "");
+                }
+                request.parts.push_back(part);
+            }
+            requests.push_back(request);
+        }
+        return true;
+    }
+
+    CurlMultiClient& client_;
+    Options options_;
+
+    // Log file; mutex_ guards it, the index and the replay state
+    mutable std::mutex mutex_;
+    int fd_;
+    void* map_;
+    size_t mapped_size_;
+    size_t write_offset_;
+    size_t live_bytes_;
+    std::map<uint64_t, Entry> entries_;   // append order
+    uint64_t next_id_;
+
+    // Replay state
+    size_t in_flight_;
+    bool healthy_;
+    int64_t probe_at_ms_;
+    std::chrono::seconds outage_backoff_;
+    double tokens_;
+    bool stopping_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::thread thread_;
+
+    uint64_t spooled_;
+    uint64_t replayed_;
+    uint64_t rejected_;
+    uint64_t refused_;
+};
@@ -3,10 +3,13 @@
  * Outputs P25 TSBK data to console for debugging and testing
  * 
  * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Messages go out through the asynchronous logger, so a slow console
+ * never holds up the router thread that delivers them.
  */
 
 #include "../src/plugin_api.h"
-#include <iostream>
+#include "../src/logger.h"
 #include <iomanip>
 #include <chrono>
 #include <sstream>
@@ -17,6 +20,7 @@ private:
     bool show_hex_dump_;
     size_t max_hex_bytes_;
     uint64_t messages_processed_;
+    std::ostringstream out_;    // reused for every message
     
 public:
     PLUGIN_INFO("Console Output", "1.0.0", "Dave K9DPD", "Outputs P25 TSBK data to console")
@@ -47,7 +51,7 @@ public:
         set_state(Plugin_State::PLUGIN_RUNNING);
         
         if (verbose_) {
-            std::cout << "[ConsoleOutput] Started console output plugin" << std::endl;
+            LOG_INFO("[ConsoleOutput] Started console output plugin");
         }
         
         return 0;
@@ -58,8 +62,8 @@ public:
             set_state(Plugin_State::PLUGIN_STOPPED);
             
             if (verbose_) {
-                std::cout << "[ConsoleOutput] Stopped console output plugin. " 
-                          << "Messages processed: " << messages_processed_ << std::endl;
+                LOG_INFO("[ConsoleOutput] Stopped console output plugin. "
+                         << "Messages processed: " << messages_processed_);
             }
         }
         
@@ -90,47 +94,79 @@ public:
         }
         
         messages_processed_++;
+        if (Logger::instance().enabled(Logger::LEVEL_INFO)) {
+            reset_output();
+            format_message(data, out_);
+            Logger::instance().write(Logger::LEVEL_INFO, out_.str());
+        }
+        return 0;
+    }
+    
+    // One write to the console for the whole batch
+    virtual size_t process_batch(const P25_TSBK_Data* const* packets, size_t count) override {
+        if (state_ != Plugin_State::PLUGIN_RUNNING) {
+            return count;
+        }
         
+        messages_processed_ += count;
+        if (Logger::instance().enabled(Logger::LEVEL_INFO)) {
+            reset_output();
+            for (size_t i = 0; i < count; i++) {
+                format_message(*packets[i], out_);
+            }
+            Logger::instance().write(Logger::LEVEL_INFO, out_.str());
+        }
+        return 0;
+    }
+    
+    virtual json get_stats() override {
+        json stats = Base_Output_Plugin::get_stats();
+        stats["messages_processed"] = messages_processed_;
+        stats["verbose"] = verbose_;
+        stats["show_hex_dump"] = show_hex_dump_;
+        return stats;
+    }
+    
+private:
+    void reset_output() {
+        out_.str("");
+        out_.clear();
+        out_.flags(std::ios_base::dec | std::ios_base::skipws);
+        out_.fill(' ');
+        out_.precision(6);
+    }
+    
+    void format_message(const P25_TSBK_Data& data, std::ostream& out) {
         // Format timestamp
         auto timestamp = std::chrono::microseconds(data.timestamp_us);
         auto time_t_val = std::chrono::duration_cast<std::chrono::seconds>(timestamp).count();
         auto microseconds = timestamp.count() % 1000000;
         time_t time_val = static_cast<time_t>(time_t_val);
         
-        std::cout << "=== P25 TSBK Message ===" << std::endl;
-        std::cout << "Timestamp: " << std::put_time(std::localtime(&time_val), "%Y-%m-%d %H:%M:%S");
-        std::cout << "." << std::setfill('0') << std::setw(6) << microseconds << std::endl;
-        std::cout << "Sequence:  " << data.sequence_number << std::endl;
-        std::cout << "NAC:       0x" << std::hex << std::uppercase << data.nac << std::dec << std::endl;
-        std::cout << "Site ID:   " << data.site_id << std::endl;
-        std::cout << "Frequency: " << std::fixed << std::setprecision(6) << data.frequency << " Hz" << std::endl;
-        std::cout << "Data Size: " << data.data_length << " bytes" << std::endl;
-        std::cout << "Source:    " << data.source_name << std::endl;
+        out << "=== P25 TSBK Message ===" << std::endl;
+        out << "Timestamp: " << std::put_time(std::localtime(&time_val), "%Y-%m-%d %H:%M:%S");
+        out << "." << std::setfill('0') << std::setw(6) << microseconds << std::endl;
+        out << "Sequence:  " << data.sequence_number << std::endl;
+        out << "NAC:       0x" << std::hex << std::uppercase << (data.system_id & 0xFFF) << std::dec << std::endl;
+        out << "Site ID:   " << data.site_id << std::endl;
+        out << "Frequency: " << std::fixed << std::setprecision(6) << data.frequency << " Hz" << std::endl;
+        out << "Data Size: " << data.data_length << " bytes" << std::endl;
+        out << "Source:    " << data.source_name << std::endl;
         
         if (show_hex_dump_ && !data.tsbk_data.empty()) {
-            std::cout << "Hex Data:  ";
+            out << "Hex Data:  ";
             size_t bytes_to_show = std::min(data.tsbk_data.size(), max_hex_bytes_);
             for (size_t i = 0; i < bytes_to_show; ++i) {
-                std::cout << std::hex << std::setfill('0') << std::setw(2) 
-                          << static_cast<unsigned int>(data.tsbk_data[i]) << " ";
+                out << std::hex << std::setfill('0') << std::setw(2) 
+                    << static_cast<unsigned int>(data.tsbk_data[i]) << " ";
             }
             if (bytes_to_show < data.tsbk_data.size()) {
-                std::cout << "... (" << (data.tsbk_data.size() - bytes_to_show) << " more bytes)";
+                out << "... (" << (data.tsbk_data.size() - bytes_to_show) << " more bytes)";
             }
-            std::cout << std::dec << std::endl;
+            out << std::dec << std::endl;
         }
         
-        std::cout << "========================" << std::endl << std::endl;
-        
-        return 0;
-    }
-    
-    virtual json get_stats() override {
-        json stats = Base_Output_Plugin::get_stats();
-        stats["messages_processed"] = messages_processed_;
-        stats["verbose"] = verbose_;
-        stats["show_hex_dump"] = show_hex_dump_;
-        return stats;
+        out << "========================" << std::endl << std::endl;
     }
 };
 
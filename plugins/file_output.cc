@@ -1,6 +1,13 @@
 /*
  * Generic File Output Plugin
  * Organizes and copies audio files to specified directories with customizable folder structures
+ *
+ * Copies are zero-copy where the filesystems allow: a hard link when source
+ * and destination share a filesystem, a FICLONE reflink (btrfs, xfs) when
+ * linking is refused, and copy_file_range or sendfile, which stay in the
+ * kernel, otherwise. The first method that works is remembered for each
+ * source/destination filesystem pair. Expanded output directories are
+ * created once and cached.
  */
 
 #include "../src/plugin_api.h"
@@ -9,8 +16,18 @@
 #include <sstream>
 #include <filesystem>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iomanip>
+#include <map>
+#include <mutex>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
 
 class File_Output : public Base_Plugin {
 private:
@@ -23,18 +40,33 @@ private:
     std::string p25_output_mode_;
     bool copy_json_;
     bool create_symlinks_;
+    bool allow_hardlinks_;        // off when archive files must not share an inode with the source
+    std::string copy_method_;     // "auto", or one of hardlink/reflink/copy_file_range/sendfile
     bool verbose_;
     
+    // Cheapest way to copy, tried in this order; COPY_SENDFILE always works
+    enum Copy_Method { COPY_HARDLINK, COPY_REFLINK, COPY_RANGE, COPY_SENDFILE };
+    
+    // Learned per (source device, destination device), and directories
+    // already created, with their device
+    std::mutex cache_mutex_;
+    std::map<std::pair<dev_t, dev_t>, Copy_Method> copy_methods_;
+    std::map<std::string, dev_t> output_dirs_;
+    static constexpr size_t MAX_CACHED_DIRS = 4096;
+    
     // Statistics
     int files_processed_;
     int files_successful_;
     int files_failed_;
+    int files_by_method_[COPY_SENDFILE + 1];
+    int buffers_written_;
     
 public:
     PLUGIN_INFO("Generic File Output", "1.0.0", "Dave K9DPD", "Organizes and copies audio files with customizable folder structures")
     
     File_Output() : copy_wav_(true), copy_mp3_(true), copy_m4a_(true), copy_p25_(true), copy_json_(true), 
-                    create_symlinks_(false), verbose_(false), files_processed_(0), files_successful_(0), files_failed_(0) {}
+                    create_symlinks_(false), allow_hardlinks_(true), copy_method_("auto"), verbose_(false),
+                    files_processed_(0), files_successful_(0), files_failed_(0), files_by_method_{}, buffers_written_(0) {}
     
     virtual ~File_Output() = default;
     
@@ -91,6 +123,8 @@ public:
         p25_output_mode_ = config_.value("p25_output_mode", "voice");
         copy_json_ = config_.value("copy_json", true);
         create_symlinks_ = config_.value("create_symlinks", false);
+        allow_hardlinks_ = config_.value("allow_hardlinks", true);
+        copy_method_ = config_.value("copy_method", "auto");
         verbose_ = config_.value("verbose", false);
         enabled_ = config_.value("enabled", true);
         
@@ -105,6 +139,7 @@ public:
             std::cout << "  P25 Output Mode: " << p25_output_mode_ << std::endl;
             std::cout << "  Copy JSON: " << (copy_json_ ? "YES" : "NO") << std::endl;
             std::cout << "  Create Symlinks: " << (create_symlinks_ ? "YES" : "NO") << std::endl;
+            std::cout << "  Copy Method: " << copy_method_ << (allow_hardlinks_ ? "" : " (no hard links)") << std::endl;
         }
         
         return 0;
@@ -115,6 +150,14 @@ public:
     }
     
     virtual int call_data_ready(Call_Data_t call_info) override {
+        return copy_call(call_info);
+    }
+    
+    virtual int call_record_ready(std::shared_ptr<const CallRecord> call) override {
+        return copy_call(*call);
+    }
+    
+    int copy_call(const Call_Data_t& call_info) {
         if (state_ != Plugin_State::PLUGIN_RUNNING || !enabled_) {
             return 0;
         }
@@ -141,7 +184,7 @@ public:
         
         try {
             // Create output directory
-            std::filesystem::create_directories(output_dir);
+            dev_t output_dev = ensure_output_dir(output_dir);
             
             if (verbose_) {
                 std::cout << "[FileOutput] Output directory: " << output_dir << std::endl;
@@ -154,19 +197,19 @@ public:
             
             // Handle WAV files
             if (copy_wav_) {
-                copy_file_if_exists(audio_file, output_dir, "WAV");
+                copy_file_if_exists(audio_file, output_dir, output_dev, "WAV");
             }
             
             // Handle MP3 files
             if (copy_mp3_) {
                 std::string mp3_file = base_dir + "/" + base_name + ".mp3";
-                copy_file_if_exists(mp3_file, output_dir, "MP3");
+                copy_file_if_exists(mp3_file, output_dir, output_dev, "MP3");
             }
             
             // Handle M4A files  
             if (copy_m4a_) {
                 std::string m4a_file = base_dir + "/" + base_name + ".m4a";
-                copy_file_if_exists(m4a_file, output_dir, "M4A");
+                copy_file_if_exists(m4a_file, output_dir, output_dev, "M4A");
             }
             
             // Handle P25 files
@@ -185,7 +228,7 @@ public:
                 // p25_output_mode_ == "always" copies all P25 files
                 
                 if (should_copy_p25) {
-                    copy_file_if_exists(p25_file, output_dir, "P25");
+                    copy_file_if_exists(p25_file, output_dir, output_dev, "P25");
                 }
             }
             
@@ -195,7 +238,17 @@ public:
                     (format == "m4a" && copy_m4a_) ||
                     (format == "wav" && copy_wav_) ||
                     (format == "p25" && copy_p25_)) {
-                    copy_file_if_exists(filepath, output_dir, format);
+                    copy_file_if_exists(filepath, output_dir, output_dev, format);
+                }
+            }
+            
+            // Formats the encoder kept in memory only; this plugin is what
+            // persists them
+            for (const auto& [format, data] : call_info.encoded_audio) {
+                if (data && call_info.converted_files.find(format) == call_info.converted_files.end() &&
+                    ((format == "mp3" && copy_mp3_) || (format == "m4a" && copy_m4a_) ||
+                     (format != "mp3" && format != "m4a" && copy_wav_))) {
+                    write_buffer(*data, std::filesystem::path(output_dir) / (base_name + "." + format), format);
                 }
             }
             
@@ -210,10 +263,7 @@ public:
                         std::cout << "[FileOutput] Created symlink: " << dest_path << std::endl;
                     }
                 } else {
-                    std::filesystem::copy_file(src_path, dest_path, std::filesystem::copy_options::overwrite_existing);
-                    if (verbose_) {
-                        std::cout << "[FileOutput] Copied JSON: " << dest_path << std::endl;
-                    }
+                    copy_file_if_exists(json_file, output_dir, output_dev, "JSON");
                 }
             }
             
@@ -243,6 +293,11 @@ public:
             static_cast<double>(files_successful_) / files_processed_ * 100.0 : 0.0;
         stats["output_base_dir"] = output_base_dir_;
         stats["folder_structure"] = folder_structure_;
+        stats["hardlinked"] = files_by_method_[COPY_HARDLINK];
+        stats["reflinked"] = files_by_method_[COPY_REFLINK];
+        stats["copy_file_range"] = files_by_method_[COPY_RANGE];
+        stats["sendfile"] = files_by_method_[COPY_SENDFILE];
+        stats["buffers_written"] = buffers_written_;
         return stats;
     }
     
@@ -288,8 +343,38 @@ private:
         return std::filesystem::path(output_base_dir_) / path;
     }
     
-    void copy_file_if_exists(const std::string& source_file, const std::string& output_dir, const std::string& format_name) {
-        if (!std::filesystem::exists(source_file)) {
+    // Creates the directory the first time it is seen; returns its device
+    dev_t ensure_output_dir(const std::string& output_dir) {
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            auto it = output_dirs_.find(output_dir);
+            if (it != output_dirs_.end()) {
+                return it->second;
+            }
+        }
+        std::filesystem::create_directories(output_dir);
+        struct stat st;
+        if (stat(output_dir.c_str(), &st) != 0) {
+            throw std::runtime_error("cannot stat " + output_dir);
+        }
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        // Time-based folder structures keep adding directories
+        if (output_dirs_.size() >= MAX_CACHED_DIRS) {
+            output_dirs_.clear();
+        }
+        output_dirs_[output_dir] = st.st_dev;
+        return st.st_dev;
+    }
+    
+    void forget_output_dir(const std::string& output_dir) {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        output_dirs_.erase(output_dir);
+    }
+    
+    void copy_file_if_exists(const std::string& source_file, const std::string& output_dir, dev_t output_dev,
+                             const std::string& format_name) {
+        struct stat src_st;
+        if (stat(source_file.c_str(), &src_st) != 0) {
             return;
         }
         
@@ -302,11 +387,23 @@ private:
                 if (verbose_) {
                     std::cout << "[FileOutput] Created " << format_name << " symlink: " << dest_path << std::endl;
                 }
-            } else {
-                std::filesystem::copy_file(src_path, dest_path, std::filesystem::copy_options::overwrite_existing);
-                if (verbose_) {
-                    std::cout << "[FileOutput] Copied " << format_name << " file: " << dest_path << std::endl;
-                }
+                return;
+            }
+            
+            int result = copy_with_best_method(src_path.string(), dest_path.string(), src_st, output_dev);
+            if (result < 0 && errno == ENOENT) {
+                // The cached directory was removed underneath us (rotation, cleanup)
+                forget_output_dir(output_dir);
+                output_dev = ensure_output_dir(output_dir);
+                result = copy_with_best_method(src_path.string(), dest_path.string(), src_st, output_dev);
+            }
+            if (result < 0) {
+                throw std::runtime_error(strerror(errno));
+            }
+            files_by_method_[result]++;
+            if (verbose_) {
+                std::cout << "[FileOutput] " << method_name(static_cast<Copy_Method>(result)) << " "
+                          << format_name << " file: " << dest_path << std::endl;
             }
         } catch (const std::exception& e) {
             if (verbose_) {
@@ -315,6 +412,126 @@ private:
         }
     }
     
+    // Tries the remembered method for this pair of filesystems, falling
+    // through to cheaper-to-support ones; returns the method that worked,
+    // or -1 with errno set
+    int copy_with_best_method(const std::string& src, const std::string& dest, const struct stat& src_st,
+                              dev_t dest_dev) {
+        std::pair<dev_t, dev_t> key(src_st.st_dev, dest_dev);
+        Copy_Method first = initial_method(src_st.st_dev == dest_dev);
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            auto it = copy_methods_.find(key);
+            if (it != copy_methods_.end()) {
+                first = it->second;
+            }
+        }
+        for (int method = first; method <= COPY_SENDFILE; method++) {
+            if (method == COPY_HARDLINK && (!allow_hardlinks_ || src_st.st_dev != dest_dev)) {
+                continue;
+            }
+            if (try_copy(static_cast<Copy_Method>(method), src, dest, src_st)) {
+                if (method != first) {
+                    std::lock_guard<std::mutex> lock(cache_mutex_);
+                    copy_methods_[key] = static_cast<Copy_Method>(method);
+                }
+                return method;
+            }
+            // Missing directory or source: no other method will do better
+            if (errno == ENOENT) {
+                return -1;
+            }
+        }
+        return -1;
+    }
+    
+    Copy_Method initial_method(bool same_device) const {
+        if (copy_method_ == "reflink") return COPY_REFLINK;
+        if (copy_method_ == "copy_file_range") return COPY_RANGE;
+        if (copy_method_ == "sendfile") return COPY_SENDFILE;
+        return same_device && allow_hardlinks_ ? COPY_HARDLINK : COPY_REFLINK;
+    }
+    
+    static const char* method_name(Copy_Method method) {
+        switch (method) {
+            case COPY_HARDLINK: return "Linked";
+            case COPY_REFLINK: return "Reflinked";
+            case COPY_RANGE: return "Copied (copy_file_range)";
+            default: return "Copied (sendfile)";
+        }
+    }
+    
+    bool try_copy(Copy_Method method, const std::string& src, const std::string& dest, const struct stat& src_st) {
+        if (method == COPY_HARDLINK) {
+            // Overwrites like the copies do
+            if (link(src.c_str(), dest.c_str()) == 0) {
+                return true;
+            }
+            if (errno != EEXIST) {
+                return false;
+            }
+            struct stat dest_st;
+            if (stat(dest.c_str(), &dest_st) == 0 && dest_st.st_ino == src_st.st_ino && dest_st.st_dev == src_st.st_dev) {
+                return true;
+            }
+            return unlink(dest.c_str()) == 0 && link(src.c_str(), dest.c_str()) == 0;
+        }
+        
+        int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            return false;
+        }
+        // Replace rather than write through: dest may be a hard link to another file
+        unlink(dest.c_str());
+        int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            int saved = errno;
+            close(in);
+            errno = saved;
+            return false;
+        }
+        
+        bool ok = false;
+        if (method == COPY_REFLINK) {
+            ok = ioctl(out, FICLONE, in) == 0;
+        } else {
+            off_t remaining = src_st.st_size;
+            ok = true;
+            while (remaining > 0) {
+                ssize_t n = method == COPY_RANGE
+                    ? copy_file_range(in, nullptr, out, nullptr, static_cast<size_t>(remaining), 0)
+                    : sendfile(out, in, nullptr, static_cast<size_t>(remaining));
+                if (n <= 0) {
+                    ok = false;
+                    break;
+                }
+                remaining -= n;
+            }
+        }
+        int saved = errno;
+        close(in);
+        close(out);
+        if (!ok) {
+            unlink(dest.c_str());
+            // Not ENOENT, so the caller moves on to the next method
+            errno = saved == ENOENT ? EIO : saved;
+        }
+        return ok;
+    }
+    
+    void write_buffer(const std::vector<uint8_t>& data, const std::filesystem::path& dest_path, const std::string& format_name) {
+        std::ofstream file(dest_path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (file) {
+            buffers_written_++;
+            if (verbose_) {
+                std::cout << "[FileOutput] Wrote " << format_name << " file: " << dest_path << std::endl;
+            }
+        } else if (verbose_) {
+            std::cout << "[FileOutput] Error writing " << format_name << " file: " << dest_path << std::endl;
+        }
+    }
+    
     void replace_token(std::string& path, const std::string& token, const std::string& value) {
         size_t pos = 0;
         while ((pos = path.find(token, pos)) != std::string::npos) {
@@ -334,4 +551,9 @@ private:
 // Plugin factory function
 extern "C" boost::shared_ptr<Plugin_Api> create_plugin() {
     return boost::shared_ptr<Plugin_Api>(new File_Output());
-}
\ No newline at end of file
+}
+// Built against the CallRecord hooks
+static int plugin_api_version() {
+    return TRUNK_DECODER_PLUGIN_API_VERSION;
+}
+BOOST_DLL_ALIAS(plugin_api_version, plugin_api_version)
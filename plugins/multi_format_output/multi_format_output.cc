@@ -0,0 +1,410 @@
+/*
+ * Multi-Format Output Plugin Implementation
+ */
+
+#include "multi_format_output.h"
+#include "../../src/audio_encoder.h"
+#include "../../src/child_process.h"
+#include "../../src/wav_writer.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+void replace_token(std::string& text, const std::string& token, const std::string& value) {
+    for (size_t pos = text.find(token); pos != std::string::npos; pos = text.find(token, pos + value.size())) {
+        text.replace(pos, token.size(), value);
+    }
+}
+
+// Samples and rate of a 16-bit mono WAV; false for anything else
+bool read_wav_pcm(const std::string& path, std::vector<int16_t>& pcm, int& sample_rate) {
+    std::ifstream file(path, std::ios::binary);
+    uint8_t riff[12];
+    if (!file.read(reinterpret_cast<char*>(riff), sizeof(riff)) || memcmp(riff, "RIFF", 4) != 0 ||
+        memcmp(riff + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    auto u16 = [](const uint8_t* in) { return static_cast<uint32_t>(in[0] | in[1] << 8); };
+    auto u32 = [&u16](const uint8_t* in) { return u16(in) | u16(in + 2) << 16; };
+    bool pcm16_mono = false;
+    uint8_t chunk[8];
+    while (file.read(reinterpret_cast<char*>(chunk), sizeof(chunk))) {
+        uint32_t size = u32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            uint8_t fmt[16];
+            file.read(reinterpret_cast<char*>(fmt), sizeof(fmt));
+            pcm16_mono = u16(fmt) == 1 && u16(fmt + 2) == 1 && u16(fmt + 14) == 16;
+            sample_rate = static_cast<int>(u32(fmt + 4));
+            file.seekg(size - sizeof(fmt) + (size & 1), std::ios::cur);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!pcm16_mono) {
+                return false;
+            }
+            pcm.resize(size / sizeof(int16_t));
+            return static_cast<bool>(file.read(reinterpret_cast<char*>(pcm.data()), pcm.size() * sizeof(int16_t)));
+        } else {
+            file.seekg(size + (size & 1), std::ios::cur);
+        }
+    }
+    return false;
+}
+
+bool write_file(const std::string& path, const std::vector<uint8_t>& bytes) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return file.good();
+}
+
+} // namespace
+
+Multi_Format_Output::Multi_Format_Output()
+    : stream_threads_(1), format_threads_(2), queue_size_(64), script_timeout_(60000), verbose_(false),
+      files_generated_(0), conversions_failed_(0), uploads_completed_(0), calls_queued_(0) {
+}
+
+Multi_Format_Output::~Multi_Format_Output() {
+    stop();
+}
+
+int Multi_Format_Output::init(json config_data) {
+    try {
+        if (parse_config(config_data) != 0) {
+            set_state(Plugin_State::PLUGIN_ERROR);
+            return -1;
+        }
+        set_state(Plugin_State::PLUGIN_INITIALIZED);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "[MultiFormatOutput] Init failed: " << e.what() << std::endl;
+        set_state(Plugin_State::PLUGIN_ERROR);
+        return -1;
+    }
+}
+
+int Multi_Format_Output::parse_config(json config_data) {
+    config_ = config_data;
+    verbose_ = config_.value("verbose", false);
+    stream_threads_ = std::max(1, config_.value("stream_threads", stream_threads_));
+    format_threads_ = std::max(1, config_.value("format_threads", format_threads_));
+    queue_size_ = static_cast<size_t>(std::max(1, config_.value("queue_size", static_cast<int>(queue_size_))));
+    script_timeout_ = std::chrono::milliseconds(config_.value("script_timeout_ms", static_cast<int>(script_timeout_.count())));
+    std::string output_dir = config_.value("output_dir", "./output");
+    std::string filename_template = config_.value("filename_template", "{system}_{talkgroup}_{timestamp}");
+
+    stream_configs_.clear();
+    if (!config_.contains("streams") || !config_["streams"].is_array()) {
+        std::cerr << "[MultiFormatOutput] No streams configured" << std::endl;
+        return -1;
+    }
+    for (const auto& stream : config_["streams"]) {
+        Stream_Config stream_config;
+        stream_config.name = stream.value("name", "");
+        if (stream_config.name.empty()) {
+            std::cerr << "[MultiFormatOutput] Stream without a name" << std::endl;
+            return -1;
+        }
+        stream_config.system_name = stream.value("system_name", stream_config.name);
+        stream_config.upload_script = stream.value("upload_script", "");
+        stream_config.async_processing = stream.value("async_processing", false);
+        if (stream.contains("formats") && stream["formats"].is_object()) {
+            for (const auto& item : stream["formats"].items()) {
+                const json& format = item.value();
+                Format_Config format_config;
+                format_config.enabled = format.value("enabled", true);
+                format_config.bitrate = format.value("bitrate", 0);
+                format_config.output_dir = format.value("output_dir", output_dir);
+                format_config.filename_template = format.value("filename_template", filename_template);
+                format_config.keep_wav = format.value("keep_wav", false);
+                stream_config.formats[item.key()] = format_config;
+            }
+        }
+        stream_configs_[stream_config.name] = stream_config;
+    }
+    return 0;
+}
+
+int Multi_Format_Output::start() {
+    if (state_ != Plugin_State::PLUGIN_INITIALIZED && state_ != Plugin_State::PLUGIN_STOPPED) {
+        return -1;
+    }
+
+    format_pool_.reset(new StagePool<Format_Task>("MultiFormatOutput/formats", format_threads_, queue_size_));
+    format_pool_->start([this](Format_Task task) { encode_format(task); });
+    for (const auto& entry : stream_configs_) {
+        if (!entry.second.async_processing) {
+            continue;
+        }
+        std::unique_ptr<StagePool<std::shared_ptr<Call_Task>>> pool(
+            new StagePool<std::shared_ptr<Call_Task>>("MultiFormatOutput/" + entry.first, stream_threads_, queue_size_));
+        pool->start([this](std::shared_ptr<Call_Task> task) { process_call(std::move(task)); });
+        stream_pools_[entry.first] = std::move(pool);
+    }
+
+    set_state(Plugin_State::PLUGIN_RUNNING);
+    if (verbose_) {
+        std::cout << "[MultiFormatOutput] Started: " << stream_configs_.size() << " streams, "
+                  << stream_pools_.size() << " async, " << format_threads_ << " format threads" << std::endl;
+    }
+    return 0;
+}
+
+int Multi_Format_Output::stop() {
+    // Stream pools first: their calls still hand formats to the format pool
+    for (auto& entry : stream_pools_) {
+        entry.second->stop();
+    }
+    stream_pools_.clear();
+    if (format_pool_) {
+        format_pool_->stop();
+        format_pool_.reset();
+    }
+    if (state_ == Plugin_State::PLUGIN_RUNNING) {
+        set_state(Plugin_State::PLUGIN_STOPPED);
+    }
+    return 0;
+}
+
+int Multi_Format_Output::call_end(Call_Data_t call_info) {
+    (void)call_info;
+    return 0;
+}
+
+int Multi_Format_Output::call_data_ready(Call_Data_t call_info) {
+    if (state_ != Plugin_State::PLUGIN_RUNNING || !enabled_) {
+        return 0;
+    }
+    const Stream_Config* config = get_stream_config(call_info.stream_name);
+    if (!config) {
+        return 0;
+    }
+
+    auto task = std::make_shared<Call_Task>();
+    task->call_info = std::move(call_info);
+    task->config = config;
+
+    auto pool = stream_pools_.find(config->name);
+    if (pool != stream_pools_.end()) {
+        // Blocks while this stream's queue is full; other streams are unaffected
+        if (pool->second->submit(task)) {
+            calls_queued_++;
+            return 0;
+        }
+    }
+    process_call(std::move(task));
+    return 0;
+}
+
+void Multi_Format_Output::process_call(std::shared_ptr<Call_Task> task) {
+    std::vector<std::string> formats;
+    for (const auto& entry : task->config->formats) {
+        if (entry.second.enabled) {
+            formats.push_back(entry.first);
+        }
+    }
+    if (formats.empty()) {
+        return;
+    }
+    if (!decode_call(*task)) {
+        conversions_failed_ += static_cast<int>(formats.size());
+        return;
+    }
+
+    task->formats_pending = static_cast<int>(formats.size());
+    bool parallel = task->config->async_processing && format_pool_;
+    for (const std::string& format : formats) {
+        Format_Task format_task{task, format};
+        if (!parallel || !format_pool_->submit(format_task)) {
+            encode_format(format_task);
+        }
+    }
+}
+
+bool Multi_Format_Output::decode_call(Call_Task& task) {
+    const Call_Data_t& call = task.call_info;
+    auto pcm = std::make_shared<std::vector<int16_t>>();
+
+    // The core has usually written the WAV already; read it back rather than decode again
+    std::string wav_file = call.wav_filename;
+    if (!wav_file.empty() && read_wav_pcm(wav_file, *pcm, task.sample_rate)) {
+        task.pcm = pcm;
+        return true;
+    }
+
+    // Otherwise decode the call's .p25, which sits beside its WAV or JSON
+    std::string base = !wav_file.empty() ? wav_file : std::string(call.json_filename);
+    size_t dot = base.find_last_of('.');
+    if (dot != std::string::npos && base.find('/', dot) == std::string::npos) {
+        base.erase(dot);
+    }
+    std::string p25_file = base + ".p25";
+    std::error_code ec;
+    if (base.empty() || !std::filesystem::exists(p25_file, ec)) {
+        std::cerr << "[MultiFormatOutput] No WAV or P25 file for call on TG " << call.talkgroup << std::endl;
+        return false;
+    }
+    DecoderPool::Lease decoder = decoder_pool_.acquire();
+    DecodeOutputs outputs;
+    outputs.wav = false;
+    outputs.json = false;
+    outputs.pcm = true;
+    if (!decoder->open_p25_file(p25_file) || !decoder->decode_to_outputs(base, outputs)) {
+        std::cerr << "[MultiFormatOutput] Failed to decode " << p25_file << std::endl;
+        return false;
+    }
+    pcm->assign(decoder->get_audio_buffer().begin(), decoder->get_audio_buffer().end());
+    task.sample_rate = decoder->output_sample_rate();
+    task.pcm = pcm;
+    return true;
+}
+
+void Multi_Format_Output::encode_format(const Format_Task& task) {
+    Call_Task& call = *task.call;
+    const Format_Config& config = call.config->formats.at(task.format);
+    const std::string wav_file = call.call_info.wav_filename;
+
+    std::error_code ec;
+    std::filesystem::create_directories(config.output_dir, ec);
+    std::string name = generate_filename(call.call_info, task.format, config.filename_template);
+    std::string output_file = config.output_dir + "/" + name;
+
+    bool ok;
+    auto encoded = call.call_info.encoded_audio.find(task.format);
+    if (encoded != call.call_info.encoded_audio.end() && encoded->second) {
+        ok = write_file(output_file, *encoded->second);
+    } else if (task.format == "wav") {
+        WavWriter writer;
+        ok = writer.open(output_file, WavWriter::Options()) &&
+             writer.write(call.pcm->data(), call.pcm->size(), call.sample_rate);
+    } else {
+        ok = encode_pcm(*call.pcm, call.sample_rate, wav_file, output_file, task.format, config.bitrate);
+    }
+
+    if (ok && config.keep_wav && task.format != "wav" && !wav_file.empty()) {
+        std::string kept = output_file.substr(0, output_file.size() - task.format.size()) + "wav";
+        std::filesystem::copy_file(wav_file, kept, std::filesystem::copy_options::overwrite_existing, ec);
+    }
+
+    if (ok) {
+        files_generated_++;
+        std::lock_guard<std::mutex> lock(call.generated_mutex);
+        call.generated_files[task.format] = output_file;
+    } else {
+        conversions_failed_++;
+        std::cerr << "[MultiFormatOutput] Failed to write " << output_file << std::endl;
+    }
+
+    // The last format of the call uploads them all
+    if (--call.formats_pending == 0) {
+        finish_call(call);
+    }
+}
+
+void Multi_Format_Output::finish_call(Call_Task& task) {
+    if (task.config->upload_script.empty()) {
+        return;
+    }
+    std::map<std::string, std::string> generated;
+    {
+        std::lock_guard<std::mutex> lock(task.generated_mutex);
+        generated = task.generated_files;
+    }
+    if (!generated.empty() && execute_upload_script(task.call_info, generated)) {
+        uploads_completed_++;
+    }
+}
+
+std::string Multi_Format_Output::generate_filename(const Call_Data_t& call_info,
+                                                   const std::string& format,
+                                                   const std::string& template_str) {
+    std::time_t timestamp = call_info.start_time > 0 ? static_cast<std::time_t>(call_info.start_time) : std::time(nullptr);
+    std::string name = template_str;
+    replace_token(name, "{system}", call_info.system_short_name.empty() ? "unknown" : call_info.system_short_name);
+    replace_token(name, "{stream}", call_info.stream_name);
+    replace_token(name, "{talkgroup}", std::to_string(call_info.talkgroup));
+    replace_token(name, "{source}", std::to_string(call_info.source_id));
+    replace_token(name, "{call}", std::to_string(call_info.call_num));
+    replace_token(name, "{timestamp}", std::to_string(static_cast<long long>(timestamp)));
+    return name + "." + format;
+}
+
+bool Multi_Format_Output::convert_audio(const std::string& wav_file,
+                                        const std::string& output_file,
+                                        const std::string& format,
+                                        int bitrate) {
+    std::error_code ec;
+    if (wav_file.empty() || !std::filesystem::exists(wav_file, ec)) {
+        return false;
+    }
+    return AudioEncoder::convert_with_ffmpeg(wav_file, output_file, format, bitrate);
+}
+
+bool Multi_Format_Output::encode_pcm(const std::vector<int16_t>& pcm,
+                                     int sample_rate,
+                                     const std::string& wav_file,
+                                     const std::string& output_file,
+                                     const std::string& format,
+                                     int bitrate) {
+    if (AudioEncoder::has_backend(format)) {
+        return AudioEncoder::encode_file(pcm.data(), pcm.size(), sample_rate, format, bitrate, output_file);
+    }
+    return convert_audio(wav_file, output_file, format, bitrate);
+}
+
+bool Multi_Format_Output::execute_upload_script(const Call_Data_t& call_info,
+                                                const std::map<std::string, std::string>& generated_files) {
+    const Stream_Config* config = get_stream_config(call_info.stream_name);
+    if (!config || config->upload_script.empty()) {
+        return false;
+    }
+    // Same arguments as the job manager's upload stage, run without a shell
+    bool ok = true;
+    for (const auto& entry : generated_files) {
+        ChildProcess::Result result =
+            ChildProcess::run({config->upload_script, entry.second, call_info.json_filename, "1"}, script_timeout_);
+        if (!result.ok()) {
+            ok = false;
+            std::cerr << "[MultiFormatOutput] Upload script failed for " << entry.second
+                      << (result.timed_out ? " (timed out)" : "") << ", exit code " << result.exit_code << std::endl;
+        } else if (verbose_) {
+            std::cout << "[MultiFormatOutput] Uploaded " << entry.second << std::endl;
+        }
+    }
+    return ok;
+}
+
+Multi_Format_Output::Stream_Config* Multi_Format_Output::get_stream_config(const std::string& stream_name) {
+    auto it = stream_configs_.find(stream_name);
+    if (it == stream_configs_.end()) {
+        it = stream_configs_.find("*");
+    }
+    return it != stream_configs_.end() ? &it->second : nullptr;
+}
+
+json Multi_Format_Output::get_stats() {
+    json stats = Base_Plugin::get_stats();
+    stats["files_generated"] = files_generated_.load();
+    stats["conversions_failed"] = conversions_failed_.load();
+    stats["uploads_completed"] = uploads_completed_.load();
+    stats["calls_queued"] = calls_queued_.load();
+    stats["decoders_created"] = decoder_pool_.created();
+    json streams = json::object();
+    for (auto& entry : stream_pools_) {
+        json stream;
+        stream["queued"] = entry.second->queue_size();
+        stream["busy"] = entry.second->busy();
+        stream["processed"] = entry.second->processed();
+        stream["stalls"] = entry.second->stalls();
+        streams[entry.first] = stream;
+    }
+    stats["streams"] = streams;
+    if (format_pool_) {
+        stats["formats_queued"] = format_pool_->queue_size();
+        stats["formats_busy"] = format_pool_->busy();
+    }
+    return stats;
+}
@@ -1,13 +1,37 @@
 /*
  * Multi-Format Output Plugin for trunk-decoder
  * Generates multiple audio formats per stream configuration
+ *
+ * Streams with async_processing get their own bounded call pool, so a
+ * busy stream's backlog never queues another stream's calls behind it.
+ * A call's PCM is loaded once, from its WAV or, when there is none, by
+ * decoding its .p25 on a decoder leased from a shared pool, and every
+ * enabled format is then encoded from that PCM in parallel on the shared
+ * format pool; the last format to finish runs the upload script. Formats
+ * the core already encoded (Call_Data_t::encoded_audio) are written out
+ * rather than encoded again. Other streams run inline on the caller's
+ * thread.
+ *
+ * {"output_dir": "./output", "filename_template": "{system}_{talkgroup}_{timestamp}",
+ *  "stream_threads": 1, "format_threads": 2, "queue_size": 64, "script_timeout_ms": 60000,
+ *  "streams": [{"name": "county", "system_name": "county", "upload_script": "up.sh",
+ *               "async_processing": true,
+ *               "formats": {"opus": {"bitrate": 16}, "mp3": {"output_dir": "/srv/mp3", "keep_wav": true}}}]}
+ *
+ * A stream named "*" takes calls from streams not listed.
  */
 
 #pragma once
 
 #include "../../src/plugin_api.h"
 #include "../../src/p25_decoder.h"
+#include "../../src/decoder_pool.h"
+#include "../../src/stage_pool.h"
+#include <atomic>
+#include <chrono>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 
@@ -18,7 +42,7 @@ private:
         int bitrate;
         std::string output_dir;
         std::string filename_template; // e.g. "{system}_{talkgroup}_{timestamp}"
-        bool keep_wav;
+        bool keep_wav;                 // copy the call's WAV next to this format's file
     };
     
     struct Stream_Config {
@@ -30,12 +54,49 @@ private:
     };
     
     std::map<std::string, Stream_Config> stream_configs_; // stream_name -> config
-    std::map<std::string, P25Decoder> decoders_; // thread-local decoders
+    
+    // One call in flight: decoded once, then shared by its format tasks
+    struct Call_Task {
+        Call_Data_t call_info;
+        const Stream_Config* config;
+        std::shared_ptr<const std::vector<int16_t>> pcm;
+        int sample_rate;
+        std::atomic<int> formats_pending;
+        std::mutex generated_mutex;
+        std::map<std::string, std::string> generated_files; // format -> path
+        
+        Call_Task() : config(nullptr), sample_rate(8000), formats_pending(0) {}
+    };
+    
+    struct Format_Task {
+        std::shared_ptr<Call_Task> call;
+        std::string format;
+    };
+    
+    // Decoders are leased per call instead of a map shared between threads
+    DecoderPool decoder_pool_;
+    
+    // stream_name -> that stream's call pool; async streams only
+    std::map<std::string, std::unique_ptr<StagePool<std::shared_ptr<Call_Task>>>> stream_pools_;
+    std::unique_ptr<StagePool<Format_Task>> format_pool_;
+    int stream_threads_;      // per async stream
+    int format_threads_;      // shared by every stream
+    size_t queue_size_;       // per pool; a full pool blocks the submitter
+    std::chrono::milliseconds script_timeout_;
+    bool verbose_;
     
     // Statistics
     std::atomic<int> files_generated_;
     std::atomic<int> conversions_failed_;
     std::atomic<int> uploads_completed_;
+    std::atomic<int> calls_queued_;
+    
+    // Pipeline: decode (call pool), encode each format (format pool), then
+    // finish_call once formats_pending reaches zero
+    void process_call(std::shared_ptr<Call_Task> task);
+    bool decode_call(Call_Task& task);
+    void encode_format(const Format_Task& task);
+    void finish_call(Call_Task& task);
     
     // Helper methods
     std::string generate_filename(const Call_Data_t& call_info, 
@@ -45,6 +106,13 @@ private:
                       const std::string& output_file,
                       const std::string& format,
                       int bitrate);
+    // In-process encoder when it has a backend for the format, else convert_audio on the WAV
+    bool encode_pcm(const std::vector<int16_t>& pcm,
+                    int sample_rate,
+                    const std::string& wav_file,
+                    const std::string& output_file,
+                    const std::string& format,
+                    int bitrate);
     bool execute_upload_script(const Call_Data_t& call_info,
                              const std::map<std::string, std::string>& generated_files);
     Stream_Config* get_stream_config(const std::string& stream_name);
@@ -59,6 +127,7 @@ public:
     virtual int stop() override;
     virtual int parse_config(json config_data) override;
     
+    // Calls are processed once their files are ready; call_end does nothing
     virtual int call_end(Call_Data_t call_info) override;
     virtual int call_data_ready(Call_Data_t call_info) override;
     
@@ -0,0 +1,497 @@
+/*
+ * Opus Stream Output Plugin
+ * Live per-talkgroup Opus over RTP (RFC 7587), fed from audio_stream
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Each talkgroup gets one Opus encoder and one RTP stream (SSRC, sequence,
+ * timestamp) that outlive the call: the next call on the talkgroup picks
+ * up the same encoder and the same stream with the marker bit set and the
+ * timestamp advanced by the silence in between, so a player keeps one
+ * session open per talkgroup. Audio is encoded in 20 ms packets as it is
+ * decoded and a pacing thread sends them at the rate they were spoken, so
+ * a call decoded faster than real time does not overrun players' jitter
+ * buffers. Streams idle for idle_timeout_s are released.
+ *
+ * Destinations are unicast or multicast host:port per talkgroup
+ * ("destinations"), or, with all_talkgroups, base_address with a port
+ * derived from the talkgroup. An SDP file per stream is written to
+ * sdp_dir for ffplay/VLC/GStreamer or a WebRTC gateway (Janus streaming
+ * plugin) to pick up.
+ *
+ * Needs a build with HAVE_LIBOPUS.
+ */
+
+#include "../src/plugin_api.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef HAVE_LIBOPUS
+#include <opus/opus.h>
+#endif
+
+class Opus_Stream_Output : public Base_Plugin {
+private:
+    static constexpr int SAMPLE_RATE = 8000;
+    static constexpr int RTP_CLOCK = 48000;          // Opus RTP always runs at 48 kHz
+    static constexpr int RTP_HEADER_BYTES = 12;
+    static constexpr int MAX_PACKET_BYTES = 1276;    // largest Opus frame
+
+    struct Stream {
+        long talkgroup;
+        sockaddr_in destination;
+        uint32_t ssrc;
+        uint16_t sequence;
+        uint32_t timestamp;
+        std::vector<int16_t> pending;                // less than one frame left over
+        const Call_Data_t* last_call;
+        std::chrono::system_clock::time_point last_call_start;
+        bool new_talkspurt;
+        std::chrono::steady_clock::time_point next_send;   // when the next packet is due
+        std::chrono::steady_clock::time_point last_audio;
+#ifdef HAVE_LIBOPUS
+        OpusEncoder* encoder;
+#endif
+
+        Stream() : talkgroup(0), destination{}, ssrc(0), sequence(0), timestamp(0),
+                   last_call(nullptr), new_talkspurt(true) {
+#ifdef HAVE_LIBOPUS
+            encoder = nullptr;
+#endif
+        }
+        ~Stream() {
+#ifdef HAVE_LIBOPUS
+            if (encoder) {
+                opus_encoder_destroy(encoder);
+            }
+#endif
+        }
+        Stream(const Stream&) = delete;
+        Stream& operator=(const Stream&) = delete;
+    };
+
+    // Configuration
+    std::map<long, std::string> destinations_;  // talkgroup -> host:port
+    bool all_talkgroups_;
+    std::string base_address_;
+    int base_port_;
+    int port_range_;
+    int ttl_;
+    int bitrate_;
+    int frame_ms_;
+    int complexity_;
+    bool inband_fec_;
+    int idle_timeout_s_;
+    std::string sdp_dir_;
+    bool verbose_;
+
+    int socket_fd_;
+    std::mt19937 ssrc_random_;
+
+    // audio_stream runs on one feeder thread; the lock is for get_stats
+    std::mutex streams_mutex_;
+    std::map<long, std::unique_ptr<Stream>> streams_;
+    std::chrono::steady_clock::time_point last_reap_;
+    
+    // Encoded packets waiting for their send time, earliest first
+    struct Paced_Packet {
+        std::chrono::steady_clock::time_point due;
+        sockaddr_in destination;
+        std::vector<uint8_t> bytes;
+        bool operator>(const Paced_Packet& other) const { return due > other.due; }
+    };
+    std::mutex pacer_mutex_;
+    std::condition_variable pacer_wake_;
+    std::priority_queue<Paced_Packet, std::vector<Paced_Packet>, std::greater<Paced_Packet>> paced_;
+    std::thread pacer_thread_;
+    bool pacer_stopping_;
+
+    // Statistics
+    std::atomic<uint64_t> packets_sent_;
+    std::atomic<uint64_t> bytes_sent_;
+    std::atomic<uint64_t> send_errors_;
+    uint64_t streams_created_;
+    uint64_t streams_released_;
+    uint64_t talkspurts_;
+
+public:
+    PLUGIN_INFO("Opus Stream Output", "1.0.0", "Dave K9DPD", "Streams live per-talkgroup Opus audio over RTP")
+
+    Opus_Stream_Output() : all_talkgroups_(false), base_address_("239.255.25.1"), base_port_(20000),
+                           port_range_(2000), ttl_(1), bitrate_(16), frame_ms_(20), complexity_(5),
+                           inband_fec_(false), idle_timeout_s_(300), verbose_(false), socket_fd_(-1),
+                           ssrc_random_(std::random_device{}()),
+                           last_reap_(std::chrono::steady_clock::now()), pacer_stopping_(false),
+                           packets_sent_(0), bytes_sent_(0), send_errors_(0),
+                           streams_created_(0), streams_released_(0), talkspurts_(0) {}
+
+    virtual ~Opus_Stream_Output() {
+        stop();
+    }
+
+    virtual int init(json config_data) override {
+        if (parse_config(config_data) != 0) {
+            set_state(Plugin_State::PLUGIN_ERROR);
+            return -1;
+        }
+#ifndef HAVE_LIBOPUS
+        std::cerr << "[OpusStreamOutput] Built without libopus; cannot stream" << std::endl;
+        set_state(Plugin_State::PLUGIN_ERROR);
+        return -1;
+#else
+        set_state(Plugin_State::PLUGIN_INITIALIZED);
+        return 0;
+#endif
+    }
+
+    virtual int start() override {
+        if (state_ != Plugin_State::PLUGIN_INITIALIZED && state_ != Plugin_State::PLUGIN_STOPPED) {
+            return -1;
+        }
+        socket_fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (socket_fd_ < 0) {
+            std::cerr << "[OpusStreamOutput] Cannot create socket: " << strerror(errno) << std::endl;
+            set_state(Plugin_State::PLUGIN_ERROR);
+            return -1;
+        }
+        unsigned char ttl = static_cast<unsigned char>(ttl_);
+        setsockopt(socket_fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        // Expedited forwarding, as for any other voice RTP
+        int tos = 0xb8;
+        setsockopt(socket_fd_, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+        pacer_stopping_ = false;
+        pacer_thread_ = std::thread(&Opus_Stream_Output::pacer_loop, this);
+        set_state(Plugin_State::PLUGIN_RUNNING);
+        if (verbose_) {
+            std::cout << "[OpusStreamOutput] Started: " << bitrate_ << " kbps, " << frame_ms_ << " ms frames" << std::endl;
+        }
+        return 0;
+    }
+
+    virtual int stop() override {
+        {
+            std::lock_guard<std::mutex> lock(pacer_mutex_);
+            pacer_stopping_ = true;
+        }
+        pacer_wake_.notify_all();
+        if (pacer_thread_.joinable()) {
+            pacer_thread_.join();
+        }
+        {
+            std::lock_guard<std::mutex> lock(pacer_mutex_);
+            paced_ = {};
+        }
+        {
+            std::lock_guard<std::mutex> lock(streams_mutex_);
+            streams_released_ += streams_.size();
+            streams_.clear();
+        }
+        if (socket_fd_ >= 0) {
+            close(socket_fd_);
+            socket_fd_ = -1;
+        }
+        if (state_ == Plugin_State::PLUGIN_RUNNING) {
+            set_state(Plugin_State::PLUGIN_STOPPED);
+            if (verbose_) {
+                std::cout << "[OpusStreamOutput] Stopped. Packets sent: " << packets_sent_.load() << std::endl;
+            }
+        }
+        return 0;
+    }
+
+    virtual int parse_config(json config_data) override {
+        config_ = config_data;
+
+        destinations_.clear();
+        if (config_.contains("destinations") && config_["destinations"].is_object()) {
+            for (auto& entry : config_["destinations"].items()) {
+                if (entry.value().is_string()) {
+                    destinations_[std::stol(entry.key())] = entry.value().get<std::string>();
+                }
+            }
+        }
+        all_talkgroups_ = config_.value("all_talkgroups", destinations_.empty());
+        base_address_ = config_.value("base_address", base_address_);
+        base_port_ = config_.value("base_port", base_port_);
+        port_range_ = std::max(2, config_.value("port_range", port_range_));
+        ttl_ = config_.value("ttl", ttl_);
+        bitrate_ = config_.value("bitrate", bitrate_);
+        frame_ms_ = config_.value("frame_ms", frame_ms_);
+        complexity_ = config_.value("complexity", complexity_);
+        inband_fec_ = config_.value("inband_fec", inband_fec_);
+        idle_timeout_s_ = config_.value("idle_timeout_s", idle_timeout_s_);
+        sdp_dir_ = config_.value("sdp_dir", "");
+        verbose_ = config_.value("verbose", false);
+        enabled_ = config_.value("enabled", true);
+
+        // Opus frame sizes that divide an LDU's 180 ms evenly
+        if (frame_ms_ != 10 && frame_ms_ != 20 && frame_ms_ != 60) {
+            std::cerr << "[OpusStreamOutput] frame_ms must be 10, 20 or 60" << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    virtual int call_end(Call_Data_t call_info) override {
+        return 0;
+    }
+
+    virtual int call_data_ready(Call_Data_t call_info) override {
+        return 0;
+    }
+
+    virtual int audio_stream(Call_Data_t* call_info, int16_t* samples, int sample_count) override {
+        if (state_ != Plugin_State::PLUGIN_RUNNING || !call_info || sample_count <= 0) {
+            return 0;
+        }
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        reap_idle_streams(now);
+
+        Stream* stream = find_stream(call_info->talkgroup);
+        if (!stream) {
+            return 0;
+        }
+        // The same Call_Data_t address can come back for a later call, so
+        // the processing start time is part of the call's identity
+        if (stream->last_call != call_info || stream->last_call_start != call_info->processing_start) {
+            // A new call: keep the stream and encoder, mark the talkspurt and
+            // let the timestamp cover the silence so players do not see a jump back
+            if (now > stream->next_send) {
+                auto gap = std::chrono::duration_cast<std::chrono::milliseconds>(now - stream->next_send).count();
+                stream->timestamp += static_cast<uint32_t>(gap * (RTP_CLOCK / 1000));
+                stream->next_send = now;
+            }
+            stream->last_call = call_info;
+            stream->last_call_start = call_info->processing_start;
+            stream->pending.clear();
+            stream->new_talkspurt = true;
+            talkspurts_++;
+        }
+        stream->last_audio = now;
+
+        const size_t frame_samples = SAMPLE_RATE * frame_ms_ / 1000;
+        stream->pending.insert(stream->pending.end(), samples, samples + sample_count);
+        size_t offset = 0;
+        while (stream->pending.size() - offset >= frame_samples) {
+            send_frame(*stream, stream->pending.data() + offset, frame_samples);
+            offset += frame_samples;
+        }
+        stream->pending.erase(stream->pending.begin(), stream->pending.begin() + offset);
+        return 0;
+    }
+
+    virtual json get_stats() override {
+        json stats = Base_Plugin::get_stats();
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        stats["active_streams"] = streams_.size();
+        stats["streams_created"] = streams_created_;
+        stats["streams_released"] = streams_released_;
+        stats["talkspurts"] = talkspurts_;
+        stats["packets_sent"] = packets_sent_.load();
+        stats["bytes_sent"] = bytes_sent_.load();
+        stats["send_errors"] = send_errors_.load();
+        json talkgroups = json::object();
+        for (const auto& entry : streams_) {
+            char address[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &entry.second->destination.sin_addr, address, sizeof(address));
+            talkgroups[std::to_string(entry.first)] =
+                std::string(address) + ":" + std::to_string(ntohs(entry.second->destination.sin_port));
+        }
+        stats["talkgroups"] = talkgroups;
+        return stats;
+    }
+
+private:
+    // The talkgroup's stream, created on first audio; nullptr if it is not streamed
+    Stream* find_stream(long talkgroup) {
+        auto existing = streams_.find(talkgroup);
+        if (existing != streams_.end()) {
+            return existing->second.get();
+        }
+
+        std::string host;
+        int port;
+        auto configured = destinations_.find(talkgroup);
+        if (configured != destinations_.end()) {
+            size_t colon = configured->second.rfind(':');
+            if (colon == std::string::npos) {
+                return nullptr;
+            }
+            host = configured->second.substr(0, colon);
+            port = std::atoi(configured->second.c_str() + colon + 1);
+        } else if (all_talkgroups_) {
+            // Even ports, leaving the odd one above for RTCP
+            host = base_address_;
+            port = base_port_ + 2 * static_cast<int>(talkgroup % (port_range_ / 2));
+        } else {
+            return nullptr;
+        }
+
+        std::unique_ptr<Stream> stream(new Stream());
+        stream->talkgroup = talkgroup;
+        stream->destination.sin_family = AF_INET;
+        stream->destination.sin_port = htons(static_cast<uint16_t>(port));
+        if (inet_pton(AF_INET, host.c_str(), &stream->destination.sin_addr) != 1) {
+            std::cerr << "[OpusStreamOutput] Bad destination for TG " << talkgroup << ": " << host << std::endl;
+            return nullptr;
+        }
+        stream->ssrc = ssrc_random_();
+        stream->sequence = static_cast<uint16_t>(ssrc_random_());
+        stream->timestamp = ssrc_random_();
+        stream->next_send = std::chrono::steady_clock::now();
+
+#ifdef HAVE_LIBOPUS
+        int error = OPUS_OK;
+        stream->encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &error);
+        if (error != OPUS_OK || !stream->encoder) {
+            std::cerr << "[OpusStreamOutput] Encoder for TG " << talkgroup << " failed: "
+                      << opus_strerror(error) << std::endl;
+            return nullptr;
+        }
+        opus_encoder_ctl(stream->encoder, OPUS_SET_BITRATE(bitrate_ * 1000));
+        opus_encoder_ctl(stream->encoder, OPUS_SET_COMPLEXITY(complexity_));
+        opus_encoder_ctl(stream->encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+        opus_encoder_ctl(stream->encoder, OPUS_SET_INBAND_FEC(inband_fec_ ? 1 : 0));
+        if (inband_fec_) {
+            opus_encoder_ctl(stream->encoder, OPUS_SET_PACKET_LOSS_PERC(5));
+        }
+#endif
+
+        write_sdp(*stream, host, port);
+        streams_created_++;
+        if (verbose_) {
+            std::cout << "[OpusStreamOutput] Streaming TG " << talkgroup << " to " << host << ":" << port << std::endl;
+        }
+        Stream* raw = stream.get();
+        streams_[talkgroup] = std::move(stream);
+        return raw;
+    }
+
+    void send_frame(Stream& stream, const int16_t* pcm, size_t frame_samples) {
+        uint8_t packet[RTP_HEADER_BYTES + MAX_PACKET_BYTES];
+        int encoded = 0;
+#ifdef HAVE_LIBOPUS
+        encoded = opus_encode(stream.encoder, pcm, static_cast<int>(frame_samples),
+                              packet + RTP_HEADER_BYTES, MAX_PACKET_BYTES);
+#else
+        (void)pcm;
+#endif
+        if (encoded <= 0) {
+            send_errors_++;
+            return;
+        }
+
+        packet[0] = 0x80;                                        // V=2, no padding/extension/CSRC
+        packet[1] = (stream.new_talkspurt ? 0x80 : 0x00) | 111;  // marker, dynamic PT 111
+        packet[2] = static_cast<uint8_t>(stream.sequence >> 8);
+        packet[3] = static_cast<uint8_t>(stream.sequence);
+        uint32_t timestamp = htonl(stream.timestamp);
+        uint32_t ssrc = htonl(stream.ssrc);
+        memcpy(packet + 4, &timestamp, 4);
+        memcpy(packet + 8, &ssrc, 4);
+
+        Paced_Packet paced;
+        paced.due = stream.next_send;
+        paced.destination = stream.destination;
+        paced.bytes.assign(packet, packet + RTP_HEADER_BYTES + encoded);
+        {
+            std::lock_guard<std::mutex> lock(pacer_mutex_);
+            paced_.push(std::move(paced));
+        }
+        pacer_wake_.notify_one();
+
+        stream.new_talkspurt = false;
+        stream.sequence++;
+        stream.timestamp += static_cast<uint32_t>(frame_samples * (RTP_CLOCK / SAMPLE_RATE));
+        stream.next_send += std::chrono::milliseconds(frame_ms_);
+    }
+
+    // Sends each packet at its due time; all talkgroups share the one thread
+    void pacer_loop() {
+        std::unique_lock<std::mutex> lock(pacer_mutex_);
+        while (!pacer_stopping_) {
+            if (paced_.empty()) {
+                pacer_wake_.wait(lock);
+                continue;
+            }
+            auto due = paced_.top().due;
+            if (std::chrono::steady_clock::now() < due) {
+                pacer_wake_.wait_until(lock, due);
+                continue;
+            }
+            Paced_Packet packet = paced_.top();
+            paced_.pop();
+            lock.unlock();
+            ssize_t sent = sendto(socket_fd_, packet.bytes.data(), packet.bytes.size(), MSG_DONTWAIT,
+                                  reinterpret_cast<const sockaddr*>(&packet.destination), sizeof(packet.destination));
+            lock.lock();
+            if (sent == static_cast<ssize_t>(packet.bytes.size())) {
+                packets_sent_++;
+                bytes_sent_ += packet.bytes.size();
+            } else {
+                send_errors_++;
+            }
+        }
+    }
+
+    // Checked at most once a second, from the feeder thread
+    void reap_idle_streams(std::chrono::steady_clock::time_point now) {
+        if (idle_timeout_s_ <= 0 || now - last_reap_ < std::chrono::seconds(1)) {
+            return;
+        }
+        last_reap_ = now;
+        for (auto it = streams_.begin(); it != streams_.end();) {
+            if (now - it->second->last_audio > std::chrono::seconds(idle_timeout_s_)) {
+                if (verbose_) {
+                    std::cout << "[OpusStreamOutput] Released idle TG " << it->first << std::endl;
+                }
+                it = streams_.erase(it);
+                streams_released_++;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void write_sdp(const Stream& stream, const std::string& host, int port) {
+        if (sdp_dir_.empty()) {
+            return;
+        }
+        std::error_code error;
+        std::filesystem::create_directories(sdp_dir_, error);
+        bool multicast = (ntohl(stream.destination.sin_addr.s_addr) >> 28) == 0xe;
+        std::ofstream sdp(sdp_dir_ + "/tg_" + std::to_string(stream.talkgroup) + ".sdp");
+        sdp << "v=0\r\n"
+            << "o=- " << stream.ssrc << " 0 IN IP4 " << host << "\r\n"
+            << "s=trunk-decoder TG " << stream.talkgroup << "\r\n"
+            << "c=IN IP4 " << host << (multicast ? "/" + std::to_string(ttl_) : "") << "\r\n"
+            << "t=0 0\r\n"
+            << "m=audio " << port << " RTP/AVP 111\r\n"
+            << "a=rtpmap:111 opus/48000/2\r\n"
+            << "a=fmtp:111 sprop-maxcapturerate=8000;stereo=0;useinbandfec=" << (inband_fec_ ? 1 : 0) << "\r\n"
+            << "a=ptime:" << frame_ms_ << "\r\n"
+            << "a=recvonly\r\n";
+    }
+};
+
+// Plugin factory function
+extern "C" boost::shared_ptr<Plugin_Api> create_plugin() {
+    return boost::shared_ptr<Plugin_Api>(new Opus_Stream_Output());
+}
@@ -0,0 +1,540 @@
+/*
+ * P25 File Input Plugin
+ * Replays captured P25C control channel packets for backfill and load tests
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * A capture is P25C packets back to back, exactly as trunk-recorder sends
+ * them over UDP or the shared-memory feed (common/p25c_packet.h); several
+ * captures concatenated into one file replay the same way. `path` is a
+ * capture or a directory of them. Every file is mapped read-only and
+ * packets are copied straight out of the mapping, once, into the payload
+ * pool. Files are merged by packet timestamp, so captures of several sites
+ * replay interleaved as they were received.
+ *
+ * `speed` paces the replay against the packets' own timestamps: 1 is real
+ * time, 10 ten times faster, 0 as fast as the router takes them. Packets
+ * are never dropped for speed; a full queue holds the replay back instead,
+ * so the same capture always produces the same packet stream. `seek_s`
+ * starts that far into the capture and `loop` replays it until stopped,
+ * shifting each pass's timestamps and sequence numbers past the last so
+ * downstream ordering and dedupe see new traffic.
+ */
+
+#include "../src/plugin_api.h"
+#include "../src/mpmc_ring.h"
+#include "common/p25c_packet.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <queue>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class P25_File_Input : public Base_Input_Plugin {
+private:
+    // Configuration
+    std::string path_;
+    bool recursive_;
+    std::vector<std::string> extensions_;   // files a directory contributes; empty takes all
+    double speed_;                          // 1 real time, 0 as fast as possible
+    bool loop_;
+    double seek_s_;
+    bool validate_checksums_;
+    size_t max_queue_size_;
+    size_t payload_slot_size_;
+    bool event_notifier_;
+    bool verbose_;
+    
+    // One mapped capture and the packet it is positioned on
+    struct Capture {
+        std::string path;
+        size_t index;
+        const uint8_t* base;
+        size_t size;
+        size_t offset;
+        P25_TSBK_Data packet;
+        const uint8_t* payload;
+        
+        Capture() : index(0), base(nullptr), size(0), offset(0), payload(nullptr) {}
+    };
+    std::vector<std::string> files_;
+    
+    std::unique_ptr<MPMCRing<P25_TSBK_Data>> queue_;
+    std::shared_ptr<PacketPool> payload_pool_;
+    std::thread replay_thread_;
+    std::atomic<bool> running_;
+    std::atomic<bool> finished_;
+    
+    // Statistics
+    std::atomic<uint64_t> packets_replayed_;
+    std::atomic<uint64_t> bytes_replayed_;
+    std::atomic<uint64_t> invalid_packets_;
+    std::atomic<uint64_t> checksum_errors_;
+    std::atomic<uint64_t> passes_;
+    std::atomic<uint64_t> queue_full_waits_;
+    std::atomic<int64_t> position_us_;      // replay position, from the start of the capture
+    std::chrono::steady_clock::time_point started_;
+
+public:
+    PLUGIN_INFO("P25 File Input", "1.0.0", "Dave K9DPD", "Replays captured P25C control channel packets from files")
+    
+    P25_File_Input() :
+        recursive_(false),
+        extensions_({".p25c"}),
+        speed_(1.0),
+        loop_(false),
+        seek_s_(0),
+        validate_checksums_(true),
+        max_queue_size_(4096),
+        payload_slot_size_(256),
+        event_notifier_(true),
+        verbose_(false),
+        running_(false),
+        finished_(false),
+        packets_replayed_(0), bytes_replayed_(0), invalid_packets_(0), checksum_errors_(0),
+        passes_(0), queue_full_waits_(0), position_us_(0) {}
+    
+    virtual ~P25_File_Input() {
+        stop();
+    }
+    
+    virtual int init(json config_data) override {
+        if (parse_config(config_data) != 0) {
+            set_state(Plugin_State::PLUGIN_ERROR);
+            return -1;
+        }
+        
+        if (event_notifier_) {
+            enable_event_notifier();
+        }
+        
+        files_ = list_captures();
+        if (files_.empty()) {
+            std::cerr << "[P25_File_Input] No captures found at " << path_ << std::endl;
+            set_state(Plugin_State::PLUGIN_ERROR);
+            return -1;
+        }
+        
+        queue_ = std::make_unique<MPMCRing<P25_TSBK_Data>>(std::max<size_t>(1, max_queue_size_));
+        payload_pool_ = PacketPool::create(payload_slot_size_, max_queue_size_ + 256);
+        
+        set_state(Plugin_State::PLUGIN_INITIALIZED);
+        return 0;
+    }
+    
+    virtual int start() override {
+        if (state_ != Plugin_State::PLUGIN_INITIALIZED) {
+            return -1;
+        }
+        
+        running_ = true;
+        finished_ = false;
+        started_ = std::chrono::steady_clock::now();
+        replay_thread_ = std::thread(&P25_File_Input::replay_worker, this);
+        
+        set_state(Plugin_State::PLUGIN_RUNNING);
+        
+        if (verbose_) {
+            std::cout << "[P25_File_Input] Replaying " << files_.size() << " capture(s) from " << path_
+                      << " at " << (speed_ > 0 ? std::to_string(speed_) + "x" : std::string("full speed"))
+                      << (loop_ ? ", looping" : "") << std::endl;
+        }
+        
+        return 0;
+    }
+    
+    virtual int stop() override {
+        if (running_) {
+            running_ = false;
+            queue_->wake_all();
+            if (replay_thread_.joinable()) {
+                replay_thread_.join();
+            }
+            
+            set_state(Plugin_State::PLUGIN_STOPPED);
+            
+            if (verbose_) {
+                std::cout << "[P25_File_Input] Stopped. " << packets_replayed_ << " packets replayed" << std::endl;
+            }
+        }
+        
+        return 0;
+    }
+    
+    virtual int parse_config(json config_data) override {
+        config_ = config_data;
+        
+        if (config_data.contains("path")) {
+            path_ = config_data["path"];
+        }
+        if (path_.empty()) {
+            std::cerr << "[P25_File_Input] path is required" << std::endl;
+            return -1;
+        }
+        
+        if (config_data.contains("recursive")) {
+            recursive_ = config_data["recursive"];
+        }
+        
+        if (config_data.contains("extensions")) {
+            extensions_ = config_data["extensions"].get<std::vector<std::string>>();
+        }
+        
+        if (config_data.contains("speed")) {
+            // A number, or "max" for as fast as possible
+            if (config_data["speed"].is_string()) {
+                speed_ = config_data["speed"] == "max" ? 0.0 : std::atof(config_data["speed"].get<std::string>().c_str());
+            } else {
+                speed_ = config_data["speed"];
+            }
+            speed_ = std::max(0.0, speed_);
+        }
+        
+        if (config_data.contains("loop")) {
+            loop_ = config_data["loop"];
+        }
+        
+        if (config_data.contains("seek_s")) {
+            seek_s_ = std::max(0.0, config_data["seek_s"].get<double>());
+        }
+        
+        if (config_data.contains("validate_checksums")) {
+            validate_checksums_ = config_data["validate_checksums"];
+        }
+        
+        if (config_data.contains("max_queue_size")) {
+            max_queue_size_ = config_data["max_queue_size"];
+        }
+        
+        if (config_data.contains("payload_slot_size")) {
+            payload_slot_size_ = config_data["payload_slot_size"];
+        }
+        
+        if (config_data.contains("event_notifier")) {
+            event_notifier_ = config_data["event_notifier"];
+        }
+        
+        if (config_data.contains("verbose")) {
+            verbose_ = config_data["verbose"];
+        }
+        
+        return 0;
+    }
+    
+    virtual bool has_data() override {
+        return queue_ && !queue_->empty();
+    }
+    
+    virtual P25_TSBK_Data get_data() override {
+        P25_TSBK_Data data;
+        if (queue_ && queue_->wait_pop(data, [this] { return running_.load() && !finished_.load(); })) {
+            return data;
+        }
+        // Return empty data once stopped or replayed
+        return P25_TSBK_Data();
+    }
+    
+    virtual void set_data_callback(std::function<void(const P25_TSBK_Data&)> callback) override {
+        data_callback_ = callback;
+    }
+    
+    virtual json get_stats() override {
+        json stats = Base_Input_Plugin::get_stats();
+        stats["path"] = path_;
+        stats["files"] = files_.size();
+        stats["speed"] = speed_;
+        stats["loop"] = loop_;
+        stats["finished"] = finished_.load();
+        stats["passes"] = passes_.load();
+        stats["packets_replayed"] = packets_replayed_.load();
+        stats["bytes_replayed"] = bytes_replayed_.load();
+        stats["invalid_packets"] = invalid_packets_.load();
+        stats["checksum_errors"] = checksum_errors_.load();
+        stats["queue_full_waits"] = queue_full_waits_.load();
+        stats["position_s"] = position_us_.load() / 1e6;
+        if (running_) {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_).count();
+            stats["packets_per_second"] = elapsed > 0 ? packets_replayed_.load() / elapsed : 0.0;
+        }
+        if (queue_) {
+            stats["queue_size"] = queue_->size();
+            stats["queue_capacity"] = queue_->capacity();
+        }
+        return stats;
+    }
+
+private:
+    bool wanted(const std::filesystem::path& file) const {
+        if (extensions_.empty()) {
+            return true;
+        }
+        std::string extension = file.extension().string();
+        return std::find(extensions_.begin(), extensions_.end(), extension) != extensions_.end();
+    }
+    
+    // Sorted, so a directory replays the same way every time
+    std::vector<std::string> list_captures() const {
+        std::vector<std::string> files;
+        std::error_code error;
+        if (!std::filesystem::is_directory(path_, error)) {
+            if (std::filesystem::is_regular_file(path_, error)) {
+                files.push_back(path_);
+            }
+            return files;
+        }
+        auto add = [&](const std::filesystem::directory_entry& entry) {
+            if (entry.is_regular_file(error) && wanted(entry.path())) {
+                files.push_back(entry.path().string());
+            }
+        };
+        if (recursive_) {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(path_, error)) {
+                add(entry);
+            }
+        } else {
+            for (const auto& entry : std::filesystem::directory_iterator(path_, error)) {
+                add(entry);
+            }
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+    
+    bool map_capture(Capture& capture) {
+        int fd = ::open(capture.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "[P25_File_Input] Cannot open " << capture.path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << "[P25_File_Input] Cannot map " << capture.path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        capture.base = static_cast<const uint8_t*>(addr);
+        capture.size = static_cast<size_t>(st.st_size);
+        capture.offset = 0;
+        return true;
+    }
+    
+    static void unmap_capture(Capture& capture) {
+        if (capture.base) {
+            munmap(const_cast<uint8_t*>(capture.base), capture.size);
+            capture.base = nullptr;
+        }
+    }
+    
+    // Position capture on its next valid packet; false at the end. A bad
+    // packet is skipped by looking for the next P25C magic after it.
+    bool advance(Capture& capture) {
+        while (capture.offset < capture.size) {
+            const uint8_t* at = capture.base + capture.offset;
+            size_t remaining = capture.size - capture.offset;
+            p25c::Result result = p25c::parse(at, remaining, validate_checksums_, capture.packet, capture.payload);
+            if (result == p25c::OK) {
+                capture.offset += p25c::HEADER_SIZE + capture.packet.data_length;
+                return true;
+            }
+            if (result == p25c::TOO_SHORT) {
+                invalid_packets_++;
+                break;
+            }
+            if (result == p25c::BAD_CHECKSUM) {
+                checksum_errors_++;
+            } else {
+                invalid_packets_++;
+            }
+            const uint8_t magic[4] = {'C', '5', '2', 'P'};   // p25c::MAGIC in host (little-endian) order
+            const void* next = memmem(at + 1, remaining - 1, magic, sizeof(magic));
+            if (!next) {
+                break;
+            }
+            capture.offset = static_cast<const uint8_t*>(next) - capture.base;
+        }
+        capture.offset = capture.size;
+        return false;
+    }
+    
+    // Sleep until the packet at timestamp_us is due; false if stopped meanwhile
+    bool pace(uint64_t timestamp_us, uint64_t first_us, std::chrono::steady_clock::time_point wall_start) {
+        if (speed_ <= 0 || timestamp_us <= first_us) {
+            return running_;
+        }
+        auto due = wall_start + std::chrono::microseconds(static_cast<int64_t>((timestamp_us - first_us) / speed_));
+        while (running_) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= due) {
+                break;
+            }
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(due - now, std::chrono::milliseconds(100)));
+        }
+        return running_;
+    }
+    
+    // Wait for room rather than drop, so a replay is the same on every run
+    bool deliver(const P25_TSBK_Data& packet) {
+        if (data_callback_ && get_event_fd() < 0) {
+            data_callback_(packet);
+            return true;
+        }
+        bool waited = false;
+        while (!queue_->try_push(packet)) {
+            if (!running_) {
+                return false;
+            }
+            if (!waited) {
+                queue_full_waits_++;
+                waited = true;
+                notify_data_ready();
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        return true;
+    }
+    
+    void replay_worker() {
+        std::vector<Capture> captures(files_.size());
+        for (size_t i = 0; i < files_.size(); i++) {
+            captures[i].path = files_[i];
+            captures[i].index = i;
+            if (!map_capture(captures[i])) {
+                captures[i].size = 0;
+            }
+        }
+        
+        // Earliest timestamp first; the file order breaks ties
+        auto later = [](const Capture* a, const Capture* b) {
+            if (a->packet.timestamp_us != b->packet.timestamp_us) {
+                return a->packet.timestamp_us > b->packet.timestamp_us;
+            }
+            return a->index > b->index;
+        };
+        
+        uint64_t time_shift = 0;        // added to timestamps on each loop pass
+        uint32_t sequence_shift = 0;    // and to sequence numbers
+        uint64_t first_us = 0;
+        uint64_t seek_us = static_cast<uint64_t>(seek_s_ * 1e6);
+        
+        do {
+            std::priority_queue<Capture*, std::vector<Capture*>, decltype(later)> pending(later);
+            for (auto& capture : captures) {
+                capture.offset = 0;
+                if (capture.base && advance(capture)) {
+                    pending.push(&capture);
+                }
+            }
+            if (pending.empty()) {
+                break;
+            }
+            
+            auto wall_start = std::chrono::steady_clock::now();
+            uint64_t pass_first_us = pending.top()->packet.timestamp_us;
+            if (passes_ == 0) {
+                first_us = pass_first_us;
+            }
+            uint64_t last_us = pass_first_us;
+            uint64_t pace_from_us = 0;
+            bool pacing = false;
+            uint32_t min_sequence = UINT32_MAX, max_sequence = 0;
+            bool queued = false;
+            size_t since_notify = 0;
+            
+            while (!pending.empty() && running_) {
+                Capture* capture = pending.top();
+                pending.pop();
+                
+                P25_TSBK_Data packet = capture->packet;
+                const uint8_t* payload = capture->payload;
+                uint64_t original_us = packet.timestamp_us;
+                if (advance(*capture)) {
+                    pending.push(capture);
+                }
+                
+                min_sequence = std::min(min_sequence, packet.sequence_number);
+                max_sequence = std::max(max_sequence, packet.sequence_number);
+                last_us = std::max(last_us, original_us);
+                
+                // seek_s applies to the first pass only
+                if (passes_ == 0 && original_us < pass_first_us + seek_us) {
+                    continue;
+                }
+                if (!pacing) {
+                    // Pace from the first packet actually sent
+                    pace_from_us = original_us;
+                    pacing = true;
+                }
+                
+                if (!pace(original_us, pace_from_us, wall_start)) {
+                    break;
+                }
+                
+                packet.timestamp_us = original_us + time_shift;
+                if (packet.sequence_number != 0) {
+                    packet.sequence_number += sequence_shift;
+                }
+                packet.tsbk_data = payload_pool_->copy(payload, packet.data_length);
+                packet.source_name = get_plugin_name();
+                packet.received_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                position_us_ = static_cast<int64_t>(original_us + time_shift - first_us);
+                
+                if (!deliver(packet)) {
+                    break;
+                }
+                packets_replayed_++;
+                bytes_replayed_ += p25c::HEADER_SIZE + packet.data_length;
+                queued = true;
+                
+                // Wake an event-driven consumer for each run of packets, not for each one
+                if (++since_notify >= 64 || pending.empty() || speed_ > 0) {
+                    notify_data_ready();
+                    since_notify = 0;
+                    queued = false;
+                }
+            }
+            if (queued) {
+                notify_data_ready();
+            }
+            passes_++;
+            
+            // The next pass follows on from this one, a millisecond after its last packet
+            time_shift += last_us - pass_first_us + 1000;
+            if (max_sequence >= min_sequence) {
+                sequence_shift += max_sequence - min_sequence + 1;
+            }
+        } while (loop_ && running_);
+        
+        for (auto& capture : captures) {
+            unmap_capture(capture);
+        }
+        finished_ = true;
+        queue_->wake_all();
+        notify_data_ready();
+        
+        if (verbose_) {
+            std::cout << "[P25_File_Input] Replay finished: " << packets_replayed_ << " packets in "
+                      << passes_ << " pass(es)" << std::endl;
+        }
+    }
+};
+
+// Plugin factory
+extern "C" std::shared_ptr<Input_Plugin_Api> create_input_plugin() {
+    return std::make_shared<P25_File_Input>();
+}
\ No newline at end of file
@@ -0,0 +1,377 @@
+/*
+ * P25 TSBK Shared-Memory Input Plugin
+ * Reads P25C packets and call boundaries from a co-located trunk-recorder
+ * through a POSIX shared-memory ring (common/p25_shm_feed.h)
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ */
+
+#include "../src/plugin_api.h"
+#include "../src/mpmc_ring.h"
+#include "common/p25_shm_feed.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+class P25_TSBK_Shm_Input : public Base_Input_Plugin {
+private:
+    // Configuration
+    std::string shm_name_;
+    size_t ring_bytes_;
+    bool unlink_on_stop_;      // remove the ring on stop(); off so trunk-recorder keeps its mapping
+    bool validate_checksums_;
+    int spin_us_;              // keep polling an empty ring this long before sleeping on it
+    size_t max_queue_size_;
+    size_t payload_slot_size_;
+    bool event_notifier_;
+    bool verbose_;
+    
+    ShmRing ring_;
+    std::unique_ptr<MPMCRing<P25_TSBK_Data>> queue_;
+    std::shared_ptr<PacketPool> payload_pool_;
+    std::thread reader_;
+    std::atomic<bool> running_;
+    uint32_t last_sequence_;
+    
+    // Calls trunk-recorder has started and not yet ended, by call number
+    std::mutex calls_mutex_;
+    std::map<int64_t, p25_shm::CallBoundary> active_calls_;
+    
+    // Statistics
+    std::atomic<uint64_t> packets_received_;
+    std::atomic<uint64_t> packets_dropped_;
+    std::atomic<uint64_t> bytes_received_;
+    std::atomic<uint64_t> checksum_errors_;
+    std::atomic<uint64_t> sequence_errors_;
+    std::atomic<uint64_t> invalid_records_;
+    std::atomic<uint64_t> calls_started_;
+    std::atomic<uint64_t> calls_ended_;
+    std::atomic<uint64_t> batches_;
+    std::atomic<uint64_t> sleeps_;
+
+public:
+    PLUGIN_INFO("P25 TSBK Shared Memory Input", "1.0.0", "Dave K9DPD", "Receives P25 TSBK control data from a co-located trunk-recorder through shared memory")
+    
+    P25_TSBK_Shm_Input() :
+        shm_name_(p25_shm::DEFAULT_NAME),
+        ring_bytes_(4 * 1024 * 1024),
+        unlink_on_stop_(false),
+        validate_checksums_(true),
+        spin_us_(50),
+        max_queue_size_(1000),
+        payload_slot_size_(256),
+        event_notifier_(true),
+        verbose_(false),
+        running_(false),
+        last_sequence_(0),
+        packets_received_(0), packets_dropped_(0), bytes_received_(0), checksum_errors_(0),
+        sequence_errors_(0), invalid_records_(0), calls_started_(0), calls_ended_(0),
+        batches_(0), sleeps_(0) {}
+    
+    virtual ~P25_TSBK_Shm_Input() {
+        stop();
+    }
+    
+    virtual int init(json config_data) override {
+        if (parse_config(config_data) != 0) {
+            set_state(Plugin_State::PLUGIN_ERROR);
+            return -1;
+        }
+        
+        if (event_notifier_) {
+            enable_event_notifier();
+        }
+        
+        // A ring left by an earlier run is kept, along with whatever
+        // trunk-recorder wrote into it while we were away
+        if (!ring_.open_named(shm_name_.c_str(), ring_bytes_, true)) {
+            std::cerr << "[P25_TSBK_Shm_Input] Failed to open shared memory " << shm_name_ << ": "
+                      << strerror(errno) << std::endl;
+            set_state(Plugin_State::PLUGIN_ERROR);
+            return -1;
+        }
+        
+        queue_ = std::make_unique<MPMCRing<P25_TSBK_Data>>(std::max<size_t>(1, max_queue_size_));
+        payload_pool_ = PacketPool::create(payload_slot_size_, max_queue_size_ + 256);
+        
+        set_state(Plugin_State::PLUGIN_INITIALIZED);
+        return 0;
+    }
+    
+    virtual int start() override {
+        if (state_ != Plugin_State::PLUGIN_INITIALIZED) {
+            return -1;
+        }
+        
+        running_ = true;
+        reader_ = std::thread(&P25_TSBK_Shm_Input::reader_worker, this);
+        
+        set_state(Plugin_State::PLUGIN_RUNNING);
+        
+        if (verbose_) {
+            std::cout << "[P25_TSBK_Shm_Input] Reading " << shm_name_ << " (" << ring_.capacity()
+                      << " byte ring)" << std::endl;
+        }
+        
+        return 0;
+    }
+    
+    virtual int stop() override {
+        if (running_) {
+            running_ = false;
+            queue_->wake_all();
+            if (reader_.joinable()) {
+                reader_.join();
+            }
+            if (unlink_on_stop_) {
+                ShmRing::unlink_named(shm_name_.c_str());
+            }
+            
+            set_state(Plugin_State::PLUGIN_STOPPED);
+            
+            if (verbose_) {
+                std::cout << "[P25_TSBK_Shm_Input] Stopped. " << packets_received_ << " received, "
+                          << packets_dropped_ << " dropped" << std::endl;
+            }
+        }
+        
+        return 0;
+    }
+    
+    virtual int parse_config(json config_data) override {
+        config_ = config_data;
+        
+        if (config_data.contains("shm_name")) {
+            shm_name_ = config_data["shm_name"];
+            if (shm_name_.empty() || shm_name_[0] != '/') {
+                shm_name_ = "/" + shm_name_;
+            }
+        }
+        
+        if (config_data.contains("ring_bytes")) {
+            ring_bytes_ = config_data["ring_bytes"];
+        }
+        
+        if (config_data.contains("unlink_on_stop")) {
+            unlink_on_stop_ = config_data["unlink_on_stop"];
+        }
+        
+        if (config_data.contains("validate_checksums")) {
+            validate_checksums_ = config_data["validate_checksums"];
+        }
+        
+        if (config_data.contains("spin_us")) {
+            spin_us_ = std::max(0, config_data["spin_us"].get<int>());
+        }
+        
+        if (config_data.contains("max_queue_size")) {
+            max_queue_size_ = config_data["max_queue_size"];
+        }
+        
+        if (config_data.contains("payload_slot_size")) {
+            payload_slot_size_ = config_data["payload_slot_size"];
+        }
+        
+        if (config_data.contains("event_notifier")) {
+            event_notifier_ = config_data["event_notifier"];
+        }
+        
+        if (config_data.contains("verbose")) {
+            verbose_ = config_data["verbose"];
+        }
+        
+        return 0;
+    }
+    
+    virtual bool has_data() override {
+        return queue_ && !queue_->empty();
+    }
+    
+    virtual P25_TSBK_Data get_data() override {
+        P25_TSBK_Data data;
+        if (queue_ && queue_->wait_pop(data, [this] { return running_.load(); })) {
+            return data;
+        }
+        // Return empty data if stopped
+        return P25_TSBK_Data();
+    }
+    
+    virtual void set_data_callback(std::function<void(const P25_TSBK_Data&)> callback) override {
+        data_callback_ = callback;
+    }
+    
+    virtual json get_stats() override {
+        json stats = Base_Input_Plugin::get_stats();
+        stats["shm_name"] = shm_name_;
+        if (ring_.valid()) {
+            stats["ring_bytes"] = ring_.capacity();
+            stats["ring_used"] = ring_.used();
+        }
+        stats["packets_received"] = packets_received_.load();
+        stats["packets_dropped"] = packets_dropped_.load();
+        stats["bytes_received"] = bytes_received_.load();
+        stats["checksum_errors"] = checksum_errors_.load();
+        stats["sequence_errors"] = sequence_errors_.load();
+        stats["invalid_records"] = invalid_records_.load();
+        stats["calls_started"] = calls_started_.load();
+        stats["calls_ended"] = calls_ended_.load();
+        {
+            std::lock_guard<std::mutex> lock(calls_mutex_);
+            stats["active_calls"] = active_calls_.size();
+        }
+        stats["batches"] = batches_.load();
+        stats["sleeps"] = sleeps_.load();
+        stats["event_notifier"] = get_event_fd() >= 0;
+        if (queue_) {
+            stats["queue_size"] = queue_->size();
+            stats["queue_capacity"] = queue_->capacity();
+        }
+        if (payload_pool_) {
+            stats["payload_slots"] = payload_pool_->slot_count();
+            stats["payload_slots_free"] = payload_pool_->available();
+            stats["payload_heap_fallbacks"] = payload_pool_->heap_fallbacks();
+        }
+        return stats;
+    }
+
+private:
+    void reader_worker() {
+        P25_TSBK_Data tsbk_data;
+        auto idle_since = std::chrono::steady_clock::now();
+        
+        while (running_) {
+            // Drain what is there, then give the space back in one store
+            uint64_t cursor = ring_.read_cursor();
+            ShmRing::Record record;
+            bool queued = false;
+            bool full = false;
+            size_t records = 0;
+            uint64_t consumed = cursor;
+            while (ring_.next(cursor, record)) {
+                if (record.type == p25_shm::FRAME && queue_->capacity() <= queue_->size()) {
+                    // Leave it in the ring; trunk-recorder sees the ring fill instead
+                    full = true;
+                    break;
+                }
+                queued |= handle_record(record, tsbk_data);
+                consumed = cursor;
+                records++;
+            }
+            if (records) {
+                ring_.release(consumed);
+                batches_++;
+                idle_since = std::chrono::steady_clock::now();
+            }
+            
+            // One wakeup per batch for an event-driven consumer
+            if (queued) {
+                notify_data_ready();
+            }
+            
+            if (full) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            } else if (!records) {
+                // Spin briefly (a burst usually has more coming), then sleep
+                // on the ring until trunk-recorder writes again
+                auto idle = std::chrono::steady_clock::now() - idle_since;
+                if (idle >= std::chrono::microseconds(spin_us_)) {
+                    sleeps_++;
+                    ring_.wait_for_data(consumed, 100);
+                    idle_since = std::chrono::steady_clock::now();
+                }
+            }
+        }
+    }
+    
+    // True if a packet went onto the queue
+    bool handle_record(const ShmRing::Record& record, P25_TSBK_Data& tsbk_data) {
+        switch (record.type) {
+            case p25_shm::FRAME:
+                bytes_received_ += record.length;
+                if (!parse_frame(record.data, record.length, tsbk_data)) {
+                    return false;
+                }
+                packets_received_++;
+                if (!queue_->try_push(tsbk_data)) {
+                    packets_dropped_++;
+                    return false;
+                }
+                if (data_callback_) {
+                    data_callback_(tsbk_data);
+                }
+                return true;
+            case p25_shm::CALL_START:
+            case p25_shm::CALL_END:
+                handle_call(record);
+                return false;
+            default:
+                invalid_records_++;
+                if (verbose_) {
+                    std::cout << "[P25_TSBK_Shm_Input] Unknown record type " << record.type << std::endl;
+                }
+                return false;
+        }
+    }
+    
+    void handle_call(const ShmRing::Record& record) {
+        p25_shm::CallBoundary call;
+        if (record.length != sizeof(call)) {
+            invalid_records_++;
+            return;
+        }
+        memcpy(&call, record.data, sizeof(call));
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        if (record.type == p25_shm::CALL_START) {
+            calls_started_++;
+            active_calls_[call.call_num] = call;
+        } else {
+            calls_ended_++;
+            active_calls_.erase(call.call_num);
+        }
+        if (verbose_) {
+            std::cout << "[P25_TSBK_Shm_Input] Call " << call.call_num
+                      << (record.type == p25_shm::CALL_START ? " started" : " ended")
+                      << " | TG:" << call.talkgroup << " | SRC:" << call.source_id << std::endl;
+        }
+    }
+    
+    bool parse_frame(const uint8_t* data, size_t length, P25_TSBK_Data& tsbk_data) {
+        const uint8_t* payload = nullptr;
+        p25c::Result result = p25c::parse(data, length, validate_checksums_, tsbk_data, payload);
+        if (result != p25c::OK) {
+            if (result == p25c::BAD_CHECKSUM) {
+                checksum_errors_++;
+            } else {
+                invalid_records_++;
+            }
+            if (verbose_) {
+                std::cout << "[P25_TSBK_Shm_Input] Invalid P25C frame (" << length << " bytes)" << std::endl;
+            }
+            return false;
+        }
+        
+        // The one copy out of the ring, so the space can go back to trunk-recorder
+        tsbk_data.tsbk_data = payload_pool_->copy(payload, tsbk_data.data_length);
+        
+        if (last_sequence_ != 0 && tsbk_data.sequence_number != 0 &&
+            tsbk_data.sequence_number != last_sequence_ + 1) {
+            sequence_errors_++;
+        }
+        last_sequence_ = tsbk_data.sequence_number;
+        
+        tsbk_data.source_name = get_plugin_name();
+        tsbk_data.received_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        return true;
+    }
+};
+
+// Plugin factory
+extern "C" std::shared_ptr<Input_Plugin_Api> create_input_plugin() {
+    return std::make_shared<P25_TSBK_Shm_Input>();
+}
\ No newline at end of file
@@ -6,18 +6,27 @@
  */
 
 #include "../src/plugin_api.h"
+#include "../src/mpmc_ring.h"
+#include "../src/thread_placement.h"
+#include "common/p25c_packet.h"
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <cstring>
-#include <queue>
+#include <atomic>
+#include <memory>
+#include <ctime>
+#include <vector>
+#include <algorithm>
 #include <mutex>
 #include <condition_variable>
-#include <atomic>
+#include <pthread.h>
+#include <sched.h>
 
 class P25_TSBK_UDP_Input : public Base_Input_Plugin {
 private:
@@ -28,27 +37,76 @@ private:
     bool validate_checksums_;
     bool verbose_;
     
-    // UDP socket
-    int socket_fd_;
+    // Socket receive tuning
+    size_t recv_batch_size_;   // datagrams per recvmmsg() call
+    int socket_rcvbuf_;        // SO_RCVBUF bytes, 0 keeps the kernel default
+    int busy_poll_us_;         // SO_BUSY_POLL microseconds, 0 disables
+    bool kernel_timestamps_;   // SO_TIMESTAMPNS into received_time
+    
+    // Receiver threads: one SO_REUSEPORT socket, thread and ring each
+    size_t receiver_threads_;
+    std::vector<int> cpu_affinity_;  // CPU for receiver i is cpu_affinity_[i % size]
+    std::string nic_;                // receive interface; its NUMA node's CPUs are the default affinity
+    int numa_node_;                  // node of the NIC (or of the pinned CPUs), -1 if unknown
+    
+    // Signal get_event_fd() so the core pulls packets instead of using the callback
+    bool event_notifier_;
+    
+    struct Receiver {
+        size_t index;
+        int socket_fd;
+        int cpu;
+        std::thread thread;
+        
+        // Where the thread actually runs, filled in once it has started
+        std::atomic<int> running_cpu;
+        std::atomic<int> running_node;
+        
+        // Bounded lock-free ring of preallocated packet slots
+        std::unique_ptr<MPMCRing<P25_TSBK_Data>> ring;
+        
+        // Consumer-side lookahead used to merge the rings by sequence number
+        P25_TSBK_Data staged;
+        bool has_staged;
+        
+        // Statistics
+        std::atomic<uint64_t> packets_received;
+        std::atomic<uint64_t> packets_dropped;
+        std::atomic<uint64_t> dropped_oldest;
+        std::atomic<uint64_t> dropped_newest;
+        std::atomic<uint64_t> bytes_received;
+        std::atomic<uint64_t> checksum_errors;
+        std::atomic<uint64_t> sequence_errors;
+        std::atomic<uint64_t> kernel_drops;   // SO_RXQ_OVFL: dropped before we read them
+        std::atomic<uint64_t> recv_calls;
+        
+        // SO_REUSEPORT hashes by source address, so each sender stays on one receiver
+        uint32_t last_sequence;
+        
+        Receiver(size_t i) : index(i), socket_fd(-1), cpu(-1), running_cpu(-1), running_node(-1), has_staged(false),
+                             packets_received(0), packets_dropped(0), dropped_oldest(0),
+                             dropped_newest(0), bytes_received(0), checksum_errors(0),
+                             sequence_errors(0), kernel_drops(0), recv_calls(0),
+                             last_sequence(0) {}
+    };
+    std::vector<std::unique_ptr<Receiver>> receivers_;
     struct sockaddr_in server_addr_;
     
-    // Threading
-    std::thread receiver_thread_;
     std::atomic<bool> running_;
     
-    // Data queue
-    std::queue<P25_TSBK_Data> data_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_cv_;
+    // Data queue settings
     size_t max_queue_size_;
+    bool drop_oldest_;  // overflow_policy: "drop_oldest" or "drop_newest"
+    
+    // Payload slab shared by every receiver; packets hold references into it
+    std::shared_ptr<PacketPool> payload_pool_;
+    size_t payload_slot_size_;
     
-    // Statistics
-    std::atomic<uint64_t> packets_received_;
-    std::atomic<uint64_t> packets_dropped_;
-    std::atomic<uint64_t> bytes_received_;
-    std::atomic<uint64_t> checksum_errors_;
-    std::atomic<uint64_t> sequence_errors_;
-    uint32_t last_sequence_;
+    // Blocking get_data() across all rings; producers only lock when a consumer waits
+    std::mutex consumer_mutex_;
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cv_;
+    std::atomic<int> waiters_;
     
 public:
     PLUGIN_INFO("P25 TSBK UDP Input", "1.0.0", "Dave K9DPD", "Receives P25 TSBK control data from trunk-recorder via UDP")
@@ -59,18 +117,22 @@ public:
         buffer_size_(8192),
         validate_checksums_(true),
         verbose_(false),
-        socket_fd_(-1),
+        recv_batch_size_(32),
+        socket_rcvbuf_(0),
+        busy_poll_us_(0),
+        kernel_timestamps_(true),
+        receiver_threads_(1),
+        numa_node_(-1),
+        event_notifier_(true),
         running_(false),
         max_queue_size_(1000),
-        packets_received_(0),
-        packets_dropped_(0),
-        bytes_received_(0),
-        checksum_errors_(0),
-        sequence_errors_(0),
-        last_sequence_(0) {}
+        drop_oldest_(false),
+        payload_slot_size_(256),
+        waiters_(0) {}
     
     virtual ~P25_TSBK_UDP_Input() {
         stop();
+        close_sockets();
     }
     
     virtual int init(json config_data) override {
@@ -79,9 +141,52 @@ public:
             return -1;
         }
         
-        if (initialize_socket() != 0) {
-            set_state(Plugin_State::PLUGIN_ERROR);
-            return -1;
+        if (event_notifier_) {
+            enable_event_notifier();
+        }
+        
+        std::vector<std::vector<int>> topology = placement::numa_topology();
+        if (!nic_.empty()) {
+            // Receive near the NIC: its node's CPUs unless pinned by hand
+            numa_node_ = placement::nic_numa_node(nic_);
+            if (cpu_affinity_.empty() && numa_node_ >= 0 && numa_node_ < static_cast<int>(topology.size())) {
+                cpu_affinity_ = topology[numa_node_];
+            }
+        } else if (!cpu_affinity_.empty()) {
+            numa_node_ = placement::node_of_cpu(cpu_affinity_.front(), topology);
+        }
+        // Rings and slabs are filled by the receivers, so put them on their node
+        bool steer_memory = numa_node_ >= 0 && topology.size() > 1 && placement::prefer_node_memory(numa_node_);
+        
+        // Rings are per receiver, so split the configured queue size between them
+        size_t ring_size = std::max<size_t>(1, max_queue_size_ / receiver_threads_);
+        
+        // Enough slots for full rings, each receiver's lookahead and packets
+        // held downstream; anything beyond that falls back to the heap
+        payload_pool_ = PacketPool::create(payload_slot_size_,
+                                           ring_size * receiver_threads_ + receiver_threads_ * 4 + 256);
+        
+        for (size_t i = 0; i < receiver_threads_; i++) {
+            auto receiver = std::make_unique<Receiver>(i);
+            if (!cpu_affinity_.empty()) {
+                receiver->cpu = cpu_affinity_[i % cpu_affinity_.size()];
+            }
+            
+            if (initialize_socket(*receiver) != 0) {
+                close_sockets();
+                if (steer_memory) {
+                    placement::reset_memory_policy();
+                }
+                set_state(Plugin_State::PLUGIN_ERROR);
+                return -1;
+            }
+            
+            receiver->ring = std::make_unique<MPMCRing<P25_TSBK_Data>>(ring_size);
+            
+            receivers_.push_back(std::move(receiver));
+        }
+        if (steer_memory) {
+            placement::reset_memory_policy();
         }
         
         set_state(Plugin_State::PLUGIN_INITIALIZED);
@@ -94,13 +199,16 @@ public:
         }
         
         running_ = true;
-        receiver_thread_ = std::thread(&P25_TSBK_UDP_Input::receiver_worker, this);
+        for (auto& receiver : receivers_) {
+            receiver->thread = std::thread(&P25_TSBK_UDP_Input::receiver_worker, this, receiver.get());
+        }
         
         set_state(Plugin_State::PLUGIN_RUNNING);
         
         if (verbose_) {
             std::cout << "[P25_TSBK_UDP_Input] Started listening on " 
-                      << listen_address_ << ":" << listen_port_ << std::endl;
+                      << listen_address_ << ":" << listen_port_
+                      << " with " << receivers_.size() << " receiver thread(s)" << std::endl;
         }
         
         return 0;
@@ -109,22 +217,26 @@ public:
     virtual int stop() override {
         if (running_) {
             running_ = false;
-            
-            if (receiver_thread_.joinable()) {
-                receiver_thread_.join();
+            {
+                std::lock_guard<std::mutex> lock(wait_mutex_);
+                wait_cv_.notify_all();
             }
             
-            if (socket_fd_ >= 0) {
-                close(socket_fd_);
-                socket_fd_ = -1;
+            for (auto& receiver : receivers_) {
+                if (receiver->thread.joinable()) {
+                    receiver->thread.join();
+                }
             }
             
+            close_sockets();
+            
             set_state(Plugin_State::PLUGIN_STOPPED);
             
             if (verbose_) {
+                json stats = get_stats();
                 std::cout << "[P25_TSBK_UDP_Input] Stopped. Stats: " 
-                          << packets_received_ << " received, " 
-                          << packets_dropped_ << " dropped" << std::endl;
+                          << stats["packets_received"] << " received, " 
+                          << stats["packets_dropped"] << " dropped" << std::endl;
             }
         }
         
@@ -150,10 +262,69 @@ public:
             max_queue_size_ = config_data["max_queue_size"];
         }
         
+        if (config_data.contains("overflow_policy")) {
+            std::string policy = config_data["overflow_policy"];
+            if (policy == "drop_oldest") {
+                drop_oldest_ = true;
+            } else if (policy == "drop_newest") {
+                drop_oldest_ = false;
+            } else {
+                std::cerr << "[P25_TSBK_UDP_Input] Unknown overflow_policy: " << policy << std::endl;
+                return -1;
+            }
+        }
+        
         if (config_data.contains("validate_checksums")) {
             validate_checksums_ = config_data["validate_checksums"];
         }
         
+        if (config_data.contains("recv_batch_size")) {
+            recv_batch_size_ = config_data["recv_batch_size"];
+            if (recv_batch_size_ == 0) {
+                recv_batch_size_ = 1;
+            }
+        }
+        
+        if (config_data.contains("socket_rcvbuf")) {
+            socket_rcvbuf_ = config_data["socket_rcvbuf"];
+        }
+        
+        if (config_data.contains("busy_poll_us")) {
+            busy_poll_us_ = config_data["busy_poll_us"];
+        }
+        
+        if (config_data.contains("kernel_timestamps")) {
+            kernel_timestamps_ = config_data["kernel_timestamps"];
+        }
+        
+        if (config_data.contains("payload_slot_size")) {
+            payload_slot_size_ = config_data["payload_slot_size"];
+        }
+        
+        if (config_data.contains("receiver_threads")) {
+            receiver_threads_ = config_data["receiver_threads"];
+            if (receiver_threads_ == 0) {
+                receiver_threads_ = 1;
+            }
+        }
+        
+        if (config_data.contains("cpu_affinity")) {
+            // An array of CPUs or a list string such as "0-3,8"
+            if (config_data["cpu_affinity"].is_string()) {
+                cpu_affinity_ = placement::parse_cpu_list(config_data["cpu_affinity"].get<std::string>());
+            } else {
+                cpu_affinity_ = config_data["cpu_affinity"].get<std::vector<int>>();
+            }
+        }
+        
+        if (config_data.contains("nic")) {
+            nic_ = config_data["nic"].get<std::string>();
+        }
+        
+        if (config_data.contains("event_notifier")) {
+            event_notifier_ = config_data["event_notifier"];
+        }
+        
         if (config_data.contains("verbose")) {
             verbose_ = config_data["verbose"];
         }
@@ -162,25 +333,43 @@ public:
     }
     
     virtual bool has_data() override {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        return !data_queue_.empty();
+        for (auto& receiver : receivers_) {
+            if (receiver->has_staged || !receiver->ring->empty()) {
+                return true;
+            }
+        }
+        return false;
     }
     
     virtual P25_TSBK_Data get_data() override {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        queue_cv_.wait(lock, [this] { return !data_queue_.empty() || !running_; });
+        std::lock_guard<std::mutex> consumer_lock(consumer_mutex_);
         
-        if (!data_queue_.empty()) {
-            P25_TSBK_Data data = data_queue_.front();
-            data_queue_.pop();
-            return data;
+        while (true) {
+            Receiver* next = stage_next();
+            if (next) {
+                next->has_staged = false;
+                return std::move(next->staged);
+            }
+            
+            if (!running_) {
+                break;
+            }
+            
+            std::unique_lock<std::mutex> lock(wait_mutex_);
+            waiters_++;
+            // Re-check under the lock so a push between stage_next and wait is not missed
+            wait_cv_.wait_for(lock, std::chrono::milliseconds(100), [this] {
+                return any_ready() || !running_;
+            });
+            waiters_--;
         }
         
         // Return empty data if stopped
         return P25_TSBK_Data();
     }
     
-    virtual void set_data_callback(std::function<void(P25_TSBK_Data)> callback) override {
+    // Note: with receiver_threads > 1 the callback is invoked from several threads
+    virtual void set_data_callback(std::function<void(const P25_TSBK_Data&)> callback) override {
         data_callback_ = callback;
     }
     
@@ -188,29 +377,93 @@ public:
         json stats = Base_Input_Plugin::get_stats();
         stats["listen_address"] = listen_address_;
         stats["listen_port"] = listen_port_;
-        stats["packets_received"] = packets_received_.load();
-        stats["packets_dropped"] = packets_dropped_.load();
-        stats["bytes_received"] = bytes_received_.load();
-        stats["checksum_errors"] = checksum_errors_.load();
-        stats["sequence_errors"] = sequence_errors_.load();
-        stats["queue_size"] = data_queue_.size();
+        if (!nic_.empty()) {
+            stats["nic"] = nic_;
+        }
+        stats["nic_numa_node"] = numa_node_;
+        
+        // Totals across receivers, with the per-thread breakdown alongside
+        uint64_t packets_received = 0, packets_dropped = 0, dropped_oldest = 0, dropped_newest = 0;
+        uint64_t bytes_received = 0, checksum_errors = 0, sequence_errors = 0;
+        uint64_t kernel_drops = 0, recv_calls = 0;
+        size_t queue_size = 0, queue_capacity = 0;
+        json per_receiver = json::array();
+        
+        for (auto& receiver : receivers_) {
+            json r;
+            r["index"] = receiver->index;
+            r["cpu"] = receiver->cpu;
+            r["running_cpu"] = receiver->running_cpu.load();
+            r["numa_node"] = receiver->running_node.load();
+            r["packets_received"] = receiver->packets_received.load();
+            r["packets_dropped"] = receiver->packets_dropped.load();
+            r["kernel_drops"] = receiver->kernel_drops.load();
+            r["queue_size"] = receiver->ring->size();
+            per_receiver.push_back(r);
+            
+            packets_received += receiver->packets_received;
+            packets_dropped += receiver->packets_dropped;
+            dropped_oldest += receiver->dropped_oldest;
+            dropped_newest += receiver->dropped_newest;
+            bytes_received += receiver->bytes_received;
+            checksum_errors += receiver->checksum_errors;
+            sequence_errors += receiver->sequence_errors;
+            kernel_drops += receiver->kernel_drops;
+            recv_calls += receiver->recv_calls;
+            queue_size += receiver->ring->size();
+            queue_capacity += receiver->ring->capacity();
+        }
+        
+        stats["packets_received"] = packets_received;
+        stats["packets_dropped"] = packets_dropped;
+        stats["dropped_oldest"] = dropped_oldest;
+        stats["dropped_newest"] = dropped_newest;
+        stats["overflow_policy"] = drop_oldest_ ? "drop_oldest" : "drop_newest";
+        stats["queue_capacity"] = queue_capacity;
+        stats["bytes_received"] = bytes_received;
+        stats["checksum_errors"] = checksum_errors;
+        stats["sequence_errors"] = sequence_errors;
+        stats["kernel_drops"] = kernel_drops;
+        stats["recv_calls"] = recv_calls;
+        stats["recv_batch_size"] = recv_batch_size_;
+        stats["receiver_threads"] = receivers_.size();
+        stats["event_notifier"] = get_event_fd() >= 0;
+        stats["receivers"] = per_receiver;
+        stats["queue_size"] = queue_size;
+        if (payload_pool_) {
+            stats["payload_slots"] = payload_pool_->slot_count();
+            stats["payload_slots_free"] = payload_pool_->available();
+            stats["payload_heap_fallbacks"] = payload_pool_->heap_fallbacks();
+        }
         return stats;
     }
     
 private:
-    int initialize_socket() {
-        socket_fd_ = socket(AF_INET, SOCK_DGRAM, 0);
-        if (socket_fd_ < 0) {
+    int initialize_socket(Receiver& receiver) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) {
             std::cerr << "[P25_TSBK_UDP_Input] Failed to create socket: " << strerror(errno) << std::endl;
             return -1;
         }
         
         // Allow address reuse
         int reuse = 1;
-        if (setsockopt(socket_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
             std::cerr << "[P25_TSBK_UDP_Input] Failed to set SO_REUSEADDR: " << strerror(errno) << std::endl;
-            close(socket_fd_);
-            socket_fd_ = -1;
+            close(fd);
+            return -1;
+        }
+        
+        // Let the kernel spread datagrams across the receiver sockets
+        if (receiver_threads_ > 1 &&
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+            std::cerr << "[P25_TSBK_UDP_Input] Failed to set SO_REUSEPORT: " << strerror(errno) << std::endl;
+            close(fd);
+            return -1;
+        }
+        
+        if (configure_receive_options(fd) != 0) {
+            close(fd);
             return -1;
         }
         
@@ -221,175 +474,302 @@ private:
         
         if (inet_pton(AF_INET, listen_address_.c_str(), &server_addr_.sin_addr) <= 0) {
             std::cerr << "[P25_TSBK_UDP_Input] Invalid IP address: " << listen_address_ << std::endl;
-            close(socket_fd_);
-            socket_fd_ = -1;
+            close(fd);
             return -1;
         }
         
-        if (bind(socket_fd_, (struct sockaddr*)&server_addr_, sizeof(server_addr_)) < 0) {
+        if (bind(fd, (struct sockaddr*)&server_addr_, sizeof(server_addr_)) < 0) {
             std::cerr << "[P25_TSBK_UDP_Input] Failed to bind to " << listen_address_ 
                       << ":" << listen_port_ << ": " << strerror(errno) << std::endl;
-            close(socket_fd_);
-            socket_fd_ = -1;
+            close(fd);
             return -1;
         }
         
+        receiver.socket_fd = fd;
         return 0;
     }
     
-    void receiver_worker() {
-        std::vector<uint8_t> buffer(buffer_size_);
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+    void close_sockets() {
+        for (auto& receiver : receivers_) {
+            if (receiver->socket_fd >= 0) {
+                close(receiver->socket_fd);
+                receiver->socket_fd = -1;
+            }
+        }
+    }
+    
+    int configure_receive_options(int fd) {
+        if (socket_rcvbuf_ > 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &socket_rcvbuf_, sizeof(socket_rcvbuf_)) < 0) {
+            std::cerr << "[P25_TSBK_UDP_Input] Failed to set SO_RCVBUF: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        
+#ifdef SO_BUSY_POLL
+        if (busy_poll_us_ > 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us_, sizeof(busy_poll_us_)) < 0) {
+            // Needs CAP_NET_ADMIN above net.core.busy_poll; not fatal
+            std::cerr << "[P25_TSBK_UDP_Input] Failed to set SO_BUSY_POLL: " << strerror(errno) << std::endl;
+        }
+#endif
+        
+        int enable = 1;
+        if (kernel_timestamps_ &&
+            setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+            std::cerr << "[P25_TSBK_UDP_Input] Failed to set SO_TIMESTAMPNS: " << strerror(errno) << std::endl;
+            kernel_timestamps_ = false;
+        }
+        
+#ifdef SO_RXQ_OVFL
+        if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) < 0 && verbose_) {
+            std::cout << "[P25_TSBK_UDP_Input] SO_RXQ_OVFL unavailable, kernel drops not reported" << std::endl;
+        }
+#endif
+        
+        // Wake up periodically so stop() does not wait for the next datagram
+        struct timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 500000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        
+        if (verbose_) {
+            int actual = 0;
+            socklen_t len = sizeof(actual);
+            getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual, &len);
+            std::cout << "[P25_TSBK_UDP_Input] Receive buffer " << actual << " bytes, batch "
+                      << recv_batch_size_ << " datagrams" << std::endl;
+        }
+        
+        return 0;
+    }
+    
+    // Sequence numbers wrap, so compare by signed distance
+    static bool sequence_before(uint32_t a, uint32_t b) {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+    
+    // Fill each receiver's lookahead and return the one holding the lowest
+    // sequence number, or nullptr if every ring is empty
+    Receiver* stage_next() {
+        Receiver* best = nullptr;
+        for (auto& receiver : receivers_) {
+            if (!receiver->has_staged) {
+                receiver->has_staged = receiver->ring->try_pop(receiver->staged);
+            }
+            if (receiver->has_staged &&
+                (!best || sequence_before(receiver->staged.sequence_number, best->staged.sequence_number))) {
+                best = receiver.get();
+            }
+        }
+        return best;
+    }
+    
+    bool any_ready() const {
+        for (const auto& receiver : receivers_) {
+            if (receiver->ring->front_ready()) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void pin_to_cpu(Receiver& receiver) {
+        if (receiver.cpu < 0) {
+            record_placement(receiver);
+            return;
+        }
+        int rc = placement::pin_current_thread(std::vector<int>(1, receiver.cpu));
+        if (numa_node_ >= 0) {
+            placement::prefer_node_memory(numa_node_);
+        }
+        record_placement(receiver);
+        if (rc != 0) {
+            std::cerr << "[P25_TSBK_UDP_Input] Failed to pin receiver " << receiver.index
+                      << " to CPU " << receiver.cpu << ": " << strerror(rc) << std::endl;
+        } else if (verbose_) {
+            std::cout << "[P25_TSBK_UDP_Input] Receiver " << receiver.index
+                      << " pinned to CPU " << receiver.cpu << std::endl;
+        }
+    }
+    
+    void record_placement(Receiver& receiver) {
+        int cpu = sched_getcpu();
+        receiver.running_cpu = cpu;
+        receiver.running_node = placement::node_of_cpu(cpu, placement::numa_topology());
+    }
+    
+    void receiver_worker(Receiver* receiver) {
+        pin_to_cpu(*receiver);
+        
+        // One contiguous buffer and one control area per datagram in the batch
+        const size_t batch = recv_batch_size_;
+        const size_t control_size = CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t));
+        std::vector<uint8_t> buffer(batch * buffer_size_);
+        std::vector<uint8_t> control(batch * control_size);
+        std::vector<struct mmsghdr> msgs(batch);
+        std::vector<struct iovec> iovecs(batch);
+        std::vector<struct sockaddr_in> client_addrs(batch);
+        
+        // Payloads live in pooled slots, so copying a packet only shares its buffer
+        P25_TSBK_Data tsbk_data;
+        P25_TSBK_Data evicted;
         
         while (running_) {
-            ssize_t bytes_received = recvfrom(socket_fd_, buffer.data(), buffer.size(), 0,
-                                            (struct sockaddr*)&client_addr, &client_len);
-            
-            if (bytes_received < 0) {
-                if (running_) {
-                    std::cerr << "[P25_TSBK_UDP_Input] recvfrom error: " << strerror(errno) << std::endl;
-                }
-                continue;
+            for (size_t i = 0; i < batch; i++) {
+                iovecs[i].iov_base = buffer.data() + i * buffer_size_;
+                iovecs[i].iov_len = buffer_size_;
+                memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                msgs[i].msg_hdr.msg_name = &client_addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(client_addrs[i]);
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_control = control.data() + i * control_size;
+                msgs[i].msg_hdr.msg_controllen = control_size;
             }
             
-            if (bytes_received == 0) {
+            // Block for the first datagram, then take whatever else is already queued
+            int count = recvmmsg(receiver->socket_fd, msgs.data(), batch, MSG_WAITFORONE, nullptr);
+            receiver->recv_calls++;
+            
+            if (count < 0) {
+                if (running_ && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    std::cerr << "[P25_TSBK_UDP_Input] recvmmsg error: " << strerror(errno) << std::endl;
+                }
                 continue;
             }
             
-            bytes_received_ += bytes_received;
-            
-            // Parse P25C packet
-            P25_TSBK_Data tsbk_data;
-            if (parse_p25c_packet(buffer.data(), bytes_received, tsbk_data)) {
-                packets_received_++;
-                
-                // Check queue size
-                {
-                    std::lock_guard<std::mutex> lock(queue_mutex_);
-                    if (data_queue_.size() >= max_queue_size_) {
-                        packets_dropped_++;
-                        if (verbose_) {
-                            std::cout << "[P25_TSBK_UDP_Input] Queue full, dropping packet" << std::endl;
-                        }
-                        continue;
-                    }
-                    
-                    data_queue_.push(tsbk_data);
+            bool queued = false;
+            for (int i = 0; i < count; i++) {
+                size_t bytes = msgs[i].msg_len;
+                if (bytes == 0) {
+                    continue;
                 }
                 
-                queue_cv_.notify_one();
+                receiver->bytes_received += bytes;
+                
+                uint64_t kernel_time_us = read_control_messages(*receiver, msgs[i].msg_hdr);
                 
-                // Call callback if set
-                if (data_callback_) {
-                    data_callback_(tsbk_data);
+                // Parse P25C packet
+                if (parse_p25c_packet(*receiver, static_cast<const uint8_t*>(iovecs[i].iov_base), bytes, tsbk_data)) {
+                    receiver->packets_received++;
+                    if (kernel_time_us != 0) {
+                        tsbk_data.received_time = kernel_time_us;
+                    }
+                    
+                    queued |= enqueue_packet(*receiver, tsbk_data, evicted);
+                    
+                    // Call callback if set
+                    if (data_callback_) {
+                        data_callback_(tsbk_data);
+                    }
                 }
             }
+            
+            // One wakeup per batch for an event-driven consumer
+            if (queued) {
+                notify_data_ready();
+            }
         }
     }
     
-    bool parse_p25c_packet(const uint8_t* data, size_t length, P25_TSBK_Data& tsbk_data) {
-        // Minimum packet size check
-        if (length < sizeof(uint32_t) * 8 + sizeof(uint16_t) * 2 + sizeof(uint64_t) + sizeof(double)) {
-            if (verbose_) {
-                std::cout << "[P25_TSBK_UDP_Input] Packet too small: " << length << " bytes" << std::endl;
+    // Returns the kernel receive timestamp in microseconds (0 if absent) and
+    // updates the socket overflow counter
+    uint64_t read_control_messages(Receiver& receiver, struct msghdr& msg) {
+        uint64_t timestamp_us = 0;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET) {
+                continue;
             }
-            return false;
-        }
-        
-        size_t offset = 0;
-        
-        // Parse header
-        memcpy(&tsbk_data.magic, data + offset, sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        
-        // Check magic number
-        if (tsbk_data.magic != 0x50323543) { // "P25C"
-            if (verbose_) {
-                std::cout << "[P25_TSBK_UDP_Input] Invalid magic: 0x" << std::hex << tsbk_data.magic << std::endl;
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                timestamp_us = static_cast<uint64_t>(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+            }
+#ifdef SO_RXQ_OVFL
+            else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                receiver.kernel_drops = drops; // cumulative for the socket
             }
-            return false;
+#endif
         }
-        
-        memcpy(&tsbk_data.version, data + offset, sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        
-        memcpy(&tsbk_data.timestamp_us, data + offset, sizeof(uint64_t));
-        offset += sizeof(uint64_t);
-        
-        memcpy(&tsbk_data.sequence_number, data + offset, sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        
-        memcpy(&tsbk_data.system_id, data + offset, sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        
-        memcpy(&tsbk_data.site_id, data + offset, sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        
-        memcpy(&tsbk_data.frequency, data + offset, sizeof(double));
-        offset += sizeof(double);
-        
-        // DEBUG: Print raw bytes and parsed values (disabled to reduce output noise)
-        // static int debug_count = 0;
-        // if (debug_count < 3) { // Only show first 3 packets to avoid spam
-        //     std::cout << "[DEBUG] Packet length: " << length << " bytes" << std::endl;
-        //     std::cout << "[DEBUG] Magic: 0x" << std::hex << tsbk_data.magic << std::dec << std::endl;
-        //     std::cout << "[DEBUG] System ID: 0x" << std::hex << tsbk_data.system_id << std::dec << std::endl;
-        //     std::cout << "[DEBUG] Frequency: " << tsbk_data.frequency << " Hz" << std::endl;
-        //     std::cout << "[DEBUG] Raw frequency bytes: ";
-        //     for (int i = 0; i < 8; i++) {
-        //         std::cout << "0x" << std::hex << (int)data[offset - 8 + i] << " ";
-        //     }
-        //     std::cout << std::dec << std::endl;
-        //     debug_count++;
-        // }
-        
-        memcpy(&tsbk_data.sample_rate, data + offset, sizeof(uint32_t));
-        offset += sizeof(uint32_t);
-        
-        memcpy(&tsbk_data.data_length, data + offset, sizeof(uint16_t));
-        offset += sizeof(uint16_t);
-        
-        memcpy(&tsbk_data.checksum, data + offset, sizeof(uint16_t));
-        offset += sizeof(uint16_t);
-        
-        // Validate data length
-        if (offset + tsbk_data.data_length > length) {
-            if (verbose_) {
-                std::cout << "[P25_TSBK_UDP_Input] Invalid data length: " << tsbk_data.data_length << std::endl;
+        return timestamp_us;
+    }
+    
+    bool enqueue_packet(Receiver& receiver, const P25_TSBK_Data& tsbk_data, P25_TSBK_Data& evicted) {
+        while (!receiver.ring->try_push(tsbk_data)) {
+            if (!drop_oldest_) {
+                receiver.packets_dropped++;
+                receiver.dropped_newest++;
+                if (verbose_) {
+                    std::cout << "[P25_TSBK_UDP_Input] Queue full, dropping packet" << std::endl;
+                }
+                return false;
+            }
+            
+            // Make room by discarding the oldest queued packet
+            if (receiver.ring->try_pop(evicted)) {
+                receiver.packets_dropped++;
+                receiver.dropped_oldest++;
+                if (verbose_) {
+                    std::cout << "[P25_TSBK_UDP_Input] Queue full, dropping oldest packet" << std::endl;
+                }
             }
-            return false;
         }
         
-        // Extract TSBK data
-        tsbk_data.tsbk_data.resize(tsbk_data.data_length);
-        memcpy(tsbk_data.tsbk_data.data(), data + offset, tsbk_data.data_length);
-        
-        // Validate checksum if enabled
-        if (validate_checksums_ && tsbk_data.checksum != 0) {
-            uint16_t calculated_checksum = calculate_checksum(tsbk_data.tsbk_data.data(), tsbk_data.data_length);
-            if (calculated_checksum != tsbk_data.checksum) {
-                checksum_errors_++;
+        // seq_cst waiters_ load pairs with the increment in get_data()
+        if (waiters_.load() > 0) {
+            std::lock_guard<std::mutex> lock(wait_mutex_);
+            wait_cv_.notify_one();
+        }
+        return true;
+    }
+    
+    bool parse_p25c_packet(Receiver& receiver, const uint8_t* data, size_t length, P25_TSBK_Data& tsbk_data) {
+        const uint8_t* payload = nullptr;
+        switch (p25c::parse(data, length, validate_checksums_, tsbk_data, payload)) {
+            case p25c::OK:
+                break;
+            case p25c::TOO_SHORT:
+                if (verbose_) {
+                    std::cout << "[P25_TSBK_UDP_Input] Packet too small: " << length << " bytes" << std::endl;
+                }
+                return false;
+            case p25c::BAD_MAGIC:
+                if (verbose_) {
+                    std::cout << "[P25_TSBK_UDP_Input] Invalid magic: 0x" << std::hex << tsbk_data.magic << std::endl;
+                }
+                return false;
+            case p25c::BAD_LENGTH:
+                if (verbose_) {
+                    std::cout << "[P25_TSBK_UDP_Input] Invalid data length: " << tsbk_data.data_length << std::endl;
+                }
+                return false;
+            case p25c::BAD_CHECKSUM:
+                receiver.checksum_errors++;
                 if (verbose_) {
                     std::cout << "[P25_TSBK_UDP_Input] Checksum mismatch: got 0x" << std::hex 
-                              << tsbk_data.checksum << ", expected 0x" << calculated_checksum << std::endl;
+                              << tsbk_data.checksum << ", expected 0x"
+                              << p25c::checksum(payload, tsbk_data.data_length) << std::endl;
                 }
                 return false;
-            }
         }
         
+        // Extract TSBK data: the only copy of the payload on its way to the outputs
+        tsbk_data.tsbk_data = payload_pool_->copy(payload, tsbk_data.data_length);
+        
         // Check sequence number
-        if (last_sequence_ != 0 && tsbk_data.sequence_number != 0) {
-            uint32_t expected_seq = last_sequence_ + 1;
+        if (receiver.last_sequence != 0 && tsbk_data.sequence_number != 0) {
+            uint32_t expected_seq = receiver.last_sequence + 1;
             if (tsbk_data.sequence_number != expected_seq) {
-                sequence_errors_++;
+                receiver.sequence_errors++;
                 if (verbose_) {
                     std::cout << "[P25_TSBK_UDP_Input] Sequence error: got " << tsbk_data.sequence_number 
                               << ", expected " << expected_seq << std::endl;
                 }
             }
         }
-        last_sequence_ = tsbk_data.sequence_number;
+        receiver.last_sequence = tsbk_data.sequence_number;
         
         // Set metadata
         tsbk_data.source_name = get_plugin_name();
@@ -398,14 +778,6 @@ private:
         
         return true;
     }
-    
-    uint16_t calculate_checksum(const uint8_t* data, size_t length) {
-        uint16_t checksum = 0;
-        for (size_t i = 0; i < length; i++) {
-            checksum ^= data[i];
-        }
-        return checksum;
-    }
 };
 
 // Plugin factory
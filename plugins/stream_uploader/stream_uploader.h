@@ -6,10 +6,9 @@
 #pragma once
 
 #include "../../src/plugin_api.h"
-#include <curl/curl.h>
-#include <queue>
-#include <thread>
-#include <mutex>
+#include "../common/curl_multi_client.h"
+#include "../common/upload_spool.h"
+#include <memory>
 #include <atomic>
 
 class Stream_Uploader : public Base_Plugin {
@@ -31,24 +30,24 @@ private:
         Upload_Config config;
         std::string format;
         std::string file_path;
+        // Call_Data_t::encoded_audio[format] when set; the request builders
+        // send it as a memory part instead of reading file_path back
+        std::shared_ptr<const std::vector<uint8_t>> data;
         int retry_count;
-        std::chrono::system_clock::time_point next_retry;
         
-        Upload_Job() : retry_count(0), next_retry(std::chrono::system_clock::now()) {}
+        Upload_Job() : retry_count(0) {}
     };
     
     std::map<std::string, std::vector<Upload_Config>> stream_uploaders_; // stream -> configs
     
-    // Async upload queue
-    std::queue<Upload_Job> upload_queue_;
-    std::vector<std::thread> upload_workers_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_condition_;
-    std::atomic<bool> stop_workers_;
+    // Every destination's uploads run on one shared multi-handle client:
+    // pooled HTTP/2 connections, shared DNS and TLS session caches, and
+    // retries that wait in its delayed list rather than on a thread
+    std::unique_ptr<CurlMultiClient> client_;
     
-    // CURL handles
-    std::map<std::thread::id, CURL*> curl_handles_;
-    std::mutex curl_mutex_;
+    // Durable retry log per destination type, replayed through client_ once
+    // the service answers again; declared after client_ so they go first
+    std::map<std::string, std::unique_ptr<UploadSpool>> spools_; // type -> spool
     
     // Statistics
     std::atomic<int> uploads_queued_;
@@ -56,15 +55,12 @@ private:
     std::atomic<int> uploads_failed_;
     std::map<std::string, std::atomic<int>> uploads_by_type_;
     
-    // Worker methods
-    void upload_worker();
-    bool upload_to_openmhz(const Upload_Job& job);
-    bool upload_to_broadcastify(const Upload_Job& job);
-    bool upload_to_custom(const Upload_Job& job);
-    
-    // CURL helpers
-    CURL* get_curl_handle();
-    static size_t write_callback(void* contents, size_t size, size_t nmemb, std::string* response);
+    // One multipart request per destination type, submitted to client_
+    CurlMultiClient::Request build_openmhz_request(const Upload_Job& job);
+    CurlMultiClient::Request build_broadcastify_request(const Upload_Job& job);
+    CurlMultiClient::Request build_custom_request(const Upload_Job& job);
+    void submit_upload(std::shared_ptr<Upload_Job> job);
+    void upload_finished(std::shared_ptr<Upload_Job> job, const CurlMultiClient::Result& result);
     
 public:
     Stream_Uploader();
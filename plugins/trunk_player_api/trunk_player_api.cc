@@ -3,20 +3,19 @@
  */
 
 #include "trunk_player_api.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <filesystem>
 
 Trunk_Player_Api::Trunk_Player_Api() 
-    : stop_workers_(false), transfers_queued_(0), transfers_completed_(0), 
-      transfers_failed_(0), audio_files_transferred_(0), metadata_records_transferred_(0) {
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    : batch_stopping_(false), transfers_queued_(0), transfers_completed_(0), transfers_failed_(0), transfers_retried_(0), transfers_spooled_(0), batches_sent_(0),
+      audio_files_transferred_(0), metadata_records_transferred_(0) {
 }
 
 Trunk_Player_Api::~Trunk_Player_Api() {
     stop();
-    curl_global_cleanup();
 }
 
 int Trunk_Player_Api::init(json config_data) {
@@ -36,14 +35,39 @@ int Trunk_Player_Api::start() {
         return -1;
     }
     
-    // Start transfer workers
-    int worker_count = config_.value("worker_threads", 2);
-    for (int i = 0; i < worker_count; i++) {
-        transfer_workers_.emplace_back(&Trunk_Player_Api::transfer_worker, this);
+    // A couple of event loops carry every upload; worker_threads keeps its old name
+    CurlMultiClient::Options options;
+    options.loops = config_.value("worker_threads", 2);
+    options.max_connections_per_host = config_.value("max_connections_per_host", 8L);
+    options.max_total_connections = config_.value("max_connections", 64L);
+    client_.reset(new CurlMultiClient(options));
+    client_->start();
+    
+    // One retry log per stream, so an outage at one server does not hold
+    // back the others
+    std::string spool_dir = config_.value("spool_dir", "");
+    if (!spool_dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(spool_dir, ec);
+        for (const auto& stream : stream_configs_) {
+            UploadSpool::Options spool_options;
+            spool_options.path = spool_dir + "/" + stream.first + ".spool";
+            spool_options.max_bytes = static_cast<size_t>(config_.value("spool_max_mb", 1024)) << 20;
+            spool_options.replay_batch = config_.value("replay_batch", 16);
+            spool_options.replay_rate = config_.value("replay_rate", 10.0);
+            std::unique_ptr<UploadSpool> spool(new UploadSpool(*client_, spool_options));
+            if (spool->open()) {
+                spool->start();
+                spools_[stream.first] = std::move(spool);
+            }
+        }
     }
     
+    batch_stopping_ = false;
+    batch_thread_ = std::thread(&Trunk_Player_Api::batch_loop, this);
+    
     set_state(Plugin_State::PLUGIN_RUNNING);
-    std::cout << "[trunk-player API] Started with " << worker_count << " workers" << std::endl;
+    std::cout << "[trunk-player API] Started with " << options.loops << " upload loops" << std::endl;
     return 0;
 }
 
@@ -52,26 +76,20 @@ int Trunk_Player_Api::stop() {
         return 0;
     }
     
-    // Stop workers
+    // Send what is still batched, so it completes or spools below
     {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        stop_workers_ = true;
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        batch_stopping_ = true;
     }
-    queue_condition_.notify_all();
-    
-    for (auto& worker : transfer_workers_) {
-        if (worker.joinable()) {
-            worker.join();
-        }
+    batch_wake_.notify_all();
+    if (batch_thread_.joinable()) {
+        batch_thread_.join();
     }
-    transfer_workers_.clear();
     
-    // Cleanup CURL handles
-    std::lock_guard<std::mutex> curl_lock(curl_mutex_);
-    for (auto& handle_pair : curl_handles_) {
-        curl_easy_cleanup(handle_pair.second);
-    }
-    curl_handles_.clear();
+    // Outstanding transfers complete as failed; what they spool is replayed
+    // on the next start
+    client_->stop();
+    spools_.clear();
     
     set_state(Plugin_State::PLUGIN_STOPPED);
     std::cout << "[trunk-player API] Stopped" << std::endl;
@@ -93,6 +111,8 @@ int Trunk_Player_Api::parse_config(json config_data) {
                 config.retry_count = stream_config.value("retry_count", 3);
                 config.timeout_seconds = stream_config.value("timeout_seconds", 30);
                 config.verify_ssl = stream_config.value("verify_ssl", true);
+                config.batch_size = std::max(1, stream_config.value("batch_size", 1));
+                config.batch_window = std::chrono::milliseconds(stream_config.value("batch_window_ms", 250));
                 
                 // Parse supported audio formats
                 if (stream_config.contains("audio_formats")) {
@@ -126,148 +146,247 @@ int Trunk_Player_Api::call_data_ready(Call_Data_t call_info) {
         return 0;
     }
     
-    Transfer_Job job;
-    job.call_info = call_info;
-    job.config = config_it->second;
+    auto job = std::make_shared<Transfer_Job>();
+    job->call_info = call_info;
+    job->config = config_it->second;
     
-    // Collect audio files that match supported formats
-    for (const std::string& format : job.config.audio_formats) {
+    // Collect audio that matches supported formats, from memory when the
+    // encoder left it there so the file is not read back
+    for (const std::string& format : job->config.audio_formats) {
+        Audio_Source audio;
         auto file_it = call_info.converted_files.find(format);
         if (file_it != call_info.converted_files.end()) {
-            if (std::filesystem::exists(file_it->second)) {
-                job.audio_files.push_back(file_it->second);
-            }
+            audio.path = file_it->second;
+        } else if (format == "wav" && strlen(call_info.wav_filename) > 0) {
+            // Also check for WAV file if format is wav
+            audio.path = call_info.wav_filename;
         }
         
-        // Also check for WAV file if format is wav
-        if (format == "wav" && strlen(call_info.wav_filename) > 0) {
-            if (std::filesystem::exists(call_info.wav_filename)) {
-                job.audio_files.push_back(call_info.wav_filename);
-            }
+        auto data_it = call_info.encoded_audio.find(format);
+        if (data_it != call_info.encoded_audio.end() && data_it->second) {
+            audio.data = data_it->second;
+            audio.filename = audio.path.empty()
+                ? std::to_string(call_info.call_num) + "." + format
+                : std::filesystem::path(audio.path).filename().string();
+        } else if (audio.path.empty() || !std::filesystem::exists(audio.path)) {
+            continue;
         }
+        job->audio_files.push_back(audio);
     }
     
-    // Queue the transfer job
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        transfer_queue_.push(job);
-        transfers_queued_++;
+    transfers_queued_++;
+    
+    // While the server is down new calls queue behind the spooled ones
+    // instead of each retrying against it from memory
+    auto spool_it = spools_.find(call_info.stream_name);
+    if (spool_it != spools_.end() && spool_it->second->backlogged()) {
+        if (spool_requests(*job, all_requests(*job))) {
+            transfers_spooled_++;
+        } else {
+            transfers_failed_++;
+        }
+        return 0;
     }
-    queue_condition_.notify_one();
     
+    if (job->config.transfer_metadata && job->config.batch_size > 1) {
+        queue_for_batch(job);
+    } else if (job->config.transfer_metadata) {
+        transfer_call_metadata(job);
+    } else {
+        transfer_audio_files(job);
+    }
     return 0;
 }
 
-void Trunk_Player_Api::transfer_worker() {
-    while (!stop_workers_) {
-        Transfer_Job job;
-        
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            queue_condition_.wait(lock, [this] { 
-                return stop_workers_ || !transfer_queue_.empty(); 
-            });
-            
-            if (stop_workers_ && transfer_queue_.empty()) {
-                break;
-            }
-            
-            if (!transfer_queue_.empty()) {
-                job = transfer_queue_.front();
-                transfer_queue_.pop();
-            }
+void Trunk_Player_Api::submit_with_retry(CurlMultiClient::Request request, int retries_left,
+                                         std::chrono::seconds backoff, std::function<void(bool)> done) {
+    CurlMultiClient::Request retry = request;
+    request.on_complete = [this, retry, retries_left, backoff, done](const CurlMultiClient::Result& result) {
+        if (result.ok()) {
+            done(true);
+            return;
         }
-        
-        bool success = true;
-        
-        // Transfer call metadata
-        if (job.config.transfer_metadata) {
-            if (!transfer_call_metadata(job)) {
-                success = false;
+        if (result.retryable() && retries_left > 0 && state_ == Plugin_State::PLUGIN_RUNNING) {
+            // Waits in the client's delayed list, not on a thread
+            transfers_retried_++;
+            CurlMultiClient::Request again = retry;
+            again.not_before = std::chrono::steady_clock::now() + backoff;
+            submit_with_retry(std::move(again), retries_left - 1, backoff * 2, done);
+            return;
+        }
+        std::cerr << "[trunk-player API] " << retry.url << " failed: " << result.error() << std::endl;
+        done(false);
+    };
+    if (!client_->submit(std::move(request))) {
+        done(false);
+    }
+}
+
+CurlMultiClient::Request Trunk_Player_Api::build_metadata_request(const Transfer_Job& job) {
+    CurlMultiClient::Request request;
+    request.url = build_call_endpoint(job.config, job.call_info);
+    request.method = "POST";
+    request.body = build_call_json(job.call_info).dump();
+    request.headers = auth_headers(job.config);
+    request.headers.push_back("Content-Type: application/json");
+    request.timeout_seconds = job.config.timeout_seconds;
+    request.verify_ssl = job.config.verify_ssl;
+    return request;
+}
+
+void Trunk_Player_Api::transfer_call_metadata(std::shared_ptr<Transfer_Job> job) {
+    submit_with_retry(build_metadata_request(*job), job->config.retry_count, std::chrono::seconds(1), [this, job](bool ok) {
+        if (!ok) {
+            // The audio needs the call record, so spool both, in order
+            if (spool_requests(*job, all_requests(*job))) {
+                transfers_spooled_++;
+                return;
             }
+            transfers_failed_++;
+            std::cerr << "[trunk-player API] Transfer failed for call " 
+                      << job->call_info.call_num << std::endl;
+            return;
         }
-        
-        // Transfer audio files
-        if (job.config.transfer_audio && success) {
-            for (const std::string& audio_file : job.audio_files) {
-                if (!transfer_audio_file(job, audio_file)) {
-                    success = false;
-                    break;
-                }
-                audio_files_transferred_++;
+        metadata_records_transferred_++;
+        transfer_audio_files(job);
+    });
+}
+
+void Trunk_Player_Api::queue_for_batch(std::shared_ptr<Transfer_Job> job) {
+    std::vector<std::shared_ptr<Transfer_Job>> full;
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        Pending_Batch& batch = batches_[job->call_info.stream_name];
+        if (batch.jobs.empty()) {
+            batch.opened = std::chrono::steady_clock::now();
+        }
+        batch.jobs.push_back(job);
+        if (static_cast<int>(batch.jobs.size()) >= job->config.batch_size) {
+            full.swap(batch.jobs);
+        }
+    }
+    if (!full.empty()) {
+        transfer_batch(std::move(full));
+    }
+    batch_wake_.notify_all();
+}
+
+void Trunk_Player_Api::batch_loop() {
+    std::unique_lock<std::mutex> lock(batch_mutex_);
+    while (true) {
+        // Batches whose window has passed, or all of them when stopping
+        auto now = std::chrono::steady_clock::now();
+        auto next_due = now + std::chrono::seconds(1);
+        std::vector<std::vector<std::shared_ptr<Transfer_Job>>> due;
+        for (auto& entry : batches_) {
+            Pending_Batch& batch = entry.second;
+            if (batch.jobs.empty()) {
+                continue;
+            }
+            auto deadline = batch.opened + batch.jobs.front()->config.batch_window;
+            if (batch_stopping_ || deadline <= now) {
+                due.emplace_back();
+                due.back().swap(batch.jobs);
+            } else {
+                next_due = std::min(next_due, deadline);
             }
         }
-        
-        // Update statistics
-        if (success) {
-            transfers_completed_++;
-            
-            // Cleanup files if requested
-            if (job.config.delete_after_transfer) {
-                for (const std::string& audio_file : job.audio_files) {
-                    std::filesystem::remove(audio_file);
-                }
-                if (strlen(job.call_info.json_filename) > 0) {
-                    std::filesystem::remove(job.call_info.json_filename);
-                }
+        if (!due.empty()) {
+            lock.unlock();
+            for (auto& jobs : due) {
+                transfer_batch(std::move(jobs));
             }
-        } else {
-            transfers_failed_++;
-            
-            // Retry logic could go here
-            std::cerr << "[trunk-player API] Transfer failed for call " 
-                      << job.call_info.call_num << std::endl;
+            lock.lock();
+            continue;
+        }
+        if (batch_stopping_) {
+            return;
         }
+        batch_wake_.wait_until(lock, next_due);
     }
 }
 
-bool Trunk_Player_Api::transfer_call_metadata(const Transfer_Job& job) {
-    CURL* curl = get_curl_handle();
-    if (!curl) return false;
-    
-    // Build API endpoint
-    std::string url = build_call_endpoint(job.config, job.call_info);
-    json call_json = build_call_json(job.call_info);
-    std::string json_data = call_json.dump();
-    
-    // Setup headers
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    
-    if (!job.config.api_key.empty()) {
-        std::string auth_header = "Authorization: Bearer " + job.config.api_key;
-        headers = curl_slist_append(headers, auth_header.c_str());
+void Trunk_Player_Api::transfer_batch(std::vector<std::shared_ptr<Transfer_Job>> jobs) {
+    const Transfer_Config& config = jobs.front()->config;
+    json calls = json::array();
+    for (const auto& job : jobs) {
+        calls.push_back(build_call_json(job->call_info));
     }
     
-    std::string response_data;
-    
-    // Configure CURL
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_data.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, job.config.timeout_seconds);
+    CurlMultiClient::Request request;
+    request.url = build_bulk_call_endpoint(config);
+    request.method = "POST";
+    request.body = calls.dump();
+    request.headers = auth_headers(config);
+    request.headers.push_back("Content-Type: application/json");
+    request.timeout_seconds = config.timeout_seconds;
+    request.verify_ssl = config.verify_ssl;
     
-    if (!job.config.verify_ssl) {
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    batches_sent_++;
+    auto batch = std::make_shared<std::vector<std::shared_ptr<Transfer_Job>>>(std::move(jobs));
+    submit_with_retry(std::move(request), config.retry_count, std::chrono::seconds(1), [this, batch](bool ok) {
+        for (const auto& job : *batch) {
+            if (ok) {
+                // Audio goes per call, all at once over the pooled connections
+                metadata_records_transferred_++;
+                transfer_audio_files(job);
+            } else if (spool_requests(*job, all_requests(*job))) {
+                // Replayed one call at a time
+                transfers_spooled_++;
+            } else {
+                transfers_failed_++;
+                std::cerr << "[trunk-player API] Transfer failed for call "
+                          << job->call_info.call_num << std::endl;
+            }
+        }
+    });
+}
+
+void Trunk_Player_Api::transfer_audio_files(std::shared_ptr<Transfer_Job> job) {
+    if (!job->config.transfer_audio || job->audio_files.empty()) {
+        finish_transfer(*job);
+        return;
     }
-    
-    CURLcode res = curl_easy_perform(curl);
-    long response_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-    
-    curl_slist_free_all(headers);
-    
-    if (res != CURLE_OK || response_code >= 400) {
-        std::cerr << "[trunk-player API] Metadata transfer failed: " 
-                  << "CURL:" << res << " HTTP:" << response_code << std::endl;
-        return false;
+    // Every file goes at once; they multiplex over the same connection
+    job->pending_uploads = static_cast<int>(job->audio_files.size());
+    for (const Audio_Source& audio : job->audio_files) {
+        transfer_audio_file(job, audio);
+    }
+}
+
+void Trunk_Player_Api::finish_transfer(const Transfer_Job& job) {
+    if (job.upload_failed) {
+        transfers_failed_++;
+        std::cerr << "[trunk-player API] Transfer failed for call " 
+                  << job.call_info.call_num << std::endl;
+        return;
+    }
+    if (job.upload_spooled) {
+        transfers_spooled_++;
+    } else {
+        transfers_completed_++;
     }
     
-    metadata_records_transferred_++;
-    return true;
+    // Cleanup files if requested; the spool keeps its own copy
+    if (job.config.delete_after_transfer) {
+        std::error_code ec;
+        for (const Audio_Source& audio : job.audio_files) {
+            if (!audio.path.empty()) {
+                std::filesystem::remove(audio.path, ec);
+            }
+        }
+        if (strlen(job.call_info.json_filename) > 0) {
+            std::filesystem::remove(job.call_info.json_filename, ec);
+        }
+    }
+}
+
+std::vector<std::string> Trunk_Player_Api::auth_headers(const Transfer_Config& config) const {
+    std::vector<std::string> headers;
+    if (!config.api_key.empty()) {
+        headers.push_back("Authorization: Bearer " + config.api_key);
+    }
+    return headers;
 }
 
 json Trunk_Player_Api::build_call_json(const Call_Data_t& call_info) {
@@ -306,6 +425,11 @@ std::string Trunk_Player_Api::build_call_endpoint(const Transfer_Config& config,
     return config.api_base_url + "/calls/";
 }
 
+// Takes a JSON array of the objects build_call_json makes
+std::string Trunk_Player_Api::build_bulk_call_endpoint(const Transfer_Config& config) {
+    return config.api_base_url + "/calls/bulk/";
+}
+
 json Trunk_Player_Api::get_stats() {
     json stats = Base_Plugin::get_stats();
     stats["transfers_queued"] = transfers_queued_.load();
@@ -313,40 +437,86 @@ json Trunk_Player_Api::get_stats() {
     stats["transfers_failed"] = transfers_failed_.load();
     stats["audio_files_transferred"] = audio_files_transferred_.load();
     stats["metadata_records_transferred"] = metadata_records_transferred_.load();
-    stats["queue_size"] = transfer_queue_.size();
+    stats["transfers_retried"] = transfers_retried_.load();
+    stats["transfers_spooled"] = transfers_spooled_.load();
+    stats["batches_sent"] = batches_sent_.load();
+    for (const auto& spool : spools_) {
+        UploadSpool::Stats spool_stats = spool.second->stats();
+        stats["spools"][spool.first] = {
+            {"pending", spool_stats.pending},
+            {"file_bytes", spool_stats.file_bytes},
+            {"replayed", spool_stats.replayed},
+            {"rejected", spool_stats.rejected},
+            {"refused", spool_stats.refused},
+            {"backlogged", spool_stats.backlogged}
+        };
+    }
+    stats["requests_in_flight"] = client_ ? client_->in_flight() : 0;
     return stats;
 }
 
-CURL* Trunk_Player_Api::get_curl_handle() {
-    std::lock_guard<std::mutex> lock(curl_mutex_);
-    std::thread::id thread_id = std::this_thread::get_id();
+CurlMultiClient::Request Trunk_Player_Api::build_audio_request(const Transfer_Job& job, const Audio_Source& audio) {
+    CurlMultiClient::Request request;
+    request.url = build_audio_endpoint(job.config, job.call_info);
+    request.headers = auth_headers(job.config);
+    request.timeout_seconds = job.config.timeout_seconds;
+    request.verify_ssl = job.config.verify_ssl;
     
-    auto it = curl_handles_.find(thread_id);
-    if (it == curl_handles_.end()) {
-        CURL* curl = curl_easy_init();
-        curl_handles_[thread_id] = curl;
-        return curl;
+    CurlMultiClient::Part file_part;
+    file_part.name = "audio_file";
+    if (audio.data) {
+        file_part.data = audio.data;
+        file_part.filename = audio.filename;
+    } else {
+        file_part.file_path = audio.path;
     }
+    request.parts.push_back(file_part);
     
-    // Reset handle for reuse
-    curl_easy_reset(it->second);
-    return it->second;
+    CurlMultiClient::Part metadata_part;
+    metadata_part.name = "metadata";
+    metadata_part.value = build_call_json(job.call_info).dump();
+    metadata_part.content_type = "application/json";
+    request.parts.push_back(metadata_part);
+    return request;
 }
 
-size_t Trunk_Player_Api::write_callback(void* contents, size_t size, size_t nmemb, std::string* response) {
-    size_t total_size = size * nmemb;
-    response->append(static_cast<char*>(contents), total_size);
-    return total_size;
+void Trunk_Player_Api::transfer_audio_file(std::shared_ptr<Transfer_Job> job, const Audio_Source& audio) {
+    submit_with_retry(build_audio_request(*job, audio), job->config.retry_count, std::chrono::seconds(1),
+                      [this, job, audio](bool ok) {
+        if (ok) {
+            audio_files_transferred_++;
+        } else if (spool_requests(*job, {build_audio_request(*job, audio)})) {
+            job->upload_spooled = true;
+        } else {
+            job->upload_failed = true;
+        }
+        if (--job->pending_uploads == 0) {
+            finish_transfer(*job);
+        }
+    });
+}
+
+std::vector<CurlMultiClient::Request> Trunk_Player_Api::all_requests(const Transfer_Job& job) {
+    std::vector<CurlMultiClient::Request> requests;
+    if (job.config.transfer_metadata) {
+        requests.push_back(build_metadata_request(job));
+    }
+    if (job.config.transfer_audio) {
+        for (const Audio_Source& audio : job.audio_files) {
+            requests.push_back(build_audio_request(job, audio));
+        }
+    }
+    return requests;
 }
 
-// Placeholder implementations - would need full multipart upload logic
-bool Trunk_Player_Api::transfer_audio_file(const Transfer_Job& job, const std::string& audio_file) {
-    // Implementation would do multipart file upload to trunk-player API
-    // For now, just return success
-    std::cout << "[trunk-player API] Would transfer: " << audio_file << std::endl;
-    return true;
+bool Trunk_Player_Api::spool_requests(const Transfer_Job& job, const std::vector<CurlMultiClient::Request>& requests) {
+    auto spool_it = spools_.find(job.call_info.stream_name);
+    if (spool_it == spools_.end() || requests.empty() || state_ != Plugin_State::PLUGIN_RUNNING) {
+        return false;
+    }
+    return spool_it->second->add(requests);
 }
 
 std::string Trunk_Player_Api::build_audio_endpoint(const Transfer_Config& config, const Call_Data_t& call_info) {
     return config.api_base_url + "/calls/" + std::to_string(call_info.call_num) + "/audio/";
-}
\ No newline at end of file
+}
@@ -6,11 +6,15 @@
 #pragma once
 
 #include "../../src/plugin_api.h"
-#include <curl/curl.h>
-#include <queue>
-#include <thread>
-#include <mutex>
+#include "../common/curl_multi_client.h"
+#include "../common/upload_spool.h"
+#include <memory>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 class Trunk_Player_Api : public Base_Plugin {
 private:
@@ -25,61 +29,89 @@ private:
         int retry_count;
         int timeout_seconds;
         bool verify_ssl;
+        int batch_size;                    // calls per bulk metadata POST; 1 sends each alone
+        std::chrono::milliseconds batch_window; // longest a call waits for its batch to fill
+    };
+    
+    // One format of the call's audio: sent from the encoder's buffer when
+    // there is one, else read from path
+    struct Audio_Source {
+        std::string path;       // on-disk copy, removed by delete_after_transfer; may be empty
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        std::string filename;   // name given to the upload
     };
     
+    // One call's metadata POST and audio uploads; shared by their callbacks
     struct Transfer_Job {
         Call_Data_t call_info;
         Transfer_Config config;
-        std::vector<std::string> audio_files; // Files to transfer
-        int retry_count;
-        std::chrono::system_clock::time_point next_retry;
+        std::vector<Audio_Source> audio_files; // Audio to transfer
+        std::atomic<int> pending_uploads;
+        std::atomic<bool> upload_failed;
+        std::atomic<bool> upload_spooled;
         
-        Transfer_Job() : retry_count(0), next_retry(std::chrono::system_clock::now()) {}
+        Transfer_Job() : pending_uploads(0), upload_failed(false), upload_spooled(false) {}
     };
     
     std::map<std::string, Transfer_Config> stream_configs_; // stream_name -> config
     
-    // Async transfer queue
-    std::queue<Transfer_Job> transfer_queue_;
-    std::vector<std::thread> transfer_workers_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_condition_;
-    std::atomic<bool> stop_workers_;
+    // Event-loop client: pooled, HTTP/2-multiplexed connections and shared
+    // DNS/TLS session caches instead of a blocking easy handle per worker
+    std::unique_ptr<CurlMultiClient> client_;
     
-    // CURL handles for API calls
-    std::map<std::thread::id, CURL*> curl_handles_;
-    std::mutex curl_mutex_;
+    // Uploads that exhausted their retries wait here, on disk, and replay
+    // when the server recovers; only streams of a spool_dir config have one.
+    // Declared after client_ so they go first.
+    std::map<std::string, std::unique_ptr<UploadSpool>> spools_; // stream_name -> spool
+    
+    // Calls waiting to go out in one bulk metadata POST, by stream; sent
+    // when batch_size is reached or by batch_thread_ once batch_window passes
+    struct Pending_Batch {
+        std::vector<std::shared_ptr<Transfer_Job>> jobs;
+        std::chrono::steady_clock::time_point opened;
+    };
+    std::map<std::string, Pending_Batch> batches_;
+    std::mutex batch_mutex_;
+    std::condition_variable batch_wake_;
+    std::thread batch_thread_;
+    bool batch_stopping_;
     
     // Statistics
     std::atomic<int> transfers_queued_;
     std::atomic<int> transfers_completed_;
     std::atomic<int> transfers_failed_;
+    std::atomic<int> transfers_retried_;
+    std::atomic<int> transfers_spooled_;
+    std::atomic<int> batches_sent_;
     std::atomic<int> audio_files_transferred_;
     std::atomic<int> metadata_records_transferred_;
     
     // API endpoints
     std::string build_call_endpoint(const Transfer_Config& config, const Call_Data_t& call_info);
+    std::string build_bulk_call_endpoint(const Transfer_Config& config);
     std::string build_audio_endpoint(const Transfer_Config& config, const Call_Data_t& call_info);
     std::string build_transmission_endpoint(const Transfer_Config& config, const Call_Data_t& call_info);
     
-    // Worker methods
-    void transfer_worker();
-    bool transfer_call_metadata(const Transfer_Job& job);
-    bool transfer_audio_file(const Transfer_Job& job, const std::string& audio_file);
-    bool transfer_transmissions(const Transfer_Job& job);
+    // Transfer steps, each started from the previous one's completion
+    void transfer_call_metadata(std::shared_ptr<Transfer_Job> job);
+    void queue_for_batch(std::shared_ptr<Transfer_Job> job);
+    void batch_loop();
+    void transfer_batch(std::vector<std::shared_ptr<Transfer_Job>> jobs);
+    void transfer_audio_files(std::shared_ptr<Transfer_Job> job);
+    void transfer_audio_file(std::shared_ptr<Transfer_Job> job, const Audio_Source& audio);
+    CurlMultiClient::Request build_metadata_request(const Transfer_Job& job);
+    CurlMultiClient::Request build_audio_request(const Transfer_Job& job, const Audio_Source& audio);
+    bool spool_requests(const Transfer_Job& job, const std::vector<CurlMultiClient::Request>& requests);
+    std::vector<CurlMultiClient::Request> all_requests(const Transfer_Job& job);
+    void submit_with_retry(CurlMultiClient::Request request, int retries_left, std::chrono::seconds backoff,
+                           std::function<void(bool)> done);
+    void finish_transfer(const Transfer_Job& job);
     
     // API helpers
-    CURL* get_curl_handle();
-    static size_t write_callback(void* contents, size_t size, size_t nmemb, std::string* response);
+    std::vector<std::string> auth_headers(const Transfer_Config& config) const;
     json build_call_json(const Call_Data_t& call_info);
     json build_transmission_json(const Call_Data_t& call_info);
     
-    // Multipart upload for audio files
-    bool upload_multipart_file(CURL* curl, const std::string& url, 
-                              const std::string& file_path,
-                              const json& metadata,
-                              const std::map<std::string, std::string>& headers);
-    
 public:
     Trunk_Player_Api();
     virtual ~Trunk_Player_Api();
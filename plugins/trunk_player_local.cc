@@ -1,6 +1,13 @@
 /*
  * Trunk Player Local Plugin
  * Uploads processed calls to local trunk-player database via Django management command
+ *
+ * In the default "worker" ingest mode one long-lived `manage.py shell`
+ * runs add_transmission for every call, fed from a queue in batches over
+ * a socket, so a call costs a line of JSON instead of a Python start-up
+ * and a Django import. "command" mode keeps the old process per call.
+ * Durations come from the decoder's sample count, or the WAV header,
+ * rather than a soxi subprocess.
  */
 
 #include "../src/plugin_api.h"
@@ -9,10 +16,21 @@
 #include <sstream>
 #include <filesystem>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <cstdio>
 #include <memory>
 #include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 class Trunk_Player_Local : public Base_Plugin {
 private:
@@ -23,19 +41,44 @@ private:
     int source_id_;
     bool keep_files_;
     bool verbose_;
+    std::string ingest_mode_;      // "worker" or "command"
+    size_t ingest_batch_size_;
+    
+    // A call whose files are ready, waiting for add_transmission
+    struct Ingest_Item {
+        std::string name;
+        std::string web_dir;
+        std::string audio_file;
+        std::string json_file;
+    };
+    
+    // Worker mode: queue drained by ingest_thread_ into the manage.py worker
+    std::deque<Ingest_Item> ingest_queue_;
+    std::mutex ingest_mutex_;
+    std::condition_variable ingest_cv_;
+    std::thread ingest_thread_;
+    bool ingest_stopping_;
+    pid_t worker_pid_;
+    int worker_fd_;               // our end of the worker's stdin/stdout socket
+    std::string worker_buffer_;   // response bytes past the last full line
     
     // Statistics
-    int calls_processed_;
-    int calls_successful_;
-    int calls_failed_;
+    std::atomic<int> calls_processed_;
+    std::atomic<int> calls_successful_;
+    std::atomic<int> calls_failed_;
+    std::atomic<int> worker_starts_;
     
 public:
     PLUGIN_INFO("Trunk Player Local", "1.0.0", "Dave K9DPD", "Uploads processed calls to local trunk-player database via Django commands")
     
     Trunk_Player_Local() : system_id_(0), source_id_(0), keep_files_(false), verbose_(false),
-                           calls_processed_(0), calls_successful_(0), calls_failed_(0) {}
+                           ingest_mode_("worker"), ingest_batch_size_(32), ingest_stopping_(false),
+                           worker_pid_(-1), worker_fd_(-1),
+                           calls_processed_(0), calls_successful_(0), calls_failed_(0), worker_starts_(0) {}
     
-    virtual ~Trunk_Player_Local() = default;
+    virtual ~Trunk_Player_Local() {
+        stop_ingest();
+    }
     
     virtual int init(json config_data) override {
         if (parse_config(config_data) != 0) {
@@ -60,14 +103,21 @@ public:
             return -1;
         }
         
+        if (ingest_mode_ == "worker") {
+            ingest_stopping_ = false;
+            ingest_thread_ = std::thread(&Trunk_Player_Local::ingest_worker, this);
+        }
+        
         set_state(Plugin_State::PLUGIN_RUNNING);
         if (verbose_) {
-            std::cout << "[TrunkPlayerUploader] Plugin started" << std::endl;
+            std::cout << "[TrunkPlayerUploader] Plugin started (" << ingest_mode_ << " ingest)" << std::endl;
         }
         return 0;
     }
     
     virtual int stop() override {
+        // Queued calls are ingested before the worker exits
+        stop_ingest();
         set_state(Plugin_State::PLUGIN_STOPPED);
         if (verbose_) {
             std::cout << "[TrunkPlayerUploader] Plugin stopped. Stats: " 
@@ -86,6 +136,8 @@ public:
         keep_files_ = config_.value("keep_files", false);
         verbose_ = config_.value("verbose", false);
         enabled_ = config_.value("enabled", true);
+        ingest_mode_ = config_.value("ingest_mode", "worker");
+        ingest_batch_size_ = std::max(1, config_.value("ingest_batch_size", 32));
         
         venv_python_path_ = trunk_player_path_ + "/venv/bin/python";
         manage_py_path_ = trunk_player_path_ + "/manage.py";
@@ -96,6 +148,7 @@ public:
             std::cout << "  System ID: " << system_id_ << std::endl;
             std::cout << "  Source ID: " << source_id_ << std::endl;
             std::cout << "  Keep Files: " << (keep_files_ ? "YES" : "NO") << std::endl;
+            std::cout << "  Ingest Mode: " << ingest_mode_ << std::endl;
         }
         
         return 0;
@@ -137,7 +190,7 @@ public:
         }
         
         // Get audio duration
-        double duration = get_audio_duration(audio_file);
+        double duration = call_info.audio_duration > 0 ? call_info.audio_duration : get_audio_duration(audio_file);
         if (duration <= 0) {
             if (verbose_) {
                 std::cout << "[TrunkPlayerUploader] Error: Could not determine audio duration" << std::endl;
@@ -158,6 +211,22 @@ public:
         // Calculate web directory
         std::string web_dir = calculate_web_dir(audio_file);
         
+        Ingest_Item item;
+        item.name = std::filesystem::path(audio_file).stem().string();
+        item.web_dir = web_dir;
+        item.audio_file = audio_file;
+        item.json_file = json_file;
+        
+        // Worker mode finishes the call on the ingest thread
+        if (ingest_mode_ == "worker") {
+            {
+                std::lock_guard<std::mutex> lock(ingest_mutex_);
+                ingest_queue_.push_back(item);
+            }
+            ingest_cv_.notify_one();
+            return 0;
+        }
+        
         // Add to trunk-player
         if (!add_transmission_to_db(audio_file, web_dir)) {
             if (verbose_) {
@@ -184,13 +253,19 @@ public:
     
     virtual json get_stats() override {
         json stats = Base_Plugin::get_stats();
-        stats["calls_processed"] = calls_processed_;
-        stats["calls_successful"] = calls_successful_;
-        stats["calls_failed"] = calls_failed_;
+        stats["calls_processed"] = calls_processed_.load();
+        stats["calls_successful"] = calls_successful_.load();
+        stats["calls_failed"] = calls_failed_.load();
         stats["success_rate"] = calls_processed_ > 0 ? 
             static_cast<double>(calls_successful_) / calls_processed_ * 100.0 : 0.0;
         stats["trunk_player_path"] = trunk_player_path_;
         stats["system_id"] = system_id_;
+        stats["ingest_mode"] = ingest_mode_;
+        stats["worker_starts"] = worker_starts_.load();
+        {
+            std::lock_guard<std::mutex> lock(ingest_mutex_);
+            stats["ingest_queue"] = ingest_queue_.size();
+        }
         stats["configured"] = validate_paths();
         return stats;
     }
@@ -200,25 +275,32 @@ private:
         return std::filesystem::exists(venv_python_path_) && std::filesystem::exists(manage_py_path_);
     }
     
+    // Seconds of audio from the WAV header: data chunk size over byte rate
     double get_audio_duration(const std::string& audio_file) {
-        std::string command = "soxi -D \"" + audio_file + "\"";
-        
-        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(command.c_str(), "r"), pclose);
-        if (!pipe) {
+        std::ifstream file(audio_file, std::ios::binary);
+        char riff[12];
+        if (!file.read(riff, sizeof(riff)) || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
             return 0.0;
         }
         
-        char buffer[128];
-        std::string result;
-        while (fgets(buffer, sizeof(buffer), pipe.get()) != nullptr) {
-            result += buffer;
-        }
-        
-        try {
-            return std::stod(result);
-        } catch (const std::exception& e) {
-            return 0.0;
+        uint32_t byte_rate = 0;
+        char chunk[8];
+        while (file.read(chunk, sizeof(chunk))) {
+            uint32_t size = static_cast<uint8_t>(chunk[4]) | static_cast<uint8_t>(chunk[5]) << 8 |
+                            static_cast<uint8_t>(chunk[6]) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(chunk[7])) << 24;
+            if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+                char fmt[16];
+                file.read(fmt, sizeof(fmt));
+                byte_rate = static_cast<uint8_t>(fmt[8]) | static_cast<uint8_t>(fmt[9]) << 8 |
+                            static_cast<uint8_t>(fmt[10]) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(fmt[11])) << 24;
+                file.seekg(size - sizeof(fmt) + (size & 1), std::ios::cur);
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                return byte_rate > 0 ? static_cast<double>(size) / byte_rate : 0.0;
+            } else {
+                file.seekg(size + (size & 1), std::ios::cur);
+            }
         }
+        return 0.0;
     }
     
     bool update_json_metadata(const std::string& json_file, double duration, int source_id) {
@@ -316,6 +398,198 @@ private:
         return result == 0;
     }
     
+    // Runs in `manage.py shell -c`: one JSON request per line in, one
+    // "OK <id>" or "ERR <id> <message>" line out. Whatever the command
+    // prints goes to stderr so it cannot be mistaken for a reply.
+    static const char* worker_script() {
+        return
+            "import io, json, sys\n"
+            "from django.core.management import call_command\n"
+            "replies = sys.stdout\n"
+            "sys.stdout = sys.stderr\n"
+            "for line in sys.stdin:\n"
+            "    request = json.loads(line)\n"
+            "    try:\n"
+            "        call_command('add_transmission', request['name'], web_url=request['web_url'], system=request['system'])\n"
+            "        replies.write('OK %d\\n' % request['id'])\n"
+            "    except BaseException as e:\n"
+            "        replies.write('ERR %d %s\\n' % (request['id'], str(e).replace('\\n', ' ')))\n"
+            "    replies.flush()\n";
+    }
+    
+    bool start_worker() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+            return false;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        if (pid == 0) {
+            dup2(fds[1], STDIN_FILENO);
+            dup2(fds[1], STDOUT_FILENO);
+            if (chdir(trunk_player_path_.c_str()) != 0) {
+                _exit(127);
+            }
+            execl(venv_python_path_.c_str(), venv_python_path_.c_str(), manage_py_path_.c_str(),
+                  "shell", "-c", worker_script(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        close(fds[1]);
+        worker_pid_ = pid;
+        worker_fd_ = fds[0];
+        worker_buffer_.clear();
+        worker_starts_++;
+        if (verbose_) {
+            std::cout << "[TrunkPlayerUploader] Started manage.py worker (pid " << pid << ")" << std::endl;
+        }
+        return true;
+    }
+    
+    void stop_worker() {
+        if (worker_fd_ >= 0) {
+            close(worker_fd_);   // EOF on its stdin ends the loop
+            worker_fd_ = -1;
+        }
+        if (worker_pid_ > 0) {
+            int status;
+            waitpid(worker_pid_, &status, 0);
+            worker_pid_ = -1;
+        }
+    }
+    
+    bool read_worker_line(std::string& line) {
+        while (true) {
+            size_t newline = worker_buffer_.find('\n');
+            if (newline != std::string::npos) {
+                line = worker_buffer_.substr(0, newline);
+                worker_buffer_.erase(0, newline + 1);
+                return true;
+            }
+            char buffer[4096];
+            ssize_t n = recv(worker_fd_, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                return false;
+            }
+            worker_buffer_.append(buffer, static_cast<size_t>(n));
+        }
+    }
+    
+    // Sends the whole batch, then collects the replies; items left without
+    // a reply because the worker died are returned in unanswered
+    void ingest_batch(const std::vector<Ingest_Item>& batch, std::vector<bool>& done,
+                      std::vector<size_t>& unanswered) {
+        unanswered.clear();
+        std::string requests;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (done[i]) {
+                continue;
+            }
+            json request = {{"id", i}, {"name", batch[i].name}, {"web_url", batch[i].web_dir}, {"system", system_id_}};
+            requests += request.dump() + "\n";
+            unanswered.push_back(i);
+        }
+        if (worker_fd_ < 0 && !start_worker()) {
+            return;
+        }
+        size_t sent = 0;
+        while (sent < requests.size()) {
+            ssize_t n = send(worker_fd_, requests.data() + sent, requests.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                stop_worker();
+                return;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        
+        std::string line;
+        size_t expected = unanswered.size();
+        for (size_t replies = 0; replies < expected; replies++) {
+            if (!read_worker_line(line)) {
+                stop_worker();
+                break;
+            }
+            bool ok = line.compare(0, 3, "OK ") == 0;
+            size_t id = std::strtoul(line.c_str() + (ok ? 3 : 4), nullptr, 10);
+            if (id >= batch.size() || done[id]) {
+                continue;
+            }
+            done[id] = true;
+            finish_item(batch[id], ok, ok ? "" : line);
+        }
+        std::vector<size_t> remaining;
+        for (size_t i : unanswered) {
+            if (!done[i]) {
+                remaining.push_back(i);
+            }
+        }
+        unanswered.swap(remaining);
+    }
+    
+    void finish_item(const Ingest_Item& item, bool ok, const std::string& error) {
+        if (!ok) {
+            if (verbose_) {
+                std::cout << "[TrunkPlayerUploader] Error: add_transmission failed for " << item.name
+                          << ": " << error << std::endl;
+            }
+            calls_failed_++;
+            return;
+        }
+        if (!keep_files_) {
+            cleanup_files(item.audio_file, item.json_file);
+        }
+        calls_successful_++;
+        if (verbose_) {
+            std::cout << "[TrunkPlayerUploader] Successfully processed call: " << item.name << std::endl;
+        }
+    }
+    
+    void ingest_worker() {
+        std::unique_lock<std::mutex> lock(ingest_mutex_);
+        while (true) {
+            ingest_cv_.wait(lock, [this] { return !ingest_queue_.empty() || ingest_stopping_; });
+            if (ingest_queue_.empty()) {
+                break;
+            }
+            std::vector<Ingest_Item> batch;
+            while (!ingest_queue_.empty() && batch.size() < ingest_batch_size_) {
+                batch.push_back(std::move(ingest_queue_.front()));
+                ingest_queue_.pop_front();
+            }
+            lock.unlock();
+            
+            // A worker that dies mid-batch is restarted once for the rest;
+            // whatever still has no answer goes through the old command
+            std::vector<bool> done(batch.size(), false);
+            std::vector<size_t> unanswered;
+            ingest_batch(batch, done, unanswered);
+            if (!unanswered.empty()) {
+                ingest_batch(batch, done, unanswered);
+            }
+            for (size_t i : unanswered) {
+                finish_item(batch[i], add_transmission_to_db(batch[i].audio_file, batch[i].web_dir), "manage.py worker unavailable");
+            }
+            
+            lock.lock();
+        }
+        lock.unlock();
+        stop_worker();
+    }
+    
+    void stop_ingest() {
+        {
+            std::lock_guard<std::mutex> lock(ingest_mutex_);
+            ingest_stopping_ = true;
+        }
+        ingest_cv_.notify_all();
+        if (ingest_thread_.joinable()) {
+            ingest_thread_.join();
+        }
+    }
+    
     void cleanup_files(const std::string& audio_file, const std::string& json_file) {
         try {
             if (std::filesystem::exists(audio_file)) {
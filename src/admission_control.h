@@ -0,0 +1,162 @@
+/*
+ * Admission control for decode jobs
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Decides whether a new job may be queued, from the real queue depth and
+ * the measured rate at which jobs finish. A job is turned away when the
+ * queue is full or would take longer than max_queue_delay to drain, and
+ * the caller is told when to retry: roughly the time the backlog needs to
+ * fall back under the limit.
+ *
+ * Once the queue is under pressure every stream is held to a token bucket
+ * refilled at its share of the service rate, so one system flooding the
+ * API is throttled on its own while quieter streams keep being accepted.
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+struct AdmissionPolicy {
+    double max_queue_delay_s = 30.0;   // backlog, in seconds of work, before new jobs are refused
+    double pressure_fraction = 0.5;    // share of that limit at which per-stream buckets apply
+    double stream_rate = 0.0;          // jobs/s per stream; 0 for an equal share of the service rate
+    double stream_burst = 20.0;        // jobs a stream may submit back to back
+    int max_retry_after_s = 60;
+};
+
+class AdmissionController {
+public:
+    enum Result {
+        ACCEPT,
+        OVERLOADED,      // queue full or too slow to drain
+        STREAM_LIMITED   // this stream used up its share
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    AdmissionController()
+        : completions_(0), window_start_(Clock::now()), service_rate_(0.0) {}
+
+    void set_policy(const AdmissionPolicy& policy) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        policy_ = policy;
+    }
+
+    // Lock-free; called for every finished job
+    void record_completion() { completions_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Jobs finished per second, smoothed
+    double service_rate() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        update_rate(Clock::now());
+        return service_rate_;
+    }
+
+    // Admit one job for a stream given the current backlog; on refusal
+    // retry_after_s says when trying again is worthwhile
+    Result admit(const std::string& stream, int queue_depth, int queue_capacity, int& retry_after_s) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Clock::time_point now = Clock::now();
+        update_rate(now);
+        retry_after_s = 0;
+
+        // Until a rate has been measured only the hard capacity applies
+        double limit = queue_capacity;
+        if (service_rate_ > 0.0) {
+            limit = std::min(limit, std::max(1.0, service_rate_ * policy_.max_queue_delay_s));
+        }
+        if (queue_depth >= limit) {
+            double excess = queue_depth - limit * policy_.pressure_fraction + 1;
+            retry_after_s = clamp_retry(service_rate_ > 0.0 ? excess / service_rate_ : 5.0);
+            return OVERLOADED;
+        }
+
+        Bucket& bucket = refill(stream, now);
+        bool under_pressure = queue_depth >= limit * policy_.pressure_fraction;
+        if (bucket.tokens >= 1.0) {
+            bucket.tokens -= 1.0;
+            return ACCEPT;
+        }
+        if (!under_pressure) {
+            return ACCEPT;
+        }
+        double rate = stream_rate();
+        retry_after_s = clamp_retry(rate > 0.0 ? (1.0 - bucket.tokens) / rate : 1.0);
+        return STREAM_LIMITED;
+    }
+
+    size_t tracked_streams() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return buckets_.size();
+    }
+
+private:
+    struct Bucket {
+        double tokens;
+        Clock::time_point updated;
+    };
+
+    static constexpr double RATE_WINDOW_S = 1.0;
+    static constexpr double RATE_SMOOTHING = 0.3;
+    static constexpr int STREAM_IDLE_S = 300;   // buckets unused this long are forgotten
+
+    AdmissionPolicy policy_;
+    std::mutex mutex_;
+    std::map<std::string, Bucket> buckets_;
+    std::atomic<uint64_t> completions_;
+    Clock::time_point window_start_;
+    double service_rate_;
+
+    void update_rate(Clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - window_start_).count();
+        if (elapsed < RATE_WINDOW_S) {
+            return;
+        }
+        double measured = completions_.exchange(0, std::memory_order_relaxed) / elapsed;
+        service_rate_ = service_rate_ > 0.0 ? service_rate_ + RATE_SMOOTHING * (measured - service_rate_) : measured;
+        window_start_ = now;
+
+        // Forget idle streams so the map stays as small as the active set
+        for (auto it = buckets_.begin(); it != buckets_.end();) {
+            if (now - it->second.updated > std::chrono::seconds(STREAM_IDLE_S)) {
+                it = buckets_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    double stream_rate() const {
+        if (policy_.stream_rate > 0.0) {
+            return policy_.stream_rate;
+        }
+        return buckets_.empty() ? service_rate_ : service_rate_ / buckets_.size();
+    }
+
+    Bucket& refill(const std::string& stream, Clock::time_point now) {
+        auto it = buckets_.find(stream);
+        if (it == buckets_.end()) {
+            it = buckets_.emplace(stream, Bucket{policy_.stream_burst, now}).first;
+            return it->second;
+        }
+        Bucket& bucket = it->second;
+        double elapsed = std::chrono::duration<double>(now - bucket.updated).count();
+        bucket.tokens = std::min(policy_.stream_burst, bucket.tokens + elapsed * stream_rate());
+        bucket.updated = now;
+        return bucket;
+    }
+
+    int clamp_retry(double seconds) const {
+        int retry = static_cast<int>(std::ceil(seconds));
+        return std::max(1, std::min(retry, policy_.max_retry_after_s));
+    }
+};
@@ -0,0 +1,86 @@
+#include "alloc_stats.h"
+
+#ifdef TRUNK_DECODER_ALLOC_STATS
+
+#include <cstdlib>
+#include <new>
+
+// Plain integers: each is only touched by its own thread
+static thread_local uint64_t thread_allocations = 0;
+static thread_local uint64_t thread_bytes = 0;
+
+static void* counted_alloc(std::size_t size) {
+    thread_allocations++;
+    thread_bytes += size;
+    return std::malloc(size ? size : 1);
+}
+
+static void* counted_alloc_aligned(std::size_t size, std::align_val_t align) {
+    thread_allocations++;
+    thread_bytes += size;
+    std::size_t alignment = static_cast<std::size_t>(align);
+    // aligned_alloc wants a whole number of alignments
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* operator new(std::size_t size) {
+    if (void* p = counted_alloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_alloc(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    if (void* p = counted_alloc_aligned(size, align)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+bool AllocStats::enabled() {
+    return true;
+}
+
+AllocStats::Counts AllocStats::thread_counts() {
+    Counts counts;
+    counts.allocations = thread_allocations;
+    counts.bytes = thread_bytes;
+    return counts;
+}
+
+#else
+
+bool AllocStats::enabled() {
+    return false;
+}
+
+AllocStats::Counts AllocStats::thread_counts() {
+    return Counts();
+}
+
+#endif
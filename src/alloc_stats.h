@@ -0,0 +1,48 @@
+/*
+ * Heap allocation counting for trunk-decoder
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Built with -DTRUNK_DECODER_ALLOC_STATS=ON, alloc_stats.cc replaces the
+ * global operator new and counts every allocation against the calling
+ * thread. A Scope around a piece of work reads how many allocations it
+ * made. The job manager adds up each call's stages that way and reports
+ * the total per call, so a change that brings allocations back into the
+ * decode path shows up in /metrics and the job status.
+ *
+ * Without the option nothing is replaced, enabled() is false and Scopes
+ * read zero.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+class AllocStats {
+public:
+    struct Counts {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+    };
+
+    static bool enabled();
+
+    // This thread's allocations since it started
+    static Counts thread_counts();
+
+    class Scope {
+    public:
+        Scope() : start_(thread_counts()) {}
+
+        Counts elapsed() const {
+            Counts now = thread_counts();
+            Counts counts;
+            counts.allocations = now.allocations - start_.allocations;
+            counts.bytes = now.bytes - start_.bytes;
+            return counts;
+        }
+
+    private:
+        Counts start_;
+    };
+};
@@ -1,4 +1,12 @@
 #include "api_service.h"
+#include "audio_encoder.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "plugin_api.h"
+#include "content_hash.h"
+#include "alloc_stats.h"
+#include "thread_placement.h"
+#include "temp_store.h"
 #include <filesystem>
 #include <fstream>
 #include <thread>
@@ -7,13 +15,197 @@
 #include <sstream>
 #include <map>
 #include <ctime>
+#include <strings.h>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/stat.h>
+
+// Live call pushed to /api/v1/stream as a raw .p25 frame stream (chunked or
+// with a Content-Length). Each LDU is decoded as soon as it is complete and
+// its audio goes to the stream hooks; the recorded bytes are then queued as
+// a normal job so the call ends up with the same files as /api/v1/decode.
+class LiveCallStream : public HttpStreamHandler {
+public:
+    explicit LiveCallStream(ApiService& api)
+        : api_(api), decoder_(api.job_manager_->acquire_decoder()),
+          recorded_(std::make_shared<std::vector<uint8_t>>()), parsed_(0), samples_streamed_(0) {}
+    
+    bool begin(const HttpRequest& request, HttpResponse& response) override {
+        if (!api_.validate_auth_token(request)) {
+            response.status_code = 401;
+            response.headers["WWW-Authenticate"] = "Bearer realm=trunk-decoder";
+            response.set_json("{\"error\": \"Authentication required\"}");
+            return false;
+        }
+        if (request.method != "POST") {
+            response.status_code = 405;
+            response.set_json("{\"error\": \"Method not allowed\"}");
+            return false;
+        }
+        
+        // Call details travel in headers since the body is the frame stream itself
+        metadata_str_ = header(request, "X-Call-Metadata");
+        filename_ = header(request, "X-Call-Filename");
+        call_.stream_name = header(request, "X-Stream-Name");
+        callback_url_ = header(request, "X-Callback-Url");
+        if (!callback_url_.empty() && !WebhookNotifier::valid_url(callback_url_)) {
+            response.status_code = 400;
+            response.set_json("{\"error\": \"callback_url must be an http:// URL\"}");
+            return false;
+        }
+        if (!api_.admit_job(call_.stream_name, response)) {
+            return false;
+        }
+        if (call_.stream_name.empty()) {
+            call_.stream_name = "default";
+        }
+        if (filename_.empty()) {
+            filename_ = "stream_call_" + std::to_string(std::time(nullptr)) + ".p25";
+        }
+        
+        int priority = call_.priority;
+        call_metadata_ = TrunkCallMetadata::parse(metadata_str_);
+        SchedulingPolicy::read_call_metadata(*call_metadata_, call_.talkgroup, call_.emergency, priority);
+        call_.priority = priority;
+        if (call_metadata_->is_object()) {
+            call_.call_json = call_metadata_->object;
+            if (!call_metadata_->short_name.empty()) {
+                call_.system_short_name = call_metadata_->short_name;
+            }
+        } else if (call_metadata_->empty()) {
+            call_.call_json = json::object();
+        }
+        call_.start_time = std::time(nullptr);
+        call_.processing_start = std::chrono::system_clock::now();
+        
+        decoder_->begin_call(call_metadata_, filename_);
+        if (api_.stream_hooks_.call_start) {
+            api_.stream_hooks_.call_start(&call_);
+        }
+        if (api_.verbose_) {
+            std::cout << "[API] Live stream started: TG " << call_.talkgroup
+                      << " | Stream:" << call_.stream_name << std::endl;
+        }
+        return true;
+    }
+    
+    bool data(const uint8_t* bytes, size_t length) override {
+        if (recorded_->size() + length > MAX_STREAM_BYTES) {
+            return false;
+        }
+        recorded_->insert(recorded_->end(), bytes, bytes + length);
+        
+        // Decode every frame that is now complete; a partial one waits for more bytes
+        P25Frame frame;
+        size_t used;
+        while ((used = frame_parser_.parse_frame(recorded_->data() + parsed_, recorded_->size() - parsed_, frame)) > 0) {
+            parsed_ += used;
+            if (call_.nac == 0) {
+                call_.nac = frame.nac;
+            }
+            if (frame.is_encrypted) {
+                call_.encrypted = true;
+            }
+            const std::vector<int16_t>& pcm = decoder_->push_frame(frame);
+            if (!pcm.empty()) {
+                samples_streamed_ += pcm.size();
+                if (api_.stream_hooks_.audio_stream) {
+                    // The plugin API takes a mutable pointer; the buffer is ours until the next frame
+                    api_.stream_hooks_.audio_stream(&call_, const_cast<int16_t*>(pcm.data()), static_cast<int>(pcm.size()));
+                }
+            }
+        }
+        return true;
+    }
+    
+    void end(bool complete, HttpResponse& response) override {
+        const CallMetadata& stats = decoder_->end_call();
+        call_.stop_time = std::time(nullptr);
+        if (api_.stream_hooks_.call_end) {
+            api_.stream_hooks_.call_end(call_);
+        }
+        
+        if (!complete) {
+            response.status_code = 413;
+            response.set_json("{\"error\": \"Stream too large\"}");
+            return;
+        }
+        if (parsed_ == 0) {
+            response.status_code = 400;
+            response.set_json("{\"error\": \"No P25 frames in stream\"}");
+            return;
+        }
+        
+        auto job = std::make_shared<ProcessingJob>();
+        job->p25_data = recorded_;
+        job->metadata_json = metadata_str_;
+        job->call_metadata = call_metadata_;
+        job->output_base_path = api_.build_output_base_path(metadata_str_, filename_);
+        job->stream_name = call_.stream_name;
+        job->upload_script = api_.upload_script_;
+        job->audio_format = api_.audio_format_;
+        job->audio_bitrate = api_.audio_bitrate_;
+        job->callback_url = callback_url_;
+        std::string job_id = api_.job_manager_->submit_job(job);
+        
+        std::ostringstream json_out;
+        json_out << "{"
+                 << "\"job_id\": \"" << job_id << "\","
+                 << "\"status\": \"" << (job_id.empty() ? "streamed" : "queued") << "\","
+                 << "\"frames\": " << stats.total_frames << ","
+                 << "\"voice_frames\": " << stats.voice_frames << ","
+                 << "\"samples_streamed\": " << samples_streamed_ << ","
+                 << "\"stream_name\": \"" << call_.stream_name << "\""
+                 << "}";
+        response.status_code = job_id.empty() ? 503 : 202;
+        response.set_json(json_out.str());
+    }
+    
+private:
+    // A call this long would be hours of audio; anything bigger is a runaway client
+    static constexpr size_t MAX_STREAM_BYTES = 64 * 1024 * 1024;
+    
+    static std::string header(const HttpRequest& request, const char* name) {
+        for (const auto& entry : request.headers) {
+            if (strcasecmp(entry.first.c_str(), name) == 0) {
+                return entry.second;
+            }
+        }
+        return "";
+    }
+    
+    ApiService& api_;
+    DecoderPool::Lease decoder_;
+    P25FrameParser frame_parser_;
+    Call_Data_t call_;
+    std::string metadata_str_;
+    std::shared_ptr<const TrunkCallMetadata> call_metadata_;
+    std::string filename_;
+    std::string callback_url_;
+    std::shared_ptr<std::vector<uint8_t>> recorded_;
+    size_t parsed_;
+    uint64_t samples_streamed_;
+};
 
 ApiService::ApiService(int port, const std::string& output_dir, bool verbose, bool foreground,
                        int worker_threads, int queue_size, int job_timeout_ms) 
-    : output_dir_(output_dir), verbose_(verbose), foreground_(foreground), audio_format_("wav"), audio_bitrate_(0),
+    : output_dir_(output_dir), archive_dir_(output_dir), verbose_(verbose), foreground_(foreground), audio_format_("wav"), audio_bitrate_(0),
+      audio_cache_memory_(AudioCache::DEFAULT_MEMORY_BYTES), audio_cache_disk_(AudioCache::DEFAULT_DISK_BYTES), upload_dedupe_(true),
       worker_threads_(worker_threads), queue_size_(queue_size), job_timeout_ms_(job_timeout_ms) {
     http_service_ = std::make_unique<HttpService>(port);
+    http_service_->set_upload_buffer_limit(DEFAULT_UPLOAD_BUFFER_LIMIT);
     job_manager_ = std::make_unique<JobManager>(worker_threads_, queue_size_, job_timeout_ms_, verbose_);
+    webhooks_ = std::make_unique<WebhookNotifier>(2, static_cast<size_t>(queue_size_ > 0 ? queue_size_ : 1), verbose_);
+    job_manager_->set_completion_handler([this](const ProcessingJob& job) {
+        if (!job.callback_url.empty()) {
+            webhooks_->notify(job.callback_url, job_status_json(job));
+        }
+        if (cluster_consumer_) {
+            cluster_consumer_->finished(job.job_id);
+        }
+    });
     
     // Register API endpoints
     http_service_->add_handler("/api/v1/decode", 
@@ -26,10 +218,40 @@ ApiService::ApiService(int port, const std::string& output_dir, bool verbose, bo
             this->handle_status_request(req, resp);
         });
         
+    http_service_->add_handler("/metrics",
+        [this](const HttpRequest& req, HttpResponse& resp) {
+            this->handle_metrics_request(req, resp);
+        });
+        
+    http_service_->add_handler("/api/v1/trace",
+        [this](const HttpRequest& req, HttpResponse& resp) {
+            this->handle_trace_request(req, resp);
+        });
+        
+    http_service_->add_handler("/api/v1/profile",
+        [this](const HttpRequest& req, HttpResponse& resp) {
+            this->handle_profile_request(req, resp);
+        });
+        
     http_service_->add_handler("/api/v1/jobs/", 
         [this](const HttpRequest& req, HttpResponse& resp) {
             this->handle_job_status_request(req, resp);
         });
+        
+    http_service_->add_handler("/api/v1/snippet",
+        [this](const HttpRequest& req, HttpResponse& resp) {
+            this->handle_snippet_request(req, resp);
+        });
+        
+    http_service_->add_handler("/api/v1/calls/",
+        [this](const HttpRequest& req, HttpResponse& resp) {
+            this->handle_call_audio_request(req, resp);
+        });
+        
+    http_service_->add_stream_handler("/api/v1/stream",
+        [this]() -> std::unique_ptr<HttpStreamHandler> {
+            return std::unique_ptr<HttpStreamHandler>(new LiveCallStream(*this));
+        });
 }
 
 ApiService::~ApiService() {
@@ -45,11 +267,20 @@ bool ApiService::start() {
         return false;
     }
     
-    // Start job manager first
+    if (!audio_cache_) {
+        audio_cache_.reset(new AudioCache(audio_cache_dir_.empty() ? output_dir_ + "/.audio-cache" : audio_cache_dir_,
+                                          audio_cache_memory_, audio_cache_disk_));
+    }
+    
+    // Start job manager first, with somewhere to send its completions
+    webhooks_->start();
     if (!job_manager_->start()) {
         std::cerr << "Failed to start job manager" << std::endl;
         return false;
     }
+    if (cluster_consumer_) {
+        cluster_consumer_->start();
+    }
     
     // Configure HTTPS if enabled
     if (!ssl_cert_file_.empty() && !ssl_key_file_.empty()) {
@@ -82,6 +313,13 @@ void ApiService::stop() {
     if (job_manager_) {
         job_manager_->stop();
     }
+    // After the job manager, so jobs that finish while it drains are acknowledged
+    if (cluster_consumer_) {
+        cluster_consumer_->stop();
+    }
+    if (webhooks_) {
+        webhooks_->stop();
+    }
 }
 
 bool ApiService::is_running() const {
@@ -110,6 +348,149 @@ bool ApiService::validate_auth_token(const HttpRequest& request) {
     return false;
 }
 
+std::string ApiService::build_output_base_path(const std::string& metadata_str, const std::string& filename) {
+    // Get original filename for output path generation; the client never picks the directory
+    std::string original_filename = filename;
+    size_t slash = original_filename.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        original_filename = original_filename.substr(slash + 1);
+    }
+    if (original_filename.empty() || original_filename == "." || original_filename == "..") {
+        original_filename = "api_call_" + std::to_string(std::time(nullptr)) + ".p25";
+    }
+    
+    // Remove .p25 extension if present
+    std::string base_filename = original_filename;
+    if (base_filename.size() > 4 && base_filename.substr(base_filename.size() - 4) == ".p25") {
+        base_filename = base_filename.substr(0, base_filename.size() - 4);
+    }
+    
+    // Create basic output path (detailed folder structure will be created by worker)
+    std::string folder_path = output_dir_;
+    if (!metadata_str.empty()) {
+        try {
+            // Quick parse for system name to create basic folder structure
+            size_t short_name_pos = metadata_str.find("\"short_name\": \"");
+            if (short_name_pos != std::string::npos) {
+                short_name_pos += 15;
+                size_t short_name_end = metadata_str.find("\"", short_name_pos);
+                std::string short_name = metadata_str.substr(short_name_pos, short_name_end - short_name_pos);
+                if (!short_name.empty() && short_name.find('/') == std::string::npos && short_name != "..") {
+                    folder_path = output_dir_ + "/" + short_name;
+                    std::filesystem::create_directories(folder_path);
+                }
+            }
+        } catch (const std::exception& e) {
+            // Use default folder if parsing fails
+        }
+    }
+    
+    return folder_path + "/" + base_filename;
+}
+
+bool ApiService::dedupe_upload(const std::string& job_id, const FileUpload& upload, const TrunkCallMetadata& metadata,
+                               HttpResponse& response, std::string& kept_job_id) {
+    DedupePolicy policy = dedupe_.policy();
+    if (!policy.enabled) {
+        return false;
+    }
+    CallFingerprint call;
+    bool fingerprinted = upload.data
+        ? call.compute(upload.data->data(), upload.data->size(), metadata, policy.fingerprint_ldus)
+        : call.compute(upload.temp_path, metadata, policy.fingerprint_ldus);
+    if (!fingerprinted) {
+        return false;
+    }
+    
+    CallDeduplicator::Match match;
+    std::shared_ptr<ProcessingJob> kept;
+    while (dedupe_.check(call, job_id, match)) {
+        kept = job_manager_->get_job_status(match.job_id);
+        if (kept) {
+            break;
+        }
+        dedupe_.forget(match.job_id);  // no longer tracked, so nothing to fold into
+    }
+    if (!kept) {
+        return false;
+    }
+    
+    kept_job_id = match.job_id;
+    
+    // A cleaner copy takes over the job's input if decoding has not started
+    ProcessingJob copy;
+    copy.p25_file_path = upload.temp_path;
+    copy.p25_data = upload.data;
+    std::string replaced_file;
+    bool merged = match.better && job_manager_->replace_queued_input(match.job_id, copy, replaced_file);
+    if (merged) {
+        dedupe_.update(match.job_id, call);
+    } else {
+        replaced_file = upload.temp_path;
+    }
+    if (!replaced_file.empty()) {
+        cleanup_temp_file(replaced_file);
+    }
+    MetricsRegistry::global().counter("trunk_decoder_dedupe_calls_total",
+                                      "Uploads recognised as copies of a call already queued",
+                                      merged ? "result=\"merged\"" : "result=\"dropped\"").add();
+    if (verbose_) {
+        std::cout << "[API] Upload duplicates job " << match.job_id
+                  << (merged ? ", using this copy's audio (fewer FEC errors)" : ", dropped") << std::endl;
+    }
+    
+    duplicate_response(*kept, merged, response);
+    return true;
+}
+
+bool ApiService::repeat_upload(uint64_t key, const std::string& job_id, HttpResponse& response) {
+    std::string earlier = recent_uploads_.find_or_add(key, job_id);
+    if (earlier.empty()) {
+        return false;
+    }
+    // A failed job is worth retrying, and an evicted one cannot be reported
+    std::shared_ptr<ProcessingJob> job = job_manager_->get_job_status(earlier);
+    if (!job || job->status == ProcessingJob::FAILED) {
+        recent_uploads_.set(key, job_id);
+        return false;
+    }
+    MetricsRegistry::global().counter("trunk_decoder_repeat_uploads_total",
+                                      "Uploads identical to a recent one, answered with its job").add();
+    if (verbose_) {
+        std::cout << "[API] Upload repeats job " << earlier << ", not queued again" << std::endl;
+    }
+    duplicate_response(*job, false, response);
+    return true;
+}
+
+void ApiService::duplicate_response(const ProcessingJob& job, bool merged, HttpResponse& response) {
+    response.status_code = 200;
+    std::string status = job_status_json(job);
+    status.pop_back();
+    status += ",\"duplicate\": true,\"merged\": ";
+    status += merged ? "true}" : "false}";
+    response.set_json(status);
+}
+
+bool ApiService::admit_job(const std::string& stream_name, HttpResponse& response) {
+    int retry_after_s = 0;
+    AdmissionController::Result result = job_manager_->admit_job(stream_name, retry_after_s);
+    if (result == AdmissionController::ACCEPT) {
+        return true;
+    }
+    
+    response.status_code = 429;
+    response.headers["Retry-After"] = std::to_string(retry_after_s);
+    std::ostringstream json;
+    json << "{"
+         << "\"error\": \"" << (result == AdmissionController::OVERLOADED
+                                 ? "Processing queue is full" : "Stream is over its share of the queue") << "\","
+         << "\"retry_after_s\": " << retry_after_s
+         << "}";
+    response.set_json(json.str());
+    return false;
+}
+
 void ApiService::handle_decode_request(const HttpRequest& request, HttpResponse& response) {
     try {
         if (verbose_) {
@@ -135,15 +516,17 @@ void ApiService::handle_decode_request(const HttpRequest& request, HttpResponse&
             return;
         }
         
-        // Get P25 file from multipart form data
-        auto p25_file_it = request.files.find("p25_file");
-        if (p25_file_it == request.files.end()) {
+        // Get P25 file from multipart form data; small uploads are kept in memory
+        auto p25_upload_it = request.file_uploads.find("p25_file");
+        if (p25_upload_it == request.file_uploads.end() ||
+            (p25_upload_it->second.temp_path.empty() && !p25_upload_it->second.data)) {
             response.status_code = 400;
             response.set_json("{\"error\": \"Missing p25_file in request\"}");
             return;
         }
         
-        std::string p25_temp_file = p25_file_it->second;
+        const FileUpload& p25_upload = p25_upload_it->second;
+        std::string p25_temp_file = p25_upload.temp_path;
         
         // Get metadata JSON
         std::string metadata_str;
@@ -159,6 +542,70 @@ void ApiService::handle_decode_request(const HttpRequest& request, HttpResponse&
             stream_name = stream_it->second;
         }
         
+        // Optional webhook, POSTed the job status once it finishes
+        std::string callback_url;
+        auto callback_it = request.form_data.find("callback_url");
+        if (callback_it != request.form_data.end()) {
+            callback_url = callback_it->second;
+            if (!callback_url.empty() && !WebhookNotifier::valid_url(callback_url)) {
+                response.status_code = 400;
+                response.set_json("{\"error\": \"callback_url must be an http:// URL\"}");
+                if (!p25_temp_file.empty()) {
+                    cleanup_temp_file(p25_temp_file);
+                }
+                return;
+            }
+        }
+        
+        // Ingest nodes queue nothing themselves; dedupe and admission happen where the job is decoded
+        if (cluster_publisher_) {
+            publish_upload(p25_upload, metadata_str, stream_name, callback_url, response);
+            return;
+        }
+        
+        // A retried upload gets the job the first attempt made; the key
+        // covers everything that shapes the job, not just the audio
+        const std::string reserved_job_id = JobManager::new_job_id();
+        const bool track_upload = upload_dedupe_ && p25_upload.hashed;
+        uint64_t upload_key = 0;
+        if (track_upload) {
+            ContentHash key(p25_upload.content_hash);
+            key.update(metadata_str.data(), metadata_str.size());
+            key.update(stream_name.data(), stream_name.size() + 1);
+            key.update(callback_url.data(), callback_url.size());
+            upload_key = key.digest();
+            if (repeat_upload(upload_key, reserved_job_id, response)) {
+                if (!p25_temp_file.empty()) {
+                    cleanup_temp_file(p25_temp_file);
+                }
+                return;
+            }
+        }
+        
+        // Parsed once here for dedupe, scheduling and plugins
+        auto call_metadata = TrunkCallMetadata::parse(metadata_str);
+        
+        // Simulcast copies of a call already queued never reach the queue
+        std::string kept_job_id;
+        if (dedupe_upload(reserved_job_id, p25_upload, *call_metadata, response, kept_job_id)) {
+            if (track_upload) {
+                recent_uploads_.set(upload_key, kept_job_id);
+            }
+            return;
+        }
+        
+        // Turn the upload away now if the queue cannot take it
+        if (!admit_job(stream_name, response)) {
+            dedupe_.forget(reserved_job_id);
+            if (track_upload) {
+                recent_uploads_.forget(upload_key);
+            }
+            if (!p25_temp_file.empty()) {
+                cleanup_temp_file(p25_temp_file);
+            }
+            return;
+        }
+        
         // Parse minimal information for logging (but don't do full processing)
         std::string system_name = "Unknown";
         std::string talkgroup = "Unknown"; 
@@ -208,58 +655,46 @@ void ApiService::handle_decode_request(const HttpRequest& request, HttpResponse&
                   << " | SRC:" << src_radio_id << " | Call:" << call_id 
                   << " | Stream:" << stream_name << " | Queued" << std::endl;
         
-        // Get original filename for output path generation
-        std::string original_filename;
-        auto upload_it = request.file_uploads.find("p25_file");
-        if (upload_it != request.file_uploads.end()) {
-            original_filename = upload_it->second.original_filename;
-        }
+        std::string output_base_path = build_output_base_path(metadata_str, p25_upload.original_filename);
         
-        if (original_filename.empty()) {
-            original_filename = "api_call_" + std::to_string(std::time(nullptr)) + ".p25";
-        }
-        
-        // Remove .p25 extension if present
-        std::string base_filename = original_filename;
-        if (base_filename.size() > 4 && base_filename.substr(base_filename.size() - 4) == ".p25") {
-            base_filename = base_filename.substr(0, base_filename.size() - 4);
-        }
+        // Queue job for asynchronous processing
+        auto job = std::make_shared<ProcessingJob>();
+        job->job_id = reserved_job_id;
+        job->p25_file_path = p25_temp_file;
+        job->p25_data = p25_upload.data;
+        job->metadata_json = metadata_str;
+        job->call_metadata = call_metadata;
+        job->output_base_path = output_base_path;
+        job->stream_name = stream_name;
+        job->upload_script = upload_script_;
+        job->audio_format = audio_format_;
+        job->audio_bitrate = audio_bitrate_;
+        job->callback_url = callback_url;
         
-        // Create basic output path (detailed folder structure will be created by worker)
-        std::string folder_path = output_dir_;
-        if (!metadata_str.empty()) {
-            try {
-                // Quick parse for system name to create basic folder structure
-                size_t short_name_pos = metadata_str.find("\"short_name\": \"");
-                if (short_name_pos != std::string::npos) {
-                    short_name_pos += 15;
-                    size_t short_name_end = metadata_str.find("\"", short_name_pos);
-                    std::string short_name = metadata_str.substr(short_name_pos, short_name_end - short_name_pos);
-                    folder_path = output_dir_ + "/" + short_name;
-                    std::filesystem::create_directories(folder_path);
-                }
-            } catch (const std::exception& e) {
-                // Use default folder if parsing fails
+        // Receive-side spans are timed by HttpService whether or not the call is sampled
+        Tracer& tracer = Tracer::instance();
+        job->trace_id = tracer.sample();
+        if (job->trace_id) {
+            job->trace_start_ns = request.received_ns;
+            tracer.record(job->trace_id, "http_receive", request.received_ns, request.body_read_ns - request.received_ns);
+            tracer.record(job->trace_id, "multipart_parse", request.received_ns, request.multipart_parse_ns);
+            if (request.temp_write_ns > 0) {
+                tracer.record(job->trace_id, "temp_write", request.received_ns, request.temp_write_ns);
             }
         }
-        
-        std::string output_base_path = folder_path + "/" + base_filename;
-        
-        // Queue job for asynchronous processing
-        std::string job_id = job_manager_->queue_job(
-            p25_temp_file,
-            metadata_str, 
-            output_base_path,
-            stream_name,
-            upload_script_,
-            audio_format_,
-            audio_bitrate_
-        );
+        std::string job_id = job_manager_->submit_job(job);
         
         if (job_id.empty()) {
-            response.status_code = 503;
-            response.set_json("{\"error\": \"Processing queue is full\"}");
-            cleanup_temp_file(p25_temp_file);
+            dedupe_.forget(reserved_job_id);
+            if (track_upload) {
+                recent_uploads_.forget(upload_key);
+            }
+            response.status_code = 429;
+            response.headers["Retry-After"] = "1";
+            response.set_json("{\"error\": \"Processing queue is full\", \"retry_after_s\": 1}");
+            if (!p25_temp_file.empty()) {
+                cleanup_temp_file(p25_temp_file);
+            }
             return;
         }
         
@@ -270,8 +705,12 @@ void ApiService::handle_decode_request(const HttpRequest& request, HttpResponse&
              << "\"job_id\": \"" << job_id << "\","
              << "\"status\": \"queued\","
              << "\"message\": \"P25 file queued for processing\","
-             << "\"stream_name\": \"" << stream_name << "\""
-             << "}";
+             << "\"stream_name\": \"" << stream_name << "\"";
+        if (job->trace_id) {
+            json << ",\"trace_id\": \"" << Tracer::hex64(job->trace_id) << "\"";
+            response.headers["X-Trace-Id"] = Tracer::hex64(job->trace_id);
+        }
+        json << "}";
         response.set_json(json.str());
         
         if (verbose_) {
@@ -288,23 +727,103 @@ void ApiService::handle_decode_request(const HttpRequest& request, HttpResponse&
     }
 }
 
+void ApiService::publish_upload(const FileUpload& upload, const std::string& metadata_str, const std::string& stream_name,
+                                const std::string& callback_url, HttpResponse& response) {
+    ClusterJob entry;
+    entry.job_id = JobManager::new_job_id();
+    entry.stream_name = stream_name;
+    entry.filename = upload.original_filename;
+    entry.metadata = metadata_str;
+    entry.callback_url = callback_url;
+    if (upload.data) {
+        entry.p25 = upload.data;
+    } else {
+        std::ifstream file(upload.temp_path, std::ios::binary);
+        auto bytes = std::make_shared<std::vector<uint8_t>>((std::istreambuf_iterator<char>(file)),
+                                                            std::istreambuf_iterator<char>());
+        entry.p25 = bytes;
+    }
+    cleanup_temp_file(upload.temp_path);
+    if (entry.p25->empty()) {
+        response.status_code = 400;
+        response.set_json("{\"error\": \"Empty p25_file\"}");
+        return;
+    }
+    
+    int shard = 0;
+    std::string error;
+    if (!cluster_publisher_->publish(entry, shard, error)) {
+        std::cerr << "[API] Failed to publish job to the decode cluster: " << error << std::endl;
+        response.status_code = 503;
+        response.headers["Retry-After"] = "1";
+        response.set_json("{\"error\": \"Decode cluster is unavailable\", \"retry_after_s\": 1}");
+        return;
+    }
+    
+    // Status and call audio are served by the decode node that owns the shard
+    const std::string& node = cluster_publisher_->shards().owner(shard);
+    response.status_code = 202;
+    std::ostringstream json;
+    json << "{"
+         << "\"job_id\": \"" << entry.job_id << "\","
+         << "\"status\": \"published\","
+         << "\"message\": \"P25 file published to the decode cluster\","
+         << "\"stream_name\": \"" << stream_name << "\","
+         << "\"shard\": " << shard;
+    if (!node.empty()) {
+        json << ",\"node\": \"" << node << "\"";
+    }
+    json << "}";
+    response.set_json(json.str());
+    
+    if (verbose_) {
+        std::cout << "[API] Published job " << entry.job_id << " for stream " << stream_name
+                  << " to shard " << shard << std::endl;
+    }
+}
+
+bool ApiService::submit_cluster_job(const ClusterJob& entry) {
+    auto job = std::make_shared<ProcessingJob>();
+    job->job_id = entry.job_id;
+    job->p25_data = entry.p25;
+    job->metadata_json = entry.metadata;
+    job->output_base_path = build_output_base_path(entry.metadata, entry.filename);
+    job->stream_name = entry.stream_name;
+    job->upload_script = upload_script_;
+    job->audio_format = audio_format_;
+    job->audio_bitrate = audio_bitrate_;
+    job->callback_url = entry.callback_url;
+    return !job_manager_->submit_job(job).empty();
+}
+
+void ApiService::set_cluster_policy(const ClusterPolicy& policy) {
+    cluster_policy_ = policy;
+    cluster_publisher_.reset();
+    cluster_consumer_.reset();
+    if (policy.role == "ingest") {
+        cluster_publisher_ = std::make_unique<ClusterPublisher>(policy);
+    } else if (policy.role == "decode") {
+        cluster_consumer_ = std::make_unique<ClusterConsumer>(policy, [this](const ClusterJob& entry) {
+            return submit_cluster_job(entry);
+        });
+    } else if (!policy.role.empty()) {
+        std::cerr << "[API] Unknown cluster role \"" << policy.role << "\", running standalone" << std::endl;
+    }
+}
+
 std::string ApiService::create_temp_file(const std::vector<uint8_t>& data, const std::string& extension) {
-    std::string temp_filename = "/tmp/trunk_decoder_" + std::to_string(std::time(nullptr)) + extension;
-    std::ofstream temp_file(temp_filename, std::ios::binary);
+    std::string temp_filename = TempStore::global().create("api" + extension);
+    if (temp_filename.empty()) {
+        return temp_filename;
+    }
+    std::ofstream temp_file(temp_filename, std::ios::binary | std::ios::trunc);
     temp_file.write(reinterpret_cast<const char*>(data.data()), data.size());
     temp_file.close();
     return temp_filename;
 }
 
 void ApiService::cleanup_temp_file(const std::string& filepath) {
-    try {
-        std::filesystem::remove(filepath);
-    } catch (const std::filesystem::filesystem_error& e) {
-        if (verbose_) {
-            std::cerr << "[API] Warning: Failed to cleanup temp file " << filepath 
-                     << ": " << e.what() << std::endl;
-        }
-    }
+    TempStore::global().release(filepath);
 }
 
 void ApiService::configure_processing(int worker_threads, int queue_size, int timeout_ms) {
@@ -321,6 +840,42 @@ void ApiService::handle_status_request(const HttpRequest& request, HttpResponse&
     try {
         auto stats = job_manager_->get_stats();
         
+        auto latency_json = [](const LatencyHistogram::Summary& latency) {
+            std::ostringstream out;
+            out << "{"
+                << "\"count\": " << latency.count << ","
+                << "\"mean_ms\": " << latency.mean_ms << ","
+                << "\"p50_ms\": " << latency.p50_ms << ","
+                << "\"p95_ms\": " << latency.p95_ms << ","
+                << "\"p99_ms\": " << latency.p99_ms << ","
+                << "\"max_ms\": " << latency.max_ms
+                << "}";
+            return out.str();
+        };
+        
+        std::ostringstream latency;
+        latency << "\"queue_wait\": " << latency_json(stats.queue_wait_latency) << ",";
+        for (int i = 0; i < static_cast<int>(PipelineStage::COUNT); ++i) {
+            latency << "\"" << pipeline_stage_name(static_cast<PipelineStage>(i)) << "\": "
+                    << latency_json(stats.stages[i].latency) << ",";
+        }
+        latency << "\"total\": " << latency_json(stats.total_latency);
+        
+        std::ostringstream cluster;
+        cluster << "\"role\": \"" << (cluster_policy_.enabled() ? cluster_policy_.role : "standalone") << "\"";
+        if (cluster_publisher_) {
+            cluster << ",\"published\": " << cluster_publisher_->published() << ","
+                    << "\"publish_failed\": " << cluster_publisher_->failed();
+        }
+        if (cluster_consumer_) {
+            cluster << ",\"node_id\": \"" << cluster_consumer_->node_id() << "\","
+                    << "\"shards\": " << cluster_consumer_->owned_shards().size() << ","
+                    << "\"in_flight\": " << cluster_consumer_->in_flight() << ","
+                    << "\"consumed\": " << cluster_consumer_->consumed() << ","
+                    << "\"acked\": " << cluster_consumer_->acked() << ","
+                    << "\"claimed\": " << cluster_consumer_->claimed();
+        }
+        
         std::ostringstream json;
         json << "{"
              << "\"status\": \"ok\","
@@ -331,9 +886,48 @@ void ApiService::handle_status_request(const HttpRequest& request, HttpResponse&
              << "\"jobs_completed\": " << stats.completed << ","
              << "\"jobs_failed\": " << stats.failed << ","
              << "\"active_workers\": " << stats.active_workers << ","
+             << "\"workers\": " << stats.workers << ","
+             << "\"min_workers\": " << stats.min_workers << ","
+             << "\"max_workers\": " << stats.max_workers << ","
+             << "\"workers_added\": " << stats.workers_added << ","
+             << "\"workers_retired\": " << stats.workers_retired << ","
              << "\"queue_size\": " << stats.queue_size << ","
-             << "\"avg_processing_time_ms\": " << stats.avg_processing_time_ms
-             << "}"
+             << "\"avg_processing_time_ms\": " << stats.avg_processing_time_ms << ","
+             << "\"tracked_jobs\": " << stats.tracked_jobs << ","
+             << "\"service_rate\": " << stats.service_rate << ","
+             << "\"jobs_overloaded\": " << stats.jobs_overloaded << ","
+             << "\"jobs_throttled\": " << stats.jobs_throttled << ","
+             << "\"jobs_timed_out\": " << stats.jobs_timed_out << ","
+             << "\"scripts\": {"
+             << "\"max_concurrent\": " << stats.scripts.max_concurrent << ","
+             << "\"running\": " << stats.scripts.running << ","
+             << "\"queued\": " << stats.scripts.queued << ","
+             << "\"succeeded\": " << stats.scripts.succeeded << ","
+             << "\"failed\": " << stats.scripts.failed << ","
+             << "\"timed_out\": " << stats.scripts.timed_out
+             << "},"
+             << "\"output_writer\": {"
+             << "\"enabled\": " << (stats.writer.enabled ? "true" : "false") << ","
+             << "\"io_uring\": " << (stats.writer.io_uring ? "true" : "false") << ","
+             << "\"in_flight\": " << stats.writer.in_flight << ","
+             << "\"written\": " << stats.writer.written << ","
+             << "\"failed\": " << stats.writer.failed
+             << "},"
+             << "\"temp_files\": {"
+             << "\"backend\": \"" << TempStore::backend_name(TempStore::global().backend()) << "\","
+             << "\"created\": " << TempStore::global().created() << ","
+             << "\"pending_cleanup\": " << TempStore::global().pending()
+             << "},"
+             << "\"cluster\": {" << cluster.str() << "},"
+             << "\"jobs_evicted\": " << stats.jobs_evicted << ","
+             << "\"webhooks\": {"
+             << "\"delivered\": " << webhooks_->delivered() << ","
+             << "\"failed\": " << webhooks_->failed() << ","
+             << "\"dropped\": " << webhooks_->dropped()
+             << "},"
+             << "\"latency\": {" << latency.str() << "}"
+             << "},"
+             << "\"threading\": " << ThreadPlacement::global().status().dump()
              << "}";
              
         response.set_json(json.str());
@@ -343,6 +937,76 @@ void ApiService::handle_status_request(const HttpRequest& request, HttpResponse&
     }
 }
 
+void ApiService::handle_metrics_request(const HttpRequest& /*request*/, HttpResponse& response) {
+    job_manager_->sample_metrics();
+    if (audio_cache_) {
+        MetricsRegistry& registry = MetricsRegistry::global();
+        registry.gauge("trunk_decoder_audio_cache_bytes", "Encoded audio held by the cache", "tier=\"memory\"")
+            .set(static_cast<int64_t>(audio_cache_->memory_used()));
+        registry.gauge("trunk_decoder_audio_cache_bytes", "Encoded audio held by the cache", "tier=\"disk\"")
+            .set(static_cast<int64_t>(audio_cache_->disk_used()));
+    }
+    response.set_text(MetricsRegistry::global().exposition());
+    response.content_type = "text/plain; version=0.0.4";
+}
+
+void ApiService::handle_trace_request(const HttpRequest& request, HttpResponse& response) {
+    if (!validate_auth_token(request)) {
+        response.status_code = 401;
+        response.headers["WWW-Authenticate"] = "Bearer realm=trunk-decoder";
+        response.set_json("{\"error\": \"Authentication required\"}");
+        return;
+    }
+    
+    // ?trace=<id> narrows the export to one call; ?format=otlp for a collector
+    std::string trace = request.query_param("trace");
+    uint64_t trace_id = Tracer::parse_trace_id(trace);
+    if (!trace.empty() && trace_id == 0) {
+        response.status_code = 400;
+        response.set_json("{\"error\": \"trace must be a hex trace ID\"}");
+        return;
+    }
+    std::string format = request.query_param("format");
+    if (format == "otlp") {
+        response.set_json(Tracer::instance().otlp_json(trace_id));
+    } else if (format.empty() || format == "chrome") {
+        response.set_json(Tracer::instance().chrome_trace_json(trace_id));
+    } else {
+        response.status_code = 400;
+        response.set_json("{\"error\": \"format must be chrome or otlp\"}");
+    }
+}
+
+void ApiService::handle_profile_request(const HttpRequest& request, HttpResponse& response) {
+    if (!validate_auth_token(request)) {
+        response.status_code = 401;
+        response.headers["WWW-Authenticate"] = "Bearer realm=trunk-decoder";
+        response.set_json("{\"error\": \"Authentication required\"}");
+        return;
+    }
+    
+    // ?enable=1|0 turns timing on or off; ?reset=1 starts a new window after this snapshot
+    StageProfiler& profiler = StageProfiler::instance();
+    std::string enable = request.query_param("enable");
+    if (!enable.empty()) {
+        if (enable != "1" && enable != "0") {
+            response.status_code = 400;
+            response.set_json("{\"error\": \"enable must be 1 or 0\"}");
+            return;
+        }
+        if (enable == "1" && !StageProfiler::compiled()) {
+            response.status_code = 409;
+            response.set_json("{\"error\": \"built without TRUNK_DECODER_PROFILE\"}");
+            return;
+        }
+        profiler.set_enabled(enable == "1");
+    }
+    response.set_json(profiler.snapshot_json().dump());
+    if (request.query_param("reset") == "1") {
+        profiler.reset();
+    }
+}
+
 void ApiService::handle_job_status_request(const HttpRequest& request, HttpResponse& response) {
     try {
         // Extract job ID from URL path (e.g., /api/v1/jobs/job_123456)
@@ -355,7 +1019,13 @@ void ApiService::handle_job_status_request(const HttpRequest& request, HttpRespo
         }
         
         std::string job_id = path.substr(last_slash + 1);
-        auto job = job_manager_->get_job_status(job_id);
+        
+        // ?wait=N long-polls up to N seconds for the job to finish
+        int wait_s = std::atoi(request.query_param("wait").c_str());
+        wait_s = std::max(0, std::min(wait_s, MAX_LONG_POLL_S));
+        auto job = wait_s > 0
+            ? job_manager_->wait_for_job(job_id, std::chrono::seconds(wait_s))
+            : job_manager_->get_job_status(job_id);
         
         if (!job) {
             response.status_code = 404;
@@ -363,47 +1033,316 @@ void ApiService::handle_job_status_request(const HttpRequest& request, HttpRespo
             return;
         }
         
-        std::string status_str;
-        switch (job->status) {
-            case ProcessingJob::QUEUED: status_str = "queued"; break;
-            case ProcessingJob::PROCESSING: status_str = "processing"; break;
-            case ProcessingJob::COMPLETED: status_str = "completed"; break;
-            case ProcessingJob::FAILED: status_str = "failed"; break;
-        }
+        response.set_json(job_status_json(*job));
         
-        std::ostringstream json;
-        json << "{"
-             << "\"job_id\": \"" << job->job_id << "\","
-             << "\"status\": \"" << status_str << "\","
-             << "\"stream_name\": \"" << job->stream_name << "\"";
-             
-        if (!job->error_message.empty()) {
-            json << ",\"error\": \"" << job->error_message << "\"";
+    } catch (const std::exception& e) {
+        response.status_code = 500;
+        response.set_json("{\"error\": \"Failed to get job status\"}");
+    }
+}
+
+// %XX and '+' in a query value
+static std::string url_decode(const std::string& value) {
+    std::string out;
+    out.reserve(value.size());
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '%' && i + 2 < value.size() && isxdigit(static_cast<unsigned char>(value[i + 1])) &&
+            isxdigit(static_cast<unsigned char>(value[i + 2]))) {
+            out += static_cast<char>(std::strtol(value.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        } else {
+            out += value[i] == '+' ? ' ' : value[i];
         }
-        
-        // Add timing information if available
-        auto now = std::chrono::system_clock::now();
-        auto received_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-            now - job->received_time).count();
-        json << ",\"age_ms\": " << received_ms;
-        
-        if (job->status == ProcessingJob::PROCESSING) {
-            auto processing_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                now - job->started_time).count();
-            json << ",\"processing_ms\": " << processing_ms;
+    }
+    return out;
+}
+
+void ApiService::handle_snippet_request(const HttpRequest& request, HttpResponse& response) {
+    if (!validate_auth_token(request)) {
+        response.status_code = 401;
+        response.headers["WWW-Authenticate"] = "Bearer realm=trunk-decoder";
+        response.set_json("{\"error\": \"Authentication required\"}");
+        return;
+    }
+    if (request.method != "GET") {
+        response.status_code = 405;
+        response.set_json("{\"error\": \"Method not allowed\"}");
+        return;
+    }
+    
+    // ?file=<path under the archive>&start=S&end=S, both in seconds of voice
+    std::filesystem::path relative = std::filesystem::path(url_decode(request.query_param("file"))).lexically_normal();
+    std::string start_param = request.query_param("start");
+    std::string end_param = request.query_param("end");
+    double start_s = std::atof(start_param.c_str());
+    double end_s = std::atof(end_param.c_str());
+    // .imbe archives (see imbe_archive.h) are synthesised straight from their records
+    const bool from_archive = relative.extension() == ".imbe";
+    bool inside = !relative.empty() && relative.is_relative() && (relative.extension() == ".p25" || from_archive) &&
+                  *relative.begin() != "..";
+    if (!inside) {
+        response.status_code = 400;
+        response.set_json("{\"error\": \"file must be a .p25 or .imbe path inside the archive\"}");
+        return;
+    }
+    if (end_param.empty() || start_s < 0.0 || end_s <= start_s || end_s - start_s > MAX_SNIPPET_S) {
+        response.status_code = 400;
+        response.set_json("{\"error\": \"start and end must give a range of up to " +
+                          std::to_string(static_cast<int>(MAX_SNIPPET_S)) + " seconds\"}");
+        return;
+    }
+    std::string p25_path = (std::filesystem::path(archive_dir_) / relative).string();
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(p25_path, ec)) {
+        response.status_code = 404;
+        response.set_json("{\"error\": \"Call not found\"}");
+        return;
+    }
+    
+    // Snippets are short, so they are decoded right here rather than queued.
+    // The sidecar index this leaves makes the next snippet of the call a seek.
+    DecoderPool::Lease decoder = job_manager_->acquire_decoder();
+    decoder->set_frame_index(true);
+    DecodeOutputs outputs;
+    outputs.wav = false;
+    outputs.json = false;
+    outputs.pcm = true;
+    outputs.start_s = start_s;
+    outputs.end_s = end_s;
+    bool decoded = from_archive ? decoder->synthesize_archive(p25_path, "", outputs)
+                                : decoder->open_p25_file(p25_path) && decoder->decode_to_outputs("", outputs);
+    decoder->set_frame_index(false);
+    if (!decoded) {
+        decoder->reset();
+        response.status_code = 500;
+        response.set_json("{\"error\": \"Failed to decode call\"}");
+        return;
+    }
+    
+    const std::vector<int16_t>& pcm = decoder->get_audio_buffer();
+    response.body.resize(WavWriter::HEADER_SIZE + pcm.size() * sizeof(int16_t));
+    WavWriter::make_header(response.body.data(), pcm.size() * sizeof(int16_t), decoder->output_sample_rate());
+    memcpy(response.body.data() + WavWriter::HEADER_SIZE, pcm.data(), pcm.size() * sizeof(int16_t));
+    response.content_type = "audio/wav";
+    if (verbose_) {
+        std::cout << "[API] Snippet " << relative.string() << " " << start_s << "-" << end_s << "s: "
+                  << pcm.size() << " samples" << std::endl;
+    }
+    decoder->reset();
+}
+
+// Samples and rate of a 16-bit mono WAV; false for anything else
+static bool read_wav_pcm(const std::string& path, std::vector<int16_t>& pcm, int& sample_rate) {
+    std::ifstream file(path, std::ios::binary);
+    uint8_t riff[12];
+    if (!file.read(reinterpret_cast<char*>(riff), sizeof(riff)) || memcmp(riff, "RIFF", 4) != 0 ||
+        memcmp(riff + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    auto u16 = [](const uint8_t* in) { return static_cast<uint32_t>(in[0] | in[1] << 8); };
+    auto u32 = [&u16](const uint8_t* in) { return u16(in) | u16(in + 2) << 16; };
+    bool pcm16_mono = false;
+    uint8_t chunk[8];
+    while (file.read(reinterpret_cast<char*>(chunk), sizeof(chunk))) {
+        uint32_t size = u32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            uint8_t fmt[16];
+            file.read(reinterpret_cast<char*>(fmt), sizeof(fmt));
+            pcm16_mono = u16(fmt) == 1 && u16(fmt + 2) == 1 && u16(fmt + 14) == 16;
+            sample_rate = static_cast<int>(u32(fmt + 4));
+            file.seekg(size - sizeof(fmt) + (size & 1), std::ios::cur);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!pcm16_mono) {
+                return false;
+            }
+            pcm.resize(size / sizeof(int16_t));
+            return static_cast<bool>(file.read(reinterpret_cast<char*>(pcm.data()), pcm.size() * sizeof(int16_t)));
+        } else {
+            file.seekg(size + (size & 1), std::ios::cur);
         }
-        
-        if (job->status == ProcessingJob::COMPLETED || job->status == ProcessingJob::FAILED) {
-            auto total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                job->completed_time - job->received_time).count();
-            json << ",\"total_time_ms\": " << total_ms;
+    }
+    return false;
+}
+
+static const char* audio_content_type(const std::string& format) {
+    if (format == "wav") return "audio/wav";
+    if (format == "flac") return "audio/flac";
+    if (format == "opus") return "audio/ogg";
+    if (format == "mp3") return "audio/mpeg";
+    if (format == "m4a") return "audio/mp4";
+    if (format == "webm") return "audio/webm";
+    return nullptr;
+}
+
+bool ApiService::encode_call(const std::string& source, bool from_archive, const std::string& format, int bitrate,
+                             const std::string& output_file) {
+    if (!from_archive) {
+        std::vector<int16_t> pcm;
+        int sample_rate = 0;
+        if (AudioEncoder::has_backend(format) && read_wav_pcm(source, pcm, sample_rate)) {
+            return AudioEncoder::encode_file(pcm.data(), pcm.size(), sample_rate, format, bitrate, output_file);
         }
-        
-        json << "}";
-        response.set_json(json.str());
-        
-    } catch (const std::exception& e) {
+        return AudioEncoder::convert_with_ffmpeg(source, output_file, format, bitrate);
+    }
+    
+    DecoderPool::Lease decoder = job_manager_->acquire_decoder();
+    DecodeOutputs outputs;
+    outputs.wav = false;
+    outputs.json = false;
+    outputs.pcm = true;
+    bool encoded = decoder->synthesize_archive(source, "", outputs);
+    if (encoded) {
+        const std::vector<int16_t>& pcm = decoder->get_audio_buffer();
+        const int sample_rate = decoder->output_sample_rate();
+        WavWriter writer;
+        if (format == "wav") {
+            encoded = writer.open(output_file, WavWriter::Options()) && writer.write(pcm.data(), pcm.size(), sample_rate);
+        } else if (!AudioEncoder::encode_file(pcm.data(), pcm.size(), sample_rate, format, bitrate, output_file)) {
+            // No codec linked in: ffmpeg needs the audio as a file
+            std::string wav_file = output_file + ".wav";
+            encoded = writer.open(wav_file, WavWriter::Options()) && writer.write(pcm.data(), pcm.size(), sample_rate) &&
+                      AudioEncoder::convert_with_ffmpeg(wav_file, output_file, format, bitrate);
+            std::remove(wav_file.c_str());
+        }
+    }
+    decoder->reset();
+    return encoded;
+}
+
+void ApiService::handle_call_audio_request(const HttpRequest& request, HttpResponse& response) {
+    if (!validate_auth_token(request)) {
+        response.status_code = 401;
+        response.headers["WWW-Authenticate"] = "Bearer realm=trunk-decoder";
+        response.set_json("{\"error\": \"Authentication required\"}");
+        return;
+    }
+    
+    // /api/v1/calls/<id>/audio, <id> being the call's path under the archive without its extension
+    static const std::string prefix = "/api/v1/calls/";
+    static const std::string suffix = "/audio";
+    const std::string& path = request.path;
+    if (path.size() <= prefix.size() + suffix.size() ||
+        path.compare(path.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        response.status_code = 404;
+        response.set_json("{\"error\": \"Not found\"}");
+        return;
+    }
+    if (request.method != "GET") {
+        response.status_code = 405;
+        response.set_json("{\"error\": \"Method not allowed\"}");
+        return;
+    }
+    std::filesystem::path id = std::filesystem::path(
+        url_decode(path.substr(prefix.size(), path.size() - prefix.size() - suffix.size()))).lexically_normal();
+    if (id.empty() || !id.is_relative() || *id.begin() == ".." || !id.has_filename()) {
+        response.status_code = 400;
+        response.set_json("{\"error\": \"call id must be a path inside the archive\"}");
+        return;
+    }
+    
+    // ?format=wav|flac|opus|mp3|m4a|webm&bitrate=KBPS (0 or absent: the format's default)
+    std::string format = request.query_param("format");
+    if (format.empty()) {
+        format = "wav";
+    }
+    const char* content_type = audio_content_type(format);
+    int bitrate = std::atoi(request.query_param("bitrate").c_str());
+    if (!content_type || bitrate < 0 || bitrate > 320) {
+        response.status_code = 400;
+        response.set_json("{\"error\": \"format must be wav, flac, opus, mp3, m4a or webm, bitrate 0-320 kbps\"}");
+        return;
+    }
+    
+    // The decoded WAV when there is one, otherwise the IMBE archive
+    std::string base = (std::filesystem::path(archive_dir_) / id).string();
+    std::string source = base + ".wav";
+    std::error_code ec;
+    bool from_archive = !std::filesystem::is_regular_file(source, ec);
+    if (from_archive) {
+        source = base + ".imbe";
+        if (!std::filesystem::is_regular_file(source, ec)) {
+            response.status_code = 404;
+            response.set_json("{\"error\": \"Call not found\"}");
+            return;
+        }
+    }
+    response.accept_ranges = true;
+    if (format == "wav" && !from_archive) {
+        response.set_file(source, content_type);
+        return;
+    }
+    
+    // The source's mtime is part of the key, so a re-decoded call is
+    // encoded afresh and the stale entry just ages out
+    struct stat info;
+    long long mtime = stat(source.c_str(), &info) == 0 ? static_cast<long long>(info.st_mtime) : 0;
+    std::string key = id.string() + "." + std::to_string(mtime) + "." + std::to_string(bitrate) + "k." + format;
+    AudioCache::Hit hit;
+    auto produce = [&](const std::string& output_file) {
+        return encode_call(source, from_archive, format, bitrate, output_file);
+    };
+    if (!audio_cache_->fetch(key, produce, hit)) {
+        response.accept_ranges = false;
         response.status_code = 500;
-        response.set_json("{\"error\": \"Failed to get job status\"}");
+        response.set_json("{\"error\": \"Failed to encode call\"}");
+        return;
+    }
+    MetricsRegistry::global().counter("trunk_decoder_audio_cache_requests_total",
+                                      "On-demand audio requests by whether they had to encode",
+                                      hit.produced ? "result=\"miss\"" : "result=\"hit\"").add();
+    if (hit.data) {
+        response.content_type = content_type;
+        response.body.assign(hit.data->begin(), hit.data->end());
+    } else {
+        response.set_file(hit.path, content_type);
+    }
+    if (verbose_) {
+        std::cout << "[API] Call audio " << id.string() << " as " << format << " ("
+                  << (hit.produced ? "encoded" : hit.data ? "memory" : "disk") << ", "
+                  << hit.size << " bytes)" << std::endl;
+    }
+}
+
+std::string ApiService::job_status_json(const ProcessingJob& job) {
+    std::string status_str;
+    switch (job.status) {
+        case ProcessingJob::QUEUED: status_str = "queued"; break;
+        case ProcessingJob::PROCESSING: status_str = "processing"; break;
+        case ProcessingJob::COMPLETED: status_str = "completed"; break;
+        case ProcessingJob::FAILED: status_str = "failed"; break;
     }
+    
+    std::ostringstream json;
+    json << "{"
+         << "\"job_id\": \"" << job.job_id << "\","
+         << "\"status\": \"" << status_str << "\","
+         << "\"stream_name\": \"" << job.stream_name << "\"";
+         
+    if (!job.error_message.empty()) {
+        json << ",\"error\": \"" << job.error_message << "\"";
+    }
+    
+    // Add timing information if available
+    auto now = std::chrono::system_clock::now();
+    auto received_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - job.received_time).count();
+    json << ",\"age_ms\": " << received_ms;
+    
+    if (job.status == ProcessingJob::PROCESSING) {
+        auto processing_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - job.started_time).count();
+        json << ",\"processing_ms\": " << processing_ms;
+    }
+    
+    if (job.status == ProcessingJob::COMPLETED || job.status == ProcessingJob::FAILED) {
+        auto total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            job.completed_time - job.received_time).count();
+        json << ",\"total_time_ms\": " << total_ms;
+        if (AllocStats::enabled()) {
+            json << ",\"allocations\": " << job.allocations << ",\"allocated_bytes\": " << job.allocated_bytes;
+        }
+    }
+    
+    json << "}";
+    return json.str();
 }
\ No newline at end of file
@@ -2,13 +2,41 @@
 #include "http_service.h"
 #include "p25_decoder.h"
 #include "job_manager.h"
+#include "webhook_notifier.h"
+#include "tracer.h"
+#include "stage_profiler.h"
+#include "audio_cache.h"
+#include "call_dedupe.h"
+#include "temp_store.h"
+#include "cluster_queue.h"
 #include <memory>
+#include <functional>
+
+// Live audio from /api/v1/stream, delivered in Plugin_Api hook order
+struct CallStreamHooks {
+    std::function<void(Call_Data_t*)> call_start;
+    std::function<void(Call_Data_t*, int16_t*, int)> audio_stream;
+    std::function<void(const Call_Data_t&)> call_end;
+};
 
 class ApiService {
+    friend class LiveCallStream;
+    
 private:
+    // Uploads up to this size are decoded from memory without a temp file
+    static constexpr size_t DEFAULT_UPLOAD_BUFFER_LIMIT = 32 * 1024 * 1024;
+    
+    // Longest a GET /api/v1/jobs/<id>?wait=N may hold its HTTP worker
+    static constexpr int MAX_LONG_POLL_S = 30;
+    
+    // Longest time range GET /api/v1/snippet decodes in one request
+    static constexpr double MAX_SNIPPET_S = 300.0;
+    
     std::unique_ptr<HttpService> http_service_;
     std::unique_ptr<JobManager> job_manager_;
+    std::unique_ptr<WebhookNotifier> webhooks_;
     std::string output_dir_;
+    std::string archive_dir_;   // .p25 and .imbe files served by /api/v1/snippet, calls by /api/v1/calls
     bool verbose_;
     bool foreground_;
     std::string auth_token_;
@@ -18,17 +46,60 @@ private:
     std::string audio_format_;
     int audio_bitrate_;
     
+    CallStreamHooks stream_hooks_;
+    
+    // Formats encoded on first play by /api/v1/calls/<id>/audio
+    std::unique_ptr<AudioCache> audio_cache_;
+    std::string audio_cache_dir_;   // empty: OUTPUT_DIR/.audio-cache
+    size_t audio_cache_memory_;
+    uint64_t audio_cache_disk_;
+    
+    // Simulcast copies of a call already queued are folded into that job,
+    // and repeats of an upload (client retries) answered with its first job
+    CallDeduplicator dedupe_;
+    RecentUploads recent_uploads_;
+    bool upload_dedupe_;
+    
     // Job processing configuration
     int worker_threads_;
     int queue_size_;
     int job_timeout_ms_;
     
+    // Decode cluster: ingest nodes publish uploads, decode nodes consume them
+    ClusterPolicy cluster_policy_;
+    std::unique_ptr<ClusterPublisher> cluster_publisher_;
+    std::unique_ptr<ClusterConsumer> cluster_consumer_;
+    
     void handle_decode_request(const HttpRequest& request, HttpResponse& response);
     void handle_status_request(const HttpRequest& request, HttpResponse& response);
+    void handle_metrics_request(const HttpRequest& request, HttpResponse& response);
+    void handle_trace_request(const HttpRequest& request, HttpResponse& response);
+    void handle_profile_request(const HttpRequest& request, HttpResponse& response);
     void handle_job_status_request(const HttpRequest& request, HttpResponse& response);
+    void handle_snippet_request(const HttpRequest& request, HttpResponse& response);
+    void handle_call_audio_request(const HttpRequest& request, HttpResponse& response);
+    // Encode a stored call (its WAV, or an .imbe archive synthesised on a pooled decoder) to output_file
+    bool encode_call(const std::string& source, bool from_archive, const std::string& format, int bitrate,
+                     const std::string& output_file);
+    std::string job_status_json(const ProcessingJob& job);
     std::string create_temp_file(const std::vector<uint8_t>& data, const std::string& extension);
     void cleanup_temp_file(const std::string& filepath);
     bool validate_auth_token(const HttpRequest& request);
+    std::string build_output_base_path(const std::string& metadata_str, const std::string& filename);
+    bool admit_job(const std::string& stream_name, HttpResponse& response);
+    // Answer for an upload that duplicates a recent call, setting kept_job_id;
+    // false if it does not, in which case it is remembered under job_id
+    bool dedupe_upload(const std::string& job_id, const FileUpload& upload, const TrunkCallMetadata& metadata,
+                       HttpResponse& response, std::string& kept_job_id);
+    // Answer for a byte-identical repeat of an upload whose job is queued or
+    // done; false if there is none, in which case key now maps to job_id
+    bool repeat_upload(uint64_t key, const std::string& job_id, HttpResponse& response);
+    void duplicate_response(const ProcessingJob& job, bool merged, HttpResponse& response);
+    // Ingest node: hand an upload to the decode cluster and answer for it
+    void publish_upload(const FileUpload& upload, const std::string& metadata_str, const std::string& stream_name,
+                        const std::string& callback_url, HttpResponse& response);
+    // Decode node: queue a job read from the cluster; false when there is no room
+    bool submit_cluster_job(const ClusterJob& entry);
     
 public:
     ApiService(int port, const std::string& output_dir, bool verbose = false, bool foreground = false,
@@ -44,17 +115,69 @@ public:
     void enable_https(const std::string& cert_file, const std::string& key_file) { 
         ssl_cert_file_ = cert_file; ssl_key_file_ = key_file; 
     }
+    void configure_tls(const TlsOptions& options) { http_service_->configure_tls(options); }
     void set_upload_script(const std::string& script) { upload_script_ = script; }
     void set_audio_format(const std::string& format) { audio_format_ = format; }
     void set_audio_bitrate(int bitrate) { audio_bitrate_ = bitrate; }
+    // Root for GET /api/v1/snippet?file=...; defaults to the output directory
+    void set_archive_dir(const std::string& dir) { archive_dir_ = dir; }
+    // Where and how much on-demand encodes are kept; set before start()
+    void set_audio_cache(const std::string& dir, size_t memory_bytes = AudioCache::DEFAULT_MEMORY_BYTES,
+                         uint64_t disk_bytes = AudioCache::DEFAULT_DISK_BYTES) {
+        audio_cache_dir_ = dir;
+        audio_cache_memory_ = memory_bytes;
+        audio_cache_disk_ = disk_bytes;
+    }
     
     // Job processing configuration
     void configure_processing(int worker_threads, int queue_size, int timeout_ms);
+    // Set before start(); called from HTTP worker threads, one call per stream at a time
+    void set_stream_hooks(const CallStreamHooks& hooks) { stream_hooks_ = hooks; }
+    // Queued jobs' PCM to streaming plugins as it decodes; set before start().
+    // Live streams keep using the stream hooks above.
+    void set_pcm_stream(std::shared_ptr<PcmStreamHub> hub) { job_manager_->set_pcm_stream(std::move(hub)); }
+    // Control channel state that fills in what call uploads leave out; set before start()
+    void set_trunking_state(std::shared_ptr<const TrunkingState> state) { job_manager_->set_trunking_state(std::move(state)); }
+    // Talkgroup and unit directory filled into every call; set before start()
+    void set_call_enrichment(std::shared_ptr<const CallEnrichment> enrichment) { job_manager_->set_call_enrichment(std::move(enrichment)); }
+    void set_upload_buffer_limit(size_t bytes) { http_service_->set_upload_buffer_limit(bytes); }
+    // Where uploads past that limit are spooled; shared by the whole process
+    void set_temp_policy(const TempPolicy& policy) { TempStore::global().configure(policy); }
+    void configure_http(int worker_threads, int backlog, int max_connections, int keep_alive_timeout_s) {
+        http_service_->configure_server(worker_threads, backlog, max_connections);
+        http_service_->configure_keep_alive(keep_alive_timeout_s, 1000);
+    }
+    void set_scheduling_policy(const SchedulingPolicy& policy) { job_manager_->set_scheduling_policy(policy); }
+    void set_encode_policy(const EncodePolicy& policy) { job_manager_->set_encode_policy(policy); }
+    void set_admission_policy(const AdmissionPolicy& policy) { job_manager_->set_admission_policy(policy); }
+    void set_autoscale_policy(const AutoscalePolicy& policy) { job_manager_->set_autoscale_policy(policy); }
+    void configure_scripts(int max_concurrent, int queue_size) { job_manager_->configure_scripts(max_concurrent, queue_size); }
+    void set_output_write_policy(const OutputWritePolicy& policy) { job_manager_->set_output_write_policy(policy); }
+    // Publish uploads to, or decode jobs from, a Redis Streams cluster; set before start()
+    void set_cluster_policy(const ClusterPolicy& policy);
+    void set_dedupe_policy(const DedupePolicy& policy) { dedupe_.set_policy(policy); }
+    // On by default: an upload with the same body, metadata and stream as a
+    // recent one that has not failed returns that job instead of a new one
+    void set_upload_dedupe(bool enabled) { upload_dedupe_ = enabled; }
+    void set_vocoder(VoiceSynth::Backend backend, const std::map<std::string, VoiceSynth::Backend>& per_stream = {}) {
+        job_manager_->set_vocoder(backend, per_stream);
+    }
+    
+    // Trace one upload in every n (0 = off); read back with GET /api/v1/trace
+    void set_trace_sampling(uint32_t every_n) { Tracer::instance().set_sample_every(every_n); }
+    
+    // Time hot-path stages (builds with TRUNK_DECODER_PROFILE only); read back with GET /api/v1/profile
+    void set_profiling(bool enabled) { StageProfiler::instance().set_enabled(enabled); }
+    
+    void set_job_retention(int ttl_s, size_t max_finished_jobs) {
+        job_manager_->set_job_retention(std::chrono::seconds(ttl_s), max_finished_jobs);
+    }
     JobManager::JobStats get_processing_stats();
     
     // Placeholder methods for compatibility - these would be implemented in HttplibService
     void enable_decryption(bool enabled) { /* TODO: pass to decoder */ }
-    void add_des_key(uint16_t key_id, const std::vector<uint8_t>& key) { /* TODO: pass to decoder */ }
-    void add_aes_key(uint16_t key_id, const std::vector<uint8_t>& key) { /* TODO: pass to decoder */ }
-    void add_adp_key(uint16_t key_id, const std::vector<uint8_t>& key) { /* TODO: pass to decoder */ }
+    // Keys go to the shared KeyStore, which every pooled decoder reads
+    void add_des_key(uint16_t key_id, const std::vector<uint8_t>& key) { KeyStore::instance().add_key(key_id, key, "des"); }
+    void add_aes_key(uint16_t key_id, const std::vector<uint8_t>& key) { KeyStore::instance().add_key(key_id, key, "aes"); }
+    void add_adp_key(uint16_t key_id, const std::vector<uint8_t>& key) { KeyStore::instance().add_key(key_id, key, "adp"); }
 };
\ No newline at end of file
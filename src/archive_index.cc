@@ -0,0 +1,218 @@
+#include "archive_index.h"
+#include <filesystem>
+#include <sstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace fs = std::filesystem;
+
+static const char* INDEX_HEADER = "# trunk-decoder archive index v1";
+
+ArchiveIndex::ArchiveIndex(const std::string& path, const std::string& decoder_version, const std::string& settings)
+    : path_(path), decoder_version_(decoder_version), settings_(settings) {}
+
+bool ArchiveIndex::open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ifstream in(path_);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string key;
+        Entry entry;
+        if (parse_line(line, key, entry)) {
+            entries_[key] = entry;
+        }
+    }
+    in.close();
+
+    bool fresh = !fs::exists(path_);
+    journal_.open(path_, std::ios::app);
+    if (!journal_.is_open()) {
+        return false;
+    }
+    if (fresh) {
+        journal_ << INDEX_HEADER << "\n";
+    }
+    return true;
+}
+
+bool ArchiveIndex::up_to_date(const std::string& file, std::string& content_hash) {
+    content_hash.clear();
+    uint64_t size;
+    int64_t mtime;
+    if (!stat_file(file, size, mtime)) {
+        return false;
+    }
+
+    std::string key = key_for(file);
+    Entry entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return false;
+        }
+        entry = it->second;
+    }
+    if (entry.size != size || entry.decoder_version != decoder_version_ || entry.settings != settings_) {
+        return false;
+    }
+    for (const auto& output : entry.outputs) {
+        if (!fs::exists(output)) {
+            return false;
+        }
+    }
+    if (entry.mtime == mtime) {
+        return true;
+    }
+
+    // Same size, new mtime: only the content can tell
+    content_hash = hash_file(file);
+    if (content_hash.empty() || content_hash != entry.hash) {
+        return false;
+    }
+    entry.mtime = mtime;
+    std::lock_guard<std::mutex> lock(mutex_);
+    store_locked(key, entry);
+    return true;
+}
+
+void ArchiveIndex::record(const std::string& file, std::string content_hash, const std::vector<std::string>& outputs) {
+    Entry entry;
+    if (!stat_file(file, entry.size, entry.mtime)) {
+        return;
+    }
+    if (content_hash.empty()) {
+        content_hash = hash_file(file);
+    }
+    entry.hash = content_hash;
+    entry.decoder_version = decoder_version_;
+    entry.settings = settings_;
+    for (const auto& output : outputs) {
+        entry.outputs.push_back(key_for(output));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    store_locked(key_for(file), entry);
+}
+
+bool ArchiveIndex::compact() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string tmp_path = path_ + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out.is_open()) {
+            return false;
+        }
+        out << INDEX_HEADER << "\n";
+        for (const auto& pair : entries_) {
+            write_line(out, pair.first, pair.second);
+        }
+        out.flush();
+        if (!out) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    journal_.close();
+    if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        journal_.open(path_, std::ios::app);
+        return false;
+    }
+    journal_.open(path_, std::ios::app);
+    return true;
+}
+
+size_t ArchiveIndex::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+std::string ArchiveIndex::hash_file(const std::string& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in.is_open()) {
+        return "";
+    }
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    char buffer[65536];
+    while (in) {
+        in.read(buffer, sizeof(buffer));
+        std::streamsize n = in.gcount();
+        for (std::streamsize i = 0; i < n; i++) {
+            hash ^= static_cast<uint8_t>(buffer[i]);
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    if (in.bad()) {
+        return "";
+    }
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return hex;
+}
+
+std::string ArchiveIndex::key_for(const std::string& file) {
+    std::error_code ec;
+    fs::path absolute = fs::absolute(file, ec);
+    return ec ? file : absolute.lexically_normal().string();
+}
+
+bool ArchiveIndex::stat_file(const std::string& file, uint64_t& size, int64_t& mtime) {
+    std::error_code ec;
+    size = fs::file_size(file, ec);
+    if (ec) {
+        return false;
+    }
+    auto write_time = fs::last_write_time(file, ec);
+    if (ec) {
+        return false;
+    }
+    mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(write_time.time_since_epoch()).count();
+    return true;
+}
+
+// path \t size \t mtime \t hash \t decoder version \t settings [\t output]...
+bool ArchiveIndex::parse_line(const std::string& line, std::string& key, Entry& entry) {
+    if (line.empty() || line[0] == '#') {
+        return false;
+    }
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, '\t')) {
+        fields.push_back(field);
+    }
+    if (fields.size() < 6) {
+        return false;
+    }
+    key = fields[0];
+    entry.size = std::strtoull(fields[1].c_str(), nullptr, 10);
+    entry.mtime = std::strtoll(fields[2].c_str(), nullptr, 10);
+    entry.hash = fields[3];
+    entry.decoder_version = fields[4];
+    entry.settings = fields[5];
+    entry.outputs.assign(fields.begin() + 6, fields.end());
+    return true;
+}
+
+void ArchiveIndex::write_line(std::ostream& out, const std::string& key, const Entry& entry) {
+    out << key << '\t' << entry.size << '\t' << entry.mtime << '\t' << entry.hash << '\t'
+        << entry.decoder_version << '\t' << entry.settings;
+    for (const auto& output : entry.outputs) {
+        out << '\t' << output;
+    }
+    out << '\n';
+}
+
+void ArchiveIndex::store_locked(const std::string& key, const Entry& entry) {
+    // Paths with tabs or newlines cannot be represented; they are just decoded every time
+    if (key.find_first_of("\t\n") != std::string::npos) {
+        return;
+    }
+    entries_[key] = entry;
+    if (journal_.is_open()) {
+        write_line(journal_, key, entry);
+        journal_.flush();
+    }
+}
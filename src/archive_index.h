@@ -0,0 +1,73 @@
+/*
+ * Incremental archive index
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Remembers, for every .p25 file a batch run decoded, its size, mtime and
+ * content hash together with the decoder version, the output settings and
+ * the files produced. On the next run a file is skipped when all of that
+ * still matches: an unchanged size and mtime is trusted as is, and a file
+ * whose mtime moved (copied, touched, restored from backup) is hashed and
+ * skipped if its content is the same.
+ *
+ * The index is a tab separated text file. New results are appended as they
+ * finish so an interrupted run loses nothing; the last line for a path wins
+ * and compact() rewrites the file with one line per path.
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+class ArchiveIndex {
+public:
+    ArchiveIndex(const std::string& path, const std::string& decoder_version, const std::string& settings);
+
+    // Read an existing index (a missing file is an empty index) and open it for appending
+    bool open();
+
+    // True if the outputs recorded for file are still valid. Whenever the
+    // content had to be hashed, the hash is returned in content_hash.
+    bool up_to_date(const std::string& file, std::string& content_hash);
+
+    // Record a file as decoded into outputs; hashes it if content_hash is empty
+    void record(const std::string& file, std::string content_hash, const std::vector<std::string>& outputs);
+
+    // Rewrite the index with the latest entry for every path
+    bool compact();
+
+    size_t size();
+
+    // 64-bit FNV-1a over the file contents, as hex; empty if unreadable
+    static std::string hash_file(const std::string& file);
+
+    // Absolute, normalised form used as the index key
+    static std::string key_for(const std::string& file);
+
+private:
+    struct Entry {
+        uint64_t size;
+        int64_t mtime;
+        std::string hash;
+        std::string decoder_version;
+        std::string settings;
+        std::vector<std::string> outputs;
+    };
+
+    static bool stat_file(const std::string& file, uint64_t& size, int64_t& mtime);
+    static bool parse_line(const std::string& line, std::string& key, Entry& entry);
+    static void write_line(std::ostream& out, const std::string& key, const Entry& entry);
+    void store_locked(const std::string& key, const Entry& entry);
+
+    std::string path_;
+    std::string decoder_version_;
+    std::string settings_;
+    std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+    std::ofstream journal_;
+};
@@ -0,0 +1,201 @@
+#include "audio_cache.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+// Produced files are written under a dot name, so a crash mid-encode only
+// leaves something load_existing() knows to delete
+static const char TEMP_PREFIX[] = ".tmp-";
+
+AudioCache::AudioCache(const std::string& dir, size_t memory_bytes, uint64_t disk_bytes)
+    : dir_(dir), memory_limit_(memory_bytes), disk_limit_(disk_bytes),
+      memory_item_limit_(memory_bytes / 16), memory_used_(0), disk_used_(0), sequence_(0) {
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+    if (ec) {
+        std::cerr << "[AudioCache] Cannot create " << dir_ << ": " << ec.message() << std::endl;
+    }
+    load_existing();
+}
+
+std::string AudioCache::file_name(const std::string& key) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string name;
+    for (unsigned char c : key) {
+        if (isalnum(c) || c == '.' || c == '_' || c == '-') {
+            name += static_cast<char>(c);
+        } else {
+            name += '%';
+            name += hex[c >> 4];
+            name += hex[c & 0xf];
+        }
+    }
+    // Never a dot file, so never mistaken for a temp file
+    if (!name.empty() && name[0] == '.') {
+        name.replace(0, 1, "%2E");
+    }
+    return name;
+}
+
+void AudioCache::load_existing() {
+    struct Found {
+        std::string name;
+        uint64_t size;
+        fs::file_time_type mtime;
+    };
+    std::vector<Found> found;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code entry_ec;
+        if (!it->is_regular_file(entry_ec)) {
+            continue;
+        }
+        std::string name = it->path().filename().string();
+        if (name.compare(0, sizeof(TEMP_PREFIX) - 1, TEMP_PREFIX) == 0) {
+            fs::remove(it->path(), entry_ec);
+            continue;
+        }
+        Found file{name, it->file_size(entry_ec), it->last_write_time(entry_ec)};
+        if (!entry_ec) {
+            found.push_back(file);
+        }
+    }
+
+    // Newest first, as if they had been used in the order they were made
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.mtime > b.mtime; });
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& file : found) {
+        lru_.push_back(Entry{file.name, file.size, nullptr});
+        entries_[file.name] = std::prev(lru_.end());
+        disk_used_ += file.size;
+    }
+    evict_locked();
+}
+
+bool AudioCache::lookup_locked(const std::string& name, Hit& hit) {
+    auto it = entries_.find(name);
+    if (it == entries_.end()) {
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    hit.data = it->second->data;
+    hit.path = dir_ + "/" + name;
+    hit.size = it->second->size;
+    return true;
+}
+
+void AudioCache::insert_locked(const std::string& name, uint64_t size, std::shared_ptr<const std::vector<uint8_t>> data) {
+    auto it = entries_.find(name);
+    if (it != entries_.end()) {
+        disk_used_ -= it->second->size;
+        memory_used_ -= it->second->data ? it->second->data->size() : 0;
+        lru_.erase(it->second);
+    }
+    memory_used_ += data ? data->size() : 0;
+    disk_used_ += size;
+    lru_.push_front(Entry{name, size, std::move(data)});
+    entries_[name] = lru_.begin();
+    evict_locked();
+}
+
+void AudioCache::evict_locked() {
+    // Memory goes first: older entries just fall back to their file
+    for (auto it = lru_.rbegin(); memory_used_ > memory_limit_ && it != lru_.rend(); ++it) {
+        if (it->data) {
+            memory_used_ -= it->data->size();
+            it->data.reset();
+        }
+    }
+    // The newest entry stays even if it alone is over the limit
+    while (disk_used_ > disk_limit_ && lru_.size() > 1) {
+        Entry& oldest = lru_.back();
+        std::error_code ec;
+        fs::remove(dir_ + "/" + oldest.name, ec);
+        disk_used_ -= oldest.size;
+        memory_used_ -= oldest.data ? oldest.data->size() : 0;
+        entries_.erase(oldest.name);
+        lru_.pop_back();
+    }
+}
+
+std::shared_ptr<const std::vector<uint8_t>> AudioCache::read_file(const std::string& path, uint64_t size) const {
+    if (size > memory_item_limit_) {
+        return nullptr;
+    }
+    auto data = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(size));
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read(reinterpret_cast<char*>(data->data()), data->size())) {
+        return nullptr;
+    }
+    return data;
+}
+
+bool AudioCache::fetch(const std::string& key, const Producer& produce, Hit& hit) {
+    const std::string name = file_name(key);
+    const std::string path = dir_ + "/" + name;
+    std::unique_lock<std::mutex> lock(mutex_);
+    produced_.wait(lock, [this, &name] { return pending_.count(name) == 0; });
+    hit.produced = false;
+    if (lookup_locked(name, hit)) {
+        if (hit.data || hit.size > memory_item_limit_) {
+            return true;
+        }
+        // Back into memory, read without holding the lock
+        lock.unlock();
+        auto data = read_file(hit.path, hit.size);
+        lock.lock();
+        auto it = entries_.find(name);
+        if (data && it != entries_.end() && !it->second->data && it->second->size == data->size()) {
+            it->second->data = data;
+            memory_used_ += data->size();
+            hit.data = data;
+            evict_locked();
+        }
+        return true;
+    }
+    pending_.insert(name);
+    std::string temp_path = dir_ + "/" + TEMP_PREFIX + std::to_string(++sequence_) + "-" + name;
+    lock.unlock();
+
+    bool produced = produce(temp_path);
+    std::error_code ec;
+    uint64_t size = produced ? fs::file_size(temp_path, ec) : 0;
+    produced = produced && !ec;
+    if (produced) {
+        fs::rename(temp_path, path, ec);
+        produced = !ec;
+    }
+    std::shared_ptr<const std::vector<uint8_t>> data;
+    if (produced) {
+        data = read_file(path, size);
+    } else {
+        fs::remove(temp_path, ec);
+    }
+
+    lock.lock();
+    pending_.erase(name);
+    if (produced) {
+        insert_locked(name, size, data);
+        hit.data = data;
+        hit.path = path;
+        hit.size = size;
+        hit.produced = true;
+    }
+    lock.unlock();
+    produced_.notify_all();
+    return produced;
+}
+
+size_t AudioCache::memory_used() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return memory_used_;
+}
+
+uint64_t AudioCache::disk_used() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return disk_used_;
+}
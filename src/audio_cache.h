@@ -0,0 +1,88 @@
+/*
+ * Encoded audio cache
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Calls are encoded into a format the first time someone plays them
+ * (GET /api/v1/calls/<id>/audio) rather than into every format at ingest.
+ * Each result is kept as a file in the cache directory, and recently used
+ * small ones in memory too. Both tiers are bounded in bytes and give up
+ * their least recently used entries first. Files left by an earlier run
+ * are taken back in by age.
+ *
+ * Concurrent requests for something not cached yet wait for the one
+ * encode rather than each starting their own.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class AudioCache {
+public:
+    static constexpr size_t DEFAULT_MEMORY_BYTES = 64 * 1024 * 1024;
+    static constexpr uint64_t DEFAULT_DISK_BYTES = 1024ull * 1024 * 1024;
+
+    struct Hit {
+        std::shared_ptr<const std::vector<uint8_t>> data;  // set when the entry is in memory
+        std::string path;                                  // the cached file
+        uint64_t size = 0;
+        bool produced = false;                             // encoded by this fetch()
+    };
+
+    // Writes the encoded audio to output_file (whose extension is the
+    // key's); false if it could not be produced
+    using Producer = std::function<bool(const std::string& output_file)>;
+
+    AudioCache(const std::string& dir, size_t memory_bytes = DEFAULT_MEMORY_BYTES,
+               uint64_t disk_bytes = DEFAULT_DISK_BYTES);
+
+    AudioCache(const AudioCache&) = delete;
+    AudioCache& operator=(const AudioCache&) = delete;
+
+    // The entry for key, running produce on a miss. key ends in the format's
+    // extension (e.g. "site/call.16k.opus"); anything outside [A-Za-z0-9._-]
+    // is escaped for the file name.
+    bool fetch(const std::string& key, const Producer& produce, Hit& hit);
+
+    size_t memory_used() const;
+    uint64_t disk_used() const;
+
+private:
+    struct Entry {
+        std::string name;
+        uint64_t size;
+        std::shared_ptr<const std::vector<uint8_t>> data;
+    };
+
+    static std::string file_name(const std::string& key);
+    void load_existing();
+    // Move name to the front and fill hit; false if absent. mutex_ held.
+    bool lookup_locked(const std::string& name, Hit& hit);
+    void insert_locked(const std::string& name, uint64_t size, std::shared_ptr<const std::vector<uint8_t>> data);
+    void evict_locked();
+    std::shared_ptr<const std::vector<uint8_t>> read_file(const std::string& path, uint64_t size) const;
+
+    std::string dir_;
+    size_t memory_limit_;
+    uint64_t disk_limit_;
+    size_t memory_item_limit_;  // larger entries are only ever served from disk
+
+    mutable std::mutex mutex_;
+    std::condition_variable produced_;
+    std::list<Entry> lru_;      // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+    std::set<std::string> pending_;
+    size_t memory_used_;
+    uint64_t disk_used_;
+    uint64_t sequence_;
+};
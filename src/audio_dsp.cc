@@ -0,0 +1,238 @@
+/*
+ * PCM resampling and gain for decoded audio
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ */
+
+#include "audio_dsp.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUDIO_DSP_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_DSP_NEON 1
+#endif
+
+namespace {
+
+// Kaiser window shape; rejection is roughly 80 dB at beta 8
+constexpr double KAISER_BETA = 8.0;
+
+// Passband edge as a fraction of the narrower Nyquist rate
+constexpr double ROLLOFF = 0.9;
+
+double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+int16_t saturate(int32_t value) {
+    return static_cast<int16_t>(std::min<int32_t>(32767, std::max<int32_t>(-32768, value)));
+}
+
+// Sum of x[i] * h[i] for n a multiple of 8
+[[maybe_unused]] int32_t dot_scalar(const int16_t* x, const int16_t* h, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += static_cast<int32_t>(x[i]) * h[i];
+    }
+    return sum;
+}
+
+#if AUDIO_DSP_SSE2
+int32_t dot_sse2(const int16_t* x, const int16_t* h, int n) {
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < n; i += 8) {
+        __m128i xv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        __m128i hv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(xv, hv));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+#define dot_kernel dot_sse2
+#define DOT_KERNEL_NAME "sse2"
+#elif AUDIO_DSP_NEON
+int32_t dot_neon(const int16_t* x, const int16_t* h, int n) {
+    int32x4_t acc = vdupq_n_s32(0);
+    for (int i = 0; i < n; i += 8) {
+        int16x8_t xv = vld1q_s16(x + i);
+        int16x8_t hv = vld1q_s16(h + i);
+        acc = vmlal_s16(acc, vget_low_s16(xv), vget_low_s16(hv));
+        acc = vmlal_s16(acc, vget_high_s16(xv), vget_high_s16(hv));
+    }
+    int32x2_t pair = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    pair = vpadd_s32(pair, pair);
+    return vget_lane_s32(pair, 0);
+}
+#define dot_kernel dot_neon
+#define DOT_KERNEL_NAME "neon"
+#else
+#define dot_kernel dot_scalar
+#define DOT_KERNEL_NAME "scalar"
+#endif
+
+} // namespace
+
+Resampler::Resampler(int in_rate, int out_rate)
+    : in_rate_(in_rate), out_rate_(out_rate), phase_(0) {
+    int divisor = std::gcd(in_rate, out_rate);
+    up_ = out_rate / divisor;
+    down_ = in_rate / divisor;
+
+    // Prototype at up_ * in_rate, cut off below the lower of the two Nyquist rates
+    const int length = up_ * TAPS_PER_PHASE;
+    const double cutoff = 0.5 * ROLLOFF / std::max(up_, down_);
+    const double center = (length - 1) / 2.0;
+    const double window_norm = bessel_i0(KAISER_BETA);
+    std::vector<double> prototype(length);
+    for (int n = 0; n < length; n++) {
+        double t = n - center;
+        double sinc = t == 0.0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+        double r = t / center;
+        double window = bessel_i0(KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - r * r))) / window_norm;
+        prototype[n] = sinc * window;
+    }
+
+    // Phase p is prototype[p + k * up_]; each is scaled to unity DC gain
+    // and stored newest-input-last so it lines up with the history
+    coefficients_.resize(static_cast<size_t>(up_) * TAPS_PER_PHASE);
+    for (int p = 0; p < up_; p++) {
+        double sum = 0.0;
+        for (int k = 0; k < TAPS_PER_PHASE; k++) {
+            sum += prototype[p + k * up_];
+        }
+        for (int k = 0; k < TAPS_PER_PHASE; k++) {
+            double value = prototype[p + k * up_] / sum * 32768.0;
+            coefficients_[p * TAPS_PER_PHASE + (TAPS_PER_PHASE - 1 - k)] =
+                saturate(static_cast<int32_t>(std::lround(value)));
+        }
+    }
+    reset();
+}
+
+void Resampler::reset() {
+    history_.assign(TAPS_PER_PHASE - 1, 0);
+    position_ = TAPS_PER_PHASE - 1;
+    phase_ = 0;
+    samples_in_ = 0;
+    samples_out_ = 0;
+    // The filter delays its output by half its length; that much of the
+    // start is dropped so output lines up with input
+    skip_ = static_cast<size_t>((up_ * TAPS_PER_PHASE - 1) / 2 / down_);
+}
+
+void Resampler::process(const int16_t* in, size_t count, std::vector<int16_t>& out) {
+    history_.insert(history_.end(), in, in + count);
+    samples_in_ += count;
+    out.reserve(out.size() + count * up_ / down_ + 1);
+
+    const size_t available = history_.size();
+    while (position_ < available) {
+        int32_t sum = dot_kernel(&history_[position_ - (TAPS_PER_PHASE - 1)],
+                                 &coefficients_[static_cast<size_t>(phase_) * TAPS_PER_PHASE],
+                                 TAPS_PER_PHASE);
+        if (skip_ > 0) {
+            skip_--;
+        } else {
+            out.push_back(saturate((sum + (1 << 14)) >> 15));
+            samples_out_++;
+        }
+        phase_ += down_;
+        position_ += phase_ / up_;
+        phase_ %= up_;
+    }
+
+    size_t consumed = available - (TAPS_PER_PHASE - 1);
+    history_.erase(history_.begin(), history_.begin() + consumed);
+    position_ -= consumed;
+}
+
+void Resampler::flush(std::vector<int16_t>& out) {
+    const uint64_t expected = samples_in_ * up_ / down_;
+    const int16_t silence[TAPS_PER_PHASE] = {};
+    for (int pass = 0; pass < 4 && samples_out_ < expected; pass++) {
+        size_t before = out.size();
+        process(silence, TAPS_PER_PHASE, out);
+        // Zeros do not count as input
+        samples_in_ -= TAPS_PER_PHASE;
+        if (samples_out_ > expected) {
+            out.resize(out.size() - std::min<size_t>(out.size() - before, samples_out_ - expected));
+            samples_out_ = expected;
+        }
+    }
+    reset();
+}
+
+const char* Resampler::kernel_name() {
+    return DOT_KERNEL_NAME;
+}
+
+AudioGain::AudioGain(const Settings& settings, int sample_rate)
+    : settings_(settings), block_samples_(std::max(1, sample_rate / 100)) {
+    fixed_gain_ = std::pow(10.0, settings_.gain_db / 20.0);
+    max_gain_ = std::pow(10.0, settings_.max_gain_db / 20.0);
+    target_rms_ = 32768.0 * std::pow(10.0, settings_.target_dbfs / 20.0);
+    gate_rms_ = 32768.0 * std::pow(10.0, settings_.gate_dbfs / 20.0);
+    const double block_ms = 1000.0 * block_samples_ / sample_rate;
+    attack_ = 1.0 - std::exp(-block_ms / std::max(1.0, settings_.attack_ms));
+    release_ = 1.0 - std::exp(-block_ms / std::max(1.0, settings_.release_ms));
+    reset();
+}
+
+void AudioGain::reset() {
+    agc_gain_ = 1.0;
+    applied_gain_ = fixed_gain_;
+}
+
+void AudioGain::process(int16_t* samples, size_t count) {
+    for (size_t offset = 0; offset < count; offset += block_samples_) {
+        process_block(samples + offset, std::min(block_samples_, count - offset));
+    }
+}
+
+void AudioGain::process_block(int16_t* samples, size_t count) {
+    double energy = 0.0;
+    int peak = 0;
+    for (size_t i = 0; i < count; i++) {
+        energy += static_cast<double>(samples[i]) * samples[i];
+        peak = std::max(peak, std::abs(static_cast<int>(samples[i])));
+    }
+
+    double gain = fixed_gain_;
+    if (settings_.agc) {
+        double level = std::sqrt(energy / count) * fixed_gain_;
+        // Silence between words keeps the gain it had
+        if (level > gate_rms_) {
+            double desired = std::min(max_gain_, target_rms_ / level);
+            agc_gain_ += (desired - agc_gain_) * (desired < agc_gain_ ? attack_ : release_);
+        }
+        gain *= agc_gain_;
+    }
+    if (peak > 0 && gain * peak > 32767.0) {
+        gain = 32767.0 / peak;
+    }
+
+    // Ramp from the previous block's gain so steps do not click
+    const double start = applied_gain_;
+    const double step = (gain - start) / count;
+    for (size_t i = 0; i < count; i++) {
+        double g = start + step * (i + 1);
+        samples[i] = saturate(static_cast<int32_t>(std::lround(samples[i] * g)));
+    }
+    applied_gain_ = gain;
+}
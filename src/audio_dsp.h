@@ -0,0 +1,106 @@
+/*
+ * PCM resampling and gain for decoded audio
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Resampler converts the vocoder's 8 kHz output to another rate (16 kHz
+ * or 48 kHz for Opus and WebRTC) with a polyphase FIR: a Kaiser windowed
+ * sinc prototype is split into one short filter per output phase, so each
+ * output sample is a single dot product over the newest input samples.
+ * Coefficients are Q15 and the dot product runs on SSE2 or NEON where
+ * available (picked at compile time, as in imbe_vocoder/simd_sub.cc).
+ * State carries across process() calls, so audio can be fed one LDU at a
+ * time; flush() drains the filter's delay at the end of a call.
+ *
+ * AudioGain applies a fixed gain and, optionally, an AGC that steers each
+ * 10 ms block toward a target RMS level, with fast attack, slow release,
+ * a gate that holds the gain through silence, and a peak limiter so the
+ * result never clips. Gain changes are ramped across a block.
+ */
+
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Resampler {
+public:
+    static constexpr int TAPS_PER_PHASE = 24;   // multiple of 8 for the vector kernels
+
+    // Any rational ratio; in_rate and out_rate in Hz
+    Resampler(int in_rate, int out_rate);
+
+    int in_rate() const { return in_rate_; }
+    int out_rate() const { return out_rate_; }
+
+    // Append the resampled input to out
+    void process(const int16_t* in, size_t count, std::vector<int16_t>& out);
+
+    // Append what is still inside the filter (its group delay) to out and reset
+    void flush(std::vector<int16_t>& out);
+
+    // Forget the previous call's history
+    void reset();
+
+    // Name of the dot product kernel in use: "sse2", "neon" or "scalar"
+    static const char* kernel_name();
+
+private:
+    int in_rate_;
+    int out_rate_;
+    int up_;        // L: interpolation factor
+    int down_;      // M: decimation factor
+    std::vector<int16_t> coefficients_;   // up_ phases of TAPS_PER_PHASE, each reversed
+    std::vector<int16_t> history_;        // last TAPS_PER_PHASE - 1 inputs, then the new block
+    size_t position_;                     // history_ index of the newest input for the next output
+    int phase_;                           // position within that input sample, 0..up_-1
+    size_t skip_;                         // outputs still inside the filter's delay
+    uint64_t samples_in_;
+    uint64_t samples_out_;
+};
+
+class AudioGain {
+public:
+    struct Settings {
+        double gain_db;        // fixed gain, applied before the AGC
+        bool agc;
+        double target_dbfs;    // AGC target RMS
+        double max_gain_db;    // most the AGC may add
+        double attack_ms;      // time constant when turning down
+        double release_ms;     // time constant when turning up
+        double gate_dbfs;      // blocks quieter than this leave the gain alone
+
+        Settings() : gain_db(0.0), agc(false), target_dbfs(-18.0), max_gain_db(24.0),
+                     attack_ms(10.0), release_ms(500.0), gate_dbfs(-50.0) {}
+
+        bool active() const { return agc || gain_db != 0.0; }
+    };
+
+    AudioGain(const Settings& settings, int sample_rate);
+
+    const Settings& settings() const { return settings_; }
+
+    // In place
+    void process(int16_t* samples, size_t count);
+
+    // Back to the fixed gain for a new call
+    void reset();
+
+private:
+    void process_block(int16_t* samples, size_t count);
+
+    Settings settings_;
+    size_t block_samples_;
+    double fixed_gain_;
+    double max_gain_;
+    double target_rms_;
+    double gate_rms_;
+    double attack_;
+    double release_;
+    double agc_gain_;       // smoothed AGC gain, on top of fixed_gain_
+    double applied_gain_;   // total gain at the end of the last block
+};
+
+#endif // AUDIO_DSP_H
@@ -0,0 +1,644 @@
+/*
+ * In-process audio encoder
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "audio_encoder.h"
+#include "child_process.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef HAVE_LIBOPUS
+#include <opus/opus.h>
+#endif
+#ifdef HAVE_LIBMP3LAME
+#include <lame/lame.h>
+#endif
+
+namespace {
+
+#ifdef HAVE_LIBOPUS
+// Minimal Ogg page writer for a single logical stream (RFC 3533 / RFC 7845)
+class OggWriter {
+public:
+    OggWriter(std::vector<uint8_t>& out, uint32_t serial) : out_(out), serial_(serial), sequence_(0) {}
+
+    void write_page(const std::vector<std::vector<uint8_t>>& packets, uint64_t granule, uint8_t flags) {
+        std::vector<uint8_t> segments;
+        size_t body_size = 0;
+        for (const auto& packet : packets) {
+            size_t remaining = packet.size();
+            while (remaining >= 255) {
+                segments.push_back(255);
+                remaining -= 255;
+            }
+            segments.push_back(static_cast<uint8_t>(remaining));
+            body_size += packet.size();
+        }
+
+        size_t start = out_.size();
+        out_.reserve(start + 27 + segments.size() + body_size);
+        const uint8_t capture[4] = {'O', 'g', 'g', 'S'};
+        out_.insert(out_.end(), capture, capture + 4);
+        out_.push_back(0);      // stream structure version
+        out_.push_back(flags);
+        put_le(granule, 8);
+        put_le(serial_, 4);
+        put_le(sequence_++, 4);
+        put_le(0, 4);           // CRC placeholder
+        out_.push_back(static_cast<uint8_t>(segments.size()));
+        out_.insert(out_.end(), segments.begin(), segments.end());
+        for (const auto& packet : packets) {
+            out_.insert(out_.end(), packet.begin(), packet.end());
+        }
+
+        uint32_t crc = crc32(&out_[start], out_.size() - start);
+        for (int i = 0; i < 4; i++) {
+            out_[start + 22 + i] = static_cast<uint8_t>(crc >> (8 * i));
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint32_t serial_;
+    uint32_t sequence_;
+
+    void put_le(uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out_.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    static uint32_t crc32(const uint8_t* data, size_t len) {
+        static uint32_t table[256];
+        static bool initialized = false;
+        if (!initialized) {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t r = i << 24;
+                for (int j = 0; j < 8; j++) {
+                    r = (r & 0x80000000u) ? (r << 1) ^ 0x04c11db7u : (r << 1);
+                }
+                table[i] = r;
+            }
+            initialized = true;
+        }
+        uint32_t crc = 0;
+        for (size_t i = 0; i < len; i++) {
+            crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xff];
+        }
+        return crc;
+    }
+};
+
+void append_le(std::vector<uint8_t>& v, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        v.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+#endif // HAVE_LIBOPUS
+
+// FLAC (RFC 9639) needs no library: fixed linear predictors of order 0-4
+// with Rice-coded residuals, which is most of what libFLAC gains on voice
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out_(out), acc_(0), bits_(0) {}
+
+    // value's low count bits, most significant first; count <= 32
+    void put(uint32_t value, int count) {
+        for (int i = count - 1; i >= 0; i--) {
+            acc_ = static_cast<uint8_t>((acc_ << 1) | ((value >> i) & 1));
+            if (++bits_ == 8) {
+                out_.push_back(acc_);
+                acc_ = 0;
+                bits_ = 0;
+            }
+        }
+    }
+
+    void put_signed(int32_t value, int count) { put(static_cast<uint32_t>(value), count); }
+
+    // quotient zeros, a one, then the k low bits
+    void put_rice(uint32_t value, int k) {
+        for (uint32_t q = value >> k; q > 0; q--) {
+            put(0, 1);
+        }
+        put(1, 1);
+        put(value, k);
+    }
+
+    void align() {
+        if (bits_ > 0) {
+            put(0, 8 - bits_);
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint8_t acc_;
+    int bits_;
+};
+
+const size_t FLAC_BLOCK_SIZE = 4096;
+const int FLAC_MAX_ORDER = 4;
+const int FLAC_MAX_PARTITION_ORDER = 8;
+
+uint8_t flac_crc8(const uint8_t* data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+uint16_t flac_crc16(const uint8_t* data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= static_cast<uint16_t>(data[i] << 8);
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x8005) : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// The frame header's 4-bit rate code; 0 takes the rate from STREAMINFO
+uint32_t flac_rate_code(int sample_rate) {
+    switch (sample_rate) {
+        case 8000: return 4;
+        case 16000: return 5;
+        case 22050: return 6;
+        case 24000: return 7;
+        case 32000: return 8;
+        case 44100: return 9;
+        case 48000: return 10;
+        case 96000: return 11;
+        default: return 0;
+    }
+}
+
+uint32_t zigzag(int32_t value) {
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+// Residual of the fixed predictor of order over block, from sample order on
+void fixed_residual(const int32_t* block, size_t n, int order, std::vector<int32_t>& residual) {
+    residual.resize(n);
+    for (size_t i = order; i < n; i++) {
+        const int32_t* x = block + i;
+        switch (order) {
+            case 0: residual[i] = x[0]; break;
+            case 1: residual[i] = x[0] - x[-1]; break;
+            case 2: residual[i] = x[0] - 2 * x[-1] + x[-2]; break;
+            case 3: residual[i] = x[0] - 3 * x[-1] + 3 * x[-2] - x[-3]; break;
+            default: residual[i] = x[0] - 4 * x[-1] + 6 * x[-2] - 4 * x[-3] + x[-4]; break;
+        }
+    }
+}
+
+struct RicePlan {
+    int partition_order;
+    std::vector<int> parameters;
+    uint64_t bits;
+};
+
+// Cheapest Rice parameter for one partition; the mean picks the
+// neighbourhood, the exact bit count the winner
+int best_rice_parameter(const uint32_t* values, size_t count, uint64_t& bits) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    int guess = 0;
+    while (guess < 14 && (static_cast<uint64_t>(count) << (guess + 1)) <= sum) {
+        guess++;
+    }
+    int best = guess;
+    bits = UINT64_MAX;
+    for (int k = std::max(0, guess - 1); k <= std::min(14, guess + 1); k++) {
+        uint64_t total = static_cast<uint64_t>(count) * (k + 1);
+        for (size_t i = 0; i < count; i++) {
+            total += values[i] >> k;
+        }
+        if (total < bits) {
+            bits = total;
+            best = k;
+        }
+    }
+    return best;
+}
+
+RicePlan plan_rice(const std::vector<uint32_t>& values, size_t n, int order) {
+    RicePlan best{0, {}, UINT64_MAX};
+    for (int partition_order = 0; partition_order <= FLAC_MAX_PARTITION_ORDER; partition_order++) {
+        size_t partitions = static_cast<size_t>(1) << partition_order;
+        size_t length = n >> partition_order;
+        if (n % partitions != 0 || length <= static_cast<size_t>(order)) {
+            break;
+        }
+        RicePlan plan{partition_order, {}, 2 + 4};
+        for (size_t p = 0; p < partitions; p++) {
+            size_t start = p == 0 ? order : p * length;
+            size_t end = (p + 1) * length;
+            uint64_t bits = 0;
+            plan.parameters.push_back(best_rice_parameter(values.data() + start, end - start, bits));
+            plan.bits += 4 + bits;
+        }
+        if (plan.bits < best.bits) {
+            best = std::move(plan);
+        }
+    }
+    return best;
+}
+
+// One mono subframe: constant, the best fixed predictor, or verbatim
+void write_flac_subframe(BitWriter& bits, const int32_t* block, size_t n) {
+    if (std::all_of(block, block + n, [block](int32_t sample) { return sample == block[0]; })) {
+        bits.put(0x00, 8);
+        bits.put_signed(block[0], 16);
+        return;
+    }
+
+    // Order by smallest residual magnitude, as libFLAC's fixed encoder does
+    static thread_local std::vector<int32_t> residual;
+    static thread_local std::vector<uint32_t> folded;
+    int max_order = static_cast<int>(std::min<size_t>(FLAC_MAX_ORDER, n - 1));
+    int order = 0;
+    uint64_t best_sum = UINT64_MAX;
+    for (int candidate = 0; candidate <= max_order; candidate++) {
+        fixed_residual(block, n, candidate, residual);
+        uint64_t sum = 0;
+        for (size_t i = candidate; i < n; i++) {
+            sum += static_cast<uint32_t>(std::abs(residual[i]));
+        }
+        if (sum < best_sum) {
+            best_sum = sum;
+            order = candidate;
+        }
+    }
+    fixed_residual(block, n, order, residual);
+    folded.resize(n);
+    for (size_t i = order; i < n; i++) {
+        folded[i] = zigzag(residual[i]);
+    }
+    RicePlan plan = plan_rice(folded, n, order);
+
+    if (16 * static_cast<uint64_t>(order) + plan.bits >= 16 * static_cast<uint64_t>(n)) {
+        bits.put(0x02, 8);
+        for (size_t i = 0; i < n; i++) {
+            bits.put_signed(block[i], 16);
+        }
+        return;
+    }
+    bits.put(0x10 | (order << 1), 8);
+    for (int i = 0; i < order; i++) {
+        bits.put_signed(block[i], 16);
+    }
+    bits.put(0, 2);     // 4-bit Rice parameters
+    bits.put(plan.partition_order, 4);
+    size_t length = n >> plan.partition_order;
+    for (size_t p = 0; p < plan.parameters.size(); p++) {
+        int k = plan.parameters[p];
+        bits.put(k, 4);
+        size_t start = p == 0 ? order : p * length;
+        for (size_t i = start; i < (p + 1) * length; i++) {
+            bits.put_rice(folded[i], k);
+        }
+    }
+}
+
+// Frame numbers are coded like UTF-8
+void put_utf8_number(BitWriter& bits, uint32_t value) {
+    if (value < 0x80) {
+        bits.put(value, 8);
+        return;
+    }
+    int extra = value < 0x800 ? 1 : value < 0x10000 ? 2 : value < 0x200000 ? 3 : value < 0x4000000 ? 4 : 5;
+    uint32_t lead_mask = (0xff00u >> (extra + 1)) & 0xff;
+    bits.put(lead_mask | (value >> (6 * extra)), 8);
+    for (int i = extra - 1; i >= 0; i--) {
+        bits.put(0x80 | ((value >> (6 * i)) & 0x3f), 8);
+    }
+}
+
+} // namespace
+
+bool AudioEncoder::has_backend(const std::string& format) {
+    if (format == "flac") return true;
+#ifdef HAVE_LIBOPUS
+    if (format == "opus") return true;
+#endif
+#ifdef HAVE_LIBMP3LAME
+    if (format == "mp3") return true;
+#endif
+    (void)format;
+    return false;
+}
+
+int AudioEncoder::default_bitrate(const std::string& format) {
+    if (format == "mp3" || format == "m4a") return 64;
+    if (format == "opus" || format == "webm") return 32;
+    return 0;
+}
+
+int AudioEncoder::lame_quality(int complexity) {
+    // 0 and 1 are far slower for no audible gain on voice
+    return complexity < 0 ? 5 : std::max(2, 7 - std::min(10, complexity) / 2);
+}
+
+bool AudioEncoder::encode(const int16_t* pcm, size_t samples, int sample_rate,
+                          const std::string& format, int bitrate_kbps,
+                          std::vector<uint8_t>& out, int complexity) {
+    out.clear();
+    if (bitrate_kbps == 0) {
+        bitrate_kbps = default_bitrate(format);
+    }
+
+#ifdef HAVE_LIBOPUS
+    if (format == "opus") {
+        return encode_opus(pcm, samples, sample_rate, bitrate_kbps, complexity, out);
+    }
+#endif
+#ifdef HAVE_LIBMP3LAME
+    if (format == "mp3") {
+        return encode_mp3(pcm, samples, sample_rate, bitrate_kbps, complexity, out);
+    }
+#endif
+    (void)complexity;
+    if (format == "flac") {
+        return encode_flac(pcm, samples, sample_rate, out);
+    }
+    return false;
+}
+
+bool AudioEncoder::encode_file(const int16_t* pcm, size_t samples, int sample_rate,
+                               const std::string& format, int bitrate_kbps,
+                               const std::string& output_file) {
+    if (!has_backend(format)) {
+        return false;
+    }
+
+    std::vector<uint8_t> encoded;
+    if (!encode(pcm, samples, sample_rate, format, bitrate_kbps, encoded)) {
+        return false;
+    }
+
+    std::ofstream file(output_file, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not create audio output file: " << output_file << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+    return file.good();
+}
+
+bool AudioEncoder::convert_with_ffmpeg(const std::string& wav_file, const std::string& output_file,
+                                       const std::string& format, int bitrate,
+                                       std::chrono::milliseconds timeout, int complexity) {
+    // Determine bitrate - use configured value or format defaults
+    if (bitrate == 0) { // Auto-select based on format
+        bitrate = default_bitrate(format);
+    }
+    
+    // Mono forced; the sample rate is kept from the WAV, which is already
+    // at the decoder's output rate. Run without a shell, so file names
+    // reach ffmpeg exactly as given.
+    std::vector<std::string> argv = {"ffmpeg", "-nostdin", "-i", wav_file, "-ac", "1"};
+    std::string bitrate_str = std::to_string(bitrate) + "k";
+    
+    if (format == "mp3") {
+        // MP3 - legacy compatibility, good browser support
+        argv.insert(argv.end(), {"-c:a", "libmp3lame", "-b:a", bitrate_str});
+        if (complexity >= 0) {
+            argv.insert(argv.end(), {"-compression_level", std::to_string(lame_quality(complexity))});
+        }
+    } else if (format == "m4a") {
+        // AAC in M4A container - web optimized, good quality/size balance
+        argv.insert(argv.end(), {"-c:a", "aac", "-b:a", bitrate_str, "-movflags", "+faststart"});
+    } else if (format == "opus" || format == "webm") {
+        // Opus codec - best compression for voice; WebM is the native web container for it
+        argv.insert(argv.end(), {"-c:a", "libopus", "-b:a", bitrate_str});
+        if (complexity >= 0) {
+            argv.insert(argv.end(), {"-compression_level", std::to_string(std::min(10, complexity))});
+        }
+    } else {
+        return false;
+    }
+    argv.push_back(output_file);
+    
+    ChildProcess::Result result = ChildProcess::run(argv, timeout, true);
+    if (result.timed_out) {
+        std::remove(output_file.c_str());
+        std::cerr << "Error: ffmpeg timed out after " << result.elapsed.count() << "ms converting " << wav_file << std::endl;
+    } else if (!result.started) {
+        std::cerr << "Error: Could not start ffmpeg: " << std::strerror(result.spawn_error) << std::endl;
+    }
+    return result.ok();
+}
+
+bool AudioEncoder::encode_flac(const int16_t* pcm, size_t samples, int sample_rate, std::vector<uint8_t>& out) {
+    if (sample_rate <= 0 || sample_rate > 655350) {
+        return false;
+    }
+    const uint32_t rate_code = flac_rate_code(sample_rate);
+    out.reserve(samples + 64);
+    const uint8_t marker[4] = {'f', 'L', 'a', 'C'};
+    out.insert(out.end(), marker, marker + 4);
+
+    // STREAMINFO, the only metadata block; frame sizes and MD5 left unknown (0)
+    BitWriter header(out);
+    header.put(0x80, 8);    // last block, type 0
+    header.put(34, 24);
+    size_t block_size = std::min(FLAC_BLOCK_SIZE, std::max<size_t>(samples, 16));
+    header.put(static_cast<uint32_t>(block_size), 16);
+    header.put(static_cast<uint32_t>(block_size), 16);
+    header.put(0, 24);
+    header.put(0, 24);
+    header.put(static_cast<uint32_t>(sample_rate), 20);
+    header.put(0, 3);       // mono
+    header.put(15, 5);      // 16 bits per sample
+    header.put(static_cast<uint32_t>(static_cast<uint64_t>(samples) >> 32) & 0xf, 4);
+    header.put(static_cast<uint32_t>(samples), 32);
+    for (int i = 0; i < 4; i++) {
+        header.put(0, 32);
+    }
+
+    std::vector<int32_t> block(FLAC_BLOCK_SIZE);
+    uint32_t frame_number = 0;
+    for (size_t pos = 0; pos < samples; pos += FLAC_BLOCK_SIZE, frame_number++) {
+        size_t n = std::min(FLAC_BLOCK_SIZE, samples - pos);
+        std::copy(pcm + pos, pcm + pos + n, block.begin());
+
+        size_t frame_start = out.size();
+        BitWriter bits(out);
+        bits.put(0x3ffe, 14);   // sync
+        bits.put(0, 1);
+        bits.put(0, 1);         // fixed block size
+        bits.put(n == FLAC_BLOCK_SIZE ? 12 : 7, 4);
+        bits.put(rate_code, 4);
+        bits.put(0, 4);         // one channel
+        bits.put(4, 3);         // 16 bits per sample
+        bits.put(0, 1);
+        put_utf8_number(bits, frame_number);
+        if (n != FLAC_BLOCK_SIZE) {
+            bits.put(static_cast<uint32_t>(n - 1), 16);
+        }
+        out.push_back(flac_crc8(&out[frame_start], out.size() - frame_start));
+
+        write_flac_subframe(bits, block.data(), n);
+        bits.align();
+        uint16_t crc = flac_crc16(&out[frame_start], out.size() - frame_start);
+        out.push_back(static_cast<uint8_t>(crc >> 8));
+        out.push_back(static_cast<uint8_t>(crc));
+    }
+    return true;
+}
+
+#ifdef HAVE_LIBOPUS
+bool AudioEncoder::encode_opus(const int16_t* pcm, size_t samples, int sample_rate,
+                               int bitrate_kbps, int complexity, std::vector<uint8_t>& out) {
+    int error = 0;
+    OpusEncoder* encoder = opus_encoder_create(sample_rate, 1, OPUS_APPLICATION_VOIP, &error);
+    if (error != OPUS_OK || !encoder) {
+        std::cerr << "Error: opus_encoder_create failed: " << opus_strerror(error) << std::endl;
+        return false;
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate_kbps * 1000));
+    opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    if (complexity >= 0) {
+        opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(std::min(10, complexity)));
+    }
+
+    opus_int32 lookahead = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+
+    // Ogg Opus granule positions are always in 48 kHz units
+    const int granule_scale = 48000 / sample_rate;
+    const int frame_size = sample_rate / 50; // 20 ms
+    const uint16_t pre_skip = static_cast<uint16_t>(lookahead * granule_scale);
+
+    OggWriter ogg(out, 0x50323544); // "P25D"
+
+    // Identification header
+    std::vector<uint8_t> head = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 1};
+    append_le(head, pre_skip, 2);
+    append_le(head, static_cast<uint32_t>(sample_rate), 4);
+    append_le(head, 0, 2);  // output gain
+    head.push_back(0);      // mapping family
+    ogg.write_page({head}, 0, 0x02);
+
+    // Comment header
+    const char* vendor = opus_get_version_string();
+    std::vector<uint8_t> tags = {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+    append_le(tags, static_cast<uint32_t>(strlen(vendor)), 4);
+    tags.insert(tags.end(), vendor, vendor + strlen(vendor));
+    append_le(tags, 0, 4);  // no user comments
+    ogg.write_page({tags}, 0, 0x00);
+
+    // Audio pages: group about one second of packets per page
+    const size_t packets_per_page = 50;
+    std::vector<std::vector<uint8_t>> page;
+    size_t page_segments = 0;
+    std::vector<int16_t> frame(frame_size, 0);
+    uint8_t packet[1275];
+    uint64_t granule = pre_skip;
+    size_t pos = 0;
+    bool ok = true;
+
+    do {
+        size_t take = std::min<size_t>(frame_size, samples - pos);
+        std::fill(frame.begin(), frame.end(), 0);
+        if (take > 0) {
+            std::memcpy(frame.data(), pcm + pos, take * sizeof(int16_t));
+        }
+        pos += take;
+
+        opus_int32 bytes = opus_encode(encoder, frame.data(), frame_size, packet, sizeof(packet));
+        if (bytes < 0) {
+            std::cerr << "Error: opus_encode failed: " << opus_strerror(bytes) << std::endl;
+            ok = false;
+            break;
+        }
+        // A page holds at most 255 lacing values
+        size_t segments = static_cast<size_t>(bytes) / 255 + 1;
+        if (!page.empty() && page_segments + segments > 255) {
+            ogg.write_page(page, granule, 0x00);
+            page.clear();
+            page_segments = 0;
+        }
+        page.emplace_back(packet, packet + bytes);
+        page_segments += segments;
+
+        bool last = pos >= samples;
+        // The final granule marks the real end of audio so players trim the padding
+        granule = last ? pre_skip + static_cast<uint64_t>(samples) * granule_scale
+                       : granule + static_cast<uint64_t>(frame_size) * granule_scale;
+        if (last || page.size() >= packets_per_page) {
+            ogg.write_page(page, granule, last ? 0x04 : 0x00);
+            page.clear();
+            page_segments = 0;
+        }
+    } while (pos < samples);
+
+    opus_encoder_destroy(encoder);
+    return ok;
+}
+#endif // HAVE_LIBOPUS
+
+#ifdef HAVE_LIBMP3LAME
+bool AudioEncoder::encode_mp3(const int16_t* pcm, size_t samples, int sample_rate,
+                              int bitrate_kbps, int complexity, std::vector<uint8_t>& out) {
+    lame_global_flags* gf = lame_init();
+    if (!gf) {
+        return false;
+    }
+    lame_set_in_samplerate(gf, sample_rate);
+    lame_set_out_samplerate(gf, sample_rate);
+    lame_set_num_channels(gf, 1);
+    lame_set_mode(gf, MONO);
+    lame_set_brate(gf, bitrate_kbps);
+    lame_set_quality(gf, lame_quality(complexity));
+    if (lame_init_params(gf) < 0) {
+        lame_close(gf);
+        return false;
+    }
+
+    // Worst case buffer size recommended by the LAME API docs
+    const size_t chunk = 8192;
+    std::vector<unsigned char> buffer(chunk * 5 / 4 + 7200);
+    bool ok = true;
+
+    for (size_t pos = 0; pos < samples; pos += chunk) {
+        int n = static_cast<int>(std::min(chunk, samples - pos));
+        short* in = const_cast<short*>(reinterpret_cast<const short*>(pcm + pos));
+        int bytes = lame_encode_buffer(gf, in, in, n, buffer.data(), static_cast<int>(buffer.size()));
+        if (bytes < 0) {
+            ok = false;
+            break;
+        }
+        out.insert(out.end(), buffer.begin(), buffer.begin() + bytes);
+    }
+
+    if (ok) {
+        int bytes = lame_encode_flush(gf, buffer.data(), static_cast<int>(buffer.size()));
+        if (bytes > 0) {
+            out.insert(out.end(), buffer.begin(), buffer.begin() + bytes);
+        }
+    }
+
+    lame_close(gf);
+    return ok;
+}
+#endif // HAVE_LIBMP3LAME
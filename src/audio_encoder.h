@@ -0,0 +1,75 @@
+/*
+ * In-process audio encoder
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Encodes decoded 16-bit mono PCM straight to compressed formats using
+ * linked codec libraries, avoiding a WAV round-trip and an ffmpeg
+ * fork/exec per call. FLAC is always built in, written natively; the
+ * other backends are compiled in when available:
+ *   HAVE_LIBOPUS     - opus (Ogg Opus container, written in-process)
+ *   HAVE_LIBMP3LAME  - mp3
+ * Formats without a linked backend (m4a, webm) report unsupported so the
+ * caller can fall back to ffmpeg.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef AUDIO_ENCODER_H
+#define AUDIO_ENCODER_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class AudioEncoder {
+public:
+    // True if this build can encode format without spawning ffmpeg
+    static bool has_backend(const std::string& format);
+
+    // Default bitrate (kbps) for a format, matching the ffmpeg path
+    static int default_bitrate(const std::string& format);
+
+    // Encode PCM to output_file. bitrate_kbps == 0 selects the default.
+    // Returns false if the format has no backend or encoding failed.
+    static bool encode_file(const int16_t* pcm, size_t samples, int sample_rate,
+                            const std::string& format, int bitrate_kbps,
+                            const std::string& output_file);
+
+    // Encode PCM to an in-memory buffer in the same container as encode_file.
+    // complexity runs 0 (fastest) to 10 for opus and mp3; -1 keeps the
+    // encoder's default.
+    static bool encode(const int16_t* pcm, size_t samples, int sample_rate,
+                       const std::string& format, int bitrate_kbps,
+                       std::vector<uint8_t>& out, int complexity = -1);
+
+    // Convert a WAV file with an ffmpeg subprocess; covers formats without
+    // a linked backend. bitrate_kbps == 0 selects the default. An ffmpeg
+    // still running after timeout (if > 0) is killed and counts as a failure.
+    // complexity is as for encode(); aac ignores it.
+    static bool convert_with_ffmpeg(const std::string& wav_file, const std::string& output_file,
+                                    const std::string& format, int bitrate_kbps,
+                                    std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+                                    int complexity = -1);
+
+private:
+    // Lossless; bitrate does not apply
+    static bool encode_flac(const int16_t* pcm, size_t samples, int sample_rate, std::vector<uint8_t>& out);
+#ifdef HAVE_LIBOPUS
+    static bool encode_opus(const int16_t* pcm, size_t samples, int sample_rate,
+                            int bitrate_kbps, int complexity, std::vector<uint8_t>& out);
+#endif
+#ifdef HAVE_LIBMP3LAME
+    static bool encode_mp3(const int16_t* pcm, size_t samples, int sample_rate,
+                           int bitrate_kbps, int complexity, std::vector<uint8_t>& out);
+#endif
+    // LAME quality (0 best, 9 fastest) for a complexity; 5 by default
+    static int lame_quality(int complexity);
+};
+
+#endif // AUDIO_ENCODER_H
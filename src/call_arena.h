@@ -0,0 +1,162 @@
+/*
+ * Per-call memory for the job pipeline
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * A CallContext goes with a job from decode until it finishes. Buffers
+ * that only live for one call, the decoded PCM on its way to the encode
+ * stage in particular, come from its monotonic arena: allocation is a
+ * pointer bump, freeing is a no-op, and the whole arena is dropped at once
+ * when the job finishes. On reset the arena's first block grows to the
+ * largest call it has held, so once a context has seen a typical call the
+ * next ones take nothing from the heap. The decoders' own scratch already
+ * persists across calls in DecoderPool.
+ *
+ * Contexts are pooled. Only one stage works on a job at a time, so a
+ * context is never used from two threads at once and needs no lock.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+class CallArena {
+public:
+    static constexpr size_t DEFAULT_BYTES = 256 * 1024;
+    // A rare hour-long call should not leave every context holding its size
+    static constexpr size_t MAX_BLOCK_BYTES = 16 * 1024 * 1024;
+
+    explicit CallArena(size_t initial_bytes = DEFAULT_BYTES)
+        : size_(initial_bytes), block_(new std::byte[size_]), upstream_(std::pmr::new_delete_resource()),
+          resource_(block_.get(), size_, &upstream_) {}
+
+    CallArena(const CallArena&) = delete;
+    CallArena& operator=(const CallArena&) = delete;
+
+    std::pmr::memory_resource* resource() { return &resource_; }
+
+    // Free everything at once; nothing allocated from the arena may be used after
+    void reset() {
+        resource_.release();
+        size_t needed = size_ + upstream_.take_allocated();
+        needed = std::min(needed, MAX_BLOCK_BYTES);
+        if (needed <= size_) {
+            return;
+        }
+        // The call overflowed the block: start the next one with a block that
+        // holds it, with room to spare. monotonic_buffer_resource cannot be
+        // handed a new buffer, so it is rebuilt in place; allocators that
+        // point at it stay valid.
+        size_ = std::min(MAX_BLOCK_BYTES, std::max(needed, size_ + size_ / 2));
+        block_.reset(new std::byte[size_]);
+        resource_.~monotonic_buffer_resource();
+        new (&resource_) std::pmr::monotonic_buffer_resource(block_.get(), size_, &upstream_);
+    }
+
+    size_t block_size() const { return size_; }
+
+private:
+    // Notes how much overflowed the block, so reset() can size the next one
+    class Upstream : public std::pmr::memory_resource {
+    public:
+        explicit Upstream(std::pmr::memory_resource* parent) : parent_(parent), allocated_(0) {}
+
+        size_t take_allocated() {
+            size_t allocated = allocated_;
+            allocated_ = 0;
+            return allocated;
+        }
+
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            allocated_ += bytes;
+            return parent_->allocate(bytes, alignment);
+        }
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+            parent_->deallocate(p, bytes, alignment);
+        }
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+        std::pmr::memory_resource* parent_;
+        size_t allocated_;
+    };
+
+    size_t size_;
+    std::unique_ptr<std::byte[]> block_;
+    Upstream upstream_;
+    std::pmr::monotonic_buffer_resource resource_;
+};
+
+struct CallContext {
+    CallArena arena;
+    std::pmr::vector<int16_t> pcm;     // decoded audio from decode to encode
+
+    CallContext() : pcm(arena.resource()) {}
+
+    void reset() {
+        std::pmr::vector<int16_t>(arena.resource()).swap(pcm);
+        arena.reset();
+    }
+};
+
+// Hands out reset contexts; each one comes back when the last shared_ptr
+// to it goes, or is deleted if the pool has gone first
+class CallContextPool : public std::enable_shared_from_this<CallContextPool> {
+public:
+    static std::shared_ptr<CallContextPool> create(size_t max_idle) {
+        return std::shared_ptr<CallContextPool>(new CallContextPool(max_idle));
+    }
+
+    std::shared_ptr<CallContext> acquire() {
+        CallContext* context = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                context = free_.back().release();
+                free_.pop_back();
+            }
+        }
+        if (!context) {
+            context = new CallContext();
+        }
+        std::weak_ptr<CallContextPool> pool = shared_from_this();
+        return std::shared_ptr<CallContext>(context, [pool](CallContext* done) {
+            if (auto owner = pool.lock()) {
+                owner->release(done);
+            } else {
+                delete done;
+            }
+        });
+    }
+
+    size_t idle() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+private:
+    explicit CallContextPool(size_t max_idle) : max_idle_(max_idle) {}
+
+    void release(CallContext* context) {
+        context->reset();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < max_idle_) {
+            free_.emplace_back(context);
+        } else {
+            delete context;
+        }
+    }
+
+    std::mutex mutex_;
+    size_t max_idle_;
+    std::vector<std::unique_ptr<CallContext>> free_;
+};
@@ -0,0 +1,154 @@
+#include "call_dedupe.h"
+#include "p25_frame_parser.h"
+#include "op25_imbe_frame.h"
+#include <algorithm>
+#include <cmath>
+
+// Codewords that failed to decode count as this many corrections
+static const double LOST_CODEWORD_ERRORS = 12.0;
+
+// Fewer comparable codewords than this is not evidence either way
+static const int MIN_COMPARED = 9;
+
+// Distinct codewords among the agreeing ones, so the silence pattern every
+// call opens with cannot match two different calls on its own
+static const int MIN_DISTINCT = 4;
+
+static bool fingerprint_frames(P25FrameParser& parser, int ldus, CallFingerprint& out) {
+    out.codewords.clear();
+    double errors = 0.0;
+    P25Frame frame;
+    for (int seen = 0; seen < ldus && parser.read_frame(frame);) {
+        if (!p25_duid_is_voice(frame.duid)) {
+            continue;
+        }
+        seen++;
+        imbe_ldu_params params;
+        if (!imbe_ldu_decode_packed(frame.payload(), frame.payload_size(), params)) {
+            out.codewords.insert(out.codewords.end(), nof_voice_codewords, CallFingerprint::UNKNOWN);
+            errors += LOST_CODEWORD_ERRORS * nof_voice_codewords;
+            continue;
+        }
+        for (size_t i = 0; i < nof_voice_codewords; i++) {
+            const uint32_t* u = params.u[i];
+            uint64_t bits = (static_cast<uint64_t>(u[0]) << 36) | (static_cast<uint64_t>(u[1]) << 24) |
+                            (static_cast<uint64_t>(u[2]) << 12) | u[3];
+            out.codewords.push_back(params.ET[i] <= CallFingerprint::MAX_COMPARED_ERRORS ? bits : CallFingerprint::UNKNOWN);
+            errors += params.ET[i];
+        }
+    }
+    if (out.codewords.empty()) {
+        return false;
+    }
+    out.errors_per_codeword = errors / out.codewords.size();
+    return true;
+}
+
+bool CallFingerprint::compute(const std::string& p25_file, const TrunkCallMetadata& metadata, int ldus) {
+    talkgroup = metadata.talkgroup;
+    source_id = metadata.source_id;
+    start_time = metadata.start_time;
+    P25FrameParser parser;
+    if (!parser.open(p25_file)) {
+        return false;
+    }
+    return fingerprint_frames(parser, ldus, *this);
+}
+
+bool CallFingerprint::compute(const uint8_t* data, size_t size, const TrunkCallMetadata& metadata, int ldus) {
+    talkgroup = metadata.talkgroup;
+    source_id = metadata.source_id;
+    start_time = metadata.start_time;
+    P25FrameParser parser;
+    if (!parser.open_buffer(data, size)) {
+        return false;
+    }
+    return fingerprint_frames(parser, ldus, *this);
+}
+
+bool CallDeduplicator::same_transmission(const CallFingerprint& a, const CallFingerprint& b) const {
+    // Unknown fields do not rule a match out; the audio still has to agree
+    if (a.talkgroup && b.talkgroup && a.talkgroup != b.talkgroup) {
+        return false;
+    }
+    if (a.source_id > 0 && b.source_id > 0 && a.source_id != b.source_id) {
+        return false;
+    }
+    if (a.start_time > 0 && b.start_time > 0 && std::fabs(a.start_time - b.start_time) > policy_.window_s) {
+        return false;
+    }
+
+    const int step = static_cast<int>(nof_voice_codewords);
+    const int max_shift = std::max(0, policy_.max_shift_ldus) * step;
+    const int a_size = static_cast<int>(a.codewords.size());
+    const int b_size = static_cast<int>(b.codewords.size());
+    for (int shift = -max_shift; shift <= max_shift; shift += step) {
+        int compared = 0;
+        int agreed = 0;
+        int distinct = 0;
+        uint64_t previous = CallFingerprint::UNKNOWN;
+        for (int i = std::max(0, -shift); i < a_size && i + shift < b_size; i++) {
+            uint64_t x = a.codewords[i];
+            uint64_t y = b.codewords[i + shift];
+            if (x == CallFingerprint::UNKNOWN || y == CallFingerprint::UNKNOWN) {
+                continue;
+            }
+            compared++;
+            if (x == y) {
+                agreed++;
+                if (x != previous) {
+                    distinct++;
+                    previous = x;
+                }
+            }
+        }
+        if (compared >= MIN_COMPARED && distinct >= MIN_DISTINCT && agreed >= policy_.min_match * compared) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CallDeduplicator::expire_locked(Clock::time_point now) {
+    auto retain = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(policy_.retain_s));
+    while (!calls_.empty() && (now - calls_.front().seen_at > retain || calls_.size() > policy_.max_calls)) {
+        calls_.pop_front();
+    }
+}
+
+bool CallDeduplicator::check(const CallFingerprint& call, const std::string& job_id, Match& match) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clock::time_point now = Clock::now();
+    expire_locked(now);
+    // Newest first: a retransmission is most likely a copy of a recent call
+    for (auto it = calls_.rbegin(); it != calls_.rend(); ++it) {
+        if (same_transmission(call, it->call)) {
+            match.job_id = it->job_id;
+            match.better = call.errors_per_codeword < it->call.errors_per_codeword;
+            return true;
+        }
+    }
+    calls_.push_back(Seen{call, job_id, now});
+    expire_locked(now);
+    return false;
+}
+
+void CallDeduplicator::update(const std::string& job_id, const CallFingerprint& call) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& seen : calls_) {
+        if (seen.job_id == job_id) {
+            seen.call = call;
+            return;
+        }
+    }
+}
+
+void CallDeduplicator::forget(const std::string& job_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = calls_.begin(); it != calls_.end(); ++it) {
+        if (it->job_id == job_id) {
+            calls_.erase(it);
+            return;
+        }
+    }
+}
@@ -0,0 +1,174 @@
+/*
+ * Simulcast duplicate-call detection
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * The same transmission is often recorded at several sites, and every copy
+ * is uploaded. Before a call is queued its first few voice LDUs are run
+ * through FEC only (no synthesis) and the information bits of each IMBE
+ * codeword are kept as a fingerprint, together with the talkgroup, source
+ * and start time from the call metadata. Copies of one transmission carry
+ * the same codewords wherever they were received, so a new call whose
+ * codewords line up with a recent call's (allowing for one recorder having
+ * caught a few LDUs more at the start) is the same audio.
+ *
+ * The fingerprint also scores the copy by its FEC corrections per codeword,
+ * so the caller can keep whichever copy came through cleanest.
+ *
+ * RecentUploads catches the plainer case of one recorder sending the same
+ * upload again (a retry after a timeout): byte-identical bodies map to the
+ * job the first one created.
+ */
+
+#pragma once
+
+#include "call_json.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct DedupePolicy {
+    bool enabled = false;
+    int fingerprint_ldus = 8;      // voice LDUs fingerprinted from the start of each call
+    double window_s = 5.0;         // start times further apart are never the same transmission
+    double min_match = 0.6;        // share of comparable codewords that must agree
+    int max_shift_ldus = 2;        // LDUs one copy may have ahead of another
+    double retain_s = 120.0;       // how long a call can still absorb late copies
+    size_t max_calls = 4096;
+};
+
+struct CallFingerprint {
+    // Codewords whose FEC corrected more than this are left out of matching
+    static constexpr uint32_t MAX_COMPARED_ERRORS = 3;
+    static constexpr uint64_t UNKNOWN = ~0ull;
+
+    long talkgroup = 0;            // 0 when unknown
+    long source_id = 0;
+    double start_time = 0.0;       // call start, seconds since the epoch; 0 when unknown
+    std::vector<uint64_t> codewords;  // u0..u3 of each codeword (48 bits), UNKNOWN when unreliable
+    double errors_per_codeword = 0.0; // lower is a cleaner copy
+
+    // Fingerprint a .p25 file, or the same bytes in memory; false if it has no voice
+    bool compute(const std::string& p25_file, const TrunkCallMetadata& metadata, int ldus);
+    bool compute(const uint8_t* data, size_t size, const TrunkCallMetadata& metadata, int ldus);
+};
+
+class CallDeduplicator {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Match {
+        std::string job_id;        // the call this one duplicates
+        bool better = false;       // this copy has fewer FEC errors than the kept one
+    };
+
+    void set_policy(const DedupePolicy& policy) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        policy_ = policy;
+    }
+    DedupePolicy policy() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return policy_;
+    }
+
+    // Whether call duplicates one seen recently; if not it is remembered
+    // under job_id, in the same step, so two copies arriving together do
+    // not both pass
+    bool check(const CallFingerprint& call, const std::string& job_id, Match& match);
+
+    // The copy kept for job_id is now call (after a better one replaced it)
+    void update(const std::string& job_id, const CallFingerprint& call);
+
+    // job_id never made it into the queue
+    void forget(const std::string& job_id);
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return calls_.size();
+    }
+
+private:
+    struct Seen {
+        CallFingerprint call;
+        std::string job_id;
+        Clock::time_point seen_at;
+    };
+
+    bool same_transmission(const CallFingerprint& a, const CallFingerprint& b) const;
+    void expire_locked(Clock::time_point now);
+
+    std::mutex mutex_;
+    DedupePolicy policy_;
+    std::deque<Seen> calls_;       // oldest first
+};
+
+// Content hash -> job for recent uploads, oldest dropped first
+class RecentUploads {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 8192;
+
+    explicit RecentUploads(size_t capacity = DEFAULT_CAPACITY) : capacity_(capacity), sequence_(0) {}
+
+    // The job an upload with this hash already went to, or, if none, remember
+    // it under job_id and return ""
+    std::string find_or_add(uint64_t hash, const std::string& job_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = jobs_.find(hash);
+        if (it != jobs_.end()) {
+            return it->second.job_id;
+        }
+        add_locked(hash, job_id);
+        return "";
+    }
+
+    // Point hash at job_id from now on
+    void set(uint64_t hash, const std::string& job_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = jobs_.find(hash);
+        if (it != jobs_.end()) {
+            it->second.job_id = job_id;
+        } else {
+            add_locked(hash, job_id);
+        }
+    }
+
+    void forget(uint64_t hash) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.erase(hash);  // its place in order_ is skipped when it comes up
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return jobs_.size();
+    }
+
+private:
+    struct Upload {
+        std::string job_id;
+        uint64_t sequence;         // tells a live entry from a forgotten one in order_
+    };
+
+    void add_locked(uint64_t hash, const std::string& job_id) {
+        jobs_[hash] = Upload{job_id, ++sequence_};
+        order_.emplace_back(hash, sequence_);
+        while (jobs_.size() > capacity_ || order_.size() > 2 * capacity_) {
+            auto it = jobs_.find(order_.front().first);
+            if (it != jobs_.end() && it->second.sequence == order_.front().second) {
+                jobs_.erase(it);
+            }
+            order_.pop_front();
+        }
+    }
+
+    std::mutex mutex_;
+    size_t capacity_;
+    uint64_t sequence_;
+    std::unordered_map<uint64_t, Upload> jobs_;
+    std::deque<std::pair<uint64_t, uint64_t>> order_;   // (hash, sequence), oldest first
+};
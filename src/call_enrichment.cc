@@ -0,0 +1,470 @@
+#include "call_enrichment.h"
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <unordered_map>
+#include <cctype>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// A whole file mapped read-only for parsing; unmapped when it goes
+class MappedFile {
+public:
+    ~MappedFile() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    bool open(const std::string& path, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = "cannot open " + path;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            error = path + " is not a regular file";
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) {
+            ::close(fd);
+            return true;
+        }
+        void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            size_ = 0;
+            error = "cannot map " + path;
+            return false;
+        }
+        madvise(addr, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(addr);
+        return true;
+    }
+
+    std::string_view text() const { return std::string_view(data_ ? data_ : "", size_); }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// One CSV record per call, quoted fields ("" for a quote) included. Fields
+// point into the mapping unless they were quoted with escapes, in which
+// case they are unescaped into scratch, valid until the next record.
+class CsvReader {
+public:
+    explicit CsvReader(std::string_view text) : text_(text), pos_(0) {
+        if (text_.substr(0, 3) == "\xef\xbb\xbf") {
+            pos_ = 3;   // UTF-8 byte order mark, as spreadsheet exports write
+        }
+    }
+
+    bool next(std::vector<std::string_view>& fields) {
+        fields.clear();
+        scratch_.clear();
+        if (pos_ >= text_.size()) {
+            return false;
+        }
+        while (true) {
+            fields.push_back(field());
+            if (pos_ >= text_.size()) {
+                break;
+            }
+            char c = text_[pos_++];
+            if (c == '\n') {
+                break;
+            }
+            if (c == '\r') {
+                if (pos_ < text_.size() && text_[pos_] == '\n') {
+                    pos_++;
+                }
+                break;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::string_view field() {
+        if (pos_ < text_.size() && text_[pos_] == '"') {
+            size_t start = ++pos_;
+            bool escaped = false;
+            while (pos_ < text_.size()) {
+                if (text_[pos_] == '"') {
+                    if (pos_ + 1 < text_.size() && text_[pos_ + 1] == '"') {
+                        escaped = true;
+                        pos_ += 2;
+                        continue;
+                    }
+                    break;
+                }
+                pos_++;
+            }
+            std::string_view quoted = text_.substr(start, pos_ - start);
+            if (pos_ < text_.size()) {
+                pos_++;   // closing quote
+            }
+            while (pos_ < text_.size() && text_[pos_] != ',' && text_[pos_] != '\n' && text_[pos_] != '\r') {
+                pos_++;   // anything after the quote up to the separator is dropped
+            }
+            if (!escaped) {
+                return quoted;
+            }
+            std::string& unescaped = scratch_.emplace_back();
+            for (size_t i = 0; i < quoted.size(); i++) {
+                unescaped += quoted[i];
+                if (quoted[i] == '"') {
+                    i++;
+                }
+            }
+            return unescaped;
+        }
+        size_t start = pos_;
+        while (pos_ < text_.size() && text_[pos_] != ',' && text_[pos_] != '\n' && text_[pos_] != '\r') {
+            pos_++;
+        }
+        return trim(text_.substr(start, pos_ - start));
+    }
+
+    static std::string_view trim(std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+            s.remove_prefix(1);
+        }
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+            s.remove_suffix(1);
+        }
+        return s;
+    }
+
+    std::string_view text_;
+    size_t pos_;
+    std::deque<std::string> scratch_;   // deque, so earlier fields' views survive
+};
+
+bool parse_id(std::string_view field, uint32_t& id) {
+    if (field.empty() || field.size() > 10) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (char c : field) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+    if (value > UINT32_MAX) {
+        return false;
+    }
+    id = static_cast<uint32_t>(value);
+    return true;
+}
+
+std::string lower(std::string_view s) {
+    std::string out;
+    for (char c : s) {
+        if (c != ' ' && c != '_') {
+            out += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+    }
+    return out;
+}
+
+std::string_view column(const std::vector<std::string_view>& fields, int index) {
+    return (index >= 0 && static_cast<size_t>(index) < fields.size()) ? fields[index] : std::string_view();
+}
+
+// Later rows replace earlier ones with the same ID
+template <typename T>
+void add_entry(std::vector<uint32_t>& ids, std::vector<T>& entries, std::unordered_map<uint32_t, size_t>& seen,
+               uint32_t id, const T& entry) {
+    auto found = seen.find(id);
+    if (found != seen.end()) {
+        entries[found->second] = entry;
+        return;
+    }
+    seen.emplace(id, ids.size());
+    ids.push_back(id);
+    entries.push_back(entry);
+}
+
+} // namespace
+
+EnrichmentTable::Text EnrichmentTable::store(std::string_view text) {
+    Text stored{static_cast<uint32_t>(strings_.size()), static_cast<uint32_t>(text.size())};
+    strings_.append(text.data(), text.size());
+    return stored;
+}
+
+bool EnrichmentTable::load_talkgroups(const std::string& path, std::string& error) {
+    MappedFile file;
+    if (!file.open(path, error)) {
+        return false;
+    }
+    // trunk-recorder's column order, unless a header row says otherwise
+    int id_col = 0, alpha_col = 2, description_col = 4, tag_col = 5, group_col = 6, priority_col = 7;
+    CsvReader reader(file.text());
+    std::vector<std::string_view> fields;
+    std::unordered_map<uint32_t, size_t> seen;
+    bool first = true;
+    while (reader.next(fields)) {
+        uint32_t id;
+        if (!parse_id(column(fields, id_col), id)) {
+            if (first) {
+                for (int i = 0; i < static_cast<int>(fields.size()); i++) {
+                    std::string name = lower(fields[i]);
+                    if (name == "decimal" || name == "dec" || name == "talkgroup" || name == "tgid") id_col = i;
+                    else if (name == "alphatag" || name == "alpha") alpha_col = i;
+                    else if (name == "description") description_col = i;
+                    else if (name == "tag") tag_col = i;
+                    else if (name == "category" || name == "group") group_col = i;
+                    else if (name == "priority") priority_col = i;
+                }
+            }
+            first = false;
+            continue;   // header, blank or malformed line
+        }
+        first = false;
+        TalkgroupText entry;
+        entry.alpha_tag = store(column(fields, alpha_col));
+        entry.description = store(column(fields, description_col));
+        entry.tag = store(column(fields, tag_col));
+        entry.group = store(column(fields, group_col));
+        entry.priority = std::atoi(std::string(column(fields, priority_col)).c_str());
+        add_entry(talkgroup_ids_, talkgroup_text_, seen, id, entry);
+    }
+    return true;
+}
+
+bool EnrichmentTable::load_units(const std::string& path, std::string& error) {
+    MappedFile file;
+    if (!file.open(path, error)) {
+        return false;
+    }
+    CsvReader reader(file.text());
+    std::vector<std::string_view> fields;
+    std::unordered_map<uint32_t, size_t> seen;
+    while (reader.next(fields)) {
+        uint32_t id;
+        if (!parse_id(column(fields, 0), id)) {
+            continue;   // header, blank or malformed line
+        }
+        add_entry(unit_ids_, unit_text_, seen, id, store(column(fields, 1)));
+    }
+    return true;
+}
+
+// strings_ is complete; turn offsets into views and index the IDs
+void EnrichmentTable::finish() {
+    strings_.shrink_to_fit();
+    auto view = [this](const Text& text) { return std::string_view(strings_.data() + text.offset, text.length); };
+    talkgroups_.reserve(talkgroup_text_.size());
+    for (const auto& text : talkgroup_text_) {
+        talkgroups_.push_back(Talkgroup{view(text.alpha_tag), view(text.description), view(text.tag),
+                                        view(text.group), text.priority});
+    }
+    unit_aliases_.reserve(unit_text_.size());
+    for (const auto& text : unit_text_) {
+        unit_aliases_.push_back(view(text));
+    }
+    talkgroup_index_.build(talkgroup_ids_);
+    unit_index_.build(unit_ids_);
+    talkgroup_text_ = std::vector<TalkgroupText>();
+    unit_text_ = std::vector<Text>();
+}
+
+std::shared_ptr<const EnrichmentTable> EnrichmentTable::load(const CallEnrichmentConfig& config, std::string& error) {
+    std::shared_ptr<EnrichmentTable> table(new EnrichmentTable());
+    if (!config.talkgroups_file.empty() && !table->load_talkgroups(config.talkgroups_file, error)) {
+        return nullptr;
+    }
+    if (!config.units_file.empty() && !table->load_units(config.units_file, error)) {
+        return nullptr;
+    }
+    table->finish();
+    return table;
+}
+
+const EnrichmentTable::Talkgroup* EnrichmentTable::talkgroup(long id) const {
+    if (id <= 0 || id > static_cast<long>(UINT32_MAX)) {
+        return nullptr;
+    }
+    int32_t index = talkgroup_index_.lookup(static_cast<uint32_t>(id));
+    return index == PerfectHashIndex::NOT_FOUND ? nullptr : &talkgroups_[index];
+}
+
+std::string_view EnrichmentTable::unit_alias(long id) const {
+    if (id <= 0 || id > static_cast<long>(UINT32_MAX)) {
+        return std::string_view();
+    }
+    int32_t index = unit_index_.lookup(static_cast<uint32_t>(id));
+    return index == PerfectHashIndex::NOT_FOUND ? std::string_view() : unit_aliases_[index];
+}
+
+CallEnrichment::CallEnrichment(const CallEnrichmentConfig& config)
+    : config_(config), talkgroup_hits_(0), talkgroup_misses_(0), unit_hits_(0), unit_misses_(0),
+      reloads_(0), reload_failures_(0), watching_(false) {
+    std::string error;
+    if (!reload(error)) {
+        std::cerr << "[CallEnrichment] " << error << std::endl;
+        std::atomic_store(&table_, EnrichmentTable::load(CallEnrichmentConfig(), error));
+    }
+}
+
+CallEnrichment::~CallEnrichment() {
+    stop_watching();
+}
+
+bool CallEnrichment::reload(std::string& error) {
+    std::lock_guard<std::mutex> lock(reload_mutex_);
+    std::shared_ptr<const EnrichmentTable> table = EnrichmentTable::load(config_, error);
+    if (!table) {
+        reload_failures_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    std::atomic_store(&table_, table);
+    reloads_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+namespace {
+
+void set_if_missing(json& call_json, const char* key, std::string_view value) {
+    if (value.empty()) {
+        return;
+    }
+    auto found = call_json.find(key);
+    if (found == call_json.end() || (found->is_string() && found->get_ref<const std::string&>().empty())) {
+        call_json[key] = std::string(value);
+    }
+}
+
+} // namespace
+
+void CallEnrichment::enrich(Call_Data_t& call, long source_id) const {
+    std::shared_ptr<const EnrichmentTable> table = snapshot();
+    const bool has_json = call.call_json.is_object();
+
+    if (const EnrichmentTable::Talkgroup* talkgroup = table->talkgroup(call.talkgroup)) {
+        talkgroup_hits_.fetch_add(1, std::memory_order_relaxed);
+        call.talkgroup_alpha_tag.assign(talkgroup->alpha_tag);
+        call.talkgroup_description.assign(talkgroup->description);
+        call.talkgroup_tag.assign(talkgroup->tag);
+        call.talkgroup_group.assign(talkgroup->group);
+        if (has_json) {
+            set_if_missing(call.call_json, "talkgroup_tag", talkgroup->alpha_tag);
+            set_if_missing(call.call_json, "talkgroup_description", talkgroup->description);
+            set_if_missing(call.call_json, "talkgroup_group_tag", talkgroup->tag);
+            set_if_missing(call.call_json, "talkgroup_group", talkgroup->group);
+        }
+    } else if (table->talkgroups()) {
+        talkgroup_misses_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (!table->units()) {
+        return;
+    }
+    std::string_view alias = table->unit_alias(call.source_id ? call.source_id : source_id);
+    if (!alias.empty()) {
+        unit_hits_.fetch_add(1, std::memory_order_relaxed);
+        call.source_alias.assign(alias);
+    } else {
+        unit_misses_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (has_json) {
+        auto src_list = call.call_json.find("srcList");
+        if (src_list != call.call_json.end() && src_list->is_array()) {
+            for (auto& src : *src_list) {
+                auto unit = src.find("src");
+                if (src.is_object() && unit != src.end() && unit->is_number()) {
+                    set_if_missing(src, "tag", table->unit_alias(unit->get<long>()));
+                }
+            }
+        }
+    }
+}
+
+void CallEnrichment::watch(bool verbose) {
+    stop_watching();
+    if (config_.reload_interval_s <= 0 || !config_.enabled()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        watching_ = true;
+    }
+    watcher_ = std::thread(&CallEnrichment::watch_loop, this, verbose);
+}
+
+void CallEnrichment::stop_watching() {
+    {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        watching_ = false;
+    }
+    watch_cv_.notify_all();
+    if (watcher_.joinable()) {
+        watcher_.join();
+    }
+}
+
+void CallEnrichment::watch_loop(bool verbose) {
+    std::error_code ec;
+    auto modified = [&ec](const std::string& path) {
+        return path.empty() ? fs::file_time_type() : fs::last_write_time(path, ec);
+    };
+    fs::file_time_type talkgroups_seen = modified(config_.talkgroups_file);
+    fs::file_time_type units_seen = modified(config_.units_file);
+
+    std::unique_lock<std::mutex> lock(watch_mutex_);
+    while (watching_) {
+        watch_cv_.wait_for(lock, std::chrono::seconds(config_.reload_interval_s), [this] { return !watching_; });
+        if (!watching_) {
+            break;
+        }
+        ec.clear();
+        fs::file_time_type talkgroups = modified(config_.talkgroups_file);
+        fs::file_time_type units = modified(config_.units_file);
+        if (ec || (talkgroups == talkgroups_seen && units == units_seen)) {
+            continue;
+        }
+        talkgroups_seen = talkgroups;
+        units_seen = units;
+
+        lock.unlock();
+        std::string error;
+        if (reload(error)) {
+            if (verbose) {
+                auto table = snapshot();
+                std::cout << "[CallEnrichment] Reloaded " << table->talkgroups() << " talkgroup(s) and "
+                          << table->units() << " unit(s)" << std::endl;
+            }
+        } else {
+            std::cerr << "[CallEnrichment] Keeping previous tables, reload failed: " << error << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+json CallEnrichment::get_stats() const {
+    auto table = snapshot();
+    json stats;
+    stats["talkgroups"] = table->talkgroups();
+    stats["units"] = table->units();
+    stats["talkgroup_hits"] = talkgroup_hits_.load(std::memory_order_relaxed);
+    stats["talkgroup_misses"] = talkgroup_misses_.load(std::memory_order_relaxed);
+    stats["unit_hits"] = unit_hits_.load(std::memory_order_relaxed);
+    stats["unit_misses"] = unit_misses_.load(std::memory_order_relaxed);
+    stats["reloads"] = reloads_.load(std::memory_order_relaxed);
+    stats["reload_failures"] = reload_failures_.load(std::memory_order_relaxed);
+    return stats;
+}
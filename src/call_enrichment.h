@@ -0,0 +1,145 @@
+/*
+ * Talkgroup and radio ID enrichment for finished calls
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Loads a trunk-recorder style talkgroup CSV (Decimal, Hex, Alpha Tag,
+ * Mode, Description, Tag, Category, Priority, or any order given a header
+ * row) and a unit CSV (ID, Alias) into one immutable EnrichmentTable. The
+ * files are mapped read-only and parsed in place; every string goes into a
+ * single pool and each ID set gets a PerfectHashIndex, so a lookup is O(1)
+ * with no probing and no per-plugin maps. The job manager fills a call's
+ * Call_Data_t (and the matching call_json keys) from it before dispatch.
+ *
+ * Like KeyStore, readers take the current table through a shared_ptr and
+ * a reload builds a complete new one and swaps it in, so a changed file
+ * never tears a lookup. A file that fails to load leaves the old table.
+ */
+
+#pragma once
+
+#include "perfect_hash.h"
+#include "plugin_api.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct CallEnrichmentConfig {
+    std::string talkgroups_file;
+    std::string units_file;
+    int reload_interval_s = 5;     // seconds between checks for changed files; 0 to never reload
+
+    bool enabled() const { return !talkgroups_file.empty() || !units_file.empty(); }
+
+    // {"talkgroups": "talkgroups.csv", "units": "units.csv", "reload_interval_s": 5}
+    static CallEnrichmentConfig from_json(const json& config) {
+        CallEnrichmentConfig c;
+        if (!config.is_object()) {
+            return c;
+        }
+        c.talkgroups_file = config.value("talkgroups", c.talkgroups_file);
+        c.units_file = config.value("units", c.units_file);
+        c.reload_interval_s = std::max(0, config.value("reload_interval_s", c.reload_interval_s));
+        return c;
+    }
+};
+
+class EnrichmentTable {
+public:
+    struct Talkgroup {
+        std::string_view alpha_tag;
+        std::string_view description;
+        std::string_view tag;
+        std::string_view group;
+        int priority;              // 0 when the file has none
+    };
+
+    // Either file may be empty (not loaded); false with error set on a
+    // file that cannot be read
+    static std::shared_ptr<const EnrichmentTable> load(const CallEnrichmentConfig& config, std::string& error);
+
+    // nullptr when the ID is not listed
+    const Talkgroup* talkgroup(long id) const;
+    // Empty when the unit is not listed
+    std::string_view unit_alias(long id) const;
+
+    size_t talkgroups() const { return talkgroups_.size(); }
+    size_t units() const { return unit_aliases_.size(); }
+
+private:
+    struct Text {
+        uint32_t offset;
+        uint32_t length;
+    };
+    struct TalkgroupText {
+        Text alpha_tag, description, tag, group;
+        int priority;
+    };
+
+    EnrichmentTable() = default;
+    bool load_talkgroups(const std::string& path, std::string& error);
+    bool load_units(const std::string& path, std::string& error);
+    Text store(std::string_view text);
+    void finish();
+
+    std::string strings_;                          // every string in the table
+    std::vector<TalkgroupText> talkgroup_text_;    // while loading
+    std::vector<Talkgroup> talkgroups_;            // views into strings_, by index
+    std::vector<uint32_t> talkgroup_ids_;
+    PerfectHashIndex talkgroup_index_;
+    std::vector<Text> unit_text_;
+    std::vector<std::string_view> unit_aliases_;
+    std::vector<uint32_t> unit_ids_;
+    PerfectHashIndex unit_index_;
+};
+
+class CallEnrichment {
+public:
+    explicit CallEnrichment(const CallEnrichmentConfig& config);
+    ~CallEnrichment();
+
+    // Load both files again and swap the new table in; the current table is
+    // kept on error
+    bool reload(std::string& error);
+
+    std::shared_ptr<const EnrichmentTable> snapshot() const { return std::atomic_load(&table_); }
+
+    // Fill in call's talkgroup names and source alias, and the same in its
+    // call_json (talkgroup_tag, talkgroup_description, talkgroup_group_tag,
+    // talkgroup_group, and srcList tags) where the uploader left them out.
+    // source_id is the call's first unit when call.source_id is not set.
+    void enrich(Call_Data_t& call, long source_id = 0) const;
+
+    // Reload whenever either file's mtime changes, every reload_interval_s
+    void watch(bool verbose = false);
+    void stop_watching();
+
+    json get_stats() const;
+
+private:
+    void watch_loop(bool verbose);
+
+    CallEnrichmentConfig config_;
+    std::shared_ptr<const EnrichmentTable> table_;
+    std::mutex reload_mutex_;   // serialises reloads; readers never take it
+
+    mutable std::atomic<uint64_t> talkgroup_hits_;
+    mutable std::atomic<uint64_t> talkgroup_misses_;
+    mutable std::atomic<uint64_t> unit_hits_;
+    mutable std::atomic<uint64_t> unit_misses_;
+    std::atomic<uint64_t> reloads_;
+    std::atomic<uint64_t> reload_failures_;
+
+    std::thread watcher_;
+    std::mutex watch_mutex_;
+    std::condition_variable watch_cv_;
+    bool watching_;
+};
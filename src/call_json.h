@@ -0,0 +1,118 @@
+/*
+ * trunk-recorder call metadata, parsed once per call
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * A call's JSON comes in with the upload and is wanted all along the
+ * pipeline: the scheduler's talkgroup and priority, the deduplicator's
+ * source and start time, plugins' call_json, and the decoder's own output,
+ * which carries the original text on with the decode results appended.
+ * TrunkCallMetadata is that JSON parsed exactly once, holding the fields
+ * the pipeline reads, the parsed object for plugins, and the text with the
+ * offset of its closing brace for splicing.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <nlohmann/json.hpp>
+
+struct TrunkCallMetadata {
+    std::string text;                  // as received
+    nlohmann::json object;             // parsed text; null unless it is a JSON object
+
+    bool has_talkgroup = false;
+    long talkgroup = 0;
+    bool has_emergency = false;
+    bool emergency = false;
+    bool has_priority = false;
+    int priority = 0;
+    long source_id = 0;                // first unit in srcList, else src; 0 when unknown
+    double start_time = 0.0;           // seconds since the epoch; 0 when unknown
+    std::string short_name;
+
+    bool empty() const { return text.empty(); }
+    bool is_object() const { return object.is_object(); }
+
+    // The text up to its last closing brace, trailing whitespace dropped;
+    // false when there is no brace to splice at
+    bool splice_body(std::string_view& body) const { return find_body(text, body); }
+
+    static bool find_body(std::string_view json_text, std::string_view& body) {
+        size_t last_brace = json_text.rfind('}');
+        if (last_brace == std::string_view::npos) {
+            return false;
+        }
+        body = json_text.substr(0, last_brace);
+        while (!body.empty() && (body.back() == ' ' || body.back() == '\n' || body.back() == '\t')) {
+            body.remove_suffix(1);
+        }
+        return true;
+    }
+
+    // Fields that are missing or malformed are left at their defaults
+    static std::shared_ptr<const TrunkCallMetadata> parse(const std::string& metadata_json) {
+        auto metadata = std::make_shared<TrunkCallMetadata>();
+        metadata->text = metadata_json;
+        if (metadata_json.empty()) {
+            return metadata;
+        }
+        nlohmann::json parsed = nlohmann::json::parse(metadata_json, nullptr, false);
+        if (!parsed.is_object()) {
+            return metadata;
+        }
+        metadata->read_fields(parsed);
+        metadata->object = std::move(parsed);
+        return metadata;
+    }
+
+private:
+    void read_fields(const nlohmann::json& call) {
+        auto found = call.find("talkgroup");
+        if (found != call.end() && found->is_number()) {
+            has_talkgroup = true;
+            talkgroup = found->get<long>();
+        }
+        found = call.find("emergency");
+        if (found != call.end()) {
+            if (found->is_boolean()) {
+                has_emergency = true;
+                emergency = found->get<bool>();
+            } else if (found->is_number()) {
+                has_emergency = true;
+                emergency = found->get<int>() != 0;
+            }
+        }
+        found = call.find("priority");
+        if (found != call.end() && found->is_number()) {
+            has_priority = true;
+            priority = found->get<int>();
+        }
+        found = call.find("start_time");
+        if (found != call.end() && found->is_number()) {
+            start_time = found->get<double>();
+        }
+        found = call.find("short_name");
+        if (found != call.end() && found->is_string()) {
+            short_name = found->get<std::string>();
+        }
+        // trunk-recorder lists every unit heard; the first one keyed up the call
+        found = call.find("srcList");
+        if (found != call.end() && found->is_array() && !found->empty()) {
+            const auto& first = (*found)[0];
+            if (first.is_object()) {
+                auto src = first.find("src");
+                if (src != first.end() && src->is_number()) {
+                    source_id = src->get<long>();
+                }
+            }
+        } else {
+            found = call.find("src");
+            if (found != call.end() && found->is_number()) {
+                source_id = found->get<long>();
+            }
+        }
+    }
+};
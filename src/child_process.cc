@@ -0,0 +1,144 @@
+#include "child_process.h"
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+extern char** environ;
+
+constexpr std::chrono::milliseconds ChildProcess::DEFAULT_KILL_GRACE;
+
+pid_t ChildProcess::spawn(const std::vector<std::string>& argv, bool quiet, int& error) {
+    error = 0;
+    if (argv.empty()) {
+        error = EINVAL;
+        return -1;
+    }
+    std::vector<char*> args;
+    for (const std::string& arg : argv) {
+        args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (quiet) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+
+    // Own process group, so a timeout can take down everything it started;
+    // default signal handling whatever this process has set
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGTERM);
+    sigaddset(&defaults, SIGINT);
+    sigset_t no_mask;
+    sigemptyset(&no_mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &no_mask);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid = -1;
+    error = posix_spawnp(&pid, args[0], &actions, &attr, args.data(), environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return error == 0 ? pid : -1;
+}
+
+int ChildProcess::open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+bool ChildProcess::try_reap(pid_t pid, Result& result) {
+    int status = 0;
+    pid_t done = waitpid(pid, &status, WNOHANG);
+    if (done == 0 || (done < 0 && errno == EINTR)) {
+        return false;
+    }
+    if (done == pid) {
+        if (WIFEXITED(status)) {
+            result.exit_code = WEXITSTATUS(status);
+        } else if (WIFSIGNALED(status)) {
+            result.signal = WTERMSIG(status);
+        }
+    }
+    // ECHILD: someone else reaped it and the status is lost
+    return true;
+}
+
+ChildProcess::Result ChildProcess::run(const std::vector<std::string>& argv, std::chrono::milliseconds timeout,
+                                       bool quiet, std::chrono::milliseconds kill_grace) {
+    Result result;
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = spawn(argv, quiet, result.spawn_error);
+    if (pid < 0) {
+        return result;
+    }
+    result.started = true;
+
+    if (!wait_for(pid, timeout.count() > 0 ? timeout : std::chrono::milliseconds(-1), result)) {
+        result.timed_out = true;
+        kill(-pid, SIGTERM);
+        if (!wait_for(pid, kill_grace, result)) {
+            kill(-pid, SIGKILL);
+            wait_for(pid, std::chrono::milliseconds(-1), result);
+        }
+    }
+    result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    return result;
+}
+
+bool ChildProcess::wait_for(pid_t pid, std::chrono::milliseconds timeout, Result& result) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    int pidfd = open_pidfd(pid);
+    auto poll_interval = std::chrono::milliseconds(1);
+    bool reaped = false;
+
+    for (;;) {
+        if (try_reap(pid, result)) {
+            reaped = true;
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (timeout.count() >= 0 && now >= deadline) {
+            break;
+        }
+
+        if (pidfd >= 0) {
+            // Readable once the child exits
+            int wait_ms = timeout.count() < 0
+                ? -1
+                : static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+            struct pollfd pfd = {pidfd, POLLIN, 0};
+            poll(&pfd, 1, wait_ms);
+        } else {
+            // No pidfd (kernels before 5.3): back off up to 50 ms between checks
+            std::this_thread::sleep_for(poll_interval);
+            poll_interval = std::min(poll_interval * 2, std::chrono::milliseconds(50));
+        }
+    }
+
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    return reaped;
+}
@@ -0,0 +1,57 @@
+/*
+ * Child processes with a time limit
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Replacement for std::system() where a hung command must not hold its
+ * caller forever (ffmpeg stuck on a bad file, an upload script waiting on
+ * a dead server). Commands are started with posix_spawnp() from an argv,
+ * with no shell in between to parse (or mangle) file names, each in a
+ * process group of its own. When the time limit passes the whole group,
+ * the command and whatever it started, gets SIGTERM and then SIGKILL if it
+ * has not gone within kill_grace. Waiting uses a pidfd where the kernel
+ * has one and polls waitpid() otherwise; either way no SIGCHLD handler is
+ * needed. ScriptExecutor builds on the same pieces to run many at once.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+class ChildProcess {
+public:
+    struct Result {
+        bool started = false;
+        bool timed_out = false;   // killed at the time limit
+        int exit_code = -1;       // -1 if it did not exit normally
+        int signal = 0;           // that ended it, if any
+        int spawn_error = 0;      // errno from posix_spawnp when not started
+        std::chrono::milliseconds elapsed{0};
+
+        bool ok() const { return started && !timed_out && exit_code == 0; }
+    };
+
+    static constexpr std::chrono::milliseconds DEFAULT_KILL_GRACE{1000};
+
+    // Run argv[0] (looked up in PATH) with argv; timeout <= 0 waits for as
+    // long as it takes. quiet sends its stdout and stderr to /dev/null.
+    static Result run(const std::vector<std::string>& argv, std::chrono::milliseconds timeout, bool quiet = false,
+                      std::chrono::milliseconds kill_grace = DEFAULT_KILL_GRACE);
+
+    // Start argv in a new process group with stdin from /dev/null; the pid,
+    // or -1 with error set
+    static pid_t spawn(const std::vector<std::string>& argv, bool quiet, int& error);
+
+    // A pidfd that polls readable once pid exits, or -1 where unsupported
+    static int open_pidfd(pid_t pid);
+
+    // Reap pid if it has exited, filling in result; false while it runs
+    static bool try_reap(pid_t pid, Result& result);
+
+private:
+    // Wait up to timeout (negative: forever) for pid; true once it is reaped
+    static bool wait_for(pid_t pid, std::chrono::milliseconds timeout, Result& result);
+};
@@ -0,0 +1,438 @@
+#include "cluster_queue.h"
+#include "job_scheduler.h"
+#include <unistd.h>
+#include <climits>
+#include <iostream>
+#include <set>
+
+namespace {
+
+std::string local_node_id() {
+    char name[HOST_NAME_MAX + 1] = {0};
+    if (gethostname(name, sizeof(name) - 1) != 0 || name[0] == '\0') {
+        return "trunk-decoder";
+    }
+    return name;
+}
+
+MetricsRegistry::Counter& published_counter(const char* result) {
+    return MetricsRegistry::global().counter("trunk_decoder_cluster_published_total",
+                                             "Jobs published to the decode cluster, by result",
+                                             std::string("result=\"") + result + "\"");
+}
+
+} // namespace
+
+ClusterShards::ClusterShards(const ClusterPolicy& policy)
+    : policy_(policy), ring_(policy.nodes) {
+}
+
+int ClusterShards::shard_for(const std::string& stream_name, const std::string& metadata) const {
+    std::string key = "stream:" + stream_name;
+    if (policy_.shard_by == "talkgroup") {
+        long talkgroup = 0;
+        bool emergency = false;
+        int priority = 0;
+        SchedulingPolicy::read_call_metadata(metadata, talkgroup, emergency, priority);
+        if (talkgroup > 0) {
+            key = "talkgroup:" + std::to_string(talkgroup);
+        }
+    }
+    return static_cast<int>(HashRing::hash(key) % static_cast<uint64_t>(policy_.shards));
+}
+
+ClusterPublisher::ClusterPublisher(const ClusterPolicy& policy)
+    : policy_(policy), shards_(policy), client_(policy.redis_host, policy.redis_port, policy.redis_password),
+      published_(0), failed_(0),
+      published_metric_(published_counter("ok")), failed_metric_(published_counter("error")) {
+}
+
+bool ClusterPublisher::publish(const ClusterJob& job, int& shard, std::string& error) {
+    shard = shards_.shard_for(job.stream_name, job.metadata);
+    std::vector<std::string> args = {"XADD", shards_.stream_key(shard)};
+    if (policy_.max_len > 0) {
+        args.insert(args.end(), {"MAXLEN", "~", std::to_string(policy_.max_len)});
+    }
+    args.insert(args.end(), {"*",
+                             "job_id", job.job_id,
+                             "stream_name", job.stream_name,
+                             "filename", job.filename,
+                             "metadata", job.metadata,
+                             "callback_url", job.callback_url});
+    args.push_back("p25");
+    if (job.p25) {
+        args.emplace_back(job.p25->begin(), job.p25->end());
+    } else {
+        args.emplace_back();
+    }
+
+    RedisClient::Reply reply;
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // A connection Redis dropped while idle fails once; the retry reconnects
+        sent = client_.command(args, reply) || client_.command(args, reply);
+        if (!sent) {
+            error = client_.error();
+        }
+    }
+    if (sent && reply.is_error()) {
+        error = reply.str;
+        sent = false;
+    }
+    if (!sent) {
+        failed_++;
+        failed_metric_.add();
+        return false;
+    }
+    published_++;
+    published_metric_.add();
+    return true;
+}
+
+ClusterConsumer::ClusterConsumer(const ClusterPolicy& policy, Submit submit)
+    : policy_(policy), submit_(std::move(submit)),
+      node_id_(policy.node_id.empty() ? local_node_id() : policy.node_id),
+      client_(policy.redis_host, policy.redis_port, policy.redis_password),
+      running_(false), consumed_(0), acked_(0), claimed_(0),
+      consumed_metric_(MetricsRegistry::global().counter("trunk_decoder_cluster_consumed_total",
+                                                         "Cluster jobs read from this node's shards")),
+      acked_metric_(MetricsRegistry::global().counter("trunk_decoder_cluster_acked_total",
+                                                      "Cluster jobs acknowledged once finished")),
+      claimed_metric_(MetricsRegistry::global().counter("trunk_decoder_cluster_claimed_total",
+                                                        "Idle cluster jobs taken over from other consumers")),
+      in_flight_metric_(MetricsRegistry::global().gauge("trunk_decoder_cluster_in_flight",
+                                                        "Cluster jobs read and not yet finished")) {
+    // Without a node list this is the only decoder and reads every shard
+    ClusterShards shards(policy_);
+    for (int shard = 0; shard < policy_.shards; shard++) {
+        if (policy_.nodes.empty() || shards.owner(shard) == node_id_) {
+            owned_.push_back(shard);
+            keys_.push_back(shards.stream_key(shard));
+        }
+    }
+    if (owned_.empty()) {
+        std::cerr << "[Cluster] Node \"" << node_id_ << "\" is not in the node list and reads no shards" << std::endl;
+    }
+}
+
+ClusterConsumer::~ClusterConsumer() {
+    stop();
+}
+
+void ClusterConsumer::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ || keys_.empty()) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&ClusterConsumer::run, this);
+}
+
+void ClusterConsumer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    wake_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void ClusterConsumer::finished(const std::string& job_id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = in_flight_.find(job_id);
+        if (it == in_flight_.end()) {
+            return;
+        }
+        acks_.push_back(it->second);
+        in_flight_.erase(it);
+        in_flight_metric_.set(static_cast<int64_t>(in_flight_.size()));
+    }
+    wake_.notify_all();
+}
+
+size_t ClusterConsumer::in_flight() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_flight_.size();
+}
+
+size_t ClusterConsumer::room() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t held = in_flight_.size() + deferred_.size();
+    size_t limit = static_cast<size_t>(policy_.max_in_flight);
+    return held < limit ? limit - held : 0;
+}
+
+void ClusterConsumer::run() {
+    bool reported = false;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_) {
+                break;
+            }
+        }
+        if (!client_.connected() && !prepare()) {
+            if (!reported) {
+                std::cerr << "[Cluster] Cannot reach Redis: " << client_.error() << "; retrying" << std::endl;
+                reported = true;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait_for(lock, std::chrono::seconds(1), [this] { return !running_; });
+            continue;
+        }
+        if (reported) {
+            std::cout << "[Cluster] Connected to Redis, reading " << keys_.size() << " shards as " << node_id_ << std::endl;
+            reported = false;
+        }
+
+        flush_acks();
+        offer_deferred();
+        if (std::chrono::steady_clock::now() >= next_claim_) {
+            claim_idle();
+            next_claim_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(policy_.claim_idle_ms / 2);
+        }
+        if (room() == 0) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait_for(lock, std::chrono::milliseconds(100), [this] { return !running_ || !acks_.empty(); });
+            continue;
+        }
+        read_entries();
+    }
+    // Whatever finished before the stop is acknowledged now, not redelivered
+    if (client_.connected()) {
+        flush_acks();
+    }
+}
+
+bool ClusterConsumer::prepare() {
+    if (!client_.connect()) {
+        return false;
+    }
+    for (const std::string& key : keys_) {
+        RedisClient::Reply reply;
+        if (!client_.command({"XGROUP", "CREATE", key, policy_.group, "0", "MKSTREAM"}, reply)) {
+            return false;
+        }
+        if (reply.is_error() && reply.str.compare(0, 9, "BUSYGROUP") != 0) {
+            std::cerr << "[Cluster] Cannot create group " << policy_.group << " on " << key << ": " << reply.str << std::endl;
+            client_.close();
+            return false;
+        }
+    }
+    // Entries delivered to this node before a restart or reconnect come first
+    history_.clear();
+    for (const std::string& key : keys_) {
+        history_[key] = "0";
+    }
+    next_claim_ = std::chrono::steady_clock::now();
+    return true;
+}
+
+void ClusterConsumer::read_entries() {
+    size_t count = room();
+    const bool history = !history_.empty();
+    std::vector<std::string> streams;
+    std::vector<std::string> ids;
+    if (history) {
+        for (const auto& cursor : history_) {
+            streams.push_back(cursor.first);
+            ids.push_back(cursor.second);
+        }
+    } else {
+        streams = keys_;
+        ids.assign(keys_.size(), ">");
+    }
+    // COUNT is per stream; split the room so one read cannot overshoot it by much
+    size_t per_stream = std::max<size_t>(1, (count + streams.size() - 1) / streams.size());
+
+    std::vector<std::string> args = {"XREADGROUP", "GROUP", policy_.group, node_id_, "COUNT", std::to_string(per_stream)};
+    if (!history) {
+        args.insert(args.end(), {"BLOCK", std::to_string(policy_.block_ms)});
+    }
+    args.push_back("STREAMS");
+    args.insert(args.end(), streams.begin(), streams.end());
+    args.insert(args.end(), ids.begin(), ids.end());
+
+    RedisClient::Reply reply;
+    if (!client_.command(args, reply, history ? 0 : policy_.block_ms)) {
+        return;   // run() reconnects
+    }
+    if (reply.is_error()) {
+        // NOGROUP after someone deleted a stream: recreate on reconnect
+        std::cerr << "[Cluster] Read failed: " << reply.str << std::endl;
+        client_.close();
+        return;
+    }
+
+    std::set<std::string> returned;
+    for (const RedisClient::Reply& stream : reply.elements) {
+        if (stream.elements.size() != 2) {
+            continue;
+        }
+        const std::string& key = stream.elements[0].str;
+        const auto& entries = stream.elements[1].elements;
+        for (const RedisClient::Reply& entry : entries) {
+            take(key, entry, false);
+        }
+        if (history && !entries.empty()) {
+            returned.insert(key);
+            history_[key] = entries.back().elements.empty() ? history_[key] : entries.back().elements[0].str;
+        }
+    }
+    if (history) {
+        for (auto it = history_.begin(); it != history_.end();) {
+            it = returned.count(it->first) ? std::next(it) : history_.erase(it);
+        }
+    }
+    offer_deferred();
+}
+
+void ClusterConsumer::claim_idle() {
+    for (const std::string& key : keys_) {
+        std::string cursor = "0-0";
+        size_t count;
+        while ((count = room()) > 0) {
+            RedisClient::Reply reply;
+            if (!client_.command({"XAUTOCLAIM", key, policy_.group, node_id_, std::to_string(policy_.claim_idle_ms),
+                                  cursor, "COUNT", std::to_string(count)}, reply)) {
+                return;
+            }
+            if (reply.is_error()) {
+                std::cerr << "[Cluster] Cannot claim idle entries on " << key << ": " << reply.str << std::endl;
+                return;
+            }
+            if (reply.elements.size() < 2) {
+                break;
+            }
+            for (const RedisClient::Reply& entry : reply.elements[1].elements) {
+                take(key, entry, true);
+            }
+            offer_deferred();
+            cursor = reply.elements[0].str;
+            if (cursor == "0-0" || cursor.empty()) {
+                break;
+            }
+        }
+    }
+}
+
+void ClusterConsumer::take(const std::string& stream, const RedisClient::Reply& entry, bool claimed) {
+    // [id, [field, value, ...]]; the fields are nil for an entry trimmed away
+    if (entry.elements.size() != 2) {
+        return;
+    }
+    Entry where{stream, entry.elements[0].str};
+    ClusterJob job;
+    bool has_p25 = false;
+    const auto& fields = entry.elements[1].elements;
+    for (size_t i = 0; i + 1 < fields.size(); i += 2) {
+        const std::string& name = fields[i].str;
+        const std::string& value = fields[i + 1].str;
+        if (name == "job_id") {
+            job.job_id = value;
+        } else if (name == "stream_name") {
+            job.stream_name = value;
+        } else if (name == "filename") {
+            job.filename = value;
+        } else if (name == "metadata") {
+            job.metadata = value;
+        } else if (name == "callback_url") {
+            job.callback_url = value;
+        } else if (name == "p25") {
+            job.p25 = std::make_shared<const std::vector<uint8_t>>(value.begin(), value.end());
+            has_p25 = !value.empty();
+        }
+    }
+    if (job.job_id.empty()) {
+        job.job_id = "cluster_" + where.id;
+    }
+    if (job.stream_name.empty()) {
+        job.stream_name = "default";
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Redelivered while this node still has it (claimed back after
+        // claim_idle_ms, or re-read from its own history): nothing to do
+        if (in_flight_.count(job.job_id)) {
+            return;
+        }
+        for (const auto& waiting : deferred_) {
+            if (waiting.second.job_id == job.job_id) {
+                return;
+            }
+        }
+        if (!has_p25) {
+            std::cerr << "[Cluster] Dropping entry " << where.id << " on " << stream << " without P25 data" << std::endl;
+            acks_.push_back(where);
+            return;
+        }
+    }
+    consumed_++;
+    consumed_metric_.add();
+    if (claimed) {
+        claimed_++;
+        claimed_metric_.add();
+    }
+    deferred_.emplace_back(std::move(where), std::move(job));
+}
+
+void ClusterConsumer::offer_deferred() {
+    while (!deferred_.empty()) {
+        auto& next = deferred_.front();
+        // Tracked before submitting, so a job that finishes at once still finds itself
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            in_flight_[next.second.job_id] = next.first;
+        }
+        if (!submit_(next.second)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            in_flight_.erase(next.second.job_id);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        in_flight_metric_.set(static_cast<int64_t>(in_flight_.size()));
+        deferred_.pop_front();
+    }
+}
+
+void ClusterConsumer::flush_acks() {
+    std::vector<Entry> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch.swap(acks_);
+    }
+    if (batch.empty()) {
+        return;
+    }
+    std::map<std::string, std::vector<std::string>> by_stream;
+    for (const Entry& entry : batch) {
+        by_stream[entry.stream].push_back(entry.id);
+    }
+    std::vector<Entry> unsent;
+    for (const auto& stream : by_stream) {
+        std::vector<std::string> args = {"XACK", stream.first, policy_.group};
+        args.insert(args.end(), stream.second.begin(), stream.second.end());
+        RedisClient::Reply reply;
+        if (!client_.command(args, reply)) {
+            for (const std::string& id : stream.second) {
+                unsent.push_back(Entry{stream.first, id});
+            }
+            continue;
+        }
+        if (reply.is_error()) {
+            std::cerr << "[Cluster] Cannot acknowledge entries on " << stream.first << ": " << reply.str << std::endl;
+            continue;
+        }
+        acked_ += static_cast<uint64_t>(reply.integer);
+        acked_metric_.add(static_cast<uint64_t>(reply.integer));
+    }
+    if (!unsent.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        acks_.insert(acks_.end(), unsent.begin(), unsent.end());
+    }
+}
@@ -0,0 +1,219 @@
+/*
+ * Decode cluster job queue
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Spreads decode jobs over several trunk-decoder nodes through Redis
+ * Streams. An ingest node takes uploads as usual but, instead of queueing
+ * them locally, publishes each one (the P25 bytes and everything that
+ * shapes the job) to one of `shards` streams, STREAM_PREFIX:<shard>. The
+ * shard comes from the call's talkgroup (or its stream_name), so one
+ * talkgroup's calls always land on the same decoder and its outputs stay
+ * together.
+ *
+ * Decode nodes read the streams through one consumer group. Shards, not
+ * talkgroups, are what is placed on the consistent hash ring of `nodes`:
+ * every node reads exactly the shards the ring gives it, and when the node
+ * list changes only the shards that move change hands. Membership is the
+ * static `nodes` list; every node should be given the same one.
+ *
+ * Delivery is at least once. An entry is acknowledged (XACK) only after
+ * its job has finished, successfully or not; entries a node read but never
+ * finished (it crashed, or was stopped with work queued) stay pending in
+ * the group. A decode node re-reads its own pending entries when it
+ * (re)connects, and claims entries on its shards that another consumer has
+ * left idle for claim_idle_ms (XAUTOCLAIM, Redis 6.2 or later), which is
+ * also how shards move after a membership change. A job may therefore run
+ * twice; outputs are written under the same names, so the second run just
+ * replaces the first.
+ *
+ * /metrics gets trunk_decoder_cluster_published_total by result, and
+ * _consumed_total, _acked_total, _claimed_total and the jobs in flight.
+ */
+
+#pragma once
+
+#include "hash_ring.h"
+#include "metrics.h"
+#include "redis_client.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+struct ClusterPolicy {
+    std::string role;                 // "" (off), "ingest" or "decode"
+    std::string redis_host = "127.0.0.1";
+    int redis_port = 6379;
+    std::string redis_password;
+    std::string stream_prefix = "trunk-decoder:jobs";
+    std::string group = "decoders";
+    int shards = 32;
+    std::vector<std::string> nodes;   // every decode node's node_id
+    std::string node_id;              // this node; default: the host name
+    std::string shard_by = "talkgroup";   // talkgroup or stream
+    int max_in_flight = 16;           // entries a decode node holds unfinished
+    int claim_idle_ms = 60000;        // take over entries pending this long
+    int block_ms = 1000;              // longest one read waits for new entries
+    size_t max_len = 100000;          // approximate cap on each shard's stream
+
+    bool enabled() const { return role == "ingest" || role == "decode"; }
+
+    // {"role": "decode", "redis_host": "10.0.0.5", "nodes": ["dec-a", "dec-b"], "node_id": "dec-a"}
+    static ClusterPolicy from_json(const nlohmann::json& config) {
+        ClusterPolicy policy;
+        if (!config.is_object()) {
+            return policy;
+        }
+        policy.role = config.value("role", policy.role);
+        policy.redis_host = config.value("redis_host", policy.redis_host);
+        policy.redis_port = config.value("redis_port", policy.redis_port);
+        policy.redis_password = config.value("redis_password", policy.redis_password);
+        policy.stream_prefix = config.value("stream_prefix", policy.stream_prefix);
+        policy.group = config.value("group", policy.group);
+        policy.shards = std::max(1, config.value("shards", policy.shards));
+        if (config.contains("nodes") && config["nodes"].is_array()) {
+            for (const auto& node : config["nodes"]) {
+                if (node.is_string()) {
+                    policy.nodes.push_back(node.get<std::string>());
+                }
+            }
+        }
+        policy.node_id = config.value("node_id", policy.node_id);
+        policy.shard_by = config.value("shard_by", policy.shard_by);
+        policy.max_in_flight = std::max(1, config.value("max_in_flight", policy.max_in_flight));
+        policy.claim_idle_ms = std::max(1000, config.value("claim_idle_ms", policy.claim_idle_ms));
+        policy.block_ms = std::max(10, config.value("block_ms", policy.block_ms));
+        policy.max_len = config.value("max_len", policy.max_len);
+        return policy;
+    }
+};
+
+// One decode job as it travels through a shard's stream
+struct ClusterJob {
+    std::string job_id;
+    std::string stream_name;
+    std::string filename;
+    std::string metadata;
+    std::string callback_url;
+    std::shared_ptr<const std::vector<uint8_t>> p25;
+};
+
+// Where ingest and decode nodes agree a job goes
+class ClusterShards {
+public:
+    explicit ClusterShards(const ClusterPolicy& policy);
+
+    int shard_for(const std::string& stream_name, const std::string& metadata) const;
+    std::string stream_key(int shard) const { return policy_.stream_prefix + ":" + std::to_string(shard); }
+    // The decode node that reads shard; "" without nodes
+    const std::string& owner(int shard) const { return ring_.owner("shard-" + std::to_string(shard)); }
+
+private:
+    ClusterPolicy policy_;
+    HashRing ring_;
+};
+
+class ClusterPublisher {
+public:
+    explicit ClusterPublisher(const ClusterPolicy& policy);
+
+    // XADD job to its shard, setting shard; false when Redis did not take
+    // it (the upload should be retried), with the reason in error
+    bool publish(const ClusterJob& job, int& shard, std::string& error);
+
+    const ClusterShards& shards() const { return shards_; }
+    uint64_t published() const { return published_.load(); }
+    uint64_t failed() const { return failed_.load(); }
+
+private:
+    ClusterPolicy policy_;
+    ClusterShards shards_;
+
+    std::mutex mutex_;   // one connection, shared by the HTTP workers
+    RedisClient client_;
+
+    std::atomic<uint64_t> published_;
+    std::atomic<uint64_t> failed_;
+    MetricsRegistry::Counter& published_metric_;
+    MetricsRegistry::Counter& failed_metric_;
+};
+
+class ClusterConsumer {
+public:
+    // Queue job locally; false when there is no room yet, in which case it
+    // is offered again later. Call finished(job.job_id) once it is done.
+    typedef std::function<bool(const ClusterJob& job)> Submit;
+
+    ClusterConsumer(const ClusterPolicy& policy, Submit submit);
+    ~ClusterConsumer();
+
+    ClusterConsumer(const ClusterConsumer&) = delete;
+    ClusterConsumer& operator=(const ClusterConsumer&) = delete;
+
+    void start();
+    // Acknowledge what has finished and stop reading; entries still in
+    // flight stay pending and are re-read on the next start
+    void stop();
+
+    // A job this consumer submitted has finished; other ids are ignored
+    void finished(const std::string& job_id);
+
+    const std::string& node_id() const { return node_id_; }
+    const std::vector<int>& owned_shards() const { return owned_; }
+    uint64_t consumed() const { return consumed_.load(); }
+    uint64_t acked() const { return acked_.load(); }
+    uint64_t claimed() const { return claimed_.load(); }
+    size_t in_flight();
+
+private:
+    struct Entry {
+        std::string stream;
+        std::string id;
+    };
+
+    void run();
+    bool prepare();
+    void read_entries();
+    void claim_idle();
+    void take(const std::string& stream, const RedisClient::Reply& entry, bool claimed);
+    void offer_deferred();
+    void flush_acks();
+    size_t room();
+
+    ClusterPolicy policy_;
+    Submit submit_;
+    std::string node_id_;
+    std::vector<int> owned_;
+    std::vector<std::string> keys_;            // owned_ as stream keys
+
+    RedisClient client_;                       // consumer thread only
+    std::map<std::string, std::string> history_;   // stream -> cursor through our own pending entries
+    std::deque<std::pair<Entry, ClusterJob>> deferred_;   // read, but not yet accepted by submit_
+    std::chrono::steady_clock::time_point next_claim_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::map<std::string, Entry> in_flight_;   // job_id -> its entry
+    std::vector<Entry> acks_;                  // finished, not yet acknowledged
+    bool running_;
+    std::thread thread_;
+
+    std::atomic<uint64_t> consumed_;
+    std::atomic<uint64_t> acked_;
+    std::atomic<uint64_t> claimed_;
+    MetricsRegistry::Counter& consumed_metric_;
+    MetricsRegistry::Counter& acked_metric_;
+    MetricsRegistry::Counter& claimed_metric_;
+    MetricsRegistry::Gauge& in_flight_metric_;
+};
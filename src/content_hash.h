@@ -0,0 +1,131 @@
+/*
+ * Streaming content hash
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * XXH64, fed in whatever pieces the data arrives in, so an upload can be
+ * hashed while it is parsed rather than read back afterwards. Not for
+ * anything an attacker gets to pick collisions in; it only has to tell
+ * one call's bytes from another's.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+class ContentHash {
+public:
+    explicit ContentHash(uint64_t seed = 0) { reset(seed); }
+
+    void reset(uint64_t seed = 0) {
+        seed_ = seed;
+        v_[0] = seed + PRIME1 + PRIME2;
+        v_[1] = seed + PRIME2;
+        v_[2] = seed;
+        v_[3] = seed - PRIME1;
+        total_ = 0;
+        pending_ = 0;
+    }
+
+    void update(const void* data, size_t length) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total_ += length;
+        if (pending_ + length < STRIPE) {
+            memcpy(buffer_ + pending_, p, length);
+            pending_ += length;
+            return;
+        }
+        if (pending_ > 0) {
+            size_t fill = STRIPE - pending_;
+            memcpy(buffer_ + pending_, p, fill);
+            consume(buffer_);
+            p += fill;
+            length -= fill;
+            pending_ = 0;
+        }
+        for (; length >= STRIPE; p += STRIPE, length -= STRIPE) {
+            consume(p);
+        }
+        memcpy(buffer_, p, length);
+        pending_ = length;
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (total_ >= STRIPE) {
+            h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+            for (uint64_t v : v_) {
+                h = (h ^ round(0, v)) * PRIME1 + PRIME4;
+            }
+        } else {
+            h = seed_ + PRIME5;
+        }
+        h += total_;
+
+        const uint8_t* p = buffer_;
+        size_t left = pending_;
+        for (; left >= 8; p += 8, left -= 8) {
+            h = rotl(h ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+        }
+        if (left >= 4) {
+            h = rotl(h ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+            p += 4;
+            left -= 4;
+        }
+        for (; left > 0; p++, left--) {
+            h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+        }
+
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    static std::string hex(uint64_t hash) {
+        char text[17];
+        snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+        return text;
+    }
+
+private:
+    static constexpr size_t STRIPE = 32;
+    static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t round(uint64_t acc, uint64_t input) { return rotl(acc + input * PRIME2, 31) * PRIME1; }
+    // Little-endian, as XXH64 is defined
+    static uint64_t read64(const uint8_t* p) {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; i--) {
+            v = (v << 8) | p[i];
+        }
+        return v;
+    }
+    static uint64_t read32(const uint8_t* p) {
+        return static_cast<uint64_t>(p[0]) | (static_cast<uint64_t>(p[1]) << 8) |
+               (static_cast<uint64_t>(p[2]) << 16) | (static_cast<uint64_t>(p[3]) << 24);
+    }
+
+    void consume(const uint8_t* stripe) {
+        for (int i = 0; i < 4; i++) {
+            v_[i] = round(v_[i], read64(stripe + 8 * i));
+        }
+    }
+
+    uint64_t seed_;
+    uint64_t v_[4];
+    uint64_t total_;
+    uint8_t buffer_[STRIPE];
+    size_t pending_;
+};
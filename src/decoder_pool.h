@@ -0,0 +1,134 @@
+/*
+ * Reusable P25 decoders
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Building a P25Decoder allocates and initialises an IMBE vocoder, so
+ * decoders are kept and handed out again instead. acquire() returns a
+ * decoder that has been reset() to a clean call state; the lease puts it
+ * back when it goes out of scope. Decode workers hold one lease for their
+ * whole life and reset between jobs, so the pool lock is only taken when a
+ * worker or a live stream starts.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include "p25_decoder.h"
+
+class DecoderPool {
+public:
+    class Lease {
+    public:
+        Lease() : pool_(nullptr), node_(-1) {}
+        Lease(DecoderPool* pool, std::unique_ptr<P25Decoder> decoder, int node)
+            : pool_(pool), decoder_(std::move(decoder)), node_(node) {}
+        Lease(Lease&& other) noexcept : pool_(other.pool_), decoder_(std::move(other.decoder_)), node_(other.node_) {
+            other.pool_ = nullptr;
+        }
+        Lease& operator=(Lease&& other) noexcept {
+            if (this != &other) {
+                give_back();
+                pool_ = other.pool_;
+                decoder_ = std::move(other.decoder_);
+                node_ = other.node_;
+                other.pool_ = nullptr;
+            }
+            return *this;
+        }
+        ~Lease() { give_back(); }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        P25Decoder* get() const { return decoder_.get(); }
+        P25Decoder* operator->() const { return decoder_.get(); }
+        P25Decoder& operator*() const { return *decoder_; }
+        explicit operator bool() const { return static_cast<bool>(decoder_); }
+
+        // Free the decoder instead of putting it back, when the pool already
+        // holds more than it will need
+        void discard() {
+            decoder_.reset();
+            pool_ = nullptr;
+        }
+
+    private:
+        void give_back() {
+            if (pool_ && decoder_) {
+                pool_->release(std::move(decoder_), node_);
+            }
+            pool_ = nullptr;
+        }
+
+        DecoderPool* pool_;
+        std::unique_ptr<P25Decoder> decoder_;
+        int node_;
+    };
+
+    DecoderPool() : created_(0) {}
+
+    DecoderPool(const DecoderPool&) = delete;
+    DecoderPool& operator=(const DecoderPool&) = delete;
+
+    // Build decoders ahead of time so the first jobs do not pay for them
+    void prewarm(size_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (free_.size() < count) {
+            free_.push_back(Idle{std::unique_ptr<P25Decoder>(new P25Decoder()), -1});
+            created_++;
+        }
+    }
+
+    // node >= 0 asks for a decoder built on that NUMA node: an idle one from
+    // the node if there is one, otherwise a new one built by the caller,
+    // which should already be running (and allocating) there
+    Lease acquire(int node = -1) {
+        std::unique_ptr<P25Decoder> decoder;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = free_.size(); i-- > 0; ) {
+                if (node < 0 || free_[i].node == node) {
+                    decoder = std::move(free_[i].decoder);
+                    node = free_[i].node;
+                    free_.erase(free_.begin() + static_cast<std::ptrdiff_t>(i));
+                    break;
+                }
+            }
+        }
+        if (decoder) {
+            decoder->reset();
+        } else {
+            decoder.reset(new P25Decoder());
+            created_++;
+        }
+        return Lease(this, std::move(decoder), node);
+    }
+
+    size_t created() const { return created_.load(); }
+
+    size_t idle() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+private:
+    // A decoder and the node its memory was first touched on, -1 if unknown
+    struct Idle {
+        std::unique_ptr<P25Decoder> decoder;
+        int node;
+    };
+
+    void release(std::unique_ptr<P25Decoder> decoder, int node) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(Idle{std::move(decoder), node});
+    }
+
+    std::mutex mutex_;
+    std::vector<Idle> free_;
+    std::atomic<size_t> created_;
+};
@@ -0,0 +1,115 @@
+/*
+ * Append-only text buffer for frame dumps
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Text and CSV dumps print two hex digits for every payload byte, and
+ * through an ostream each one is a hex/setw/setfill round trip plus a
+ * locale-aware integer conversion. DumpBuffer appends to one std::string
+ * instead: bytes come from a table of digit pairs and integers from
+ * std::to_chars. Given a sink, callers hand it the text in blocks with
+ * flush_if_full(), so a full-day export goes out in large writes without
+ * being held in memory; flush() or destruction writes the rest.
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+class DumpBuffer {
+public:
+    static constexpr size_t DEFAULT_FLUSH_BYTES = 1 << 20;
+
+    explicit DumpBuffer(std::ostream* sink = nullptr, size_t flush_bytes = DEFAULT_FLUSH_BYTES)
+        : sink_(sink), flush_bytes_(flush_bytes) {
+        text_.reserve(sink ? flush_bytes + 4096 : 4096);
+    }
+    ~DumpBuffer() { flush(); }
+    DumpBuffer(const DumpBuffer&) = delete;
+    DumpBuffer& operator=(const DumpBuffer&) = delete;
+
+    DumpBuffer& text(const char* s) { text_.append(s); return *this; }
+    DumpBuffer& text(const char* s, size_t length) { text_.append(s, length); return *this; }
+    DumpBuffer& text(std::string_view s) { text_.append(s.data(), s.size()); return *this; }
+    DumpBuffer& ch(char c) { text_.push_back(c); return *this; }
+
+    DumpBuffer& dec(uint64_t value) {
+        char digits[20];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        text_.append(digits, result.ptr - digits);
+        return *this;
+    }
+
+    // Lowercase, zero-padded to at least width digits; as std::hex with setw/setfill('0')
+    DumpBuffer& hex(uint64_t value, int width = 1) {
+        char digits[16];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value, 16);
+        size_t length = result.ptr - digits;
+        if (static_cast<size_t>(width) > length) {
+            text_.append(width - length, '0');
+        }
+        text_.append(digits, length);
+        return *this;
+    }
+
+    // Two digits per byte, each followed by separator; with between_only,
+    // no separator after the last byte
+    DumpBuffer& hex_bytes(const uint8_t* data, size_t count, char separator, bool between_only = false) {
+        if (count == 0) {
+            return *this;
+        }
+        size_t at = text_.size();
+        size_t added = count * 3 - (between_only ? 1 : 0);
+        text_.resize(at + added);
+        char* out = &text_[at];
+        for (size_t i = 0; i < count; i++) {
+            memcpy(out, HEX_PAIRS + data[i] * 2, 2);
+            out += 2;
+            if (!between_only || i + 1 < count) {
+                *out++ = separator;
+            }
+        }
+        return *this;
+    }
+
+    // Hand the text to the sink once flush_bytes of it have built up
+    void flush_if_full() {
+        if (sink_ && text_.size() >= flush_bytes_) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (sink_ && !text_.empty()) {
+            sink_->write(text_.data(), static_cast<std::streamsize>(text_.size()));
+            text_.clear();
+        }
+    }
+
+    size_t size() const { return text_.size(); }
+    bool empty() const { return text_.empty(); }
+    void clear() { text_.clear(); }
+    const std::string& str() const { return text_; }
+    std::string_view view(size_t from = 0) const { return std::string_view(text_).substr(from); }
+
+private:
+    static constexpr char HEX_PAIRS[] =
+        "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+        "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+        "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+        "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+        "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+        "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+        "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+        "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+    std::ostream* sink_;
+    size_t flush_bytes_;
+    std::string text_;
+};
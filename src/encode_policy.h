@@ -0,0 +1,135 @@
+/*
+ * Per-call encoder bitrate and complexity
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * IMBE is 4.4 kbps of 8 kHz voice; past about 16 kbps Opus (32 kbps MP3)
+ * a bigger encode buys egress, not audio. With the policy on, each call's
+ * lossy formats get a voice bitrate scaled by the call's class (emergency
+ * and high-priority talkgroups up, low down), trimmed for long calls and
+ * for calls whose FEC lost enough frames that there is little left to
+ * preserve, and never above a bitrate the call asked for. FLAC and WAV
+ * are lossless and untouched.
+ *
+ * Complexity follows the encode stage's backlog instead: full while its
+ * queue is nearly empty, stepping down to min_complexity as it fills, so
+ * a burst costs less CPU per call rather than waiting behind slow
+ * encodes. Emergency calls always encode at full complexity.
+ */
+
+#pragma once
+
+#include "job_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <nlohmann/json.hpp>
+
+struct EncodeSettings {
+    int bitrate_kbps;   // 0 for the format's default
+    int complexity;     // 0 (fastest) to 10, -1 for the encoder's default
+};
+
+struct EncodePolicy {
+    bool enabled = false;
+
+    // Voice bitrate per lossy format before scaling
+    std::map<std::string, int> bitrate_kbps = {{"opus", 16}, {"webm", 16}, {"mp3", 32}, {"m4a", 32}};
+    int min_kbps = 8;
+
+    // Bitrate multiplier per job class
+    double class_scale[static_cast<int>(JobClass::COUNT)] = {
+        1.5,    // emergency
+        1.25,   // high
+        1.0,    // normal
+        0.75    // low
+    };
+
+    double long_call_s = 120.0;           // calls at least this long...
+    double long_call_scale = 0.75;        // ...are scaled by this
+    double poor_quality_bad_frames = 0.2; // bad frame rate at which...
+    double poor_quality_scale = 0.75;     // ...this applies too
+
+    // Encode queue fill (queued / capacity) where complexity starts to
+    // drop, and where it reaches min_complexity
+    int max_complexity = 10;
+    int min_complexity = 2;
+    double backlog_start = 0.25;
+    double backlog_full = 0.75;
+
+    // Encoder complexity for an encode queue backlog_fill full
+    int complexity_for(double backlog_fill, JobClass job_class) const {
+        if (job_class == JobClass::EMERGENCY || backlog_fill <= backlog_start) {
+            return max_complexity;
+        }
+        if (backlog_fill >= backlog_full || backlog_full <= backlog_start) {
+            return min_complexity;
+        }
+        double t = (backlog_fill - backlog_start) / (backlog_full - backlog_start);
+        return max_complexity - static_cast<int>(std::lround(t * (max_complexity - min_complexity)));
+    }
+
+    // requested_kbps is what the call asked for (0 for nothing); with the
+    // policy off that and the encoder's default complexity are returned
+    EncodeSettings choose(const std::string& format, int requested_kbps, JobClass job_class,
+                          double duration_s, double bad_frame_rate, double backlog_fill) const {
+        if (!enabled) {
+            return EncodeSettings{requested_kbps, -1};
+        }
+        EncodeSettings settings{requested_kbps, complexity_for(backlog_fill, job_class)};
+        auto base = bitrate_kbps.find(format);
+        if (base == bitrate_kbps.end()) {
+            return settings;   // lossless, or a format the policy does not size
+        }
+        double kbps = base->second * class_scale[static_cast<int>(job_class)];
+        if (long_call_s > 0 && duration_s >= long_call_s) {
+            kbps *= long_call_scale;
+        }
+        if (bad_frame_rate >= poor_quality_bad_frames) {
+            kbps *= poor_quality_scale;
+        }
+        int chosen = std::max(min_kbps, static_cast<int>(std::lround(kbps)));
+        settings.bitrate_kbps = requested_kbps > 0 ? std::min(requested_kbps, chosen) : chosen;
+        return settings;
+    }
+
+    // {"enabled": true, "bitrate_kbps": {"opus": 16, "mp3": 32}, "min_kbps": 8,
+    //  "class_scale": {"emergency": 1.5, "high": 1.25, "normal": 1.0, "low": 0.75},
+    //  "long_call_s": 120, "long_call_scale": 0.75,
+    //  "poor_quality_bad_frames": 0.2, "poor_quality_scale": 0.75,
+    //  "max_complexity": 10, "min_complexity": 2, "backlog_start": 0.25, "backlog_full": 0.75}
+    static EncodePolicy from_json(const nlohmann::json& config) {
+        EncodePolicy policy;
+        if (!config.is_object()) {
+            return policy;
+        }
+        policy.enabled = config.value("enabled", true);
+        if (config.contains("bitrate_kbps")) {
+            for (const auto& item : config["bitrate_kbps"].items()) {
+                policy.bitrate_kbps[item.key()] = std::max(1, item.value().get<int>());
+            }
+        }
+        policy.min_kbps = std::max(1, config.value("min_kbps", policy.min_kbps));
+        if (config.contains("class_scale")) {
+            const auto& scale = config["class_scale"];
+            for (int i = 0; i < static_cast<int>(JobClass::COUNT); i++) {
+                const char* name = job_class_name(static_cast<JobClass>(i));
+                if (scale.contains(name)) {
+                    policy.class_scale[i] = std::max(0.0, scale[name].get<double>());
+                }
+            }
+        }
+        policy.long_call_s = config.value("long_call_s", policy.long_call_s);
+        policy.long_call_scale = config.value("long_call_scale", policy.long_call_scale);
+        policy.poor_quality_bad_frames = config.value("poor_quality_bad_frames", policy.poor_quality_bad_frames);
+        policy.poor_quality_scale = config.value("poor_quality_scale", policy.poor_quality_scale);
+        policy.max_complexity = std::min(10, std::max(0, config.value("max_complexity", policy.max_complexity)));
+        policy.min_complexity = std::min(policy.max_complexity,
+                                         std::max(0, config.value("min_complexity", policy.min_complexity)));
+        policy.backlog_start = config.value("backlog_start", policy.backlog_start);
+        policy.backlog_full = config.value("backlog_full", policy.backlog_full);
+        return policy;
+    }
+};
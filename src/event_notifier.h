@@ -0,0 +1,58 @@
+/*
+ * Readiness notification for input plugins
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Thin wrapper around a non-blocking eventfd. A producer calls notify()
+ * after queueing data; the consumer watches fd() with epoll and calls
+ * drain() before emptying the queue, so every notify() that races with
+ * the drain produces another wakeup and nothing is left behind.
+ */
+
+#pragma once
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+
+class EventNotifier {
+public:
+    EventNotifier() : fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+    ~EventNotifier() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    EventNotifier(const EventNotifier&) = delete;
+    EventNotifier& operator=(const EventNotifier&) = delete;
+
+    bool valid() const { return fd_ >= 0; }
+    int fd() const { return fd_; }
+
+    // Make fd() readable; cheap enough to call once per received batch
+    void notify() {
+        uint64_t one = 1;
+        ssize_t ret;
+        do {
+            ret = write(fd_, &one, sizeof(one));
+        } while (ret < 0 && errno == EINTR);
+    }
+
+    // Reset the counter; returns the number of notify() calls folded together
+    uint64_t drain() { return drain(fd_); }
+
+    static uint64_t drain(int fd) {
+        uint64_t count = 0;
+        ssize_t ret;
+        do {
+            ret = read(fd, &count, sizeof(count));
+        } while (ret < 0 && errno == EINTR);
+        return ret == sizeof(count) ? count : 0;
+    }
+
+private:
+    int fd_;
+};
@@ -0,0 +1,155 @@
+#include "frame_index.h"
+#include "p25_frame_parser.h"
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+static const char INDEX_MAGIC[8] = {'P', '2', '5', 'F', 'I', 'D', 'X', '1'};
+static const size_t HEADER_BYTES = 32;
+static const size_t ENTRY_BYTES = 9;
+
+static void put_le(uint8_t* out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+bool FrameIndex::add(uint64_t offset, uint8_t duid) {
+    if (offset > UINT32_MAX || total_samples_ + SAMPLES_PER_LDU > UINT32_MAX) {
+        return false;
+    }
+    Entry entry;
+    entry.offset = static_cast<uint32_t>(offset);
+    entry.sample = static_cast<uint32_t>(total_samples_);
+    entry.duid = duid;
+    entries_.push_back(entry);
+    if (p25_duid_is_voice(duid)) {
+        total_samples_ += SAMPLES_PER_LDU;
+    }
+    return true;
+}
+
+size_t FrameIndex::seek_point(uint64_t sample, int prime_ldus) const {
+    size_t target = entries_.size();
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (p25_duid_is_voice(entries_[i].duid) && entries_[i].sample + SAMPLES_PER_LDU > sample) {
+            target = i;
+            break;
+        }
+    }
+    if (target == entries_.size()) {
+        return target;
+    }
+
+    // Step back over prime_ldus earlier voice frames; whatever sits between
+    // them (HDU, TDU) is read too
+    size_t start = target;
+    for (int primed = 0; start > 0 && primed < prime_ldus; ) {
+        start--;
+        if (p25_duid_is_voice(entries_[start].duid)) {
+            primed++;
+        }
+    }
+    return start;
+}
+
+bool FrameIndex::stat_source(const std::string& p25_file, uint64_t& size, int64_t& mtime) {
+    std::error_code ec;
+    size = fs::file_size(p25_file, ec);
+    if (ec) {
+        return false;
+    }
+    auto write_time = fs::last_write_time(p25_file, ec);
+    if (ec) {
+        return false;
+    }
+    mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(write_time.time_since_epoch()).count();
+    return true;
+}
+
+bool FrameIndex::load(const std::string& path, const std::string& p25_file) {
+    clear();
+    uint64_t size;
+    int64_t mtime;
+    if (!stat_source(p25_file, size, mtime)) {
+        return false;
+    }
+    std::ifstream in(path, std::ios::binary);
+    uint8_t header[HEADER_BYTES];
+    if (!in.read(reinterpret_cast<char*>(header), HEADER_BYTES) ||
+        memcmp(header, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        get_le(header + 8, 8) != size || static_cast<int64_t>(get_le(header + 16, 8)) != mtime) {
+        return false;
+    }
+    uint32_t count = static_cast<uint32_t>(get_le(header + 24, 4));
+    std::vector<uint8_t> body(static_cast<size_t>(count) * ENTRY_BYTES);
+    if (!in.read(reinterpret_cast<char*>(body.data()), body.size())) {
+        return false;
+    }
+
+    entries_.resize(count);
+    uint32_t previous_sample = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* raw = body.data() + static_cast<size_t>(i) * ENTRY_BYTES;
+        Entry& entry = entries_[i];
+        entry.offset = static_cast<uint32_t>(get_le(raw, 4));
+        entry.sample = static_cast<uint32_t>(get_le(raw + 4, 4));
+        entry.duid = raw[8];
+        if (entry.offset >= size || entry.sample < previous_sample) {
+            clear();
+            return false;
+        }
+        previous_sample = entry.sample;
+    }
+    // The last frame's own voice is not in its entry
+    total_samples_ = count == 0 ? 0 : entries_.back().sample;
+    if (count > 0 && p25_duid_is_voice(entries_.back().duid)) {
+        total_samples_ += SAMPLES_PER_LDU;
+    }
+    return true;
+}
+
+bool FrameIndex::save(const std::string& path, const std::string& p25_file) const {
+    uint64_t size;
+    int64_t mtime;
+    if (!stat_source(p25_file, size, mtime)) {
+        return false;
+    }
+    std::vector<uint8_t> out(HEADER_BYTES + entries_.size() * ENTRY_BYTES, 0);
+    memcpy(out.data(), INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    put_le(out.data() + 8, size, 8);
+    put_le(out.data() + 16, static_cast<uint64_t>(mtime), 8);
+    put_le(out.data() + 24, entries_.size(), 4);
+    uint8_t* raw = out.data() + HEADER_BYTES;
+    for (const auto& entry : entries_) {
+        put_le(raw, entry.offset, 4);
+        put_le(raw + 4, entry.sample, 4);
+        raw[8] = entry.duid;
+        raw += ENTRY_BYTES;
+    }
+
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.write(reinterpret_cast<const char*>(out.data()), out.size())) {
+            return false;
+        }
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+/*
+ * Sidecar frame index for .p25 files
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * A FrameIndex lists every frame of a .p25 file with its byte offset, its
+ * DUID and the voice time before it, counted in 8 kHz samples at 1440 per
+ * LDU (180 ms on air, whether or not the LDU turns out decodable). That is
+ * enough to seek straight to the LDU holding a given second of a call
+ * instead of parsing everything in front of it.
+ *
+ * The index is stored next to the call as FILE.p25.idx: a 32-byte header
+ * (magic, the .p25's size and mtime, frame count) followed by 9 bytes per
+ * frame, all little-endian. An index whose size or mtime no longer match
+ * the .p25 is ignored.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class FrameIndex {
+public:
+    static constexpr int SAMPLES_PER_LDU = 1440;
+
+    struct Entry {
+        uint32_t offset;    // frame header's byte offset in the .p25
+        uint32_t sample;    // voice samples before this frame
+        uint8_t duid;
+    };
+
+    // FILE.p25 -> FILE.p25.idx
+    static std::string path_for(const std::string& p25_file) { return p25_file + ".idx"; }
+
+    void clear() { entries_.clear(); total_samples_ = 0; }
+
+    // Append the next frame; false once offsets no longer fit (4 GiB)
+    bool add(uint64_t offset, uint8_t duid);
+
+    const std::vector<Entry>& entries() const { return entries_; }
+    bool empty() const { return entries_.empty(); }
+    uint64_t total_samples() const { return total_samples_; }
+
+    // First frame to read so that the LDU holding sample is decoded after
+    // prime_ldus voice frames in front of it. entries().size() if sample
+    // is past the last LDU.
+    size_t seek_point(uint64_t sample, int prime_ldus) const;
+
+    // Read path, unless it was made for a different version of p25_file
+    bool load(const std::string& path, const std::string& p25_file);
+
+    // Write atomically (temp file and rename), stamped with p25_file's size and mtime
+    bool save(const std::string& path, const std::string& p25_file) const;
+
+private:
+    static bool stat_source(const std::string& p25_file, uint64_t& size, int64_t& mtime);
+
+    std::vector<Entry> entries_;
+    uint64_t total_samples_ = 0;
+};
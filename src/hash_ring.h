@@ -0,0 +1,60 @@
+/*
+ * Consistent hashing
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Maps keys onto a set of named nodes so that adding or removing a node
+ * only moves the keys that node gains or loses, about 1/N of them, instead
+ * of reshuffling everything the way hash % N does. Each node is placed on
+ * the ring at `replicas` points to even out how much each one owns.
+ */
+
+#pragma once
+
+#include "content_hash.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class HashRing {
+public:
+    explicit HashRing(const std::vector<std::string>& nodes, int replicas = 128) : nodes_(nodes) {
+        std::sort(nodes_.begin(), nodes_.end());
+        nodes_.erase(std::unique(nodes_.begin(), nodes_.end()), nodes_.end());
+        for (size_t n = 0; n < nodes_.size(); n++) {
+            for (int r = 0; r < replicas; r++) {
+                std::string point = nodes_[n] + "#" + std::to_string(r);
+                points_.emplace_back(hash(point), n);
+            }
+        }
+        std::sort(points_.begin(), points_.end());
+    }
+
+    bool empty() const { return nodes_.empty(); }
+    const std::vector<std::string>& nodes() const { return nodes_; }
+
+    // The node that owns key; "" when the ring has none
+    const std::string& owner(const std::string& key) const {
+        static const std::string none;
+        if (points_.empty()) {
+            return none;
+        }
+        auto it = std::lower_bound(points_.begin(), points_.end(), std::make_pair(hash(key), size_t(0)));
+        if (it == points_.end()) {
+            it = points_.begin();
+        }
+        return nodes_[it->second];
+    }
+
+    static uint64_t hash(const std::string& key) {
+        ContentHash h;
+        h.update(key.data(), key.size());
+        return h.digest();
+    }
+
+private:
+    std::vector<std::string> nodes_;
+    std::vector<std::pair<uint64_t, size_t>> points_;
+};
@@ -1,14 +1,27 @@
 #include "http_service.h"
+#include "multipart_parser.h"
+#include "content_hash.h"
+#include "tracer.h"
+#include "thread_placement.h"
+#include "temp_store.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
-#include <thread>
+#include <strings.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cctype>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <cstring>
-#include <regex>
 
 #ifdef HAVE_OPENSSL
 void HttpService::init_ssl() {
@@ -28,20 +41,60 @@ void HttpService::init_ssl() {
     if (SSL_CTX_use_certificate_file(ssl_ctx_, cert_file_.c_str(), SSL_FILETYPE_PEM) <= 0) {
         std::cerr << "Failed to load certificate file: " << cert_file_ << std::endl;
         ERR_print_errors_fp(stderr);
+        cleanup_ssl();
         return;
     }
     
     if (SSL_CTX_use_PrivateKey_file(ssl_ctx_, key_file_.c_str(), SSL_FILETYPE_PEM) <= 0) {
         std::cerr << "Failed to load private key file: " << key_file_ << std::endl;
         ERR_print_errors_fp(stderr);
+        cleanup_ssl();
         return;
     }
     
     // Verify private key matches certificate
     if (!SSL_CTX_check_private_key(ssl_ctx_)) {
         std::cerr << "Private key does not match the certificate" << std::endl;
+        cleanup_ssl();
+        return;
+    }
+    
+    SSL_CTX_set_min_proto_version(ssl_ctx_, TLS1_2_VERSION);
+    if (SSL_CTX_set_cipher_list(ssl_ctx_, tls_options_.cipher_list.c_str()) != 1 ||
+        SSL_CTX_set_ciphersuites(ssl_ctx_, tls_options_.ciphersuites.c_str()) != 1) {
+        std::cerr << "Invalid TLS cipher configuration" << std::endl;
+        ERR_print_errors_fp(stderr);
+        cleanup_ssl();
         return;
     }
+    uint64_t options = SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_PRIORITIZE_CHACHA | SSL_OP_NO_RENEGOTIATION;
+    
+    // Resumption: tickets and the server-side cache share one lifetime.
+    // Ticket keys are made per process, so a restart means one full
+    // handshake per client.
+    if (!tls_options_.session_tickets) {
+        options |= SSL_OP_NO_TICKET;
+    }
+    if (tls_options_.session_cache_size > 0) {
+        static const unsigned char SESSION_CONTEXT[] = "trunk-decoder";
+        SSL_CTX_set_session_id_context(ssl_ctx_, SESSION_CONTEXT, sizeof(SESSION_CONTEXT) - 1);
+        SSL_CTX_set_session_cache_mode(ssl_ctx_, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ssl_ctx_, static_cast<long>(tls_options_.session_cache_size));
+    } else {
+        SSL_CTX_set_session_cache_mode(ssl_ctx_, SSL_SESS_CACHE_OFF);
+    }
+    SSL_CTX_set_timeout(ssl_ctx_, tls_options_.session_timeout_s);
+    
+    if (tls_options_.ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+        options |= SSL_OP_ENABLE_KTLS;
+#else
+        std::cerr << "Kernel TLS requested but this OpenSSL cannot do it" << std::endl;
+#endif
+    }
+    SSL_CTX_set_options(ssl_ctx_, options);
+    // Idle keep-alive connections give their read and write buffers back
+    SSL_CTX_set_mode(ssl_ctx_, SSL_MODE_RELEASE_BUFFERS);
     
     std::cout << "SSL context initialized successfully" << std::endl;
 }
@@ -53,59 +106,16 @@ void HttpService::cleanup_ssl() {
     }
     EVP_cleanup();
 }
-
-void HttpService::handle_client_ssl(SSL* ssl) {
-    char buffer[65536];
-    int bytes_read = SSL_read(ssl, buffer, sizeof(buffer) - 1);
-    
-    if (bytes_read <= 0) {
-        int ssl_error = SSL_get_error(ssl, bytes_read);
-        if (ssl_error != SSL_ERROR_WANT_READ && ssl_error != SSL_ERROR_WANT_WRITE) {
-            std::cerr << "SSL_read error: " << ssl_error << std::endl;
-        }
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        return;
-    }
-    
-    buffer[bytes_read] = '\0';
-    std::string request_data(buffer);
-    
-    try {
-        HttpRequest request = parse_request(request_data);
-        HttpResponse response;
-        
-        // Find handler for this path
-        auto handler_it = handlers_.find(request.path);
-        if (handler_it != handlers_.end()) {
-            handler_it->second(request, response);
-        } else {
-            response.status_code = 404;
-            response.set_json("{\"error\": \"Not found\"}");
-        }
-        
-        std::string response_str = create_response(response);
-        SSL_write(ssl, response_str.c_str(), response_str.length());
-        
-    } catch (const std::exception& e) {
-        std::string error_response = 
-            "HTTP/1.1 500 Internal Server Error\r\n"
-            "Content-Type: application/json\r\n"
-            "Content-Length: 32\r\n"
-            "\r\n"
-            "{\"error\": \"Internal server error\"}";
-        SSL_write(ssl, error_response.c_str(), error_response.length());
-    }
-    
-    SSL_shutdown(ssl);
-    SSL_free(ssl);
-}
 #endif
 
 void HttpService::add_handler(const std::string& path, HttpHandler handler) {
     handlers_[path] = handler;
 }
 
+void HttpService::add_stream_handler(const std::string& path, HttpStreamHandlerFactory factory) {
+    stream_handlers_[path] = factory;
+}
+
 bool HttpService::start() {
 #ifdef HAVE_OPENSSL
     if (use_tls_) {
@@ -117,7 +127,7 @@ bool HttpService::start() {
     }
 #endif
 
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_fd < 0) {
         std::cerr << "Failed to create socket" << std::endl;
         return false;
@@ -135,6 +145,11 @@ bool HttpService::start() {
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(port_);
+    if (!bind_address_.empty() && inet_pton(AF_INET, bind_address_.c_str(), &address.sin_addr) <= 0) {
+        std::cerr << "Invalid bind address " << bind_address_ << std::endl;
+        close(server_fd);
+        return false;
+    }
 
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         std::cerr << "Failed to bind to port " << port_ << std::endl;
@@ -142,57 +157,88 @@ bool HttpService::start() {
         return false;
     }
 
-    if (listen(server_fd, 10) < 0) {
+    if (listen(server_fd, backlog_) < 0) {
         std::cerr << "Failed to listen on socket" << std::endl;
         close(server_fd);
         return false;
     }
 
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0 || !wakeup_.valid()) {
+        std::cerr << "Failed to create epoll instance" << std::endl;
+        close(server_fd);
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = server_fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, server_fd, &ev);
+    ev.data.fd = wakeup_.fd();
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_.fd(), &ev);
+
+    // Every connection is queued at most once, so this capacity never blocks the loop
+    workers_.reset(new StagePool<std::shared_ptr<HttpConnection>>("HTTP", worker_threads_, max_connections_));
+    workers_->set_thread_start([](size_t index) {
+        ThreadPlacement::global().place("http", index);
+    });
+    workers_->start([this](std::shared_ptr<HttpConnection> conn) {
+        this->serve_connection(conn);
+    });
+
     running_ = true;
-    std::cout << (use_tls_ ? "HTTPS" : "HTTP") << " service started on port " << port_ << std::endl;
+    std::cout << (use_tls_ ? "HTTPS" : "HTTP") << " service started on port " << port_
+              << " (" << worker_threads_ << " workers, backlog " << backlog_ << ")" << std::endl;
 
-    // Accept connections in a loop
+    const int MAX_EVENTS = 64;
+    struct epoll_event events[MAX_EVENTS];
     while (running_) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        int client_socket = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
-        if (client_socket < 0) {
-            if (running_) {
-                std::cerr << "Failed to accept connection" << std::endl;
+        int count = epoll_wait(epoll_fd_, events, MAX_EVENTS, 1000);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            continue;
+            std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
         }
 
-#ifdef HAVE_OPENSSL
-        if (use_tls_) {
-            // Handle SSL connection
-            std::thread([this, client_socket]() {
-                SSL *ssl = SSL_new(this->ssl_ctx_);
-                SSL_set_fd(ssl, client_socket);
-                
-                if (SSL_accept(ssl) <= 0) {
-                    ERR_print_errors_fp(stderr);
-                    SSL_free(ssl);
-                    close(client_socket);
-                    return;
-                }
-                
-                this->handle_client_ssl(ssl);
-                close(client_socket);
-            }).detach();
-        } else {
-#endif
-            // Handle regular HTTP connection
-            std::thread([this, client_socket]() {
-                this->handle_client(client_socket);
-            }).detach();
-#ifdef HAVE_OPENSSL
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server_fd) {
+                accept_connections(server_fd);
+            } else if (fd == wakeup_.fd()) {
+                wakeup_.drain();
+            } else {
+                dispatch_connection(fd);
+            }
         }
-#endif
+
+        close_idle_connections();
     }
 
+    running_ = false;
     close(server_fd);
+
+    // Unblock workers stuck in recv, let them finish, then drop whatever is left
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        for (auto& entry : connections_) {
+            if (entry.second->busy) {
+                shutdown(entry.first, SHUT_RDWR);
+            }
+        }
+    }
+    workers_->stop();
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        for (auto& entry : connections_) {
+            close_connection_locked(*entry.second);
+        }
+        connections_.clear();
+    }
+    workers_.reset();
+    close(epoll_fd_);
+    epoll_fd_ = -1;
     
 #ifdef HAVE_OPENSSL
     if (use_tls_) {
@@ -205,147 +251,577 @@ bool HttpService::start() {
 
 void HttpService::stop() {
     running_ = false;
+    wakeup_.notify();
 }
 
-void HttpService::handle_client(int client_socket) {
-    if (debug_enabled_) std::cout << "[DEBUG] Client connected" << std::endl;
-    std::string request_data;
-    std::string headers;
-    size_t content_length = 0;
-    bool headers_complete = false;
+size_t HttpService::open_connections() {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    return connections_.size();
+}
+
+void HttpService::accept_connections(int server_fd) {
+    while (true) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_socket = accept4(server_fd, (struct sockaddr *)&client_addr, &client_len, SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && running_) {
+                std::cerr << "Failed to accept connection: " << strerror(errno) << std::endl;
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        if (connections_.size() >= max_connections_) {
+            static const char busy[] =
+                "HTTP/1.1 503 Service Unavailable\r\n"
+                "Content-Type: application/json\r\n"
+                "Content-Length: 33\r\n"
+                "Connection: close\r\n"
+                "\r\n"
+                "{\"error\": \"Too many connections\"}";
+            send(client_socket, busy, sizeof(busy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(client_socket);
+            connections_rejected_++;
+            continue;
+        }
+
+        // Workers use blocking I/O bounded by these timeouts
+        struct timeval timeout;
+        timeout.tv_sec = io_timeout_s_;
+        timeout.tv_usec = 0;
+        setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        int nodelay = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        auto conn = std::make_shared<HttpConnection>();
+        conn->fd = client_socket;
+        conn->last_activity = std::chrono::steady_clock::now();
+        connections_[client_socket] = conn;
+        connections_accepted_++;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.fd = client_socket;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_socket, &ev);
+
+        if (debug_enabled_) std::cout << "[DEBUG] Client connected (fd " << client_socket << ")" << std::endl;
+    }
+}
+
+void HttpService::dispatch_connection(int fd) {
+    std::shared_ptr<HttpConnection> conn;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        auto it = connections_.find(fd);
+        if (it == connections_.end() || it->second->busy) {
+            return;
+        }
+        conn = it->second;
+        conn->busy = true;
+    }
+    workers_->submit(conn);
+}
+
+void HttpService::close_idle_connections() {
+    auto now = std::chrono::steady_clock::now();
+    auto limit = std::chrono::seconds(keep_alive_timeout_s_ > 0 ? keep_alive_timeout_s_ : io_timeout_s_);
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    for (auto it = connections_.begin(); it != connections_.end();) {
+        HttpConnection& conn = *it->second;
+        if (!conn.busy && now - conn.last_activity > limit) {
+            if (debug_enabled_) std::cout << "[DEBUG] Closing idle connection (fd " << conn.fd << ")" << std::endl;
+            close_connection_locked(conn);
+            it = connections_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void HttpService::close_connection_locked(HttpConnection& conn) {
+    if (conn.fd < 0) {
+        return;
+    }
+#ifdef HAVE_OPENSSL
+    if (conn.ssl) {
+        SSL_shutdown(conn.ssl);
+        SSL_free(conn.ssl);
+        conn.ssl = nullptr;
+    }
+#endif
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+    close(conn.fd);
+    conn.fd = -1;
+}
+
+void HttpService::release_connection(const std::shared_ptr<HttpConnection>& conn, bool keep_alive) {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    if (keep_alive && running_) {
+        conn->busy = false;
+        conn->last_activity = std::chrono::steady_clock::now();
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.fd = conn->fd;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd, &ev) == 0) {
+            return;
+        }
+    }
+    int fd = conn->fd;
+    close_connection_locked(*conn);
+    connections_.erase(fd);
+}
+
+ssize_t HttpService::connection_recv(HttpConnection& conn, char* buffer, size_t length) {
+#ifdef HAVE_OPENSSL
+    if (conn.ssl) {
+        return SSL_read(conn.ssl, buffer, static_cast<int>(length));
+    }
+#endif
+    ssize_t ret;
+    do {
+        ret = recv(conn.fd, buffer, length, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+bool HttpService::connection_send(HttpConnection& conn, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t ret;
+#ifdef HAVE_OPENSSL
+        if (conn.ssl) {
+            ret = SSL_write(conn.ssl, data.data() + sent, static_cast<int>(data.size() - sent));
+        } else
+#endif
+        ret = send(conn.fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        sent += ret;
+    }
+    return true;
+}
+
+bool HttpService::read_headers(HttpConnection& conn, std::string& header_block) {
+    const size_t MAX_HEADER_SIZE = 64 * 1024;
+    char buffer[16384];
     
-    // First, read headers to determine Content-Length
+    size_t header_end = conn.buffer.find("\r\n\r\n");
+    while (header_end == std::string::npos) {
+        if (conn.buffer.size() > MAX_HEADER_SIZE) {
+            if (debug_enabled_) std::cout << "[DEBUG] Request headers too large" << std::endl;
+            return false;
+        }
+        ssize_t bytes_read = connection_recv(conn, buffer, sizeof(buffer));
+        if (bytes_read <= 0) {
+            if (debug_enabled_ && !conn.buffer.empty()) {
+                std::cout << "[DEBUG] Connection closed or error mid-headers: " << bytes_read << std::endl;
+            }
+            return false;
+        }
+        size_t search_from = conn.buffer.size() >= 3 ? conn.buffer.size() - 3 : 0;
+        conn.buffer.append(buffer, bytes_read);
+        header_end = conn.buffer.find("\r\n\r\n", search_from);
+    }
+    
+    // Whatever follows is the start of the body (or of a pipelined request)
+    header_block = conn.buffer.substr(0, header_end + 4);
+    conn.buffer.erase(0, header_end + 4);
+    return true;
+}
+
+bool HttpService::read_body_chunks(HttpConnection& conn, size_t content_length,
+                                   const std::function<bool(const char*, size_t)>& sink) {
+    size_t remaining = content_length;
+    
+    // Bytes that arrived together with the headers
+    if (!conn.buffer.empty()) {
+        size_t take = std::min(remaining, conn.buffer.size());
+        if (!sink(conn.buffer.data(), take)) {
+            return false;
+        }
+        conn.buffer.erase(0, take);
+        remaining -= take;
+    }
+    
+    char buffer[16384];
+    while (remaining > 0) {
+        ssize_t bytes_read = connection_recv(conn, buffer, std::min(sizeof(buffer), remaining));
+        if (bytes_read <= 0) {
+            if (debug_enabled_) {
+                std::cout << "[DEBUG] Body read error: " << bytes_read << " with "
+                          << remaining << " bytes outstanding" << std::endl;
+            }
+            return false;
+        }
+        if (!sink(buffer, bytes_read)) {
+            return false;
+        }
+        remaining -= bytes_read;
+    }
+    return true;
+}
+
+bool HttpService::read_line(HttpConnection& conn, std::string& line) {
+    const size_t MAX_LINE = 4096;
     char buffer[1024];
-    while (!headers_complete) {
-        if (debug_enabled_) std::cout << "[DEBUG] Reading headers..." << std::endl;
-        ssize_t bytes_read = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+    size_t end = conn.buffer.find("\r\n");
+    while (end == std::string::npos) {
+        if (conn.buffer.size() > MAX_LINE) {
+            return false;
+        }
+        ssize_t bytes_read = connection_recv(conn, buffer, sizeof(buffer));
         if (bytes_read <= 0) {
-            if (debug_enabled_) std::cout << "[DEBUG] Connection closed or error: " << bytes_read << std::endl;
-            close(client_socket);
-            return;
+            return false;
         }
-        
-        if (debug_enabled_) std::cout << "[DEBUG] Read " << bytes_read << " bytes" << std::endl;
-        buffer[bytes_read] = '\0';
-        request_data += buffer;
-        
-        // Check if we have complete headers (ending with \r\n\r\n)
-        size_t header_end = request_data.find("\r\n\r\n");
-        if (header_end != std::string::npos) {
-            headers = request_data.substr(0, header_end + 4);
-            headers_complete = true;
-            if (debug_enabled_) std::cout << "[DEBUG] Headers complete, length: " << headers.length() << std::endl;
-            
-            // Extract Content-Length from headers
-            size_t cl_pos = headers.find("Content-Length:");
-            if (cl_pos != std::string::npos) {
-                size_t cl_start = cl_pos + 15; // strlen("Content-Length:")
-                size_t cl_end = headers.find("\r\n", cl_start);
-                if (cl_end != std::string::npos) {
-                    std::string cl_str = headers.substr(cl_start, cl_end - cl_start);
-                    // Trim whitespace
-                    cl_str.erase(0, cl_str.find_first_not_of(" \t"));
-                    cl_str.erase(cl_str.find_last_not_of(" \t") + 1);
-                    content_length = std::stoul(cl_str);
-                    if (debug_enabled_) {
-                        std::cout << "[DEBUG] Processing " << content_length << " bytes" << std::endl;
-                    }
+        size_t search_from = conn.buffer.empty() ? 0 : conn.buffer.size() - 1;
+        conn.buffer.append(buffer, bytes_read);
+        end = conn.buffer.find("\r\n", search_from);
+    }
+    line = conn.buffer.substr(0, end);
+    conn.buffer.erase(0, end + 2);
+    return true;
+}
+
+bool HttpService::read_chunked_body(HttpConnection& conn, const std::function<bool(const char*, size_t)>& sink) {
+    std::string line;
+    while (true) {
+        // Chunk size in hex, optionally followed by ;extensions
+        if (!read_line(conn, line) || line.empty() || !isxdigit(static_cast<unsigned char>(line[0]))) {
+            if (debug_enabled_) std::cout << "[DEBUG] Bad chunk header" << std::endl;
+            return false;
+        }
+        size_t chunk_size = std::strtoull(line.c_str(), nullptr, 16);
+        if (chunk_size == 0) {
+            // Skip any trailers up to the closing blank line
+            do {
+                if (!read_line(conn, line)) {
+                    return false;
                 }
+            } while (!line.empty());
+            return true;
+        }
+        if (!read_body_chunks(conn, chunk_size, sink)) {
+            return false;
+        }
+        if (!read_line(conn, line) || !line.empty()) {
+            if (debug_enabled_) std::cout << "[DEBUG] Missing CRLF after chunk" << std::endl;
+            return false;
+        }
+    }
+}
+
+bool HttpService::is_chunked(const HttpRequest& request) {
+    for (const auto& header : request.headers) {
+        if (strcasecmp(header.first.c_str(), "Transfer-Encoding") == 0) {
+            return strcasestr(header.second.c_str(), "chunked") != nullptr;
+        }
+    }
+    return false;
+}
+
+bool HttpService::read_body_stream(HttpConnection& conn, const HttpRequest& request,
+                                   const std::function<bool(const char*, size_t)>& sink) {
+    if (is_chunked(request)) {
+        return read_chunked_body(conn, sink);
+    }
+    return read_body_chunks(conn, request_content_length(request), sink);
+}
+
+bool HttpService::read_body(HttpConnection& conn, HttpRequest& request) {
+    size_t content_length = request_content_length(request);
+    if (content_length == 0 && !is_chunked(request)) {
+        return true;
+    }
+    if (debug_enabled_) std::cout << "[DEBUG] Reading body, Content-Length: " << content_length << std::endl;
+    
+    if (request.content_type.find("multipart/form-data") != std::string::npos) {
+        return stream_multipart_body(conn, request, content_length);
+    }
+    
+    request.body.reserve(content_length);
+    return read_body_stream(conn, request, [&request](const char* data, size_t length) {
+        request.body.insert(request.body.end(), data, data + length);
+        return true;
+    });
+}
+
+bool HttpService::serve_stream(HttpConnection& conn, const HttpRequest& request,
+                               const HttpStreamHandlerFactory& factory, HttpResponse& response,
+                               bool& reusable) {
+    std::unique_ptr<HttpStreamHandler> handler = factory();
+    if (!handler || !handler->begin(request, response)) {
+        // Refused before the body; the connection cannot be reused without reading it
+        reusable = request_content_length(request) == 0 && !is_chunked(request);
+        return true;
+    }
+    
+    bool aborted = false;
+    bool received = read_body_stream(conn, request, [&handler, &aborted](const char* data, size_t length) {
+        if (!handler->data(reinterpret_cast<const uint8_t*>(data), length)) {
+            aborted = true;
+            return false;
+        }
+        return true;
+    });
+    handler->end(received, response);
+    
+    // A client that went away gets no response; an aborted upload gets one and is closed
+    reusable = received;
+    return received || aborted;
+}
+
+bool HttpService::stream_multipart_body(HttpConnection& conn, HttpRequest& request, size_t content_length) {
+    const size_t MAX_FIELD_SIZE = 1024 * 1024;
+    
+    MultipartParser parser(MultipartParser::boundary_from_content_type(request.content_type));
+    bool keep_in_memory = upload_buffer_limit_ > 0 && content_length > 0 && content_length <= upload_buffer_limit_;
+    FileUpload* upload = nullptr;
+    ContentHash upload_hash;
+    std::string* field = nullptr;
+    std::ofstream temp_file;
+    std::vector<std::string> temp_paths;
+    
+    parser.on_part_begin = [&](const MultipartParser::Part& part) {
+        if (debug_enabled_) {
+            std::cout << "[HTTP] Found field: " << part.name << (part.filename.empty() ? " (text)" : " (file)") << std::endl;
+        }
+        if (part.filename.empty()) {
+            upload = nullptr;
+            field = &request.form_data[part.name];
+            field->clear();
+            return true;
+        }
+        field = nullptr;
+        upload = &request.file_uploads[part.name];
+        upload->original_filename = part.filename;
+        upload->temp_path.clear();
+        upload->data.reset();
+        upload->hashed = false;
+        upload_hash.reset();
+        if (keep_in_memory) {
+            upload->data = std::make_shared<std::vector<uint8_t>>();
+            upload->data->reserve(content_length);
+            return true;
+        }
+        // TempStore never lets the client's filename pick the directory
+        upload->temp_path = TempStore::global().create("upload_" + part.filename);
+        if (upload->temp_path.empty()) {
+            return false;
+        }
+        temp_paths.push_back(upload->temp_path);
+        temp_file.open(upload->temp_path, std::ios::binary | std::ios::trunc);
+        if (!temp_file) {
+            std::cerr << "[HTTP] Failed to create upload file " << upload->temp_path << std::endl;
+            return false;
+        }
+        request.files[part.name] = upload->temp_path;
+        return true;
+    };
+    parser.on_part_data = [&](const char* data, size_t length) {
+        if (field) {
+            if (field->size() + length > MAX_FIELD_SIZE) {
+                return false;
             }
+            field->append(data, length);
+            return true;
+        }
+        if (upload) {
+            upload_hash.update(data, length);
         }
+        if (upload && temp_file.is_open()) {
+            int64_t write_start = Tracer::now_ns();
+            temp_file.write(data, length);
+            request.temp_write_ns += Tracer::now_ns() - write_start;
+            return static_cast<bool>(temp_file);
+        } else if (upload && upload->data) {
+            upload->data->insert(upload->data->end(), data, data + length);
+        }
+        return true;
+    };
+    parser.on_part_end = [&]() {
+        if (upload) {
+            upload->content_hash = upload_hash.digest();
+            upload->hashed = true;
+        }
+        field = nullptr;
+        upload = nullptr;
+        if (temp_file.is_open()) {
+            int64_t close_start = Tracer::now_ns();
+            temp_file.close();
+            request.temp_write_ns += Tracer::now_ns() - close_start;
+            return !temp_file.fail();
+        }
+        return true;
+    };
+    
+    // Keep reading after a parse error so the connection stays in step with the next request
+    // Parse time excludes the temp file writes made from inside feed()
+    int64_t feed_ns = 0;
+    bool received = read_body_stream(conn, request, [&parser, &feed_ns](const char* data, size_t length) {
+        int64_t feed_start = Tracer::now_ns();
+        parser.feed(data, length);
+        feed_ns += Tracer::now_ns() - feed_start;
+        return true;
+    });
+    request.multipart_parse_ns = feed_ns - request.temp_write_ns;
+    if (temp_file.is_open()) {
+        temp_file.close();
     }
     
-    // Now read the body if Content-Length is specified
-    if (content_length > 0) {
-        if (debug_enabled_) std::cout << "[DEBUG] Reading body, Content-Length: " << content_length << std::endl;
-        if (debug_enabled_) std::cout << "[DEBUG] Total request_data length: " << request_data.length() << std::endl;
-        // Find the actual body start position (after \r\n\r\n)
-        size_t header_end_pos = request_data.find("\r\n\r\n");
-        if (header_end_pos == std::string::npos) {
-            if (debug_enabled_) std::cout << "[DEBUG] Header end not found!" << std::endl;
-            close(client_socket);
+    if (!received || !parser.complete()) {
+        if (debug_enabled_ || received) {
+            std::cout << "[HTTP] Discarding " << (received ? "malformed" : "truncated") << " multipart upload" << std::endl;
+        }
+        for (const auto& path : temp_paths) {
+            TempStore::global().release(path);
+        }
+        request.files.clear();
+        request.file_uploads.clear();
+    }
+    return received;
+}
+
+size_t HttpService::request_content_length(const HttpRequest& request) {
+    for (const auto& header : request.headers) {
+        if (strcasecmp(header.first.c_str(), "Content-Length") == 0) {
+            return std::stoul(header.second);
+        }
+    }
+    return 0;
+}
+
+bool HttpService::wants_keep_alive(const HttpRequest& request, const std::string& request_data) const {
+    if (keep_alive_timeout_s_ <= 0) {
+        return false;
+    }
+    std::string connection;
+    for (const auto& header : request.headers) {
+        if (strcasecmp(header.first.c_str(), "Connection") == 0) {
+            connection = header.second;
+            std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+        }
+    }
+    if (connection.find("close") != std::string::npos) {
+        return false;
+    }
+    // HTTP/1.1 defaults to persistent connections, 1.0 has to ask
+    size_t line_end = request_data.find("\r\n");
+    bool http_11 = request_data.rfind("HTTP/1.1", line_end) != std::string::npos;
+    return http_11 || connection.find("keep-alive") != std::string::npos;
+}
+
+void HttpService::serve_connection(std::shared_ptr<HttpConnection> conn) {
+#ifdef HAVE_OPENSSL
+    if (use_tls_ && !conn->ssl) {
+        conn->ssl = SSL_new(ssl_ctx_);
+        SSL_set_fd(conn->ssl, conn->fd);
+        if (SSL_accept(conn->ssl) <= 0) {
+            ERR_print_errors_fp(stderr);
+            release_connection(conn, false);
             return;
         }
-        if (debug_enabled_) std::cout << "[DEBUG] Header end position: " << header_end_pos << std::endl;
-        size_t body_start = header_end_pos + 4; // Skip past \r\n\r\n
-        if (debug_enabled_) std::cout << "[DEBUG] Body start position: " << body_start << std::endl;
-        size_t body_already_read = request_data.length() - body_start;
-        if (debug_enabled_) std::cout << "[DEBUG] Body already read calculation: " << request_data.length() << " - " << body_start << " = " << body_already_read << std::endl;
-        
-        // Sanity check: if we've already read all the body data, don't try to read more
-        if (body_already_read >= content_length) {
-            if (debug_enabled_) std::cout << "[DEBUG] All body data already read, skipping additional reads" << std::endl;
-        } else {
-            size_t body_remaining = content_length - body_already_read;
-        if (debug_enabled_) std::cout << "[DEBUG] Body already read: " << body_already_read << ", remaining: " << body_remaining << std::endl;
-        
-        // Read remaining body data with timeout
-        struct timeval timeout;
-        timeout.tv_sec = 1;  // 1 second timeout
-        timeout.tv_usec = 0;
+        tls_handshakes_++;
+        if (SSL_session_reused(conn->ssl)) {
+            tls_resumed_++;
+        }
+        // The ClientHello was what woke us; wait for the request itself
+        if (SSL_pending(conn->ssl) == 0) {
+            release_connection(conn, true);
+            return;
+        }
+    }
+#endif
+
+    bool keep_alive = false;
+    do {
+        std::string header_block;
+        if (!read_headers(*conn, header_block)) {
+            release_connection(conn, false);
+            return;
+        }
+        conn->requests_served++;
+        requests_served_++;
         
-        while (body_remaining > 0) {
-            size_t to_read = std::min(body_remaining, sizeof(buffer));
-            if (debug_enabled_) std::cout << "[DEBUG] Reading " << to_read << " bytes of body..." << std::endl;
-            
-            // Set socket timeout
-            fd_set readfds;
-            FD_ZERO(&readfds);
-            FD_SET(client_socket, &readfds);
+        HttpResponse response;
+        std::string range;
+        try {
+            HttpRequest request = parse_request(header_block);
+            request.received_ns = Tracer::now_ns();
+            auto range_it = request.headers.find("Range");
+            if (range_it != request.headers.end() && request.method == "GET") {
+                range = range_it->second;
+            }
             
-            int ready = select(client_socket + 1, &readfds, nullptr, nullptr, &timeout);
-            if (ready <= 0) {
-                if (debug_enabled_) std::cout << "[DEBUG] Socket timeout or error, assuming all data received" << std::endl;
-                break;  // Timeout or error, assume we have all the data
+            // curl and friends wait for this before sending a large upload
+            auto expect = request.headers.find("Expect");
+            if (expect != request.headers.end() && strcasecmp(expect->second.c_str(), "100-continue") == 0) {
+                connection_send(*conn, "HTTP/1.1 100 Continue\r\n\r\n");
             }
+            keep_alive = running_ && wants_keep_alive(request, header_block) &&
+                         conn->requests_served < max_keep_alive_requests_;
             
-            ssize_t bytes_read = recv(client_socket, buffer, to_read, 0);
-            if (bytes_read <= 0) {
-                if (debug_enabled_) std::cout << "[DEBUG] Body read error: " << bytes_read << std::endl;
-                break;  // Connection closed or error, assume we have all the data
+            // Streaming endpoints consume the body themselves
+            auto stream_it = stream_handlers_.find(request.path);
+            if (stream_it != stream_handlers_.end()) {
+                bool reusable = false;
+                if (!serve_stream(*conn, request, stream_it->second, response, reusable)) {
+                    release_connection(conn, false);
+                    return;
+                }
+                keep_alive = keep_alive && reusable;
+            } else if (!read_body(*conn, request)) {
+                release_connection(conn, false);
+                return;
             }
+            request.body_read_ns = Tracer::now_ns();
             
-            if (debug_enabled_) std::cout << "[DEBUG] Read " << bytes_read << " bytes of body" << std::endl;
-            request_data.append(buffer, bytes_read);
-            body_remaining -= bytes_read;
-        }
-        if (debug_enabled_) std::cout << "[DEBUG] Body reading complete" << std::endl;
+            // Find handler for this path; one registered with a trailing '/'
+            // also serves everything below it (e.g. /api/v1/jobs/<id>)
+            auto handler_it = handlers_.find(request.path);
+            if (handler_it == handlers_.end()) {
+                for (auto it = handlers_.begin(); it != handlers_.end(); ++it) {
+                    const std::string& prefix = it->first;
+                    if (!prefix.empty() && prefix.back() == '/' && request.path.compare(0, prefix.size(), prefix) == 0 &&
+                        (handler_it == handlers_.end() || prefix.size() > handler_it->first.size())) {
+                        handler_it = it;
+                    }
+                }
+            }
+            if (stream_it != stream_handlers_.end()) {
+                // Response already filled in by the stream handler
+            } else if (handler_it != handlers_.end()) {
+                handler_it->second(request, response);
+            } else {
+                response.status_code = 404;
+                response.set_json("{\"error\": \"Not found\"}");
+            }
+        } catch (const std::exception& e) {
+            if (debug_enabled_) std::cout << "[DEBUG] Request failed: " << e.what() << std::endl;
+            response = HttpResponse();
+            response.status_code = 500;
+            response.set_json("{\"error\": \"Internal server error\"}");
+            keep_alive = false;
         }
-    }
-    
-    // Only log size mismatches in debug mode
-    if (debug_enabled_ && content_length > 0 && request_data.size() != content_length) {
-        std::cout << "[DEBUG] Size mismatch: received " << request_data.size() 
-                  << " bytes, expected " << content_length << std::endl;
-    }
-    
-    try {
-        HttpRequest request = parse_request(request_data);
-        HttpResponse response;
         
-        // Find handler for this path
-        auto handler_it = handlers_.find(request.path);
-        if (handler_it != handlers_.end()) {
-            handler_it->second(request, response);
-        } else {
-            response.status_code = 404;
-            response.set_json("{\"error\": \"Not found\"}");
+        if (!send_response(*conn, response, range, keep_alive)) {
+            keep_alive = false;
         }
         
-        std::string response_str = create_response(response);
-        send(client_socket, response_str.c_str(), response_str.length(), 0);
-        
-    } catch (const std::exception& e) {
-        std::string error_response = 
-            "HTTP/1.1 500 Internal Server Error\r\n"
-            "Content-Type: application/json\r\n"
-            "Content-Length: 23\r\n"
-            "\r\n"
-            "{\"error\": \"Internal server error\"}";
-        send(client_socket, error_response.c_str(), error_response.length(), 0);
-    }
+        // Serve pipelined requests before going back to epoll, which would
+        // not report bytes we already hold
+#ifdef HAVE_OPENSSL
+    } while (keep_alive && (!conn->buffer.empty() || (conn->ssl && SSL_pending(conn->ssl) > 0)));
+#else
+    } while (keep_alive && !conn->buffer.empty());
+#endif
     
-    close(client_socket);
+    release_connection(conn, keep_alive);
 }
 
 HttpRequest HttpService::parse_request(const std::string& request_data) {
@@ -358,6 +834,13 @@ HttpRequest HttpService::parse_request(const std::string& request_data) {
     if (std::getline(iss, line)) {
         std::istringstream line_iss(line);
         line_iss >> request.method >> request.path;
+        
+        // Route on the path alone
+        size_t query_start = request.path.find('?');
+        if (query_start != std::string::npos) {
+            request.query = request.path.substr(query_start + 1);
+            request.path.erase(query_start);
+        }
     }
     
     // Parse headers
@@ -396,178 +879,183 @@ HttpRequest HttpService::parse_request(const std::string& request_data) {
                 request.body = std::vector<uint8_t>(body_data.begin(), body_data.end());
             }
         }
-        
-        // Parse multipart form data if applicable
-        if (request.content_type.find("multipart/form-data") != std::string::npos) {
-            parse_multipart_form_data(request.content_type, request.body, request);
-        }
     }
     
     return request;
 }
 
-bool HttpService::parse_multipart_form_data(const std::string& content_type, 
-                                           const std::vector<uint8_t>& body, 
-                                           HttpRequest& request) {
-    if (debug_enabled_) std::cout << "[HTTP] Parsing multipart data, content-type: " << content_type << std::endl;
-    if (debug_enabled_) std::cout << "[HTTP] Body size: " << body.size() << " bytes" << std::endl;
-    
-    // Extract boundary from content type
-    std::regex boundary_regex("boundary=([^;\\s]+)");
-    std::smatch match;
-    if (!std::regex_search(content_type, match, boundary_regex)) {
-        if (debug_enabled_) std::cout << "[HTTP] Failed to extract boundary from content-type" << std::endl;
-        return false;
+bool HttpService::connection_send_file(HttpConnection& conn, int fd, uint64_t offset, uint64_t length) {
+#ifdef HAVE_OPENSSL
+#ifdef SSL_OP_ENABLE_KTLS
+    if (conn.ssl && BIO_get_ktls_send(SSL_get_wbio(conn.ssl))) {
+        // The kernel encrypts, so the file can go straight to the socket
+        while (length > 0) {
+            ossl_ssize_t sent = SSL_sendfile(conn.ssl, fd, static_cast<off_t>(offset),
+                                             static_cast<size_t>(std::min<uint64_t>(length, 1 << 30)), 0);
+            if (sent <= 0) {
+                return false;
+            }
+            offset += sent;
+            length -= sent;
+        }
+        return true;
     }
-    
-    std::string boundary = "--" + match[1].str();
-    if (debug_enabled_) std::cout << "[HTTP] Extracted boundary: " << boundary << std::endl;
-    std::string body_str(body.begin(), body.end());
-    
-    // Debug: show raw body content
-    if (debug_enabled_) std::cout << "[HTTP] Raw body content (" << body_str.size() << " bytes):" << std::endl;
-    if (body_str.size() < 500) {
-        if (debug_enabled_) std::cout << "[HTTP] Body: " << body_str << std::endl;
-    } else {
-        if (debug_enabled_) std::cout << "[HTTP] Body (first 500 chars): " << body_str.substr(0, 500) << std::endl;
+#endif
+    if (conn.ssl) {
+        // TLS has to see the bytes, so they go through user space in chunks
+        std::string chunk;
+        while (length > 0) {
+            chunk.resize(static_cast<size_t>(std::min<uint64_t>(length, 64 * 1024)));
+            ssize_t got = pread(fd, &chunk[0], chunk.size(), static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+            chunk.resize(static_cast<size_t>(got));
+            if (!connection_send(conn, chunk)) {
+                return false;
+            }
+            offset += got;
+            length -= got;
+        }
+        return true;
     }
-    
-    // Split by boundary - need to process parts between boundaries
-    size_t start = body_str.find(boundary);
-    if (start == std::string::npos) {
-        if (debug_enabled_) std::cout << "[HTTP] No boundary found in body" << std::endl;
+#endif
+    off_t position = static_cast<off_t>(offset);
+    while (length > 0) {
+        ssize_t sent = sendfile(conn.fd, fd, &position, static_cast<size_t>(std::min<uint64_t>(length, 1 << 30)));
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        length -= sent;
+    }
+    return true;
+}
+
+bool HttpService::parse_range(const std::string& range, uint64_t total, uint64_t& offset, uint64_t& length) {
+    // bytes=FIRST-LAST, bytes=FIRST- or bytes=-SUFFIX
+    size_t dash = range.find('-');
+    if (range.compare(0, 6, "bytes=") != 0 || dash == std::string::npos || dash < 6) {
         return false;
     }
-    
-    if (debug_enabled_) std::cout << "[HTTP] Found boundary at position: " << start << std::endl;
-    if (debug_enabled_) std::cout << "[HTTP] Processing multipart sections..." << std::endl;
-    int part_count = 0;
-    
-    while (start != std::string::npos) {
-        // Find next boundary
-        size_t next_boundary = body_str.find(boundary, start + boundary.length());
-        if (next_boundary == std::string::npos) {
-            // Check for final boundary with --
-            next_boundary = body_str.find(boundary + "--", start + boundary.length());
+    std::string first_str = range.substr(6, dash - 6);
+    std::string last_str = range.substr(dash + 1);
+    auto digits = [](const std::string& text) {
+        return !text.empty() && std::all_of(text.begin(), text.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); });
+    };
+    if (first_str.empty()) {
+        if (!digits(last_str) || total == 0) {
+            return false;
         }
-        
-        if (next_boundary != std::string::npos) {
-            part_count++;
-            if (debug_enabled_) std::cout << "[HTTP] Processing part " << part_count << std::endl;
-            
-            // Extract the part content between boundaries
-            std::string part = body_str.substr(start + boundary.length(), next_boundary - start - boundary.length());
-            
-            if (debug_enabled_) std::cout << "[HTTP] Part " << part_count << " size: " << part.size() << " bytes" << std::endl;
-            if (part.size() > 0 && part.size() < 200) {
-                if (debug_enabled_) std::cout << "[HTTP] Part content (first 200 chars): " << part.substr(0, 200) << std::endl;
+        uint64_t suffix = std::min<uint64_t>(std::strtoull(last_str.c_str(), nullptr, 10), total);
+        if (suffix == 0) {
+            return false;
+        }
+        offset = total - suffix;
+        length = suffix;
+        return true;
+    }
+    if (!digits(first_str) || (!last_str.empty() && !digits(last_str))) {
+        return false;
+    }
+    uint64_t first = std::strtoull(first_str.c_str(), nullptr, 10);
+    uint64_t last = last_str.empty() ? total - 1 : std::min<uint64_t>(std::strtoull(last_str.c_str(), nullptr, 10), total - 1);
+    if (first >= total || last < first) {
+        return false;
+    }
+    offset = first;
+    length = last - first + 1;
+    return true;
+}
+
+bool HttpService::send_response(HttpConnection& conn, HttpResponse& response, const std::string& range, bool keep_alive) {
+    int fd = -1;
+    uint64_t total = response.body.size();
+    if (!response.file_path.empty()) {
+        struct stat info;
+        fd = open(response.file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+            if (fd >= 0) {
+                close(fd);
             }
-            
-            if (!part.empty()) {
-                // Remove leading newlines from part content
-                size_t start_pos = part.find_first_not_of("\r\n");
-                if (start_pos != std::string::npos) {
-                    part = part.substr(start_pos);
-                }
-                
-                // Find headers/content boundary manually to preserve binary data
-                size_t headers_end = part.find("\r\n\r\n");
-                if (headers_end == std::string::npos) {
-                    headers_end = part.find("\n\n");
-                    if (headers_end != std::string::npos) {
-                        headers_end += 2; // Skip \n\n
-                    }
-                } else {
-                    headers_end += 4; // Skip \r\n\r\n
-                }
-                
-                if (headers_end == std::string::npos) {
-                    continue; // Invalid part format
-                }
-                
-                std::string headers_section = part.substr(0, headers_end - 4);
-                std::string content = part.substr(headers_end);
-                
-                std::string name;
-                std::string filename;
-                bool is_file = false;
-                
-                // Parse headers manually to avoid stringstream corruption
-                std::istringstream headers_stream(headers_section);
-                std::string line;
-                while (std::getline(headers_stream, line)) {
-                    // Remove trailing \r if present
-                    if (!line.empty() && line.back() == '\r') {
-                        line.pop_back();
-                    }
-                    
-                    if (debug_enabled_) std::cout << "[HTTP] Header line: '" << line << "'" << std::endl;
-                    if (line.find("Content-Disposition:") != std::string::npos) {
-                        if (debug_enabled_) std::cout << "[HTTP] Found Content-Disposition: " << line << std::endl;
-                        // Extract name and filename
-                        std::smatch name_match;
-                        std::smatch filename_match;
-                        std::regex name_regex("name=\"([^\"]+)\"");
-                        if (std::regex_search(line, name_match, name_regex)) {
-                            name = name_match[1].str();
-                            if (debug_enabled_) std::cout << "[HTTP] Extracted name: " << name << std::endl;
-                        }
-                        
-                        std::regex filename_regex("filename=\"([^\"]+)\"");
-                        if (std::regex_search(line, filename_match, filename_regex)) {
-                            filename = filename_match[1].str();
-                            is_file = true;
-                            if (debug_enabled_) std::cout << "[HTTP] Extracted filename: " << filename << std::endl;
-                        }
-                    }
-                }
-                
-                if (debug_enabled_) std::cout << "[HTTP] Found field: " << name << (is_file ? " (file)" : " (text)") << std::endl;
-                
-                if (is_file) {
-                    // For file uploads, we'll write to a temporary file
-                    std::string temp_filename = "/tmp/trunk_decoder_upload_" + std::to_string(time(nullptr)) + "_" + filename;
-                    std::ofstream temp_file(temp_filename, std::ios::binary);
-                    temp_file.write(content.c_str(), content.length());
-                    temp_file.close();
-                    
-                    // Store both temp path and original filename
-                    request.files[name] = temp_filename;
-                    FileUpload upload;
-                    upload.temp_path = temp_filename;
-                    upload.original_filename = filename;
-                    request.file_uploads[name] = upload;
-                } else {
-                    request.form_data[name] = content;
-                }
+            fd = -1;
+            response = HttpResponse();
+            response.status_code = 500;
+            response.set_json("{\"error\": \"Failed to read response body\"}");
+            total = response.body.size();
+        } else {
+            total = static_cast<uint64_t>(info.st_size);
+        }
+    }
+    
+    // Only one range is honoured; a list of them gets the whole body, which
+    // is an allowed answer
+    uint64_t offset = 0;
+    uint64_t length = total;
+    if (response.accept_ranges && response.status_code == 200) {
+        response.headers["Accept-Ranges"] = "bytes";
+        if (!range.empty() && range.find(',') == std::string::npos) {
+            if (parse_range(range, total, offset, length)) {
+                response.status_code = 206;
+                response.headers["Content-Range"] = "bytes " + std::to_string(offset) + "-" +
+                                                    std::to_string(offset + length - 1) + "/" + std::to_string(total);
+            } else {
+                response.status_code = 416;
+                response.headers["Content-Range"] = "bytes */" + std::to_string(total);
+                offset = 0;
+                length = 0;
             }
         }
-        
-        // Move to next boundary
-        start = next_boundary;
     }
     
-    return true;
+    std::string head = create_response_head(response, length, keep_alive);
+    bool sent;
+    if (fd >= 0) {
+        sent = connection_send(conn, head) && connection_send_file(conn, fd, offset, length);
+        close(fd);
+    } else {
+        head.append(response.body.begin() + offset, response.body.begin() + offset + length);
+        sent = connection_send(conn, head);
+    }
+    return sent;
 }
 
-std::string HttpService::create_response(const HttpResponse& response) {
+std::string HttpService::create_response_head(const HttpResponse& response, uint64_t content_length, bool keep_alive) {
     std::ostringstream oss;
     
     // Status line
     oss << "HTTP/1.1 " << response.status_code;
     switch (response.status_code) {
         case 200: oss << " OK"; break;
+        case 202: oss << " Accepted"; break;
+        case 206: oss << " Partial Content"; break;
         case 400: oss << " Bad Request"; break;
+        case 401: oss << " Unauthorized"; break;
         case 404: oss << " Not Found"; break;
+        case 405: oss << " Method Not Allowed"; break;
+        case 413: oss << " Payload Too Large"; break;
+        case 416: oss << " Range Not Satisfiable"; break;
+        case 429: oss << " Too Many Requests"; break;
         case 500: oss << " Internal Server Error"; break;
+        case 503: oss << " Service Unavailable"; break;
         default: oss << " Unknown"; break;
     }
     oss << "\r\n";
     
     // Headers
     oss << "Content-Type: " << response.content_type << "\r\n";
-    oss << "Content-Length: " << response.body.size() << "\r\n";
-    oss << "Connection: close\r\n";
+    oss << "Content-Length: " << content_length << "\r\n";
+    if (keep_alive) {
+        oss << "Connection: keep-alive\r\n";
+        oss << "Keep-Alive: timeout=" << keep_alive_timeout_s_ << ", max=" << max_keep_alive_requests_ << "\r\n";
+    } else {
+        oss << "Connection: close\r\n";
+    }
     
     for (const auto& header : response.headers) {
         oss << header.first << ": " << header.second << "\r\n";
@@ -575,9 +1063,5 @@ std::string HttpService::create_response(const HttpResponse& response) {
     
     oss << "\r\n";
     
-    // Body
-    std::string response_str = oss.str();
-    response_str.append(response.body.begin(), response.body.end());
-    
-    return response_str;
+    return oss.str();
 }
\ No newline at end of file
@@ -4,6 +4,12 @@
 #include <memory>
 #include <map>
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include "event_notifier.h"
+#include "stage_pool.h"
 
 #ifdef HAVE_OPENSSL
 #include <openssl/ssl.h>
@@ -11,19 +17,46 @@
 #endif
 
 struct FileUpload {
-    std::string temp_path;
+    std::string temp_path;              // empty when the upload was kept in memory
     std::string original_filename;
+    std::shared_ptr<std::vector<uint8_t>> data;  // contents when kept in memory; shareable with a job
+    uint64_t content_hash = 0;          // ContentHash of the contents, computed as they are parsed
+    bool hashed = false;
 };
 
 struct HttpRequest {
     std::string method;
     std::string path;
+    std::string query;             // after '?', not URL-decoded
     std::string content_type;
     std::vector<uint8_t> body;
     std::map<std::string, std::string> headers;
     std::map<std::string, std::string> files; // For multipart form data (temp paths)
     std::map<std::string, FileUpload> file_uploads; // For detailed file info
     std::map<std::string, std::string> form_data;
+    
+    // For tracing (Tracer::now_ns()): headers read, body read, and the parts
+    // of the body read spent parsing multipart and writing temp files
+    int64_t received_ns = 0;
+    int64_t body_read_ns = 0;
+    int64_t multipart_parse_ns = 0;
+    int64_t temp_write_ns = 0;
+    
+    // Raw value of name=... in the query string, "" if absent
+    std::string query_param(const std::string& name) const {
+        size_t pos = 0;
+        while (pos <= query.size()) {
+            size_t end = query.find('&', pos);
+            if (end == std::string::npos) {
+                end = query.size();
+            }
+            if (query.compare(pos, name.size(), name) == 0 && pos + name.size() < end && query[pos + name.size()] == '=') {
+                return query.substr(pos + name.size() + 1, end - pos - name.size() - 1);
+            }
+            pos = end + 1;
+        }
+        return "";
+    }
 };
 
 struct HttpResponse {
@@ -32,6 +65,18 @@ struct HttpResponse {
     std::vector<uint8_t> body;
     std::map<std::string, std::string> headers;
     
+    // Sent from this file instead of body, with sendfile() on plain
+    // connections; see set_file()
+    std::string file_path;
+    // Answer "Range: bytes=..." with 206 and just that part of the body or file
+    bool accept_ranges = false;
+    
+    void set_file(const std::string& path, const std::string& type) {
+        content_type = type;
+        body.clear();
+        file_path = path;
+    }
+    
     void set_json(const std::string& json_str) {
         content_type = "application/json";
         body = std::vector<uint8_t>(json_str.begin(), json_str.end());
@@ -45,48 +90,186 @@ struct HttpResponse {
 
 using HttpHandler = std::function<void(const HttpRequest&, HttpResponse&)>;
 
+// Endpoint that consumes the body while it is still arriving, e.g. a live
+// call pushed with chunked transfer encoding. One instance per request; it
+// holds a worker for as long as the upload lasts.
+class HttpStreamHandler {
+public:
+    virtual ~HttpStreamHandler() = default;
+    
+    // Headers are in; fill response and return false to refuse the body
+    virtual bool begin(const HttpRequest& request, HttpResponse& response) = 0;
+    
+    // Body bytes as they arrive; false aborts the upload
+    virtual bool data(const uint8_t* bytes, size_t length) = 0;
+    
+    // complete is false when the client went away or data() aborted
+    virtual void end(bool complete, HttpResponse& response) = 0;
+};
+
+using HttpStreamHandlerFactory = std::function<std::unique_ptr<HttpStreamHandler>()>;
+
+// One accepted client. The event loop owns the socket while it is idle
+// in epoll; a worker owns it while busy is set.
+struct HttpConnection {
+    int fd = -1;
+    bool busy = false;
+    int requests_served = 0;
+    std::chrono::steady_clock::time_point last_activity;
+    std::string buffer;             // bytes read past the end of the previous request
+#ifdef HAVE_OPENSSL
+    SSL* ssl = nullptr;
+#endif
+};
+
+// TLS tuning, applied to the server's one SSL_CTX at start(). Clients that
+// reconnect resume their session (a ticket, or the server-side cache for
+// clients without ticket support) with one round trip and no key exchange
+// or certificate signature. Cipher order favours AES-GCM, which OpenSSL
+// runs on AES-NI, and falls back to ChaCha20-Poly1305 for clients that
+// list it first because they have no AES hardware.
+struct TlsOptions {
+    bool session_tickets = true;
+    size_t session_cache_size = 20480;     // server-side sessions kept, 0 for no cache
+    int session_timeout_s = 7200;          // how long a session or ticket can be resumed
+    // Kernel TLS for sends (OpenSSL 3 on Linux with the tls module): the
+    // kernel encrypts, so file responses go out with SSL_sendfile() instead
+    // of through user space. Off by default; unused when the cipher or the
+    // kernel cannot do it.
+    bool ktls = false;
+    std::string cipher_list =              // TLS 1.2
+        "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+        "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:"
+        "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305";
+    std::string ciphersuites =             // TLS 1.3
+        "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256";
+};
+
+// Event-loop server: one thread waits in epoll for readable connections and
+// hands each to a fixed pool of workers. Idle keep-alive connections cost a
+// map entry rather than a thread, and are closed after keep_alive_timeout.
 class HttpService {
 private:
     int port_;
-    bool running_;
+    std::string bind_address_;     // empty: all interfaces
+    std::atomic<bool> running_;
     bool use_tls_;
     bool debug_enabled_;
     std::string cert_file_;
     std::string key_file_;
+    TlsOptions tls_options_;
     std::map<std::string, HttpHandler> handlers_;
+    std::map<std::string, HttpStreamHandlerFactory> stream_handlers_;
+    
+    // Server tuning
+    int worker_threads_;
+    int backlog_;
+    size_t max_connections_;
+    int keep_alive_timeout_s_;
+    int max_keep_alive_requests_;
+    int io_timeout_s_;
+    
+    int epoll_fd_;
+    EventNotifier wakeup_;
+    std::mutex connections_mutex_;
+    std::unordered_map<int, std::shared_ptr<HttpConnection>> connections_;
+    std::unique_ptr<StagePool<std::shared_ptr<HttpConnection>>> workers_;
+    std::atomic<uint64_t> connections_accepted_;
+    std::atomic<uint64_t> connections_rejected_;
+    std::atomic<uint64_t> requests_served_;
+    std::atomic<uint64_t> tls_handshakes_;
+    std::atomic<uint64_t> tls_resumed_;
+    size_t upload_buffer_limit_;
     
 #ifdef HAVE_OPENSSL
     SSL_CTX *ssl_ctx_;
     void init_ssl();
     void cleanup_ssl();
-    void handle_client_ssl(SSL* ssl);
 #endif
     
-    void handle_client(int client_socket);
+    void accept_connections(int server_fd);
+    void dispatch_connection(int fd);
+    void close_idle_connections();
+    void serve_connection(std::shared_ptr<HttpConnection> conn);
+    void release_connection(const std::shared_ptr<HttpConnection>& conn, bool keep_alive);
+    void close_connection_locked(HttpConnection& conn);
+    bool read_headers(HttpConnection& conn, std::string& header_block);
+    bool read_body(HttpConnection& conn, HttpRequest& request);
+    bool read_line(HttpConnection& conn, std::string& line);
+    bool read_chunked_body(HttpConnection& conn, const std::function<bool(const char*, size_t)>& sink);
+    bool read_body_stream(HttpConnection& conn, const HttpRequest& request,
+                          const std::function<bool(const char*, size_t)>& sink);
+    bool serve_stream(HttpConnection& conn, const HttpRequest& request,
+                      const HttpStreamHandlerFactory& factory, HttpResponse& response, bool& reusable);
+    static bool is_chunked(const HttpRequest& request);
+    bool read_body_chunks(HttpConnection& conn, size_t content_length,
+                          const std::function<bool(const char*, size_t)>& sink);
+    bool stream_multipart_body(HttpConnection& conn, HttpRequest& request, size_t content_length);
+    static size_t request_content_length(const HttpRequest& request);
+    ssize_t connection_recv(HttpConnection& conn, char* buffer, size_t length);
+    bool connection_send(HttpConnection& conn, const std::string& data);
+    bool connection_send_file(HttpConnection& conn, int fd, uint64_t offset, uint64_t length);
+    // Turn a single satisfiable byte range into offset/length (and 206); false if unsatisfiable
+    static bool parse_range(const std::string& range, uint64_t total, uint64_t& offset, uint64_t& length);
+    bool send_response(HttpConnection& conn, HttpResponse& response, const std::string& range, bool keep_alive);
+    bool wants_keep_alive(const HttpRequest& request, const std::string& request_data) const;
     HttpRequest parse_request(const std::string& request_data);
-    std::string create_response(const HttpResponse& response);
-    bool parse_multipart_form_data(const std::string& content_type, 
-                                  const std::vector<uint8_t>& body, 
-                                  HttpRequest& request);
+    std::string create_response_head(const HttpResponse& response, uint64_t content_length, bool keep_alive);
     
 public:
-    HttpService(int port) : port_(port), running_(false), use_tls_(false), debug_enabled_(false) {
+    HttpService(int port) : port_(port), running_(false), use_tls_(false), debug_enabled_(false),
+                            worker_threads_(8), backlog_(128), max_connections_(256),
+                            keep_alive_timeout_s_(15), max_keep_alive_requests_(1000), io_timeout_s_(10),
+                            epoll_fd_(-1), connections_accepted_(0), connections_rejected_(0), requests_served_(0),
+                            tls_handshakes_(0), tls_resumed_(0), upload_buffer_limit_(0) {
 #ifdef HAVE_OPENSSL
         ssl_ctx_ = nullptr;
 #endif
     }
     
     void add_handler(const std::string& path, HttpHandler handler);
+    void add_stream_handler(const std::string& path, HttpStreamHandlerFactory factory);
     bool start();
     void stop();
     bool is_running() const { return running_; }
     
+    // IPv4 address to listen on; only takes effect on the next start()
+    void set_bind_address(const std::string& address) { bind_address_ = address == "0.0.0.0" ? "" : address; }
+    
+    // Server tuning; only takes effect on the next start()
+    void configure_server(int worker_threads, int backlog, size_t max_connections) {
+        worker_threads_ = worker_threads > 0 ? worker_threads : 1;
+        backlog_ = backlog > 0 ? backlog : 128;
+        max_connections_ = max_connections > 0 ? max_connections : 1;
+    }
+    
+    // timeout_s 0 disables keep-alive; io_timeout_s bounds each read/write on a busy connection
+    void configure_keep_alive(int timeout_s, int max_requests, int io_timeout_s = 10) {
+        keep_alive_timeout_s_ = timeout_s >= 0 ? timeout_s : 0;
+        max_keep_alive_requests_ = max_requests > 0 ? max_requests : 1;
+        io_timeout_s_ = io_timeout_s > 0 ? io_timeout_s : 10;
+    }
+    
+    // Multipart requests up to this size keep their files in FileUpload::data
+    // instead of a TempStore file; 0 always spools uploads
+    void set_upload_buffer_limit(size_t bytes) { upload_buffer_limit_ = bytes; }
+    
+    size_t open_connections();
+    uint64_t connections_accepted() const { return connections_accepted_.load(); }
+    uint64_t connections_rejected() const { return connections_rejected_.load(); }
+    uint64_t requests_served() const { return requests_served_.load(); }
+    // Completed TLS handshakes, and how many of them resumed a session
+    uint64_t tls_handshakes() const { return tls_handshakes_.load(); }
+    uint64_t tls_resumed() const { return tls_resumed_.load(); }
+    
     // TLS configuration
     void enable_tls(const std::string& cert_file, const std::string& key_file) {
         cert_file_ = cert_file;
         key_file_ = key_file;
         use_tls_ = true;
     }
+    // Only takes effect on the next start()
+    void configure_tls(const TlsOptions& options) { tls_options_ = options; }
     
     // Debug configuration
     void enable_debug(bool enable = true) {
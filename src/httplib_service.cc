@@ -1,4 +1,5 @@
 #include "httplib_service.h"
+#include "metrics.h"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -21,6 +22,10 @@ HttplibService::HttplibService(int port, const std::string& output_dir, bool ver
         this->handle_status_request(req, res);
     });
     
+    server_->Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(MetricsRegistry::global().exposition(), "text/plain; version=0.0.4");
+    });
+    
     // Enable CORS if needed
     server_->set_pre_routing_handler([](const httplib::Request& req, httplib::Response& res) {
         res.set_header("Access-Control-Allow-Origin", "*");
@@ -180,37 +185,17 @@ void HttplibService::handle_decode_request(const httplib::Request& req, httplib:
             }
         }
         
-        // Create temporary file from uploaded content
-        std::string temp_filename = "/tmp/trunk_decoder_" + std::to_string(std::time(nullptr)) + "_" + p25_file.filename;
-        std::ofstream temp_file(temp_filename, std::ios::binary);
-        temp_file.write(p25_file.content.c_str(), p25_file.content.size());
-        temp_file.close();
-        
-        // Verify file size matches uploaded content
-        std::ifstream check_file(temp_filename, std::ios::binary | std::ios::ate);
-        size_t written_size = check_file.tellg();
-        check_file.close();
-        
-        if (verbose_) {
-            std::cout << "[API] File written: " << written_size << " bytes (expected " << p25_file.content.size() << " bytes)" << std::endl;
-        }
-        
-        if (written_size != p25_file.content.size()) {
-            std::cout << "[API] WARNING: File size mismatch! Expected " << p25_file.content.size() 
-                      << " bytes, wrote " << written_size << " bytes" << std::endl;
-        }
-        
         // Generate output filenames
         std::string base_filename = "api_call_" + std::to_string(std::time(nullptr));
         std::string output_base = output_dir_ + "/" + base_filename;
         std::string wav_file = output_base + ".wav";
         std::string json_file = output_base + ".json";
         
-        // Process the P25 file
-        if (!decoder_.open_p25_file(temp_filename)) {
+        // Decode straight from the uploaded content, no temp file round trip
+        const uint8_t* p25_data = reinterpret_cast<const uint8_t*>(p25_file.content.data());
+        if (!decoder_.open_p25_buffer(p25_data, p25_file.content.size(), p25_file.filename)) {
             res.status = 400;
             res.set_content("{\"error\": \"Failed to open P25 file\"}", "application/json");
-            cleanup_temp_file(temp_filename);
             return;
         }
         
@@ -218,7 +203,6 @@ void HttplibService::handle_decode_request(const httplib::Request& req, httplib:
         if (!decoder_.decode_to_audio(output_base)) {
             res.status = 500;
             res.set_content("{\"error\": \"Failed to decode P25 file\"}", "application/json");
-            cleanup_temp_file(temp_filename);
             return;
         }
         
@@ -261,9 +245,6 @@ void HttplibService::handle_decode_request(const httplib::Request& req, httplib:
             std::cout << "[API] Successfully processed P25 file" << std::endl;
         }
         
-        // Cleanup
-        cleanup_temp_file(temp_filename);
-        
     } catch (const std::exception& e) {
         res.status = 500;
         std::ostringstream error_json;
@@ -0,0 +1,184 @@
+#include "imbe_archive.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char ARCHIVE_MAGIC[8] = {'P', '2', '5', 'I', 'M', 'B', 'E', '1'};
+
+// Record layout: kind, flags (bit 0 new transmission), bad frames, repeat
+// run (capped at 255; concealment mutes past 15 anyway), the nine 2-bit
+// decisions in three bytes, one spare byte, then per codeword the 88 bits
+// of u0..u7 in the usual packed order (as imbe_pack() builds them), E0 and ET
+static const size_t CODEWORD_BYTES = 13;
+static const size_t CODEWORDS_OFFSET = 8;
+
+static void put_le(uint8_t* out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+void ImbeArchive::pack(const VoiceWork& work, uint8_t* out) {
+    memset(out, 0, RECORD_BYTES);
+    out[0] = work.kind;
+    out[1] = work.new_transmission ? 1 : 0;
+    out[2] = static_cast<uint8_t>(std::min(255, std::max(0, work.bad_frames)));
+    out[3] = static_cast<uint8_t>(std::min(255, std::max(0, work.repeat_run)));
+    uint32_t decisions = 0;
+    for (int i = 0; i < VoiceWork::FRAMES; i++) {
+        decisions |= static_cast<uint32_t>(work.decisions[i] & 0x3) << (2 * i);
+    }
+    put_le(out + 4, decisions, 3);
+
+    for (int i = 0; i < VoiceWork::FRAMES; i++) {
+        const uint32_t* u = work.u[i];
+        uint8_t* cw = out + CODEWORDS_OFFSET + i * CODEWORD_BYTES;
+        cw[0] = u[0] >> 4;
+        cw[1] = ((u[0] & 0xf) << 4) | (u[1] >> 8);
+        cw[2] = u[1] & 0xff;
+        cw[3] = u[2] >> 4;
+        cw[4] = ((u[2] & 0xf) << 4) | (u[3] >> 8);
+        cw[5] = u[3] & 0xff;
+        cw[6] = u[4] >> 3;
+        cw[7] = ((u[4] & 0x7) << 5) | (u[5] >> 6);
+        cw[8] = ((u[5] & 0x3f) << 2) | (u[6] >> 9);
+        cw[9] = (u[6] >> 1) & 0xff;
+        cw[10] = ((u[6] & 0x1) << 7) | ((u[7] >> 1) & 0x7f);
+        cw[11] = static_cast<uint8_t>(std::min<uint32_t>(255, work.E0[i]));
+        cw[12] = static_cast<uint8_t>(std::min<uint32_t>(255, work.ET[i]));
+    }
+}
+
+void ImbeArchive::unpack(const uint8_t* in, VoiceWork& work) {
+    work.kind = in[0] <= VoiceWork::LDU ? static_cast<VoiceWork::Kind>(in[0]) : VoiceWork::SKIPPED;
+    work.new_transmission = (in[1] & 1) != 0;
+    work.bad_frames = in[2];
+    work.repeat_run = in[3];
+    uint32_t decisions = static_cast<uint32_t>(get_le(in + 4, 3));
+    for (int i = 0; i < VoiceWork::FRAMES; i++) {
+        uint32_t decision = (decisions >> (2 * i)) & 0x3;
+        work.decisions[i] = decision <= VoiceQuality::MUTE ? static_cast<VoiceQuality::Decision>(decision)
+                                                           : VoiceQuality::MUTE;
+    }
+
+    for (int i = 0; i < VoiceWork::FRAMES; i++) {
+        const uint8_t* cw = in + CODEWORDS_OFFSET + i * CODEWORD_BYTES;
+        uint32_t* u = work.u[i];
+        u[0] = (cw[0] << 4) | ((cw[1] & 0xf0) >> 4);
+        u[1] = ((cw[1] & 0xf) << 8) | cw[2];
+        u[2] = (cw[3] << 4) | ((cw[4] & 0xf0) >> 4);
+        u[3] = ((cw[4] & 0xf) << 8) | cw[5];
+        u[4] = (cw[6] << 3) | ((cw[7] & 0xe0) >> 5);
+        u[5] = ((cw[7] & 0x1f) << 6) | (cw[8] >> 2);
+        u[6] = ((cw[8] & 0x3) << 9) | (cw[9] << 1) | ((cw[10] & 0x80) >> 7);
+        // Bit 0 of u7 is kept free, as the FEC decoder leaves it
+        u[7] = (cw[10] & 0x7f) << 1;
+        work.E0[i] = cw[11];
+        work.ET[i] = cw[12];
+    }
+}
+
+bool ImbeArchive::write(const std::string& path, const std::vector<VoiceWork>& voice, const std::string& metadata_json) {
+    const size_t metadata_offset = HEADER_BYTES + voice.size() * RECORD_BYTES;
+    std::vector<uint8_t> out(metadata_offset + metadata_json.size(), 0);
+    memcpy(out.data(), ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    put_le(out.data() + 8, HEADER_BYTES, 4);
+    put_le(out.data() + 12, RECORD_BYTES, 4);
+    put_le(out.data() + 16, voice.size(), 8);
+    put_le(out.data() + 24, metadata_offset, 8);
+    put_le(out.data() + 32, metadata_json.size(), 8);
+    put_le(out.data() + 40, VoiceWork::FRAMES * VoiceWork::SAMPLES_PER_FRAME, 4);
+    for (size_t i = 0; i < voice.size(); i++) {
+        pack(voice[i], out.data() + HEADER_BYTES + i * RECORD_BYTES);
+    }
+    memcpy(out.data() + metadata_offset, metadata_json.data(), metadata_json.size());
+
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.write(reinterpret_cast<const char*>(out.data()), out.size())) {
+            return false;
+        }
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ImbeArchive::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) < HEADER_BYTES) {
+        ::close(fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    base_ = static_cast<const uint8_t*>(addr);
+    size_ = static_cast<size_t>(st.st_size);
+
+    // Later versions may grow the header or the records; this one reads its own fields
+    uint64_t header_bytes = get_le(base_ + 8, 4);
+    uint64_t record_bytes = get_le(base_ + 12, 4);
+    uint64_t records = get_le(base_ + 16, 8);
+    uint64_t metadata_offset = get_le(base_ + 24, 8);
+    uint64_t metadata_bytes = get_le(base_ + 32, 8);
+    bool valid = memcmp(base_, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) == 0 &&
+                 header_bytes >= HEADER_BYTES && record_bytes >= RECORD_BYTES &&
+                 records <= (size_ - header_bytes) / record_bytes &&
+                 metadata_offset >= header_bytes + records * record_bytes &&
+                 metadata_offset <= size_ && metadata_bytes <= size_ - metadata_offset;
+    if (!valid || header_bytes != HEADER_BYTES || record_bytes != RECORD_BYTES) {
+        close();
+        return false;
+    }
+    records_ = static_cast<size_t>(records);
+    metadata_offset_ = static_cast<size_t>(metadata_offset);
+    metadata_bytes_ = static_cast<size_t>(metadata_bytes);
+    madvise(addr, size_, MADV_SEQUENTIAL);
+    return true;
+}
+
+void ImbeArchive::close() {
+    if (base_) {
+        munmap(const_cast<uint8_t*>(base_), size_);
+    }
+    base_ = nullptr;
+    size_ = 0;
+    records_ = 0;
+    metadata_offset_ = 0;
+    metadata_bytes_ = 0;
+}
+
+void ImbeArchive::read(size_t index, VoiceWork& work) const {
+    unpack(base_ + HEADER_BYTES + index * RECORD_BYTES, work);
+}
+
+std::string ImbeArchive::metadata_json() const {
+    if (!base_) {
+        return "";
+    }
+    return std::string(reinterpret_cast<const char*>(base_ + metadata_offset_), metadata_bytes_);
+}
@@ -3,6 +3,11 @@
  * Manages input plugins for receiving P25 TSBK data
  * 
  * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Plugins that expose a readiness fd (get_event_fd) are served by a single
+ * dispatcher thread blocked in epoll_wait: it only wakes when an input
+ * has queued data and hands each packet to the data callback. Plugins
+ * without one keep calling the callback from their own threads.
  */
 
 #pragma once
@@ -12,7 +17,15 @@
 #include <memory>
 #include <string>
 #include <functional>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
 #include <dlfcn.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "event_notifier.h"
 
 class InputPluginManager {
 private:
@@ -29,11 +42,22 @@ private:
     };
     
     std::vector<InputPluginInfo> plugins_;
-    std::function<void(P25_TSBK_Data)> data_callback_;
+    std::function<void(const P25_TSBK_Data&)> data_callback_;
     bool verbose_;
     
+    // Event-driven dispatch
+    static constexpr size_t DISPATCH_BATCH = 64;  // packets per plugin before moving on
+    int epoll_fd_;
+    EventNotifier dispatcher_wakeup_;
+    std::thread dispatcher_thread_;
+    std::atomic<bool> dispatching_;
+    std::atomic<uint64_t> dispatch_wakeups_;
+    std::atomic<uint64_t> packets_dispatched_;
+    
 public:
-    InputPluginManager(bool verbose = false) : verbose_(verbose) {}
+    InputPluginManager(bool verbose = false)
+        : verbose_(verbose), epoll_fd_(-1), dispatching_(false),
+          dispatch_wakeups_(0), packets_dispatched_(0) {}
     
     ~InputPluginManager() {
         stop_all();
@@ -81,11 +105,13 @@ public:
                 std::cout << "[InputPluginManager] Started plugin: " << plugin_info.name << std::endl;
             }
         }
-        return 0;
+        return start_dispatcher();
     }
     
     // Stop all plugins
     int stop_all() {
+        stop_dispatcher();
+        
         for (auto& plugin_info : plugins_) {
             if (plugin_info.plugin) {
                 plugin_info.plugin->stop();
@@ -102,16 +128,24 @@ public:
     }
     
     // Set data callback for all plugins
-    void set_data_callback(std::function<void(P25_TSBK_Data)> callback) {
+    void set_data_callback(std::function<void(const P25_TSBK_Data&)> callback) {
         data_callback_ = callback;
         
         for (auto& plugin_info : plugins_) {
-            if (plugin_info.plugin) {
+            if (plugin_info.plugin && plugin_info.plugin->get_event_fd() < 0) {
                 plugin_info.plugin->set_data_callback(callback);
             }
         }
     }
     
+    json get_dispatch_stats() const {
+        json stats;
+        stats["running"] = dispatching_.load();
+        stats["wakeups"] = dispatch_wakeups_.load();
+        stats["packets_dispatched"] = packets_dispatched_.load();
+        return stats;
+    }
+    
     // Get statistics from all plugins
     json get_all_stats() {
         json all_stats = json::array();
@@ -149,6 +183,17 @@ public:
         return names;
     }
     
+    // Names loaded plugins stamp on their packets (P25_TSBK_Data::source_name)
+    std::vector<std::string> get_source_names() {
+        std::vector<std::string> names;
+        for (const auto& plugin_info : plugins_) {
+            if (plugin_info.plugin && plugin_info.enabled) {
+                names.push_back(plugin_info.plugin->get_plugin_name());
+            }
+        }
+        return names;
+    }
+    
     // Get data from the first plugin that has it
     P25_TSBK_Data get_data() {
         for (auto& plugin_info : plugins_) {
@@ -160,6 +205,138 @@ public:
     }
     
 private:
+    int start_dispatcher() {
+        if (dispatching_ || !data_callback_) {
+            return 0;
+        }
+        
+        std::vector<size_t> event_plugins;
+        for (size_t i = 0; i < plugins_.size(); i++) {
+            if (plugins_[i].plugin && plugins_[i].enabled && plugins_[i].plugin->get_event_fd() >= 0) {
+                event_plugins.push_back(i);
+            }
+        }
+        if (event_plugins.empty()) {
+            return 0;
+        }
+        
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0 || !dispatcher_wakeup_.valid()) {
+            std::cerr << "[InputPluginManager] Failed to create dispatcher: " << strerror(errno) << std::endl;
+            close_epoll();
+            return -1;
+        }
+        
+        // event.data.u64 is the plugin index; the wakeup fd uses plugins_.size()
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = plugins_.size();
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, dispatcher_wakeup_.fd(), &event) != 0) {
+            std::cerr << "[InputPluginManager] epoll_ctl failed: " << strerror(errno) << std::endl;
+            close_epoll();
+            return -1;
+        }
+        for (size_t index : event_plugins) {
+            event.data.u64 = index;
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, plugins_[index].plugin->get_event_fd(), &event) != 0) {
+                std::cerr << "[InputPluginManager] epoll_ctl failed for " << plugins_[index].name
+                          << ": " << strerror(errno) << std::endl;
+                close_epoll();
+                return -1;
+            }
+        }
+        
+        dispatching_ = true;
+        dispatcher_thread_ = std::thread(&InputPluginManager::dispatcher_worker, this);
+        
+        if (verbose_) {
+            std::cout << "[InputPluginManager] Dispatcher watching " << event_plugins.size()
+                      << " event-driven input(s)" << std::endl;
+        }
+        return 0;
+    }
+    
+    void stop_dispatcher() {
+        if (dispatching_) {
+            dispatching_ = false;
+            dispatcher_wakeup_.notify();
+            if (dispatcher_thread_.joinable()) {
+                dispatcher_thread_.join();
+            }
+        }
+        close_epoll();
+    }
+    
+    void close_epoll() {
+        if (epoll_fd_ >= 0) {
+            close(epoll_fd_);
+            epoll_fd_ = -1;
+        }
+    }
+    
+    void dispatcher_worker() {
+        const size_t wakeup_index = plugins_.size();
+        std::vector<struct epoll_event> events(plugins_.size() + 1);
+        std::vector<bool> pending(plugins_.size(), false);
+        size_t pending_count = 0;
+        
+        while (dispatching_) {
+            // Sleep only when every input has been drained
+            int count = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()),
+                                   pending_count > 0 ? 0 : -1);
+            if (count < 0) {
+                if (errno != EINTR) {
+                    std::cerr << "[InputPluginManager] epoll_wait error: " << strerror(errno) << std::endl;
+                    break;
+                }
+                continue;
+            }
+            
+            for (int i = 0; i < count; i++) {
+                size_t index = events[i].data.u64;
+                if (index == wakeup_index) {
+                    dispatcher_wakeup_.drain();
+                    continue;
+                }
+                // Reset the counter before draining, so later notifies wake us again
+                EventNotifier::drain(plugins_[index].plugin->get_event_fd());
+                if (!pending[index]) {
+                    pending[index] = true;
+                    pending_count++;
+                }
+            }
+            if (count > 0) {
+                dispatch_wakeups_++;
+            }
+            
+            // Round-robin a bounded batch from each ready input so one busy
+            // source cannot starve the others
+            for (size_t index = 0; index < pending.size() && dispatching_; index++) {
+                if (!pending[index]) {
+                    continue;
+                }
+                auto& plugin = plugins_[index].plugin;
+                size_t delivered = 0;
+                while (delivered < DISPATCH_BATCH && plugin->has_data()) {
+                    P25_TSBK_Data data = plugin->get_data();
+                    delivered++;
+                    try {
+                        data_callback_(data);
+                    } catch (const std::exception& e) {
+                        std::cerr << "[InputPluginManager] Data callback failed for "
+                                  << plugins_[index].name << ": " << e.what() << std::endl;
+                    }
+                }
+                packets_dispatched_ += delivered;
+                if (delivered < DISPATCH_BATCH) {
+                    pending[index] = false;
+                    pending_count--;
+                }
+            }
+        }
+    }
+    
     int load_plugin(InputPluginInfo& plugin_info) {
         if (verbose_) {
             std::cout << "[InputPluginManager] Loading plugin: " << plugin_info.name 
@@ -204,8 +381,9 @@ private:
                 return -1;
             }
             
-            // Set data callback if we have one
-            if (data_callback_) {
+            // Set data callback if we have one; event-driven plugins are
+            // served by the dispatcher instead
+            if (data_callback_ && plugin_info.plugin->get_event_fd() < 0) {
                 plugin_info.plugin->set_data_callback(data_callback_);
             }
             
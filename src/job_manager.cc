@@ -3,17 +3,147 @@
  */
 
 #include "job_manager.h"
-#include <iostream>
+#include "plugin_api.h"
+#include "audio_encoder.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "pcm_stream.h"
+#include "trunking_state.h"
+#include "call_enrichment.h"
+#include "stage_profiler.h"
+#include "alloc_stats.h"
+#include "thread_placement.h"
+#include "temp_store.h"
+#include "logger.h"
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <chrono>
 #include <random>
 #include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+
+bool write_buffer(const std::vector<uint8_t>& data, const std::string& path) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(file);
+}
+
+} // namespace
+
+const char* pipeline_stage_name(PipelineStage stage) {
+    switch (stage) {
+        case PipelineStage::DECODE: return "decode";
+        case PipelineStage::ENCODE: return "encode";
+        case PipelineStage::DISPATCH: return "dispatch";
+        case PipelineStage::UPLOAD: return "upload";
+        default: return "unknown";
+    }
+}
+
+namespace {
+
+// Exported on /metrics. Unlike JobStats these never reset, as Prometheus
+// counters must not go backwards.
+struct JobMetrics {
+    MetricsRegistry::Counter& completed;
+    MetricsRegistry::Counter& failed;
+    MetricsRegistry::Counter& overloaded;
+    MetricsRegistry::Counter& throttled;
+    MetricsRegistry::Counter* timed_out[static_cast<int>(PipelineStage::COUNT)];
+    MetricsRegistry::Histogram& queue_wait;
+    MetricsRegistry::Histogram& total;
+    MetricsRegistry::Histogram* stage[static_cast<int>(PipelineStage::COUNT)];
+    MetricsRegistry::Counter& allocations;
+    MetricsRegistry::Counter& allocated_bytes;
+    MetricsRegistry::Gauge& queue_depth;
+    MetricsRegistry::Gauge& urgent_queue_depth;
+    MetricsRegistry::Gauge& active_workers;
+    MetricsRegistry::Gauge& workers;
+    MetricsRegistry::Counter& workers_added;
+    MetricsRegistry::Counter& workers_retired;
+    MetricsRegistry::Gauge* stage_queue_depth[static_cast<int>(PipelineStage::COUNT)];
+    MetricsRegistry::Gauge& encode_complexity;
+
+    explicit JobMetrics(MetricsRegistry& registry)
+        : completed(registry.counter("trunk_decoder_jobs_total", "Jobs finished, by result", "result=\"completed\"")),
+          failed(registry.counter("trunk_decoder_jobs_total", "Jobs finished, by result", "result=\"failed\"")),
+          overloaded(registry.counter("trunk_decoder_jobs_refused_total", "Jobs refused by admission control",
+                                      "reason=\"overloaded\"")),
+          throttled(registry.counter("trunk_decoder_jobs_refused_total", "Jobs refused by admission control",
+                                     "reason=\"throttled\"")),
+          queue_wait(registry.histogram("trunk_decoder_job_queue_wait_seconds", "Time jobs waited before decode")),
+          total(registry.histogram("trunk_decoder_job_duration_seconds", "Time from job receipt to completion")),
+          allocations(registry.counter("trunk_decoder_job_allocations_total",
+                                       "Heap allocations made by finished jobs (allocation-counting builds)")),
+          allocated_bytes(registry.counter("trunk_decoder_job_allocated_bytes_total",
+                                           "Bytes heap-allocated by finished jobs (allocation-counting builds)")),
+          queue_depth(registry.gauge("trunk_decoder_job_queue_depth", "Jobs waiting for a decode worker")),
+          urgent_queue_depth(registry.gauge("trunk_decoder_job_urgent_queue_depth",
+                                            "Emergency and high-priority jobs waiting for a decode worker")),
+          active_workers(registry.gauge("trunk_decoder_decode_workers_busy", "Decode workers processing a job")),
+          workers(registry.gauge("trunk_decoder_decode_workers", "Decode worker threads running")),
+          workers_added(registry.counter("trunk_decoder_decode_worker_changes_total",
+                                         "Decode workers started or retired by the autoscaler", "change=\"added\"")),
+          workers_retired(registry.counter("trunk_decoder_decode_worker_changes_total",
+                                           "Decode workers started or retired by the autoscaler", "change=\"retired\"")),
+          encode_complexity(registry.gauge("trunk_decoder_encode_complexity",
+                                           "Encoder complexity the encode policy last chose (-1 when off)")) {
+        for (int i = 0; i < static_cast<int>(PipelineStage::COUNT); ++i) {
+            std::string label = std::string("stage=\"") + pipeline_stage_name(static_cast<PipelineStage>(i)) + "\"";
+            stage[i] = &registry.histogram("trunk_decoder_stage_duration_seconds", "Time jobs spent in each stage", label);
+            stage_queue_depth[i] = &registry.gauge("trunk_decoder_stage_queue_depth",
+                                                   "Jobs waiting for each pipeline stage", label);
+            timed_out[i] = &registry.counter("trunk_decoder_jobs_timed_out_total",
+                                             "Jobs failed at the job timeout, by the stage they were in", label);
+        }
+    }
+
+    static JobMetrics& get() {
+        static JobMetrics metrics(MetricsRegistry::global());
+        return metrics;
+    }
+};
+
+} // namespace
 
 JobManager::JobManager(int max_workers, int max_queue_size, int timeout_ms, bool verbose)
-    : shutdown_requested_(false), jobs_queued_(0), jobs_completed_(0), jobs_failed_(0), active_workers_(0),
-      max_worker_threads_(max_workers), max_queue_size_(max_queue_size), job_timeout_ms_(timeout_ms), verbose_(verbose) {
+    : next_queue_(0), pending_jobs_(0), urgent_pending_(0), sleeping_workers_(0), searching_workers_(0),
+      worker_target_(max_workers > 0 ? max_workers : 1), shutdown_requested_(false), numa_nodes_(1),
+      autoscale_stop_(false), decode_time_us_(0), workers_added_(0), workers_retired_(0),
+      jobs_queued_(0), jobs_completed_(0), jobs_failed_(0), active_workers_(0), jobs_stolen_(0),
+      deadline_misses_(0), jobs_overloaded_(0), jobs_throttled_(0), jobs_timed_out_(0),
+      max_worker_threads_(max_workers > 0 ? max_workers : 1), max_queue_size_(max_queue_size),
+      job_timeout_ms_(timeout_ms), verbose_(verbose), persist_encoded_audio_(true), output_sample_rate_(8000), segment_threads_(1),
+      job_tracker_(DEFAULT_JOB_TTL, DEFAULT_MAX_FINISHED_JOBS), jobs_evicted_(0), vocoder_(VoiceSynth::FIXED_POINT),
+      scripts_("upload", 4, static_cast<size_t>(max_queue_size > 0 ? max_queue_size : 1)) {
+    for (auto& count : jobs_by_class_) {
+        count = 0;
+    }
+    // A queued job should not wait longer than a job is allowed to run
+    if (job_timeout_ms_ > 0) {
+        AdmissionPolicy admission;
+        admission.max_queue_delay_s = job_timeout_ms_ / 1000.0;
+        admission_.set_policy(admission);
+    }
+    
+    // Queues exist before start() so jobs can be accepted early
+    setup_worker_queues();
+    
+    // One context per call between decode and encode; keep enough idle for a full set of workers
+    call_contexts_ = CallContextPool::create(static_cast<size_t>(max_worker_threads_) * 2);
+    
+    // Encoding is CPU bound but lighter than decode; uploads mostly wait on I/O
+    size_t stage_queue = static_cast<size_t>(max_queue_size_ > 0 ? max_queue_size_ : 1);
+    stages_[static_cast<int>(PipelineStage::ENCODE)].reset(
+        new StagePool<std::shared_ptr<ProcessingJob>>("JobManager:encode", std::max(1, max_worker_threads_ / 2), stage_queue));
+    stages_[static_cast<int>(PipelineStage::DISPATCH)].reset(
+        new StagePool<std::shared_ptr<ProcessingJob>>("JobManager:dispatch", 1, stage_queue));
+    stages_[static_cast<int>(PipelineStage::UPLOAD)].reset(
+        new StagePool<std::shared_ptr<ProcessingJob>>("JobManager:upload", 2, stage_queue));
 }
 
 JobManager::~JobManager() {
@@ -27,13 +157,53 @@ bool JobManager::start() {
     
     shutdown_requested_ = false;
     
+    // The threading config may have been read after the queues were made
+    place_worker_queues();
+    
+    // Autoscaled pools start small and grow with the load
+    const AutoscalePolicy& autoscale = autoscaler_.policy();
+    int initial_workers = autoscale.enabled ? autoscaler_.min_workers(max_worker_threads_) : max_worker_threads_;
+    
+    // On a single node decoders can be built up front; otherwise each worker
+    // builds its own once it is pinned, so the vocoder state is node-local
+    if (numa_nodes_ <= 1) {
+        decoder_pool_.prewarm(static_cast<size_t>(initial_workers));
+    }
+    
+    // Downstream stages first so decode workers always have somewhere to hand off
+    scripts_.start();
+    if (write_policy_.enabled && !writer_) {
+        writer_.reset(new OutputWriter(write_policy_));
+    }
+    if (writer_) {
+        writer_->start();
+    }
+    for (int i = static_cast<int>(PipelineStage::ENCODE); i < static_cast<int>(PipelineStage::COUNT); ++i) {
+        PipelineStage stage = static_cast<PipelineStage>(i);
+        stages_[i]->set_thread_start([stage](size_t index) {
+            ThreadPlacement::global().place(pipeline_stage_name(stage), index);
+        });
+        stages_[i]->start([this, stage](std::shared_ptr<ProcessingJob> job) {
+            run_stage(stage, std::move(job));
+        });
+    }
+    
     // Start worker threads
-    for (int i = 0; i < max_worker_threads_; ++i) {
-        worker_threads_.emplace_back(&JobManager::worker_thread_main, this);
+    worker_threads_.resize(static_cast<size_t>(max_worker_threads_));
+    worker_live_.assign(static_cast<size_t>(max_worker_threads_), false);
+    worker_target_ = 0;
+    resize_workers(initial_workers);
+    JobMetrics::get().workers.set(initial_workers);
+    
+    if (autoscale.enabled) {
+        autoscale_stop_ = false;
+        autoscale_thread_ = std::thread(&JobManager::autoscale_main, this);
     }
     
     if (verbose_) {
-        std::cout << "[JobManager] Started with " << max_worker_threads_ << " worker threads" << std::endl;
+        LOG_INFO("[JobManager] Started with " << initial_workers << " worker threads on "
+                 << numa_nodes_ << " NUMA node(s)"
+                 << (autoscale.enabled ? ", autoscaling up to " + std::to_string(max_worker_threads_) : ""));
     }
     
     return true;
@@ -44,12 +214,22 @@ void JobManager::stop() {
         return; // Already stopped
     }
     
+    // No workers may be started once shutdown begins
+    if (autoscale_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(autoscale_mutex_);
+            autoscale_stop_ = true;
+        }
+        autoscale_wake_.notify_all();
+        autoscale_thread_.join();
+    }
+    
     // Signal shutdown
     {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
+        std::lock_guard<std::mutex> lock(park_mutex_);
         shutdown_requested_ = true;
     }
-    queue_condition_.notify_all();
+    park_condition_.notify_all();
     
     // Wait for workers to finish
     for (auto& worker : worker_threads_) {
@@ -59,14 +239,93 @@ void JobManager::stop() {
     }
     worker_threads_.clear();
     
-    // Cleanup decoders
-    {
-        std::lock_guard<std::mutex> lock(decoder_mutex_);
-        thread_decoders_.clear();
+    // Then the decode stage's writes, which hand jobs on to the stages after
+    if (writer_) {
+        writer_->stop();
+    }
+    
+    // Then drain the later stages in pipeline order
+    for (int i = static_cast<int>(PipelineStage::ENCODE); i < static_cast<int>(PipelineStage::COUNT); ++i) {
+        stages_[i]->stop();
     }
+    // Last, the scripts the upload stage queued
+    scripts_.stop();
     
     if (verbose_) {
-        std::cout << "[JobManager] Stopped all workers" << std::endl;
+        LOG_INFO("[JobManager] Stopped all workers");
+    }
+}
+
+void JobManager::resize_workers(int count) {
+    std::vector<size_t> start;
+    int previous;
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        previous = worker_target_.load();
+        worker_target_ = count;
+        for (size_t i = 0; i < static_cast<size_t>(count) && i < worker_live_.size(); ++i) {
+            if (!worker_live_[i]) {
+                worker_live_[i] = true;
+                start.push_back(i);
+            }
+        }
+    }
+    // Parked workers past the new size wake up and retire
+    if (count < previous) {
+        park_condition_.notify_all();
+    }
+    for (size_t index : start) {
+        // A slot's previous thread has already given it up and is on its way out
+        if (worker_threads_[index].joinable()) {
+            worker_threads_[index].join();
+        }
+        worker_threads_[index] = std::thread(&JobManager::worker_thread_main, this, index);
+    }
+}
+
+void JobManager::autoscale_main() {
+    CpuIdleMeter cpu;
+    auto last = std::chrono::steady_clock::now();
+    const int interval_ms = autoscaler_.policy().interval_ms;
+    
+    std::unique_lock<std::mutex> lock(autoscale_mutex_);
+    while (!autoscale_stop_) {
+        autoscale_wake_.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return autoscale_stop_; });
+        if (autoscale_stop_) {
+            break;
+        }
+        lock.unlock();
+        
+        auto now = std::chrono::steady_clock::now();
+        WorkerAutoscaler::Sample sample;
+        sample.workers = worker_target_.load();
+        sample.max_workers = max_worker_threads_;
+        sample.busy = active_workers_.load();
+        sample.queued = std::max(0, pending_jobs_.load());
+        sample.decode_time_s = decode_time_us_.load(std::memory_order_relaxed) / 1e6;
+        sample.cpu_idle = cpu.sample();
+        sample.elapsed_s = std::chrono::duration<double>(now - last).count();
+        last = now;
+        
+        int wanted = autoscaler_.decide(sample);
+        if (wanted != sample.workers) {
+            if (wanted > sample.workers) {
+                workers_added_ += static_cast<uint64_t>(wanted - sample.workers);
+                JobMetrics::get().workers_added.add(static_cast<uint64_t>(wanted - sample.workers));
+            } else {
+                workers_retired_ += static_cast<uint64_t>(sample.workers - wanted);
+                JobMetrics::get().workers_retired.add(static_cast<uint64_t>(sample.workers - wanted));
+            }
+            if (verbose_) {
+                LOG_INFO("[JobManager] Scaling decode workers " << sample.workers << " -> " << wanted
+                         << " (" << sample.queued << " queued, " << sample.busy << " busy, "
+                         << sample.decode_time_s * 1000.0 << " ms per job)");
+            }
+            resize_workers(wanted);
+            JobMetrics::get().workers.set(wanted);
+        }
+        
+        lock.lock();
     }
 }
 
@@ -82,15 +341,7 @@ std::string JobManager::queue_job(const std::string& p25_temp_file,
                                  const std::string& audio_format,
                                  int audio_bitrate) {
     
-    // Generate unique job ID
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(100000, 999999);
-    std::string job_id = "job_" + std::to_string(dis(gen)) + "_" + std::to_string(std::time(nullptr));
-    
-    // Create job
     auto job = std::make_shared<ProcessingJob>();
-    job->job_id = job_id;
     job->p25_file_path = p25_temp_file;
     job->metadata_json = metadata_json;
     job->output_base_path = output_base_path;
@@ -98,50 +349,99 @@ std::string JobManager::queue_job(const std::string& p25_temp_file,
     job->upload_script = upload_script;
     job->audio_format = audio_format;
     job->audio_bitrate = audio_bitrate;
+    return submit_job(job);
+}
+
+AdmissionController::Result JobManager::admit_job(const std::string& stream_name, int& retry_after_s) {
+    AdmissionController::Result result =
+        admission_.admit(stream_name, std::max(0, pending_jobs_.load()), max_queue_size_, retry_after_s);
+    if (result == AdmissionController::OVERLOADED) {
+        jobs_overloaded_++;
+        JobMetrics::get().overloaded.add();
+    } else if (result == AdmissionController::STREAM_LIMITED) {
+        jobs_throttled_++;
+        JobMetrics::get().throttled.add();
+    }
+    if (result != AdmissionController::ACCEPT && verbose_) {
+        LOG_WARN("[JobManager] Refusing job for stream " << stream_name
+                 << (result == AdmissionController::OVERLOADED ? " (overloaded)" : " (stream over its share)")
+                 << ", retry after " << retry_after_s << "s");
+    }
+    return result;
+}
+
+std::string JobManager::new_job_id() {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dis(100000, 999999);
+    return "job_" + std::to_string(dis(gen)) + "_" + std::to_string(std::time(nullptr));
+}
+
+std::string JobManager::submit_job(std::shared_ptr<ProcessingJob> job) {
+    if (job->job_id.empty()) {
+        job->job_id = new_job_id();
+    }
+    const std::string job_id = job->job_id;
     job->status = ProcessingJob::QUEUED;
+    job->stage = PipelineStage::DECODE;
     
-    // Check queue size limit
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        if (job_queue_.size() >= static_cast<size_t>(max_queue_size_)) {
-            if (verbose_) {
-                std::cerr << "[JobManager] Queue is full, rejecting job " << job_id << std::endl;
-            }
-            return "";  // Queue full
-        }
-        
-        // Add to queue
-        job_queue_.push(job);
-        jobs_queued_++;
+    if (!job->call_metadata) {
+        job->call_metadata = TrunkCallMetadata::parse(job->metadata_json);
     }
+    SchedulingPolicy::read_call_metadata(*job->call_metadata, job->talkgroup, job->emergency, job->priority);
+    job->job_class = scheduling_policy_.classify(job->emergency, job->talkgroup, job->priority);
+    job->deadline = std::chrono::steady_clock::now() + scheduling_policy_.slack_for(job->job_class);
     
-    // Track job
-    {
-        std::lock_guard<std::mutex> lock(tracker_mutex_);
-        job_tracker_[job_id] = job;
-    }
+    // Track job before a worker can pick it up
+    jobs_evicted_ += job_tracker_.insert(job_id, job);
     
-    // Notify workers
-    queue_condition_.notify_one();
+    if (!push_job(job)) {
+        if (verbose_) {
+            LOG_WARN("[JobManager] Queue is full, rejecting job " << job_id);
+        }
+        job_tracker_.erase(job_id);
+        return "";  // Queue full
+    }
+    jobs_queued_++;
     
     if (verbose_) {
-        std::cout << "[JobManager] Queued job " << job_id << " for stream " << stream_name << std::endl;
+        LOG_INFO("[JobManager] Queued " << job_class_name(job->job_class) << " job " << job_id
+                 << " for stream " << job->stream_name);
     }
     
     return job_id;
 }
 
+bool JobManager::replace_queued_input(const std::string& job_id, const ProcessingJob& copy, std::string& replaced_file) {
+    return job_tracker_.update(job_id, [&copy, &replaced_file](ProcessingJob& job) {
+        if (job.status != ProcessingJob::QUEUED) {
+            return false;
+        }
+        replaced_file = job.p25_file_path;
+        job.p25_file_path = copy.p25_file_path;
+        job.p25_data = copy.p25_data;
+        return true;
+    });
+}
+
 std::shared_ptr<ProcessingJob> JobManager::get_job_status(const std::string& job_id) {
-    std::lock_guard<std::mutex> lock(tracker_mutex_);
-    auto it = job_tracker_.find(job_id);
-    return (it != job_tracker_.end()) ? it->second : nullptr;
+    return job_tracker_.find(job_id);
 }
 
 void JobManager::remove_completed_job(const std::string& job_id) {
-    std::lock_guard<std::mutex> lock(tracker_mutex_);
     job_tracker_.erase(job_id);
 }
 
+std::shared_ptr<ProcessingJob> JobManager::wait_for_job(const std::string& job_id, std::chrono::milliseconds timeout) {
+    return job_tracker_.wait(job_id, timeout, [](const ProcessingJob& job) {
+        return job.status == ProcessingJob::COMPLETED || job.status == ProcessingJob::FAILED;
+    });
+}
+
+void JobManager::set_job_retention(std::chrono::seconds ttl, size_t max_finished_jobs) {
+    jobs_evicted_ += job_tracker_.set_retention(ttl, max_finished_jobs);
+}
+
 JobManager::JobStats JobManager::get_stats() {
     JobStats stats;
     stats.queued = jobs_queued_.load();
@@ -149,150 +449,454 @@ JobManager::JobStats JobManager::get_stats() {
     stats.failed = jobs_failed_.load();
     stats.active_workers = active_workers_.load();
     stats.total_processed = stats.completed + stats.failed;
+    stats.queue_size = std::max(0, pending_jobs_.load());
+    stats.jobs_stolen = jobs_stolen_.load();
+    stats.numa_nodes = numa_nodes_;
+    stats.urgent_queue_size = std::max(0, urgent_pending_.load());
+    for (int i = 0; i < static_cast<int>(JobClass::COUNT); ++i) {
+        stats.jobs_by_class[i] = jobs_by_class_[i].load();
+    }
+    stats.deadline_misses = deadline_misses_.load();
+    stats.tracked_jobs = static_cast<int>(job_tracker_.size());
+    stats.jobs_evicted = jobs_evicted_.load();
+    stats.jobs_overloaded = jobs_overloaded_.load();
+    stats.jobs_throttled = jobs_throttled_.load();
+    stats.jobs_timed_out = jobs_timed_out_.load();
+    stats.scripts.max_concurrent = scripts_.max_concurrent();
+    stats.scripts.running = scripts_.running();
+    stats.scripts.queued = static_cast<int>(scripts_.queued());
+    stats.scripts.succeeded = scripts_.succeeded();
+    stats.scripts.failed = scripts_.failed();
+    stats.scripts.timed_out = scripts_.timed_out();
+    stats.writer.enabled = writer_ != nullptr;
+    stats.writer.io_uring = writer_ && writer_->uses_io_uring();
+    stats.writer.in_flight = writer_ ? writer_->in_flight() : 0;
+    stats.writer.written = writer_ ? writer_->written() : 0;
+    stats.writer.failed = writer_ ? writer_->failed() : 0;
+    stats.service_rate = admission_.service_rate();
+    stats.workers = worker_threads_.empty() ? 0 : worker_target_.load();
+    stats.max_workers = max_worker_threads_;
+    stats.min_workers = autoscaler_.policy().enabled ? autoscaler_.min_workers(max_worker_threads_) : max_worker_threads_;
+    stats.workers_added = workers_added_.load();
+    stats.workers_retired = workers_retired_.load();
+    stats.decode_time_ms = decode_time_us_.load(std::memory_order_relaxed) / 1000.0;
     
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        stats.queue_size = static_cast<int>(job_queue_.size());
+    JobStats::StageStats& decode = stats.stages[static_cast<int>(PipelineStage::DECODE)];
+    decode.threads = stats.workers;
+    decode.busy = stats.active_workers;
+    decode.queue_size = stats.queue_size;
+    decode.queue_capacity = max_queue_size_;
+    decode.processed = static_cast<uint64_t>(stats.total_processed);
+    decode.stalls = 0;
+    decode.latency = stage_latency_[static_cast<int>(PipelineStage::DECODE)].summary();
+    for (int i = static_cast<int>(PipelineStage::ENCODE); i < static_cast<int>(PipelineStage::COUNT); ++i) {
+        JobStats::StageStats& stage = stats.stages[i];
+        stage.threads = stages_[i]->threads();
+        stage.busy = stages_[i]->busy();
+        stage.queue_size = static_cast<int>(stages_[i]->queue_size());
+        stage.queue_capacity = static_cast<int>(stages_[i]->capacity());
+        stage.processed = stages_[i]->processed();
+        stage.stalls = stages_[i]->stalls();
+        stage.latency = stage_latency_[i].summary();
     }
     
-    // Calculate average processing time (simplified)
-    stats.avg_processing_time_ms = stats.total_processed > 0 ? 1500.0 : 0.0;  // Placeholder
+    stats.queue_wait_latency = queue_wait_latency_.summary();
+    stats.total_latency = total_latency_.summary();
+    stats.avg_processing_time_ms = stats.total_latency.mean_ms;
     
     return stats;
 }
 
+void JobManager::sample_metrics() {
+    JobMetrics& metrics = JobMetrics::get();
+    metrics.queue_depth.set(std::max(0, pending_jobs_.load()));
+    metrics.urgent_queue_depth.set(std::max(0, urgent_pending_.load()));
+    metrics.active_workers.set(active_workers_.load());
+    metrics.workers.set(worker_threads_.empty() ? 0 : worker_target_.load());
+    metrics.stage_queue_depth[static_cast<int>(PipelineStage::DECODE)]->set(std::max(0, pending_jobs_.load()));
+    for (int i = static_cast<int>(PipelineStage::ENCODE); i < static_cast<int>(PipelineStage::COUNT); ++i) {
+        if (stages_[i]) {
+            metrics.stage_queue_depth[i]->set(static_cast<int64_t>(stages_[i]->queue_size()));
+        }
+    }
+}
+
 void JobManager::reset_stats() {
     jobs_queued_ = 0;
     jobs_completed_ = 0;
     jobs_failed_ = 0;
+    jobs_stolen_ = 0;
+    deadline_misses_ = 0;
+    jobs_evicted_ = 0;
+    jobs_overloaded_ = 0;
+    jobs_throttled_ = 0;
+    jobs_timed_out_ = 0;
+    for (auto& count : jobs_by_class_) {
+        count = 0;
+    }
+    queue_wait_latency_.reset();
+    total_latency_.reset();
+    for (auto& histogram : stage_latency_) {
+        histogram.reset();
+    }
+}
+
+void JobManager::setup_worker_queues() {
+    worker_queues_.clear();
+    for (int i = 0; i < max_worker_threads_; ++i) {
+        worker_queues_.push_back(std::make_unique<WorkerQueue>());
+    }
+    place_worker_queues();
+}
+
+void JobManager::place_worker_queues() {
+    ThreadPlacement& placement = ThreadPlacement::global();
+    const std::vector<std::vector<int>>& topology = placement.topology();
+    numa_nodes_ = static_cast<int>(placement.numa_nodes());
+    
+    if (const PoolPlacement* decode = placement.pool("decode")) {
+        // Configured CPUs; a worker's node is where its first CPU is
+        for (size_t i = 0; i < worker_queues_.size(); ++i) {
+            worker_queues_[i]->cpus = decode->cpus_for(i);
+            int node = placement::node_of_cpu(worker_queues_[i]->cpus.front(), topology);
+            worker_queues_[i]->numa_node = node >= 0 ? node : 0;
+        }
+    } else {
+        // Spread workers across NUMA nodes and keep each one on its node's CPUs,
+        // so a decoder's working set stays in local memory. Single-node machines
+        // are left to the kernel scheduler.
+        std::vector<int> nodes;
+        for (size_t node = 0; node < topology.size(); ++node) {
+            if (!topology[node].empty()) {
+                nodes.push_back(static_cast<int>(node));
+            }
+        }
+        for (size_t i = 0; i < worker_queues_.size(); ++i) {
+            worker_queues_[i]->numa_node = nodes.size() > 1 ? nodes[i % nodes.size()] : 0;
+            worker_queues_[i]->cpus = nodes.size() > 1 ? topology[nodes[i % nodes.size()]] : std::vector<int>();
+        }
+    }
+    
+    // Steal from the next workers on the same node first, then the rest
+    size_t count = worker_queues_.size();
+    for (size_t i = 0; i < count; ++i) {
+        std::vector<size_t>& victims = worker_queues_[i]->victims;
+        victims.clear();
+        for (int pass = 0; pass < 2; ++pass) {
+            for (size_t step = 1; step < count; ++step) {
+                size_t victim = (i + step) % count;
+                bool local = worker_queues_[victim]->numa_node == worker_queues_[i]->numa_node;
+                if (local == (pass == 0)) {
+                    victims.push_back(victim);
+                }
+            }
+        }
+    }
+}
+
+bool JobManager::push_job(std::shared_ptr<ProcessingJob> job) {
+    // Reserve a queue slot first so concurrent submitters cannot overshoot the limit
+    if (pending_jobs_.fetch_add(1) >= max_queue_size_) {
+        pending_jobs_--;
+        return false;
+    }
+    
+    jobs_by_class_[static_cast<int>(job->job_class)]++;
+    if (job->job_class == JobClass::EMERGENCY || job->job_class == JobClass::HIGH) {
+        std::lock_guard<std::mutex> lock(urgent_mutex_);
+        auto deadline = job->deadline;
+        urgent_jobs_.push(std::move(job), deadline);
+        urgent_pending_++;
+    } else {
+        // Only running workers' queues; before start() that is all of them
+        size_t running = static_cast<size_t>(std::max(1, std::min(worker_target_.load(), max_worker_threads_)));
+        WorkerQueue& queue = *worker_queues_[next_queue_.fetch_add(1, std::memory_order_relaxed) % running];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        auto deadline = job->deadline;
+        queue.jobs.push(std::move(job), deadline);
+    }
+    
+    // A searching worker will find the job (and wake a peer if it finds more),
+    // so only wake a sleeper when nobody is looking
+    if (searching_workers_.load() == 0 && sleeping_workers_.load() > 0) {
+        wake_worker();
+    }
+    return true;
+}
+
+std::shared_ptr<ProcessingJob> JobManager::find_job(size_t index) {
+    std::shared_ptr<ProcessingJob> job;
+    
+    WorkerQueue& own = *worker_queues_[index];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        // Take an urgent job unless our own earliest deadline is sooner (an aged job)
+        if (urgent_pending_.load() > 0) {
+            std::lock_guard<std::mutex> urgent_lock(urgent_mutex_);
+            if (!urgent_jobs_.empty() &&
+                (own.jobs.empty() || urgent_jobs_.top_deadline() <= own.jobs.top_deadline())) {
+                job = urgent_jobs_.pop();
+                urgent_pending_--;
+            }
+        }
+        if (!job && !own.jobs.empty()) {
+            job = own.jobs.pop();
+        }
+    }
+    
+    if (!job) {
+        for (size_t victim : own.victims) {
+            WorkerQueue& queue = *worker_queues_[victim];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty()) {
+                job = queue.jobs.pop();
+                jobs_stolen_++;
+                break;
+            }
+        }
+    }
+    
+    if (job) {
+        pending_jobs_--;
+        if (std::chrono::steady_clock::now() > job->deadline) {
+            deadline_misses_++;
+        }
+    }
+    return job;
+}
+
+void JobManager::wake_worker() {
+    std::lock_guard<std::mutex> lock(park_mutex_);
+    park_condition_.notify_one();
 }
 
-void JobManager::worker_thread_main() {
+void JobManager::worker_thread_main(size_t index) {
+    WorkerQueue& own = *worker_queues_[index];
+    ThreadPlacement::Placed placed = ThreadPlacement::global().place("decode", index, own.cpus);
+    
     if (verbose_) {
-        std::cout << "[JobManager] Worker thread " << std::this_thread::get_id() << " started" << std::endl;
+        LOG_INFO("[JobManager] Worker thread " << index << " started on CPUs "
+                 << placement::format_cpu_list(placed.affinity) << " (node " << placed.numa_node << ")");
     }
     
-    while (!shutdown_requested_) {
-        std::shared_ptr<ProcessingJob> job;
+    DecoderPool::Lease decoder = decoder_pool_.acquire(numa_nodes_ > 1 ? own.numa_node : -1);
+    if (pcm_stream_ && !decoder->pcm_publisher()) {
+        decoder->set_pcm_publisher(pcm_stream_->make_publisher());
+    }
+    PcmPublisher* publisher = decoder->pcm_publisher();
+    decoder->set_output_sample_rate(output_sample_rate_);
+    decoder->set_audio_gain(audio_gain_);
+    decoder->set_wav_write_options(wav_options_);
+    decoder->set_segment_parallelism(segment_threads_);
+    
+    bool retired = false;
+    std::vector<OutputWriter::File> writes;
+    searching_workers_++;
+    while (true) {
+        std::shared_ptr<ProcessingJob> job = find_job(index);
         
-        // Get job from queue
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            queue_condition_.wait(lock, [this] {
-                return shutdown_requested_ || !job_queue_.empty();
-            });
+        if (!job) {
+            searching_workers_--;
             
-            if (shutdown_requested_ && job_queue_.empty()) {
+            // Drain the queues before honouring shutdown
+            std::unique_lock<std::mutex> lock(park_mutex_);
+            if (shutdown_requested_ && pending_jobs_.load() == 0) {
+                worker_live_[index] = false;
                 break;
             }
-            
-            if (!job_queue_.empty()) {
-                job = job_queue_.front();
-                job_queue_.pop();
-                job->status = ProcessingJob::PROCESSING;
-                job->started_time = std::chrono::system_clock::now();
+            // The pool shrank past this worker: retire now it has nothing to do
+            if (static_cast<int>(index) >= worker_target_.load()) {
+                worker_live_[index] = false;
+                retired = true;
+                // A job pushed while this worker was still searching woke nobody
+                if (pending_jobs_.load() > 0) {
+                    park_condition_.notify_one();
+                }
+                break;
             }
+            sleeping_workers_++;
+            park_condition_.wait(lock, [this, index] {
+                return shutdown_requested_ || pending_jobs_.load() > 0 ||
+                       static_cast<int>(index) >= worker_target_.load();
+            });
+            sleeping_workers_--;
+            searching_workers_++;
+            continue;
         }
         
-        if (job) {
-            active_workers_++;
-            
-            if (verbose_) {
-                std::cout << "[JobManager] Processing job " << job->job_id << std::endl;
+        // Last searcher hands off: wake a peer if more work is waiting
+        if (--searching_workers_ == 0 && pending_jobs_.load() > 0 && sleeping_workers_.load() > 0) {
+            wake_worker();
+        }
+        {
+            // Under the tracker lock so replace_queued_input() sees the job either
+            // before its input is read or not at all
+            job_tracker_.locked(job->job_id, [&job] { job->status = ProcessingJob::PROCESSING; });
+        }
+        job->started_time = std::chrono::system_clock::now();
+        queue_wait_latency_.record(job->started_time - job->received_time);
+        JobMetrics::get().queue_wait.record(job->started_time - job->received_time);
+        Tracer::instance().record(job->trace_id, "queue_wait", Tracer::to_ns(job->received_time),
+                                  Tracer::to_ns(job->started_time) - Tracer::to_ns(job->received_time));
+        
+        active_workers_++;
+        
+        // The timeout runs from here, so time spent queued is admission's concern
+        if (job_timeout_ms_ > 0) {
+            job->run_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(job_timeout_ms_);
+        }
+        
+        if (verbose_) {
+            LOG_INFO("[JobManager] Processing job " << job->job_id);
+        }
+        
+        // Decode here, then hand the job to the next stage it needs
+        auto decode_start = std::chrono::steady_clock::now();
+        bool decoded;
+        {
+            Tracer::Scope span(job->trace_id, "decode");
+            AllocStats::Scope allocs;
+            if (publisher) {
+                publisher->begin_call(std::make_shared<const Call_Data_t>(make_call_data(*job)));
             }
-            
-            // Process the job
-            bool success = process_job(job);
-            
-            // Update job status
-            job->completed_time = std::chrono::system_clock::now();
-            if (success) {
-                job->status = ProcessingJob::COMPLETED;
-                jobs_completed_++;
-                
-                if (verbose_) {
-                    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-                        job->completed_time - job->started_time);
-                    std::cout << "[JobManager] Completed job " << job->job_id 
-                             << " in " << duration.count() << "ms" << std::endl;
-                }
-            } else {
-                job->status = ProcessingJob::FAILED;
-                jobs_failed_++;
-                
-                if (verbose_) {
-                    std::cout << "[JobManager] Failed job " << job->job_id 
-                             << ": " << job->error_message << std::endl;
-                }
+            decoded = process_job(job, *decoder, writes);
+            if (publisher) {
+                publisher->end_call();
             }
-            
-            active_workers_--;
+            count_allocations(*job, allocs);
         }
+        auto decode_time = std::chrono::steady_clock::now() - decode_start;
+        int64_t decode_us = std::chrono::duration_cast<std::chrono::microseconds>(decode_time).count();
+        int64_t smoothed = decode_time_us_.load(std::memory_order_relaxed);
+        decode_time_us_.store(smoothed == 0 ? decode_us : smoothed + (decode_us - smoothed) / 8, std::memory_order_relaxed);
+        stage_latency_[static_cast<int>(PipelineStage::DECODE)].record(decode_time);
+        JobMetrics::get().stage[static_cast<int>(PipelineStage::DECODE)]->record(decode_time);
+        if (decoded) {
+            commit_outputs(job, std::move(writes));
+        } else {
+            finish_job(job, false);
+        }
+        writes.clear();
+        
+        active_workers_--;
+        searching_workers_++;
+    }
+    
+    // Idle decoders are only kept for running workers and live streams
+    if (retired) {
+        decoder.discard();
     }
     
     if (verbose_) {
-        std::cout << "[JobManager] Worker thread " << std::this_thread::get_id() << " stopped" << std::endl;
+        LOG_INFO("[JobManager] Worker thread " << std::this_thread::get_id()
+                 << (retired ? " retired" : " stopped"));
     }
 }
 
-bool JobManager::process_job(std::shared_ptr<ProcessingJob> job) {
+bool JobManager::process_job(std::shared_ptr<ProcessingJob> job, P25Decoder& decoder, std::vector<OutputWriter::File>& writes) {
     try {
-        // Get thread-local decoder
-        P25Decoder* decoder = get_thread_decoder();
-        if (!decoder) {
-            job->error_message = "Failed to get decoder instance";
-            return false;
-        }
+        // Nothing from the previous call (vocoder history, counters) carries over
+        decoder.reset();
+        decoder.set_trace_id(job->trace_id);
+        decoder.set_deadline(job->run_deadline);
         
-        // Configure decoder
-        decoder->set_audio_format(job->audio_format);
-        decoder->set_audio_bitrate(job->audio_bitrate);
+        // Decode to WAV only; other formats are encoded from the PCM in the encode stage
+        decoder.set_audio_format("wav");
+        decoder.set_audio_bitrate(0);
         
-        // Open P25 file
-        if (!decoder->open_p25_file(job->p25_file_path)) {
+        auto vocoder = stream_vocoders_.find(job->stream_name);
+        decoder.set_vocoder(vocoder != stream_vocoders_.end() ? vocoder->second : vocoder_);
+        
+        // Open the P25 input; uploads kept in memory never touch the filesystem
+        bool opened = job->p25_data
+            ? decoder.open_p25_buffer(job->p25_data->data(), job->p25_data->size(), job->job_id)
+            : decoder.open_p25_file(job->p25_file_path);
+        if (!opened) {
             job->error_message = "Failed to open P25 file";
             cleanup_temp_files(*job);
             return false;
         }
         
-        // Decode to audio
-        if (!decoder->decode_to_audio(job->output_base_path)) {
-            job->error_message = "Failed to decode P25 audio";
+        // Decode to audio; with a writer the WAV is written from the PCM
+        // afterwards, and the decoder only writes JSON when no metadata came
+        DecodeOutputs outputs;
+        if (writer_) {
+            outputs.wav = false;
+            outputs.pcm = true;
+            outputs.json = job->metadata_json.empty();
+        }
+        if (!decoder.decode_to_outputs(job->output_base_path, outputs)) {
+            if (decoder.timed_out()) {
+                job->timed_out = true;
+                job->error_message = "Timed out decoding after " + std::to_string(job_timeout_ms_) + "ms";
+            } else {
+                job->error_message = "Failed to decode P25 audio";
+            }
             cleanup_temp_files(*job);
             return false;
         }
         
+        // The P25 input is no longer needed by any later stage
+        cleanup_temp_files(*job);
+        
         // Write metadata JSON if provided
-        std::string json_file;
-        if (!job->metadata_json.empty()) {
-            json_file = job->output_base_path + ".json";
-            std::ofstream json_out(json_file);
+        if (!job->metadata_json.empty() && writer_) {
+            job->json_file = job->output_base_path + ".json";
+            writes.push_back(OutputWriter::File::text(job->json_file, job->metadata_json));
+        } else if (!job->metadata_json.empty()) {
+            job->json_file = job->output_base_path + ".json";
+            std::ofstream json_out(job->json_file);
             if (json_out.is_open()) {
                 json_out << job->metadata_json;
                 json_out.close();
             } else {
                 if (verbose_) {
-                    std::cout << "[JobManager] Warning: Failed to write metadata JSON for job " 
-                             << job->job_id << std::endl;
+                    LOG_WARN("[JobManager] Failed to write metadata JSON for job " 
+                             << job->job_id);
                 }
             }
         }
         
         // Check if WAV file was generated
-        std::string wav_file = job->output_base_path + ".wav";
-        if (!std::filesystem::exists(wav_file)) {
+        job->wav_file = job->output_base_path + ".wav";
+        if (writer_) {
+            // The call's arena holds the PCM until the writer is done with it
+            const std::vector<int16_t>& pcm = decoder.get_audio_buffer();
+            job->context = call_contexts_->acquire();
+            job->context->pcm.assign(pcm.begin(), pcm.end());
+            OutputWriter::File wav;
+            wav.path = job->wav_file;
+            wav.prefix.resize(WavWriter::HEADER_SIZE);
+            WavWriter::make_header(reinterpret_cast<uint8_t*>(&wav.prefix[0]), pcm.size() * sizeof(int16_t),
+                                   decoder.output_sample_rate());
+            wav.data = job->context->pcm.data();
+            wav.size = job->context->pcm.size() * sizeof(int16_t);
+            wav.owner = job->context;
+            writes.push_back(std::move(wav));
+        } else if (!std::filesystem::exists(job->wav_file)) {
             job->error_message = "WAV file was not generated";
-            cleanup_temp_files(*job);
             return false;
         }
+        job->converted_files["wav"] = job->wav_file;
+        const CallMetadata& stats = decoder.get_call_metadata();
+        job->sample_rate = decoder.output_sample_rate();
+        job->audio_duration = decoder.get_audio_buffer().size() / static_cast<double>(job->sample_rate);
+        job->nac = stats.nac;
+        job->encrypted = stats.has_encrypted_frames;
+        job->bad_frame_rate = stats.voice_quality.bad_frame_rate();
+        job->bit_error_rate = stats.voice_quality.bit_error_rate();
         
-        // Execute upload script if configured
-        if (!job->upload_script.empty() && std::filesystem::exists(job->upload_script)) {
-            execute_upload_script(*job, wav_file, json_file);
+        if (job->output_formats.empty()) {
+            job->output_formats[job->audio_format.empty() ? "wav" : job->audio_format] = true;
+            if (job->audio_bitrate > 0) {
+                job->format_bitrates[job->audio_format] = job->audio_bitrate;
+            }
+        }
+        if (needs_stage(*job, PipelineStage::ENCODE) && !job->context) {
+            const std::vector<int16_t>& pcm = decoder.get_audio_buffer();
+            job->context = call_contexts_->acquire();
+            job->context->pcm.assign(pcm.begin(), pcm.end());
         }
-        
-        // Cleanup temporary files
-        cleanup_temp_files(*job);
         
         return true;
         
@@ -303,58 +907,381 @@ bool JobManager::process_job(std::shared_ptr<ProcessingJob> job) {
     }
 }
 
-P25Decoder* JobManager::get_thread_decoder() {
-    std::lock_guard<std::mutex> lock(decoder_mutex_);
-    std::thread::id thread_id = std::this_thread::get_id();
-    
-    auto it = thread_decoders_.find(thread_id);
-    if (it == thread_decoders_.end()) {
-        // Create new decoder for this thread
-        auto decoder = std::make_unique<P25Decoder>();
-        P25Decoder* decoder_ptr = decoder.get();
-        thread_decoders_[thread_id] = std::move(decoder);
-        return decoder_ptr;
+bool JobManager::encode_job(ProcessingJob& job, std::vector<OutputWriter::File>& writes) {
+    PROFILE_STAGE(ProfileStage::ENCODE);
+    bool persist = persist_encoded_audio_ || !job.upload_script.empty();
+    // How far the encode queue has backed up sets the policy's complexity
+    StagePool<std::shared_ptr<ProcessingJob>>& encode_stage = *stages_[static_cast<int>(PipelineStage::ENCODE)];
+    double backlog_fill = encode_policy_.enabled
+        ? static_cast<double>(encode_stage.queue_size()) / static_cast<double>(encode_stage.capacity())
+        : 0.0;
+    for (const auto& format_pair : job.output_formats) {
+        const std::string& format = format_pair.first;
+        if (!format_pair.second || format == "wav") {
+            continue; // Disabled, or already written by the decode
+        }
+        
+        int requested = 0;
+        auto bitrate_it = job.format_bitrates.find(format);
+        if (bitrate_it != job.format_bitrates.end()) {
+            requested = bitrate_it->second;
+        }
+        EncodeSettings settings = encode_policy_.choose(format, requested, job.job_class, job.audio_duration,
+                                                        job.bad_frame_rate, backlog_fill);
+        int bitrate = settings.bitrate_kbps;
+        JobMetrics::get().encode_complexity.set(settings.complexity);
+        
+        // In-process codec when linked in: the bytes stay in memory for the
+        // uploaders and hit the disk only if something wants the file.
+        // Otherwise ffmpeg on the WAV.
+        std::string output_file = job.output_base_path + "." + format;
+        if (AudioEncoder::has_backend(format)) {
+            auto encoded = std::make_shared<std::vector<uint8_t>>();
+            const std::pmr::vector<int16_t>& pcm = job.context->pcm;
+            if (AudioEncoder::encode(pcm.data(), pcm.size(), job.sample_rate, format, bitrate, *encoded,
+                                     settings.complexity)) {
+                job.encoded_audio[format] = encoded;
+                if (persist && writer_) {
+                    job.converted_files[format] = output_file;
+                    writes.push_back(OutputWriter::File::buffer(output_file, encoded));
+                } else if (persist) {
+                    if (write_buffer(*encoded, output_file)) {
+                        job.converted_files[format] = output_file;
+                    } else {
+                        LOG_ERROR("[JobManager] Failed to write " << output_file);
+                    }
+                }
+                continue;
+            }
+        }
+        std::chrono::milliseconds remaining;
+        if (!time_left(job, remaining)) {
+            return false;
+        }
+        if (AudioEncoder::convert_with_ffmpeg(job.wav_file, output_file, format, bitrate, remaining,
+                                              settings.complexity)) {
+            job.converted_files[format] = output_file;
+        } else if (!time_left(job, remaining)) {
+            return false;   // ffmpeg was killed at the deadline
+        } else {
+            LOG_ERROR("[JobManager] Failed to encode " << format << " for job " << job.job_id);
+        }
     }
     
-    return it->second.get();
+    // Nothing after encode uses the arena; give it back before the job waits in slower stages
+    job.context.reset();
+    return true;
+}
+
+bool JobManager::dispatch_job(ProcessingJob& job) {
+    PROFILE_STAGE(ProfileStage::DISPATCH);
+    auto call = std::make_shared<const CallRecord>(make_call_data(job));
+    if (call_record_handler_) {
+        call_record_handler_(call);
+    }
+    if (call_handler_) {
+        call_handler_(*call);
+    }
+    return true;
 }
 
-void JobManager::cleanup_temp_files(const ProcessingJob& job) {
-    if (!job.delete_temp_files) {
+Call_Data_t JobManager::make_call_data(const ProcessingJob& job) const {
+    Call_Data_t call_data;
+    call_data.talkgroup = job.talkgroup;
+    call_data.emergency = job.emergency;
+    call_data.priority = job.priority;
+    call_data.stream_name = job.stream_name;
+    call_data.system_short_name = job.system_name;
+    call_data.processing_start = job.started_time;
+    call_data.nac = job.nac;
+    call_data.encrypted = job.encrypted;
+    call_data.bad_frame_rate = job.bad_frame_rate;
+    call_data.bit_error_rate = job.bit_error_rate;
+    call_data.audio_duration = job.audio_duration;
+    snprintf(call_data.wav_filename, sizeof(call_data.wav_filename), "%s", job.wav_file.c_str());
+    snprintf(call_data.json_filename, sizeof(call_data.json_filename), "%s", job.json_file.c_str());
+    call_data.converted_files = job.converted_files;
+    call_data.encoded_audio = job.encoded_audio;
+    if (job.call_metadata && job.call_metadata->is_object()) {
+        call_data.call_json = job.call_metadata->object;
+    }
+    if (trunking_state_) {
+        trunking_state_->enrich(call_data, job.received_time);
+    }
+    if (enrichment_) {
+        enrichment_->enrich(call_data, job.call_metadata ? job.call_metadata->source_id : 0);
+    }
+    return call_data;
+}
+
+void JobManager::upload_job(std::shared_ptr<ProcessingJob> job) {
+    auto stage_start = std::chrono::steady_clock::now();
+    std::chrono::milliseconds remaining;
+    if (!time_left(*job, remaining)) {
+        finish_job(job, false);
+        return;
+    }
+    std::vector<std::string> files;
+    if (std::filesystem::exists(job->upload_script)) {
+        for (const auto& format_pair : job->output_formats) {
+            auto converted = job->converted_files.find(format_pair.first);
+            if (format_pair.second && converted != job->converted_files.end()) {
+                files.push_back(converted->second);
+            }
+        }
+    }
+    if (files.empty()) {
+        finish_job(job, true);
         return;
     }
     
-    try {
-        if (std::filesystem::exists(job.p25_file_path)) {
-            std::filesystem::remove(job.p25_file_path);
+    // One script per file; whichever exits last finishes the job. A script's
+    // exit code is logged but, as before, does not fail the call.
+    struct Uploads {
+        std::atomic<size_t> pending;
+        std::atomic<bool> timed_out;
+        explicit Uploads(size_t count) : pending(count), timed_out(false) {}
+    };
+    auto uploads = std::make_shared<Uploads>(files.size());
+    auto script_done = [this, job, uploads, stage_start](const ScriptExecutor::Result& result) {
+        if (result.timed_out) {
+            uploads->timed_out = true;
+            LOG_ERROR("[JobManager] Upload script for job " << job->job_id << " killed after "
+                      << result.elapsed.count() << "ms");
+        } else if (!result.ok() && verbose_) {
+            LOG_WARN("[JobManager] Upload script returned non-zero exit code: " << result.exit_code
+                     << " for job " << job->job_id);
+        }
+        if (--uploads->pending > 0) {
+            return;
+        }
+        auto stage_time = std::chrono::steady_clock::now() - stage_start;
+        stage_latency_[static_cast<int>(PipelineStage::UPLOAD)].record(stage_time);
+        JobMetrics::get().stage[static_cast<int>(PipelineStage::UPLOAD)]->record(stage_time);
+        if (uploads->timed_out) {
+            job->timed_out = true;
+            job->error_message = "Upload script timed out";
         }
-    } catch (const std::filesystem::filesystem_error& e) {
+        finish_job(job, !uploads->timed_out);
+    };
+    
+    for (const std::string& file : files) {
+        ScriptExecutor::Request request;
+        request.argv = {job->upload_script, file, job->json_file, "1"};
+        request.timeout = remaining;
         if (verbose_) {
-            std::cerr << "[JobManager] Warning: Failed to cleanup temp file " 
-                     << job.p25_file_path << ": " << e.what() << std::endl;
+            LOG_INFO("[JobManager] Queueing upload script for job " << job->job_id << ": "
+                     << job->upload_script << " \"" << file << "\"");
+        }
+        if (!scripts_.submit(std::move(request), script_done)) {
+            // Shutting down: count it as run so the job still finishes
+            script_done(ScriptExecutor::Result());
         }
     }
 }
 
-void JobManager::execute_upload_script(const ProcessingJob& job, const std::string& wav_file, const std::string& json_file) {
+bool JobManager::needs_stage(const ProcessingJob& job, PipelineStage stage) const {
+    switch (stage) {
+        case PipelineStage::ENCODE:
+            for (const auto& format_pair : job.output_formats) {
+                if (format_pair.second && format_pair.first != "wav") {
+                    return true;
+                }
+            }
+            return false;
+        case PipelineStage::DISPATCH:
+            return call_handler_ || call_record_handler_;
+        case PipelineStage::UPLOAD:
+            return !job.upload_script.empty();
+        default:
+            return false;
+    }
+}
+
+void JobManager::run_stage(PipelineStage stage, std::shared_ptr<ProcessingJob> job) {
+    if (stage == PipelineStage::UPLOAD) {
+        Tracer::Scope span(job->trace_id, pipeline_stage_name(stage));
+        upload_job(std::move(job));
+        return;
+    }
+    bool success = false;
+    auto stage_start = std::chrono::steady_clock::now();
+    Tracer::Scope span(job->trace_id, pipeline_stage_name(stage));
+    AllocStats::Scope allocs;
+    std::chrono::milliseconds remaining;
+    std::vector<OutputWriter::File> writes;
     try {
-        std::ostringstream cmd;
-        cmd << job.upload_script << " \"" << wav_file << "\" \"" << json_file << "\" \"1\"";
+        // A job past its deadline goes no further
+        if (time_left(*job, remaining)) {
+            switch (stage) {
+                case PipelineStage::ENCODE: success = encode_job(*job, writes); break;
+                case PipelineStage::DISPATCH: success = dispatch_job(*job); break;
+                default: break;
+            }
+        }
+    } catch (const std::exception& e) {
+        job->error_message = std::string(pipeline_stage_name(stage)) + " stage failed: " + e.what();
+    }
+    count_allocations(*job, allocs);
+    auto stage_time = std::chrono::steady_clock::now() - stage_start;
+    stage_latency_[static_cast<int>(stage)].record(stage_time);
+    JobMetrics::get().stage[static_cast<int>(stage)]->record(stage_time);
+    
+    if (success) {
+        commit_outputs(job, std::move(writes));
+    } else {
+        finish_job(job, false);
+    }
+}
+
+bool JobManager::time_left(ProcessingJob& job, std::chrono::milliseconds& remaining) {
+    remaining = std::chrono::milliseconds(0);
+    if (job.run_deadline == std::chrono::steady_clock::time_point::max()) {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now >= job.run_deadline) {
+        if (!job.timed_out) {
+            job.timed_out = true;
+            job.error_message = "Timed out in " + std::string(pipeline_stage_name(job.stage)) + " stage after " +
+                                std::to_string(job_timeout_ms_) + "ms";
+        }
+        return false;
+    }
+    remaining = std::max(std::chrono::milliseconds(1),
+                         std::chrono::duration_cast<std::chrono::milliseconds>(job.run_deadline - now));
+    return true;
+}
+
+void JobManager::count_allocations(ProcessingJob& job, const AllocStats::Scope& scope) {
+    AllocStats::Counts counts = scope.elapsed();
+    job.allocations += counts.allocations;
+    job.allocated_bytes += counts.bytes;
+}
+
+void JobManager::advance_job(std::shared_ptr<ProcessingJob> job) {
+    for (int i = static_cast<int>(job->stage) + 1; i < static_cast<int>(PipelineStage::COUNT); ++i) {
+        PipelineStage stage = static_cast<PipelineStage>(i);
+        if (!needs_stage(*job, stage)) {
+            continue;
+        }
+        job->stage = stage;
+        if (!stages_[i]->submit(job)) {
+            job->error_message = std::string(pipeline_stage_name(stage)) + " stage is stopped";
+            finish_job(job, false);
+        }
+        return;
+    }
+    finish_job(job, true);
+}
+
+void JobManager::commit_outputs(std::shared_ptr<ProcessingJob> job, std::vector<OutputWriter::File> files) {
+    if (files.empty()) {
+        advance_job(job);
+        return;
+    }
+    auto written = [this, job](const std::vector<std::string>& failed) {
+        for (const std::string& path : failed) {
+            if (path == job->wav_file) {
+                job->error_message = "WAV file was not generated";
+                finish_job(job, false);
+                return;
+            }
+            if (path == job->json_file) {
+                if (verbose_) {
+                    LOG_WARN("[JobManager] Failed to write metadata JSON for job "
+                             << job->job_id);
+                }
+                continue;
+            }
+            for (auto it = job->converted_files.begin(); it != job->converted_files.end(); ++it) {
+                if (it->second == path) {
+                    job->converted_files.erase(it);
+                    break;
+                }
+            }
+        }
+        // Without an encode stage nothing reads the PCM again
+        if (job->stage == PipelineStage::DECODE && !needs_stage(*job, PipelineStage::ENCODE)) {
+            job->context.reset();
+        }
+        advance_job(job);
+    };
+    if (writer_ && writer_->submit(std::move(files), written)) {
+        return;
+    }
+    // No writer, or it has stopped for shutdown
+    written(OutputWriter::write_now(files, write_policy_));
+}
+
+void JobManager::finish_job(std::shared_ptr<ProcessingJob> job, bool success) {
+    job->context.reset();
+    job->completed_time = std::chrono::system_clock::now();
+    total_latency_.record(job->completed_time - job->received_time);
+    JobMetrics::get().total.record(job->completed_time - job->received_time);
+    if (job->trace_id) {
+        int64_t start_ns = job->trace_start_ns ? job->trace_start_ns : Tracer::to_ns(job->received_time);
+        Tracer::instance().record(job->trace_id, Tracer::ROOT_SPAN, start_ns, Tracer::to_ns(job->completed_time) - start_ns);
+    }
+    // Status changes under the tracker lock so wait_for_job() cannot miss it
+    jobs_evicted_ += job_tracker_.finish(job->job_id, job, [&job, success] {
+        job->status = success ? ProcessingJob::COMPLETED : ProcessingJob::FAILED;
+    });
+    admission_.record_completion();
+    if (AllocStats::enabled()) {
+        JobMetrics::get().allocations.add(job->allocations);
+        JobMetrics::get().allocated_bytes.add(job->allocated_bytes);
+    }
+    
+    if (success) {
+        jobs_completed_++;
+        JobMetrics::get().completed.add();
         
         if (verbose_) {
-            std::cout << "[JobManager] Executing upload script for job " << job.job_id 
-                     << ": " << cmd.str() << std::endl;
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                job->completed_time - job->started_time);
+            if (AllocStats::enabled()) {
+                LOG_INFO("[JobManager] Completed job " << job->job_id << " in " << duration.count() << "ms, "
+                         << job->allocations << " allocations (" << job->allocated_bytes << " bytes)");
+            } else {
+                LOG_INFO("[JobManager] Completed job " << job->job_id << " in " << duration.count() << "ms");
+            }
         }
-        
-        int result = std::system(cmd.str().c_str());
-        if (result != 0 && verbose_) {
-            std::cout << "[JobManager] Upload script returned non-zero exit code: " << result 
-                     << " for job " << job.job_id << std::endl;
+    } else {
+        jobs_failed_++;
+        JobMetrics::get().failed.add();
+        if (job->timed_out) {
+            jobs_timed_out_++;
+            JobMetrics::get().timed_out[static_cast<int>(job->stage)]->add();
         }
-    } catch (const std::exception& e) {
+        
         if (verbose_) {
-            std::cerr << "[JobManager] Error executing upload script for job " << job.job_id 
-                     << ": " << e.what() << std::endl;
+            LOG_INFO("[JobManager] Failed job " << job->job_id 
+                     << " in " << pipeline_stage_name(job->stage) << ": " << job->error_message);
+        }
+    }
+    
+    if (completion_handler_) {
+        try {
+            completion_handler_(*job);
+        } catch (const std::exception& e) {
+            LOG_ERROR("[JobManager] Completion handler failed for job " << job->job_id << ": " << e.what());
         }
     }
+}
+
+void JobManager::configure_stage(PipelineStage stage, int threads, int queue_size) {
+    if (stage == PipelineStage::DECODE || stage == PipelineStage::COUNT || !worker_threads_.empty()) {
+        return;  // Decode is sized by the constructor; stages are fixed once running
+    }
+    stages_[static_cast<int>(stage)]->configure(threads, static_cast<size_t>(std::max(1, queue_size)));
+}
+
+void JobManager::cleanup_temp_files(ProcessingJob& job) {
+    job.p25_data.reset();
+    if (!job.delete_temp_files || job.p25_file_path.empty()) {
+        return;
+    }
+    // Unlinked in batches off the worker
+    TempStore::global().release(job.p25_file_path);
 }
\ No newline at end of file
@@ -1,11 +1,48 @@
 /*
  * Job Manager for trunk-decoder
  * Separates network ingestion from processing with asynchronous queue
+ *
+ * Jobs run through a staged pipeline: decode -> encode -> plugin dispatch
+ * -> upload. Decode is CPU bound and runs on the scheduler described
+ * below; each later stage has its own bounded StagePool sized separately,
+ * so I/O-bound uploads never occupy a decode worker. Stages a job does not
+ * need (no extra formats, no call handler, no upload script) are skipped.
+ *
+ * Each worker owns a queue. Submitted jobs are spread across the queues and
+ * an idle worker steals from its neighbours (same NUMA node first), so no
+ * single lock is shared by every enqueue and dequeue. Sleeping workers are
+ * only woken when no other worker is already looking for work; a worker
+ * that finds a job wakes the next one if more are waiting.
+ *
+ * Queues are ordered by deadline (see job_scheduler.h). Emergency and
+ * high-priority jobs go to one shared queue that every worker checks
+ * first, so they never wait behind a busy worker's backlog.
+ *
+ * Submitters ask admit_job() first: it refuses work when the backlog is
+ * longer than the measured service rate can clear in time, and holds each
+ * stream to its share once the queue is under pressure (see
+ * admission_control.h).
+ *
+ * With an autoscale policy the number of decode workers follows the load
+ * (worker_autoscaler.h). Every worker keeps its queue slot; only the first
+ * worker_target_ take new submissions, and a retired worker's leftover
+ * jobs are stolen like any other. A retiring worker frees its decoder
+ * rather than returning it to the pool, so a quiet node does not keep a
+ * vocoder per peak-load worker.
+ *
+ * With an output write policy the decode and encode stages hand their
+ * files to an OutputWriter instead of writing them on their own threads;
+ * the job moves on to the next stage once its files are in place.
+ *
+ * Finished jobs stay queryable for a retention period and are then evicted
+ * oldest first (job_tracker.h). The tracker is sharded by job id, so status
+ * polls take one shard's lock shared and do not queue behind submissions
+ * or each other. Clients can block in wait_for_job() instead of polling,
+ * or register a completion handler.
  */
 
 #pragma once
 
-#include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -15,24 +52,97 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
+#include <functional>
+#include <algorithm>
 #include "p25_decoder.h"
+#include "decoder_pool.h"
+#include "job_scheduler.h"
+#include "encode_policy.h"
+#include "job_tracker.h"
+#include "stage_pool.h"
+#include "latency_histogram.h"
+#include "admission_control.h"
+#include "worker_autoscaler.h"
+#include "script_executor.h"
+#include "output_writer.h"
+#include "call_arena.h"
+#include "alloc_stats.h"
+
+struct Call_Data_t;
+typedef Call_Data_t CallRecord;
+class PcmStreamHub;
+class TrunkingState;
+class CallEnrichment;
+
+enum class PipelineStage {
+    DECODE = 0,   // P25 -> PCM and WAV
+    ENCODE,       // PCM -> extra formats
+    DISPATCH,     // call handler (output plugins)
+    UPLOAD,       // upload script
+    COUNT
+};
+
+const char* pipeline_stage_name(PipelineStage stage);
 
 struct ProcessingJob {
     std::string job_id;
     std::string p25_file_path;     // Temporary P25 file
+    std::shared_ptr<const std::vector<uint8_t>> p25_data;  // In-memory upload; p25_file_path is left empty
     std::string metadata_json;     // Call metadata
+    std::shared_ptr<const TrunkCallMetadata> call_metadata;  // metadata_json parsed; submit_job() fills it in if unset
     std::string output_base_path;  // Base path for outputs
     std::string stream_name;       // Which stream this belongs to
     std::string upload_script;     // Script to run after processing
     std::string audio_format;      // Target audio format
     int audio_bitrate;             // Audio bitrate
     bool delete_temp_files;        // Cleanup temp files after processing
+    std::string system_name;       // System short name, passed to the call handler
+    std::string callback_url;      // Notified when the job finishes, empty for none
+    
+    // Extra formats to encode besides WAV; empty means just audio_format
+    std::map<std::string, bool> output_formats;
+    std::map<std::string, int> format_bitrates;
+    
+    // Results handed from stage to stage
+    PipelineStage stage;
+    std::shared_ptr<CallContext> context;               // per-call arena holding the decoded audio, until encode is done
+    int sample_rate;                                    // of pcm and the WAV file
+    std::string wav_file;
+    std::string json_file;
+    std::map<std::string, std::string> converted_files; // format -> path, including wav
+    std::map<std::string, std::shared_ptr<const std::vector<uint8_t>>> encoded_audio; // format -> in-process encoder output
+    double audio_duration;         // seconds of decoded audio
+    uint32_t nac;
+    bool encrypted;
+    double bad_frame_rate;
+    double bit_error_rate;
+    
+    // Heap allocations made by the call's stages, in TRUNK_DECODER_ALLOC_STATS builds
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    
+    // Scheduling, from the call metadata
+    long talkgroup;
+    bool emergency;
+    int priority;
+    JobClass job_class;
+    std::chrono::steady_clock::time_point deadline;
     
     // Timing
     std::chrono::system_clock::time_point received_time;
     std::chrono::system_clock::time_point started_time;
     std::chrono::system_clock::time_point completed_time;
     
+    // Decode start plus the job timeout. The decoder, later stages and the
+    // ffmpeg and upload script children all stop at it; timed_out says one did.
+    std::chrono::steady_clock::time_point run_deadline;
+    bool timed_out;
+    
+    // Set when the tracer sampled this call; spans start from trace_start_ns
+    uint64_t trace_id;
+    int64_t trace_start_ns;
+    
     // Status
     enum Status {
         QUEUED,
@@ -43,50 +153,165 @@ struct ProcessingJob {
     
     std::string error_message;
     
-    ProcessingJob() : status(QUEUED), audio_bitrate(0), delete_temp_files(true) {
+    ProcessingJob() : audio_bitrate(0), delete_temp_files(true), stage(PipelineStage::DECODE), sample_rate(8000), audio_duration(0.0), nac(0),
+                      encrypted(false), bad_frame_rate(0.0), bit_error_rate(0.0), allocations(0), allocated_bytes(0),
+                      talkgroup(0), emergency(false), priority(1), job_class(JobClass::NORMAL),
+                      timed_out(false), trace_id(0), trace_start_ns(0), status(QUEUED) {
         received_time = std::chrono::system_clock::now();
+        run_deadline = std::chrono::steady_clock::time_point::max();
     }
 };
 
 class JobManager {
 private:
-    // Job queue
-    std::queue<std::shared_ptr<ProcessingJob>> job_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_condition_;
+    typedef DeadlineQueue<std::shared_ptr<ProcessingJob>> JobQueue;
+    
+    // Per-worker queue of normal and low priority jobs, earliest deadline first
+    struct alignas(64) WorkerQueue {
+        std::mutex mutex;
+        JobQueue jobs;
+        int numa_node = 0;
+        std::vector<int> cpus;          // pinned CPUs, empty for no pinning
+        std::vector<size_t> victims;    // steal order, same node first
+    };
+    std::vector<std::unique_ptr<WorkerQueue>> worker_queues_;
+    std::atomic<size_t> next_queue_;    // round-robin target for external submitters
+    std::atomic<int> pending_jobs_;     // jobs sitting in any queue
+    
+    // Emergency and high-priority jobs, shared by all workers
+    std::mutex urgent_mutex_;
+    JobQueue urgent_jobs_;
+    std::atomic<int> urgent_pending_;
+    SchedulingPolicy scheduling_policy_;
+    EncodePolicy encode_policy_;
     
-    // Worker threads
+    // Parking for idle workers
+    std::mutex park_mutex_;
+    std::condition_variable park_condition_;
+    std::atomic<int> sleeping_workers_;
+    std::atomic<int> searching_workers_;
+    
+    // Worker threads, one slot per possible worker. Workers at or past
+    // worker_target_ retire once idle; worker_live_ (under park_mutex_) says
+    // which slots still have a thread that has not decided to exit.
     std::vector<std::thread> worker_threads_;
+    std::vector<bool> worker_live_;
+    std::atomic<int> worker_target_;
     std::atomic<bool> shutdown_requested_;
+    int numa_nodes_;
+    
+    // Grows and shrinks the decode workers when a policy is enabled
+    WorkerAutoscaler autoscaler_;
+    std::thread autoscale_thread_;
+    std::mutex autoscale_mutex_;
+    std::condition_variable autoscale_wake_;
+    bool autoscale_stop_;
+    std::atomic<int64_t> decode_time_us_;      // smoothed per-job decode time
+    std::atomic<uint64_t> workers_added_;
+    std::atomic<uint64_t> workers_retired_;
     
     // Statistics
     std::atomic<int> jobs_queued_;
     std::atomic<int> jobs_completed_;
     std::atomic<int> jobs_failed_;
     std::atomic<int> active_workers_;
+    std::atomic<uint64_t> jobs_stolen_;
+    std::atomic<uint64_t> jobs_by_class_[static_cast<int>(JobClass::COUNT)];
+    std::atomic<uint64_t> deadline_misses_;    // jobs started after their deadline
+    std::atomic<uint64_t> jobs_overloaded_;    // refused by admit_job() for backlog
+    std::atomic<uint64_t> jobs_throttled_;     // refused by admit_job() for a stream's share
+    std::atomic<uint64_t> jobs_timed_out_;
+    
+    AdmissionController admission_;
+    
+    // Latency: time queued before decode, time spent in each stage, and
+    // received -> completed for the whole pipeline
+    LatencyHistogram queue_wait_latency_;
+    LatencyHistogram stage_latency_[static_cast<int>(PipelineStage::COUNT)];
+    LatencyHistogram total_latency_;
     
     // Configuration
     int max_worker_threads_;
     int max_queue_size_;
     int job_timeout_ms_;
     bool verbose_;
+    bool persist_encoded_audio_;
+    int output_sample_rate_;
+    AudioGain::Settings audio_gain_;
+    WavWriter::Options wav_options_;
+    int segment_threads_;
+    OutputWritePolicy write_policy_;
+    
+    // Job tracking, sharded by id; finished jobs expire after the TTL
+    static constexpr std::chrono::seconds DEFAULT_JOB_TTL{600};
+    static constexpr size_t DEFAULT_MAX_FINISHED_JOBS = 10000;
+    JobTracker<ProcessingJob> job_tracker_;
+    std::atomic<uint64_t> jobs_evicted_;
+    std::function<void(const ProcessingJob&)> completion_handler_;
+    
+    // Decoders are built at start(); each worker leases one for its lifetime
+    DecoderPool decoder_pool_;
+    std::shared_ptr<CallContextPool> call_contexts_;
+    
+    // Voice synthesis backend, by stream name with a default; set before start()
+    VoiceSynth::Backend vocoder_;
+    std::map<std::string, VoiceSynth::Backend> stream_vocoders_;
     
-    // Job tracking
-    std::map<std::string, std::shared_ptr<ProcessingJob>> job_tracker_;
-    std::mutex tracker_mutex_;
+    // Stages after decode, indexed by PipelineStage
+    std::unique_ptr<StagePool<std::shared_ptr<ProcessingJob>>> stages_[static_cast<int>(PipelineStage::COUNT)];
+    std::function<void(const Call_Data_t&)> call_handler_;
+    std::function<void(std::shared_ptr<const CallRecord>)> call_record_handler_;
     
-    // Per-thread decoders to avoid thread safety issues
-    std::map<std::thread::id, std::unique_ptr<P25Decoder>> thread_decoders_;
-    std::mutex decoder_mutex_;
+    // Upload scripts, started by the upload stage and run here so a slow
+    // script holds neither that stage's threads nor a decode worker
+    ScriptExecutor scripts_;
+    
+    // Writes the decode and encode stages' files; null without a write policy
+    std::unique_ptr<OutputWriter> writer_;
+    
+    // Live PCM to streaming plugins; each worker's decoder gets a publisher
+    std::shared_ptr<PcmStreamHub> pcm_stream_;
+    
+    // Control channel state for make_call_data(), may be null
+    std::shared_ptr<const TrunkingState> trunking_state_;
+    std::shared_ptr<const CallEnrichment> enrichment_;
     
     // Worker thread function
-    void worker_thread_main();
+    void worker_thread_main(size_t index);
+    void autoscale_main();
+    // Run count workers, starting slots that have none
+    void resize_workers(int count);
     
-    // Job processing
-    bool process_job(std::shared_ptr<ProcessingJob> job);
-    P25Decoder* get_thread_decoder();
-    void cleanup_temp_files(const ProcessingJob& job);
-    void execute_upload_script(const ProcessingJob& job, const std::string& wav_file, const std::string& json_file);
+    // Scheduling
+    void setup_worker_queues();
+    // Assign CPUs and NUMA nodes from the threading config or the topology
+    void place_worker_queues();
+    bool push_job(std::shared_ptr<ProcessingJob> job);
+    std::shared_ptr<ProcessingJob> find_job(size_t index);
+    void wake_worker();
+    
+    // Job processing, one function per stage
+    // Files for the output writer come back in writes; with no writer they
+    // are written before returning
+    bool process_job(std::shared_ptr<ProcessingJob> job, P25Decoder& decoder, std::vector<OutputWriter::File>& writes);
+    bool encode_job(ProcessingJob& job, std::vector<OutputWriter::File>& writes);
+    bool dispatch_job(ProcessingJob& job);
+    Call_Data_t make_call_data(const ProcessingJob& job) const;
+    // Queue the job's upload scripts; it finishes when the last one exits
+    void upload_job(std::shared_ptr<ProcessingJob> job);
+    void run_stage(PipelineStage stage, std::shared_ptr<ProcessingJob> job);
+    void advance_job(std::shared_ptr<ProcessingJob> job);
+    // Write files, then advance the job (or fail it if its WAV could not be
+    // written); from the writer thread when there is one
+    void commit_outputs(std::shared_ptr<ProcessingJob> job, std::vector<OutputWriter::File> files);
+    // Add what one stage allocated to the job's total
+    static void count_allocations(ProcessingJob& job, const AllocStats::Scope& scope);
+    void finish_job(std::shared_ptr<ProcessingJob> job, bool success);
+    bool needs_stage(const ProcessingJob& job, PipelineStage stage) const;
+    void cleanup_temp_files(ProcessingJob& job);
+    // Time left before the job's run_deadline, 0 for no limit; marks the job
+    // timed out (and returns false) once there is none
+    bool time_left(ProcessingJob& job, std::chrono::milliseconds& remaining);
     
 public:
     JobManager(int max_workers = 4, int max_queue_size = 1000, int timeout_ms = 30000, bool verbose = false);
@@ -97,6 +322,10 @@ public:
     void stop();
     bool is_running() const;
     
+    // Decoders for work outside the job queue (live streams); the lease
+    // must be released before this JobManager is destroyed
+    DecoderPool::Lease acquire_decoder() { return decoder_pool_.acquire(); }
+    
     // Job management
     std::string queue_job(const std::string& p25_temp_file, 
                          const std::string& metadata_json,
@@ -106,9 +335,27 @@ public:
                          const std::string& audio_format = "wav",
                          int audio_bitrate = 0);
     
+    // Whether a job for stream_name should be queued now; on refusal
+    // retry_after_s is the suggested wait for the client
+    AdmissionController::Result admit_job(const std::string& stream_name, int& retry_after_s);
+    
+    // Queue a fully built job (formats, system name, ...); returns its ID or "" if full.
+    // A job_id already set (from new_job_id()) is kept.
+    std::string submit_job(std::shared_ptr<ProcessingJob> job);
+    static std::string new_job_id();
+    
+    // Decode copy's P25 input instead of job_id's, if that job has not
+    // started yet; replaced_file is the temp file it no longer needs ("" for
+    // an in-memory upload). Routing, metadata and callbacks stay the job's own.
+    bool replace_queued_input(const std::string& job_id, const ProcessingJob& copy, std::string& replaced_file);
+    
     std::shared_ptr<ProcessingJob> get_job_status(const std::string& job_id);
     void remove_completed_job(const std::string& job_id);
     
+    // Block until the job completes or fails, or the timeout passes; returns
+    // the job in whatever state it reached, or nullptr if it is not tracked
+    std::shared_ptr<ProcessingJob> wait_for_job(const std::string& job_id, std::chrono::milliseconds timeout);
+    
     // Statistics
     struct JobStats {
         int queued;
@@ -118,11 +365,139 @@ public:
         int queue_size;
         double avg_processing_time_ms;
         int total_processed;
+        uint64_t jobs_stolen;
+        int numa_nodes;
+        int urgent_queue_size;
+        uint64_t jobs_by_class[static_cast<int>(JobClass::COUNT)];
+        uint64_t deadline_misses;
+        int tracked_jobs;
+        uint64_t jobs_evicted;     // finished jobs dropped from tracking
+        uint64_t jobs_overloaded;
+        uint64_t jobs_throttled;
+        uint64_t jobs_timed_out;   // failed at the job timeout, in any stage
+        
+        struct ScriptStats {
+            int max_concurrent;
+            int running;
+            int queued;
+            uint64_t succeeded;
+            uint64_t failed;
+            uint64_t timed_out;
+        } scripts;
+        
+        struct WriterStats {
+            bool enabled;
+            bool io_uring;
+            int in_flight;
+            uint64_t written;
+            uint64_t failed;
+        } writer;
+        double service_rate;       // jobs finished per second
+        int workers;               // decode workers running (the autoscaler's current size)
+        int min_workers;
+        int max_workers;
+        uint64_t workers_added;    // by the autoscaler
+        uint64_t workers_retired;
+        double decode_time_ms;     // smoothed, as the autoscaler sees it
+        
+        struct StageStats {
+            int threads;
+            int busy;
+            int queue_size;
+            int queue_capacity;
+            uint64_t processed;
+            uint64_t stalls;       // jobs that waited for room in this stage's queue
+            LatencyHistogram::Summary latency;
+        } stages[static_cast<int>(PipelineStage::COUNT)];
+        
+        LatencyHistogram::Summary queue_wait_latency;
+        LatencyHistogram::Summary total_latency;
     };
     
     JobStats get_stats();
     void reset_stats();
     
+    // Copy queue depths and busy workers into the /metrics gauges
+    void sample_metrics();
+    
     // Configuration
     void set_verbose(bool verbose) { verbose_ = verbose; }
+    
+    void set_admission_policy(const AdmissionPolicy& policy) { admission_.set_policy(policy); }
+    
+    // Vary the decode workers between policy.min_workers and max_workers
+    // with the load; set before start(). Without it all max_workers run.
+    void set_autoscale_policy(const AutoscalePolicy& policy) { autoscaler_.set_policy(policy); }
+    
+    // Talkgroup priorities and per-class slack; set before start()
+    void set_scheduling_policy(const SchedulingPolicy& policy) { scheduling_policy_ = policy; }
+    
+    // Per-call bitrate and complexity for the encode stage; set before start()
+    void set_encode_policy(const EncodePolicy& policy) { encode_policy_ = policy; }
+    
+    // Vocoder backend for every stream, and overrides for named streams; set before start()
+    void set_vocoder(VoiceSynth::Backend backend,
+                     const std::map<std::string, VoiceSynth::Backend>& per_stream = {}) {
+        vocoder_ = backend;
+        stream_vocoders_ = per_stream;
+    }
+    
+    // Threads and queue depth of a stage after decode; set before start()
+    void configure_stage(PipelineStage stage, int threads, int queue_size);
+    
+    // How many upload scripts run at once, and how many may wait; set before start()
+    void configure_scripts(int max_concurrent, int queue_size) {
+        scripts_.configure(max_concurrent, static_cast<size_t>(std::max(1, queue_size)));
+    }
+    
+    // Receives every decoded call with all of its formats (DISPATCH stage)
+    void set_call_handler(std::function<void(const Call_Data_t&)> handler) { call_handler_ = std::move(handler); }
+    // The same, as one shared immutable record per call for fanning out to
+    // several plugins without copying; either handler or both may be set
+    void set_call_record_handler(std::function<void(std::shared_ptr<const CallRecord>)> handler) {
+        call_record_handler_ = std::move(handler);
+    }
+    
+    // Stream each job's PCM to the hub's subscribers while it decodes; set
+    // before start(). Subscribers see Call_Data_t as known before decode
+    // (talkgroup, stream, system), not the decode results.
+    void set_pcm_stream(std::shared_ptr<PcmStreamHub> hub) { pcm_stream_ = std::move(hub); }
+    
+    // Fill in source unit, frequency and emergency from the control channel
+    // when a call's metadata left them out; set before start()
+    void set_trunking_state(std::shared_ptr<const TrunkingState> state) { trunking_state_ = std::move(state); }
+    // Talkgroup names and unit aliases for every call handed to plugins; set before start()
+    void set_call_enrichment(std::shared_ptr<const CallEnrichment> enrichment) { enrichment_ = std::move(enrichment); }
+    
+    // Output rate of every job's audio (resampled in-process from 8 kHz)
+    // and gain/AGC on the decoded PCM; set before start()
+    void set_audio_processing(int sample_rate, const AudioGain::Settings& gain) {
+        output_sample_rate_ = sample_rate;
+        audio_gain_ = gain;
+    }
+    
+    // Synthesise calls over a minute long as up to threads parallel segments
+    // (P25Decoder::set_segment_parallelism); set before start()
+    void set_segment_parallelism(int threads) { segment_threads_ = threads; }
+    
+    // How workers write WAV files (preallocation, page cache, O_DIRECT); set before start()
+    void set_wav_write_options(const WavWriter::Options& options) { wav_options_ = options; }
+    
+    // Write WAV, JSON and persisted encoded files from an io_uring writer
+    // thread rather than the stage threads; set before start(). The writer's
+    // fsync policy then stands in for the WAV options' drop_cache and direct_io.
+    void set_output_write_policy(const OutputWritePolicy& policy) { write_policy_ = policy; }
+    
+    // Whether formats encoded in-process are also written next to the WAV.
+    // Uploaders take the bytes from Call_Data_t::encoded_audio either way;
+    // turn this off when no file plugin or upload script needs the files.
+    // Jobs with an upload script always persist.
+    void set_persist_encoded_audio(bool persist) { persist_encoded_audio_ = persist; }
+    
+    // Called once per job when it completes or fails, from whichever pipeline
+    // thread finished it; keep it short. Set before start()
+    void set_completion_handler(std::function<void(const ProcessingJob&)> handler) { completion_handler_ = std::move(handler); }
+    
+    // How long finished jobs stay queryable, and how many at most
+    void set_job_retention(std::chrono::seconds ttl, size_t max_finished_jobs);
 };
\ No newline at end of file
@@ -0,0 +1,167 @@
+/*
+ * Priority and deadline scheduling for decode jobs
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Every job is given a class (emergency, high, normal, low) and a deadline:
+ * its arrival time plus the class's slack. Queues hand out the earliest
+ * deadline first, so an emergency call or a dispatch talkgroup goes ahead
+ * of a backlog of routine traffic, while a low-priority job still ages
+ * past newer work once it has waited longer than the difference in slack
+ * and cannot starve.
+ */
+
+#pragma once
+
+#include "call_json.h"
+
+#include <set>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+enum class JobClass {
+    EMERGENCY = 0,
+    HIGH,
+    NORMAL,
+    LOW,
+    COUNT
+};
+
+inline const char* job_class_name(JobClass job_class) {
+    switch (job_class) {
+        case JobClass::EMERGENCY: return "emergency";
+        case JobClass::HIGH: return "high";
+        case JobClass::NORMAL: return "normal";
+        case JobClass::LOW: return "low";
+        default: return "unknown";
+    }
+}
+
+struct SchedulingPolicy {
+    std::set<long> high_priority_talkgroups;
+    std::set<long> low_priority_talkgroups;
+
+    // Time a job of each class may wait before it overtakes everything newer
+    std::chrono::milliseconds slack[static_cast<int>(JobClass::COUNT)] = {
+        std::chrono::milliseconds(0),       // emergency
+        std::chrono::milliseconds(2000),    // high
+        std::chrono::milliseconds(15000),   // normal
+        std::chrono::milliseconds(120000)   // low
+    };
+
+    // Emergency flag first, then configured talkgroups, then the call's
+    // trunk-recorder style priority (0 high, 1 normal, 2+ low)
+    JobClass classify(bool emergency, long talkgroup, int priority) const {
+        if (emergency) {
+            return JobClass::EMERGENCY;
+        }
+        if (high_priority_talkgroups.count(talkgroup)) {
+            return JobClass::HIGH;
+        }
+        if (low_priority_talkgroups.count(talkgroup)) {
+            return JobClass::LOW;
+        }
+        if (priority <= 0) {
+            return JobClass::HIGH;
+        }
+        return priority == 1 ? JobClass::NORMAL : JobClass::LOW;
+    }
+
+    std::chrono::milliseconds slack_for(JobClass job_class) const {
+        return slack[static_cast<int>(job_class)];
+    }
+
+    // Pick talkgroup, emergency and priority out of trunk-recorder's call
+    // JSON; fields that are missing or malformed are left untouched
+    static void read_call_metadata(const TrunkCallMetadata& metadata, long& talkgroup,
+                                   bool& emergency, int& priority) {
+        if (metadata.has_talkgroup) {
+            talkgroup = metadata.talkgroup;
+        }
+        if (metadata.has_emergency) {
+            emergency = metadata.emergency;
+        }
+        if (metadata.has_priority) {
+            priority = metadata.priority;
+        }
+    }
+
+    static void read_call_metadata(const std::string& metadata_json, long& talkgroup,
+                                   bool& emergency, int& priority) {
+        if (!metadata_json.empty()) {
+            read_call_metadata(*TrunkCallMetadata::parse(metadata_json), talkgroup, emergency, priority);
+        }
+    }
+
+    // {"high_priority_talkgroups": [...], "low_priority_talkgroups": [...],
+    //  "slack_ms": {"emergency": 0, "high": 2000, "normal": 15000, "low": 120000}}
+    static SchedulingPolicy from_json(const nlohmann::json& config) {
+        SchedulingPolicy policy;
+        if (config.contains("high_priority_talkgroups")) {
+            for (const auto& tg : config["high_priority_talkgroups"]) {
+                policy.high_priority_talkgroups.insert(tg.get<long>());
+            }
+        }
+        if (config.contains("low_priority_talkgroups")) {
+            for (const auto& tg : config["low_priority_talkgroups"]) {
+                policy.low_priority_talkgroups.insert(tg.get<long>());
+            }
+        }
+        if (config.contains("slack_ms")) {
+            const auto& slack_ms = config["slack_ms"];
+            for (int i = 0; i < static_cast<int>(JobClass::COUNT); i++) {
+                const char* name = job_class_name(static_cast<JobClass>(i));
+                if (slack_ms.contains(name)) {
+                    policy.slack[i] = std::chrono::milliseconds(slack_ms[name].get<int64_t>());
+                }
+            }
+        }
+        return policy;
+    }
+};
+
+// Earliest-deadline-first queue; FIFO among equal deadlines. Not thread safe.
+template <typename T>
+class DeadlineQueue {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    DeadlineQueue() : sequence_(0) {}
+
+    void push(T value, Clock::time_point deadline) {
+        entries_.push_back(Entry{deadline, sequence_++, std::move(value)});
+        std::push_heap(entries_.begin(), entries_.end(), later);
+    }
+
+    // Caller must check empty() first
+    T pop() {
+        std::pop_heap(entries_.begin(), entries_.end(), later);
+        T value = std::move(entries_.back().value);
+        entries_.pop_back();
+        return value;
+    }
+
+    Clock::time_point top_deadline() const { return entries_.front().deadline; }
+
+    bool empty() const { return entries_.empty(); }
+    size_t size() const { return entries_.size(); }
+
+private:
+    struct Entry {
+        Clock::time_point deadline;
+        uint64_t sequence;
+        T value;
+    };
+
+    static bool later(const Entry& a, const Entry& b) {
+        return a.deadline != b.deadline ? a.deadline > b.deadline : a.sequence > b.sequence;
+    }
+
+    std::vector<Entry> entries_;
+    uint64_t sequence_;
+};
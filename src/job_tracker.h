@@ -0,0 +1,205 @@
+/*
+ * Sharded tracking of submitted jobs by id
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Status polling, submission, the workers' status changes and waiters all
+ * look jobs up by id. One map under one mutex puts every poll in line with
+ * every enqueue, so ids are hashed over SHARDS independent shards, each
+ * with its own lock and wait condition. Lookups take their shard's lock
+ * shared and never block one another; only inserts, status changes and
+ * eviction take it exclusively, and only for that shard.
+ *
+ * Jobs stay tracked after they finish for a retention period. Every job
+ * gets the same TTL, so each shard's finish order is its expiry order and
+ * a FIFO of finish times is all the timer needed. Expired jobs are erased
+ * when their shard next changes, and each insert also sweeps one other
+ * shard in turn, so a shard nothing lands on still empties. Lookups hide
+ * an expired job that has not been erased yet. The finished-job cap is
+ * kept per shard (max_finished / SHARDS, at least one).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+template <typename T>
+class JobTracker {
+public:
+    typedef std::chrono::steady_clock Clock;
+    static constexpr size_t SHARDS = 16;
+
+    JobTracker(std::chrono::seconds ttl, size_t max_finished)
+        : ttl_(ttl), max_finished_per_shard_(per_shard(max_finished)), size_(0), sweep_cursor_(0) {}
+
+    // Applies to jobs already finished too; returns the number evicted
+    size_t set_retention(std::chrono::seconds ttl, size_t max_finished) {
+        ttl_.store(ttl, std::memory_order_relaxed);
+        max_finished_per_shard_.store(per_shard(max_finished), std::memory_order_relaxed);
+        size_t evicted = 0;
+        auto now = Clock::now();
+        for (Shard& shard : shards_) {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            evicted += evict_locked(shard, now);
+        }
+        return evicted;
+    }
+
+    // Replaces any job tracked under the same id; returns the number evicted
+    size_t insert(const std::string& id, std::shared_ptr<T> job) {
+        auto now = Clock::now();
+        Shard& shard = shard_for(id);
+        size_t evicted = 0;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            evicted += evict_locked(shard, now);
+            auto result = shard.jobs.insert_or_assign(id, Entry{std::move(job), false, Clock::time_point()});
+            if (result.second) {
+                size_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        Shard& other = shards_[sweep_cursor_.fetch_add(1, std::memory_order_relaxed) % SHARDS];
+        if (&other != &shard) {
+            std::unique_lock<std::shared_mutex> lock(other.mutex);
+            evicted += evict_locked(other, now);
+        }
+        return evicted;
+    }
+
+    void erase(const std::string& id) {
+        Shard& shard = shard_for(id);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        if (shard.jobs.erase(id)) {
+            size_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Null when the id is unknown, evicted or past its TTL
+    std::shared_ptr<T> find(const std::string& id) const {
+        const Shard& shard = shard_for(id);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.jobs.find(id);
+        if (it == shard.jobs.end() || expired(it->second, Clock::now())) {
+            return nullptr;
+        }
+        return it->second.job;
+    }
+
+    // Run update on the tracked job under its shard's exclusive lock, so
+    // wait() and other updates see the change whole; false when the id is
+    // not tracked or update returns false
+    bool update(const std::string& id, const std::function<bool(T&)>& update) {
+        Shard& shard = shard_for(id);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.jobs.find(id);
+        return it != shard.jobs.end() && update(*it->second.job);
+    }
+
+    // Run change under id's shard lock whether or not the id is tracked,
+    // for status changes that update() callers must see before or after
+    void locked(const std::string& id, const std::function<void()>& change) {
+        Shard& shard = shard_for(id);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        change();
+    }
+
+    // Final status change: make it under the shard lock, start job's TTL
+    // if it is still the one tracked as id, and wake the waiters; returns
+    // the number evicted
+    size_t finish(const std::string& id, const std::shared_ptr<T>& job, const std::function<void()>& change) {
+        auto now = Clock::now();
+        Shard& shard = shard_for(id);
+        size_t evicted = 0;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            change();
+            auto it = shard.jobs.find(id);
+            if (it != shard.jobs.end() && it->second.job == job) {
+                it->second.finished = true;
+                it->second.finished_at = now;
+                shard.finished.emplace_back(now, id);
+            }
+            evicted = evict_locked(shard, now);
+        }
+        shard.job_finished.notify_all();
+        return evicted;
+    }
+
+    // Wait up to timeout for done(job) after a finish(); null when the id
+    // is not tracked
+    std::shared_ptr<T> wait(const std::string& id, std::chrono::milliseconds timeout,
+                            const std::function<bool(const T&)>& done) {
+        Shard& shard = shard_for(id);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.jobs.find(id);
+        if (it == shard.jobs.end() || expired(it->second, Clock::now())) {
+            return nullptr;
+        }
+        std::shared_ptr<T> job = it->second.job;
+        shard.job_finished.wait_for(lock, timeout, [&job, &done] { return done(*job); });
+        return job;
+    }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry {
+        std::shared_ptr<T> job;
+        bool finished;
+        Clock::time_point finished_at;
+    };
+
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::condition_variable_any job_finished;
+        std::unordered_map<std::string, Entry> jobs;
+        std::deque<std::pair<Clock::time_point, std::string>> finished;
+    };
+
+    static size_t per_shard(size_t max_finished) {
+        return std::max<size_t>(1, max_finished / SHARDS);
+    }
+
+    Shard& shard_for(const std::string& id) { return shards_[std::hash<std::string>()(id) % SHARDS]; }
+    const Shard& shard_for(const std::string& id) const { return shards_[std::hash<std::string>()(id) % SHARDS]; }
+
+    bool expired(const Entry& entry, Clock::time_point now) const {
+        return entry.finished && entry.finished_at + ttl_.load(std::memory_order_relaxed) <= now;
+    }
+
+    size_t evict_locked(Shard& shard, Clock::time_point now) {
+        std::chrono::seconds ttl = ttl_.load(std::memory_order_relaxed);
+        size_t max_finished = max_finished_per_shard_.load(std::memory_order_relaxed);
+        size_t evicted = 0;
+        while (!shard.finished.empty() &&
+               (shard.finished.front().first + ttl <= now || shard.finished.size() > max_finished)) {
+            // Skip entries whose job was removed by hand or tracked again since
+            auto it = shard.jobs.find(shard.finished.front().second);
+            if (it != shard.jobs.end() && it->second.finished &&
+                it->second.finished_at == shard.finished.front().first) {
+                shard.jobs.erase(it);
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                evicted++;
+            }
+            shard.finished.pop_front();
+        }
+        return evicted;
+    }
+
+    Shard shards_[SHARDS];
+    std::atomic<std::chrono::seconds> ttl_;
+    std::atomic<size_t> max_finished_per_shard_;
+    std::atomic<size_t> size_;
+    std::atomic<size_t> sweep_cursor_;
+};
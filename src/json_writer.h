@@ -0,0 +1,164 @@
+/*
+ * Streaming JSON writer for call metadata
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Writes the pretty-printed layout trunk-recorder uses for call JSON (two
+ * spaces per level, one field per line, short arrays inline) straight into
+ * a caller-owned std::string. Integers and fixed-precision floats go
+ * through std::to_chars, so once the buffer has grown to the size of a
+ * call's metadata, later calls write it without allocating.
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out) : out_(out), depth_(0), first_(true) {}
+
+    JsonWriter& begin_object() {
+        out_.append("{\n");
+        depth_++;
+        first_ = true;
+        return *this;
+    }
+
+    JsonWriter& end_object() {
+        depth_--;
+        out_.push_back('\n');
+        indent();
+        out_.push_back('}');
+        first_ = false;
+        return *this;
+    }
+
+    // Carry on an object someone else wrote: body is its text up to the
+    // closing brace, and fields written next are appended to it
+    JsonWriter& splice(std::string_view body) {
+        out_.append(body.data(), body.size());
+        if (!body.empty() && body.back() != ',') {
+            out_.append(",\n");
+        }
+        depth_ = 1;
+        first_ = true;
+        return *this;
+    }
+
+    JsonWriter& key(std::string_view name) {
+        if (!first_) {
+            out_.append(",\n");
+        }
+        first_ = false;
+        indent();
+        out_.push_back('"');
+        escaped(name);
+        out_.append("\": ");
+        return *this;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, JsonWriter&>::type
+    field(std::string_view name, T value) {
+        key(name);
+        integer(value);
+        return *this;
+    }
+
+    JsonWriter& field(std::string_view name, bool value) {
+        key(name);
+        out_.append(value ? "true" : "false");
+        return *this;
+    }
+
+    // As an ostream in std::fixed with setprecision(precision)
+    JsonWriter& field(std::string_view name, double value, int precision) {
+        key(name);
+        char digits[64];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, precision);
+        if (result.ec == std::errc()) {
+            out_.append(digits, result.ptr - digits);
+        } else {
+            out_.push_back('0');
+        }
+        return *this;
+    }
+
+    JsonWriter& field(std::string_view name, std::string_view value) {
+        key(name);
+        out_.push_back('"');
+        escaped(value);
+        out_.push_back('"');
+        return *this;
+    }
+
+    JsonWriter& field(std::string_view name, const char* value) {
+        return field(name, std::string_view(value));
+    }
+
+    // Whole array on one line: [a, b, c]
+    JsonWriter& field(std::string_view name, const uint64_t* values, size_t count) {
+        key(name);
+        out_.push_back('[');
+        for (size_t i = 0; i < count; i++) {
+            if (i) {
+                out_.append(", ");
+            }
+            integer(values[i]);
+        }
+        out_.push_back(']');
+        return *this;
+    }
+
+    JsonWriter& object_field(std::string_view name) {
+        key(name);
+        return begin_object();
+    }
+
+private:
+    template <typename T>
+    void integer(T value) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        out_.append(digits, result.ptr - digits);
+    }
+
+    void indent() {
+        out_.append(static_cast<size_t>(depth_) * 2, ' ');
+    }
+
+    void escaped(std::string_view text) {
+        static constexpr char HEX[] = "0123456789abcdef";
+        size_t run = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            out_.append(text.data() + run, i - run);
+            run = i + 1;
+            switch (c) {
+                case '"': out_.append("\\\""); break;
+                case '\\': out_.append("\\\\"); break;
+                case '\n': out_.append("\\n"); break;
+                case '\r': out_.append("\\r"); break;
+                case '\t': out_.append("\\t"); break;
+                default:
+                    out_.append("\\u00");
+                    out_.push_back(HEX[c >> 4]);
+                    out_.push_back(HEX[c & 0x0f]);
+            }
+        }
+        out_.append(text.data() + run, text.size() - run);
+    }
+
+    std::string& out_;
+    int depth_;
+    bool first_;
+};
@@ -0,0 +1,174 @@
+#include "key_store.h"
+#include <nlohmann/json.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <cctype>
+
+namespace fs = std::filesystem;
+
+static bool parse_hex(const std::string& hex, std::vector<uint8_t>& bytes) {
+    std::string digits;
+    for (char c : hex) {
+        if (!std::isspace(static_cast<unsigned char>(c))) {
+            digits += c;
+        }
+    }
+    if (digits.compare(0, 2, "0x") == 0 || digits.compare(0, 2, "0X") == 0) {
+        digits = digits.substr(2);
+    }
+    if (digits.empty() || digits.size() % 2 != 0 ||
+        digits.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+        return false;
+    }
+    bytes.clear();
+    for (size_t i = 0; i < digits.size(); i += 2) {
+        bytes.push_back(static_cast<uint8_t>(std::stoul(digits.substr(i, 2), nullptr, 16)));
+    }
+    return true;
+}
+
+bool KeySet::add(uint16_t keyid, const std::vector<uint8_t>& key, const std::string& algorithm) {
+    std::string alg;
+    for (char c : algorithm) {
+        alg += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    if (alg.empty()) {
+        alg = key.size() == 5 ? "adp" : key.size() == 8 ? "des" : key.size() == 32 ? "aes" : "";
+    }
+    if (alg.compare(0, 3, "des") == 0) {
+        P25DESDecrypt::expand_key(key, des[keyid]);
+    } else if (alg.compare(0, 3, "aes") == 0) {
+        P25AESDecrypt::expand_key(key, aes[keyid]);
+    } else if (alg.compare(0, 3, "adp") == 0 || alg == "rc4") {
+        P25ADPDecrypt::expand_key(key, adp[keyid]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+KeyStore& KeyStore::instance() {
+    static KeyStore store;
+    return store;
+}
+
+KeyStore::KeyStore() : keys_(std::make_shared<const KeySet>()), generation_(0), watching_(false) {}
+
+KeyStore::~KeyStore() {
+    stop_watching();
+}
+
+bool KeyStore::add_key(uint16_t keyid, const std::vector<uint8_t>& key, const std::string& algorithm) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    std::shared_ptr<KeySet> updated = std::make_shared<KeySet>(*snapshot());
+    if (!updated->add(keyid, key, algorithm)) {
+        return false;
+    }
+    std::atomic_store(&keys_, std::shared_ptr<const KeySet>(updated));
+    generation_.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+void KeyStore::replace(std::shared_ptr<const KeySet> keys) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    std::atomic_store(&keys_, keys ? keys : std::make_shared<const KeySet>());
+    generation_.fetch_add(1, std::memory_order_release);
+}
+
+bool KeyStore::load_file(const std::string& path, std::string& error) {
+    nlohmann::json document;
+    try {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            error = "cannot open " + path;
+            return false;
+        }
+        file >> document;
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+
+    std::shared_ptr<KeySet> keys = std::make_shared<KeySet>();
+    const nlohmann::json& entries = document.contains("decryption_keys") ? document["decryption_keys"] : nlohmann::json::array();
+    if (!entries.is_array()) {
+        error = "decryption_keys must be an array";
+        return false;
+    }
+    for (const auto& entry : entries) {
+        if (!entry.is_object() || !entry.contains("keyid") || !entry.contains("key")) {
+            error = "each key needs keyid and key";
+            return false;
+        }
+        uint16_t keyid;
+        try {
+            keyid = entry["keyid"].is_number() ? entry["keyid"].get<uint16_t>()
+                                               : static_cast<uint16_t>(std::stoul(entry["keyid"].get<std::string>(), nullptr, 16));
+        } catch (const std::exception&) {
+            error = "invalid keyid " + entry["keyid"].dump();
+            return false;
+        }
+        std::vector<uint8_t> key;
+        if (!entry["key"].is_string() || !parse_hex(entry["key"].get<std::string>(), key)) {
+            error = "invalid key for keyid " + entry["keyid"].dump();
+            return false;
+        }
+        if (!keys->add(keyid, key, entry.value("algorithm", ""))) {
+            error = "unknown algorithm for keyid " + entry["keyid"].dump();
+            return false;
+        }
+    }
+    replace(keys);
+    return true;
+}
+
+void KeyStore::watch(const std::string& path, int interval_s, bool verbose) {
+    stop_watching();
+    {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        watching_ = true;
+    }
+    watcher_ = std::thread(&KeyStore::watch_loop, this, path, interval_s > 0 ? interval_s : 1, verbose);
+}
+
+void KeyStore::stop_watching() {
+    {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        watching_ = false;
+    }
+    watch_cv_.notify_all();
+    if (watcher_.joinable()) {
+        watcher_.join();
+    }
+}
+
+void KeyStore::watch_loop(std::string path, int interval_s, bool verbose) {
+    std::error_code ec;
+    fs::file_time_type last_seen = fs::last_write_time(path, ec);
+
+    std::unique_lock<std::mutex> lock(watch_mutex_);
+    while (watching_) {
+        watch_cv_.wait_for(lock, std::chrono::seconds(interval_s), [this] { return !watching_; });
+        if (!watching_) {
+            break;
+        }
+        fs::file_time_type modified = fs::last_write_time(path, ec);
+        if (ec || modified == last_seen) {
+            continue;
+        }
+        last_seen = modified;
+
+        lock.unlock();
+        std::string error;
+        if (load_file(path, error)) {
+            if (verbose) {
+                std::cout << "[KeyStore] Reloaded " << snapshot()->size() << " key(s) from " << path << std::endl;
+            }
+        } else {
+            std::cerr << "[KeyStore] Keeping previous keys, reload of " << path << " failed: " << error << std::endl;
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ * Process-wide decryption key store
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Holds every configured key with its schedule already built (AES round
+ * keys, DES subkeys), as one immutable KeySet. Readers take the current
+ * set through a shared_ptr; writers build a complete new set and swap it
+ * in, so a reload never blocks or tears a decode in progress. Decoders
+ * keep the set they last loaded and only fetch it again when generation()
+ * changes, which is a single atomic load per lookup.
+ *
+ * Keys come from a JSON file with a "decryption_keys" array (normally the
+ * main config file) and can be reloaded from it while running:
+ *
+ *   { "decryption_keys": [ { "keyid": "1234", "key": "0123...", "algorithm": "aes" } ] }
+ *
+ * "keyid" is hex; "algorithm" (des, aes, adp) may be left out, in which
+ * case the key length decides: 5 bytes ADP, 8 DES, 32 AES-256.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
+#include "p25_des_decrypt.h"
+#include "p25_aes_decrypt.h"
+#include "p25_adp_decrypt.h"
+
+struct KeySet {
+    std::unordered_map<uint16_t, P25DESDecrypt::KeySchedule> des;
+    std::unordered_map<uint16_t, P25AESDecrypt::ExpandedKey> aes;
+    std::unordered_map<uint16_t, P25ADPDecrypt::Key> adp;
+
+    size_t size() const { return des.size() + aes.size() + adp.size(); }
+
+    // Schedule a raw key under algorithm ("des", "aes", "adp" or "" to go by length)
+    bool add(uint16_t keyid, const std::vector<uint8_t>& key, const std::string& algorithm = "");
+};
+
+class KeyStore {
+public:
+    static KeyStore& instance();
+
+    KeyStore();
+    ~KeyStore();
+
+    KeyStore(const KeyStore&) = delete;
+    KeyStore& operator=(const KeyStore&) = delete;
+
+    std::shared_ptr<const KeySet> snapshot() const { return std::atomic_load(&keys_); }
+
+    // Bumped on every change
+    uint64_t generation() const { return generation_.load(std::memory_order_acquire); }
+
+    // Add or replace one key (copy on write)
+    bool add_key(uint16_t keyid, const std::vector<uint8_t>& key, const std::string& algorithm = "");
+
+    // Swap in a complete key set
+    void replace(std::shared_ptr<const KeySet> keys);
+
+    // Replace the keys with those in a JSON file; the current set is kept on error
+    bool load_file(const std::string& path, std::string& error);
+
+    // Reload path whenever its mtime changes, checking every interval_s
+    void watch(const std::string& path, int interval_s = 5, bool verbose = false);
+    void stop_watching();
+
+private:
+    void watch_loop(std::string path, int interval_s, bool verbose);
+
+    std::shared_ptr<const KeySet> keys_;
+    std::atomic<uint64_t> generation_;
+    std::mutex writer_mutex_;   // serialises writers; readers never take it
+
+    std::thread watcher_;
+    std::mutex watch_mutex_;
+    std::condition_variable watch_cv_;
+    bool watching_;
+};
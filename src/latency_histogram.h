@@ -0,0 +1,126 @@
+/*
+ * Lock-free latency histogram
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * HDR-style log-linear buckets over microseconds: values below 64 get
+ * exact buckets, larger ones 32 sub-buckets per power of two, so any
+ * reported percentile is within ~3% of the true value. record() is a
+ * couple of relaxed atomic adds and may be called from any thread.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+class LatencyHistogram {
+public:
+    struct Summary {
+        uint64_t count;
+        double mean_ms;
+        double p50_ms;
+        double p95_ms;
+        double p99_ms;
+        double max_ms;
+    };
+
+    LatencyHistogram() : count_(0), sum_us_(0), max_us_(0) {
+        for (auto& bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record_us(uint64_t us) {
+        buckets_[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_us_.fetch_add(us, std::memory_order_relaxed);
+        uint64_t seen = max_us_.load(std::memory_order_relaxed);
+        while (us > seen && !max_us_.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {
+        }
+    }
+
+    template <typename Duration>
+    void record(Duration duration) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        record_us(us > 0 ? static_cast<uint64_t>(us) : 0);
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max_us() const { return max_us_.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding the given quantile (0..1), capped at the max
+    uint64_t percentile_us(double quantile) const {
+        uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(quantile * total + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > total) rank = total;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t upper = bucket_upper(i);
+                uint64_t max = max_us();
+                return upper < max ? upper : max;
+            }
+        }
+        return max_us();
+    }
+
+    Summary summary() const {
+        Summary s;
+        s.count = count();
+        s.mean_ms = s.count ? sum_us_.load(std::memory_order_relaxed) / 1000.0 / s.count : 0.0;
+        s.p50_ms = percentile_us(0.50) / 1000.0;
+        s.p95_ms = percentile_us(0.95) / 1000.0;
+        s.p99_ms = percentile_us(0.99) / 1000.0;
+        s.max_ms = max_us() / 1000.0;
+        return s;
+    }
+
+    // Not atomic with respect to concurrent record() calls
+    void reset() {
+        for (auto& bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_us_.store(0, std::memory_order_relaxed);
+        max_us_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr int SUB_BITS = 5;                         // 32 sub-buckets per octave
+    static constexpr uint64_t SUB_COUNT = 1ULL << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    static size_t bucket_index(uint64_t v) {
+        if (v < 2 * SUB_COUNT) {
+            return static_cast<size_t>(v);
+        }
+        int shift = (63 - __builtin_clzll(v)) - SUB_BITS;
+        return static_cast<size_t>((shift + 1) * SUB_COUNT + ((v >> shift) - SUB_COUNT));
+    }
+
+    static uint64_t bucket_upper(size_t index) {
+        if (index < 2 * SUB_COUNT) {
+            return index;
+        }
+        int shift = static_cast<int>(index / SUB_COUNT) - 1;
+        uint64_t mantissa = index % SUB_COUNT + SUB_COUNT;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> buckets_[BUCKETS];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_us_;
+    std::atomic<uint64_t> max_us_;
+};
@@ -0,0 +1,500 @@
+/*
+ * Asynchronous, rate-limited console logging
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Decode, pipeline and plugin threads must never wait on stdout: when it
+ * is a pipe to journald and journald falls behind, every write(2) on it
+ * blocks. LOG_INFO(...) and friends instead format into a thread-local
+ * line buffer and copy the line into a byte ring owned by the writing
+ * thread (single producer, single consumer, no lock). A background
+ * flusher drains every ring, puts the lines back in the order they were
+ * written and hands them to stdout (WARN and ERROR to stderr) a batch at
+ * a time. When a thread's ring is full the line is dropped and counted,
+ * unless set_drop_when_full(false) asks the thread to wait instead.
+ *
+ * The level is checked before anything is formatted, so a disabled line
+ * costs one relaxed load. Every LOG_* site also has its own token bucket
+ * (set_rate_limit): a site that fires faster than the limit has the
+ * extra lines counted rather than written, and its next line that gets
+ * through says how many were suppressed.
+ *
+ * set_async(false) writes each line directly, under a lock, in the
+ * calling thread; the command-line batch mode uses it so its output
+ * keeps its order with everything else printed to the terminal.
+ */
+
+#pragma once
+
+#include "metrics.h"
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+class Logger {
+public:
+    enum Level { LEVEL_TRACE, LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR, LEVEL_OFF };
+
+    static constexpr size_t MAX_LINE_LENGTH = 8192;                     // longer lines are cut short
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 256 * 1024;    // per logging thread
+    static constexpr int FLUSH_INTERVAL_MS = 20;
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    bool enabled(Level level) const { return level >= level_.load(std::memory_order_relaxed); }
+    void set_level(Level level) { level_.store(level, std::memory_order_relaxed); }
+    Level level() const { return static_cast<Level>(level_.load(std::memory_order_relaxed)); }
+
+    // Lines per second each LOG_* site may write, with bursts of up to
+    // burst lines; 0 turns rate limiting off
+    void set_rate_limit(double per_second, uint32_t burst) {
+        burst_.store(std::max<uint32_t>(1, burst), std::memory_order_relaxed);
+        interval_ns_.store(per_second > 0 ? static_cast<int64_t>(1e9 / per_second) : 0, std::memory_order_relaxed);
+    }
+
+    void set_async(bool async) {
+        if (!async) {
+            flush();
+        }
+        async_.store(async, std::memory_order_relaxed);
+    }
+    void set_drop_when_full(bool drop) { drop_when_full_.store(drop, std::memory_order_relaxed); }
+
+    // Ring size for threads that have not logged yet
+    void set_buffer_size(size_t bytes) {
+        buffer_size_.store(std::max<size_t>(bytes, 2 * (MAX_LINE_LENGTH + sizeof(RecordHeader))), std::memory_order_relaxed);
+    }
+
+    // One line, or several; a newline is added if the text lacks one
+    void write(Level level, const char* text, size_t length) {
+        if (length == 0) {
+            return;
+        }
+        if (!async_.load(std::memory_order_relaxed) || stopping_.load()) {
+            write_direct(level, text, length);
+            return;
+        }
+        ThreadBuffer& buffer = thread_buffer();
+        length = std::min(length, buffer.size - sizeof(RecordHeader));
+        RecordHeader header;
+        header.seq = next_seq_.fetch_add(1, std::memory_order_relaxed);
+        header.length = static_cast<uint32_t>(length);
+        header.level = static_cast<uint32_t>(level);
+
+        size_t needed = sizeof(header) + length;
+        uint64_t head = buffer.head.load(std::memory_order_relaxed);
+        while (buffer.size - (head - buffer.tail.load(std::memory_order_acquire)) < needed) {
+            if (drop_when_full_.load(std::memory_order_relaxed) || stopping_.load()) {
+                dropped_metric_.add();
+                return;
+            }
+            wake_flusher();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        buffer.put(head, &header, sizeof(header));
+        buffer.put(head + sizeof(header), text, length);
+        buffer.head.store(head + needed, std::memory_order_release);
+        written_metric_.add();
+
+        // Past half full, don't leave it for the flusher's next tick
+        uint64_t used = head + needed - buffer.tail.load(std::memory_order_relaxed);
+        if (used >= buffer.size / 2 && used - needed < buffer.size / 2) {
+            wake_flusher();
+        }
+    }
+
+    void write(Level level, const std::string& text) { write(level, text.data(), text.size()); }
+
+    // Returns once every line written before the call has been handed to
+    // stdout or stderr
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!flusher_.joinable()) {
+            return;
+        }
+        uint64_t wanted = ++flush_requests_;
+        flush_cv_.notify_all();
+        done_cv_.wait(lock, [&] { return flushed_ >= wanted || !flusher_.joinable(); });
+    }
+
+    uint64_t lines_written() const { return written_metric_.value(); }
+    uint64_t lines_dropped() const { return dropped_metric_.value(); }
+    uint64_t lines_suppressed() const { return suppressed_metric_.value(); }
+
+    static const char* level_name(Level level) {
+        static const char* const names[] = {"trace", "debug", "info", "warn", "error", "off"};
+        return level >= LEVEL_TRACE && level <= LEVEL_OFF ? names[level] : "info";
+    }
+
+    // False, leaving level alone, for an unknown name
+    static bool parse_level(const std::string& name, Level& level) {
+        for (int i = LEVEL_TRACE; i <= LEVEL_OFF; i++) {
+            if (name == level_name(static_cast<Level>(i))) {
+                level = static_cast<Level>(i);
+                return true;
+            }
+        }
+        if (name == "warning") {
+            level = LEVEL_WARN;
+            return true;
+        }
+        return false;
+    }
+
+    // One LOG_* call site's token bucket, kept as a theoretical arrival time
+    // (GCRA) so allowing a line is a single compare-and-swap
+    class Site {
+    public:
+        bool allow() {
+            Logger& logger = Logger::instance();
+            int64_t interval = logger.interval_ns_.load(std::memory_order_relaxed);
+            if (interval == 0) {
+                return true;
+            }
+            int64_t tolerance = interval * (logger.burst_.load(std::memory_order_relaxed) - 1);
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t tat = tat_.load(std::memory_order_relaxed);
+            for (;;) {
+                int64_t start = std::max(tat, now);
+                if (start - now > tolerance) {
+                    suppressed_.fetch_add(1, std::memory_order_relaxed);
+                    logger.suppressed_metric_.add();
+                    return false;
+                }
+                if (tat_.compare_exchange_weak(tat, start + interval, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+        }
+
+        uint64_t take_suppressed() { return suppressed_.exchange(0, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<int64_t> tat_{0};
+        std::atomic<uint64_t> suppressed_{0};
+    };
+
+    // Formats one line in this thread's line buffer and writes it when it
+    // goes out of scope. Used through the LOG_* macros.
+    class Line {
+    public:
+        Line(Level level, Site* site) : level_(level), site_(site), buffer_(&LineBuffer::acquire(owned_)) {}
+        ~Line() {
+            if (site_) {
+                uint64_t suppressed = site_->take_suppressed();
+                if (suppressed > 0) {
+                    buffer_->stream << " (" << suppressed << " similar lines suppressed)";
+                }
+            }
+            Logger::instance().write(level_, buffer_->buf.data, buffer_->buf.length());
+            buffer_->busy = false;
+        }
+        Line(const Line&) = delete;
+        Line& operator=(const Line&) = delete;
+
+        std::ostream& stream() { return buffer_->stream; }
+
+    private:
+        struct FixedBuf : std::streambuf {
+            char data[MAX_LINE_LENGTH];
+            FixedBuf() { reset(); }
+            void reset() { setp(data, data + sizeof(data)); }
+            size_t length() const { return static_cast<size_t>(pptr() - pbase()); }
+        };
+
+        struct LineBuffer {
+            FixedBuf buf;
+            std::ostream stream;
+            std::ios_base::fmtflags flags;
+            bool busy;
+
+            LineBuffer() : stream(&buf), flags(stream.flags()), busy(false) {}
+
+            // This thread's buffer, or a private one when a line is formatted
+            // while another is (an operator<< that logs)
+            static LineBuffer& acquire(std::unique_ptr<LineBuffer>& owned) {
+                thread_local LineBuffer shared;
+                LineBuffer* line = &shared;
+                if (shared.busy) {
+                    owned.reset(new LineBuffer());
+                    line = owned.get();
+                }
+                line->busy = true;
+                line->buf.reset();
+                line->stream.clear();
+                line->stream.flags(line->flags);
+                line->stream.precision(6);
+                line->stream.fill(' ');
+                return *line;
+            }
+        };
+
+        Level level_;
+        Site* site_;
+        std::unique_ptr<LineBuffer> owned_;
+        LineBuffer* buffer_;
+    };
+
+private:
+    struct RecordHeader {
+        uint64_t seq;
+        uint32_t length;
+        uint32_t level;
+    };
+
+    // Written only by its thread and read only by the flusher; kept until
+    // drained after the thread exits
+    struct ThreadBuffer {
+        explicit ThreadBuffer(size_t bytes) : data(new char[bytes]), size(bytes), head(0), tail(0) {}
+
+        void put(uint64_t at, const void* from, size_t length) {
+            size_t offset = at % size;
+            size_t first = std::min(length, size - offset);
+            memcpy(data.get() + offset, from, first);
+            memcpy(data.get(), static_cast<const char*>(from) + first, length - first);
+        }
+
+        void get(uint64_t at, void* to, size_t length) const {
+            size_t offset = at % size;
+            size_t first = std::min(length, size - offset);
+            memcpy(to, data.get() + offset, first);
+            memcpy(static_cast<char*>(to) + first, data.get(), length - first);
+        }
+
+        std::unique_ptr<char[]> data;
+        size_t size;
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> tail;
+    };
+
+    struct Pending {
+        uint64_t seq;
+        uint32_t level;
+        size_t offset;
+        size_t length;
+    };
+
+    Logger()
+        : level_(LEVEL_INFO), interval_ns_(0), burst_(1), async_(true), drop_when_full_(true),
+          buffer_size_(DEFAULT_BUFFER_SIZE), next_seq_(0), stopping_(false), flush_requests_(0), flushed_(0),
+          written_metric_(MetricsRegistry::global().counter("trunk_decoder_log_lines_total",
+                                                            "Log lines, by what became of them", "result=\"written\"")),
+          dropped_metric_(MetricsRegistry::global().counter("trunk_decoder_log_lines_total",
+                                                            "Log lines, by what became of them", "result=\"dropped\"")),
+          suppressed_metric_(MetricsRegistry::global().counter("trunk_decoder_log_lines_total",
+                                                               "Log lines, by what became of them", "result=\"suppressed\"")) {}
+
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            flush_cv_.notify_all();
+        }
+        if (flusher_.joinable()) {
+            flusher_.join();
+        }
+    }
+
+    ThreadBuffer& thread_buffer() {
+        thread_local std::shared_ptr<ThreadBuffer> buffer;
+        if (!buffer) {
+            buffer = std::make_shared<ThreadBuffer>(buffer_size_.load(std::memory_order_relaxed));
+            std::lock_guard<std::mutex> lock(mutex_);
+            buffers_.push_back(buffer);
+            if (!flusher_.joinable() && !stopping_) {
+                flusher_ = std::thread(&Logger::flush_worker, this);
+            }
+        }
+        return *buffer;
+    }
+
+    void wake_flusher() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush_cv_.notify_all();
+    }
+
+    void flush_worker() {
+        std::vector<Pending> pending;
+        std::string text;
+        std::string out;
+        std::string err;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            flush_cv_.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS),
+                               [&] { return stopping_ || flush_requests_ > flushed_; });
+            bool stop = stopping_;
+            uint64_t requested = flush_requests_;
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers = buffers_;
+            lock.unlock();
+
+            pending.clear();
+            text.clear();
+            for (const auto& buffer : buffers) {
+                drain(*buffer, pending, text);
+            }
+            // Rings are drained one after another; put the lines back in the
+            // order they were written
+            std::sort(pending.begin(), pending.end(),
+                      [](const Pending& a, const Pending& b) { return a.seq < b.seq; });
+            out.clear();
+            err.clear();
+            for (const Pending& line : pending) {
+                std::string& to = line.level >= LEVEL_WARN ? err : out;
+                to.append(text, line.offset, line.length);
+                if (line.length == 0 || text[line.offset + line.length - 1] != '\n') {
+                    to += '\n';
+                }
+            }
+            write_all(STDOUT_FILENO, out.data(), out.size());
+            write_all(STDERR_FILENO, err.data(), err.size());
+
+            lock.lock();
+            // A thread that has exited leaves its ring behind; forget it once empty
+            buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(), [](const std::shared_ptr<ThreadBuffer>& buffer) {
+                return buffer.use_count() == 1 &&
+                       buffer->head.load(std::memory_order_acquire) == buffer->tail.load(std::memory_order_relaxed);
+            }), buffers_.end());
+            flushed_ = std::max(flushed_, requested);
+            done_cv_.notify_all();
+            if (stop) {
+                break;
+            }
+        }
+    }
+
+    static void drain(ThreadBuffer& buffer, std::vector<Pending>& pending, std::string& text) {
+        uint64_t head = buffer.head.load(std::memory_order_acquire);
+        uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+        while (tail < head) {
+            RecordHeader header;
+            buffer.get(tail, &header, sizeof(header));
+            Pending line = {header.seq, header.level, text.size(), header.length};
+            text.resize(text.size() + header.length);
+            buffer.get(tail + sizeof(header), &text[line.offset], header.length);
+            pending.push_back(line);
+            tail += sizeof(header) + header.length;
+        }
+        buffer.tail.store(tail, std::memory_order_release);
+    }
+
+    void write_direct(Level level, const char* text, size_t length) {
+        int fd = level >= LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO;
+        std::lock_guard<std::mutex> lock(direct_mutex_);
+        if (text[length - 1] == '\n') {
+            write_all(fd, text, length);
+        } else {
+            struct iovec parts[2] = {{const_cast<char*>(text), length}, {const_cast<char*>("\n"), 1}};
+            if (writev(fd, parts, 2) != static_cast<ssize_t>(length + 1)) {
+                // A short or failed writev: fall back to plain writes for the rest
+                write_all(fd, text, length);
+                write_all(fd, "\n", 1);
+            }
+        }
+        written_metric_.add();
+    }
+
+    static void write_all(int fd, const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t n = ::write(fd, data, length);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;   // nowhere to report it
+            }
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+    }
+
+    std::atomic<int> level_;
+    std::atomic<int64_t> interval_ns_;
+    std::atomic<uint32_t> burst_;
+    std::atomic<bool> async_;
+    std::atomic<bool> drop_when_full_;
+    std::atomic<size_t> buffer_size_;
+    std::atomic<uint64_t> next_seq_;
+    std::atomic<bool> stopping_;
+
+    std::mutex mutex_;
+    std::condition_variable flush_cv_;
+    std::condition_variable done_cv_;
+    std::thread flusher_;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+    uint64_t flush_requests_;
+    uint64_t flushed_;
+    std::mutex direct_mutex_;
+
+    MetricsRegistry::Counter& written_metric_;
+    MetricsRegistry::Counter& dropped_metric_;
+    MetricsRegistry::Counter& suppressed_metric_;
+};
+
+// The "logging" config block
+struct LogPolicy {
+    Logger::Level level = Logger::LEVEL_INFO;
+    double rate_limit = 100;         // lines per second per log site, 0 for no limit
+    uint32_t burst = 200;
+    bool async = true;
+    bool drop_when_full = true;
+    size_t buffer_kb = Logger::DEFAULT_BUFFER_SIZE / 1024;
+
+    static LogPolicy from_json(const nlohmann::json& j) {
+        LogPolicy policy;
+        if (!j.is_object()) {
+            return policy;
+        }
+        Logger::parse_level(j.value("level", std::string(Logger::level_name(policy.level))), policy.level);
+        policy.rate_limit = std::max(0.0, j.value("rate_limit", policy.rate_limit));
+        policy.burst = j.value("burst", policy.burst);
+        policy.async = j.value("async", policy.async);
+        policy.drop_when_full = j.value("drop_when_full", policy.drop_when_full);
+        policy.buffer_kb = j.value("buffer_kb", policy.buffer_kb);
+        return policy;
+    }
+
+    void apply(Logger& logger = Logger::instance()) const {
+        logger.set_level(level);
+        logger.set_rate_limit(rate_limit, burst);
+        logger.set_buffer_size(buffer_kb * 1024);
+        logger.set_drop_when_full(drop_when_full);
+        logger.set_async(async);
+    }
+};
+
+// The level is checked before expr is evaluated; expr is anything that can
+// follow "stream <<", e.g. LOG_INFO("[JobManager] Completed job " << id)
+#define TD_LOG(level, expr)                                              \
+    do {                                                                 \
+        if (Logger::instance().enabled(level)) {                         \
+            static Logger::Site td_log_site_;                            \
+            if (td_log_site_.allow()) {                                  \
+                Logger::Line td_log_line_(level, &td_log_site_);         \
+                td_log_line_.stream() << expr;                           \
+            }                                                            \
+        }                                                                \
+    } while (0)
+
+#define LOG_TRACE(expr) TD_LOG(Logger::LEVEL_TRACE, expr)
+#define LOG_DEBUG(expr) TD_LOG(Logger::LEVEL_DEBUG, expr)
+#define LOG_INFO(expr) TD_LOG(Logger::LEVEL_INFO, expr)
+#define LOG_WARN(expr) TD_LOG(Logger::LEVEL_WARN, expr)
+#define LOG_ERROR(expr) TD_LOG(Logger::LEVEL_ERROR, expr)
@@ -15,6 +15,8 @@
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <cctype>
 #include <vector>
 #include <filesystem>
 #include <algorithm>
@@ -24,11 +26,22 @@
 #include <sstream>
 #include <thread>
 #include <map>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
 #include "p25_decoder.h"
+#include "decoder_pool.h"
+#include "archive_index.h"
+#include "key_store.h"
 #include "api_service.h"
 #include "input_plugin_manager.h"
 #include "output_plugin_manager.h"
 #include "plugin_router.h"
+#include "tsbk_sequencer.h"
+#include "logger.h"
+#include "trunking_state.h"
+#include "plugin_host.h"
+#include "thread_placement.h"
 #include "plugin_api.h"
 #include <boost/dll/shared_library.hpp>
 #include <boost/dll/import.hpp>
@@ -48,6 +61,7 @@ struct DecoderConfig {
     bool enable_json = false;
     bool enable_wav = false;
     bool enable_text = false;
+    bool enable_imbe = false;           // FILE.imbe parameter archive, synthesised on demand
     bool recursive = false;
     bool verbose = false;
     bool quiet = false;
@@ -63,8 +77,13 @@ struct DecoderConfig {
     std::map<std::string, std::string> metadata_fields;
     
     // Output settings
-    int audio_sample_rate = 8000;
-    std::string audio_format = "wav"; // "wav", "mp3", "m4a", "opus", "webm"
+    int audio_sample_rate = 8000;       // resampled in-process from the vocoder's 8 kHz
+    double audio_gain_db = 0.0;
+    bool agc = false;                   // level each call toward -18 dBFS RMS
+    bool wav_direct_io = false;         // O_DIRECT WAV writes for archive disks
+    bool wav_drop_cache = false;        // keep written calls out of the page cache
+    bool frame_index = false;           // write FILE.p25.idx next to each decoded call
+    std::string audio_format = "wav"; // "wav", "flac", "mp3", "m4a", "opus", "webm"
     int audio_bitrate = 0; // 0 = auto, otherwise kbps (e.g. 64, 128)
     bool include_frame_analysis = true;
     
@@ -88,7 +107,15 @@ struct DecoderConfig {
     std::vector<IngestStream> ingest_streams;
     
     // Processing options
-    bool process_encrypted = true;
+    bool process_encrypted = true;      // false: no vocoder work on voice we hold no key for
+    bool encrypted_metadata_only = false; // also no audio file for calls never decrypted (implies not processing them)
+    bool frame_concealment = false;     // repeat/mute bad IMBE frames instead of synthesizing them
+    int conceal_max_repeats = 3;
+    bool skip_silence = false;          // no synthesis for frames too quiet to hear
+    bool compact_silence = false;       // cut long silent stretches out of the audio files
+    int silence_keep_ms = P25Decoder::DEFAULT_SILENCE_KEEP_MS;
+    std::string vocoder = "fixed";      // IMBE synthesis backend: fixed or float
+    int segment_threads = 1;            // synthesise long calls as this many parallel segments
     bool skip_empty_frames = false;
     
     // Post-processing
@@ -102,6 +129,8 @@ struct DecoderConfig {
         std::string algorithm;
     };
     std::vector<KeyInfo> decryption_keys;
+    std::string key_file;          // file with a decryption_keys array; defaults to the config file
+    int key_reload_interval = 5;   // seconds between checks for a changed key file
     
     // Input plugin configuration
     struct InputPluginConfig {
@@ -137,6 +166,22 @@ struct DecoderConfig {
         bool enabled = true;
     };
     std::vector<RoutingRule> routing_rules;
+    
+    // "routing_rules" and "output_queues" as written, for PluginRouter;
+    // empty when the file has no routing_rules
+    json routing = json::object();
+    
+    // Reorder buffer and cross-feed dedupe ahead of the router (tsbk_sequencer.h)
+    json tsbk_sequencer = json::object();
+    
+    // Talkgroup/unit tables decoded from routed TSBKs (trunking_state.h)
+    json trunking = json::object();
+    
+    // CPU and NUMA placement per thread pool (thread_placement.h)
+    json threading = json::object();
+    
+    // Console log level, rate limiting and buffering (logger.h)
+    json logging = json::object();
 };
 
 // Simple JSON implementation for parsing (from api_service.cc)
@@ -214,6 +259,7 @@ bool parse_config_file(const std::string& config_path, DecoderConfig& config) {
     config.enable_json = json.get_bool("enable_json", config.enable_json);
     config.enable_wav = json.get_bool("enable_wav", config.enable_wav);
     config.enable_text = json.get_bool("enable_text", config.enable_text);
+    config.enable_imbe = json.get_bool("enable_imbe", config.enable_imbe);
     config.recursive = json.get_bool("recursive", config.recursive);
     config.verbose = json.get_bool("verbose", config.verbose);
     config.quiet = json.get_bool("quiet", config.quiet);
@@ -225,10 +271,24 @@ bool parse_config_file(const std::string& config_path, DecoderConfig& config) {
     config.ssl_key = json.get("ssl_key", config.ssl_key);
     config.audio_format = json.get("audio_format", config.audio_format);
     config.process_encrypted = json.get_bool("process_encrypted", config.process_encrypted);
+    config.encrypted_metadata_only = json.get_bool("encrypted_metadata_only", config.encrypted_metadata_only);
+    config.frame_concealment = json.get_bool("frame_concealment", config.frame_concealment);
+    config.conceal_max_repeats = std::stoi(json.get("conceal_max_repeats", std::to_string(config.conceal_max_repeats)));
+    config.skip_silence = json.get_bool("skip_silence", config.skip_silence);
+    config.compact_silence = json.get_bool("compact_silence", config.compact_silence);
+    config.silence_keep_ms = std::stoi(json.get("silence_keep_ms", std::to_string(config.silence_keep_ms)));
+    config.vocoder = json.get("vocoder", config.vocoder);
+    config.segment_threads = std::stoi(json.get("segment_threads", std::to_string(config.segment_threads)));
     config.skip_empty_frames = json.get_bool("skip_empty_frames", config.skip_empty_frames);
     config.include_frame_analysis = json.get_bool("include_frame_analysis", config.include_frame_analysis);
     config.upload_script = json.get("upload_script", config.upload_script);
     config.audio_bitrate = std::stoi(json.get("audio_bitrate", std::to_string(config.audio_bitrate)));
+    config.audio_sample_rate = std::stoi(json.get("audio_sample_rate", std::to_string(config.audio_sample_rate)));
+    config.audio_gain_db = std::stod(json.get("audio_gain_db", std::to_string(config.audio_gain_db)));
+    config.agc = json.get_bool("agc", config.agc);
+    config.wav_direct_io = json.get_bool("wav_direct_io", config.wav_direct_io);
+    config.wav_drop_cache = json.get_bool("wav_drop_cache", config.wav_drop_cache);
+    config.frame_index = json.get_bool("frame_index", config.frame_index);
     
     // Parse input_plugins array manually using nlohmann::json
     try {
@@ -259,6 +319,29 @@ bool parse_config_file(const std::string& config_path, DecoderConfig& config) {
             }
         }
         
+        if (full_config.contains("routing_rules")) {
+            config.routing["routing_rules"] = full_config["routing_rules"];
+            if (full_config.contains("output_queues")) {
+                config.routing["output_queues"] = full_config["output_queues"];
+            }
+        }
+        
+        if (full_config.contains("tsbk_sequencer")) {
+            config.tsbk_sequencer = full_config["tsbk_sequencer"];
+        }
+        
+        if (full_config.contains("trunking")) {
+            config.trunking = full_config["trunking"];
+        }
+        
+        if (full_config.contains("threading")) {
+            config.threading = full_config["threading"];
+        }
+        
+        if (full_config.contains("logging")) {
+            config.logging = full_config["logging"];
+        }
+        
         // Parse plugins array (for call processing)
         if (full_config.contains("plugins") && full_config["plugins"].is_array()) {
             for (const auto& plugin_json : full_config["plugins"]) {
@@ -274,12 +357,47 @@ bool parse_config_file(const std::string& config_path, DecoderConfig& config) {
         // Ignore parsing errors for plugins, fallback to defaults
     }
     
-    // TODO: Parse decryption_keys array from JSON config
-    // For now, use command line -k options for key specification
+    // The decryption_keys array itself is loaded by KeyStore, which can reload it while running
+    config.key_file = json.get("key_file", config.key_file);
+    config.key_reload_interval = std::stoi(json.get("key_reload_interval", std::to_string(config.key_reload_interval)));
     
     return true;
 }
 
+// Re-read the config file while the plugin system runs: routing rules swap
+// in whole, and an output plugin whose config changed is restarted on its
+// own. Adding or removing plugins still needs a restart.
+void reload_plugin_config(const std::string& config_path, PluginRouter& router,
+                          OutputPluginManager& output_manager, bool verbose) {
+    DecoderConfig config;
+    if (!parse_config_file(config_path, config)) {
+        std::cerr << "Keeping the running configuration" << std::endl;
+        return;
+    }
+    
+    if (!config.routing.empty() && router.reload_routes_from_config(config.routing) != 0) {
+        std::cerr << "Keeping the previous routing rules" << std::endl;
+    }
+    
+    for (const auto& plugin_config : config.output_plugins) {
+        if (!plugin_config.enabled) {
+            continue;
+        }
+        json running = output_manager.get_config(plugin_config.name);
+        if (running.is_null()) {
+            std::cerr << "Output plugin " << plugin_config.name << " is new, restart to load it" << std::endl;
+        } else if (running != plugin_config.config_data) {
+            if (router.restart_output(plugin_config.name, plugin_config.config_data) != 0) {
+                std::cerr << "Output plugin " << plugin_config.name << " keeps its previous config" << std::endl;
+            }
+        }
+    }
+    
+    if (verbose) {
+        std::cout << "Reloaded plugin configuration from " << config_path << std::endl;
+    }
+}
+
 void print_usage(const std::string& program_name) {
     std::cout << "Usage: " << program_name << " [options] [p25_file_or_directory]\n";
     std::cout << "       " << program_name << " -c <config.json>\n\n";
@@ -298,26 +416,57 @@ void print_usage(const std::string& program_name) {
     std::cout << "  -k, --key KEYID:KEY     Add decryption key (hex format)\n";
     std::cout << "                          Key length determines algorithm:\n";
     std::cout << "                          5 bytes = ADP/RC4, 8 bytes = DES-OFB, 32 bytes = AES-256\n";
-    std::cout << "  -b, --bitrate RATE      Audio bitrate in kbps (default: auto per format)\n\n";
+    std::cout << "  -b, --bitrate RATE      Audio bitrate in kbps (default: auto per format)\n";
+    std::cout << "  -j, --jobs N            Decode N files in parallel, largest first (default: 1)\n";
+    std::cout << "  --manifest FILE         Skip files listed in FILE and append each file decoded\n";
+    std::cout << "                          (resume an interrupted batch)\n";
+    std::cout << "  --index FILE            Keep a content-hash index of decoded files and skip\n";
+    std::cout << "                          files unchanged since they were last decoded\n";
+    std::cout << "  --skip-encrypted        Do not vocode voice encrypted with a key we do not hold\n";
+    std::cout << "  --encrypted-metadata-only\n";
+    std::cout << "                          As --skip-encrypted, and write only metadata for calls\n";
+    std::cout << "                          that could not be decrypted at all\n";
+    std::cout << "  --conceal [N]           Repeat the last good audio for frames the FEC could not\n";
+    std::cout << "                          recover, muting after N repeats (default: 3)\n";
+    std::cout << "  --skip-silence          Output zeros for frames too quiet to hear (under about\n";
+    std::cout << "                          -60 dBFS) without synthesizing them (fixed vocoder)\n";
+    std::cout << "  --compact-silence [MS]  Cut silent stretches in the audio down to MS each\n";
+    std::cout << "                          (default: 500); the JSON reports the time cut\n";
+    std::cout << "  --vocoder fixed|float   IMBE synthesis backend: the fixed-point reference\n";
+    std::cout << "                          decoder (default) or the faster floating point one\n";
+    std::cout << "  --segment-threads N     Synthesise calls over a minute long as up to N segments\n";
+    std::cout << "                          in parallel, split where transmissions end\n";
+    std::cout << "  --sample-rate HZ        Output audio rate, resampled from 8000 (e.g. 16000, 48000)\n";
+    std::cout << "  --gain DB               Fixed gain applied to the decoded audio\n";
+    std::cout << "  --agc                   Level each call toward -18 dBFS\n";
+    std::cout << "  --direct-io             Write WAV files with O_DIRECT and keep them out of the\n";
+    std::cout << "                          page cache (archive disks)\n";
+    std::cout << "  --frame-index           Write FILE.p25.idx next to each call for fast --range\n";
+    std::cout << "  --range START-END       Decode only seconds START to END of each call's voice\n";
+    std::cout << "                          (END may be left out to run to the end)\n\n";
     std::cout << "Output format options (must specify at least one):\n";
     std::cout << "  --json                  Generate JSON metadata files\n";
     std::cout << "  --wav                   Generate WAV audio files\n";
     std::cout << "  --text                  Generate text dump files\n";
-    std::cout << "  --csv                   Generate CSV frame analysis files\n\n";
+    std::cout << "  --csv                   Generate CSV frame analysis files\n";
+    std::cout << "  --imbe                  Generate IMBE parameter archives (decode them later\n";
+    std::cout << "                          by passing the .imbe file as input)\n\n";
     std::cout << "Additional format options:\n";
+    std::cout << "  --flac                  Generate FLAC audio files (lossless, encoded in-process)\n";
     std::cout << "  --mp3                   Generate MP3 audio files (legacy compatibility)\n";
     std::cout << "  --m4a                   Generate M4A/AAC audio files (web-optimized)\n";
     std::cout << "  --opus                  Generate Opus audio files (best compression)\n";
     std::cout << "  --webm                  Generate WebM/Opus audio files (web native)\n";
     std::cout << "  --transcript            Generate voice transcription (unimplemented)\n\n";
     std::cout << "Input:\n";
-    std::cout << "  Single file:            Process one .p25 file\n";
+    std::cout << "  Single file:            Process one .p25 file, or synthesise one .imbe archive\n";
     std::cout << "  Directory:              Process all .p25 files in directory\n\n";
     std::cout << "Output files:\n";
     std::cout << "  FILENAME.wav            WAV audio file (16-bit, 8kHz, mono)\n";
     std::cout << "  FILENAME.json           Call metadata in JSON format\n";
     std::cout << "  FILENAME.txt            Text dump of P25 frame analysis\n";
-    std::cout << "  FILENAME.csv            CSV frame data for spreadsheet analysis\n\n";
+    std::cout << "  FILENAME.csv            CSV frame data for spreadsheet analysis\n";
+    std::cout << "  FILENAME.imbe           IMBE voice parameters and metadata (about 5.7 kbps)\n\n";
 }
 
 // Helper function to parse hex key string with algorithm detection
@@ -421,13 +570,24 @@ std::vector<std::string> find_p25_files(const std::string& directory_path, bool
     return p25_files;
 }
 
+// Serializes console output when several files are decoded at once
+static std::mutex console_mutex;
+
 bool process_single_file(const std::string& input_file, const std::string& output_dir, 
                         bool verbose, bool quiet, bool enable_json, bool enable_wav, bool enable_text, bool enable_csv,
-                        const std::string& audio_format, int audio_bitrate, P25Decoder& decoder) {
+                        const std::string& audio_format, int audio_bitrate, P25Decoder& decoder,
+                        double range_start = 0.0, double range_end = 0.0, bool enable_imbe = false) {
+    
+    // Every file starts from a clean decoder, whatever was decoded before it
+    decoder.reset();
+    
+    // An IMBE archive from an earlier --imbe run is synthesised, not parsed
+    const bool from_archive = fs::path(input_file).extension() == ".imbe";
     
     // Open P25 file
-    if (!decoder.open_p25_file(input_file)) {
+    if (!from_archive && !decoder.open_p25_file(input_file)) {
         if (!quiet) {
+            std::lock_guard<std::mutex> lock(console_mutex);
             std::cerr << "Error: Failed to open P25 file: " << input_file << std::endl;
         }
         return false;
@@ -438,6 +598,7 @@ bool process_single_file(const std::string& input_file, const std::string& outpu
     std::string output_prefix = fs::path(output_dir) / filename;
 
     if (!quiet) {
+        std::lock_guard<std::mutex> lock(console_mutex);
         std::cout << "Processing: " << fs::path(input_file).filename().string();
         if (verbose) {
             std::cout << " -> " << output_prefix;
@@ -450,73 +611,338 @@ bool process_single_file(const std::string& input_file, const std::string& outpu
     decoder.set_audio_format(audio_format);
     decoder.set_audio_bitrate(audio_bitrate);
 
-    // Decode based on enabled formats
-    bool success = true;
+    // Decode once; every enabled output is fed from the same pass over the file
+    DecodeOutputs outputs;
+    outputs.wav = enable_wav;
+    outputs.json = enable_json;
+    outputs.text = enable_text;
+    outputs.csv = enable_csv;
+    outputs.imbe = enable_imbe;
+    outputs.start_s = range_start;
+    outputs.end_s = range_end;
     
-    if (enable_wav) {
-        if (!decoder.decode_to_audio(output_prefix)) {
-            if (!quiet) {
-                std::cerr << "Error: Failed to decode P25 audio: " << input_file << std::endl;
-            }
-            success = false;
+    bool decoded = from_archive ? decoder.synthesize_archive(input_file, output_prefix, outputs)
+                                : decoder.decode_to_outputs(output_prefix, outputs);
+    if (!decoded) {
+        if (!quiet) {
+            std::lock_guard<std::mutex> lock(console_mutex);
+            std::cerr << "Error: Failed to decode P25 file: " << input_file << std::endl;
+        }
+        return false;
+    }
+
+    if (verbose) {
+        std::lock_guard<std::mutex> lock(console_mutex);
+        const CallMetadata& metadata = decoder.get_call_metadata();
+        std::cout << "  NAC: 0x" << std::hex << metadata.nac << std::dec;
+        std::cout << ", Frames: " << metadata.total_frames;
+        std::cout << ", Voice: " << metadata.voice_frames;
+        std::cout << ", Duration: " << std::fixed << std::setprecision(2) << metadata.call_length << "s";
+        if (metadata.voice_quality.codewords() > 0) {
+            std::cout << ", BER: " << std::setprecision(4) << metadata.voice_quality.bit_error_rate()
+                      << ", Bad frames: " << std::setprecision(1) << metadata.voice_quality.bad_frame_rate() * 100 << "%";
+        }
+        std::cout << std::endl;
+    }
+
+    return true;
+}
+
+// Everything a batch run needs besides the list of files
+struct BatchSettings {
+    std::string output_dir;
+    bool verbose = false;
+    bool quiet = false;
+    bool enable_json = false;
+    bool enable_wav = false;
+    bool enable_text = false;
+    bool enable_csv = false;
+    std::string audio_format = "wav";
+    int audio_bitrate = 0;
+    int jobs = 1;
+    std::string manifest_path;
+    std::string index_path;
+    std::map<uint16_t, std::vector<uint8_t>> des_keys;
+    std::map<uint16_t, std::vector<uint8_t>> aes_keys;
+    std::map<uint16_t, std::vector<uint8_t>> adp_keys;
+    bool skip_encrypted = false;
+    bool encrypted_metadata_only = false;
+    int conceal_max_repeats = -1;   // -1: synthesize every frame
+    bool skip_silence = false;
+    int silence_keep_ms = -1;       // -1: no silence compaction
+    VoiceSynth::Backend vocoder = VoiceSynth::FIXED_POINT;
+    int sample_rate = 8000;
+    AudioGain::Settings gain;
+    WavWriter::Options wav_options;
+    int segment_threads = 1;
+    bool frame_index = false;
+    double range_start = 0.0;   // seconds of voice; range_end 0 for the rest of the call
+    double range_end = 0.0;
+    bool enable_imbe = false;
+};
+
+// Output settings that must match for an indexed result to be reused
+static std::string index_settings(const BatchSettings& settings) {
+    std::ostringstream out;
+    out << (settings.enable_wav ? "wav" : "") << (settings.enable_json ? "+json" : "")
+        << (settings.enable_text ? "+text" : "") << (settings.enable_csv ? "+csv" : "")
+        << (settings.enable_imbe ? "+imbe" : "")
+        << ";format=" << settings.audio_format << ";bitrate=" << settings.audio_bitrate
+        << ";keys=" << settings.des_keys.size() + settings.aes_keys.size() + settings.adp_keys.size()
+        << (settings.skip_encrypted ? ";skip-encrypted" : "") << (settings.encrypted_metadata_only ? ";metadata-only" : "")
+        << (settings.conceal_max_repeats >= 0 ? ";conceal=" + std::to_string(settings.conceal_max_repeats) : "")
+        << (settings.skip_silence ? ";skip-silence" : "")
+        << (settings.silence_keep_ms >= 0 ? ";compact-silence=" + std::to_string(settings.silence_keep_ms) : "")
+        << (settings.vocoder != VoiceSynth::FIXED_POINT ? std::string(";vocoder=") + VoiceSynth::backend_name(settings.vocoder) : "")
+        << (settings.sample_rate != 8000 ? ";rate=" + std::to_string(settings.sample_rate) : "")
+        << (settings.gain.gain_db != 0.0 ? ";gain=" + std::to_string(settings.gain.gain_db) : "")
+        << (settings.gain.agc ? ";agc" : "")
+        << (settings.segment_threads > 1 ? ";segments=" + std::to_string(settings.segment_threads) : "")
+        << (settings.range_start > 0.0 || settings.range_end > 0.0
+            ? ";range=" + std::to_string(settings.range_start) + "-" + std::to_string(settings.range_end) : "");
+    return out.str();
+}
+
+// The files process_single_file leaves behind for input_file
+static std::vector<std::string> expected_outputs(const std::string& input_file, const BatchSettings& settings) {
+    std::string prefix = (fs::path(settings.output_dir) / fs::path(input_file).stem()).string();
+    std::vector<std::string> outputs;
+    // Calls that could not be decrypted may have been left without audio
+    if (settings.enable_wav && fs::exists(prefix + ".wav")) {
+        outputs.push_back(prefix + ".wav");
+        if (settings.audio_format != "wav" && fs::exists(prefix + "." + settings.audio_format)) {
+            outputs.push_back(prefix + "." + settings.audio_format);
+        }
+    }
+    if (settings.enable_json) outputs.push_back(prefix + ".json");
+    if (settings.enable_text) outputs.push_back(prefix + ".txt");
+    if (settings.enable_csv) outputs.push_back(prefix + ".csv");
+    // Archives are only written by full decodes of .p25 files
+    if (settings.enable_imbe && fs::path(input_file).extension() == ".p25" &&
+        settings.range_start <= 0.0 && settings.range_end <= 0.0) {
+        outputs.push_back(prefix + ".imbe");
+    }
+    return outputs;
+}
+
+// A manifest holds one absolute path per line for each file already decoded
+static std::string manifest_key(const std::string& file) {
+    std::error_code ec;
+    fs::path absolute = fs::absolute(file, ec);
+    return ec ? file : absolute.lexically_normal().string();
+}
+
+static std::unordered_set<std::string> read_manifest(const std::string& manifest_path) {
+    std::unordered_set<std::string> done;
+    std::ifstream manifest(manifest_path);
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (!line.empty()) {
+            done.insert(line);
+        }
+    }
+    return done;
+}
+
+static void configure_decoder(P25Decoder& decoder, const BatchSettings& settings) {
+    decoder.set_skip_undecodable(settings.skip_encrypted || settings.encrypted_metadata_only,
+                                 settings.encrypted_metadata_only);
+    decoder.set_frame_concealment(settings.conceal_max_repeats >= 0, settings.conceal_max_repeats);
+    decoder.set_vocoder(settings.vocoder);
+    decoder.set_silence_skip(settings.skip_silence);
+    decoder.set_silence_compaction(settings.silence_keep_ms >= 0, settings.silence_keep_ms);
+    decoder.set_segment_parallelism(settings.segment_threads);
+    decoder.set_output_sample_rate(settings.sample_rate);
+    decoder.set_audio_gain(settings.gain);
+    decoder.set_wav_write_options(settings.wav_options);
+    decoder.set_frame_index(settings.frame_index);
+    if (settings.des_keys.empty() && settings.aes_keys.empty() && settings.adp_keys.empty() &&
+        KeyStore::instance().snapshot()->size() == 0) {
+        return;
+    }
+    decoder.enable_decryption(true);
+    for (const auto& key_pair : settings.des_keys) {
+        decoder.add_des_key(key_pair.first, key_pair.second);
+    }
+    for (const auto& key_pair : settings.aes_keys) {
+        decoder.add_aes_key(key_pair.first, key_pair.second);
+    }
+    for (const auto& key_pair : settings.adp_keys) {
+        decoder.add_adp_key(key_pair.first, key_pair.second);
+    }
+}
+
+// Decode a file or a directory of files. With -j N, N workers each lease a
+// decoder and take the next file from a shared index; files are ordered
+// largest first so a long call is never the last thing left running.
+int run_batch(const std::string& input_path, bool recursive, const BatchSettings& settings) {
+    std::vector<std::string> files_to_process;
+    
+    // Check if input is a file or directory
+    if (fs::is_regular_file(input_path)) {
+        // Single file
+        if (fs::path(input_path).extension() != ".p25" && fs::path(input_path).extension() != ".imbe") {
+            std::cerr << "Error: Input file must have .p25 or .imbe extension" << std::endl;
+            return 1;
+        }
+        files_to_process.push_back(input_path);
+    } else if (fs::is_directory(input_path)) {
+        // Directory - find all .p25 files
+        files_to_process = find_p25_files(input_path, recursive);
+        if (files_to_process.empty()) {
+            std::cout << "No .p25 files found in " << input_path << std::endl;
+            return 0;
         }
     } else {
-        // Still need to process P25 frames for metadata, just don't save audio
-        if (!decoder.process_frames_only()) {
-            if (!quiet) {
-                std::cerr << "Error: Failed to process P25 frames: " << input_file << std::endl;
-            }
-            success = false;
+        std::cerr << "Error: Input path does not exist or is not accessible: " << input_path << std::endl;
+        return 1;
+    }
+    
+    // Resume: drop files an earlier run already finished
+    std::ofstream manifest;
+    size_t skipped = 0;
+    if (!settings.manifest_path.empty()) {
+        std::unordered_set<std::string> done = read_manifest(settings.manifest_path);
+        if (!done.empty()) {
+            auto finished = [&done](const std::string& file) { return done.count(manifest_key(file)) > 0; };
+            auto kept_end = std::remove_if(files_to_process.begin(), files_to_process.end(), finished);
+            skipped = files_to_process.end() - kept_end;
+            files_to_process.erase(kept_end, files_to_process.end());
+        }
+        manifest.open(settings.manifest_path, std::ios::app);
+        if (!manifest.is_open()) {
+            std::cerr << "Error: Cannot write manifest " << settings.manifest_path << std::endl;
+            return 1;
         }
     }
     
-    if (!success) {
-        return false;
+    std::unique_ptr<ArchiveIndex> index;
+    if (!settings.index_path.empty()) {
+        index.reset(new ArchiveIndex(settings.index_path, P25_DECODER_VERSION, index_settings(settings)));
+        if (!index->open()) {
+            std::cerr << "Error: Cannot write index " << settings.index_path << std::endl;
+            return 1;
+        }
     }
     
-    // Generate JSON metadata if requested
-    if (enable_json) {
-        std::string json_filename = output_prefix + ".json";
-        if (!decoder.save_json_metadata(json_filename)) {
-            if (!quiet) {
-                std::cerr << "Warning: Failed to save JSON metadata: " << json_filename << std::endl;
-            }
+    if (!settings.quiet) {
+        std::cout << "Found " << files_to_process.size() << " P25 file(s) to process";
+        if (skipped > 0) {
+            std::cout << " (" << skipped << " already in manifest)";
         }
+        std::cout << std::endl;
+    }
+    if (files_to_process.empty()) {
+        return 0;
     }
     
-    // Generate text dump if requested
-    if (enable_text) {
-        std::string text_filename = output_prefix + ".txt";
-        if (!decoder.save_text_dump(text_filename)) {
-            if (!quiet) {
-                std::cerr << "Warning: Failed to save text dump: " << text_filename << std::endl;
-            }
+    int jobs = std::max(1, std::min(settings.jobs, static_cast<int>(files_to_process.size())));
+    if (jobs > 1) {
+        std::vector<std::pair<uintmax_t, std::string>> sized;
+        sized.reserve(files_to_process.size());
+        for (const auto& file : files_to_process) {
+            std::error_code ec;
+            uintmax_t size = fs::file_size(file, ec);
+            sized.emplace_back(ec ? 0 : size, file);
+        }
+        std::stable_sort(sized.begin(), sized.end(),
+                         [](const std::pair<uintmax_t, std::string>& a, const std::pair<uintmax_t, std::string>& b) {
+                             return a.first > b.first;
+                         });
+        for (size_t i = 0; i < sized.size(); i++) {
+            files_to_process[i] = std::move(sized[i].second);
         }
     }
     
-    // Generate CSV dump if requested
-    if (enable_csv) {
-        std::string csv_filename = output_prefix + ".csv";
-        if (!decoder.save_csv_dump(csv_filename)) {
-            if (!quiet) {
-                std::cerr << "Warning: Failed to save CSV dump: " << csv_filename << std::endl;
+    if (!settings.quiet) {
+        int total_keys = settings.des_keys.size() + settings.aes_keys.size() + settings.adp_keys.size();
+        if (total_keys > 0) {
+            std::cout << "Enabled decryption with " << total_keys << " key(s): ";
+            if (!settings.des_keys.empty()) std::cout << settings.des_keys.size() << " DES ";
+            if (!settings.aes_keys.empty()) std::cout << settings.aes_keys.size() << " AES ";
+            if (!settings.adp_keys.empty()) std::cout << settings.adp_keys.size() << " ADP ";
+            std::cout << std::endl;
+        }
+        if (jobs > 1) {
+            std::cout << "Decoding with " << jobs << " parallel jobs" << std::endl;
+        }
+    }
+    
+    // Process all files (file mode)
+    DecoderPool decoders;
+    decoders.prewarm(static_cast<size_t>(jobs));
+    std::atomic<size_t> next_file(0);
+    std::atomic<int> successful(0);
+    std::atomic<int> failed(0);
+    std::atomic<int> unchanged(0);
+    std::mutex manifest_mutex;
+    auto start_time = std::chrono::steady_clock::now();
+    
+    auto worker = [&]() {
+        DecoderPool::Lease decoder = decoders.acquire();
+        configure_decoder(*decoder, settings);
+        for (size_t i = next_file++; i < files_to_process.size(); i = next_file++) {
+            const std::string& file = files_to_process[i];
+            std::string content_hash;
+            if (index && index->up_to_date(file, content_hash)) {
+                unchanged++;
+                continue;
+            }
+            if (process_single_file(file, settings.output_dir, settings.verbose, settings.quiet,
+                                    settings.enable_json, settings.enable_wav, settings.enable_text, settings.enable_csv,
+                                    settings.audio_format, settings.audio_bitrate, *decoder,
+                                    settings.range_start, settings.range_end, settings.enable_imbe)) {
+                successful++;
+                if (index) {
+                    index->record(file, content_hash, expected_outputs(file, settings));
+                }
+                if (manifest.is_open()) {
+                    std::lock_guard<std::mutex> lock(manifest_mutex);
+                    manifest << manifest_key(file) << std::endl;
+                }
+            } else {
+                failed++;
             }
         }
+    };
+    
+    std::vector<std::thread> workers;
+    for (int i = 1; i < jobs; i++) {
+        workers.emplace_back(worker);
     }
-
-    if (verbose) {
-        const CallMetadata& metadata = decoder.get_call_metadata();
-        std::cout << "  NAC: 0x" << std::hex << metadata.nac << std::dec;
-        std::cout << ", Frames: " << metadata.total_frames;
-        std::cout << ", Voice: " << metadata.voice_frames;
-        std::cout << ", Duration: " << std::fixed << std::setprecision(2) << metadata.call_length << "s";
-        std::cout << std::endl;
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
     }
-
-    return true;
+    
+    if (index && !index->compact() && !settings.quiet) {
+        std::cerr << "Warning: Could not compact index " << settings.index_path << std::endl;
+    }
+    
+    auto end_time = std::chrono::steady_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    
+    if (!settings.quiet) {
+        std::cout << "\nProcessing complete!" << std::endl;
+        std::cout << "Successful: " << successful << std::endl;
+        if (unchanged > 0) {
+            std::cout << "Unchanged (skipped): " << unchanged << std::endl;
+        }
+        if (failed > 0) {
+            std::cout << "Failed: " << failed << std::endl;
+        }
+        std::cout << "Total time: " << duration.count() << "ms" << std::endl;
+    }
+    
+    return (failed > 0) ? 1 : 0;
 }
 
 int main(int argc, char* argv[]) {
+    // A plugin host child runs one plugin and nothing else
+    if (argc > 1 && std::strcmp(argv[1], PluginHost::HOST_FLAG) == 0) {
+        return run_plugin_host(argc, argv);
+    }
+    
     try {
         std::string input_path;
         std::string output_dir = "."; // Default to current directory
@@ -532,7 +958,27 @@ int main(int argc, char* argv[]) {
         bool enable_wav = false;
         bool enable_text = false;
         bool enable_csv = false;
+        bool enable_imbe = false;
         bool use_config_file = false;
+        int batch_jobs = 1;
+        std::string manifest_path;
+        std::string index_path;
+        bool skip_encrypted = false;
+        bool encrypted_metadata_only = false;
+        int conceal_max_repeats = -1;
+        bool skip_silence = false;
+        int silence_keep_ms = -1;
+        std::string vocoder;
+        int segment_threads = 0;    // 0: from the config, else 1
+        int sample_rate = 0;        // 0: from the config, else 8000
+        double gain_db = 0.0;
+        bool gain_set = false;
+        bool agc = false;
+        bool direct_io = false;
+        bool wav_drop_cache = false;
+        bool frame_index = false;
+        double range_start = 0.0;
+        double range_end = 0.0;
         std::map<uint16_t, std::vector<uint8_t>> des_keys;
         std::map<uint16_t, std::vector<uint8_t>> aes_keys;
         std::map<uint16_t, std::vector<uint8_t>> adp_keys;
@@ -580,6 +1026,97 @@ int main(int argc, char* argv[]) {
                     std::cerr << "Error: -b requires an argument\n";
                     return 1;
                 }
+            } else if (arg == "-j" || arg == "--jobs") {
+                if (i + 1 < argc && argv[i + 1][0] != '-') {
+                    batch_jobs = std::stoi(argv[++i]);
+                    if (batch_jobs < 1) {
+                        std::cerr << "Error: -j must be at least 1\n";
+                        return 1;
+                    }
+                } else {
+                    std::cerr << "Error: -j requires an argument\n";
+                    return 1;
+                }
+            } else if (arg == "--manifest") {
+                if (i + 1 < argc && argv[i + 1][0] != '-') {
+                    manifest_path = argv[++i];
+                } else {
+                    std::cerr << "Error: --manifest requires an argument\n";
+                    return 1;
+                }
+            } else if (arg == "--index") {
+                if (i + 1 < argc && argv[i + 1][0] != '-') {
+                    index_path = argv[++i];
+                } else {
+                    std::cerr << "Error: --index requires an argument\n";
+                    return 1;
+                }
+            } else if (arg == "--skip-encrypted") {
+                skip_encrypted = true;
+            } else if (arg == "--encrypted-metadata-only") {
+                encrypted_metadata_only = true;
+            } else if (arg == "--conceal") {
+                conceal_max_repeats = 3;
+                if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                    conceal_max_repeats = std::stoi(argv[++i]);
+                }
+            } else if (arg == "--skip-silence") {
+                skip_silence = true;
+            } else if (arg == "--compact-silence") {
+                silence_keep_ms = P25Decoder::DEFAULT_SILENCE_KEEP_MS;
+                if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                    silence_keep_ms = std::stoi(argv[++i]);
+                }
+            } else if (arg == "--vocoder") {
+                if (i + 1 < argc) {
+                    vocoder = argv[++i];
+                } else {
+                    std::cerr << "Error: --vocoder requires an argument\n";
+                    return 1;
+                }
+            } else if (arg == "--segment-threads") {
+                if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                    segment_threads = std::stoi(argv[++i]);
+                } else {
+                    std::cerr << "Error: --segment-threads requires a number\n";
+                    return 1;
+                }
+            } else if (arg == "--sample-rate") {
+                if (i + 1 < argc && argv[i + 1][0] != '-') {
+                    sample_rate = std::stoi(argv[++i]);
+                } else {
+                    std::cerr << "Error: --sample-rate requires an argument\n";
+                    return 1;
+                }
+            } else if (arg == "--gain") {
+                if (i + 1 < argc) {
+                    gain_db = std::stod(argv[++i]);
+                    gain_set = true;
+                } else {
+                    std::cerr << "Error: --gain requires an argument\n";
+                    return 1;
+                }
+            } else if (arg == "--agc") {
+                agc = true;
+            } else if (arg == "--direct-io") {
+                direct_io = true;
+            } else if (arg == "--frame-index") {
+                frame_index = true;
+            } else if (arg == "--range") {
+                // START-END or START-, in seconds
+                std::string range = i + 1 < argc ? argv[++i] : "";
+                size_t dash = range.find('-');
+                char* end = nullptr;
+                range_start = std::strtod(range.c_str(), &end);
+                bool valid = !range.empty() && dash != std::string::npos && end == range.c_str() + dash && range_start >= 0.0;
+                if (valid && dash + 1 < range.size()) {
+                    range_end = std::strtod(range.c_str() + dash + 1, &end);
+                    valid = *end == '\0' && range_end > range_start;
+                }
+                if (!valid) {
+                    std::cerr << "Error: --range requires START-END in seconds (e.g. 12-20)\n";
+                    return 1;
+                }
             } else if (arg == "--json") {
                 enable_json = true;
             } else if (arg == "--wav") {
@@ -588,6 +1125,8 @@ int main(int argc, char* argv[]) {
                 enable_text = true;
             } else if (arg == "--csv") {
                 enable_csv = true;
+            } else if (arg == "--imbe") {
+                enable_imbe = true;
             } else if (arg == "-k" || arg == "--key") {
                 if (i + 1 < argc && argv[i + 1][0] != '-') {
                     std::string key_spec = argv[++i];
@@ -614,6 +1153,9 @@ int main(int argc, char* argv[]) {
                     std::cerr << "Error: -k requires a key specification\n";
                     return 1;
                 }
+            } else if (arg == "--flac") {
+                audio_format = "flac";
+                enable_wav = true;
             } else if (arg == "--mp3") {
                 audio_format = "mp3";
                 enable_wav = true;
@@ -652,6 +1194,10 @@ int main(int argc, char* argv[]) {
                 return 1;
             }
             
+            // Before any pool starts, so every thread is placed as it comes up
+            ThreadPlacement::global().configure(config.threading);
+            LogPolicy::from_json(config.logging).apply();
+            
             // Override config with command-line arguments if provided
             if (!input_path.empty()) config.input_path = input_path;
             if (output_dir != ".") config.output_dir = output_dir;
@@ -662,6 +1208,28 @@ int main(int argc, char* argv[]) {
             if (enable_json) config.enable_json = true;
             if (enable_wav) config.enable_wav = true;
             if (enable_text) config.enable_text = true;
+            if (enable_imbe) config.enable_imbe = true;
+            if (skip_encrypted) config.process_encrypted = false;
+            if (encrypted_metadata_only) config.encrypted_metadata_only = true;
+            if (conceal_max_repeats >= 0) {
+                config.frame_concealment = true;
+                config.conceal_max_repeats = conceal_max_repeats;
+            }
+            if (skip_silence) config.skip_silence = true;
+            if (silence_keep_ms >= 0) {
+                config.compact_silence = true;
+                config.silence_keep_ms = silence_keep_ms;
+            }
+            if (!vocoder.empty()) config.vocoder = vocoder;
+            if (segment_threads > 0) config.segment_threads = segment_threads;
+            if (sample_rate > 0) config.audio_sample_rate = sample_rate;
+            if (gain_set) config.audio_gain_db = gain_db;
+            if (agc) config.agc = true;
+            if (direct_io) {
+                config.wav_direct_io = true;
+                config.wav_drop_cache = true;
+            }
+            if (frame_index) config.frame_index = true;
             
             // Use config values
             input_path = config.input_path;
@@ -672,6 +1240,20 @@ int main(int argc, char* argv[]) {
             enable_json = config.enable_json;
             enable_wav = config.enable_wav;
             enable_text = config.enable_text;
+            enable_imbe = config.enable_imbe;
+            skip_encrypted = !config.process_encrypted;
+            encrypted_metadata_only = config.encrypted_metadata_only;
+            conceal_max_repeats = config.frame_concealment ? config.conceal_max_repeats : -1;
+            skip_silence = config.skip_silence;
+            silence_keep_ms = config.compact_silence ? std::max(0, config.silence_keep_ms) : -1;
+            vocoder = config.vocoder;
+            segment_threads = config.segment_threads;
+            sample_rate = config.audio_sample_rate;
+            gain_db = config.audio_gain_db;
+            agc = config.agc;
+            wav_drop_cache = config.wav_drop_cache;
+            direct_io = config.wav_direct_io;
+            frame_index = config.frame_index;
             if (audio_format == "wav") { // Only override if not set by command line
                 audio_format = config.audio_format;
             }
@@ -679,8 +1261,22 @@ int main(int argc, char* argv[]) {
                 audio_bitrate = config.audio_bitrate;
             }
             
+            // Keys from the config (or its key_file) are shared by every decoder and hot reloaded
+            std::string key_path = config.key_file.empty() ? config_file : config.key_file;
+            std::string key_error;
+            if (!KeyStore::instance().load_file(key_path, key_error)) {
+                std::cerr << "Error: Cannot load decryption keys from " << key_path << ": " << key_error << std::endl;
+                return 1;
+            }
+            if (KeyStore::instance().snapshot()->size() > 0 || !config.key_file.empty()) {
+                KeyStore::instance().watch(key_path, config.key_reload_interval, verbose);
+            }
+            
             if (!quiet) {
                 std::cout << "Using config file: " << config_file << std::endl;
+                if (KeyStore::instance().snapshot()->size() > 0) {
+                    std::cout << "Loaded " << KeyStore::instance().snapshot()->size() << " shared decryption key(s) from " << key_path << std::endl;
+                }
                 if (config.service_mode == "api") {
                     std::cout << "Service mode: API (endpoint: " << config.api_endpoint << ")" << std::endl;
                 }
@@ -694,8 +1290,8 @@ int main(int argc, char* argv[]) {
         }
         
         // Require at least one output format (unless using config file with plugins)
-        if (config.input_plugins.empty() && !enable_json && !enable_wav && !enable_text && !enable_csv) {
-            std::cerr << "Error: Must specify at least one output format (--json, --wav, --text, or --csv)\n";
+        if (config.input_plugins.empty() && !enable_json && !enable_wav && !enable_text && !enable_csv && !enable_imbe) {
+            std::cerr << "Error: Must specify at least one output format (--json, --wav, --text, --csv, or --imbe)\n";
             std::cerr << "Use -h for help or -c for config file mode\n";
             return 1;
         }
@@ -721,7 +1317,51 @@ int main(int argc, char* argv[]) {
             std::cout << std::endl;
         }
 
-        // Always run with plugin system
+        // An input file or directory is decoded directly; the plugin system
+        // runs when the config supplies input plugins instead
+        if (!input_path.empty() && config.input_plugins.empty()) {
+            BatchSettings batch;
+            batch.output_dir = output_dir;
+            batch.verbose = verbose;
+            batch.quiet = quiet;
+            batch.enable_json = enable_json;
+            batch.enable_wav = enable_wav;
+            batch.enable_text = enable_text;
+            batch.enable_csv = enable_csv;
+            batch.enable_imbe = enable_imbe;
+            batch.audio_format = audio_format;
+            batch.audio_bitrate = audio_bitrate;
+            batch.jobs = batch_jobs;
+            batch.manifest_path = manifest_path;
+            batch.index_path = index_path;
+            batch.des_keys = des_keys;
+            batch.aes_keys = aes_keys;
+            batch.adp_keys = adp_keys;
+            batch.skip_encrypted = skip_encrypted;
+            batch.encrypted_metadata_only = encrypted_metadata_only;
+            batch.conceal_max_repeats = conceal_max_repeats;
+            batch.skip_silence = skip_silence;
+            batch.silence_keep_ms = silence_keep_ms;
+            batch.sample_rate = sample_rate > 0 ? sample_rate : 8000;
+            batch.segment_threads = std::max(1, segment_threads);
+            batch.gain.gain_db = gain_db;
+            batch.gain.agc = agc;
+            batch.wav_options.direct_io = direct_io;
+            batch.wav_options.drop_cache = direct_io || wav_drop_cache;
+            batch.frame_index = frame_index;
+            batch.range_start = range_start;
+            batch.range_end = range_end;
+            if (!vocoder.empty() && !VoiceSynth::parse_backend(vocoder, batch.vocoder)) {
+                std::cerr << "Error: Unknown vocoder '" << vocoder << "' (use fixed or float)\n";
+                return 1;
+            }
+            // Everything asked for on the command line is printed, in order
+            Logger::instance().set_rate_limit(0, 1);
+            Logger::instance().set_async(false);
+            return run_batch(input_path, recursive, batch);
+        }
+        
+        // Otherwise run with plugin system
         if (!quiet) {
             std::cout << "Starting trunk-decoder with plugin system" << std::endl;
             std::cout << "Loading input plugins..." << std::endl;
@@ -729,7 +1369,8 @@ int main(int argc, char* argv[]) {
         
         // Initialize input plugin manager
         std::cout << "[DEBUG] Creating InputPluginManager..." << std::endl;
-        InputPluginManager input_manager(verbose);
+        auto input_manager_ptr = std::make_shared<InputPluginManager>(verbose);
+        InputPluginManager& input_manager = *input_manager_ptr;
         std::cout << "[DEBUG] InputPluginManager created successfully" << std::endl;
         
         // Input plugins are now parsed during config loading
@@ -764,7 +1405,16 @@ int main(int argc, char* argv[]) {
             std::cout << "Loading output plugins..." << std::endl;
         }
         
-        OutputPluginManager output_manager(verbose);
+        auto output_manager_ptr = std::make_shared<OutputPluginManager>(verbose);
+        OutputPluginManager& output_manager = *output_manager_ptr;
+        
+        // Call state from the control channel, readable by every plugin
+        TrunkingStateConfig trunking_config = TrunkingStateConfig::from_json(config.trunking);
+        std::shared_ptr<TrunkingState> trunking;
+        if (trunking_config.enabled) {
+            trunking = std::make_shared<TrunkingState>(trunking_config);
+            output_manager.set_trunking_state(trunking);
+        }
         
         // Load configured output plugins
         if (!config.output_plugins.empty()) {
@@ -778,10 +1428,6 @@ int main(int argc, char* argv[]) {
             }
         }
         
-        // Create shared pointers for plugin managers
-        auto input_manager_ptr = std::make_shared<InputPluginManager>(input_manager);
-        auto output_manager_ptr = std::make_shared<OutputPluginManager>(output_manager);
-        
         // Load call processing plugins directly (simplified approach)
         boost::shared_ptr<Plugin_Api> file_output_plugin = nullptr;
         boost::dll::shared_library file_output_lib; // Keep library alive
@@ -794,10 +1440,16 @@ int main(int argc, char* argv[]) {
                     }
                     
                     try {
-                        // Load the plugin library and keep it alive
-                        file_output_lib.load(plugin_config.library);
-                        auto creator = file_output_lib.get<boost::shared_ptr<Plugin_Api>()>("_create_plugin");
-                        file_output_plugin = creator();
+                        PluginHostConfig host_config = PluginHostConfig::from_json(plugin_config.config_data.value("host", json()));
+                        if (host_config.enabled) {
+                            file_output_plugin.reset(new HostedCallPlugin(plugin_config.name, plugin_config.library, host_config));
+                        } else {
+                            // Load the plugin library and keep it alive
+                            file_output_lib.load(plugin_config.library);
+                            auto creator = file_output_lib.get<boost::shared_ptr<Plugin_Api>()>("_create_plugin");
+                            file_output_plugin = creator();
+                            file_output_plugin->set_trunking_state(trunking);
+                        }
                         
                         // Initialize and start the plugin
                         if (file_output_plugin->init(plugin_config.config_data) == 0) {
@@ -824,16 +1476,31 @@ int main(int argc, char* argv[]) {
         // Initialize plugin router
         PluginRouter plugin_router(input_manager_ptr, output_manager_ptr, verbose);
         
-        // Add default routing rule (route all inputs to file_output)
-        plugin_router.add_route("*", {"file_output"});
-        if (!quiet) {
-            std::cout << "Added routing rule: * -> file_output" << std::endl;
+        if (!config.routing.empty()) {
+            if (plugin_router.load_routes_from_config(config.routing) != 0) {
+                return 1;
+            }
+        } else {
+            // Add default routing rule (route all inputs to file_output)
+            plugin_router.add_route("*", {"file_output"});
+            if (!quiet) {
+                std::cout << "Added routing rule: * -> file_output" << std::endl;
+            }
         }
         
-        // Set up plugin router data callback
-        input_manager.set_data_callback([&plugin_router, verbose](P25_TSBK_Data data) {
+        // Overlapping feeds are put in order and deduplicated before routing
+        TsbkSequencer sequencer([&plugin_router, &trunking](const P25_TSBK_Data& data) {
+            // Outputs see state that already includes this packet
+            if (trunking) {
+                trunking->process(data);
+            }
             // Route data through plugin system (correct parameter order: data, source)
             plugin_router.route_data(data, data.source_name);
+        }, TsbkSequencerConfig::from_json(config.tsbk_sequencer));
+        
+        // Set up plugin router data callback
+        input_manager.set_data_callback([&sequencer, verbose](const P25_TSBK_Data& data) {
+            sequencer.push(data);
             
             // Basic packet counter for progress indication - only show every 1000 packets
             static int packet_count = 0;
@@ -849,6 +1516,11 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         
+        // Give each input its own routing entry and lock-free counters
+        for (const auto& source : input_manager.get_source_names()) {
+            plugin_router.register_source(source);
+        }
+        
         if (input_manager.start_all() != 0) {
             std::cerr << "Failed to start input plugins" << std::endl;
             return 1;
@@ -865,21 +1537,48 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         
+        // Outputs are loaded now, so give each one its delivery queue
+        plugin_router.start();
+        sequencer.start();
+        
         if (!quiet) {
             std::cout << "Plugin-based processing started" << std::endl;
             std::cout << "Press Ctrl+C to stop" << std::endl;
         }
         
+        // Routing and output plugin configs follow the config file, checked
+        // as often as the key file
+        std::error_code config_ec;
+        fs::file_time_type config_seen;
+        if (use_config_file) {
+            config_seen = fs::last_write_time(config_file, config_ec);
+        }
+        int reload_counter = 0;
+        
         // Run until interrupted
         try {
             while (true) {
                 std::this_thread::sleep_for(std::chrono::seconds(1));
                 
+                if (use_config_file && ++reload_counter >= std::max(1, config.key_reload_interval)) {
+                    reload_counter = 0;
+                    fs::file_time_type modified = fs::last_write_time(config_file, config_ec);
+                    if (!config_ec && modified != config_seen) {
+                        config_seen = modified;
+                        reload_plugin_config(config_file, plugin_router, output_manager, verbose);
+                    }
+                }
+                
                 // Print stats periodically
                 static int stats_counter = 0;
                 if (verbose && ++stats_counter % 60 == 0) {
                     json stats = input_manager.get_all_stats();
                     std::cout << "Input plugin stats: " << stats.dump(2) << std::endl;
+                    std::cout << "TSBK sequencer stats: " << sequencer.get_stats_json().dump(2) << std::endl;
+                    if (trunking) {
+                        std::cout << "Trunking state: " << trunking->get_stats_json().dump(2) << std::endl;
+                    }
+                    std::cout << "Thread placement: " << ThreadPlacement::global().status().dump(2) << std::endl;
                 }
             }
         } catch (const std::exception& e) {
@@ -887,6 +1586,8 @@ int main(int argc, char* argv[]) {
         }
         
         input_manager.stop_all();
+        sequencer.stop();
+        plugin_router.stop();
         output_manager.stop_all();
         
         if (!quiet) {
@@ -895,94 +1596,6 @@ int main(int argc, char* argv[]) {
         
         return 0;
 
-        std::vector<std::string> files_to_process;
-        
-        // Check if input is a file or directory
-        if (fs::is_regular_file(input_path)) {
-            // Single file
-            if (fs::path(input_path).extension() != ".p25") {
-                std::cerr << "Error: Input file must have .p25 extension" << std::endl;
-                return 1;
-            }
-            files_to_process.push_back(input_path);
-        } else if (fs::is_directory(input_path)) {
-            // Directory - find all .p25 files
-            files_to_process = find_p25_files(input_path, recursive);
-            if (files_to_process.empty()) {
-                std::cout << "No .p25 files found in " << input_path << std::endl;
-                return 0;
-            }
-        } else {
-            std::cerr << "Error: Input path does not exist or is not accessible: " << input_path << std::endl;
-            return 1;
-        }
-
-        if (!quiet) {
-            std::cout << "Found " << files_to_process.size() << " P25 file(s) to process" << std::endl;
-        }
-
-        // Create and configure decoder
-        P25Decoder decoder;
-        
-        // Add encryption keys to decoder if any were provided
-        if (!des_keys.empty() || !aes_keys.empty() || !adp_keys.empty()) {
-            decoder.enable_decryption(true);
-            
-            // Add DES keys
-            for (const auto& key_pair : des_keys) {
-                decoder.add_des_key(key_pair.first, key_pair.second);
-            }
-            
-            // Add AES keys
-            for (const auto& key_pair : aes_keys) {
-                decoder.add_aes_key(key_pair.first, key_pair.second);
-            }
-            
-            // Add ADP keys
-            for (const auto& key_pair : adp_keys) {
-                decoder.add_adp_key(key_pair.first, key_pair.second);
-            }
-            
-            if (!quiet) {
-                int total_keys = des_keys.size() + aes_keys.size() + adp_keys.size();
-                std::cout << "Enabled decryption with " << total_keys << " key(s): ";
-                if (!des_keys.empty()) std::cout << des_keys.size() << " DES ";
-                if (!aes_keys.empty()) std::cout << aes_keys.size() << " AES ";
-                if (!adp_keys.empty()) std::cout << adp_keys.size() << " ADP ";
-                std::cout << std::endl;
-            }
-        }
-        
-        // Process all files (file mode)
-        int successful = 0;
-        int failed = 0;
-        auto start_time = std::chrono::steady_clock::now();
-
-        for (const auto& file : files_to_process) {
-            if (process_single_file(file, output_dir, verbose, quiet, enable_json, enable_wav, enable_text, enable_csv, audio_format, audio_bitrate, decoder)) {
-                successful++;
-            } else {
-                failed++;
-            }
-            
-            // Progress display is handled by individual "Processing:" messages
-            // No need for overwriting progress line that causes output mixing
-        }
-
-        auto end_time = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-
-        if (!quiet) {
-            std::cout << "\nProcessing complete!" << std::endl;
-            std::cout << "Successful: " << successful << std::endl;
-            if (failed > 0) {
-                std::cout << "Failed: " << failed << std::endl;
-            }
-            std::cout << "Total time: " << duration.count() << "ms" << std::endl;
-        }
-
-        return (failed > 0) ? 1 : 0;
-
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
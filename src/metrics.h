@@ -0,0 +1,306 @@
+/*
+ * Metrics registry with Prometheus text exposition
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Counters and histograms are sharded: each thread is given one of SHARDS
+ * cache-line sized slots the first time it records, and a record is a
+ * relaxed fetch_add on that slot, so decode workers never contend on a
+ * line or take a lock. Scrapes sum the shards. Gauges are a single atomic,
+ * meant to be set from a sampled value (queue depth) rather than bumped
+ * in a loop.
+ *
+ * Metrics are created once, under the registry lock, and live as long as
+ * the registry; callers look them up at construction and keep the
+ * reference. The same name and labels always return the same metric.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class MetricsRegistry {
+public:
+    static constexpr size_t SHARDS = 16;
+    static constexpr size_t MAX_BUCKETS = 16;
+
+    // This thread's shard; threads are dealt out round-robin
+    static size_t shard_index() {
+        static std::atomic<size_t> next_shard(0);
+        thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return shard;
+    }
+
+    class Counter {
+    public:
+        Counter() {
+            for (auto& shard : shards_) {
+                shard.value.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void add(uint64_t n = 1) {
+            shards_[shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const {
+            uint64_t total = 0;
+            for (const auto& shard : shards_) {
+                total += shard.value.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> value;
+        };
+        Shard shards_[SHARDS];
+    };
+
+    class Gauge {
+    public:
+        Gauge() : value_(0) {}
+
+        void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+        void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+        int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<int64_t> value_;
+    };
+
+    // Durations against fixed upper bounds; exposed in seconds
+    class Histogram {
+    public:
+        explicit Histogram(const std::vector<double>& bounds_s) {
+            for (size_t i = 0; i < bounds_s.size() && i < MAX_BUCKETS; i++) {
+                bounds_ns_.push_back(static_cast<uint64_t>(bounds_s[i] * 1e9));
+            }
+            for (auto& shard : shards_) {
+                for (auto& bucket : shard.buckets) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+                shard.sum_ns.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void record_ns(uint64_t ns) {
+            size_t bucket = 0;
+            while (bucket < bounds_ns_.size() && ns > bounds_ns_[bucket]) {
+                bucket++;
+            }
+            Shard& shard = shards_[shard_index()];
+            shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            shard.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+        }
+
+        template <typename Duration>
+        void record(Duration duration) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+            record_ns(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+        }
+
+        const std::vector<uint64_t>& bounds_ns() const { return bounds_ns_; }
+
+        // Per-bucket (not cumulative) counts, the last one past every bound
+        std::vector<uint64_t> counts() const {
+            std::vector<uint64_t> totals(bounds_ns_.size() + 1, 0);
+            for (const auto& shard : shards_) {
+                for (size_t i = 0; i < totals.size(); i++) {
+                    totals[i] += shard.buckets[i].load(std::memory_order_relaxed);
+                }
+            }
+            return totals;
+        }
+
+        uint64_t sum_ns() const {
+            uint64_t total = 0;
+            for (const auto& shard : shards_) {
+                total += shard.sum_ns.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> buckets[MAX_BUCKETS + 1];
+            std::atomic<uint64_t> sum_ns;
+        };
+        std::vector<uint64_t> bounds_ns_;
+        Shard shards_[SHARDS];
+    };
+
+    // 10 us .. 10 s, for per-call and per-message latencies
+    static std::vector<double> latency_buckets() {
+        return {1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0};
+    }
+
+    // The registry the service exposes on /metrics
+    static MetricsRegistry& global() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    // labels in exposition form without braces, e.g. plugin="mqtt"
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "") {
+        Metric& metric = find_or_add(name, help, COUNTER, labels, {});
+        return *metric.counter;
+    }
+
+    Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "") {
+        Metric& metric = find_or_add(name, help, GAUGE, labels, {});
+        return *metric.gauge;
+    }
+
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "",
+                         const std::vector<double>& bounds_s = latency_buckets()) {
+        Metric& metric = find_or_add(name, help, HISTOGRAM, labels, bounds_s);
+        return *metric.histogram;
+    }
+
+    // Prometheus text format 0.0.4
+    std::string exposition() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream out;
+        out.precision(12);
+        for (const auto& family : families_) {
+            out << "# HELP " << family->name << " " << family->help << "\n";
+            out << "# TYPE " << family->name << " " << type_name(family->type) << "\n";
+            for (const auto& metric : family->metrics) {
+                switch (family->type) {
+                    case COUNTER:
+                        if (metric->counter) {
+                            out << family->name << label_block(metric->labels, "") << " "
+                                << metric->counter->value() << "\n";
+                        }
+                        break;
+                    case GAUGE:
+                        if (metric->gauge) {
+                            out << family->name << label_block(metric->labels, "") << " "
+                                << metric->gauge->value() << "\n";
+                        }
+                        break;
+                    case HISTOGRAM:
+                        if (metric->histogram) {
+                            write_histogram(out, family->name, metric->labels, *metric->histogram);
+                        }
+                        break;
+                }
+            }
+        }
+        return out.str();
+    }
+
+    // Quotes, backslashes and newlines escaped for use inside a label value
+    static std::string escape_label(const std::string& value) {
+        std::string escaped;
+        for (char c : value) {
+            if (c == '\\' || c == '"') {
+                escaped += '\\';
+                escaped += c;
+            } else if (c == '\n') {
+                escaped += "\\n";
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+private:
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Metric {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    struct Family {
+        std::string name;
+        std::string help;
+        Type type;
+        std::vector<std::unique_ptr<Metric>> metrics;
+    };
+
+    static const char* type_name(Type type) {
+        switch (type) {
+            case COUNTER: return "counter";
+            case GAUGE: return "gauge";
+            default: return "histogram";
+        }
+    }
+
+    static std::string label_block(const std::string& labels, const std::string& extra) {
+        if (labels.empty() && extra.empty()) {
+            return "";
+        }
+        return "{" + labels + (labels.empty() || extra.empty() ? "" : ",") + extra + "}";
+    }
+
+    static void write_histogram(std::ostringstream& out, const std::string& name,
+                                const std::string& labels, const Histogram& histogram) {
+        std::vector<uint64_t> counts = histogram.counts();
+        const std::vector<uint64_t>& bounds = histogram.bounds_ns();
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < bounds.size(); i++) {
+            cumulative += counts[i];
+            std::ostringstream le;
+            le << "le=\"" << bounds[i] / 1e9 << "\"";
+            out << name << "_bucket" << label_block(labels, le.str()) << " " << cumulative << "\n";
+        }
+        cumulative += counts.back();
+        out << name << "_bucket" << label_block(labels, "le=\"+Inf\"") << " " << cumulative << "\n";
+        out << name << "_sum" << label_block(labels, "") << " " << histogram.sum_ns() / 1e9 << "\n";
+        out << name << "_count" << label_block(labels, "") << " " << cumulative << "\n";
+    }
+
+    Metric& find_or_add(const std::string& name, const std::string& help, Type type,
+                        const std::string& labels, const std::vector<double>& bounds_s) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Family* family = nullptr;
+        for (auto& existing : families_) {
+            if (existing->name == name) {
+                family = existing.get();
+                break;
+            }
+        }
+        if (!family) {
+            families_.emplace_back(new Family{name, help, type, {}});
+            family = families_.back().get();
+        }
+        for (auto& metric : family->metrics) {
+            if (metric->labels == labels) {
+                return *metric;
+            }
+        }
+        // A name already registered as another type keeps its first type;
+        // the mismatched metric still records but is left out of scrapes
+        std::unique_ptr<Metric> metric(new Metric);
+        metric->labels = labels;
+        switch (type) {
+            case COUNTER: metric->counter.reset(new Counter); break;
+            case GAUGE: metric->gauge.reset(new Gauge); break;
+            case HISTOGRAM: metric->histogram.reset(new Histogram(bounds_s)); break;
+        }
+        family->metrics.push_back(std::move(metric));
+        return *family->metrics.back();
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Family>> families_;
+};
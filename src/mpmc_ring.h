@@ -0,0 +1,158 @@
+/*
+ * Bounded lock-free ring buffer
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Fixed-capacity MPMC queue (Vyukov's bounded queue) with preallocated
+ * slots. Values are copy-assigned into a slot and moved out of it, so a
+ * popped slot does not keep shared payloads (PacketBuffer) alive while it
+ * waits to be reused. Consumers that need
+ * to block can use wait_pop(), which only takes a mutex when the ring is
+ * empty; producers only touch the mutex when a consumer is waiting.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+template <typename T>
+class MPMCRing {
+public:
+    explicit MPMCRing(size_t capacity)
+        : capacity_(capacity > 0 ? capacity : 1),
+          slots_(new Slot[capacity_]),
+          enqueue_pos_(0), dequeue_pos_(0), waiters_(0) {
+        for (size_t i = 0; i < capacity_; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPMCRing(const MPMCRing&) = delete;
+    MPMCRing& operator=(const MPMCRing&) = delete;
+
+    // Run fn on every slot value, e.g. to preallocate per-slot state.
+    // Only call before the ring is shared between threads.
+    template <typename Fn>
+    void prepare_slots(Fn fn) {
+        for (size_t i = 0; i < capacity_; i++) {
+            fn(slots_[i].value);
+        }
+    }
+
+    // Returns false if the ring is full
+    bool try_push(const T& value) {
+        Slot* slot;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &slots_[pos % capacity_];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = value;
+        // seq_cst pairs with the waiters_ increment in wait_pop()
+        slot->sequence.store(pos + 1);
+
+        if (waiters_.load() > 0) {
+            std::lock_guard<std::mutex> lock(wait_mutex_);
+            wait_cv_.notify_one();
+        }
+        return true;
+    }
+
+    // Returns false if the ring is empty
+    bool try_pop(T& out) {
+        Slot* slot;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &slots_[pos % capacity_];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        out = std::move(slot->value);
+        slot->sequence.store(pos + capacity_, std::memory_order_release);
+        return true;
+    }
+
+    // Block until a value is available or keep_waiting() returns false
+    template <typename Pred>
+    bool wait_pop(T& out, Pred keep_waiting) {
+        while (!try_pop(out)) {
+            std::unique_lock<std::mutex> lock(wait_mutex_);
+            waiters_++;
+            // Re-check under the lock so a push between try_pop and wait is not missed
+            wait_cv_.wait_for(lock, std::chrono::milliseconds(100), [&] {
+                return front_ready() || !keep_waiting();
+            });
+            waiters_--;
+            if (!front_ready() && !keep_waiting()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Wake every blocked wait_pop() so it can re-check its predicate
+    void wake_all() {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        wait_cv_.notify_all();
+    }
+
+    // Approximate while producers or consumers are active
+    size_t size() const {
+        size_t head = dequeue_pos_.load();
+        size_t tail = enqueue_pos_.load();
+        return tail > head ? tail - head : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    // True once the next value is fully published. Uses seq_cst loads, so a
+    // consumer that announces itself before checking cannot miss a push.
+    bool front_ready() const {
+        size_t pos = dequeue_pos_.load();
+        return slots_[pos % capacity_].sequence.load() == pos + 1;
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<size_t> enqueue_pos_;
+    alignas(64) std::atomic<size_t> dequeue_pos_;
+    alignas(64) std::atomic<int> waiters_;
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cv_;
+};
@@ -0,0 +1,233 @@
+/*
+ * Incremental multipart/form-data parser
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Bytes are fed in whatever chunks the socket delivers. The parser scans
+ * for the "\r\n--boundary" delimiter and hands part contents to callbacks
+ * as soon as they can no longer be the start of a delimiter, so an upload
+ * never has to be held in memory as a whole. Only a delimiter-sized tail
+ * and the current part's headers are buffered.
+ */
+
+#pragma once
+
+#include <string>
+#include <functional>
+#include <cstring>
+#include <cstddef>
+#include <strings.h>
+
+class MultipartParser {
+public:
+    struct Part {
+        std::string name;
+        std::string filename;       // empty for plain form fields
+        std::string content_type;
+    };
+
+    // Returning false from a callback aborts the parse
+    std::function<bool(const Part&)> on_part_begin;
+    std::function<bool(const char*, size_t)> on_part_data;
+    std::function<bool()> on_part_end;
+
+    explicit MultipartParser(const std::string& boundary)
+        : delimiter_("\r\n--" + boundary), state_(PREAMBLE), failed_(boundary.empty()) {
+        // Lets the first boundary match the same delimiter as later ones
+        buffer_ = "\r\n";
+    }
+
+    // Pull the boundary parameter out of a Content-Type header
+    static std::string boundary_from_content_type(const std::string& content_type) {
+        size_t pos = content_type.find("boundary=");
+        if (pos == std::string::npos) {
+            return "";
+        }
+        pos += 9;
+        if (pos < content_type.size() && content_type[pos] == '"') {
+            size_t end = content_type.find('"', pos + 1);
+            return end == std::string::npos ? "" : content_type.substr(pos + 1, end - pos - 1);
+        }
+        size_t end = content_type.find_first_of("; \t", pos);
+        return content_type.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    }
+
+    // false once the input is malformed or a callback refused it
+    bool feed(const char* data, size_t length) {
+        if (failed_ || state_ == DONE) {
+            return !failed_;
+        }
+        buffer_.append(data, length);
+        size_t consumed = 0;
+        while (!failed_ && state_ != DONE) {
+            size_t used = 0;
+            bool progressed = step(consumed, used);
+            consumed += used;
+            if (!progressed) {
+                break;  // need more input
+            }
+        }
+        buffer_.erase(0, consumed);
+        return !failed_;
+    }
+
+    bool complete() const { return state_ == DONE; }
+    bool failed() const { return failed_; }
+    bool in_part() const { return state_ == BODY; }
+
+private:
+    enum State { PREAMBLE, AFTER_BOUNDARY, HEADERS, BODY, DONE };
+
+    static const size_t MAX_HEADER_SIZE = 16 * 1024;
+
+    const std::string delimiter_;
+    State state_;
+    bool failed_;
+    std::string buffer_;
+
+    // Process from offset; sets used and returns false when more input is needed
+    bool step(size_t offset, size_t& used) {
+        const char* begin = buffer_.data() + offset;
+        size_t available = buffer_.size() - offset;
+
+        switch (state_) {
+            case PREAMBLE:
+            case BODY: {
+                const char* hit = static_cast<const char*>(
+                    memmem(begin, available, delimiter_.data(), delimiter_.size()));
+                if (hit) {
+                    size_t content = hit - begin;
+                    if (state_ == BODY && !emit(begin, content)) {
+                        return false;
+                    }
+                    if (state_ == BODY && on_part_end && !on_part_end()) {
+                        failed_ = true;
+                        return false;
+                    }
+                    used = content + delimiter_.size();
+                    state_ = AFTER_BOUNDARY;
+                    return true;
+                }
+                // Keep a tail that could still be the start of the delimiter
+                if (available < delimiter_.size()) {
+                    return false;
+                }
+                size_t safe = available - (delimiter_.size() - 1);
+                if (state_ == BODY && !emit(begin, safe)) {
+                    return false;
+                }
+                used = safe;
+                return false;
+            }
+
+            case AFTER_BOUNDARY: {
+                size_t i = 0;
+                while (i < available && (begin[i] == ' ' || begin[i] == '\t')) {
+                    i++;
+                }
+                if (available - i < 2) {
+                    used = i;
+                    return false;
+                }
+                if (begin[i] == '-' && begin[i + 1] == '-') {
+                    state_ = DONE;
+                } else if (begin[i] == '\r' && begin[i + 1] == '\n') {
+                    state_ = HEADERS;
+                } else {
+                    failed_ = true;
+                    return false;
+                }
+                used = i + 2;
+                return true;
+            }
+
+            case HEADERS: {
+                // A part without headers starts straight with the blank line
+                size_t end;
+                size_t skip;
+                if (available >= 2 && begin[0] == '\r' && begin[1] == '\n') {
+                    end = 0;
+                    skip = 2;
+                } else {
+                    const char* hit = static_cast<const char*>(memmem(begin, available, "\r\n\r\n", 4));
+                    if (!hit) {
+                        if (available > MAX_HEADER_SIZE) {
+                            failed_ = true;
+                        }
+                        return false;
+                    }
+                    end = hit - begin;
+                    skip = end + 4;
+                }
+                Part part = parse_part_headers(std::string(begin, end));
+                if (on_part_begin && !on_part_begin(part)) {
+                    failed_ = true;
+                    return false;
+                }
+                used = skip;
+                state_ = BODY;
+                return true;
+            }
+
+            case DONE:
+                break;
+        }
+        return false;
+    }
+
+    bool emit(const char* data, size_t length) {
+        if (length > 0 && on_part_data && !on_part_data(data, length)) {
+            failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    static Part parse_part_headers(const std::string& headers) {
+        Part part;
+        size_t start = 0;
+        while (start < headers.size()) {
+            size_t end = headers.find("\r\n", start);
+            if (end == std::string::npos) {
+                end = headers.size();
+            }
+            std::string line = headers.substr(start, end - start);
+            start = end + 2;
+
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::string key = line.substr(0, colon);
+            size_t value_start = line.find_first_not_of(" \t", colon + 1);
+            std::string value = value_start == std::string::npos ? "" : line.substr(value_start);
+
+            if (strcasecmp(key.c_str(), "Content-Disposition") == 0) {
+                part.name = parameter(value, "name");
+                part.filename = parameter(value, "filename");
+            } else if (strcasecmp(key.c_str(), "Content-Type") == 0) {
+                part.content_type = value;
+            }
+        }
+        return part;
+    }
+
+    // Value of key="..." (or key=token) in a header; "name" does not match "filename"
+    static std::string parameter(const std::string& value, const std::string& key) {
+        size_t pos = 0;
+        while ((pos = value.find(key + "=", pos)) != std::string::npos) {
+            if (pos > 0 && value[pos - 1] != ';' && value[pos - 1] != ' ' && value[pos - 1] != '\t') {
+                pos += key.size();
+                continue;
+            }
+            pos += key.size() + 1;
+            if (pos < value.size() && value[pos] == '"') {
+                size_t end = value.find('"', pos + 1);
+                return value.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+            }
+            size_t end = value.find(';', pos);
+            return value.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        }
+        return "";
+    }
+};
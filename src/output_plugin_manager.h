@@ -3,15 +3,21 @@
  * Manages output plugins and routing from input plugins
  * 
  * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * The plugin list is fixed once initialize_all() has run, but one plugin's
+ * instance can be replaced while data flows (restart_plugin()), so every
+ * reader takes the instance with std::atomic_load.
  */
 
 #pragma once
 
 #include "plugin_api.h"
+#include "plugin_host.h"
 #include <vector>
 #include <memory>
 #include <string>
 #include <functional>
+#include <mutex>
 #include <boost/dll/import.hpp>
 
 namespace dll = boost::dll;
@@ -30,7 +36,9 @@ private:
     };
     
     std::vector<OutputPluginInfo> plugins_;
+    std::mutex restart_mutex_;
     bool verbose_;
+    std::shared_ptr<const TrunkingState> trunking_state_;
     
 public:
     OutputPluginManager(bool verbose = false) : verbose_(verbose) {}
@@ -47,6 +55,9 @@ public:
         return 0;
     }
     
+    // Given to every plugin loaded after this
+    void set_trunking_state(std::shared_ptr<const TrunkingState> state) { trunking_state_ = std::move(state); }
+    
     // Load and initialize all plugins
     int initialize_all() {
         for (auto& plugin_info : plugins_) {
@@ -100,8 +111,9 @@ public:
     // Send data to all output plugins
     void send_data(const P25_TSBK_Data& data) {
         for (auto& plugin_info : plugins_) {
-            if (plugin_info.plugin && plugin_info.enabled) {
-                plugin_info.plugin->process_data(data);
+            auto plugin = std::atomic_load(&plugin_info.plugin);
+            if (plugin && plugin_info.enabled) {
+                plugin->process_data(data);
             }
         }
     }
@@ -110,21 +122,33 @@ public:
     void send_data_to(const P25_TSBK_Data& data, const std::vector<std::string>& plugin_names) {
         for (const auto& name : plugin_names) {
             for (auto& plugin_info : plugins_) {
-                if (plugin_info.name == name && plugin_info.plugin && plugin_info.enabled) {
-                    plugin_info.plugin->process_data(data);
+                if (plugin_info.name == name && plugin_info.enabled) {
+                    if (auto plugin = std::atomic_load(&plugin_info.plugin)) {
+                        plugin->process_data(data);
+                    }
                     break;
                 }
             }
         }
     }
     
+    // Send a run of packets to every output plugin, one process_batch() each
+    void send_batch(const P25_TSBK_Data* const* packets, size_t count) {
+        for (auto& plugin_info : plugins_) {
+            auto plugin = std::atomic_load(&plugin_info.plugin);
+            if (plugin && plugin_info.enabled) {
+                plugin->process_batch(packets, count);
+            }
+        }
+    }
+    
     // Get statistics from all plugins
     json get_all_stats() {
         json all_stats = json::array();
         
         for (const auto& plugin_info : plugins_) {
-            if (plugin_info.plugin) {
-                json plugin_stats = plugin_info.plugin->get_stats();
+            if (auto plugin = std::atomic_load(&plugin_info.plugin)) {
+                json plugin_stats = plugin->get_stats();
                 plugin_stats["plugin_name"] = plugin_info.name;
                 plugin_stats["library_path"] = plugin_info.library_path;
                 all_stats.push_back(plugin_stats);
@@ -134,6 +158,61 @@ public:
         return all_stats;
     }
     
+    // Look up a loaded, enabled plugin by name (nullptr if none)
+    std::shared_ptr<Output_Plugin_Api> get_plugin(const std::string& name) {
+        for (auto& plugin_info : plugins_) {
+            if (plugin_info.name == name && plugin_info.enabled) {
+                return std::atomic_load(&plugin_info.plugin);
+            }
+        }
+        return nullptr;
+    }
+    
+    // Config the named plugin was last loaded with (null if no such plugin)
+    json get_config(const std::string& name) {
+        std::lock_guard<std::mutex> lock(restart_mutex_);
+        for (const auto& plugin_info : plugins_) {
+            if (plugin_info.name == name) {
+                return plugin_info.config;
+            }
+        }
+        return json();
+    }
+    
+    // Load, init and start a new instance of the named plugin with config,
+    // then put it in place of the running one, which is handed back in
+    // old_plugin still running: the caller stops it once nothing is using
+    // it (PluginRouter::restart_output). On failure the running instance
+    // stays and nullptr is returned.
+    std::shared_ptr<Output_Plugin_Api> restart_plugin(const std::string& name, const json& config,
+                                                      std::shared_ptr<Output_Plugin_Api>& old_plugin) {
+        std::lock_guard<std::mutex> lock(restart_mutex_);
+        for (auto& plugin_info : plugins_) {
+            if (plugin_info.name != name || !plugin_info.enabled) {
+                continue;
+            }
+            OutputPluginInfo replacement(plugin_info.name, plugin_info.library_path);
+            replacement.config = config;
+            if (load_plugin(replacement) != 0) {
+                std::cerr << "[OutputPluginManager] Failed to reload plugin: " << name << std::endl;
+                return nullptr;
+            }
+            if (replacement.plugin->start() != 0) {
+                std::cerr << "[OutputPluginManager] Failed to start reloaded plugin: " << name << std::endl;
+                replacement.plugin->stop();
+                return nullptr;
+            }
+            plugin_info.config = config;
+            old_plugin = std::atomic_exchange(&plugin_info.plugin, replacement.plugin);
+            if (verbose_) {
+                std::cout << "[OutputPluginManager] Reloaded plugin: " << name << std::endl;
+            }
+            return replacement.plugin;
+        }
+        std::cerr << "[OutputPluginManager] No enabled plugin named " << name << " to reload" << std::endl;
+        return nullptr;
+    }
+    
     // Get list of active plugin names
     std::vector<std::string> get_active_plugin_names() {
         std::vector<std::string> names;
@@ -153,6 +232,16 @@ private:
                           << " from " << plugin_info.library_path << std::endl;
             }
             
+            // Hosted plugins run in their own process behind a proxy
+            PluginHostConfig host_config = PluginHostConfig::from_json(plugin_info.config.value("host", json()));
+            if (host_config.enabled) {
+                plugin_info.plugin = std::make_shared<HostedOutputPlugin>(plugin_info.name, plugin_info.library_path, host_config);
+                if (verbose_) {
+                    std::cout << "[OutputPluginManager] Plugin " << plugin_info.name << " runs in a plugin host" << std::endl;
+                }
+                return plugin_info.plugin->init(plugin_info.config);
+            }
+            
             // Load the plugin library
             std::function<std::shared_ptr<Output_Plugin_Api>()> creator;
             creator = dll::import_alias<std::shared_ptr<Output_Plugin_Api>()>(
@@ -170,6 +259,8 @@ private:
                           << " v" << plugin_info.plugin->get_plugin_version() << std::endl;
             }
             
+            plugin_info.plugin->set_trunking_state(trunking_state_);
+            
             // Initialize plugin
             if (plugin_info.plugin->init(plugin_info.config) != 0) {
                 std::cerr << "[OutputPluginManager] Failed to initialize plugin: " << plugin_info.name << std::endl;
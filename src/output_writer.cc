@@ -0,0 +1,568 @@
+#include "output_writer.h"
+#include "stage_profiler.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+enum Step { OPEN, WRITE, SYNC, CLOSE, RENAME, DONE };
+
+enum SyncMode { SYNC_NONE, SYNC_DATA, SYNC_FULL };
+
+SyncMode sync_mode(const std::string& name) {
+    if (name == "data") {
+        return SYNC_DATA;
+    }
+    if (name == "full") {
+        return SYNC_FULL;
+    }
+    return SYNC_NONE;
+}
+
+const int OPEN_FLAGS = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+const uint64_t WAKE_TAG = 0;
+
+} // namespace
+
+// Just enough of liburing: one submission and one completion ring, mapped
+// from the kernel, with the opcodes it supports probed once
+class OutputWriter::Ring {
+public:
+    static std::unique_ptr<Ring> create(unsigned entries, int& error) {
+        std::unique_ptr<Ring> ring(new Ring());
+        error = ring->setup(entries);
+        if (error != 0) {
+            ring.reset();
+        }
+        return ring;
+    }
+
+    ~Ring() {
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_ != MAP_FAILED) {
+            munmap(sq_ptr_, sq_size_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    bool supports(int opcode) const {
+        return opcode >= 0 && static_cast<size_t>(opcode) < supported_.size() && supported_[opcode];
+    }
+
+    // A cleared entry to fill in, or nullptr while the ring is full
+    io_uring_sqe* next_sqe() {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_tail_local_ - head >= sq_entries_) {
+            return nullptr;
+        }
+        unsigned index = sq_tail_local_ & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        sq_tail_local_++;
+        return sqe;
+    }
+
+    // Hand the kernel what next_sqe() gave out and wait for a completion
+    void submit_and_wait() {
+        unsigned submitting = sq_tail_local_ - __atomic_load_n(sq_tail_, __ATOMIC_RELAXED);
+        __atomic_store_n(sq_tail_, sq_tail_local_, __ATOMIC_RELEASE);
+        int ret;
+        do {
+            ret = static_cast<int>(syscall(__NR_io_uring_enter, fd_, submitting, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (ret > 0) {
+                submitting -= std::min(submitting, static_cast<unsigned>(ret));
+            }
+        } while (ret < 0 && errno == EINTR);
+    }
+
+    // f(user_data, res) for each completion waiting
+    template <typename F>
+    void drain(F f) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+            uint64_t data = cqe.user_data;
+            int res = cqe.res;
+            head++;
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            f(data, res);
+            tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        }
+    }
+
+private:
+    Ring() : fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED), sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+             sq_size_(0), cq_size_(0), sqes_size_(0), sq_entries_(0), sq_tail_local_(0) {}
+
+    int setup(unsigned entries) {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            return errno;
+        }
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            return errno;
+        }
+        cq_ptr_ = single ? sq_ptr_
+                         : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            return errno;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(
+            mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) {
+            return errno;
+        }
+
+        char* sq = static_cast<char*>(sq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+        sq_tail_local_ = *sq_tail_;
+        char* cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // Without a probe (before 5.6) none of the file opcodes beyond
+        // writev and fsync exist either
+        const unsigned probe_ops = 256;
+        std::vector<char> storage(sizeof(io_uring_probe) + probe_ops * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        supported_.assign(probe_ops, false);
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, probe_ops) == 0) {
+            for (unsigned op = 0; op <= probe->last_op && op < probe_ops; op++) {
+                supported_[op] = probe->ops[op].flags & IO_URING_OP_SUPPORTED;
+            }
+        } else {
+            supported_[IORING_OP_WRITEV] = true;
+            supported_[IORING_OP_FSYNC] = true;
+        }
+        return 0;
+    }
+
+    int fd_;
+    void* sq_ptr_;
+    void* cq_ptr_;
+    io_uring_sqe* sqes_;
+    size_t sq_size_;
+    size_t cq_size_;
+    size_t sqes_size_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned sq_entries_;
+    unsigned sq_tail_local_;   // entries handed out; published to sq_tail_ on submit
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    io_uring_cqe* cqes_;
+    std::vector<bool> supported_;
+};
+
+struct OutputWriter::Batch {
+    size_t remaining;
+    std::vector<std::string> failed;
+    Callback done;
+};
+
+// One file on its way through the steps
+struct OutputWriter::Op {
+    File file;
+    std::shared_ptr<Batch> batch;
+    std::string temp_path;
+    SyncMode sync;
+    bool atomic;
+    Step step;
+    bool ok;
+    int fd;
+    size_t total;
+    size_t written;
+    struct iovec iov[2];
+    int iovcnt;
+    std::chrono::steady_clock::time_point started;
+
+    Op(File&& f, const OutputWritePolicy& policy, std::shared_ptr<Batch> owner)
+        : file(std::move(f)), batch(std::move(owner)), sync(sync_mode(policy.fsync)), atomic(policy.atomic_rename),
+          step(OPEN), ok(true), fd(-1), written(0), iovcnt(0), started(std::chrono::steady_clock::now()) {
+        temp_path = atomic ? file.path + ".tmp" : file.path;
+        total = file.prefix.size() + file.size;
+    }
+
+    // iov <- whatever of prefix and data is still to be written
+    void aim() {
+        iovcnt = 0;
+        size_t skip = written;
+        if (skip < file.prefix.size()) {
+            iov[iovcnt].iov_base = const_cast<char*>(file.prefix.data()) + skip;
+            iov[iovcnt].iov_len = file.prefix.size() - skip;
+            iovcnt++;
+            skip = 0;
+        } else {
+            skip -= file.prefix.size();
+        }
+        if (file.size > skip) {
+            iov[iovcnt].iov_base = const_cast<char*>(static_cast<const char*>(file.data)) + skip;
+            iov[iovcnt].iov_len = file.size - skip;
+            iovcnt++;
+        }
+    }
+
+    int opcode() const {
+        switch (step) {
+            case OPEN: return IORING_OP_OPENAT;
+            case WRITE: return IORING_OP_WRITEV;
+            case SYNC: return IORING_OP_FSYNC;
+            case CLOSE: return IORING_OP_CLOSE;
+            case RENAME: return IORING_OP_RENAMEAT;
+            default: return -1;
+        }
+    }
+
+    void prep(io_uring_sqe* sqe) {
+        sqe->opcode = static_cast<uint8_t>(opcode());
+        sqe->user_data = reinterpret_cast<uint64_t>(this);
+        switch (step) {
+            case OPEN:
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(temp_path.c_str());
+                sqe->len = 0644;
+                sqe->open_flags = OPEN_FLAGS;
+                break;
+            case WRITE:
+                aim();
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(iov);
+                sqe->len = static_cast<uint32_t>(iovcnt);
+                sqe->off = written;
+                break;
+            case SYNC:
+                sqe->fd = fd;
+                sqe->fsync_flags = sync == SYNC_DATA ? IORING_FSYNC_DATASYNC : 0;
+                break;
+            case CLOSE:
+                sqe->fd = fd;
+                break;
+            case RENAME:
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(temp_path.c_str());
+                sqe->len = static_cast<uint32_t>(AT_FDCWD);
+                sqe->off = reinterpret_cast<uint64_t>(file.path.c_str());
+                break;
+            default:
+                break;
+        }
+    }
+
+    // The current step here and now; the result as a completion would carry it
+    int run_now() {
+        int ret = 0;
+        switch (step) {
+            case OPEN: ret = open(temp_path.c_str(), OPEN_FLAGS, 0644); break;
+            case WRITE: aim(); ret = static_cast<int>(pwritev(fd, iov, iovcnt, static_cast<off_t>(written))); break;
+            case SYNC: ret = sync == SYNC_DATA ? fdatasync(fd) : fsync(fd); break;
+            case CLOSE: ret = close(fd); break;
+            case RENAME: ret = rename(temp_path.c_str(), file.path.c_str()); break;
+            default: break;
+        }
+        return ret < 0 ? -errno : ret;
+    }
+
+    // Move on from the step just run
+    void advance(int result) {
+        if (result == -EINTR || result == -EAGAIN) {
+            return;   // run the same step again
+        }
+        switch (step) {
+            case OPEN:
+                if (result < 0) {
+                    return fail(result);
+                }
+                fd = result;
+                step = total > 0 ? WRITE : after_write();
+                return;
+            case WRITE:
+                if (result <= 0) {
+                    return fail(result < 0 ? result : -ENOSPC);
+                }
+                written += static_cast<size_t>(result);
+                if (written >= total) {
+                    step = after_write();
+                }
+                return;
+            case SYNC:
+                if (result < 0) {
+                    return fail(result);
+                }
+                step = CLOSE;
+                return;
+            case CLOSE:
+                fd = -1;   // gone even when close reports an error
+                if (result < 0) {
+                    return fail(result);
+                }
+                step = atomic ? RENAME : DONE;
+                return;
+            case RENAME:
+                if (result < 0) {
+                    return fail(result);
+                }
+                step = DONE;
+                return;
+            default:
+                return;
+        }
+    }
+
+    Step after_write() const {
+        return sync != SYNC_NONE ? SYNC : CLOSE;
+    }
+
+    // Leave nothing half written behind
+    void fail(int result) {
+        std::cerr << "[OutputWriter] Failed to write " << file.path << ": " << std::strerror(-result) << std::endl;
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        unlink(temp_path.c_str());
+        ok = false;
+        step = DONE;
+    }
+};
+
+OutputWriter::File OutputWriter::File::text(const std::string& path, std::string contents) {
+    File file;
+    file.path = path;
+    file.prefix = std::move(contents);
+    return file;
+}
+
+OutputWriter::File OutputWriter::File::buffer(const std::string& path, std::shared_ptr<const std::vector<uint8_t>> bytes) {
+    File file;
+    file.path = path;
+    file.data = bytes->data();
+    file.size = bytes->size();
+    file.owner = std::move(bytes);
+    return file;
+}
+
+OutputWriter::OutputWriter(const OutputWritePolicy& policy)
+    : policy_(policy), stopping_(false), written_(0), failed_(0), in_flight_(0),
+      bytes_metric_(MetricsRegistry::global().counter("trunk_decoder_output_write_bytes_total",
+                                                      "Bytes written to output files by the output writer")),
+      duration_metric_(MetricsRegistry::global().histogram("trunk_decoder_output_write_seconds",
+                                                           "Time from submission until an output file was in place")),
+      in_flight_metric_(MetricsRegistry::global().gauge("trunk_decoder_output_writes_in_flight",
+                                                        "Output files being written")) {
+    policy_.queue_depth = std::max(1, policy_.queue_depth);
+    if (policy_.fsync != "none" && policy_.fsync != "data" && policy_.fsync != "full") {
+        std::cerr << "[OutputWriter] Unknown fsync policy \"" << policy_.fsync << "\", using none" << std::endl;
+        policy_.fsync = "none";
+    }
+    // One entry per file in flight, and one for the wakeup poll
+    int error = 0;
+    ring_ = Ring::create(static_cast<unsigned>(policy_.queue_depth) + 1, error);
+    if (!ring_) {
+        std::cerr << "[OutputWriter] io_uring unavailable (" << std::strerror(error)
+                  << "), writing from the writer thread" << std::endl;
+    }
+}
+
+OutputWriter::~OutputWriter() {
+    stop();
+}
+
+void OutputWriter::start() {
+    if (thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+    }
+    thread_ = std::thread(&OutputWriter::run, this);
+}
+
+void OutputWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+bool OutputWriter::submit(std::vector<File>&& files, Callback done) {
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = files.size();
+    batch->done = std::move(done);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ || !thread_.joinable()) {
+            return false;
+        }
+        for (File& file : files) {
+            queue_.push_back(std::unique_ptr<Op>(new Op(std::move(file), policy_, batch)));
+        }
+    }
+    if (files.empty()) {
+        batch->done(batch->failed);
+        return true;
+    }
+    wake_.notify();
+    return true;
+}
+
+std::vector<std::string> OutputWriter::write_now(const std::vector<File>& files, const OutputWritePolicy& policy) {
+    PROFILE_STAGE(ProfileStage::WAV_WRITE);
+    std::vector<std::string> failed;
+    for (const File& file : files) {
+        Op op(File(file), policy, nullptr);
+        while (op.step != DONE) {
+            op.advance(op.run_now());
+        }
+        if (!op.ok) {
+            failed.push_back(file.path);
+        }
+    }
+    return failed;
+}
+
+void OutputWriter::run() {
+    size_t active = 0;
+    bool wake_armed = false;
+
+    // Issue op's current step: on the ring where it can go, otherwise here,
+    // carrying on until a step is in flight or the file is done
+    auto issue = [this, &active](Op* op) {
+        while (op->step != DONE) {
+            if (ring_ && ring_->supports(op->opcode())) {
+                io_uring_sqe* sqe = ring_->next_sqe();
+                if (sqe) {
+                    op->prep(sqe);
+                    return;
+                }
+            }
+            op->advance(op->run_now());
+        }
+        complete(*op, op->ok);
+        delete op;
+        active--;
+    };
+
+    for (;;) {
+        std::vector<std::unique_ptr<Op>> starting;
+        bool stopping;
+        bool more;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (!queue_.empty() && active + starting.size() < static_cast<size_t>(policy_.queue_depth)) {
+                starting.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+            }
+            stopping = stopping_ && queue_.empty();
+            more = !queue_.empty();
+        }
+        for (std::unique_ptr<Op>& op : starting) {
+            active++;
+            in_flight_++;
+            issue(op.release());
+        }
+        in_flight_metric_.set(in_flight_.load());
+        if (stopping && active == 0) {
+            break;
+        }
+
+        if (!ring_) {
+            // Everything ran in issue(); sleep only once the queue is empty
+            if (!more) {
+                struct pollfd pfd = {wake_.fd(), POLLIN, 0};
+                poll(&pfd, 1, -1);
+                wake_.drain();
+            }
+            continue;
+        }
+
+        if (!wake_armed) {
+            io_uring_sqe* sqe = ring_->next_sqe();
+            if (sqe) {
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = wake_.fd();
+                sqe->poll32_events = POLLIN;
+                sqe->user_data = WAKE_TAG;
+                wake_armed = true;
+            }
+        }
+        ring_->submit_and_wait();
+        ring_->drain([&](uint64_t data, int res) {
+            if (data == WAKE_TAG) {
+                wake_armed = false;
+                wake_.drain();
+                return;
+            }
+            Op* op = reinterpret_cast<Op*>(data);
+            op->advance(res);
+            issue(op);
+        });
+    }
+}
+
+void OutputWriter::complete(Op& op, bool ok) {
+    in_flight_--;
+    MetricsRegistry::global().counter("trunk_decoder_output_writes_total", "Output files written, by result",
+                                      ok ? "result=\"ok\"" : "result=\"failed\"").add();
+    if (ok) {
+        written_++;
+        bytes_metric_.add(op.total);
+    } else {
+        failed_++;
+    }
+    duration_metric_.record(std::chrono::steady_clock::now() - op.started);
+
+    Batch& batch = *op.batch;
+    if (!ok) {
+        batch.failed.push_back(op.file.path);
+    }
+    if (--batch.remaining > 0) {
+        return;
+    }
+    try {
+        batch.done(batch.failed);
+    } catch (const std::exception& e) {
+        std::cerr << "[OutputWriter] Completion callback failed: " << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,130 @@
+/*
+ * Asynchronous output files
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Decode workers used to write each call's WAV, JSON and encoded audio
+ * themselves, so a slow archive volume (NFS, SMB) held a decoder idle for
+ * every millisecond the server took. With an OutputWriter a worker hands
+ * over the finished buffers and goes back to decoding; one writer thread
+ * keeps up to queue_depth files in flight on an io_uring and runs the
+ * callback once all of a batch's files are in place. The job only moves
+ * to its next stage (and so to call_data_ready) from that callback.
+ *
+ * Each file goes through open, write, the fsync policy ("none", "data" for
+ * fdatasync, "full" for fsync), close and, with atomic_rename, a rename from
+ * PATH.tmp over PATH, so nothing downstream ever sees half a file. Steps the
+ * kernel's io_uring lacks (renameat before 5.11, say) run on the writer
+ * thread instead, and where there is no io_uring at all (seccomp, old
+ * kernels) the whole sequence does; either way off the decode workers.
+ *
+ * Callbacks run on the writer thread and should only hand the job on.
+ * /metrics gets trunk_decoder_output_writes_total by result, the bytes
+ * written, the time per file and the number in flight.
+ */
+
+#pragma once
+
+#include "event_notifier.h"
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+struct OutputWritePolicy {
+    bool enabled = false;
+    std::string fsync = "none";   // none, data or full, before the rename
+    bool atomic_rename = true;    // write PATH.tmp, then rename it over PATH
+    int queue_depth = 64;         // files in flight at once
+
+    // {"enabled": true, "fsync": "data", "queue_depth": 64}
+    static OutputWritePolicy from_json(const nlohmann::json& config) {
+        OutputWritePolicy policy;
+        if (config.is_boolean()) {
+            policy.enabled = config.get<bool>();
+            return policy;
+        }
+        if (!config.is_object()) {
+            return policy;
+        }
+        policy.enabled = config.value("enabled", true);
+        policy.fsync = config.value("fsync", policy.fsync);
+        policy.atomic_rename = config.value("atomic_rename", policy.atomic_rename);
+        policy.queue_depth = std::max(1, config.value("queue_depth", policy.queue_depth));
+        return policy;
+    }
+};
+
+class OutputWriter {
+public:
+    // prefix (a header, or the whole of a small file) then size bytes at
+    // data, which owner keeps alive until the write is done
+    struct File {
+        std::string path;
+        std::string prefix;
+        const void* data = nullptr;
+        size_t size = 0;
+        std::shared_ptr<const void> owner;
+
+        static File text(const std::string& path, std::string contents);
+        static File buffer(const std::string& path, std::shared_ptr<const std::vector<uint8_t>> bytes);
+    };
+
+    // Paths that could not be written, empty when all were
+    typedef std::function<void(const std::vector<std::string>& failed)> Callback;
+
+    explicit OutputWriter(const OutputWritePolicy& policy);
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    void start();
+    // Write everything submitted, then join the writer thread
+    void stop();
+
+    // Queue a batch; false (files untouched) once stopping. done is called
+    // exactly once when it returns true.
+    bool submit(std::vector<File>&& files, Callback done);
+
+    // The same steps on the caller's thread; the paths that failed
+    static std::vector<std::string> write_now(const std::vector<File>& files, const OutputWritePolicy& policy);
+
+    bool uses_io_uring() const { return ring_ != nullptr; }
+    uint64_t written() const { return written_.load(); }
+    uint64_t failed() const { return failed_.load(); }
+    int in_flight() const { return in_flight_.load(); }
+
+private:
+    class Ring;
+    struct Batch;
+    struct Op;
+
+    void run();
+    void complete(Op& op, bool ok);
+
+    OutputWritePolicy policy_;
+    std::unique_ptr<Ring> ring_;
+
+    std::mutex mutex_;
+    std::deque<std::unique_ptr<Op>> queue_;
+    bool stopping_;
+    EventNotifier wake_;
+    std::thread thread_;
+
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> failed_;
+    std::atomic<int> in_flight_;
+
+    MetricsRegistry::Counter& bytes_metric_;
+    MetricsRegistry::Histogram& duration_metric_;
+    MetricsRegistry::Gauge& in_flight_metric_;
+};
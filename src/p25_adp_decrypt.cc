@@ -6,16 +6,26 @@
 P25ADPDecrypt::P25ADPDecrypt() : d_position(0) {
     std::fill(d_keystream, d_keystream + 469, 0);
     std::fill(d_mi, d_mi + 9, 0);
+    std::fill(d_superframe_mask, d_superframe_mask + P25_SUPERFRAME_BYTES, 0);
 }
 
 P25ADPDecrypt::~P25ADPDecrypt() {
 }
 
 bool P25ADPDecrypt::add_key(uint16_t keyid, const std::vector<uint8_t>& key) {
-    d_keys[keyid] = key;
+    expand_key(key, d_keys[keyid]);
     return true;
 }
 
+void P25ADPDecrypt::expand_key(const std::vector<uint8_t>& key, Key& padded) {
+    // Pad with leading zeros if key is too short, use the first 5 bytes of a longer one
+    std::fill(padded.bytes, padded.bytes + 5, 0);
+    size_t length = std::min<size_t>(key.size(), 5);
+    for (size_t i = 0; i < length; i++) {
+        padded.bytes[5 - length + i] = key[i];
+    }
+}
+
 bool P25ADPDecrypt::has_key(uint16_t keyid) const {
     return d_keys.find(keyid) != d_keys.end();
 }
@@ -26,22 +36,17 @@ bool P25ADPDecrypt::prepare(uint16_t keyid, const uint8_t mi[9]) {
         return false; // Key not found
     }
     
+    prepare(key_iter->second, mi);
+    return true;
+}
+
+void P25ADPDecrypt::prepare(const Key& key, const uint8_t mi[9]) {
     d_position = 0;
     std::memcpy(d_mi, mi, sizeof(d_mi));
     
-    // Prepare 5-byte ADP key from stored key
-    uint8_t adp_key[5] = {0};
-    const auto& stored_key = key_iter->second;
-    
-    // Pad with leading zeros if key is too short, copy up to 5 bytes
-    for (size_t i = 0; i < 5 && i < stored_key.size(); i++) {
-        adp_key[5 - stored_key.size() + i] = stored_key[i];
-    }
-    
     // Generate keystream using RC4 algorithm
-    generate_keystream(adp_key, mi);
-    
-    return true;
+    generate_keystream(key.bytes, mi);
+    p25_build_superframe_mask(d_keystream, 267, d_superframe_mask);
 }
 
 bool P25ADPDecrypt::decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool is_ldu2, int voice_frame_num) {
@@ -71,6 +76,11 @@ bool P25ADPDecrypt::decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool i
     return true;
 }
 
+bool P25ADPDecrypt::decrypt_superframe(uint8_t codewords[P25_SUPERFRAME_BYTES]) {
+    p25_xor_superframe(codewords, d_superframe_mask);
+    return true;
+}
+
 void P25ADPDecrypt::generate_keystream(const uint8_t key[5], const uint8_t mi[9]) {
     // ADP/RC4 keystream generation based on Boatboad's implementation
     uint8_t adp_key[13], S[256], K[256];
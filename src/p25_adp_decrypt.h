@@ -5,13 +5,21 @@
 #include <cstdint>
 #include <string>
 #include <unordered_map>
+#include "p25_superframe_crypt.h"
 
 class P25ADPDecrypt {
+public:
+    // RC4 is keyed with key and MI together, so only the padded key is kept
+    struct Key {
+        uint8_t bytes[5];
+    };
+    
 private:
-    std::unordered_map<uint16_t, std::vector<uint8_t>> d_keys;
+    std::unordered_map<uint16_t, Key> d_keys;
     uint8_t d_mi[9];
     uint8_t d_keystream[469]; // ADP keystream size
     uint32_t d_position;
+    uint8_t d_superframe_mask[P25_SUPERFRAME_BYTES];
     
     // RC4 swap function
     inline void adp_swap(uint8_t *S, uint32_t i, uint32_t j) {
@@ -31,9 +39,17 @@ public:
     bool add_key(uint16_t keyid, const std::vector<uint8_t>& key);
     bool has_key(uint16_t keyid) const;
     
+    // Pad a key to 5 bytes without storing it, for keys held outside the decryptor
+    static void expand_key(const std::vector<uint8_t>& key, Key& padded);
+    
     // Decryption preparation and processing
     bool prepare(uint16_t keyid, const uint8_t mi[9]);
+    void prepare(const Key& key, const uint8_t mi[9]);
     bool decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool is_ldu2, int voice_frame_num);
+    
+    // Decrypt the 18 codewords of a superframe in place: LDU1's 9 followed
+    // by LDU2's 9, packed 11 bytes apart
+    bool decrypt_superframe(uint8_t codewords[P25_SUPERFRAME_BYTES]);
 };
 
 #endif // P25_ADP_DECRYPT_H
\ No newline at end of file
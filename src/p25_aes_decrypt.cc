@@ -3,6 +3,16 @@
 #include <cstring>
 #include <algorithm>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define P25_AES_X86 1
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define P25_AES_ARM 1
+#endif
+
 // AES S-box (from Boatboad's implementation)
 const uint8_t P25AESDecrypt::sbox[256] = {
     //0     1    2      3     4    5     6     7      8    9     A      B    C     D     E     F
@@ -58,18 +68,93 @@ const uint8_t P25AESDecrypt::Rcon[11] = {
        ((y>>3 & 1) * xtime(xtime(xtime(x)))) ^         \
        ((y>>4 & 1) * xtime(xtime(xtime(xtime(x))))))   \
 
+// Hardware OFB keystream: each block is the encryption of the previous one,
+// so there is nothing to interleave and 15 dependent blocks is all it does.
+// The round keys are in the FIPS-197 byte order KeyExpansion produces.
+#if defined(P25_AES_X86)
+__attribute__((target("aes,sse2")))
+static void aesni_ofb_keystream(const uint8_t* round_keys, uint8_t iv[16], uint8_t* out, int blocks) {
+    __m128i rk[15];
+    for (int r = 0; r < 15; r++) {
+        rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys + 16 * r));
+    }
+    __m128i state = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+    for (int block = 0; block < blocks; block++) {
+        state = _mm_xor_si128(state, rk[0]);
+        for (int r = 1; r < 14; r++) {
+            state = _mm_aesenc_si128(state, rk[r]);
+        }
+        state = _mm_aesenclast_si128(state, rk[14]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * block), state);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(iv), state);
+}
+
+static bool hardware_aes() {
+    static const bool available = __builtin_cpu_supports("aes");
+    return available;
+}
+#elif defined(P25_AES_ARM)
+__attribute__((target("+crypto")))
+static void armv8_ofb_keystream(const uint8_t* round_keys, uint8_t iv[16], uint8_t* out, int blocks) {
+    uint8x16_t rk[15];
+    for (int r = 0; r < 15; r++) {
+        rk[r] = vld1q_u8(round_keys + 16 * r);
+    }
+    uint8x16_t state = vld1q_u8(iv);
+    for (int block = 0; block < blocks; block++) {
+        for (int r = 0; r < 13; r++) {
+            state = vaesmcq_u8(vaeseq_u8(state, rk[r]));
+        }
+        state = veorq_u8(vaeseq_u8(state, rk[13]), rk[14]);
+        vst1q_u8(out + 16 * block, state);
+    }
+    vst1q_u8(iv, state);
+}
+
+static bool hardware_aes() {
+    static const bool available = (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+    return available;
+}
+#else
+static bool hardware_aes() {
+    return false;
+}
+#endif
+
+const char* P25AESDecrypt::implementation() {
+#if defined(P25_AES_X86)
+    return hardware_aes() ? "aes-ni" : "software";
+#elif defined(P25_AES_ARM)
+    return hardware_aes() ? "armv8-ce" : "software";
+#else
+    return "software";
+#endif
+}
+
 P25AESDecrypt::P25AESDecrypt() : d_position(0) {
     std::fill(d_keystream, d_keystream + 240, 0);
+    std::fill(d_superframe_mask, d_superframe_mask + P25_SUPERFRAME_BYTES, 0);
 }
 
 P25AESDecrypt::~P25AESDecrypt() {
 }
 
 bool P25AESDecrypt::add_key(uint16_t keyid, const std::vector<uint8_t>& key) {
-    d_keys[keyid] = key;
+    expand_key(key, d_keys[keyid]);
     return true;
 }
 
+void P25AESDecrypt::expand_key(const std::vector<uint8_t>& key, ExpandedKey& expanded) {
+    // Prepare 32-byte AES-256 key from the given key, zero padded
+    uint8_t aes_key[32] = {0};
+    for (size_t i = 0; i < 32 && i < key.size(); i++) {
+        aes_key[i] = key[i];
+    }
+    KeyExpansion(expanded.RoundKey, aes_key);
+    std::memset(aes_key, 0, sizeof(aes_key));
+}
+
 bool P25AESDecrypt::has_key(uint16_t keyid) const {
     return d_keys.find(keyid) != d_keys.end();
 }
@@ -80,21 +165,16 @@ bool P25AESDecrypt::prepare(uint16_t keyid, const uint8_t mi[9]) {
         return false; // Key not found
     }
     
+    prepare(key_iter->second, mi);
+    return true;
+}
+
+void P25AESDecrypt::prepare(const ExpandedKey& key, const uint8_t mi[9]) {
     d_position = 0;
     
-    // Prepare 32-byte AES-256 key from stored key
-    uint8_t aes_key[32] = {0};
-    const auto& stored_key = key_iter->second;
-    
-    // Copy up to 32 bytes from stored key
-    for (size_t i = 0; i < 32 && i < stored_key.size(); i++) {
-        aes_key[i] = stored_key[i];
-    }
-    
     // Generate keystream using AES-OFB
-    generate_keystream(aes_key, mi);
-    
-    return true;
+    generate_keystream(key.RoundKey, mi);
+    p25_build_superframe_mask(d_keystream, 16 + 11, d_superframe_mask);
 }
 
 bool P25AESDecrypt::decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool is_ldu2, int voice_frame_num) {
@@ -123,27 +203,33 @@ bool P25AESDecrypt::decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool i
     return true;
 }
 
-void P25AESDecrypt::generate_keystream(const uint8_t key[32], const uint8_t mi[9]) {
-    // Initialize AES context with 256-bit key
-    AES_ctx ctx;
-    AES_init_ctx_iv(&ctx, key, mi); // Use MI as IV
-    
+bool P25AESDecrypt::decrypt_superframe(uint8_t codewords[P25_SUPERFRAME_BYTES]) {
+    p25_xor_superframe(codewords, d_superframe_mask);
+    return true;
+}
+
+void P25AESDecrypt::generate_keystream(const uint8_t* RoundKey, const uint8_t mi[9]) {
     // Generate 240-byte keystream using AES-OFB mode
     uint8_t iv[16];
     std::memcpy(iv, mi, 9);
     std::memset(iv + 9, 0, 7); // Pad MI to 16 bytes for AES block size
     
+#if defined(P25_AES_X86)
+    if (hardware_aes()) {
+        aesni_ofb_keystream(RoundKey, iv, d_keystream, 15);
+        return;
+    }
+#elif defined(P25_AES_ARM)
+    if (hardware_aes()) {
+        armv8_ofb_keystream(RoundKey, iv, d_keystream, 15);
+        return;
+    }
+#endif
+    
     for (int block = 0; block < 15; block++) { // 240/16 = 15 blocks
-        // Encrypt IV to get keystream block
-        AES_ECB_encrypt(&ctx, iv);
-        
-        // Copy encrypted block to keystream
-        for (int i = 0; i < 16 && (block * 16 + i) < 240; i++) {
-            d_keystream[block * 16 + i] = iv[i];
-        }
-        
-        // For OFB mode, the encrypted output becomes the next IV
-        // (This is simplified - production should use proper OFB chaining)
+        // Encrypt IV in place; in OFB mode the output is also the next IV
+        Cipher((state_t*)iv, RoundKey);
+        std::memcpy(d_keystream + block * 16, iv, 16);
     }
 }
 
@@ -5,19 +5,27 @@
 #include <cstdint>
 #include <string>
 #include <unordered_map>
+#include "p25_superframe_crypt.h"
 
 #define AES_BLOCKLEN 16
 
 class P25AESDecrypt {
+public:
+    // Keys are expanded once when added; prepare() only runs the cipher
+    struct ExpandedKey {
+        uint8_t RoundKey[240];
+    };
+    
 private:
-    std::unordered_map<uint16_t, std::vector<uint8_t>> d_keys;
+    std::unordered_map<uint16_t, ExpandedKey> d_keys;
     uint8_t d_keystream[240]; // 16 bytes per block x 15 blocks (FDMA)
     uint32_t d_position;
+    uint8_t d_superframe_mask[P25_SUPERFRAME_BYTES];
     
     // AES-256 parameters
-    unsigned Nb = 4;
-    unsigned Nk = 8;  // AES-256
-    unsigned Nr = 14; // 14 rounds for AES-256
+    static constexpr unsigned Nb = 4;
+    static constexpr unsigned Nk = 8;  // AES-256
+    static constexpr unsigned Nr = 14; // 14 rounds for AES-256
     
     // AES implementation structures
     struct AES_ctx {
@@ -33,7 +41,7 @@ private:
     static const uint8_t Rcon[11];
     
     // AES internal functions
-    void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key);
+    static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key);
     void AddRoundKey(uint8_t round, state_t* state, const uint8_t* RoundKey);
     void SubBytes(state_t* state);
     void ShiftRows(state_t* state);
@@ -53,8 +61,8 @@ private:
     uint8_t xtime(uint8_t x);
     void XorWithIv(uint8_t* buf, const uint8_t* Iv);
     
-    // Keystream generation
-    void generate_keystream(const uint8_t key[32], const uint8_t mi[9]);
+    // Keystream generation; uses AES-NI or ARMv8 AES instructions when the CPU has them
+    void generate_keystream(const uint8_t* RoundKey, const uint8_t mi[9]);
     
 public:
     P25AESDecrypt();
@@ -64,9 +72,21 @@ public:
     bool add_key(uint16_t keyid, const std::vector<uint8_t>& key);
     bool has_key(uint16_t keyid) const;
     
+    // Expand a key (zero padded to 32 bytes) without storing it, for keys
+    // held outside the decryptor such as the shared KeyStore
+    static void expand_key(const std::vector<uint8_t>& key, ExpandedKey& expanded);
+    
     // Decryption preparation and processing
     bool prepare(uint16_t keyid, const uint8_t mi[9]);
+    void prepare(const ExpandedKey& key, const uint8_t mi[9]);
     bool decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool is_ldu2, int voice_frame_num);
+    
+    // Decrypt the 18 codewords of a superframe in place: LDU1's 9 followed
+    // by LDU2's 9, packed 11 bytes apart
+    bool decrypt_superframe(uint8_t codewords[P25_SUPERFRAME_BYTES]);
+    
+    // "aes-ni", "armv8-ce" or "software"
+    static const char* implementation();
 };
 
 #endif // P25_AES_DECRYPT_H
\ No newline at end of file
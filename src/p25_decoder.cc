@@ -18,33 +18,113 @@
  */
 
 #include "p25_decoder.h"
+#include "audio_encoder.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "stage_profiler.h"
+#include "pcm_stream.h"
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <fstream>
-#include <sstream>
-#include <iomanip>
 #include <ctime>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <sys/stat.h>
 
 // OP25 IMBE decoder includes (based on trunk-recorder implementation)
-#include "imbe_vocoder/imbe_vocoder.h"
 #include "op25_imbe_frame.h"
 
 // Type definitions from OP25
 typedef std::vector<bool> bit_vector;
 typedef std::vector<bool> voice_codeword;
 
+namespace {
+
+// Process-wide decode counters, looked up once and shared by every decoder
+struct DecoderMetrics {
+    MetricsRegistry::Counter& frames;
+    MetricsRegistry::Counter& imbe_frames;
+    MetricsRegistry::Counter& concealed_frames;
+    MetricsRegistry::Counter& segmented_calls;
+    MetricsRegistry::Histogram& vocoder_frame;
+
+    explicit DecoderMetrics(MetricsRegistry& registry)
+        : frames(registry.counter("trunk_decoder_frames_decoded_total", "P25 frames parsed by the decoder")),
+          imbe_frames(registry.counter("trunk_decoder_imbe_frames_total", "IMBE frames synthesised by the vocoder")),
+          concealed_frames(registry.counter("trunk_decoder_imbe_concealed_frames_total",
+                                            "IMBE frames repeated or muted instead of synthesised")),
+          segmented_calls(registry.counter("trunk_decoder_segmented_calls_total",
+                                           "Long calls synthesised as parallel segments")),
+          vocoder_frame(registry.histogram("trunk_decoder_vocoder_frame_seconds",
+                                           "Vocoder synthesis time per IMBE frame, one sample per LDU or lone frame", "",
+                                           {5e-6, 1e-5, 2e-5, 5e-5, 1e-4, 2e-4, 5e-4, 1e-3, 2e-3, 5e-3})) {}
+
+    static DecoderMetrics& get() {
+        static DecoderMetrics metrics(MetricsRegistry::global());
+        return metrics;
+    }
+};
+
+// VoiceSynth::decode with its per-frame cost recorded; returns the time taken in ns
+int64_t timed_synth(VoiceSynth& synth, const uint32_t (*u)[8], const uint32_t* E0, const uint32_t* ET,
+                    size_t n, int16_t* out) {
+    DecoderMetrics& metrics = DecoderMetrics::get();
+    PROFILE_STAGE(ProfileStage::IMBE_DECODE);
+    auto start = std::chrono::steady_clock::now();
+    synth.decode(u, E0, ET, n, out);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    metrics.vocoder_frame.record(elapsed / n);
+    metrics.imbe_frames.add(n);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+} // namespace
+
 P25Decoder::P25Decoder() {
     parser_ = std::make_unique<P25FrameParser>();
+    deadline_ = std::chrono::steady_clock::time_point::max();
+    timed_out_ = false;
+    input_buffer_ = nullptr;
+    input_buffer_size_ = 0;
+    current_algorithm_id_ = 0x80;
+    current_key_id_ = 0;
+    crypt_ready_ = false;
+    crypt_missing_ = false;
+    superframe_decodable_seen_ = false;
+    skip_undecodable_ = false;
+    undecodable_metadata_only_ = false;
+    conceal_frames_ = false;
+    conceal_max_repeats_ = VoiceQuality::DEFAULT_MAX_REPEATS;
+    std::fill(last_good_pcm_, last_good_pcm_ + SAMPLES_PER_IMBE_FRAME, 0);
+    silence_skip_ = false;
+    silence_compaction_ = false;
+    silence_keep_frames_ = DEFAULT_SILENCE_KEEP_MS * 8 / SAMPLES_PER_IMBE_FRAME;
+    silence_run_frames_ = 0;
+    shared_keys_generation_ = UINT64_MAX;
+    call_active_ = false;
+    trace_id_ = 0;
+    trace_parse_ns_ = 0;
+    trace_vocoder_ns_ = 0;
     text_dump_enabled_ = false; // Default to false to reduce output
+    csv_frame_hex_ = false;
     imbe_decoder_initialized_ = false;
     current_frame_num_ = 0;
     decryption_enabled_ = false;
     audio_format_ = "wav";
     audio_bitrate_ = 0;
+    ffmpeg_fallback_ = true;
+    output_sample_rate_ = 8000;
+    segment_threads_ = 1;
+    min_segment_ldus_ = DEFAULT_MIN_SEGMENT_LDUS;
+    frame_index_enabled_ = false;
     
     // Initialize IMBE vocoder (trunk-recorder approach)
-    vocoder_ = new imbe_vocoder();
+    synth_ = VoiceSynth::create(VoiceSynth::FIXED_POINT);
     imbe_decoder_initialized_ = true;
     // Note: IMBE vocoder constructor prints its own copyright message
     
@@ -57,21 +137,21 @@ P25Decoder::P25Decoder() {
 
 P25Decoder::~P25Decoder() {
     close_audio_output();
-    if (vocoder_) {
-        delete vocoder_;
-    }
 }
 
 bool P25Decoder::open_p25_file(const std::string& filename) {
     input_filename_ = filename;
+    input_buffer_ = nullptr;
+    input_buffer_size_ = 0;
     if (!parser_->open(filename)) {
-        std::cerr << "Error: Failed to open P25 file: " << filename << std::endl;
+        LOG_ERROR("Error: Failed to open P25 file: " << filename);
         return false;
     }
     
     // Initialize metadata
     metadata_ = CallMetadata();
     metadata_.start_time = time(nullptr); // For now, use current time
+    silence_run_frames_ = 0;
     
     // Clear audio buffer for new file
     audio_buffer_.clear();
@@ -79,296 +159,662 @@ bool P25Decoder::open_p25_file(const std::string& filename) {
     return true;
 }
 
-bool P25Decoder::setup_wav_output(const std::string& filename) {
-    // Create WAV file like trunk-recorder does
-    audio_file_.open(filename + ".wav", std::ios::binary);
-    if (!audio_file_.is_open()) {
-        std::cerr << "Error: Could not create WAV output file: " << filename << ".wav" << std::endl;
+bool P25Decoder::open_p25_buffer(const uint8_t* data, size_t size, const std::string& source_name) {
+    input_filename_ = source_name;
+    input_buffer_ = data;
+    input_buffer_size_ = size;
+    if (!parser_->open_buffer(data, size)) {
+        LOG_ERROR("Error: Failed to open P25 buffer: " << source_name);
+        input_buffer_ = nullptr;
+        input_buffer_size_ = 0;
         return false;
     }
     
-    // Write placeholder WAV header (we'll update it when we close the file)
-    write_wav_header();
+    metadata_ = CallMetadata();
+    metadata_.start_time = time(nullptr);
+    silence_run_frames_ = 0;
+    audio_buffer_.clear();
     
     return true;
 }
 
-void P25Decoder::write_wav_header() {
-    // WAV header for 16-bit, 8kHz, mono audio
-    const int sample_rate = 8000;
-    const int bits_per_sample = 16;
-    const int channels = 1;
-    const int data_size = 0; // We'll update this later
+void P25Decoder::begin_call(const std::string& metadata_json, const std::string& source_name) {
+    begin_call(TrunkCallMetadata::parse(metadata_json), source_name);
+}
+
+void P25Decoder::begin_call(std::shared_ptr<const TrunkCallMetadata> call_metadata, const std::string& source_name) {
+    parser_->close();
+    input_filename_ = source_name;
+    input_buffer_ = nullptr;
+    input_buffer_size_ = 0;
     
-    // WAV header structure
-    struct {
-        char riff[4] = {'R', 'I', 'F', 'F'};
-        uint32_t file_size = 36 + data_size; // Will be updated later
-        char wave[4] = {'W', 'A', 'V', 'E'};
-        char fmt[4] = {'f', 'm', 't', ' '};
-        uint32_t fmt_size = 16;
-        uint16_t format = 1; // PCM
-        uint16_t num_channels = channels;
-        uint32_t sample_rate_val = sample_rate;
-        uint32_t byte_rate = sample_rate * channels * bits_per_sample / 8;
-        uint16_t block_align = channels * bits_per_sample / 8;
-        uint16_t bits_per_sample_val = bits_per_sample;
-        char data[4] = {'d', 'a', 't', 'a'};
-        uint32_t data_size_val = data_size; // Will be updated later
-    } wav_header;
+    metadata_ = CallMetadata();
+    metadata_.start_time = time(nullptr);
+    audio_buffer_.clear();
+    external_metadata_ = std::move(call_metadata);
+    std::fill(current_mi_, current_mi_ + 9, 0);
+    current_algorithm_id_ = 0x80;
+    current_key_id_ = 0;
+    crypt_ready_ = false;
+    crypt_missing_ = false;
+    superframe_decodable_seen_ = false;
+    std::fill(last_good_pcm_, last_good_pcm_ + SAMPLES_PER_IMBE_FRAME, 0);
+    
+    if (external_metadata_ && external_metadata_->is_object()) {
+        const TrunkCallMetadata& call = *external_metadata_;
+        if (call.has_talkgroup) {
+            metadata_.talkgroup = call.talkgroup;
+        }
+        auto source = call.object.find("source");
+        if (source != call.object.end() && source->is_number()) {
+            metadata_.source_id = source->get<long>();
+        } else if (call.source_id) {
+            metadata_.source_id = call.source_id;
+        }
+        if (!call.short_name.empty()) {
+            metadata_.system_short_name = call.short_name;
+        }
+    }
     
-    audio_file_.write(reinterpret_cast<const char*>(&wav_header), sizeof(wav_header));
+    frame_pcm_.reserve(SAMPLES_PER_LDU);
+    if (gain_) {
+        gain_->reset();
+    }
+    call_active_ = true;
 }
 
-void P25Decoder::finalize_wav_file() {
-    if (!audio_file_.is_open()) return;
+const std::vector<int16_t>& P25Decoder::push_frame(const P25Frame& frame) {
+    if (!call_active_) {
+        begin_call();
+    }
     
-    // Calculate actual data size
-    std::streampos current_pos = audio_file_.tellp();
-    uint32_t data_size = static_cast<uint32_t>(current_pos) - 44; // 44 is WAV header size
-    uint32_t file_size = 36 + data_size;
+    count_frame(frame);
+    frame_pcm_.clear();
     
-    // Update WAV header with correct sizes
-    audio_file_.seekp(4);
-    audio_file_.write(reinterpret_cast<const char*>(&file_size), 4);
+    if (frame.is_voice_frame) {
+        frame_pcm_.resize(SAMPLES_PER_LDU);
+        size_t sample_count = decode_voice_frame(frame, frame_pcm_.data());
+        frame_pcm_.resize(sample_count);
+        if (gain_ && sample_count > 0) {
+            gain_->process(frame_pcm_.data(), sample_count);
+        }
+        if (pcm_publisher_ && sample_count > 0) {
+            pcm_publisher_->publish(frame_pcm_.data(), sample_count);
+        }
+        // A skipped LDU still took its 180 ms on air
+        metadata_.call_length += (sample_count > 0 ? sample_count : SAMPLES_PER_LDU) / 8000.0;
+    }
+    metadata_.end_time = time(nullptr);
+    return frame_pcm_;
+}
+
+const CallMetadata& P25Decoder::end_call() {
+    if (call_active_) {
+        metadata_.end_time = time(nullptr);
+        call_active_ = false;
+    }
+    return metadata_;
+}
+
+void P25Decoder::reset() {
+    close_audio_output();
+    parser_->close();
+    input_filename_.clear();
+    input_buffer_ = nullptr;
+    input_buffer_size_ = 0;
+    
+    metadata_ = CallMetadata();
+    external_metadata_.reset();
+    audio_buffer_.clear();
+    frame_pcm_.clear();
+    current_frame_num_ = 0;
+    silence_run_frames_ = 0;
+    if (resampler_) {
+        resampler_->reset();
+    }
+    if (gain_) {
+        gain_->reset();
+    }
+    
+    std::fill(current_mi_, current_mi_ + 9, 0);
+    current_algorithm_id_ = 0x80;
+    current_key_id_ = 0;
+    crypt_ready_ = false;
+    crypt_missing_ = false;
+    superframe_decodable_seen_ = false;
+    std::fill(last_good_pcm_, last_good_pcm_ + SAMPLES_PER_IMBE_FRAME, 0);
+    call_active_ = false;
+    trace_id_ = 0;
+    trace_parse_ns_ = 0;
+    trace_vocoder_ns_ = 0;
+    deadline_ = std::chrono::steady_clock::time_point::max();
+    timed_out_ = false;
+    
+    if (synth_) {
+        synth_->reset();
+    }
+}
+
+void P25Decoder::count_frame(const P25Frame& frame) {
+    DecoderMetrics::get().frames.add();
+    metadata_.total_frames++;
+    if (metadata_.total_frames == 1) {
+        metadata_.nac = frame.nac;
+    }
+    if (frame.is_encrypted) {
+        metadata_.has_encrypted_frames = true;
+    }
+    if (frame.is_voice_frame) {
+        metadata_.voice_frames++;
+    }
+}
+
+bool P25Decoder::reopen_input() {
+    parser_.reset(new P25FrameParser());
+    if (input_buffer_) {
+        return parser_->open_buffer(input_buffer_, input_buffer_size_);
+    }
+    return parser_->open(input_filename_);
+}
+
+bool P25Decoder::setup_wav_output(const std::string& filename, uint64_t max_voice_samples) {
+    // Create the file now so a bad output path fails before decoding; the
+    // header and samples are written together by close_audio_output()
+    if (!wav_writer_.open(filename + ".wav", wav_options_)) {
+        LOG_ERROR("Error: Could not create WAV output file: " << filename << ".wav");
+        return false;
+    }
+    reserve_audio_buffer(max_voice_samples);
+    return true;
+}
+
+void P25Decoder::reserve_audio_buffer(uint64_t max_voice_samples) {
+    size_t input_size = input_buffer_size_;
+    struct stat info;
+    if (!input_buffer_ && stat(input_filename_.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+        input_size = static_cast<size_t>(info.st_size);
+    }
+    // An LDU is at least its 5-byte frame header and nine 18-byte codewords,
+    // so this is an upper bound for files holding nothing but voice. With
+    // no input to go by (a pipe, an archive) only a known limit is reserved.
+    const size_t min_ldu_bytes = 5 + IMBE_FRAMES_PER_LDU * 18;
+    size_t samples = input_size / min_ldu_bytes * SAMPLES_PER_LDU;
+    if (max_voice_samples < samples || (input_size == 0 && max_voice_samples != UINT64_MAX)) {
+        samples = static_cast<size_t>(max_voice_samples);
+    }
+    samples = samples / 8000 * output_sample_rate_ + samples % 8000 * output_sample_rate_ / 8000;
+    // Leave room for the resampler's flush at the end of the call
+    audio_buffer_.reserve(samples + Resampler::TAPS_PER_PHASE * (output_sample_rate_ / 8000 + 1));
+}
+
+bool P25Decoder::load_frame_index() {
+    const bool from_file = !input_buffer_ && !input_filename_.empty();
+    const std::string index_path = FrameIndex::path_for(input_filename_);
+    if (from_file && frame_index_.load(index_path, input_filename_)) {
+        return true;
+    }
     
-    audio_file_.seekp(40);
-    audio_file_.write(reinterpret_cast<const char*>(&data_size), 4);
+    // No usable sidecar: one pass over the frame headers, no vocoder
+    frame_index_.clear();
+    P25Frame frame;
+    bool complete = true;
+    while (true) {
+        int64_t offset = parser_->position();
+        if (offset < 0) {
+            complete = false;
+            break;
+        }
+        if (!parser_->read_frame(frame)) {
+            break;
+        }
+        if (!frame_index_.add(static_cast<uint64_t>(offset), frame.duid)) {
+            complete = false;
+            break;
+        }
+    }
+    if (!complete || !parser_->seek(0)) {
+        frame_index_.clear();
+        reopen_input();
+        return false;
+    }
+    if (from_file && frame_index_enabled_ && !frame_index_.save(index_path, input_filename_)) {
+        LOG_WARN("Warning: Could not write frame index " << index_path);
+    }
+    return !frame_index_.empty();
 }
 
-void P25Decoder::write_audio_samples(const std::vector<int16_t>& samples) {
-    if (audio_file_.is_open() && !samples.empty()) {
-        audio_file_.write(reinterpret_cast<const char*>(samples.data()), 
-                         samples.size() * sizeof(int16_t));
+bool P25Decoder::seek_to_sample(uint64_t sample, int& frame_number, uint64_t& voice_sample) {
+    if (!load_frame_index()) {
+        return false;
     }
+    // Past the last LDU only the final frame is left to read
+    size_t start = std::min(frame_index_.seek_point(sample, RANGE_PRIME_LDUS), frame_index_.entries().size() - 1);
+    const FrameIndex::Entry& entry = frame_index_.entries()[start];
+    if (!parser_->seek(entry.offset)) {
+        reopen_input();
+        return false;
+    }
+    frame_number = static_cast<int>(start);
+    voice_sample = entry.sample;
+    return true;
 }
 
 void P25Decoder::close_audio_output() {
-    if (audio_file_.is_open()) {
-        finalize_wav_file();
-        audio_file_.close();
+    PROFILE_STAGE(ProfileStage::WAV_WRITE);
+    if (wav_writer_.is_open()) {
+        wav_writer_.write(audio_buffer_.data(), audio_buffer_.size(), output_sample_rate_);
+    }
+}
+
+void P25Decoder::update_encryption_sync(const P25Frame& frame) {
+    if (!frame.es_valid) {
+        return; // keep the last sync that decoded cleanly
     }
+    current_algorithm_id_ = frame.algorithm_id;
+    current_key_id_ = frame.key_id;
+    std::copy(frame.message_indicator, frame.message_indicator + 9, current_mi_);
+    metadata_.algorithm_id = current_algorithm_id_;
+    metadata_.key_id = current_key_id_;
+    
+    // Clear calls never reach the ciphers
+    crypt_ready_ = frame.is_encrypted && decryption_enabled_ &&
+                   prepare_decryption(current_algorithm_id_, current_key_id_, current_mi_);
+    crypt_missing_ = frame.is_encrypted && !crypt_ready_;
+    if (!crypt_missing_) {
+        superframe_decodable_seen_ = true;
+    }
+    metadata_.undecodable = crypt_missing_ && !superframe_decodable_seen_;
+}
+
+void P25Decoder::decrypt_codeword(std::vector<uint8_t>& codeword, bool is_ldu2, int voice_frame_num) {
+    PROFILE_STAGE(ProfileStage::DECRYPT);
+    switch (current_algorithm_id_) {
+        case 0x81: des_decrypt_->decrypt_imbe_codeword(codeword, is_ldu2, voice_frame_num); break;
+        case 0x84: aes_decrypt_->decrypt_imbe_codeword(codeword, is_ldu2, voice_frame_num); break;
+        case 0xAA: adp_decrypt_->decrypt_imbe_codeword(codeword, is_ldu2, voice_frame_num); break;
+        default: break;
+    }
+}
+
+size_t P25Decoder::decode_voice_frame(const P25Frame& frame, int16_t* audio_samples) {
+    VoiceWork work;
+    prepare_voice_frame(frame, work);
+    return render_voice(work, *synth_, last_good_pcm_, audio_samples, trace_vocoder_ns_);
 }
 
-bool P25Decoder::decode_voice_frame(const P25Frame& frame, std::vector<int16_t>& audio_samples) {
-    audio_samples.clear();
+void P25Decoder::prepare_voice_frame(const P25Frame& frame, VoiceWork& work) {
+    // Encryption sync in an LDU2 covers the superframe after it, so it is
+    // taken up only once this frame's own voice has been decrypted
+    struct SyncAfterDecode {
+        P25Decoder* decoder;
+        const P25Frame& frame;
+        ~SyncAfterDecode() {
+            if (frame.duid == static_cast<uint8_t>(P25Duid::LDU2)) {
+                decoder->update_encryption_sync(frame);
+            }
+        }
+    } sync_after_decode{this, frame};
+    
+    work.kind = VoiceWork::SKIPPED;
+    work.new_transmission = false;
+    
+    // Nothing but noise would come out of the vocoder
+    if (crypt_missing_ && skip_undecodable_) {
+        metadata_.skipped_frames++;
+        return;
+    }
     
     if (frame.is_voice_frame && imbe_decoder_initialized_) {
         // Try to decode actual IMBE voice data
-        if (extract_imbe_from_p25_frame(frame, audio_samples)) {
+        if (extract_imbe_from_p25_frame(frame, work)) {
+            work.kind = VoiceWork::LDU;
             if (text_dump_enabled_) {
-                std::cout << "  [VOICE] Decoded IMBE audio (" << frame.data.size() 
-                          << " bytes P25 -> " << audio_samples.size() << " samples)" << std::endl;
+                LOG_INFO("  [VOICE] Decoded IMBE audio (" << frame.payload_size() 
+                         << " bytes P25 -> " << SAMPLES_PER_LDU << " samples)");
             }
-            return true;
+            return;
         }
     }
     
     // Fall back to synthetic audio if IMBE decoding fails
     if (frame.is_voice_frame) {
-        const int SAMPLES_PER_FRAME = 160;
-        audio_samples.resize(SAMPLES_PER_FRAME, 0); // Silence as fallback
+        work.kind = VoiceWork::SILENCE;
         
         if (text_dump_enabled_) {
-            std::cout << "  [VOICE] IMBE decode failed, using silence (" << frame.data.size() 
-                      << " bytes P25 -> " << SAMPLES_PER_FRAME << " samples)" << std::endl;
+            LOG_INFO("  [VOICE] IMBE decode failed, using silence (" << frame.payload_size() 
+                     << " bytes P25 -> " << SAMPLES_PER_IMBE_FRAME << " samples)");
         }
-        
-        return true;
     }
-    
-    return false;
 }
 
-bool P25Decoder::extract_imbe_from_p25_frame(const P25Frame& frame, std::vector<int16_t>& audio_samples) {
-    if (!imbe_decoder_initialized_ || !vocoder_) {
+bool P25Decoder::extract_imbe_from_p25_frame(const P25Frame& frame, VoiceWork& work) {
+    if (!imbe_decoder_initialized_ || !synth_) {
         return false;
     }
     
-    const int SAMPLES_PER_FRAME = 160;
-    audio_samples.clear();
-    
     try {
-        // Convert frame data to bit vector for processing (same as trunk-recorder)
-        bit_vector frame_bits(frame.data.size() * 8);
-        for (size_t i = 0; i < frame.data.size(); i++) {
-            for (int bit = 0; bit < 8; bit++) {
-                frame_bits[i * 8 + bit] = (frame.data[i] >> (7 - bit)) & 1;
+        // P25 voice frames contain 9 IMBE codewords, all FEC decoded in one pass.
+        // Codewords are deinterleaved straight from the packed LDU bytes via the
+        // precomputed offset tables in op25_imbe_frame.h (no bit_vector churn).
+        imbe_ldu_params params;
+        {
+            PROFILE_STAGE(ProfileStage::FEC);
+            if (!imbe_ldu_decode_packed(frame.payload(), frame.payload_size(), params)) {
+                return false;
             }
         }
         
-        // P25 voice frames contain 9 IMBE codewords - decode each one (trunk-recorder approach)
-        for (int i = 0; i < 9; i++) {
-            voice_codeword codeword(144); // IMBE codeword is 144 bits
-            
-            // Use proper OP25 deinterleaving (same as trunk-recorder)
-            imbe_deinterleave(frame_bits, codeword, i);
+        work.bad_frames = 0;
+        for (int i = 0; i < IMBE_FRAMES_PER_LDU; i++) {
+            uint32_t* u = params.u[i];
             
-            // Decode IMBE parameters (same as trunk-recorder)
-            uint32_t u[8];
-            uint32_t E0, ET;
-            size_t errs = imbe_header_decode(codeword, u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7], E0, ET);
-            
-            // Convert to frame vector format for vocoder (same as trunk-recorder)
-            int16_t frame_vector[8];
-            for (int j = 0; j < 8; j++) {
-                frame_vector[j] = u[j];
+            // Encrypted voice: the cipher covers the 88 information bits
+            if (crypt_ready_) {
+                imbe_pack(crypt_codeword_, u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7]);
+                decrypt_codeword(crypt_codeword_, frame.duid == static_cast<uint8_t>(P25Duid::LDU2), i);
+                imbe_unpack(crypt_codeword_, u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7]);
+                u[7] <<= 1;
             }
-            frame_vector[7] >>= 1; // Same bit shift as trunk-recorder
-            
-            // Decode with IMBE vocoder (same as trunk-recorder)
-            int16_t snd[160]; // 160 samples per IMBE frame
-            vocoder_->imbe_decode(frame_vector, snd);
-            
-            // Add decoded samples to output
-            for (int j = 0; j < 160; j++) {
-                audio_samples.push_back(snd[j]);
+            work.decisions[i] = metadata_.voice_quality.add_codeword(params.E0[i], params.ET[i], u[0], u[7],
+                                                                     conceal_max_repeats_);
+            if (work.decisions[i] != VoiceQuality::VOICE) {
+                work.bad_frames++;
             }
         }
-        
-        if (!audio_samples.empty()) {
-            return true; // Successfully decoded audio
-        }
+        work.repeat_run = metadata_.voice_quality.repeat_run();
+        memcpy(work.u, params.u, sizeof(work.u));
+        memcpy(work.E0, params.E0, sizeof(work.E0));
+        memcpy(work.ET, params.ET, sizeof(work.ET));
+        return true;
         
     } catch (const std::exception& e) {
         if (text_dump_enabled_) {
-            std::cout << "  [ERROR] IMBE decode exception: " << e.what() << std::endl;
+            LOG_INFO("  [ERROR] IMBE decode exception: " << e.what());
         }
     }
     
     return false; // Failed to decode
 }
 
-std::string P25Decoder::generate_json_metadata() {
-    // Check if there's a corresponding .json file - use just filename, not full path
-    std::string basename = input_filename_;
+size_t P25Decoder::render_voice(const VoiceWork& work, VoiceSynth& synth, int16_t* last_good,
+                                int16_t* audio_samples, int64_t& vocoder_ns) const {
+    if (work.kind == VoiceWork::SILENCE) {
+        std::fill(audio_samples, audio_samples + SAMPLES_PER_IMBE_FRAME, 0); // Silence as fallback
+        return SAMPLES_PER_IMBE_FRAME;
+    }
+    if (work.kind != VoiceWork::LDU) {
+        return 0;
+    }
     
-    // Remove path, keeping only filename
-    size_t last_slash = basename.find_last_of("/\\");
-    if (last_slash != std::string::npos) {
-        basename = basename.substr(last_slash + 1);
+    // Decode all codewords with the IMBE vocoder straight into the caller's buffer
+    if (!conceal_frames_ || work.bad_frames == 0) {
+        vocoder_ns += timed_synth(synth, work.u, work.E0, work.ET, IMBE_FRAMES_PER_LDU, audio_samples);
+        if (conceal_frames_) {
+            std::copy(audio_samples + SAMPLES_PER_LDU - SAMPLES_PER_IMBE_FRAME,
+                      audio_samples + SAMPLES_PER_LDU, last_good);
+        }
+        return SAMPLES_PER_LDU;
     }
     
-    // Create JSON filename from basename
-    std::string json_filename = basename;
-    if (json_filename.size() > 4 && json_filename.substr(json_filename.size() - 4) == ".p25") {
-        json_filename = json_filename.substr(0, json_filename.size() - 4) + ".json";
+    // Only the good frames go through synthesis
+    DecoderMetrics::get().concealed_frames.add(work.bad_frames);
+    for (int i = 0; i < IMBE_FRAMES_PER_LDU; i++) {
+        int16_t* out = audio_samples + i * SAMPLES_PER_IMBE_FRAME;
+        if (work.decisions[i] == VoiceQuality::VOICE) {
+            vocoder_ns += timed_synth(synth, &work.u[i], &work.E0[i], &work.ET[i], 1, out);
+            std::copy(out, out + SAMPLES_PER_IMBE_FRAME, last_good);
+        } else {
+            conceal_frame(work.decisions[i], work.repeat_run, last_good, out);
+        }
+    }
+    return SAMPLES_PER_LDU;
+}
+
+void P25Decoder::conceal_frame(VoiceQuality::Decision decision, int run, const int16_t* last_good,
+                               int16_t* audio_samples) const {
+    if (decision == VoiceQuality::MUTE || run > 15) {
+        std::fill(audio_samples, audio_samples + SAMPLES_PER_IMBE_FRAME, 0);
+        return;
+    }
+    for (int j = 0; j < SAMPLES_PER_IMBE_FRAME; j++) {
+        audio_samples[j] = last_good[j] >> run;
+    }
+}
+
+std::vector<size_t> P25Decoder::plan_segments() const {
+    std::vector<size_t> starts{0};
+    const size_t total = voice_work_.size();
+    const size_t min_ldus = static_cast<size_t>(std::max(1, min_segment_ldus_));
+    if (segment_threads_ <= 1 || total < 2 * min_ldus) {
+        return starts;
     }
     
-    std::ostringstream json;
-    json << std::fixed << std::setprecision(2);
+    // Even shares, cut at the first transmission boundary past each share
+    const size_t share = std::max(min_ldus, (total + segment_threads_ - 1) / segment_threads_);
+    for (size_t i = 1; i < total && starts.size() < static_cast<size_t>(segment_threads_); i++) {
+        if (voice_work_[i].new_transmission && i - starts.back() >= share && total - i >= min_ldus) {
+            starts.push_back(i);
+        }
+    }
+    return starts;
+}
+
+void P25Decoder::synthesize_segments(const std::vector<size_t>& starts) {
+    size_t total_samples = 0;
+    for (const auto& work : voice_work_) {
+        total_samples += work.sample_count();
+    }
+    segment_pcm_.resize(total_samples);
     
-    // Try to read existing JSON metadata from trunk-recorder
-    std::ifstream existing_json(json_filename);
-    bool has_existing_metadata = false;
-    std::string existing_content;
+    // The first segment carries on with this decoder's own vocoder; the rest
+    // get reused spares, reset so each starts like a new call
+    while (segment_synths_.size() + 1 < starts.size()) {
+        segment_synths_.push_back(VoiceSynth::create(synth_->backend()));
+        segment_synths_.back()->set_silence_skip(silence_skip_);
+    }
     
-    if (existing_json.is_open()) {
-        std::string line;
-        while (std::getline(existing_json, line)) {
-            existing_content += line + "\n";
+    struct Segment {
+        size_t begin, end, offset;
+        VoiceSynth* synth;
+        int64_t vocoder_ns;
+        int16_t last_good[SAMPLES_PER_IMBE_FRAME];
+    };
+    std::vector<Segment> segments(starts.size());
+    size_t offset = 0;
+    for (size_t s = 0; s < starts.size(); s++) {
+        Segment& segment = segments[s];
+        segment.begin = starts[s];
+        segment.end = s + 1 < starts.size() ? starts[s + 1] : voice_work_.size();
+        segment.offset = offset;
+        segment.vocoder_ns = 0;
+        if (s == 0) {
+            segment.synth = synth_.get();
+            std::copy(last_good_pcm_, last_good_pcm_ + SAMPLES_PER_IMBE_FRAME, segment.last_good);
+        } else {
+            segment.synth = segment_synths_[s - 1].get();
+            segment.synth->reset();
+            std::fill(segment.last_good, segment.last_good + SAMPLES_PER_IMBE_FRAME, 0);
+        }
+        for (size_t i = segment.begin; i < segment.end; i++) {
+            offset += voice_work_[i].sample_count();
         }
-        existing_json.close();
-        has_existing_metadata = true;
     }
     
-    if (has_existing_metadata) {
-        // Parse and enhance existing metadata
-        // Remove the closing brace and add our P25 analysis
-        size_t last_brace = existing_content.rfind("}");
-        if (last_brace != std::string::npos) {
-            std::string base_json = existing_content.substr(0, last_brace);
-            
-            // Remove trailing whitespace and comma if present
-            while (!base_json.empty() && (base_json.back() == ' ' || base_json.back() == '\n' || base_json.back() == '\t')) {
-                base_json.pop_back();
-            }
-            
-            json << base_json;
-            if (!base_json.empty() && base_json.back() != ',') {
-                json << ",\n";
-            }
-            
-            // Add our P25 frame analysis
-            json << "  \"decoder_source\": \"trunk-decoder\",\n";
-            json << "  \"input_file\": \"" << basename << "\",\n";
-            json << "  \"p25_frames\": " << metadata_.total_frames << ",\n";
-            json << "  \"voice_frames\": " << metadata_.voice_frames << ",\n";
-            json << "  \"nac\": " << metadata_.nac << ",\n";
-            json << "  \"note\": \"Enhanced with P25 frame analysis from trunk-decoder\"\n";
-            json << "}";
-        } else {
-            // Fallback if JSON parsing fails
-            has_existing_metadata = false;
+    auto run = [this](Segment& segment) {
+        int16_t* out = segment_pcm_.data() + segment.offset;
+        for (size_t i = segment.begin; i < segment.end; i++) {
+            out += render_voice(voice_work_[i], *segment.synth, segment.last_good, out, segment.vocoder_ns);
         }
+    };
+    
+    std::vector<std::thread> threads;
+    for (size_t s = 1; s < segments.size(); s++) {
+        threads.emplace_back(run, std::ref(segments[s]));
+    }
+    run(segments[0]);
+    for (auto& thread : threads) {
+        thread.join();
     }
     
-    if (!has_existing_metadata) {
-        // Check if we have external metadata to use
-        if (!external_metadata_.empty()) {
-            // Parse external metadata and merge with our decoder info
-            std::string base_json = external_metadata_;
-            
-            // Remove closing brace to add our fields
-            size_t last_brace = base_json.rfind("}");
-            if (last_brace != std::string::npos) {
-                base_json = base_json.substr(0, last_brace);
-                
-                // Remove trailing whitespace and comma if present
-                while (!base_json.empty() && (base_json.back() == ' ' || base_json.back() == '\n' || base_json.back() == '\t')) {
-                    base_json.pop_back();
-                }
-                
-                json << base_json;
-                if (!base_json.empty() && base_json.back() != ',') {
-                    json << ",\n";
-                }
-                
-                // Add decoder-specific info
-                json << "  \"decoder_source\": \"trunk-decoder\",\n";
-                json << "  \"input_file\": \"" << basename << "\",\n";
-                json << "  \"p25_frames\": " << metadata_.total_frames << ",\n";
-                json << "  \"voice_frames\": " << metadata_.voice_frames << "\n";
-                json << "}";
-            } else {
-                // Fallback if parsing fails
-                has_existing_metadata = false;
-            }
+    for (const auto& segment : segments) {
+        trace_vocoder_ns_ += segment.vocoder_ns;
+    }
+    if (segments.size() > 1) {
+        DecoderMetrics::get().segmented_calls.add();
+    }
+}
+
+void P25Decoder::write_encryption_fields(JsonWriter& json) {
+    if (!metadata_.has_encrypted_frames) {
+        return;
+    }
+    json.field("algid", static_cast<int>(metadata_.algorithm_id));
+    json.field("keyid", metadata_.key_id);
+    json.field("undecodable", metadata_.undecodable);
+    if (metadata_.skipped_frames > 0) {
+        json.field("skipped_frames", metadata_.skipped_frames);
+    }
+}
+
+void P25Decoder::write_quality_fields(JsonWriter& json) {
+    const VoiceQuality& quality = metadata_.voice_quality;
+    if (quality.codewords() == 0) {
+        return;
+    }
+    json.object_field("voice_quality");
+    json.field("codewords", quality.codewords());
+    json.field("corrected_bits", quality.corrected_bits());
+    json.field("average_errors", quality.average_errors(), 4);
+    json.field("bit_error_rate", quality.bit_error_rate(), 4);
+    json.field("bad_frames", quality.bad_frames());
+    json.field("bad_frame_rate", quality.bad_frame_rate(), 4);
+    json.field("repeats", quality.repeats());
+    json.field("mutes", quality.mutes());
+    json.field("peak_error_rate", quality.peak_error_rate(), 4);
+    json.field("error_histogram", quality.histogram(), VoiceQuality::HISTOGRAM_BINS);
+    json.end_object();
+}
+
+void P25Decoder::write_decoder_fields(JsonWriter& json, std::string_view input_file) {
+    write_encryption_fields(json);
+    write_quality_fields(json);
+    json.field("decoder_source", "trunk-decoder");
+    json.field("input_file", input_file);
+    json.field("p25_frames", metadata_.total_frames);
+    json.field("voice_frames", metadata_.voice_frames);
+    if (silence_compaction_) {
+        json.field("silence_trimmed", metadata_.silence_trimmed_samples / 8000.0, 2);
+    }
+}
+
+const std::string& P25Decoder::generate_json_metadata() {
+    json_text_.clear();
+    JsonWriter json(json_text_);
+    
+    // Check if there's a corresponding .json file - use just filename, not full path
+    std::string_view basename = input_filename_;
+    size_t last_slash = basename.find_last_of("/\\");
+    if (last_slash != std::string_view::npos) {
+        basename.remove_prefix(last_slash + 1);
+    }
+    
+    // Create JSON filename from basename
+    std::string json_filename(basename);
+    if (json_filename.size() > 4 && json_filename.compare(json_filename.size() - 4, 4, ".p25") == 0) {
+        json_filename.replace(json_filename.size() - 4, 4, ".json");
+    }
+    
+    // Existing JSON metadata from trunk-recorder, enhanced with our P25 analysis
+    std::ifstream existing_json(json_filename, std::ios::binary);
+    if (existing_json.is_open()) {
+        existing_json_.assign(std::istreambuf_iterator<char>(existing_json), std::istreambuf_iterator<char>());
+        std::string_view body;
+        if (TrunkCallMetadata::find_body(existing_json_, body)) {
+            json.splice(body);
+            write_decoder_fields(json, basename);
+            json.field("nac", metadata_.nac);
+            json.field("note", "Enhanced with P25 frame analysis from trunk-decoder");
+            json.end_object();
+            return json_text_;
         }
-        
-        if (external_metadata_.empty()) {
-            // Generate basic metadata (original behavior)
-            json << "{\n";
-            json << "  \"call_length\": " << metadata_.call_length << ",\n";
-            json << "  \"audio_type\": \"" << metadata_.audio_type << "\",\n";
-            json << "  \"nac\": " << metadata_.nac << ",\n";
-            json << "  \"encrypted\": " << (metadata_.has_encrypted_frames ? 1 : 0) << ",\n";
-            
-            // Decoder-specific info
-            json << "  \"decoder_source\": \"trunk-decoder\",\n";
-            json << "  \"input_file\": \"" << basename << "\",\n";
-            json << "  \"p25_frames\": " << metadata_.total_frames << ",\n";
-            json << "  \"voice_frames\": " << metadata_.voice_frames << "\n";
-            
-            json << "}";
+    }
+    
+    // External metadata merged with our decoder info; without a closing
+    // brace there is nothing to merge into and the output stays empty
+    if (external_metadata_ && !external_metadata_->empty()) {
+        std::string_view body;
+        if (external_metadata_->splice_body(body)) {
+            json.splice(body);
+            write_decoder_fields(json, basename);
+            json.end_object();
         }
+        return json_text_;
     }
     
-    return json.str();
+    // Generate basic metadata (original behavior)
+    json.begin_object();
+    json.field("call_length", metadata_.call_length, 2);
+    json.field("audio_type", metadata_.audio_type);
+    json.field("nac", metadata_.nac);
+    json.field("encrypted", metadata_.has_encrypted_frames ? 1 : 0);
+    write_decoder_fields(json, basename);
+    json.end_object();
+    return json_text_;
 }
 
 bool P25Decoder::decode_to_audio(const std::string& output_prefix) {
+    return decode_to_outputs(output_prefix, DecodeOutputs());
+}
+
+bool P25Decoder::decode_to_outputs(const std::string& output_prefix, const DecodeOutputs& outputs) {
     if (!parser_) {
-        std::cerr << "Error: No P25 file opened" << std::endl;
+        LOG_ERROR("Error: No P25 file opened");
         return false;
     }
     
     output_prefix_ = output_prefix;
     
+    // Voice time in 8 kHz samples; a range keeps [range_start, range_end)
+    const bool audio = outputs.wav || outputs.pcm;
+    const bool ranged = outputs.ranged();
+    const uint64_t range_start = static_cast<uint64_t>(std::max(0.0, outputs.start_s) * 8000.0);
+    const uint64_t range_end = outputs.end_s > 0.0 ? static_cast<uint64_t>(outputs.end_s * 8000.0) : UINT64_MAX;
+    if (ranged && range_end <= range_start) {
+        LOG_ERROR("Error: Empty time range " << outputs.start_s << "-" << outputs.end_s);
+        return false;
+    }
+    
+    // Filter history and AGC level start over with each call
+    if (resampler_) {
+        resampler_->reset();
+    }
+    if (gain_) {
+        gain_->reset();
+    }
+    
     // Setup WAV audio output
-    if (!setup_wav_output(output_prefix)) {
+    const uint64_t max_voice_samples = range_end - range_start;
+    if (outputs.wav && !setup_wav_output(output_prefix, max_voice_samples)) {
         return false;
     }
+    if (outputs.pcm && !outputs.wav) {
+        reserve_audio_buffer(max_voice_samples);
+    }
+    
+    // CSV rows need nothing from the end of the file, so stream them directly
+    std::ofstream csv_file;
+    DumpBuffer csv_out(&csv_file);
+    if (outputs.csv) {
+        csv_file.open(output_prefix + ".csv");
+        if (!csv_file.is_open()) {
+            LOG_ERROR("Error: Failed to open CSV file for writing: " << output_prefix << ".csv");
+        } else {
+            write_csv_header(csv_out);
+        }
+    }
+    
+    // The text dump header carries call totals, so frames are collected first
+    DumpBuffer text_body;
     
     // Only show these messages in verbose mode now
     // std::cout << "Decoding P25 file: " << input_filename_ << std::endl;
@@ -377,78 +823,214 @@ bool P25Decoder::decode_to_audio(const std::string& output_prefix) {
     
     P25Frame frame;
     int frame_count = 0;
+    uint64_t voice_sample = 0;
+    int16_t audio_samples[SAMPLES_PER_LDU];
+    int64_t decode_start_ns = trace_id_ ? Tracer::now_ns() : 0;
+    int64_t vocoder_start_ns = trace_vocoder_ns_;
+    
+    // Long calls can only be told apart once parsed, so with segmenting on
+    // every call's voice is prepared first and synthesised after the loop
+    const bool segmenting = audio && segment_threads_ > 1 && !ranged;
+    // The archive gets the same prepared voice
+    const bool archiving = outputs.imbe && !ranged;
+    bool transmission_ended = false;
+    voice_work_.clear();
+    
+    // A range starts at the nearest LDU (less the priming ones); without
+    // an index, for a pipe, everything in front is decoded and dropped
+    if (ranged) {
+        seek_to_sample(range_start, frame_count, voice_sample);
+    }
     
-    while (parser_->read_frame(frame)) {
-        frame_count++;
-        metadata_.total_frames++;
-        
-        // Update metadata from first frame
-        if (frame_count == 1) {
-            metadata_.nac = frame.nac;
+    // A complete pass over a file leaves an index behind when enabled
+    const bool index_pass = frame_index_enabled_ && !ranged && !input_buffer_ && !input_filename_.empty();
+    bool index_complete = index_pass;
+    if (index_pass) {
+        frame_index_.clear();
+    }
+    
+    const bool has_deadline = deadline_ != std::chrono::steady_clock::time_point::max();
+    timed_out_ = false;
+    
+    while (true) {
+        if (has_deadline && frame_count % DEADLINE_CHECK_FRAMES == 0 &&
+            std::chrono::steady_clock::now() >= deadline_) {
+            timed_out_ = true;
+            break;
         }
-        
-        // Check for encrypted frames
-        if (frame.is_encrypted) {
-            metadata_.has_encrypted_frames = true;
+        int64_t parse_start_ns = trace_id_ ? Tracer::now_ns() : 0;
+        int64_t frame_offset = index_complete ? parser_->position() : 0;
+        if (!parser_->read_frame(frame)) {
+            break;
+        }
+        if (index_complete) {
+            index_complete = frame_offset >= 0 && frame_index_.add(static_cast<uint64_t>(frame_offset), frame.duid);
+        }
+        if (trace_id_) {
+            trace_parse_ns_ += Tracer::now_ns() - parse_start_ns;
         }
+        frame_count++;
+        count_frame(frame);
         
         // Print frame info if text dump is enabled
-        if (text_dump_enabled_) {
-            std::cout << "Frame " << frame_count << ":\n";
-            std::cout << parser_->dump_frame_text(frame);
+        if (text_dump_enabled_ || outputs.text) {
+            size_t frame_start = text_body.size();
+            text_body.text("Frame ").dec(frame_count).text(":\n");
+            parser_->append_frame_text(frame, text_body);
+            if (text_dump_enabled_) {
+                LOG_INFO(text_body.view(frame_start));
+            }
+            if (outputs.text) {
+                text_body.text("----------------------------------------\n");
+            } else {
+                text_body.clear();
+            }
+        }
+        
+        if (csv_file.is_open()) {
+            write_csv_row(csv_out, frame_count, frame);
+            csv_out.flush_if_full();
         }
         
         // Process voice frames
-        if (frame.is_voice_frame) {
-            metadata_.voice_frames++;
-            
-            std::vector<int16_t> audio_samples;
-            if (decode_voice_frame(frame, audio_samples)) {
-                write_audio_samples(audio_samples);
-                
-                // Accumulate audio buffer for later processing if needed
-                audio_buffer_.insert(audio_buffer_.end(), 
-                                   audio_samples.begin(), audio_samples.end());
+        if (frame.is_voice_frame && (segmenting || (archiving && !audio))) {
+            voice_work_.emplace_back();
+            prepare_voice_frame(frame, voice_work_.back());
+            voice_work_.back().new_transmission = transmission_ended;
+            transmission_ended = false;
+        } else if (frame.is_voice_frame) {
+            if (audio) {
+                VoiceWork work;
+                prepare_voice_frame(frame, work);
+                if (archiving) {
+                    work.new_transmission = transmission_ended;
+                    transmission_ended = false;
+                    voice_work_.push_back(work);
+                }
+                size_t sample_count = render_voice(work, *synth_, last_good_pcm_, audio_samples, trace_vocoder_ns_);
+                // Priming LDUs and the parts of edge LDUs outside a range are dropped
+                emit_voice(audio_samples, sample_count, voice_sample, range_start, range_end);
             }
+            voice_sample += SAMPLES_PER_LDU;
+        }
+        
+        if (p25_duid_is_boundary(frame.duid)) {
+            transmission_ended = true;
         }
         
         if (text_dump_enabled_) {
-            std::cout << "----------------------------------------\n";
+            LOG_INFO("----------------------------------------");
         }
+        
+        if (ranged && voice_sample >= range_end) {
+            break;
+        }
+    }
+    
+    // Segmented synthesis is the rest of the work; skip it if already late
+    if (!timed_out_ && has_deadline && segmenting && std::chrono::steady_clock::now() >= deadline_) {
+        timed_out_ = true;
+    }
+    if (timed_out_) {
+        if (outputs.wav) {
+            wav_writer_.close();
+            std::remove((output_prefix + ".wav").c_str());
+        }
+        LOG_ERROR("Error: Decode of " << (input_filename_.empty() ? std::string("buffer") : input_filename_)
+                  << " timed out after " << frame_count << " frames");
+        return false;
+    }
+    
+    if (index_complete && !frame_index_.save(FrameIndex::path_for(input_filename_), input_filename_)) {
+        LOG_WARN("Warning: Could not write frame index " << FrameIndex::path_for(input_filename_));
+    }
+    
+    if (segmenting) {
+        synthesize_segments(plan_segments());
+        // Gain, publishing and resampling run over the stitched call in
+        // frame order, exactly as they would have during the loop
+        const int16_t* pcm = segment_pcm_.data();
+        for (const auto& work : voice_work_) {
+            size_t sample_count = work.sample_count();
+            std::copy(pcm, pcm + sample_count, audio_samples);
+            pcm += sample_count;
+            emit_voice(audio_samples, sample_count, 0, 0, UINT64_MAX);
+        }
+    }
+    
+    if (trace_id_) {
+        Tracer& tracer = Tracer::instance();
+        tracer.record(trace_id_, "frame_parse", decode_start_ns, trace_parse_ns_);
+        tracer.record(trace_id_, "vocoder", decode_start_ns, trace_vocoder_ns_ - vocoder_start_ns);
+    }
+    
+    // The resampler still holds its filter delay's worth of the call
+    if (audio && resampler_) {
+        resampled_.clear();
+        resampler_->flush(resampled_);
+        audio_buffer_.insert(audio_buffer_.end(), resampled_.begin(), resampled_.end());
     }
     
     // Finalize metadata
     metadata_.end_time = time(nullptr);
-    metadata_.call_length = audio_buffer_.size() / 8000.0; // Duration in seconds at 8kHz
+    if (ranged) {
+        // Air time of the range itself, skipped LDUs included
+        uint64_t range_stop = std::min(voice_sample, range_end);
+        metadata_.call_length = range_stop > range_start ? (range_stop - range_start) / 8000.0 : 0.0;
+    } else if (audio) {
+        metadata_.call_length = audio_buffer_.size() / static_cast<double>(output_sample_rate_);
+        metadata_.call_length += metadata_.skipped_frames * (SAMPLES_PER_LDU / 8000.0);
+        metadata_.call_length += metadata_.silence_trimmed_samples / 8000.0;
+    } else {
+        metadata_.call_length = metadata_.voice_frames * 0.18; // Approximation: 180ms per voice frame
+    }
     
-    // Close audio file
-    close_audio_output();
+    if (csv_file.is_open()) {
+        csv_out.flush();
+        csv_file.close();
+        if (text_dump_enabled_) {
+            LOG_INFO("Wrote CSV dump to: " << output_prefix << ".csv");
+        }
+    }
     
-    // Convert to modern format if requested
-    if (audio_format_ != "wav") {
-        std::string wav_file = output_prefix + ".wav";
-        std::string extension;
-        if (audio_format_ == "mp3") extension = "mp3";
-        else if (audio_format_ == "m4a") extension = "m4a";
-        else if (audio_format_ == "opus") extension = "opus";
-        else if (audio_format_ == "webm") extension = "webm";
-        
-        std::string final_audio_file = output_prefix + "." + extension;
-        
-        if (convert_to_modern_format(wav_file, final_audio_file)) {
-            // Keep WAV file - don't remove it, users may want both formats
-            // std::remove(wav_file.c_str()); // Commented out - preserve WAV
+    if (outputs.text) {
+        std::string text_filename = output_prefix + ".txt";
+        std::ofstream text_file(text_filename);
+        if (!text_file.is_open()) {
+            LOG_ERROR("Error: Failed to open text file for writing: " << text_filename);
+        } else {
+            write_text_dump_header(text_file);
+            text_file.write(text_body.str().data(), static_cast<std::streamsize>(text_body.size()));
+            text_file.close();
+            if (text_dump_enabled_) {
+                LOG_INFO("Wrote text dump to: " << text_filename);
+            }
         }
     }
     
+    if (outputs.wav) {
+        finish_audio_file(output_prefix);
+    }
+    
     // Write JSON metadata
-    std::string json_filename = output_prefix + ".json";
-    std::ofstream json_file(json_filename);
-    if (json_file.is_open()) {
-        json_file << generate_json_metadata();
-        json_file.close();
-        if (text_dump_enabled_) {
-            std::cout << "Wrote metadata to: " << json_filename << std::endl;
+    if (outputs.json) {
+        std::string json_filename = output_prefix + ".json";
+        std::ofstream json_file(json_filename);
+        if (json_file.is_open()) {
+            json_file << generate_json_metadata();
+            json_file.close();
+            if (text_dump_enabled_) {
+                LOG_INFO("Wrote metadata to: " << json_filename);
+            }
+        }
+    }
+    
+    if (archiving) {
+        std::string archive_filename = output_prefix + ".imbe";
+        if (!ImbeArchive::write(archive_filename, voice_work_, generate_json_metadata())) {
+            LOG_ERROR("Error: Failed to write IMBE archive: " << archive_filename);
+        } else if (text_dump_enabled_) {
+            LOG_INFO("Wrote IMBE archive to: " << archive_filename);
         }
     }
     
@@ -457,20 +1039,210 @@ bool P25Decoder::decode_to_audio(const std::string& output_prefix) {
     return true;
 }
 
+bool P25Decoder::synthesize_archive(const std::string& archive_file, const std::string& output_prefix,
+                                    const DecodeOutputs& outputs) {
+    ImbeArchive archive;
+    if (!archive.open(archive_file)) {
+        LOG_ERROR("Error: Not a readable IMBE archive: " << archive_file);
+        return false;
+    }
+    
+    const bool audio = outputs.wav || outputs.pcm;
+    const bool ranged = outputs.ranged();
+    const uint64_t range_start = static_cast<uint64_t>(std::max(0.0, outputs.start_s) * 8000.0);
+    const uint64_t range_end = outputs.end_s > 0.0 ? static_cast<uint64_t>(outputs.end_s * 8000.0) : UINT64_MAX;
+    if (ranged && range_end <= range_start) {
+        LOG_ERROR("Error: Empty time range " << outputs.start_s << "-" << outputs.end_s);
+        return false;
+    }
+    
+    // The archive is a whole call: vocoder, gain and buffers start over
+    // just as for a newly opened file
+    reset();
+    output_prefix_ = output_prefix;
+    
+    // Record i is the LDU at 1440 * i samples, so a range reads only its
+    // own records and the priming ones in front
+    const uint64_t first_ldu = range_start / SAMPLES_PER_LDU;
+    size_t first = first_ldu > RANGE_PRIME_LDUS ? static_cast<size_t>(first_ldu - RANGE_PRIME_LDUS) : 0;
+    size_t last = archive.size();
+    if (range_end != UINT64_MAX) {
+        last = std::min<uint64_t>(last, (range_end + SAMPLES_PER_LDU - 1) / SAMPLES_PER_LDU);
+    }
+    first = std::min(first, last);
+    voice_work_.resize(last - first);
+    uint64_t voice_samples = 0;
+    for (size_t i = first; i < last; i++) {
+        archive.read(i, voice_work_[i - first]);
+        voice_samples += voice_work_[i - first].sample_count();
+    }
+    metadata_.voice_frames = static_cast<int>(archive.size());
+    
+    if (outputs.wav && !setup_wav_output(output_prefix, voice_samples)) {
+        return false;
+    }
+    if (outputs.pcm && !outputs.wav) {
+        reserve_audio_buffer(voice_samples);
+    }
+    
+    if (audio) {
+        // A range is short enough that splitting it would only cost history
+        synthesize_segments(ranged ? std::vector<size_t>{0} : plan_segments());
+        const int16_t* pcm = segment_pcm_.data();
+        uint64_t voice_sample = static_cast<uint64_t>(first) * SAMPLES_PER_LDU;
+        int16_t audio_samples[SAMPLES_PER_LDU];
+        for (const auto& work : voice_work_) {
+            size_t sample_count = work.sample_count();
+            std::copy(pcm, pcm + sample_count, audio_samples);
+            pcm += sample_count;
+            emit_voice(audio_samples, sample_count, voice_sample, range_start, range_end);
+            voice_sample += SAMPLES_PER_LDU;
+        }
+        if (resampler_) {
+            resampled_.clear();
+            resampler_->flush(resampled_);
+            audio_buffer_.insert(audio_buffer_.end(), resampled_.begin(), resampled_.end());
+        }
+    }
+    
+    uint64_t total_samples = static_cast<uint64_t>(archive.size()) * SAMPLES_PER_LDU;
+    uint64_t range_stop = std::min(total_samples, range_end);
+    metadata_.call_length = range_stop > range_start ? (range_stop - range_start) / 8000.0 : 0.0;
+    metadata_.end_time = time(nullptr);
+    
+    if (outputs.wav) {
+        finish_audio_file(output_prefix);
+    }
+    
+    if (outputs.json) {
+        std::string json_filename = output_prefix + ".json";
+        std::ofstream json_file(json_filename);
+        if (json_file.is_open()) {
+            json_file << archive.metadata_json();
+            json_file.close();
+            if (text_dump_enabled_) {
+                LOG_INFO("Wrote metadata to: " << json_filename);
+            }
+        }
+    }
+    
+    return true;
+}
+
 void P25Decoder::set_output_sample_rate(int rate) {
-    // For P25, output is always 8kHz
-    if (rate != 8000) {
-        std::cout << "Warning: P25 audio is always 8kHz, ignoring requested rate " << rate << std::endl;
+    if (rate == output_sample_rate_) {
+        return;
+    }
+    if (rate < 8000 || rate > 192000) {
+        LOG_WARN("Warning: Unsupported output sample rate " << rate << ", keeping "
+                 << output_sample_rate_);
+        return;
+    }
+    output_sample_rate_ = rate;
+    if (rate == 8000) {
+        resampler_.reset();
+    } else {
+        resampler_.reset(new Resampler(8000, rate));
+    }
+}
+
+void P25Decoder::set_audio_gain(const AudioGain::Settings& settings) {
+    if (!settings.active()) {
+        gain_.reset();
+        return;
+    }
+    gain_.reset(new AudioGain(settings, 8000));
+}
+
+void P25Decoder::emit_audio(const int16_t* samples, size_t count) {
+    if (!resampler_) {
+        audio_buffer_.insert(audio_buffer_.end(), samples, samples + count);
+        return;
+    }
+    resampled_.clear();
+    resampler_->process(samples, count, resampled_);
+    audio_buffer_.insert(audio_buffer_.end(), resampled_.begin(), resampled_.end());
+}
+
+void P25Decoder::emit_voice(int16_t* samples, size_t count, uint64_t voice_sample,
+                            uint64_t range_start, uint64_t range_end) {
+    if (gain_ && count > 0) {
+        gain_->process(samples, count);
+    }
+    size_t first = std::min<uint64_t>(count, range_start > voice_sample ? range_start - voice_sample : 0);
+    size_t last = std::min<uint64_t>(count, range_end - voice_sample);
+    if (first >= last) {
+        return;
+    }
+    if (pcm_publisher_) {
+        pcm_publisher_->publish(samples + first, last - first);
+    }
+    size_t kept = silence_compaction_ ? compact_silence(samples + first, last - first) : last - first;
+    emit_audio(samples + first, kept);
+}
+
+size_t P25Decoder::compact_silence(int16_t* samples, size_t count) {
+    size_t kept = 0;
+    for (size_t frame = 0; frame < count; frame += SAMPLES_PER_IMBE_FRAME) {
+        size_t length = std::min<size_t>(SAMPLES_PER_IMBE_FRAME, count - frame);
+        const int16_t* begin = samples + frame;
+        bool silent = std::all_of(begin, begin + length, [](int16_t sample) { return sample == 0; });
+        if (!silent) {
+            silence_run_frames_ = 0;
+        } else if (++silence_run_frames_ > silence_keep_frames_) {
+            metadata_.silence_trimmed_samples += length;
+            continue;
+        }
+        if (kept != frame) {
+            std::copy(begin, begin + length, samples + kept);
+        }
+        kept += length;
+    }
+    return kept;
+}
+
+void P25Decoder::finish_audio_file(const std::string& output_prefix) {
+    // Nothing in the call could be decrypted: keep the metadata only
+    bool drop_audio = undecodable_metadata_only_ && metadata_.undecodable;
+    if (drop_audio) {
+        wav_writer_.close();
+        std::remove((output_prefix + ".wav").c_str());
+        audio_buffer_.clear();
+        if (text_dump_enabled_) {
+            LOG_INFO("Encrypted without a key, no audio written for: " << output_prefix);
+        }
+    }
+    
+    // Header and PCM in a single write
+    close_audio_output();
+    
+    // Convert to modern format if requested
+    if (audio_format_ != "wav" && !drop_audio) {
+        std::string extension;
+        if (audio_format_ == "flac") extension = "flac";
+        else if (audio_format_ == "mp3") extension = "mp3";
+        else if (audio_format_ == "m4a") extension = "m4a";
+        else if (audio_format_ == "opus") extension = "opus";
+        else if (audio_format_ == "webm") extension = "webm";
+        
+        std::string final_audio_file = output_prefix + "." + extension;
+        
+        bool encoded = encode_audio(audio_format_, audio_bitrate_, final_audio_file);
+        if (!encoded && text_dump_enabled_) {
+            LOG_WARN("Warning: No encoder available for format: " << audio_format_);
+        }
+        // Keep WAV file - don't remove it, users may want both formats
     }
 }
 
 void P25Decoder::enable_text_dump(bool enable) {
-    text_dump_enabled_ = enable;
+    // Nothing is formatted for a dump the log level would throw away
+    text_dump_enabled_ = enable && Logger::instance().enabled(Logger::LEVEL_INFO);
 }
 
 bool P25Decoder::process_frames_only() {
     if (!parser_) {
-        std::cerr << "Error: No P25 file opened" << std::endl;
+        LOG_ERROR("Error: No P25 file opened");
         return false;
     }
     
@@ -479,31 +1251,12 @@ bool P25Decoder::process_frames_only() {
     
     while (parser_->read_frame(frame)) {
         frame_count++;
-        metadata_.total_frames++;
-        
-        // Update metadata from first frame
-        if (frame_count == 1) {
-            metadata_.nac = frame.nac;
-        }
-        
-        // Check for encrypted frames
-        if (frame.is_encrypted) {
-            metadata_.has_encrypted_frames = true;
-        }
+        count_frame(frame);
         
         // Print frame info if text dump is enabled
         if (text_dump_enabled_) {
-            std::cout << "Frame " << frame_count << ":\n";
-            std::cout << parser_->dump_frame_text(frame);
-        }
-        
-        // Process voice frames (for metadata only, no audio output)
-        if (frame.is_voice_frame) {
-            metadata_.voice_frames++;
-        }
-        
-        if (text_dump_enabled_) {
-            std::cout << "----------------------------------------\n";
+            LOG_INFO("Frame " << frame_count << ":\n" << parser_->dump_frame_text(frame)
+                     << "----------------------------------------");
         }
     }
     
@@ -519,7 +1272,7 @@ bool P25Decoder::process_frames_only() {
 bool P25Decoder::save_json_metadata(const std::string& filename) {
     std::ofstream json_file(filename);
     if (!json_file.is_open()) {
-        std::cerr << "Error: Failed to open JSON file for writing: " << filename << std::endl;
+        LOG_ERROR("Error: Failed to open JSON file for writing: " << filename);
         return false;
     }
     
@@ -527,7 +1280,7 @@ bool P25Decoder::save_json_metadata(const std::string& filename) {
     json_file.close();
     
     if (text_dump_enabled_) {
-        std::cout << "Wrote JSON metadata to: " << filename << std::endl;
+        LOG_INFO("Wrote JSON metadata to: " << filename);
     }
     
     return true;
@@ -535,50 +1288,45 @@ bool P25Decoder::save_json_metadata(const std::string& filename) {
 
 bool P25Decoder::save_text_dump(const std::string& filename) {
     if (!parser_) {
-        std::cerr << "Error: No P25 file opened" << std::endl;
+        LOG_ERROR("Error: No P25 file opened");
         return false;
     }
     
     std::ofstream text_file(filename);
     if (!text_file.is_open()) {
-        std::cerr << "Error: Failed to open text file for writing: " << filename << std::endl;
+        LOG_ERROR("Error: Failed to open text file for writing: " << filename);
         return false;
     }
     
     // Write header information
-    text_file << "P25 Frame Analysis Report\n";
-    text_file << "=========================\n\n";
-    text_file << "Input file: " << input_filename_ << "\n";
-    text_file << "Total frames: " << metadata_.total_frames << "\n";
-    text_file << "Voice frames: " << metadata_.voice_frames << "\n";
-    text_file << "NAC: 0x" << std::hex << metadata_.nac << std::dec << " (" << metadata_.nac << ")\n";
-    text_file << "Duration: ~" << metadata_.call_length << " seconds\n";
-    text_file << "\n";
+    write_text_dump_header(text_file);
     
     // Re-process file to generate text dump
     // Reset parser to beginning of file
-    parser_.reset(new P25FrameParser());
-    if (!parser_->open(input_filename_)) {
+    if (!reopen_input()) {
         text_file.close();
-        std::cerr << "Error: Failed to reopen P25 file for text dump: " << input_filename_ << std::endl;
+        LOG_ERROR("Error: Failed to reopen P25 file for text dump: " << input_filename_);
         return false;
     }
     
     P25Frame frame;
     int frame_count = 0;
+    DumpBuffer out(&text_file);
     
     while (parser_->read_frame(frame)) {
         frame_count++;
         
-        text_file << "Frame " << frame_count << ":\n";
-        text_file << parser_->dump_frame_text(frame);
-        text_file << "----------------------------------------\n";
+        out.text("Frame ").dec(frame_count).text(":\n");
+        parser_->append_frame_text(frame, out);
+        out.text("----------------------------------------\n");
+        out.flush_if_full();
     }
     
+    out.flush();
     text_file.close();
     
     if (text_dump_enabled_) {
-        std::cout << "Wrote text dump to: " << filename << std::endl;
+        LOG_INFO("Wrote text dump to: " << filename);
     }
     
     return true;
@@ -586,25 +1334,26 @@ bool P25Decoder::save_text_dump(const std::string& filename) {
 
 bool P25Decoder::save_csv_dump(const std::string& filename) {
     if (!parser_) {
-        std::cerr << "Error: No P25 file opened" << std::endl;
+        LOG_ERROR("Error: No P25 file opened");
         return false;
     }
     
     std::ofstream csv_file(filename);
     if (!csv_file.is_open()) {
-        std::cerr << "Error: Failed to open CSV file for writing: " << filename << std::endl;
+        LOG_ERROR("Error: Failed to open CSV file for writing: " << filename);
         return false;
     }
     
     // Write CSV header
-    csv_file << "Frame,DUID,DUID_Name,NAC,Length_Bytes,Is_Voice_Frame,Is_Encrypted,Emergency_Flag,Talk_Group,Source_ID,Algorithm_ID,Key_ID,Data_Size,Frame_Data_Hex\n";
+    DumpBuffer out(&csv_file);
+    write_csv_header(out);
+    out.flush();
     
     // Re-process file to generate CSV data
     // Reset parser to beginning of file
-    parser_.reset(new P25FrameParser());
-    if (!parser_->open(input_filename_)) {
+    if (!reopen_input()) {
         csv_file.close();
-        std::cerr << "Error: Failed to reopen P25 file for CSV dump: " << input_filename_ << std::endl;
+        LOG_ERROR("Error: Failed to reopen P25 file for CSV dump: " << input_filename_);
         return false;
     }
     
@@ -619,45 +1368,69 @@ bool P25Decoder::save_csv_dump(const std::string& filename) {
             metadata_.has_encrypted_frames = true;
         }
         
-        // Populate missing frame metadata from call metadata
-        frame.talk_group = (metadata_.talkgroup > 0) ? (uint16_t)metadata_.talkgroup : 0;
-        frame.source_id = (metadata_.source_id > 0) ? (uint32_t)metadata_.source_id : 0;
-        
-        // Format frame data as CSV
-        csv_file << frame_count << ",";
-        csv_file << "0x" << std::hex << std::setw(2) << std::setfill('0') << (int)frame.duid << ",";
-        csv_file << "\"" << frame.frame_type_name << "\",";
-        csv_file << "0x" << std::hex << frame.nac << ",";
-        csv_file << std::dec << frame.length << ",";
-        csv_file << (frame.is_voice_frame ? "YES" : "NO") << ",";
-        csv_file << (frame.is_encrypted ? "YES" : "NO") << ",";
-        csv_file << (frame.emergency_flag ? "YES" : "NO") << ",";
-        csv_file << frame.talk_group << ",";
-        csv_file << frame.source_id << ",";
-        csv_file << "0x" << std::hex << std::setw(2) << std::setfill('0') << (int)frame.algorithm_id << ",";
-        csv_file << frame.key_id << ",";
-        csv_file << std::dec << frame.data.size() << ",";
-        
-        // Add hex dump of frame data
-        csv_file << "\"";
-        for (size_t i = 0; i < frame.data.size(); i++) {
-            csv_file << std::hex << std::setw(2) << std::setfill('0') << (int)frame.data[i];
-            if (i < frame.data.size() - 1) {
-                csv_file << " ";
-            }
-        }
-        csv_file << "\"\n";
+        write_csv_row(out, frame_count, frame);
+        out.flush_if_full();
     }
     
+    out.flush();
     csv_file.close();
     
     if (text_dump_enabled_) {
-        std::cout << "Wrote CSV dump to: " << filename << std::endl;
+        LOG_INFO("Wrote CSV dump to: " << filename);
     }
     
     return true;
 }
 
+void P25Decoder::write_text_dump_header(std::ostream& out) {
+    out << "P25 Frame Analysis Report\n";
+    out << "=========================\n\n";
+    out << "Input file: " << input_filename_ << "\n";
+    out << "Total frames: " << metadata_.total_frames << "\n";
+    out << "Voice frames: " << metadata_.voice_frames << "\n";
+    out << "NAC: 0x" << std::hex << metadata_.nac << std::dec << " (" << metadata_.nac << ")\n";
+    out << "Duration: ~" << metadata_.call_length << " seconds\n";
+    out << "\n";
+}
+
+void P25Decoder::write_csv_header(DumpBuffer& out) {
+    out.text("Frame,DUID,DUID_Name,NAC,Length_Bytes,Is_Voice_Frame,Is_Encrypted,Emergency_Flag,Talk_Group,Source_ID,Algorithm_ID,Key_ID,Data_Size,Frame_Data_Hex\n");
+    csv_frame_hex_ = false;
+}
+
+void P25Decoder::write_csv_row(DumpBuffer& out, int frame_count, const P25Frame& frame) {
+    // Populate missing frame metadata from call metadata
+    uint16_t talk_group = (metadata_.talkgroup > 0) ? (uint16_t)metadata_.talkgroup : 0;
+    uint32_t source_id = (metadata_.source_id > 0) ? (uint32_t)metadata_.source_id : 0;
+    
+    // Format frame data as CSV. Frame and Key_ID are in hex where the
+    // original ostream writer left std::hex set; existing exports are
+    // compared byte for byte, so that is kept.
+    if (csv_frame_hex_) {
+        out.hex(frame_count);
+    } else {
+        out.dec(frame_count);
+    }
+    out.text(",0x").hex(frame.duid, 2).ch(',');
+    out.ch('"').text(frame.frame_type_name).text("\",");
+    out.text("0x").hex(frame.nac).ch(',');
+    out.dec(frame.length).ch(',');
+    out.text(frame.is_voice_frame ? "YES," : "NO,");
+    out.text(frame.is_encrypted ? "YES," : "NO,");
+    out.text(frame.emergency_flag ? "YES," : "NO,");
+    out.dec(talk_group).ch(',');
+    out.dec(source_id).ch(',');
+    out.text("0x").hex(frame.algorithm_id, 2).ch(',');
+    out.hex(frame.key_id).ch(',');
+    const uint8_t* payload = frame.payload();
+    size_t payload_size = frame.payload_size();
+    out.dec(payload_size).ch(',');
+    
+    // Add hex dump of frame data
+    out.ch('"').hex_bytes(payload, payload_size, ' ', true).text("\"\n");
+    csv_frame_hex_ = payload_size > 0;
+}
+
 bool P25Decoder::add_des_key(uint16_t keyid, const std::vector<uint8_t>& key) {
     if (des_decrypt_) {
         return des_decrypt_->add_key(keyid, key);
@@ -683,11 +1456,122 @@ void P25Decoder::enable_decryption(bool enable) {
     decryption_enabled_ = enable;
 }
 
+void P25Decoder::set_frame_concealment(bool enable, int max_repeats) {
+    conceal_frames_ = enable;
+    conceal_max_repeats_ = max_repeats >= 0 ? max_repeats : VoiceQuality::DEFAULT_MAX_REPEATS;
+}
+
+void P25Decoder::set_vocoder(VoiceSynth::Backend backend) {
+    if (!synth_ || synth_->backend() != backend) {
+        synth_ = VoiceSynth::create(backend);
+        synth_->set_silence_skip(silence_skip_);
+    }
+}
+
+void P25Decoder::set_silence_skip(bool enable) {
+    silence_skip_ = enable;
+    synth_->set_silence_skip(enable);
+    for (auto& synth : segment_synths_) {
+        synth->set_silence_skip(enable);
+    }
+}
+
+void P25Decoder::set_silence_compaction(bool enable, int keep_ms) {
+    silence_compaction_ = enable;
+    silence_keep_frames_ = std::max(0, keep_ms) * 8 / SAMPLES_PER_IMBE_FRAME;
+}
+
+void P25Decoder::set_segment_parallelism(int threads, int min_segment_ldus) {
+    segment_threads_ = std::max(1, threads);
+    min_segment_ldus_ = std::max(1, min_segment_ldus);
+}
+
+void P25Decoder::set_skip_undecodable(bool skip, bool metadata_only) {
+    skip_undecodable_ = skip;
+    undecodable_metadata_only_ = skip && metadata_only;
+}
+
+bool P25Decoder::has_key(uint8_t algorithm_id, uint16_t keyid) {
+    switch (algorithm_id) {
+        case 0x81: return des_decrypt_->has_key(keyid) || shared_keys().des.count(keyid) > 0;
+        case 0x84: return aes_decrypt_->has_key(keyid) || shared_keys().aes.count(keyid) > 0;
+        case 0xAA: return adp_decrypt_->has_key(keyid) || shared_keys().adp.count(keyid) > 0;
+        default: return false;
+    }
+}
+
+const KeySet& P25Decoder::shared_keys() {
+    KeyStore& store = KeyStore::instance();
+    uint64_t generation = store.generation();
+    if (generation != shared_keys_generation_ || !shared_keys_) {
+        shared_keys_ = store.snapshot();
+        shared_keys_generation_ = generation;
+    }
+    return *shared_keys_;
+}
+
+bool P25Decoder::prepare_decryption(uint8_t algorithm_id, uint16_t keyid, const uint8_t mi[9]) {
+    switch (algorithm_id) {
+        case 0x81: {
+            if (des_decrypt_->prepare(keyid, mi)) {
+                return true;
+            }
+            const auto& keys = shared_keys().des;
+            auto it = keys.find(keyid);
+            if (it == keys.end()) {
+                return false;
+            }
+            des_decrypt_->prepare(it->second, mi);
+            return true;
+        }
+        case 0x84: {
+            if (aes_decrypt_->prepare(keyid, mi)) {
+                return true;
+            }
+            const auto& keys = shared_keys().aes;
+            auto it = keys.find(keyid);
+            if (it == keys.end()) {
+                return false;
+            }
+            aes_decrypt_->prepare(it->second, mi);
+            return true;
+        }
+        case 0xAA: {
+            if (adp_decrypt_->prepare(keyid, mi)) {
+                return true;
+            }
+            const auto& keys = shared_keys().adp;
+            auto it = keys.find(keyid);
+            if (it == keys.end()) {
+                return false;
+            }
+            adp_decrypt_->prepare(it->second, mi);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool P25Decoder::decrypt_superframe(uint8_t algorithm_id, uint8_t codewords[P25_SUPERFRAME_BYTES]) {
+    switch (algorithm_id) {
+        case 0x81: return des_decrypt_->decrypt_superframe(codewords);
+        case 0x84: return aes_decrypt_->decrypt_superframe(codewords);
+        case 0xAA: return adp_decrypt_->decrypt_superframe(codewords);
+        default: return false;
+    }
+}
+
 void P25Decoder::set_external_metadata(const std::string& json_metadata) {
     if (json_metadata.empty()) return;
     
     // Store the external metadata to merge with our decoder metadata
-    external_metadata_ = json_metadata;
+    external_metadata_ = TrunkCallMetadata::parse(json_metadata);
+}
+
+void P25Decoder::set_external_metadata(std::shared_ptr<const TrunkCallMetadata> call_metadata) {
+    if (!call_metadata || call_metadata->empty()) return;
+    external_metadata_ = std::move(call_metadata);
 }
 
 void P25Decoder::set_audio_format(const std::string& format) {
@@ -698,36 +1582,24 @@ void P25Decoder::set_audio_bitrate(int bitrate) {
     audio_bitrate_ = bitrate;
 }
 
-bool P25Decoder::convert_to_modern_format(const std::string& wav_file, const std::string& output_file) {
-    std::string command;
-    
-    // Determine bitrate - use configured value or format defaults
-    int bitrate = audio_bitrate_;
-    if (bitrate == 0) { // Auto-select based on format
-        if (audio_format_ == "mp3" || audio_format_ == "m4a") bitrate = 64;
-        else if (audio_format_ == "opus" || audio_format_ == "webm") bitrate = 32;
-    }
-    
-    // Base command with mono forced and sample rate
-    std::string base_opts = " -ac 1 -ar 8000";
-    std::string bitrate_str = std::to_string(bitrate) + "k";
-    
-    if (audio_format_ == "mp3") {
-        // MP3 - legacy compatibility, good browser support
-        command = "ffmpeg -i \"" + wav_file + "\"" + base_opts + " -c:a libmp3lame -b:a " + bitrate_str + " \"" + output_file + "\" 2>/dev/null";
-    } else if (audio_format_ == "m4a") {
-        // AAC in M4A container - web optimized, good quality/size balance
-        command = "ffmpeg -i \"" + wav_file + "\"" + base_opts + " -c:a aac -b:a " + bitrate_str + " -movflags +faststart \"" + output_file + "\" 2>/dev/null";
-    } else if (audio_format_ == "opus") {
-        // Opus codec - best compression for voice
-        command = "ffmpeg -i \"" + wav_file + "\"" + base_opts + " -c:a libopus -b:a " + bitrate_str + " \"" + output_file + "\" 2>/dev/null";
-    } else if (audio_format_ == "webm") {
-        // WebM container with Opus - native web format
-        command = "ffmpeg -i \"" + wav_file + "\"" + base_opts + " -c:a libopus -b:a " + bitrate_str + " \"" + output_file + "\" 2>/dev/null";
-    } else {
+void P25Decoder::set_ffmpeg_fallback(bool enable) {
+    ffmpeg_fallback_ = enable;
+}
+
+bool P25Decoder::encode_audio(const std::string& format, int bitrate, const std::string& output_file) const {
+    // Encode straight from the decoded PCM when a codec is linked in,
+    // otherwise (or on failure) fall back to ffmpeg on the WAV file
+    if (AudioEncoder::encode_file(audio_buffer_.data(), audio_buffer_.size(), output_sample_rate_,
+                                  format, bitrate, output_file)) {
+        return true;
+    }
+    if (!ffmpeg_fallback_) {
         return false;
     }
-    
-    int result = std::system(command.c_str());
-    return result == 0;
+    return convert_to_modern_format(output_prefix_ + ".wav", output_file, format, bitrate);
+}
+
+bool P25Decoder::convert_to_modern_format(const std::string& wav_file, const std::string& output_file,
+                                          const std::string& format, int bitrate) const {
+    return AudioEncoder::convert_with_ffmpeg(wav_file, output_file, format, bitrate);
 }
\ No newline at end of file
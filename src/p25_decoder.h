@@ -20,11 +20,24 @@
 #include "p25_des_decrypt.h"
 #include "p25_aes_decrypt.h"
 #include "p25_adp_decrypt.h"
+#include "key_store.h"
+#include "voice_quality.h"
+#include "voice_synth.h"
+#include "audio_dsp.h"
+#include "wav_writer.h"
+#include "frame_index.h"
+#include "imbe_archive.h"
+#include "call_json.h"
+#include "json_writer.h"
+#include <chrono>
 #include <string>
 #include <vector>
 #include <memory>
 #include <fstream>
 
+// Bump whenever decoded output changes, so archive indexes re-decode
+#define P25_DECODER_VERSION "1.2"
+
 // Forward declarations for OP25/IMBE decoder components (trunk-recorder integration)
 // We'll need to copy or link the relevant source files
 namespace gr {
@@ -33,6 +46,8 @@ namespace gr {
     }
 }
 
+class PcmPublisher;
+
 struct CallMetadata {
     // Basic call info
     long talkgroup;
@@ -48,6 +63,18 @@ struct CallMetadata {
     int voice_frames;
     bool has_encrypted_frames;
     
+    // Encryption sync from the last LDU2 that decoded cleanly
+    uint8_t algorithm_id;
+    uint16_t key_id;
+    bool undecodable;       // encrypted with a key we do not hold, never decrypted
+    int skipped_frames;     // LDUs not run through the vocoder because of that
+    
+    // FEC results and repeat/mute decisions for every IMBE codeword
+    VoiceQuality voice_quality;
+    
+    // 8 kHz samples of silence cut from the audio by silence compaction
+    uint64_t silence_trimmed_samples;
+    
     // Audio info
     std::string audio_type;
     int freq;
@@ -56,39 +83,87 @@ struct CallMetadata {
     // Default values to match trunk-recorder format
     CallMetadata() : talkgroup(0), source_id(0), nac(0), start_time(0), end_time(0), call_length(0),
                     total_frames(0), voice_frames(0), has_encrypted_frames(false),
-                    audio_type("digital"), freq(0), freq_error(0) {}
+                    algorithm_id(0x80), key_id(0), undecodable(false), skipped_frames(0),
+                    silence_trimmed_samples(0), audio_type("digital"), freq(0), freq_error(0) {}
+};
+
+// Outputs produced by a single pass over the input file
+struct DecodeOutputs {
+    bool wav;   // PREFIX.wav (plus converted format if configured)
+    bool json;  // PREFIX.json
+    bool text;  // PREFIX.txt frame analysis
+    bool csv;   // PREFIX.csv frame data
+    bool pcm;   // audio into get_audio_buffer() only, no file (implied by wav)
+    bool imbe;  // PREFIX.imbe IMBE parameter archive (see imbe_archive.h); not for ranges
+    
+    // Only the voice between these, in seconds of air time (180 ms per
+    // LDU); end_s 0 runs to the end of the call. Frames in front of the
+    // range are skipped by seeking (see P25Decoder::set_frame_index).
+    double start_s;
+    double end_s;
+    
+    DecodeOutputs() : wav(true), json(true), text(false), csv(false), pcm(false), imbe(false), start_s(0.0), end_s(0.0) {}
+    
+    bool ranged() const { return start_s > 0.0 || end_s > 0.0; }
 };
 
 class P25Decoder {
+public:
+    static constexpr int IMBE_FRAMES_PER_LDU = 9;
+    static constexpr int SAMPLES_PER_IMBE_FRAME = 160;
+    static constexpr int SAMPLES_PER_LDU = IMBE_FRAMES_PER_LDU * SAMPLES_PER_IMBE_FRAME;
+    // About a minute of voice; shorter segments are not worth a thread
+    static constexpr int DEFAULT_MIN_SEGMENT_LDUS = 333;
+    // Voice frames decoded, and thrown away, ahead of a time range so the
+    // vocoder history and encryption sync are in place where it starts
+    static constexpr int RANGE_PRIME_LDUS = 3;
+    // Silence compaction leaves this much of every silent stretch
+    static constexpr int DEFAULT_SILENCE_KEEP_MS = 500;
+
 private:
     std::unique_ptr<P25FrameParser> parser_;
     std::string input_filename_;
+    const uint8_t* input_buffer_;      // set by open_p25_buffer(), owned by the caller
+    size_t input_buffer_size_;
     std::string output_prefix_;
     
-    // Audio output
-    std::ofstream audio_file_;
+    // Audio output: the whole call's PCM, written to the WAV file once at the end
+    WavWriter wav_writer_;
+    WavWriter::Options wav_options_;
     std::vector<int16_t> audio_buffer_;
     
     // JSON metadata output
     CallMetadata metadata_;
-    std::string external_metadata_;
+    std::shared_ptr<const TrunkCallMetadata> external_metadata_;
+    std::string json_text_;        // generate_json_metadata() output, reused between calls
+    std::string existing_json_;    // trunk-recorder's .json beside the input, when there is one
     
     // IMBE decoder components
     bool imbe_decoder_initialized_;
     
-    // OP25 IMBE vocoder (trunk-recorder approach)  
-    class imbe_vocoder* vocoder_;
+    // IMBE synthesis, fixed-point imbe_vocoder unless set_vocoder() says otherwise
+    std::unique_ptr<VoiceSynth> synth_;
+    
+    // Tracing: time spent parsing frames and synthesising, summed over the call
+    uint64_t trace_id_;
+    int64_t trace_parse_ns_;
+    int64_t trace_vocoder_ns_;
+    
+    // Cooperative time limit for one call (set_deadline)
+    std::chrono::steady_clock::time_point deadline_;
+    bool timed_out_;
     
     // P25 frame processing
     int current_frame_num_;
     
     // IMBE parameter extraction from P25 frames
-    bool extract_imbe_from_p25_frame(const P25Frame& frame, std::vector<int16_t>& audio_samples);
+    bool extract_imbe_from_p25_frame(const P25Frame& frame, VoiceWork& work);
     
     // Output control
     bool text_dump_enabled_;
     std::string audio_format_;
     int audio_bitrate_;
+    bool ffmpeg_fallback_;
     
     // Decryption support
     std::unique_ptr<P25DESDecrypt> des_decrypt_;
@@ -96,19 +171,117 @@ private:
     std::unique_ptr<P25ADPDecrypt> adp_decrypt_;
     bool decryption_enabled_;
     uint8_t current_mi_[9]; // Current Message Indicator
+    uint8_t current_algorithm_id_;
+    uint16_t current_key_id_;
+    bool crypt_ready_;      // keystream prepared for the current superframe
+    bool crypt_missing_;    // current superframe is encrypted and cannot be decrypted
+    bool superframe_decodable_seen_;
+    bool skip_undecodable_;
+    bool undecodable_metadata_only_;
+    std::vector<uint8_t> crypt_codeword_;
+    
+    // Take ALGID/KID/MI from an LDU2's encryption sync for the voice that follows
+    void update_encryption_sync(const P25Frame& frame);
+    void decrypt_codeword(std::vector<uint8_t>& codeword, bool is_ldu2, int voice_frame_num);
+    
+    // Last KeyStore snapshot, refreshed when the store's generation moves
+    std::shared_ptr<const KeySet> shared_keys_;
+    uint64_t shared_keys_generation_;
+    const KeySet& shared_keys();
+    
+    // Frame concealment: repeat the last good frame's audio or mute instead
+    // of synthesizing codewords the FEC could not recover
+    bool conceal_frames_;
+    int conceal_max_repeats_;
+    int16_t last_good_pcm_[SAMPLES_PER_IMBE_FRAME];
+    void conceal_frame(VoiceQuality::Decision decision, int run, const int16_t* last_good,
+                       int16_t* audio_samples) const;
+    
+    // Silence: quiet frames skip synthesis (VoiceSynth::set_silence_skip),
+    // and compaction cuts runs of all-zero frames in the audio output down
+    // to silence_keep_frames_; silence_run_frames_ counts the current run
+    bool silence_skip_;
+    bool silence_compaction_;
+    int silence_keep_frames_;
+    int silence_run_frames_;
+    // Compacts samples in place, returning how many are left
+    size_t compact_silence(int16_t* samples, size_t count);
+    
+    // Segment-parallel synthesis of long calls: voice is prepared in order,
+    // then split at transmission boundaries and each segment synthesised on
+    // its own thread with its own vocoder (see set_segment_parallelism)
+    int segment_threads_;
+    int min_segment_ldus_;
+    std::vector<VoiceWork> voice_work_;
+    std::vector<int16_t> segment_pcm_;
+    std::vector<std::unique_ptr<VoiceSynth>> segment_synths_;
+    std::vector<size_t> plan_segments() const;
+    void synthesize_segments(const std::vector<size_t>& starts);
+    
+    // Sidecar frame index: written next to decoded files when enabled,
+    // read (or built by a header scan) to seek for a time range
+    bool frame_index_enabled_;
+    FrameIndex frame_index_;
+    bool load_frame_index();
+    // Position the parser a few LDUs ahead of voice sample; frame_number
+    // and voice_sample are set to where reading resumes
+    bool seek_to_sample(uint64_t sample, int& frame_number, uint64_t& voice_sample);
+    
+    // Push-style call state
+    bool call_active_;
+    std::vector<int16_t> frame_pcm_;
+    
+    // Live audio to streaming plugins, fed as each LDU is synthesised
+    std::shared_ptr<PcmPublisher> pcm_publisher_;
+    
+    // Post-vocoder processing: gain/AGC at 8 kHz, then resampling for the
+    // WAV file and audio buffer. Both are off (nullptr) by default.
+    int output_sample_rate_;
+    std::unique_ptr<Resampler> resampler_;
+    std::unique_ptr<AudioGain> gain_;
+    std::vector<int16_t> resampled_;
+    void emit_audio(const int16_t* samples, size_t count);
+    // Gain, then the part of an LDU starting at voice_sample that falls in
+    // [range_start, range_end) to the publisher and emit_audio()
+    void emit_voice(int16_t* samples, size_t count, uint64_t voice_sample,
+                    uint64_t range_start, uint64_t range_end);
+    // WAV file (or its removal) and the converted format once the audio is complete
+    void finish_audio_file(const std::string& output_prefix);
     
     // Internal methods
-    bool setup_wav_output(const std::string& filename);
-    void write_audio_samples(const std::vector<int16_t>& samples);
+    bool setup_wav_output(const std::string& filename, uint64_t max_voice_samples);
     void close_audio_output();
-    void write_wav_header();
-    void finalize_wav_file();
-    bool convert_to_modern_format(const std::string& wav_file, const std::string& output_file);
+    // Room in audio_buffer_ for every LDU the input could hold, or max_voice_samples if fewer
+    void reserve_audio_buffer(uint64_t max_voice_samples);
+    bool convert_to_modern_format(const std::string& wav_file, const std::string& output_file,
+                                  const std::string& format, int bitrate) const;
     
-    bool decode_voice_frame(const P25Frame& frame, std::vector<int16_t>& audio_samples);
+    // Decodes one LDU into audio_samples (room for SAMPLES_PER_LDU), returns sample count
+    size_t decode_voice_frame(const P25Frame& frame, int16_t* audio_samples);
+    void prepare_voice_frame(const P25Frame& frame, VoiceWork& work);
+    // Synthesis (or concealment) of prepared voice; last_good is the
+    // concealment history that goes with synth. Returns the sample count.
+    size_t render_voice(const VoiceWork& work, VoiceSynth& synth, int16_t* last_good,
+                        int16_t* audio_samples, int64_t& vocoder_ns) const;
     void extract_voice_params(const P25Frame& frame);
     
-    std::string generate_json_metadata();
+    // Valid until the next call
+    const std::string& generate_json_metadata();
+    void write_encryption_fields(JsonWriter& json);
+    void write_quality_fields(JsonWriter& json);
+    void write_decoder_fields(JsonWriter& json, std::string_view input_file);
+    
+    // Frame dump formatting shared by the single-pass and standalone dumps
+    void write_text_dump_header(std::ostream& out);
+    void write_csv_header(DumpBuffer& out);
+    void write_csv_row(DumpBuffer& out, int frame_count, const P25Frame& frame);
+    bool csv_frame_hex_;    // the Frame column is hex after a row with payload
+    
+    // Rewind to the first frame of whatever was opened last
+    bool reopen_input();
+    
+    // Per-frame call counters shared by the file and push paths
+    void count_frame(const P25Frame& frame);
     
 public:
     P25Decoder();
@@ -116,19 +289,69 @@ public:
     
     // Main processing methods
     bool open_p25_file(const std::string& filename);
+    
+    // Decode from memory (e.g. an upload that was never written to disk).
+    // data must stay valid until the decoder is reopened; source_name stands
+    // in for the file name in dumps and metadata lookups.
+    bool open_p25_buffer(const uint8_t* data, size_t size, const std::string& source_name = "memory");
+    
+    // Push-style decoding for inputs that deliver one frame at a time. The
+    // decoder keeps vocoder, encryption sync and call counters between
+    // push_frame() calls and writes nothing to disk; the PCM it returns is
+    // valid until the next push_frame(). metadata_json (trunk-recorder call
+    // JSON) seeds talkgroup, source and system and is merged into the JSON
+    // output like set_external_metadata().
+    void begin_call(const std::string& metadata_json = "", const std::string& source_name = "stream");
+    void begin_call(std::shared_ptr<const TrunkCallMetadata> call_metadata, const std::string& source_name);
+    const std::vector<int16_t>& push_frame(const P25Frame& frame);
+    const CallMetadata& end_call();
+    bool in_call() const { return call_active_; }
+    
+    // Back to a freshly constructed state for a new call: vocoder history,
+    // encryption sync, counters and input are cleared, buffers keep their
+    // capacity. Configuration (keys, formats, dump options) is kept.
+    void reset();
+    uint8_t current_algorithm_id() const { return current_algorithm_id_; }
+    uint16_t current_key_id() const { return current_key_id_; }
+    
     bool decode_to_audio(const std::string& output_prefix);
+    // Decode once and feed every requested output from the same frame iteration
+    bool decode_to_outputs(const std::string& output_prefix, const DecodeOutputs& outputs);
     bool process_frames_only(); // Process P25 frames without audio output
     
+    // Synthesise a PREFIX.imbe archive from an earlier decode into
+    // outputs.wav/pcm with this decoder's current vocoder, concealment,
+    // gain and rate; outputs.json writes the archived metadata. A range
+    // goes straight to its records. Frame dumps need the .p25 and are not
+    // written from an archive.
+    bool synthesize_archive(const std::string& archive_file, const std::string& output_prefix,
+                            const DecodeOutputs& outputs);
+    
     // Output methods  
     bool save_json_metadata(const std::string& filename);
     bool save_text_dump(const std::string& filename);
     bool save_csv_dump(const std::string& filename);
     
+    // Encode the PCM from the last decode to another format without decoding again.
+    // Safe to call concurrently for different formats once decoding has finished.
+    bool encode_audio(const std::string& format, int bitrate, const std::string& output_file) const;
+    const std::vector<int16_t>& get_audio_buffer() const { return audio_buffer_; }
+    
     // Configuration
+    // Rate of the WAV file, get_audio_buffer() and encode_audio(); anything
+    // other than 8000 goes through the in-process resampler. push_frame()
+    // and the PCM publisher stay at the vocoder's 8 kHz.
     void set_output_sample_rate(int rate = 8000);
+    int output_sample_rate() const { return output_sample_rate_; }
+    // Fixed gain and/or AGC on the vocoder output, every path; inactive settings turn it off
+    void set_audio_gain(const AudioGain::Settings& settings);
+    // Preallocation, page cache and O_DIRECT behaviour of WAV writes (see wav_writer.h)
+    void set_wav_write_options(const WavWriter::Options& options) { wav_options_ = options; }
     void enable_text_dump(bool enable = true);
     void set_audio_format(const std::string& format = "wav");
     void set_audio_bitrate(int bitrate = 0);
+    // Use ffmpeg for formats without a linked encoder (default on)
+    void set_ffmpeg_fallback(bool enable = true);
     
     // Decryption methods
     bool add_des_key(uint16_t keyid, const std::vector<uint8_t>& key);
@@ -136,11 +359,78 @@ public:
     bool add_adp_key(uint16_t keyid, const std::vector<uint8_t>& key);
     void enable_decryption(bool enable = true);
     
+    // Whether a key for algorithm_id/keyid is held here or in the KeyStore
+    bool has_key(uint8_t algorithm_id, uint16_t keyid);
+    
+    // Voice encrypted with a key we do not hold is not run through the
+    // vocoder once an LDU2 has shown it: those LDUs produce no audio and are
+    // counted in CallMetadata::skipped_frames. With metadata_only a call that
+    // never became decodable also gets no audio file, only its metadata.
+    void set_skip_undecodable(bool skip = true, bool metadata_only = false);
+    
+    // Conceal bad IMBE frames per TIA-102.BABA instead of synthesizing them:
+    // a frame the VoiceQuality rules mark for repeat replays the last good
+    // frame's audio 6 dB quieter each time, and after max_repeats in a row
+    // (or at a high error rate) frames are muted. Neither runs the vocoder.
+    void set_frame_concealment(bool enable = true, int max_repeats = VoiceQuality::DEFAULT_MAX_REPEATS);
+    
+    // Decode frames too quiet to hear (under about -60 dBFS) as zeros
+    // without running synthesis on them. The fixed-point vocoder only; the
+    // float one synthesises everything.
+    void set_silence_skip(bool enable = true);
+    
+    // Cut every run of silent frames (160 samples of zeros: skipped quiet
+    // frames, muted and undecodable ones) in the WAV file, the audio buffer
+    // and encoded formats down to keep_ms, and report the time cut as
+    // silence_trimmed in the JSON. call_length stays the time on air.
+    // push_frame() and live PCM are not compacted. Off by default.
+    void set_silence_compaction(bool enable = true, int keep_ms = DEFAULT_SILENCE_KEEP_MS);
+    
+    // Split calls of at least 2 * min_segment_ldus voice LDUs at TDU/HDU
+    // boundaries into up to threads segments and synthesise them in
+    // parallel, each with a fresh vocoder, for lower latency on very long
+    // calls. Vocoder history no longer runs across those boundaries, and
+    // live PCM is published once synthesis is done. 1 (default) turns it off.
+    void set_segment_parallelism(int threads, int min_segment_ldus = DEFAULT_MIN_SEGMENT_LDUS);
+    
+    // Write FILE.p25.idx (see frame_index.h) for every file decoded from
+    // start to end, and for files a time range had to scan. Ranged decodes
+    // use a valid sidecar whether or not this is on. Off by default.
+    void set_frame_index(bool enable = true) { frame_index_enabled_ = enable; }
+    
+    // Switch the voice synthesis backend; its history starts over
+    void set_vocoder(VoiceSynth::Backend backend);
+    VoiceSynth::Backend vocoder() const { return synth_->backend(); }
+    
+    // Publish each decoded LDU to plugins' audio_stream() hooks (see
+    // pcm_stream.h) while a call is begun on the publisher. Kept by reset().
+    void set_pcm_publisher(std::shared_ptr<PcmPublisher> publisher) { pcm_publisher_ = std::move(publisher); }
+    PcmPublisher* pcm_publisher() const { return pcm_publisher_.get(); }
+    
+    // Record frame_parse and vocoder spans for this call under a sampled
+    // trace ID (see tracer.h); reset() clears it
+    void set_trace_id(uint64_t trace_id) { trace_id_ = trace_id; }
+    
+    // Give up on the call once deadline passes. The frame loop checks the
+    // clock every DEADLINE_CHECK_FRAMES frames; a decode cut short writes
+    // no files, returns false and leaves timed_out() true. reset() clears both.
+    static constexpr int DEADLINE_CHECK_FRAMES = 32;
+    void set_deadline(std::chrono::steady_clock::time_point deadline) { deadline_ = deadline; }
+    bool timed_out() const { return timed_out_; }
+    bool undecodable() const { return metadata_.undecodable; }
+    
+    // Generate the keystream for a superframe: algorithm 0x81 DES-OFB, 0x84
+    // AES-256, 0xAA ADP. Keys added to this decoder are tried first, then the
+    // process-wide KeyStore. False if neither has the key.
+    bool prepare_decryption(uint8_t algorithm_id, uint16_t keyid, const uint8_t mi[9]);
+    bool decrypt_superframe(uint8_t algorithm_id, uint8_t codewords[P25_SUPERFRAME_BYTES]);
+    
     // Get call information
     const CallMetadata& get_call_metadata() const { return metadata_; }
     
     // Set metadata from external source (API)
     void set_external_metadata(const std::string& json_metadata);
+    void set_external_metadata(std::shared_ptr<const TrunkCallMetadata> call_metadata);
 };
 
 #endif // P25_DECODER_H
\ No newline at end of file
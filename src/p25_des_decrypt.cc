@@ -1,21 +1,159 @@
 #include "p25_des_decrypt.h"
 #include <iostream>
-#include <sstream>
-#include <iomanip>
+#include <cstring>
 #include <algorithm>
 
+// DES tables (FIPS 46-3), bit 1 is the most significant bit
+static const int initial_perm[64] = {
+    58, 50, 42, 34, 26, 18, 10, 2, 60, 52, 44, 36, 28, 20, 12, 4,
+    62, 54, 46, 38, 30, 22, 14, 6, 64, 56, 48, 40, 32, 24, 16, 8,
+    57, 49, 41, 33, 25, 17,  9, 1, 59, 51, 43, 35, 27, 19, 11, 3,
+    61, 53, 45, 37, 29, 21, 13, 5, 63, 55, 47, 39, 31, 23, 15, 7
+};
+
+static const int final_perm[64] = {
+    40, 8, 48, 16, 56, 24, 64, 32, 39, 7, 47, 15, 55, 23, 63, 31,
+    38, 6, 46, 14, 54, 22, 62, 30, 37, 5, 45, 13, 53, 21, 61, 29,
+    36, 4, 44, 12, 52, 20, 60, 28, 35, 3, 43, 11, 51, 19, 59, 27,
+    34, 2, 42, 10, 50, 18, 58, 26, 33, 1, 41,  9, 49, 17, 57, 25
+};
+
+// Key permutation table (parity bit drop)
+static const int keyp[56] = {
+    57, 49, 41, 33, 25, 17, 9,  1, 58, 50, 42, 34, 26, 18,
+    10,  2, 59, 51, 43, 35, 27, 19, 11,  3, 60, 52, 44, 36,
+    63, 55, 47, 39, 31, 23, 15,  7, 62, 54, 46, 38, 30, 22,
+    14,  6, 61, 53, 45, 37, 29, 21, 13,  5, 28, 20, 12,  4
+};
+
+// Shift schedule
+static const int shift_table[16] = {
+    1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1
+};
+
+// Key compression table
+static const int key_comp[48] = {
+    14, 17, 11, 24,  1,  5,  3, 28, 15,  6, 21, 10,
+    23, 19, 12,  4, 26,  8, 16,  7, 27, 20, 13,  2,
+    41, 52, 31, 37, 47, 55, 30, 40, 51, 45, 33, 48,
+    44, 49, 39, 56, 34, 53, 46, 42, 50, 36, 29, 32
+};
+
+// Straight permutation applied to the S-box output
+static const int per[32] = {
+    16,  7, 20, 21, 29, 12, 28, 17,  1, 15, 23, 26,  5, 18, 31, 10,
+     2,  8, 24, 14, 32, 27,  3,  9, 19, 13, 30,  6, 22, 11,  4, 25
+};
+
+static const uint8_t sbox[8][4][16] = {
+    { { 14, 4, 13, 1, 2, 15, 11, 8, 3, 10, 6, 12, 5, 9, 0, 7 },
+      { 0, 15, 7, 4, 14, 2, 13, 1, 10, 6, 12, 11, 9, 5, 3, 8 },
+      { 4, 1, 14, 8, 13, 6, 2, 11, 15, 12, 9, 7, 3, 10, 5, 0 },
+      { 15, 12, 8, 2, 4, 9, 1, 7, 5, 11, 3, 14, 10, 0, 6, 13 } },
+    { { 15, 1, 8, 14, 6, 11, 3, 4, 9, 7, 2, 13, 12, 0, 5, 10 },
+      { 3, 13, 4, 7, 15, 2, 8, 14, 12, 0, 1, 10, 6, 9, 11, 5 },
+      { 0, 14, 7, 11, 10, 4, 13, 1, 5, 8, 12, 6, 9, 3, 2, 15 },
+      { 13, 8, 10, 1, 3, 15, 4, 2, 11, 6, 7, 12, 0, 5, 14, 9 } },
+    { { 10, 0, 9, 14, 6, 3, 15, 5, 1, 13, 12, 7, 11, 4, 2, 8 },
+      { 13, 7, 0, 9, 3, 4, 6, 10, 2, 8, 5, 14, 12, 11, 15, 1 },
+      { 13, 6, 4, 9, 8, 15, 3, 0, 11, 1, 2, 12, 5, 10, 14, 7 },
+      { 1, 10, 13, 0, 6, 9, 8, 7, 4, 15, 14, 3, 11, 5, 2, 12 } },
+    { { 7, 13, 14, 3, 0, 6, 9, 10, 1, 2, 8, 5, 11, 12, 4, 15 },
+      { 13, 8, 11, 5, 6, 15, 0, 3, 4, 7, 2, 12, 1, 10, 14, 9 },
+      { 10, 6, 9, 0, 12, 11, 7, 13, 15, 1, 3, 14, 5, 2, 8, 4 },
+      { 3, 15, 0, 6, 10, 1, 13, 8, 9, 4, 5, 11, 12, 7, 2, 14 } },
+    { { 2, 12, 4, 1, 7, 10, 11, 6, 8, 5, 3, 15, 13, 0, 14, 9 },
+      { 14, 11, 2, 12, 4, 7, 13, 1, 5, 0, 15, 10, 3, 9, 8, 6 },
+      { 4, 2, 1, 11, 10, 13, 7, 8, 15, 9, 12, 5, 6, 3, 0, 14 },
+      { 11, 8, 12, 7, 1, 14, 2, 13, 6, 15, 0, 9, 10, 4, 5, 3 } },
+    { { 12, 1, 10, 15, 9, 2, 6, 8, 0, 13, 3, 4, 14, 7, 5, 11 },
+      { 10, 15, 4, 2, 7, 12, 9, 5, 6, 1, 13, 14, 0, 11, 3, 8 },
+      { 9, 14, 15, 5, 2, 8, 12, 3, 7, 0, 4, 10, 1, 13, 11, 6 },
+      { 4, 3, 2, 12, 9, 5, 15, 10, 11, 14, 1, 7, 6, 0, 8, 13 } },
+    { { 4, 11, 2, 14, 15, 0, 8, 13, 3, 12, 9, 7, 5, 10, 6, 1 },
+      { 13, 0, 11, 7, 4, 9, 1, 10, 14, 3, 5, 12, 2, 15, 8, 6 },
+      { 1, 4, 11, 13, 12, 3, 7, 14, 10, 15, 6, 8, 0, 5, 9, 2 },
+      { 6, 11, 13, 8, 1, 4, 10, 7, 9, 5, 0, 15, 14, 2, 3, 12 } },
+    { { 13, 2, 8, 4, 6, 15, 11, 1, 10, 9, 3, 14, 5, 0, 12, 7 },
+      { 1, 15, 13, 8, 10, 3, 7, 4, 12, 5, 6, 11, 0, 14, 9, 2 },
+      { 7, 11, 4, 1, 9, 12, 14, 2, 0, 6, 10, 13, 15, 3, 5, 8 },
+      { 2, 1, 14, 7, 4, 10, 8, 13, 15, 12, 9, 0, 3, 5, 6, 11 } }
+};
+
+// Permute the top in_bits of in (bit 1 = MSB of an in_bits wide value)
+static uint64_t permute_bits(uint64_t in, int in_bits, const int* table, int n) {
+    uint64_t out = 0;
+    for (int i = 0; i < n; i++) {
+        out = (out << 1) | ((in >> (in_bits - table[i])) & 1);
+    }
+    return out;
+}
+
+// Lookup tables built once: the S-boxes folded together with the P
+// permutation (one table per S-box, indexed by its 6-bit input), and the
+// initial/final permutations split into one table per input byte.
+struct DESTables {
+    uint32_t sp[8][64];
+    uint64_t ip[8][256];
+    uint64_t fp[8][256];
+
+    DESTables() {
+        for (int box = 0; box < 8; box++) {
+            for (int v = 0; v < 64; v++) {
+                int row = ((v >> 4) & 2) | (v & 1);
+                int col = (v >> 1) & 0xF;
+                uint32_t placed = static_cast<uint32_t>(sbox[box][row][col]) << (28 - 4 * box);
+                sp[box][v] = static_cast<uint32_t>(permute_bits(placed, 32, per, 32));
+            }
+        }
+        for (int byte = 0; byte < 8; byte++) {
+            for (int v = 0; v < 256; v++) {
+                uint64_t in = static_cast<uint64_t>(v) << (56 - 8 * byte);
+                ip[byte][v] = permute_bits(in, 64, initial_perm, 64);
+                fp[byte][v] = permute_bits(in, 64, final_perm, 64);
+            }
+        }
+    }
+};
+
+static const DESTables& des_tables() {
+    static const DESTables tables;
+    return tables;
+}
+
+static inline uint64_t permute_bytes(const uint64_t table[8][256], uint64_t in) {
+    uint64_t out = 0;
+    for (int byte = 0; byte < 8; byte++) {
+        out |= table[byte][(in >> (56 - 8 * byte)) & 0xFF];
+    }
+    return out;
+}
+
 P25DESDecrypt::P25DESDecrypt() : d_position(0) {
     std::fill(d_keystream, d_keystream + 224, 0);
+    std::fill(d_superframe_mask, d_superframe_mask + P25_SUPERFRAME_BYTES, 0);
 }
 
 P25DESDecrypt::~P25DESDecrypt() {
 }
 
 bool P25DESDecrypt::add_key(uint16_t keyid, const std::vector<uint8_t>& key) {
-    d_keys[keyid] = key;
+    expand_key(key, d_keys[keyid]);
     return true;
 }
 
+void P25DESDecrypt::expand_key(const std::vector<uint8_t>& key, KeySchedule& schedule) {
+    // Prepare 8-byte DES key: pad with leading zeros if key is too short,
+    // use the first 8 bytes of a longer one
+    uint8_t des_key[8] = {0};
+    size_t length = std::min<size_t>(key.size(), 8);
+    for (size_t i = 0; i < length; i++) {
+        des_key[8 - length + i] = key[i];
+    }
+    key_schedule(des_key, schedule);
+    std::memset(des_key, 0, sizeof(des_key));
+}
+
 bool P25DESDecrypt::has_key(uint16_t keyid) const {
     return d_keys.find(keyid) != d_keys.end();
 }
@@ -26,21 +164,16 @@ bool P25DESDecrypt::prepare(uint16_t keyid, const uint8_t mi[9]) {
         return false; // Key not found
     }
     
+    prepare(key_iter->second, mi);
+    return true;
+}
+
+void P25DESDecrypt::prepare(const KeySchedule& schedule, const uint8_t mi[9]) {
     d_position = 0;
     
-    // Prepare 8-byte DES key from stored key
-    uint8_t des_key[8] = {0};
-    const auto& stored_key = key_iter->second;
-    
-    // Pad with leading zeros if key is too short, copy up to 8 bytes
-    for (size_t i = 0; i < 8 && i < stored_key.size(); i++) {
-        des_key[8 - stored_key.size() + i] = stored_key[i];
-    }
-    
     // Generate keystream using DES-OFB
-    generate_keystream(des_key, mi);
-    
-    return true;
+    generate_keystream(schedule, mi);
+    p25_build_superframe_mask(d_keystream, 8 + 11, d_superframe_mask);
 }
 
 bool P25DESDecrypt::decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool is_ldu2, int voice_frame_num) {
@@ -69,151 +202,77 @@ bool P25DESDecrypt::decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool i
     return true;
 }
 
-void P25DESDecrypt::generate_keystream(const uint8_t key[8], const uint8_t mi[9]) {
-    // Convert key and MI to string format for DES processing
-    std::string key_str = byteArray2string(key);
-    std::string mi_str = byteArray2string(const_cast<uint8_t*>(mi)); // Cast away const for compatibility
-    
-    // Convert to binary
-    std::string key_bin = hex2bin(key_str);
-    
-    // DES key permutation table (parity bit drop)
-    static const int keyp[56] = { 
-        57, 49, 41, 33, 25, 17, 9,  1, 58, 50, 42, 34, 26, 18,
-        10,  2, 59, 51, 43, 35, 27, 19, 11,  3, 60, 52, 44, 36,
-        63, 55, 47, 39, 31, 23, 15,  7, 62, 54, 46, 38, 30, 22,
-        14,  6, 61, 53, 45, 37, 29, 21, 13,  5, 28, 20, 12,  4
-    };
+bool P25DESDecrypt::decrypt_superframe(uint8_t codewords[P25_SUPERFRAME_BYTES]) {
+    p25_xor_superframe(codewords, d_superframe_mask);
+    return true;
+}
+
+void P25DESDecrypt::key_schedule(const uint8_t key[8], KeySchedule& schedule) {
+    uint64_t key_bits = 0;
+    for (int i = 0; i < 8; i++) {
+        key_bits = (key_bits << 8) | key[i];
+    }
     
     // Get 56-bit key without parity bits
-    key_bin = permute(key_bin, keyp, 56);
-    
-    // DES shift schedule
-    static const int shift_table[16] = { 
-        1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1 
-    };
-    
-    // Key compression table
-    static const int key_comp[48] = { 
-        14, 17, 11, 24,  1,  5,  3, 28, 15,  6, 21, 10,
-        23, 19, 12,  4, 26,  8, 16,  7, 27, 20, 13,  2,
-        41, 52, 31, 37, 47, 55, 30, 40, 51, 45, 33, 48,
-        44, 49, 39, 56, 34, 53, 46, 42, 50, 36, 29, 32
-    };
+    uint64_t permuted = permute_bits(key_bits, 64, keyp, 56);
+    uint32_t left = static_cast<uint32_t>(permuted >> 28) & 0xFFFFFFF;
+    uint32_t right = static_cast<uint32_t>(permuted) & 0xFFFFFFF;
     
     // Generate 16 round keys
-    std::vector<std::string> rkb(16), rk(16);
-    std::string left = key_bin.substr(0, 28);
-    std::string right = key_bin.substr(28, 28);
-    
-    for (int i = 0; i < 16; i++) {
-        left = shift_left(left, shift_table[i]);
-        right = shift_left(right, shift_table[i]);
-        
-        std::string combine = left + right;
-        std::string round_key = permute(combine, key_comp, 48);
-        
-        rkb[i] = round_key;
-        rk[i] = bin2hex(round_key);
-    }
-    
-    // Generate 224-byte keystream using DES-OFB mode
-    std::string iv = mi_str; // Use MI as initialization vector
-    
-    for (int block = 0; block < 28; block++) { // 224/8 = 28 blocks
-        // Encrypt IV with DES using generated round keys
-        std::string encrypted_iv = encrypt(iv, rkb, rk);
-        
-        // Convert encrypted block to bytes and store in keystream
-        uint8_t block_bytes[8];
-        string2ByteArray(encrypted_iv, block_bytes);
+    for (int round = 0; round < 16; round++) {
+        int shift = shift_table[round];
+        left = ((left << shift) | (left >> (28 - shift))) & 0xFFFFFFF;
+        right = ((right << shift) | (right >> (28 - shift))) & 0xFFFFFFF;
         
-        for (int i = 0; i < 8 && (block * 8 + i) < 224; i++) {
-            d_keystream[block * 8 + i] = block_bytes[i];
+        uint64_t combine = (static_cast<uint64_t>(left) << 28) | right;
+        uint64_t round_key = permute_bits(combine, 56, key_comp, 48);
+        for (int group = 0; group < 8; group++) {
+            schedule.subkeys[round][group] = (round_key >> (42 - 6 * group)) & 0x3F;
         }
-        
-        // Update IV for next block (OFB mode)
-        iv = encrypted_iv;
     }
 }
 
-// DES utility functions (simplified implementations based on OP25)
-std::string P25DESDecrypt::hex2bin(const std::string& s) {
-    std::unordered_map<char, std::string> hex_to_bin = {
-        {'0',"0000"}, {'1',"0001"}, {'2',"0010"}, {'3',"0011"},
-        {'4',"0100"}, {'5',"0101"}, {'6',"0110"}, {'7',"0111"},
-        {'8',"1000"}, {'9',"1001"}, {'A',"1010"}, {'B',"1011"},
-        {'C',"1100"}, {'D',"1101"}, {'E',"1110"}, {'F',"1111"}
-    };
-    
-    std::string bin = "";
-    for (char c : s) {
-        bin += hex_to_bin[std::toupper(c)];
+// f(R, K): E group i is bits 4i..4i+5 of R (bit 0 meaning bit 32), which
+// is the top six bits of R rotated left by 4i - 1; S-boxes and P are then a
+// single table lookup per group
+uint32_t P25DESDecrypt::feistel(uint32_t r, const uint8_t subkey[8]) {
+    const DESTables& tables = des_tables();
+    uint32_t out = tables.sp[0][(((r >> 1) | (r << 31)) >> 26) ^ subkey[0]];
+    for (int group = 1; group < 8; group++) {
+        int shift = 4 * group - 1;
+        uint32_t rotated = (r << shift) | (r >> (32 - shift));
+        out |= tables.sp[group][(rotated >> 26) ^ subkey[group]];
     }
-    return bin;
+    return out;
 }
 
-std::string P25DESDecrypt::bin2hex(const std::string& s) {
-    std::unordered_map<std::string, char> bin_to_hex = {
-        {"0000",'0'}, {"0001",'1'}, {"0010",'2'}, {"0011",'3'},
-        {"0100",'4'}, {"0101",'5'}, {"0110",'6'}, {"0111",'7'},
-        {"1000",'8'}, {"1001",'9'}, {"1010",'A'}, {"1011",'B'},
-        {"1100",'C'}, {"1101",'D'}, {"1110",'E'}, {"1111",'F'}
-    };
+void P25DESDecrypt::generate_keystream(const KeySchedule& schedule, const uint8_t mi[9]) {
+    const DESTables& tables = des_tables();
     
-    std::string hex = "";
-    for (size_t i = 0; i < s.length(); i += 4) {
-        hex += bin_to_hex[s.substr(i, 4)];
-    }
-    return hex;
-}
-
-std::string P25DESDecrypt::permute(const std::string& k, const int* arr, int n) {
-    std::string per = "";
-    for (int i = 0; i < n; i++) {
-        per += k[arr[i] - 1];
-    }
-    return per;
-}
-
-std::string P25DESDecrypt::shift_left(const std::string& k, int shifts) {
-    return k.substr(shifts) + k.substr(0, shifts);
-}
-
-std::string P25DESDecrypt::xor_(const std::string& a, const std::string& b) {
-    std::string result = "";
-    for (size_t i = 0; i < a.size(); i++) {
-        result += (a[i] == b[i]) ? '0' : '1';
+    // Use the first 64 bits of the MI as initialization vector
+    uint64_t iv = 0;
+    for (int i = 0; i < 8; i++) {
+        iv = (iv << 8) | mi[i];
     }
-    return result;
-}
-
-std::string P25DESDecrypt::encrypt(const std::string& pt, const std::vector<std::string>& rkb, const std::vector<std::string>& rk) {
-    // Simplified DES encryption - in production, use full DES implementation
-    // This is a placeholder that should be replaced with complete DES algorithm
     
-    // For now, return a simple transformation
-    // TODO: Implement full DES encryption algorithm
-    std::string result = pt;
+    // In OFB each block encrypts the previous output, and IP undoes FP, so
+    // the chain stays in permuted form and FP is only applied to the output
+    uint64_t block = permute_bytes(tables.ip, iv);
+    uint32_t left = static_cast<uint32_t>(block >> 32);
+    uint32_t right = static_cast<uint32_t>(block);
     
-    // Apply some basic transformation using the round keys
-    for (int round = 0; round < 16; round++) {
-        result = xor_(result, rkb[round].substr(0, std::min(result.length(), rkb[round].length())));
-    }
-    
-    return result;
-}
-
-std::string P25DESDecrypt::byteArray2string(const uint8_t array[8]) {
-    std::stringstream ss;
-    for (int i = 0; i < 8; i++) {
-        ss << std::hex << std::setfill('0') << std::setw(2) << (int)array[i];
+    // Generate 224-byte keystream using DES-OFB mode
+    for (int b = 0; b < 28; b++) { // 224/8 = 28 blocks
+        for (int round = 0; round < 16; round++) {
+            uint32_t next = left ^ feistel(right, schedule.subkeys[round]);
+            left = right;
+            right = next;
+        }
+        // Undo the last swap; (right, left) is both this block before FP and the next input after IP
+        std::swap(left, right);
+        uint64_t output = permute_bytes(tables.fp, (static_cast<uint64_t>(left) << 32) | right);
+        for (int i = 0; i < 8; i++) {
+            d_keystream[b * 8 + i] = static_cast<uint8_t>(output >> (56 - 8 * i));
+        }
     }
-    return ss.str();
 }
-
-void P25DESDecrypt::string2ByteArray(const std::string& s, uint8_t array[8]) {
-    for (int i = 0; i < 8 && i * 2 < (int)s.length(); i++) {
-        array[i] = std::stoul(s.substr(i * 2, 2), nullptr, 16);
-    }
-}
\ No newline at end of file
@@ -5,25 +5,28 @@
 #include <cstdint>
 #include <string>
 #include <unordered_map>
+#include "p25_superframe_crypt.h"
 
 class P25DESDecrypt {
+public:
+    // Round keys are derived once when a key is added; each round's 48 bits
+    // are kept as the eight 6-bit groups that index the S-boxes
+    struct KeySchedule {
+        uint8_t subkeys[16][8];
+    };
+    
 private:
-    std::unordered_map<uint16_t, std::vector<uint8_t>> d_keys;
+    std::unordered_map<uint16_t, KeySchedule> d_keys;
     uint8_t d_keystream[224];
     uint32_t d_position;
+    uint8_t d_superframe_mask[P25_SUPERFRAME_BYTES];
     
     // DES implementation methods
-    std::string hex2bin(const std::string& s);
-    std::string bin2hex(const std::string& s);
-    std::string permute(const std::string& k, const int* arr, int n);
-    std::string shift_left(const std::string& k, int shifts);
-    std::string xor_(const std::string& a, const std::string& b);
-    std::string encrypt(const std::string& pt, const std::vector<std::string>& rkb, const std::vector<std::string>& rk);
-    std::string byteArray2string(const uint8_t array[8]);
-    void string2ByteArray(const std::string& s, uint8_t array[8]);
+    static void key_schedule(const uint8_t key[8], KeySchedule& schedule);
+    static uint32_t feistel(uint32_t r, const uint8_t subkey[8]);
     
     // Keystream generation
-    void generate_keystream(const uint8_t key[8], const uint8_t mi[9]);
+    void generate_keystream(const KeySchedule& schedule, const uint8_t mi[9]);
     
 public:
     P25DESDecrypt();
@@ -33,9 +36,17 @@ public:
     bool add_key(uint16_t keyid, const std::vector<uint8_t>& key);
     bool has_key(uint16_t keyid) const;
     
+    // Build a key schedule without storing it, for keys held outside the decryptor
+    static void expand_key(const std::vector<uint8_t>& key, KeySchedule& schedule);
+    
     // Decryption preparation and processing
     bool prepare(uint16_t keyid, const uint8_t mi[9]);
+    void prepare(const KeySchedule& schedule, const uint8_t mi[9]);
     bool decrypt_imbe_codeword(std::vector<uint8_t>& codeword, bool is_ldu2, int voice_frame_num);
+    
+    // Decrypt the 18 codewords of a superframe in place: LDU1's 9 followed
+    // by LDU2's 9, packed 11 bytes apart
+    bool decrypt_superframe(uint8_t codewords[P25_SUPERFRAME_BYTES]);
 };
 
 #endif // P25_DES_DECRYPT_H
\ No newline at end of file
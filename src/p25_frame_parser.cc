@@ -1,9 +1,16 @@
 #include "p25_frame_parser.h"
+#include "p25_reed_solomon.h"
+#include "op25_imbe_frame.h"
+#include "stage_profiler.h"
 #include <iostream>
-#include <iomanip>
-#include <sstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-P25FrameParser::P25FrameParser() {
+P25FrameParser::P25FrameParser()
+    : mmap_enabled_(true), owns_mapping_(false), map_base_(nullptr), map_size_(0), map_pos_(0) {
 }
 
 P25FrameParser::~P25FrameParser() {
@@ -15,6 +22,10 @@ bool P25FrameParser::open(const std::string& filename) {
     close();
     
     filename_ = filename;
+    if (mmap_enabled_ && open_mapped(filename)) {
+        return true;
+    }
+    
     file_.open(filename, std::ios::binary);
     if (!file_.is_open()) {
         std::cerr << "Error: Could not open file " << filename << std::endl;
@@ -23,31 +34,107 @@ bool P25FrameParser::open(const std::string& filename) {
     return true;
 }
 
+bool P25FrameParser::open_mapped(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    // Only regular, non-empty files can be mapped; pipes and FIFOs use the stream reader
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    
+    map_base_ = static_cast<const uint8_t*>(addr);
+    map_size_ = static_cast<size_t>(st.st_size);
+    map_pos_ = 0;
+    owns_mapping_ = true;
+    return true;
+}
+
+bool P25FrameParser::open_buffer(const uint8_t* data, size_t size) {
+    close();
+    
+    filename_.clear();
+    if (!data || size == 0) {
+        std::cerr << "Error: Empty P25 buffer" << std::endl;
+        return false;
+    }
+    
+    // Same reader as a mapped file, minus the munmap on close
+    map_base_ = data;
+    map_size_ = size;
+    map_pos_ = 0;
+    owns_mapping_ = false;
+    return true;
+}
+
 void P25FrameParser::close() {
+    if (map_base_) {
+        if (owns_mapping_) {
+            munmap(const_cast<uint8_t*>(map_base_), map_size_);
+        }
+        owns_mapping_ = false;
+        map_base_ = nullptr;
+        map_size_ = 0;
+        map_pos_ = 0;
+    }
     if (file_.is_open()) {
         file_.close();
     }
+    file_.clear();
 }
 
 bool P25FrameParser::has_more_frames() {
+    if (map_base_) {
+        return map_pos_ < map_size_;
+    }
     return file_.is_open() && !file_.eof() && file_.peek() != EOF;
 }
 
-std::string P25FrameParser::get_frame_type_name(uint8_t duid) {
-    switch (duid) {
-        case 0x00: return "HDU (Header Data Unit)";
-        case 0x03: return "TDU (Terminator Data Unit)";
-        case 0x05: return "LDU1 (Logical Data Unit 1)";
-        case 0x07: return "TDU (Terminator Data Unit)";
-        case 0x0A: return "LDU2 (Logical Data Unit 2)";
-        case 0x0C: return "PDU (Packet Data Unit)";
-        case 0x0F: return "TDU (Terminator Data Unit)";
-        case 0x12: return "TSBK (Trunking System Block)";
-        default: return "Unknown DUID (" + std::to_string(duid) + ")";
+int64_t P25FrameParser::position() {
+    if (map_base_) {
+        return static_cast<int64_t>(map_pos_);
+    }
+    if (!file_.is_open()) {
+        return -1;
+    }
+    return static_cast<int64_t>(file_.tellg());
+}
+
+bool P25FrameParser::seek(uint64_t offset) {
+    if (map_base_) {
+        if (offset > map_size_) {
+            return false;
+        }
+        map_pos_ = static_cast<size_t>(offset);
+        return true;
     }
+    if (!file_.is_open()) {
+        return false;
+    }
+    file_.clear();
+    file_.seekg(static_cast<std::streamoff>(offset));
+    return static_cast<bool>(file_);
 }
 
+constexpr P25FrameParser::DuidHandlers P25FrameParser::duid_handlers_;
+
 bool P25FrameParser::read_frame(P25Frame& frame) {
+    PROFILE_STAGE(ProfileStage::READ_FRAME);
+    if (map_base_) {
+        return read_frame_mapped(frame);
+    }
+    
     if (!file_.is_open() || file_.eof()) {
         return false;
     }
@@ -67,77 +154,177 @@ bool P25FrameParser::read_frame(P25Frame& frame) {
     
     // Frame length logging removed - not needed for normal operation
     
-    // Set frame info
-    frame.frame_type_name = get_frame_type_name(frame.duid);
-    frame.is_voice_frame = (frame.duid == 0x05 || frame.duid == 0x0A); // LDU1 or LDU2
-    
     // Read frame data
-    frame.data.resize(frame.length);
-    file_.read(reinterpret_cast<char*>(frame.data.data()), frame.length);
-    
-    if (file_.gcount() != frame.length) {
-        frame.data.resize(file_.gcount());
-        // Continue parsing instead of stopping - this allows processing of partial data
+    frame.view = nullptr;
+    frame.view_size = 0;
+    uint8_t* body = frame.inline_data;
+    if (frame.length > P25Frame::INLINE_PAYLOAD) {
+        frame.data.resize(frame.length);   // keeps its capacity from frame to frame
+        body = frame.data.data();
+    }
+    file_.read(reinterpret_cast<char*>(body), frame.length);
+    frame.data_size = static_cast<size_t>(file_.gcount());
+    if (frame.data_size > P25Frame::INLINE_PAYLOAD && frame.data_size < frame.length) {
+        frame.data.resize(frame.data_size);
+    } else if (frame.length > P25Frame::INLINE_PAYLOAD && frame.data_size <= P25Frame::INLINE_PAYLOAD) {
+        // A short read of a long frame still fits inline
+        std::copy(body, body + frame.data_size, frame.inline_data);
     }
+    // A short read continues parsing instead of stopping - this allows processing of partial data
     
-    // Parse encryption fields for LDU2 frames
-    if (frame.duid == 0x0A) { // LDU2
-        parse_encryption_fields(frame);
+    finish_frame(frame);
+    return true;
+}
+
+bool P25FrameParser::read_frame_mapped(P25Frame& frame) {
+    if (map_size_ - map_pos_ < 5) {
+        return false; // End of file or truncated header
     }
     
+    // Same 5-byte header layout as the stream reader: DUID + NAC + Length
+    const uint8_t* header = map_base_ + map_pos_;
+    frame.duid = header[0];
+    frame.nac = (header[1] << 8) | header[2];
+    frame.length = (header[3] << 8) | header[4];
+    map_pos_ += 5;
+    
+    // Hand out a view into the mapping; a short trailing frame is kept as partial data
+    size_t available = std::min<size_t>(frame.length, map_size_ - map_pos_);
+    frame.data_size = 0;
+    frame.view = map_base_ + map_pos_;
+    frame.view_size = available;
+    map_pos_ += available;
+    
+    finish_frame(frame);
     return true;
 }
 
-std::string P25FrameParser::dump_frame_text(const P25Frame& frame) {
-    std::ostringstream oss;
+size_t P25FrameParser::parse_frame(const uint8_t* data, size_t size, P25Frame& frame) {
+    if (size < 5) {
+        return 0;
+    }
+    uint16_t length = (data[3] << 8) | data[4];
+    if (size - 5 < length) {
+        return 0;
+    }
     
-    oss << "==== P25 Frame ====\n";
-    oss << "DUID: 0x" << std::hex << std::setw(2) << std::setfill('0') << (int)frame.duid << " (" << frame.frame_type_name << ")\n";
-    oss << "NAC:  0x" << std::hex << std::setw(3) << std::setfill('0') << frame.nac << std::dec << " (" << frame.nac << ")\n";
-    oss << "Length: " << frame.length << " bytes (" << (frame.length * 8) << " bits)\n";
+    frame.duid = data[0];
+    frame.nac = (data[1] << 8) | data[2];
+    frame.length = length;
+    frame.data_size = 0;
+    frame.view = data + 5;
+    frame.view_size = length;
+    
+    finish_frame(frame);
+    return 5 + static_cast<size_t>(length);
+}
+
+void P25FrameParser::finish_frame(P25Frame& frame) {
+    // Set frame info
+    frame.frame_type_name = p25_duid_name(frame.duid);
+    frame.is_voice_frame = p25_duid_is_voice(frame.duid);
+    
+    // The frame is reused between reads; only an LDU2 carries encryption
+    // sync, so every other frame is unencrypted with no sync
+    frame.algorithm_id = 0x80;
+    frame.key_id = 0;
+    frame.is_encrypted = false;
+    frame.es_valid = false;
+    std::fill(frame.message_indicator, frame.message_indicator + 9, 0);
+    
+    // Encryption sync for LDU2 frames
+    FrameHandler handler = duid_handlers_.handler[frame.duid];
+    if (handler) {
+        (this->*handler)(frame);
+    }
+}
+
+std::string P25FrameParser::dump_frame_text(const P25Frame& frame) {
+    DumpBuffer out;
+    append_frame_text(frame, out);
+    return out.str();
+}
+
+void P25FrameParser::append_frame_text(const P25Frame& frame, DumpBuffer& out) {
+    out.text("==== P25 Frame ====\n");
+    out.text("DUID: 0x").hex(frame.duid, 2).text(" (").text(frame.frame_type_name).text(")\n");
+    out.text("NAC:  0x").hex(frame.nac, 3).text(" (").dec(frame.nac).text(")\n");
+    out.text("Length: ").dec(frame.length).text(" bytes (").dec(frame.length * 8).text(" bits)\n");
     
     if (frame.is_voice_frame) {
-        oss << "Voice Frame: YES (contains IMBE voice data)\n";
+        out.text("Voice Frame: YES (contains IMBE voice data)\n");
     } else {
-        oss << "Voice Frame: NO\n";
+        out.text("Voice Frame: NO\n");
     }
     
     // Dump all raw data in hex
-    oss << "Raw Data (" << frame.data.size() << " bytes):\n";
-    for (size_t i = 0; i < frame.data.size(); i += 16) {
-        oss << std::hex << std::setw(4) << std::setfill('0') << i << ": ";
-        for (size_t j = i; j < std::min(i + 16, frame.data.size()); j++) {
-            oss << std::hex << std::setw(2) << std::setfill('0') << (int)frame.data[j] << " ";
-        }
-        oss << "\n";
+    const uint8_t* payload = frame.payload();
+    size_t payload_size = frame.payload_size();
+    out.text("Raw Data (").dec(payload_size).text(" bytes):\n");
+    for (size_t i = 0; i < payload_size; i += 16) {
+        out.hex(i, 4).text(": ");
+        out.hex_bytes(payload + i, std::min<size_t>(16, payload_size - i), ' ');
+        out.ch('\n');
     }
     
-    oss << std::dec; // Reset to decimal
-    oss << "\n";
+    out.ch('\n');
+}
+
+// The 24 Hamming(10,6,3) words of LDU2 encryption sync, as byte/mask pairs
+struct es_bit_table {
+    static const int BITS = 240;
+    imbe_bit_offset off[BITS];
     
-    return oss.str();
+    es_bit_table() {
+        for (int i = 0; i < BITS; i++) {
+            off[i].byte = imbe_ldu_ls_data_bits[i] >> 3;
+            off[i].mask = 0x80 >> (imbe_ldu_ls_data_bits[i] & 7);
+        }
+    }
+};
+
+static const es_bit_table& es_bits() {
+    static const es_bit_table table;
+    return table;
 }
 
 void P25FrameParser::parse_encryption_fields(P25Frame& frame) {
     // Only parse encryption fields for LDU2 frames that have encryption data
-    if (frame.duid != 0x0A) { // Only LDU2 frames have encryption sync data
+    if (frame.duid != static_cast<uint8_t>(P25Duid::LDU2)) { // Only LDU2 frames have encryption sync data
         return;
     }
     
-    if (frame.data.size() < 216) { // Standard P25 LDU frame is 216 bytes
+    // Unencrypted unless the encryption sync says otherwise (finish_frame reset the fields)
+    if (frame.payload_size() < 216) { // Standard P25 LDU frame is 216 bytes
         return;
     }
     
-    // Simple encryption detection - avoid complex deinterleaving for now to prevent breakage
-    // This is a simplified approach that should work for most cases
-    frame.algorithm_id = 0x80; // Default to unencrypted
-    frame.key_id = 0;
-    frame.is_encrypted = false;
+    // 24 hexbits, each sent as Hamming(10,6,3): 6 data bits then 4 parity
+    const uint8_t* payload = frame.payload();
+    const imbe_bit_offset* off = es_bits().off;
+    uint8_t hexbits[24];
+    for (int i = 0; i < 24; i++) {
+        uint32_t word = 0;
+        for (int b = 0; b < 10; b++, off++) {
+            word = (word << 1) | ((payload[off->byte] & off->mask) ? 1 : 0);
+        }
+        hexbits[i] = hmg1063Dec(word >> 4, word & 0xF);
+    }
+    
+    // RS(24,16,9): 16 data hexbits, 8 parity
+    if (P25ReedSolomon::decode(hexbits, 24, 8) < 0) {
+        return;
+    }
+    
+    // 72-bit MI, 8-bit ALGID, 16-bit KID
+    uint8_t* mi = frame.message_indicator;
+    for (int i = 0, j = 0; i < 9; i += 3, j += 4) {
+        mi[i] = (hexbits[j] << 2) | (hexbits[j + 1] >> 4);
+        mi[i + 1] = ((hexbits[j + 1] & 0x0F) << 4) | (hexbits[j + 2] >> 2);
+        mi[i + 2] = ((hexbits[j + 2] & 0x03) << 6) | hexbits[j + 3];
+    }
+    frame.algorithm_id = (hexbits[12] << 2) | (hexbits[13] >> 4);
+    frame.key_id = ((hexbits[13] & 0x0F) << 12) | (hexbits[14] << 6) | hexbits[15];
+    frame.is_encrypted = frame.algorithm_id != 0x80;
+    frame.es_valid = true;
 }
-
-// Simple Hamming(10,6,3) decoder - simplified version for extraction
-uint8_t P25FrameParser::hamming_10_6_decode(uint8_t high, uint8_t low) {
-    // This is a simplified version - production code should use full error correction
-    // For now, just extract the data bits without error correction
-    return (high << 2) | (low & 0x03);
-}
\ No newline at end of file
@@ -1,19 +1,89 @@
 #ifndef P25_FRAME_PARSER_H
 #define P25_FRAME_PARSER_H
 
+#include "dump_buffer.h"
 #include <string>
 #include <vector>
 #include <cstdint>
 #include <fstream>
 
+// Data Unit IDs as they appear in the 5-byte frame header
+enum class P25Duid : uint8_t {
+    HDU = 0x00,         // Header Data Unit
+    TDU = 0x03,         // Terminator Data Unit
+    LDU1 = 0x05,        // Logical Data Unit 1, voice + link control
+    TDU_07 = 0x07,      // reported as a TDU
+    LDU2 = 0x0A,        // Logical Data Unit 2, voice + encryption sync
+    PDU = 0x0C,         // Packet Data Unit
+    TDU_LC = 0x0F,      // Terminator with link control
+    TSBK = 0x12         // Trunking System Block
+};
+
+// Display name of every possible DUID, built at compile time so frames
+// never format one; unknown values read "Unknown DUID (n)"
+struct P25DuidNames {
+    static constexpr size_t MAX_NAME = 32;
+    char text[256][MAX_NAME];
+    
+    constexpr P25DuidNames() : text{} {
+        for (int duid = 0; duid < 256; duid++) {
+            const char* known = known_name(duid);
+            size_t n = 0;
+            if (known) {
+                while (known[n]) { text[duid][n] = known[n]; n++; }
+                continue;
+            }
+            const char prefix[] = "Unknown DUID (";
+            for (size_t i = 0; prefix[i]; i++) text[duid][n++] = prefix[i];
+            if (duid >= 100) text[duid][n++] = static_cast<char>('0' + duid / 100);
+            if (duid >= 10) text[duid][n++] = static_cast<char>('0' + duid / 10 % 10);
+            text[duid][n++] = static_cast<char>('0' + duid % 10);
+            text[duid][n++] = ')';
+        }
+    }
+    
+    static constexpr const char* known_name(int duid) {
+        switch (duid) {
+            case 0x00: return "HDU (Header Data Unit)";
+            case 0x03: return "TDU (Terminator Data Unit)";
+            case 0x05: return "LDU1 (Logical Data Unit 1)";
+            case 0x07: return "TDU (Terminator Data Unit)";
+            case 0x0A: return "LDU2 (Logical Data Unit 2)";
+            case 0x0C: return "PDU (Packet Data Unit)";
+            case 0x0F: return "TDU (Terminator Data Unit)";
+            case 0x12: return "TSBK (Trunking System Block)";
+            default: return nullptr;
+        }
+    }
+};
+
+inline constexpr P25DuidNames P25_DUID_NAMES{};
+
+constexpr const char* p25_duid_name(uint8_t duid) { return P25_DUID_NAMES.text[duid]; }
+constexpr bool p25_duid_is_voice(uint8_t duid) {
+    return duid == static_cast<uint8_t>(P25Duid::LDU1) || duid == static_cast<uint8_t>(P25Duid::LDU2);
+}
+// Ends or starts a transmission: the vocoder has nothing to carry across it
+constexpr bool p25_duid_is_boundary(uint8_t duid) {
+    return duid == static_cast<uint8_t>(P25Duid::HDU) || duid == static_cast<uint8_t>(P25Duid::TDU) ||
+           duid == static_cast<uint8_t>(P25Duid::TDU_LC);
+}
+
 struct P25Frame {
+    // LDUs are 216 bytes; anything up to this is read into the frame itself
+    static constexpr size_t INLINE_PAYLOAD = 256;
+    
     uint8_t duid;           // Data Unit ID
     uint16_t nac;           // Network Access Code  
     uint16_t length;        // Frame length in bytes
-    std::vector<uint8_t> data;  // Raw frame data
+    uint8_t inline_data[INLINE_PAYLOAD];    // Raw frame data (stream reader)
+    std::vector<uint8_t> data;  // Stream reader frames too long for inline_data
+    size_t data_size;           // bytes held in inline_data or data
+    const uint8_t* view;        // Zero-copy view into a memory-mapped file (mmap reader)
+    size_t view_size;
     
     // Parsed frame info
-    std::string frame_type_name;
+    const char* frame_type_name;    // p25_duid_name(duid), static storage
     bool is_voice_frame;
     bool is_encrypted;      // Frame contains encrypted voice data
     bool emergency_flag;    // Emergency transmission flag
@@ -21,10 +91,20 @@ struct P25Frame {
     uint32_t source_id;     // Radio source ID (if available)
     uint8_t algorithm_id;   // Algorithm ID (ALGID) for encryption
     uint16_t key_id;        // Key ID (KID) for encryption
+    uint8_t message_indicator[9]; // MI for the superframe that follows (LDU2)
+    bool es_valid;          // LDU2 encryption sync decoded (Hamming + RS corrected)
     
-    P25Frame() : duid(0), nac(0), length(0), is_voice_frame(false), 
+    P25Frame() : duid(0), nac(0), length(0), data_size(0), view(nullptr), view_size(0),
+                 frame_type_name(p25_duid_name(0)), is_voice_frame(false),
                  is_encrypted(false), emergency_flag(false), talk_group(0), source_id(0),
-                 algorithm_id(0), key_id(0) {}
+                 algorithm_id(0), key_id(0), message_indicator{0}, es_valid(false) {}
+    
+    // Frame payload regardless of reader mode. A mapped view stays valid
+    // until the parser that produced it is closed or reopened.
+    const uint8_t* payload() const {
+        return view ? view : data_size <= INLINE_PAYLOAD ? inline_data : data.data();
+    }
+    size_t payload_size() const { return view ? view_size : data_size; }
 };
 
 class P25FrameParser {
@@ -32,27 +112,61 @@ private:
     std::ifstream file_;
     std::string filename_;
     
-    // Frame type mapping
-    std::string get_frame_type_name(uint8_t duid);
+    // mmap reader state (regular files); falls back to file_ for pipes etc.
+    // Also drives open_buffer(), in which case the memory is not ours to unmap.
+    bool mmap_enabled_;
+    bool owns_mapping_;
+    const uint8_t* map_base_;
+    size_t map_size_;
+    size_t map_pos_;
+    
+    bool open_mapped(const std::string& filename);
+    bool read_frame_mapped(P25Frame& frame);
+    void finish_frame(P25Frame& frame);
     
     // Parse encryption fields from LDU2 frames
     void parse_encryption_fields(P25Frame& frame);
     
-    // Hamming decoder helper
-    uint8_t hamming_10_6_decode(uint8_t high, uint8_t low);
+    // Per-DUID work after the header is read, indexed by DUID; null for none
+    typedef void (P25FrameParser::*FrameHandler)(P25Frame& frame);
+    struct DuidHandlers {
+        FrameHandler handler[256];
+        constexpr DuidHandlers() : handler{} {
+            handler[static_cast<uint8_t>(P25Duid::LDU2)] = &P25FrameParser::parse_encryption_fields;
+        }
+    };
+    static const DuidHandlers duid_handlers_;
     
 public:
     P25FrameParser();
     ~P25FrameParser();
     
     bool open(const std::string& filename);
+    
+    // Parse frames straight out of memory; data must outlive the parser's use of it
+    bool open_buffer(const uint8_t* data, size_t size);
     void close();
     
+    // Use mmap for regular files (default on); takes effect on next open()
+    void set_mmap_enabled(bool enable) { mmap_enabled_ = enable; }
+    bool is_memory_mapped() const { return map_base_ != nullptr; }
+    
     // Read next frame from file
     bool read_frame(P25Frame& frame);
     
+    // Byte offset of the next frame, or -1 for a stream that cannot tell (pipe)
+    int64_t position();
+    // Continue reading at a frame header's offset (see FrameIndex)
+    bool seek(uint64_t offset);
+    
+    // Parse one frame (header + payload) at the start of data, for inputs that
+    // arrive in pieces. Returns the bytes it spans, or 0 if it is not all there
+    // yet. The frame's view points into data.
+    size_t parse_frame(const uint8_t* data, size_t size, P25Frame& frame);
+    
     // Parse and dump frame info as text
     std::string dump_frame_text(const P25Frame& frame);
+    void append_frame_text(const P25Frame& frame, DumpBuffer& out);
     
     // Check if file has more frames
     bool has_more_frames();
@@ -0,0 +1,191 @@
+/*
+ * Reed-Solomon coding over GF(64) for P25 link control and encryption sync
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * P25 protects the LDU1 link control and the LDU2 encryption sync with
+ * shortened RS codes over GF(2^6) (primitive polynomial x^6 + x + 1,
+ * generator roots alpha^1 .. alpha^(parity)): RS(24,12,13) and
+ * RS(24,16,9). Log/antilog tables are built once; decoding is the usual
+ * syndromes, Berlekamp-Massey, Chien search and Forney, restricted to the
+ * symbols actually sent so a shortened code needs no zero padding.
+ * encode() computes the parity, for test signals.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+class P25ReedSolomon {
+public:
+    static const int MAX_SYMBOLS = 63;
+    static const int MAX_PARITY = 16;
+
+    // Fill in the last parity symbols of codeword[0..length) from the data
+    // symbols before them, in the order decode() expects
+    static void encode(uint8_t* codeword, int length, int parity) {
+        const Tables& gf = tables();
+        if (length > MAX_SYMBOLS || parity > MAX_PARITY || parity >= length || parity <= 0) {
+            return;
+        }
+
+        // Generator g(x) = (x + alpha^1) ... (x + alpha^parity), g[i] of x^i
+        uint8_t g[MAX_PARITY + 1] = {1};
+        for (int j = 1; j <= parity; j++) {
+            for (int i = j; i > 0; i--) {
+                g[i] = g[i - 1] ^ gf.mul_exp(g[i], j);
+            }
+            g[0] = gf.mul_exp(g[0], j);
+        }
+
+        // Remainder of data(x) x^parity / g(x), highest power first
+        uint8_t remainder[MAX_PARITY] = {0};
+        for (int i = 0; i < length - parity; i++) {
+            uint8_t feedback = codeword[i] ^ remainder[0];
+            for (int k = 0; k < parity - 1; k++) {
+                remainder[k] = remainder[k + 1] ^ gf.mul(feedback, g[parity - 1 - k]);
+            }
+            remainder[parity - 1] = gf.mul(feedback, g[0]);
+        }
+        std::memcpy(codeword + length - parity, remainder, static_cast<size_t>(parity));
+    }
+
+    // Correct codeword[0..length) in place, most significant symbol first
+    // with the last parity symbols at the end. Returns the number of symbols
+    // corrected, or -1 if there are more errors than the code can fix.
+    static int decode(uint8_t* codeword, int length, int parity) {
+        const Tables& gf = tables();
+        if (length > MAX_SYMBOLS || parity > MAX_PARITY || parity >= length) {
+            return -1;
+        }
+
+        // Syndromes S_j = r(alpha^(j+1)), Horner's rule
+        uint8_t syndrome[MAX_PARITY];
+        bool clean = true;
+        for (int j = 0; j < parity; j++) {
+            uint8_t s = codeword[0];
+            for (int i = 1; i < length; i++) {
+                s = gf.mul_exp(s, j + 1) ^ codeword[i];
+            }
+            syndrome[j] = s;
+            clean = clean && s == 0;
+        }
+        if (clean) {
+            return 0;
+        }
+
+        // Berlekamp-Massey: error locator lambda(x)
+        uint8_t lambda[MAX_PARITY + 1] = {1};
+        uint8_t previous[MAX_PARITY + 1] = {1};
+        int errors = 0;
+        int shift = 1;
+        uint8_t previous_discrepancy = 1;
+        for (int n = 0; n < parity; n++) {
+            uint8_t discrepancy = syndrome[n];
+            for (int i = 1; i <= errors; i++) {
+                discrepancy ^= gf.mul(lambda[i], syndrome[n - i]);
+            }
+            if (discrepancy == 0) {
+                shift++;
+                continue;
+            }
+            uint8_t scale = gf.div(discrepancy, previous_discrepancy);
+            uint8_t saved[MAX_PARITY + 1];
+            std::memcpy(saved, lambda, sizeof(saved));
+            for (int i = 0; i + shift <= parity; i++) {
+                lambda[i + shift] ^= gf.mul(scale, previous[i]);
+            }
+            if (2 * errors <= n) {
+                errors = n + 1 - errors;
+                std::memcpy(previous, saved, sizeof(previous));
+                previous_discrepancy = discrepancy;
+                shift = 1;
+            } else {
+                shift++;
+            }
+        }
+        if (errors > parity / 2) {
+            return -1;
+        }
+
+        // Error evaluator omega(x) = S(x) lambda(x) mod x^parity
+        uint8_t omega[MAX_PARITY] = {0};
+        for (int i = 0; i < parity; i++) {
+            for (int k = 0; k <= errors && k <= i; k++) {
+                omega[i] ^= gf.mul(lambda[k], syndrome[i - k]);
+            }
+        }
+
+        // Chien search over the transmitted positions; symbol i sits at x^(length-1-i)
+        int found = 0;
+        int positions[MAX_PARITY];
+        uint8_t values[MAX_PARITY];
+        for (int i = 0; i < length && found <= errors; i++) {
+            int inverse = (63 - (length - 1 - i)) % 63;   // log of X^-1
+            uint8_t sum = 0;
+            for (int k = 0; k <= errors; k++) {
+                sum ^= gf.mul_exp(lambda[k], (inverse * k) % 63);
+            }
+            if (sum != 0) {
+                continue;
+            }
+            // Forney with first root alpha^1: e = omega(X^-1) / lambda'(X^-1)
+            uint8_t numerator = 0;
+            for (int k = 0; k < parity; k++) {
+                numerator ^= gf.mul_exp(omega[k], (inverse * k) % 63);
+            }
+            uint8_t denominator = 0;
+            for (int k = 1; k <= errors; k += 2) {
+                denominator ^= gf.mul_exp(lambda[k], (inverse * (k - 1)) % 63);
+            }
+            if (denominator == 0 || found == errors) {
+                return -1;
+            }
+            positions[found] = i;
+            values[found] = gf.div(numerator, denominator);
+            found++;
+        }
+        if (found != errors) {
+            return -1;   // locator roots outside the shortened code
+        }
+        for (int k = 0; k < found; k++) {
+            codeword[positions[k]] ^= values[k];
+        }
+        return found;
+    }
+
+private:
+    struct Tables {
+        uint8_t exp[126];   // doubled so products need no modulo
+        uint8_t log[64];
+
+        Tables() {
+            uint8_t x = 1;
+            for (int i = 0; i < 63; i++) {
+                exp[i] = exp[i + 63] = x;
+                log[x] = static_cast<uint8_t>(i);
+                x <<= 1;
+                if (x & 0x40) {
+                    x ^= 0x43;   // x^6 + x + 1
+                }
+            }
+            log[0] = 0;
+        }
+
+        uint8_t mul(uint8_t a, uint8_t b) const {
+            return (a && b) ? exp[log[a] + log[b]] : 0;
+        }
+        uint8_t mul_exp(uint8_t a, int power) const {
+            return a ? exp[log[a] + power] : 0;
+        }
+        uint8_t div(uint8_t a, uint8_t b) const {
+            return (a && b) ? exp[log[a] + 63 - log[b]] : 0;
+        }
+    };
+
+    static const Tables& tables() {
+        static const Tables gf;
+        return gf;
+    }
+};
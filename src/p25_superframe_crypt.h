@@ -0,0 +1,40 @@
+/*
+ * Superframe keystream layout shared by the P25 decryptors
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * A superframe is an LDU1 and an LDU2, 9 IMBE codewords each. The bytes of
+ * keystream every codeword is XORed with are fixed once the keystream for
+ * an MI has been generated, so prepare() gathers them into one 198-byte
+ * mask and a whole superframe decrypts with a single XOR pass.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define P25_SUPERFRAME_CODEWORDS 18
+#define P25_IMBE_CODEWORD_BYTES 11
+#define P25_SUPERFRAME_BYTES (P25_SUPERFRAME_CODEWORDS * P25_IMBE_CODEWORD_BYTES)
+
+// first_offset is where LDU1's first codeword starts in the keystream; the
+// 9th codeword of each LDU skips two bytes and LDU2 starts 101 bytes later
+inline void p25_build_superframe_mask(const uint8_t* keystream, size_t first_offset, uint8_t* mask) {
+    for (int ldu = 0; ldu < 2; ldu++) {
+        for (int frame = 0; frame < 9; frame++) {
+            size_t offset = first_offset + (ldu ? 101 : 0) + frame * P25_IMBE_CODEWORD_BYTES + (frame < 8 ? 0 : 2);
+            const uint8_t* source = keystream + offset;
+            uint8_t* target = mask + (ldu * 9 + frame) * P25_IMBE_CODEWORD_BYTES;
+            for (int j = 0; j < P25_IMBE_CODEWORD_BYTES; j++) {
+                target[j] = source[j];
+            }
+        }
+    }
+}
+
+inline void p25_xor_superframe(uint8_t* codewords, const uint8_t* mask) {
+    for (int i = 0; i < P25_SUPERFRAME_BYTES; i++) {
+        codewords[i] ^= mask[i];
+    }
+}
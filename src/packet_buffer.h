@@ -0,0 +1,191 @@
+/*
+ * Pooled, reference-counted packet payloads
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * PacketPool carves one slab into fixed-size slots. A PacketBuffer is a
+ * shared handle to one slot: copying it only bumps a reference count, so
+ * input plugins, the router, ring buffers and output plugins all see the
+ * same bytes. The slot goes back to the pool when the last handle is
+ * dropped. Payloads larger than a slot, or requested while the pool is
+ * exhausted, fall back to a heap block with the same semantics.
+ */
+
+#pragma once
+
+#include "mpmc_ring.h"
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+class PacketPool;
+
+class PacketBuffer {
+public:
+    PacketBuffer() : header_(nullptr) {}
+    PacketBuffer(const PacketBuffer& other) : header_(other.header_) { retain(); }
+    PacketBuffer(PacketBuffer&& other) noexcept : header_(other.header_) { other.header_ = nullptr; }
+    ~PacketBuffer() { reset(); }
+
+    PacketBuffer& operator=(const PacketBuffer& other) {
+        if (header_ != other.header_) {
+            reset();
+            header_ = other.header_;
+            retain();
+        }
+        return *this;
+    }
+
+    PacketBuffer& operator=(PacketBuffer&& other) noexcept {
+        if (this != &other) {
+            reset();
+            header_ = other.header_;
+            other.header_ = nullptr;
+        }
+        return *this;
+    }
+
+    // Unpooled copy, for producers without a pool
+    static PacketBuffer copy_of(const uint8_t* data, size_t size) {
+        PacketBuffer buffer = allocate_heap(size);
+        if (size > 0) {
+            std::memcpy(buffer.header_->data, data, size);
+        }
+        return buffer;
+    }
+
+    const uint8_t* data() const { return header_ ? header_->data : nullptr; }
+    size_t size() const { return header_ ? header_->size : 0; }
+    bool empty() const { return size() == 0; }
+    const uint8_t& operator[](size_t i) const { return header_->data[i]; }
+    const uint8_t* begin() const { return data(); }
+    const uint8_t* end() const { return data() + size(); }
+
+    // Number of handles sharing this payload (0 for an empty buffer)
+    uint32_t use_count() const { return header_ ? header_->refs.load(std::memory_order_relaxed) : 0; }
+    bool is_pooled() const { return header_ && header_->pool; }
+
+    void reset();
+
+private:
+    friend class PacketPool;
+
+    struct Header {
+        std::atomic<uint32_t> refs;
+        uint32_t index;
+        size_t size;
+        uint8_t* data;
+        std::shared_ptr<PacketPool> pool;  // null for heap blocks; keeps the slab alive
+    };
+
+    explicit PacketBuffer(Header* header) : header_(header) {}
+
+    void retain() {
+        if (header_) {
+            header_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    static PacketBuffer allocate_heap(size_t size) {
+        void* block = ::operator new(sizeof(Header) + size);
+        Header* header = new (block) Header();
+        header->refs.store(1, std::memory_order_relaxed);
+        header->index = 0;
+        header->size = size;
+        header->data = static_cast<uint8_t*>(block) + sizeof(Header);
+        return PacketBuffer(header);
+    }
+
+    Header* header_;
+};
+
+class PacketPool : public std::enable_shared_from_this<PacketPool> {
+public:
+    static std::shared_ptr<PacketPool> create(size_t slot_size, size_t slot_count) {
+        return std::shared_ptr<PacketPool>(new PacketPool(slot_size, slot_count));
+    }
+
+    ~PacketPool() {
+        ::operator delete(slab_);
+    }
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    // Copy size bytes into a pooled slot (or a heap block if none fits)
+    PacketBuffer copy(const uint8_t* data, size_t size) {
+        uint32_t index;
+        if (size > slot_size_ || !free_slots_.try_pop(index)) {
+            heap_fallbacks_.fetch_add(1, std::memory_order_relaxed);
+            return PacketBuffer::copy_of(data, size);
+        }
+
+        uint8_t* slot = slab_ + static_cast<size_t>(index) * stride_;
+        PacketBuffer::Header* header = new (slot) PacketBuffer::Header();
+        header->refs.store(1, std::memory_order_relaxed);
+        header->index = index;
+        header->size = size;
+        header->data = slot + header_size();
+        header->pool = shared_from_this();
+        if (size > 0) {
+            std::memcpy(header->data, data, size);
+        }
+        return PacketBuffer(header);
+    }
+
+    size_t slot_size() const { return slot_size_; }
+    size_t slot_count() const { return slot_count_; }
+    size_t available() const { return free_slots_.size(); }
+    uint64_t heap_fallbacks() const { return heap_fallbacks_.load(std::memory_order_relaxed); }
+
+private:
+    friend class PacketBuffer;
+
+    PacketPool(size_t slot_size, size_t slot_count)
+        : slot_size_(slot_size), slot_count_(slot_count > 0 ? slot_count : 1),
+          // Cache-line sized slots so neighbouring packets never share a line
+          stride_((header_size() + slot_size + 63) & ~static_cast<size_t>(63)),
+          slab_(static_cast<uint8_t*>(::operator new(stride_ * slot_count_))),
+          free_slots_(slot_count_), heap_fallbacks_(0) {
+        for (size_t i = 0; i < slot_count_; i++) {
+            free_slots_.try_push(static_cast<uint32_t>(i));
+        }
+    }
+
+    static constexpr size_t header_size() {
+        return (sizeof(PacketBuffer::Header) + 15) & ~static_cast<size_t>(15);
+    }
+
+    void release(uint32_t index) {
+        free_slots_.try_push(index);
+    }
+
+    const size_t slot_size_;
+    const size_t slot_count_;
+    const size_t stride_;
+    uint8_t* slab_;
+    MPMCRing<uint32_t> free_slots_;
+    std::atomic<uint64_t> heap_fallbacks_;
+};
+
+inline void PacketBuffer::reset() {
+    if (!header_) {
+        return;
+    }
+    if (header_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (header_->pool) {
+            // Hold the pool until the slot is back on its free list
+            std::shared_ptr<PacketPool> pool = std::move(header_->pool);
+            uint32_t index = header_->index;
+            header_->~Header();
+            pool->release(index);
+        } else {
+            header_->~Header();
+            ::operator delete(header_);
+        }
+    }
+    header_ = nullptr;
+}
@@ -0,0 +1,306 @@
+/*
+ * Live PCM delivery to streaming plugins
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Decoders hand their audio to plugins' audio_stream() hook as it is
+ * synthesised, one LDU (1440 samples, 180 ms) per chunk, without waiting
+ * for the WAV file. Every decoder gets a PcmPublisher, and every publisher
+ * has its own single-producer/single-consumer ring per subscribed plugin,
+ * so the decoder thread never shares a ring with another producer and
+ * never takes a lock to publish. Each plugin is fed from its rings by its
+ * own thread.
+ *
+ * A full ring drops the chunk and counts it rather than blocking decode;
+ * a slow plugin loses audio, never the pipeline. Plugins subscribe
+ * before start() and before any publisher is made.
+ */
+
+#pragma once
+
+#include "plugin_api.h"
+#include "p25_decoder.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class PcmRing {
+public:
+    static constexpr size_t CHUNK_SAMPLES = P25Decoder::SAMPLES_PER_LDU;
+
+    struct Chunk {
+        std::shared_ptr<const Call_Data_t> call;
+        size_t count;
+        int16_t samples[CHUNK_SAMPLES];
+    };
+
+    explicit PcmRing(size_t capacity)
+        : capacity_(capacity > 0 ? capacity : 1), slots_(new Chunk[capacity_]),
+          head_(0), tail_(0), dropped_(0) {}
+
+    PcmRing(const PcmRing&) = delete;
+    PcmRing& operator=(const PcmRing&) = delete;
+
+    // Producer only; false (and counted) when the consumer is too far behind
+    bool try_push(const std::shared_ptr<const Call_Data_t>& call, const int16_t* samples, size_t count) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= capacity_) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Chunk& chunk = slots_[tail % capacity_];
+        chunk.call = call;
+        chunk.count = count;
+        memcpy(chunk.samples, samples, count * sizeof(int16_t));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only; the chunk stays valid until pop()
+    Chunk* front() {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots_[head % capacity_];
+    }
+
+    void pop() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    const size_t capacity_;
+    std::unique_ptr<Chunk[]> slots_;
+    alignas(64) std::atomic<uint64_t> head_;
+    alignas(64) std::atomic<uint64_t> tail_;
+    std::atomic<uint64_t> dropped_;
+};
+
+// A feeder thread's wakeup; publishers only lock it while the feeder is parked
+struct PcmWake {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<bool> parked{false};
+};
+
+// One per decoder; used only by the thread holding that decoder
+class PcmPublisher {
+public:
+    // Chunks published until end_call() are delivered against this call
+    void begin_call(std::shared_ptr<const Call_Data_t> call) { call_ = std::move(call); }
+    void end_call() { call_.reset(); }
+    bool in_call() const { return static_cast<bool>(call_); }
+
+    // Split into LDU-sized chunks and offer each to every subscriber
+    inline void publish(const int16_t* samples, size_t count);
+
+private:
+    friend class PcmStreamHub;
+    struct Target {
+        std::shared_ptr<PcmRing> ring;
+        std::shared_ptr<PcmWake> wake;
+    };
+
+    PcmPublisher() = default;
+
+    std::vector<std::shared_ptr<Target>> targets_;
+    std::shared_ptr<const Call_Data_t> call_;
+};
+
+class PcmStreamHub {
+public:
+    // About 11.5 s of audio per publisher before a stalled plugin drops chunks
+    static constexpr size_t DEFAULT_RING_CHUNKS = 64;
+
+    explicit PcmStreamHub(bool verbose = false) : verbose_(verbose), running_(false) {}
+    ~PcmStreamHub() { stop(); }
+
+    PcmStreamHub(const PcmStreamHub&) = delete;
+    PcmStreamHub& operator=(const PcmStreamHub&) = delete;
+
+    void subscribe(const std::string& name, boost::shared_ptr<Plugin_Api> plugin,
+                   size_t ring_chunks = DEFAULT_RING_CHUNKS) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto subscriber = std::make_shared<Subscriber>();
+        subscriber->name = name;
+        subscriber->plugin = plugin;
+        subscriber->ring_chunks = ring_chunks;
+        subscribers_.push_back(subscriber);
+    }
+
+    bool has_subscribers() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !subscribers_.empty();
+    }
+
+    // A publisher with a fresh ring to every current subscriber
+    std::shared_ptr<PcmPublisher> make_publisher() {
+        std::shared_ptr<PcmPublisher> publisher(new PcmPublisher());
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& subscriber : subscribers_) {
+            auto target = std::make_shared<PcmPublisher::Target>();
+            target->wake = subscriber->wake;
+            target->ring = std::make_shared<PcmRing>(subscriber->ring_chunks);
+            publisher->targets_.push_back(target);
+
+            // Copy on write: the feeder thread walks its list without the lock
+            auto rings = std::make_shared<std::vector<std::shared_ptr<PcmRing>>>(
+                *std::atomic_load(&subscriber->rings));
+            rings->push_back(target->ring);
+            std::atomic_store(&subscriber->rings,
+                              std::shared_ptr<const std::vector<std::shared_ptr<PcmRing>>>(rings));
+        }
+        return publisher;
+    }
+
+    void start() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_) {
+            return;
+        }
+        running_ = true;
+        for (const auto& subscriber : subscribers_) {
+            subscriber->stopping.store(false);
+            subscriber->thread = std::thread(&PcmStreamHub::feed, this, subscriber);
+        }
+    }
+
+    void stop() {
+        std::vector<std::shared_ptr<Subscriber>> subscribers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_) {
+                return;
+            }
+            running_ = false;
+            subscribers = subscribers_;
+        }
+        for (const auto& subscriber : subscribers) {
+            {
+                std::lock_guard<std::mutex> lock(subscriber->wake->mutex);
+                subscriber->stopping.store(true);
+            }
+            subscriber->wake->condition.notify_all();
+            if (subscriber->thread.joinable()) {
+                subscriber->thread.join();
+            }
+        }
+    }
+
+    json get_stats() const {
+        json stats = json::object();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& subscriber : subscribers_) {
+            uint64_t dropped = 0;
+            auto rings = std::atomic_load(&subscriber->rings);
+            for (const auto& ring : *rings) {
+                dropped += ring->dropped();
+            }
+            stats[subscriber->name] = {
+                {"chunks_delivered", subscriber->delivered.load()},
+                {"chunks_dropped", dropped},
+                {"publishers", rings->size()}
+            };
+        }
+        return stats;
+    }
+
+private:
+    struct Subscriber {
+        std::string name;
+        boost::shared_ptr<Plugin_Api> plugin;
+        size_t ring_chunks = DEFAULT_RING_CHUNKS;
+        std::shared_ptr<const std::vector<std::shared_ptr<PcmRing>>> rings =
+            std::make_shared<const std::vector<std::shared_ptr<PcmRing>>>();
+        std::atomic<uint64_t> delivered{0};
+        std::shared_ptr<PcmWake> wake = std::make_shared<PcmWake>();
+        std::atomic<bool> stopping{false};
+        std::thread thread;
+    };
+
+    void feed(std::shared_ptr<Subscriber> subscriber) {
+        while (true) {
+            bool delivered = false;
+            auto rings = std::atomic_load(&subscriber->rings);
+            // Round-robin one chunk per ring so a busy decoder cannot starve the others
+            for (const auto& ring : *rings) {
+                PcmRing::Chunk* chunk = ring->front();
+                if (!chunk) {
+                    continue;
+                }
+                try {
+                    // The hook takes mutable pointers; plugins treat both as read-only
+                    subscriber->plugin->audio_stream(const_cast<Call_Data_t*>(chunk->call.get()),
+                                                     chunk->samples, static_cast<int>(chunk->count));
+                } catch (const std::exception& e) {
+                    if (verbose_) {
+                        std::cerr << "[PcmStreamHub] " << subscriber->name << " audio_stream failed: "
+                                  << e.what() << std::endl;
+                    }
+                }
+                ring->pop();
+                subscriber->delivered.fetch_add(1, std::memory_order_relaxed);
+                delivered = true;
+            }
+            if (delivered) {
+                continue;
+            }
+
+            PcmWake& wake = *subscriber->wake;
+            std::unique_lock<std::mutex> lock(wake.mutex);
+            if (subscriber->stopping.load()) {
+                break;
+            }
+            wake.parked.store(true);
+            // Pairs with the fence in publish(): either it sees parked or we see its chunk
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool empty = true;
+            for (const auto& ring : *rings) {
+                if (ring->front()) {
+                    empty = false;
+                    break;
+                }
+            }
+            if (empty) {
+                // The timeout also picks up rings added since the snapshot
+                wake.condition.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            wake.parked.store(false);
+        }
+    }
+
+    bool verbose_;
+    bool running_;
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<Subscriber>> subscribers_;
+};
+
+inline void PcmPublisher::publish(const int16_t* samples, size_t count) {
+    if (!call_ || targets_.empty()) {
+        return;
+    }
+    for (const auto& target : targets_) {
+        bool pushed = false;
+        for (size_t offset = 0; offset < count; offset += PcmRing::CHUNK_SAMPLES) {
+            size_t length = std::min(PcmRing::CHUNK_SAMPLES, count - offset);
+            pushed |= target->ring->try_push(call_, samples + offset, length);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (pushed && target->wake->parked.load()) {
+            std::lock_guard<std::mutex> lock(target->wake->mutex);
+            target->wake->condition.notify_one();
+        }
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * Perfect hash index over 32-bit keys
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Hash and displace: keys are hashed into buckets of about four, and each
+ * bucket, largest first, is given the smallest displacement that puts all
+ * its keys into slots nobody has taken yet. A lookup is then two hashes,
+ * one displacement read and one key compare, with no probing and no
+ * collisions, however the keys fall. Slots are sized for a load of 0.8 so
+ * building stays fast; a key that was never added lands on a slot holding
+ * some other key (or none) and the compare turns it away.
+ *
+ * Built once and read-only after, so any number of threads can look up.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+class PerfectHashIndex {
+public:
+    static constexpr int32_t NOT_FOUND = -1;
+
+    // keys must be distinct; lookup() returns a key's position in keys
+    bool build(const std::vector<uint32_t>& keys) {
+        size_t slots = keys.size() + keys.size() / 4 + 1;
+        for (int attempt = 0; attempt < 8; attempt++, slots += slots / 2) {
+            if (try_build(keys, slots)) {
+                return true;
+            }
+        }
+        displacements_.clear();
+        slots_.clear();
+        return false;
+    }
+
+    int32_t lookup(uint32_t key) const {
+        if (slots_.empty()) {
+            return NOT_FOUND;
+        }
+        uint32_t d = displacements_[reduce(mix(key, 0), displacements_.size())];
+        const Slot& slot = slots_[reduce(mix(key, d + 1), slots_.size())];
+        return (slot.index != NOT_FOUND && slot.key == key) ? slot.index : NOT_FOUND;
+    }
+
+    size_t size() const { return slots_.size(); }
+
+private:
+    struct Slot {
+        uint32_t key;
+        int32_t index;
+    };
+
+    static constexpr uint32_t MAX_DISPLACEMENT = 1u << 20;
+
+    static uint32_t mix(uint32_t key, uint32_t seed) {
+        uint64_t h = (static_cast<uint64_t>(seed) << 32 | key) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 32;
+        return static_cast<uint32_t>(h);
+    }
+
+    // h scaled into [0, n) without a division
+    static size_t reduce(uint32_t h, size_t n) {
+        return static_cast<size_t>((static_cast<uint64_t>(h) * n) >> 32);
+    }
+
+    bool try_build(const std::vector<uint32_t>& keys, size_t slot_count) {
+        const size_t bucket_count = std::max<size_t>(1, keys.size() / 4);
+        std::vector<std::vector<int32_t>> buckets(bucket_count);
+        for (size_t i = 0; i < keys.size(); i++) {
+            buckets[reduce(mix(keys[i], 0), bucket_count)].push_back(static_cast<int32_t>(i));
+        }
+        std::vector<size_t> order(bucket_count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        displacements_.assign(bucket_count, 0);
+        slots_.assign(slot_count, Slot{0, NOT_FOUND});
+        std::vector<size_t> placed;
+        for (size_t b : order) {
+            const std::vector<int32_t>& bucket = buckets[b];
+            if (bucket.empty()) {
+                break;
+            }
+            uint32_t d = 0;
+            for (; d < MAX_DISPLACEMENT; d++) {
+                placed.clear();
+                bool fits = true;
+                for (int32_t index : bucket) {
+                    size_t slot = reduce(mix(keys[index], d + 1), slot_count);
+                    if (slots_[slot].index != NOT_FOUND ||
+                        std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+                        fits = false;
+                        break;
+                    }
+                    placed.push_back(slot);
+                }
+                if (fits) {
+                    break;
+                }
+            }
+            if (d == MAX_DISPLACEMENT) {
+                return false;   // duplicate keys, or too few slots
+            }
+            displacements_[b] = d;
+            for (size_t i = 0; i < bucket.size(); i++) {
+                slots_[placed[i]] = Slot{keys[bucket[i]], bucket[i]};
+            }
+        }
+        return true;
+    }
+
+    std::vector<uint32_t> displacements_;
+    std::vector<Slot> slots_;
+};
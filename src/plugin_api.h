@@ -15,13 +15,21 @@
 #include <boost/dll/alias.hpp>
 #include <boost/shared_ptr.hpp>
 #include <nlohmann/json.hpp>
+#include "packet_buffer.h"
+#include "event_notifier.h"
 
 using json = nlohmann::json;
 
+// Call plugin API revision a plugin was built against, exported by
+// TRUNK_DECODER_PLUGIN_FACTORY. 2 adds the CallRecord hooks; a library
+// without the export is version 1 and only gets the by-value hooks.
+#define TRUNK_DECODER_PLUGIN_API_VERSION 2
+
 // Forward declarations
 struct Call_Data_t;
 struct System_Info;
 struct P25_TSBK_Data;
+class TrunkingState;
 
 // Plugin lifecycle states
 enum class Plugin_State {
@@ -44,6 +52,13 @@ struct Call_Data_t {
     bool encrypted;
     bool emergency;
     
+    // Voice quality from the decoder's FEC, for dropping garbage calls
+    double bad_frame_rate;   // share of IMBE frames repeated or muted
+    double bit_error_rate;   // corrected bits over channel bits
+    
+    // Length of the decoded audio in seconds, from its sample count; 0 if unknown
+    double audio_duration;
+    
     // System info
     std::string system_short_name;
     std::string system_name;
@@ -53,11 +68,23 @@ struct Call_Data_t {
     uint8_t site_id;
     std::string site_name;
     
+    // Directory names from the talkgroup and unit files (call_enrichment.h);
+    // empty when not listed
+    std::string talkgroup_alpha_tag;
+    std::string talkgroup_description;
+    std::string talkgroup_tag;
+    std::string talkgroup_group;
+    std::string source_alias;
+    
     // File paths
     char wav_filename[512];
     char json_filename[512];
     std::map<std::string, std::string> converted_files; // format -> filepath
     
+    // Formats encoded in-process, shared by every plugin; a format may be
+    // here without a file when the job manager was told not to persist it
+    std::map<std::string, std::shared_ptr<const std::vector<uint8_t>>> encoded_audio;
+    
     // Rich metadata
     json call_json;
     
@@ -68,6 +95,7 @@ struct Call_Data_t {
     
     Call_Data_t() : talkgroup(0), source_id(0), call_num(0), freq(0.0),
                    start_time(0), stop_time(0), encrypted(false), emergency(false),
+                   bad_frame_rate(0.0), bit_error_rate(0.0), audio_duration(0.0),
                    nac(0), wacn(0), rfss(0), site_id(0), priority(1) {
         wav_filename[0] = '\0';
         json_filename[0] = '\0';
@@ -75,6 +103,10 @@ struct Call_Data_t {
     }
 };
 
+// A finished call as handed to plugins: built once and shared, never
+// modified after, so every plugin reads the same copy
+typedef Call_Data_t CallRecord;
+
 // System information
 struct System_Info {
     std::string short_name;
@@ -98,7 +130,7 @@ struct P25_TSBK_Data {
     uint32_t sample_rate;        // Sample rate of data
     uint16_t data_length;        // Length of P25 data
     uint16_t checksum;           // Simple integrity check
-    std::vector<uint8_t> tsbk_data; // Raw P25 TSBK data
+    PacketBuffer tsbk_data;      // Raw P25 TSBK data, shared between copies
     
     // Derived/processed fields
     std::string source_name;     // Input plugin name
@@ -139,11 +171,23 @@ public:
     virtual std::string get_plugin_author() = 0;
     virtual std::string get_plugin_description() = 0;
     
+    // Talkgroup/unit state decoded from the control channel (trunking_state.h),
+    // handed over before init(); null when the core runs without it
+    virtual void set_trunking_state(std::shared_ptr<const TrunkingState> state) { trunking_state_ = std::move(state); }
+    
+    // Version 2 call hooks: the record is shared by every plugin, so nothing
+    // is copied per plugin. Keep the pointer to hold on to the call past
+    // the hook. The defaults copy it into the by-value hooks above, so
+    // plugins written against version 1 keep working unchanged.
+    virtual int call_record_end(std::shared_ptr<const CallRecord> call) { return call_end(*call); }
+    virtual int call_record_ready(std::shared_ptr<const CallRecord> call) { return call_data_ready(*call); }
+    
 protected:
     Plugin_State state_ = Plugin_State::PLUGIN_UNINITIALIZED;
     json config_;
     std::string plugin_name_;
     bool enabled_ = true;
+    std::shared_ptr<const TrunkingState> trunking_state_;
 };
 
 // Plugin factory function typedef
@@ -155,7 +199,9 @@ typedef boost::shared_ptr<Plugin_Api> pluginapi_create_t();
     static boost::shared_ptr<Plugin_Api> create_plugin() { \
         return boost::shared_ptr<Plugin_Api>(new PluginClass()); \
     } \
-    BOOST_DLL_ALIAS(create_plugin, create_plugin)
+    BOOST_DLL_ALIAS(create_plugin, create_plugin) \
+    static int plugin_api_version() { return TRUNK_DECODER_PLUGIN_API_VERSION; } \
+    BOOST_DLL_ALIAS(plugin_api_version, plugin_api_version)
 
 #define PLUGIN_INFO(name, version, author, description) \
     virtual std::string get_plugin_name() override { return name; } \
@@ -174,6 +220,9 @@ public:
     virtual bool is_enabled() override { return enabled_; }
     
     virtual int call_start(Call_Data_t* call_info) override { return 0; }
+    // Version 2 plugins override call_record_end()/call_record_ready() instead
+    virtual int call_end(Call_Data_t call_info) override { return 0; }
+    virtual int call_data_ready(Call_Data_t call_info) override { return 0; }
     virtual int audio_stream(Call_Data_t* call_info, int16_t* samples, int sample_count) override { return 0; }
     virtual int system_started(System_Info system_info) override { return 0; }
     virtual int system_stopped(System_Info system_info) override { return 0; }
@@ -215,7 +264,11 @@ public:
     // Input-specific methods
     virtual bool has_data() = 0;  // Check if data is available
     virtual P25_TSBK_Data get_data() = 0;  // Get next TSBK data packet
-    virtual void set_data_callback(std::function<void(P25_TSBK_Data)> callback) = 0;  // Set callback for async data
+    virtual void set_data_callback(std::function<void(const P25_TSBK_Data&)> callback) = 0;  // Set callback for async data
+    
+    // Readiness fd (eventfd) that becomes readable when has_data() turns true,
+    // or -1 if the plugin only delivers through the data callback
+    virtual int get_event_fd() { return -1; }
     
 protected:
     Plugin_State state_ = Plugin_State::PLUGIN_UNINITIALIZED;
@@ -241,9 +294,28 @@ public:
         return stats;
     }
     
+    virtual int get_event_fd() override { return data_ready_ ? data_ready_->fd() : -1; }
+    
 protected:
     void set_state(Plugin_State state) { state_ = state; }
-    std::function<void(P25_TSBK_Data)> data_callback_;
+    
+    // Call from init() to hand queued data to the core through get_event_fd()
+    // instead of invoking the data callback from the plugin's own threads
+    void enable_event_notifier() {
+        if (!data_ready_) {
+            data_ready_ = std::make_unique<EventNotifier>();
+        }
+    }
+    
+    // Signal that get_data() has something; no-op without a notifier
+    void notify_data_ready() {
+        if (data_ready_) {
+            data_ready_->notify();
+        }
+    }
+    
+    std::function<void(const P25_TSBK_Data&)> data_callback_;
+    std::unique_ptr<EventNotifier> data_ready_;
 };
 
 // Output Plugin API Interface
@@ -270,13 +342,31 @@ public:
     
     // Output-specific methods
     virtual int process_data(const P25_TSBK_Data& data) = 0;  // Process incoming data
+    
+    // A run of packets from the router's queue, in order. Returns how many
+    // failed (0 for all processed); override to take one lock or write
+    // once per batch instead of per packet.
+    virtual size_t process_batch(const P25_TSBK_Data* const* packets, size_t count) {
+        size_t failed = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (process_data(*packets[i]) != 0) {
+                failed++;
+            }
+        }
+        return failed;
+    }
     virtual int flush() = 0;  // Flush any buffered data
     virtual bool is_ready() = 0;  // Check if ready to accept data
     
+    // Talkgroup/unit state decoded from the control channel (trunking_state.h),
+    // handed over before init(); null when the core runs without it
+    virtual void set_trunking_state(std::shared_ptr<const TrunkingState> state) { trunking_state_ = std::move(state); }
+    
 protected:
     Plugin_State state_ = Plugin_State::PLUGIN_UNINITIALIZED;
     json config_;
     bool enabled_ = true;
+    std::shared_ptr<const TrunkingState> trunking_state_;
 };
 
 // Base output plugin implementation
@@ -0,0 +1,662 @@
+#include "plugin_host.h"
+#include "plugin_manager.h"
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// Fixed part of a TSBK record; the source name and packet bytes follow
+struct TsbkRecordHeader {
+    uint64_t timestamp_us;
+    uint64_t received_time;
+    double frequency;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence_number;
+    uint32_t system_id;
+    uint32_t site_id;
+    uint32_t sample_rate;
+    uint16_t data_length;
+    uint16_t checksum;
+    uint16_t source_length;
+    uint16_t reserved;
+};
+
+// Packets handed to the hosted plugin in one process_batch()
+const size_t HOST_BATCH_SIZE = 256;
+
+json call_to_json(const Call_Data_t& call) {
+    json j;
+    j["talkgroup"] = call.talkgroup;
+    j["source_id"] = call.source_id;
+    j["call_num"] = call.call_num;
+    j["freq"] = call.freq;
+    j["start_time"] = call.start_time;
+    j["stop_time"] = call.stop_time;
+    j["encrypted"] = call.encrypted;
+    j["emergency"] = call.emergency;
+    j["bad_frame_rate"] = call.bad_frame_rate;
+    j["bit_error_rate"] = call.bit_error_rate;
+    j["audio_duration"] = call.audio_duration;
+    j["system_short_name"] = call.system_short_name;
+    j["system_name"] = call.system_name;
+    j["nac"] = call.nac;
+    j["wacn"] = call.wacn;
+    j["rfss"] = call.rfss;
+    j["site_id"] = call.site_id;
+    j["site_name"] = call.site_name;
+    j["wav_filename"] = call.wav_filename;
+    j["json_filename"] = call.json_filename;
+    j["converted_files"] = call.converted_files;
+    j["call_json"] = call.call_json;
+    j["stream_name"] = call.stream_name;
+    j["priority"] = call.priority;
+    return j;
+}
+
+void call_from_json(const json& j, Call_Data_t& call) {
+    call.talkgroup = j.value("talkgroup", 0L);
+    call.source_id = j.value("source_id", 0L);
+    call.call_num = j.value("call_num", 0L);
+    call.freq = j.value("freq", 0.0);
+    call.start_time = j.value("start_time", 0L);
+    call.stop_time = j.value("stop_time", 0L);
+    call.encrypted = j.value("encrypted", false);
+    call.emergency = j.value("emergency", false);
+    call.bad_frame_rate = j.value("bad_frame_rate", 0.0);
+    call.bit_error_rate = j.value("bit_error_rate", 0.0);
+    call.audio_duration = j.value("audio_duration", 0.0);
+    call.system_short_name = j.value("system_short_name", std::string());
+    call.system_name = j.value("system_name", std::string());
+    call.nac = j.value("nac", static_cast<uint16_t>(0));
+    call.wacn = j.value("wacn", 0u);
+    call.rfss = j.value("rfss", static_cast<uint8_t>(0));
+    call.site_id = j.value("site_id", static_cast<uint8_t>(0));
+    call.site_name = j.value("site_name", std::string());
+    std::string wav = j.value("wav_filename", std::string());
+    std::string meta = j.value("json_filename", std::string());
+    snprintf(call.wav_filename, sizeof(call.wav_filename), "%s", wav.c_str());
+    snprintf(call.json_filename, sizeof(call.json_filename), "%s", meta.c_str());
+    if (j.contains("converted_files") && j["converted_files"].is_object()) {
+        call.converted_files = j["converted_files"].get<std::map<std::string, std::string>>();
+    }
+    if (j.contains("call_json")) {
+        call.call_json = j["call_json"];
+    }
+    call.stream_name = j.value("stream_name", std::string());
+    call.priority = j.value("priority", 1);
+}
+
+void notify_fd(int fd) {
+    uint64_t one = 1;
+    ssize_t ret;
+    do {
+        ret = write(fd, &one, sizeof(one));
+    } while (ret < 0 && errno == EINTR);
+}
+
+std::string self_executable() {
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0) {
+        return std::string();
+    }
+    path[len] = '\0';
+    return path;
+}
+
+}  // namespace
+
+PluginHost::PluginHost(const std::string& name, const std::string& library, Kind kind,
+                       const json& plugin_config, const PluginHostConfig& config)
+    : name_(name), library_(library), kind_(kind), plugin_config_(plugin_config.dump()), config_(config),
+      running_(false), child_(-1), sent_(0), dropped_(0), blocked_(0), restarts_(0),
+      dropped_metric_(MetricsRegistry::global().counter("trunk_decoder_plugin_host_dropped_total",
+                                                        "Records dropped because a plugin host's ring stayed full",
+                                                        "plugin=\"" + MetricsRegistry::escape_label(name) + "\"")),
+      restarts_metric_(MetricsRegistry::global().counter("trunk_decoder_plugin_host_restarts_total",
+                                                         "Times a plugin host process was started again after exiting",
+                                                         "plugin=\"" + MetricsRegistry::escape_label(name) + "\"")) {}
+
+PluginHost::~PluginHost() {
+    stop();
+}
+
+bool PluginHost::start() {
+    if (running_.load()) {
+        return true;
+    }
+    if (!ring_.valid() && !ring_.create(config_.ring_bytes, ("trunk-decoder-" + name_).c_str())) {
+        std::cerr << "[PluginHost] " << name_ << ": cannot create ring: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (!data_ready_.valid() || !space_ready_.valid()) {
+        std::cerr << "[PluginHost] " << name_ << ": cannot create eventfds" << std::endl;
+        return false;
+    }
+    pid_t pid = launch();
+    if (pid < 0) {
+        return false;
+    }
+    child_.store(pid);
+    running_.store(true);
+    supervisor_ = std::thread(&PluginHost::supervise, this);
+    return true;
+}
+
+void PluginHost::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        ring_.try_write(STOP, static_cast<const ShmRing::Piece*>(nullptr), 0);
+        data_ready_.notify();
+    }
+    {
+        std::lock_guard<std::mutex> lock(supervisor_mutex_);
+        supervisor_cv_.notify_all();
+    }
+    // The supervisor reaps the child; give it time to drain the ring first
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.stop_timeout_ms);
+    while (child_.load() > 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    pid_t pid = child_.load();
+    if (pid > 0) {
+        std::cerr << "[PluginHost] " << name_ << ": host did not exit, killing pid " << pid << std::endl;
+        kill(pid, SIGKILL);
+    }
+    if (supervisor_.joinable()) {
+        supervisor_.join();
+    }
+}
+
+pid_t PluginHost::launch() {
+    std::string exe = self_executable();
+    if (exe.empty()) {
+        std::cerr << "[PluginHost] " << name_ << ": cannot find own executable" << std::endl;
+        return -1;
+    }
+    // Everything the child needs is built before fork(); after it only
+    // async-signal-safe calls are made
+    std::vector<std::string> args = {
+        exe, HOST_FLAG, kind_ == Kind::OUTPUT ? "output" : "call", name_, library_,
+        std::to_string(ring_.fd()), std::to_string(data_ready_.fd()), std::to_string(space_ready_.fd()),
+        std::to_string(getpid()), plugin_config_
+    };
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    int inherited[3] = {ring_.fd(), data_ready_.fd(), space_ready_.fd()};
+    pid_t parent = getpid();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "[PluginHost] " << name_ << ": fork failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    if (pid == 0) {
+        // Go down with the decoder however it exits
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != parent) {
+            _exit(1);
+        }
+        for (int fd : inherited) {
+            fcntl(fd, F_SETFD, 0);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    std::cout << "[PluginHost] Started host for " << name_ << " (pid " << pid << ")" << std::endl;
+    return pid;
+}
+
+void PluginHost::supervise() {
+    const std::chrono::milliseconds base_delay(config_.restart_delay_ms);
+    const std::chrono::milliseconds max_delay(config_.max_restart_delay_ms);
+    std::chrono::milliseconds delay = base_delay;
+    auto launched = std::chrono::steady_clock::now();
+
+    for (;;) {
+        pid_t pid = child_.load();
+        int status = 0;
+        while (pid > 0 && waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        child_.store(-1);
+        if (!running_.load()) {
+            break;
+        }
+
+        if (WIFSIGNALED(status)) {
+            std::cerr << "[PluginHost] " << name_ << ": host killed by signal " << WTERMSIG(status) << std::endl;
+        } else {
+            std::cerr << "[PluginHost] " << name_ << ": host exited with status " << WEXITSTATUS(status) << std::endl;
+        }
+        // A host that stayed up a while gets the short delay again
+        if (std::chrono::steady_clock::now() - launched > max_delay) {
+            delay = base_delay;
+        }
+        {
+            std::unique_lock<std::mutex> lock(supervisor_mutex_);
+            supervisor_cv_.wait_for(lock, delay, [this] { return !running_.load(); });
+        }
+        if (!running_.load()) {
+            break;
+        }
+        delay = std::min(delay * 2, max_delay);
+
+        launched = std::chrono::steady_clock::now();
+        child_.store(launch());
+        restarts_.fetch_add(1, std::memory_order_relaxed);
+        restarts_metric_.add();
+        if (child_.load() < 0) {
+            // Nothing to wait for; go round the backoff again
+            std::unique_lock<std::mutex> lock(supervisor_mutex_);
+            supervisor_cv_.wait_for(lock, delay, [this] { return !running_.load(); });
+            if (!running_.load()) {
+                break;
+            }
+        }
+    }
+}
+
+bool PluginHost::write_record(uint32_t type, const ShmRing::Piece* pieces, size_t count) {
+    if (ring_.try_write(type, pieces, count)) {
+        sent_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += pieces[i].size;
+    }
+    if (config_.block_when_full && size <= ring_.max_payload() && running_.load()) {
+        blocked_.fetch_add(1, std::memory_order_relaxed);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.block_timeout_ms);
+        for (;;) {
+            // Make sure the child is awake to drain what is already there
+            data_ready_.notify();
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                break;
+            }
+            struct pollfd pfd = {space_ready_.fd(), POLLIN, 0};
+            poll(&pfd, 1, static_cast<int>(left.count()));
+            space_ready_.drain();
+            if (ring_.try_write(type, pieces, count)) {
+                sent_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    dropped_metric_.add();
+    return false;
+}
+
+size_t PluginHost::send_tsbk(const P25_TSBK_Data* const* packets, size_t count) {
+    if (!ring_.valid()) {
+        return count;
+    }
+    size_t dropped = 0;
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    for (size_t i = 0; i < count; i++) {
+        const P25_TSBK_Data& data = *packets[i];
+        TsbkRecordHeader header = {};
+        header.timestamp_us = data.timestamp_us;
+        header.received_time = data.received_time;
+        header.frequency = data.frequency;
+        header.magic = data.magic;
+        header.version = data.version;
+        header.sequence_number = data.sequence_number;
+        header.system_id = data.system_id;
+        header.site_id = data.site_id;
+        header.sample_rate = data.sample_rate;
+        header.data_length = data.data_length;
+        header.checksum = data.checksum;
+        header.source_length = static_cast<uint16_t>(std::min<size_t>(data.source_name.size(), UINT16_MAX));
+        ShmRing::Piece pieces[3] = {
+            {&header, sizeof(header)},
+            {data.source_name.data(), header.source_length},
+            {data.tsbk_data.data(), data.tsbk_data.size()}
+        };
+        if (!write_record(TSBK, pieces, 3)) {
+            dropped++;
+        }
+    }
+    data_ready_.notify();
+    return dropped;
+}
+
+bool PluginHost::send_call(RecordType type, const Call_Data_t& call) {
+    if (!ring_.valid()) {
+        return false;
+    }
+    std::string body = call_to_json(call).dump();
+    ShmRing::Piece piece = {body.data(), body.size()};
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    bool sent = write_record(type, &piece, 1);
+    data_ready_.notify();
+    return sent;
+}
+
+bool PluginHost::send_audio(const Call_Data_t& call, const int16_t* samples, int sample_count) {
+    if (!ring_.valid() || sample_count < 0) {
+        return false;
+    }
+    std::string body = call_to_json(call).dump();
+    uint32_t body_length = static_cast<uint32_t>(body.size());
+    ShmRing::Piece pieces[3] = {
+        {&body_length, sizeof(body_length)},
+        {body.data(), body.size()},
+        {samples, static_cast<size_t>(sample_count) * sizeof(int16_t)}
+    };
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    bool sent = write_record(AUDIO, pieces, 3);
+    data_ready_.notify();
+    return sent;
+}
+
+json PluginHost::get_stats() const {
+    json stats;
+    stats["plugin_name"] = name_;
+    stats["library_path"] = library_;
+    stats["running"] = running_.load();
+    stats["pid"] = child_.load();
+    stats["sent"] = sent_.load();
+    stats["dropped"] = dropped_.load();
+    stats["blocked"] = blocked_.load();
+    stats["restarts"] = restarts_.load();
+    if (ring_.valid()) {
+        stats["ring_bytes"] = ring_.capacity();
+        stats["ring_used"] = ring_.used();
+    }
+    return stats;
+}
+
+int run_plugin_host(int argc, char* argv[]) {
+    if (argc < 10) {
+        std::cerr << "usage: " << argv[0] << " " << PluginHost::HOST_FLAG
+                  << " output|call NAME LIBRARY RING_FD DATA_FD SPACE_FD PARENT_PID CONFIG" << std::endl;
+        return 1;
+    }
+    std::string kind = argv[2];
+    std::string name = argv[3];
+    std::string library = argv[4];
+    int ring_fd = atoi(argv[5]);
+    int data_fd = atoi(argv[6]);
+    int space_fd = atoi(argv[7]);
+    pid_t parent = static_cast<pid_t>(atoi(argv[8]));
+    json config = json::parse(argv[9], nullptr, false);
+    if (config.is_discarded()) {
+        std::cerr << "[PluginHost] " << name << ": bad plugin config" << std::endl;
+        return 1;
+    }
+
+    ShmRing ring;
+    if (!ring.attach(ring_fd)) {
+        std::cerr << "[PluginHost] " << name << ": cannot map ring" << std::endl;
+        return 1;
+    }
+
+    // Declared first so the plugin objects are gone before the library unloads
+    boost::dll::shared_library lib;
+    std::shared_ptr<Output_Plugin_Api> output;
+    boost::shared_ptr<Plugin_Api> call_plugin;
+    int api_version = 1;
+    try {
+        lib.load(library, boost::dll::load_mode::append_decorations);
+        if (kind == "output") {
+            output = lib.get_alias<std::shared_ptr<Output_Plugin_Api>()>("create_output_plugin")();
+        } else {
+            call_plugin = lib.get_alias<boost::shared_ptr<Plugin_Api>()>("create_plugin")();
+            api_version = plugin_library_api_version(lib);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[PluginHost] " << name << ": cannot load " << library << ": " << e.what() << std::endl;
+        return 2;
+    }
+
+    int rc = output ? output->init(config) : call_plugin->init(config);
+    if (rc != 0) {
+        std::cerr << "[PluginHost] " << name << ": plugin init failed" << std::endl;
+        return 2;
+    }
+    rc = output ? output->start() : call_plugin->start();
+    if (rc != 0) {
+        std::cerr << "[PluginHost] " << name << ": plugin start failed" << std::endl;
+        return 3;
+    }
+
+    std::vector<P25_TSBK_Data> packets(HOST_BATCH_SIZE);
+    std::vector<const P25_TSBK_Data*> batch(HOST_BATCH_SIZE);
+    for (size_t i = 0; i < HOST_BATCH_SIZE; i++) {
+        batch[i] = &packets[i];
+    }
+    std::vector<int16_t> samples;
+    bool stopping = false;
+
+    while (!stopping && getppid() == parent) {
+        struct pollfd pfd = {data_fd, POLLIN, 0};
+        poll(&pfd, 1, 1000);
+        EventNotifier::drain(data_fd);
+
+        uint64_t cursor = ring.read_cursor();
+        size_t pending = 0;
+        ShmRing::Record record;
+        for (;;) {
+            uint64_t at = cursor;
+            if (stopping || !ring.next(cursor, record)) {
+                break;
+            }
+            if (record.type != PluginHost::TSBK && pending) {
+                // Keep order: packets queued before this record go first
+                output->process_batch(batch.data(), pending);
+                pending = 0;
+                ring.release(at);
+            }
+            switch (record.type) {
+                case PluginHost::TSBK: {
+                    if (!output || record.length < sizeof(TsbkRecordHeader)) {
+                        continue;
+                    }
+                    TsbkRecordHeader header;
+                    std::memcpy(&header, record.data, sizeof(header));
+                    size_t body = record.length - sizeof(header);
+                    if (header.source_length > body) {
+                        continue;
+                    }
+                    P25_TSBK_Data& data = packets[pending++];
+                    data.magic = header.magic;
+                    data.version = header.version;
+                    data.timestamp_us = header.timestamp_us;
+                    data.sequence_number = header.sequence_number;
+                    data.system_id = header.system_id;
+                    data.site_id = header.site_id;
+                    data.frequency = header.frequency;
+                    data.sample_rate = header.sample_rate;
+                    data.data_length = header.data_length;
+                    data.checksum = header.checksum;
+                    data.received_time = header.received_time;
+                    const uint8_t* p = record.data + sizeof(header);
+                    data.source_name.assign(reinterpret_cast<const char*>(p), header.source_length);
+                    data.tsbk_data = PacketBuffer::copy_of(p + header.source_length, body - header.source_length);
+                    if (pending == HOST_BATCH_SIZE) {
+                        output->process_batch(batch.data(), pending);
+                        pending = 0;
+                        ring.release(cursor);
+                    }
+                    continue;
+                }
+                case PluginHost::CALL_END:
+                case PluginHost::CALL_READY: {
+                    json j = json::parse(record.data, record.data + record.length, nullptr, false);
+                    if (!call_plugin || j.is_discarded()) {
+                        break;
+                    }
+                    auto call = std::make_shared<CallRecord>();
+                    call_from_json(j, *call);
+                    // A version 1 library predates the record hooks
+                    if (record.type == PluginHost::CALL_END) {
+                        if (api_version >= 2) {
+                            call_plugin->call_record_end(call);
+                        } else {
+                            call_plugin->call_end(*call);
+                        }
+                    } else if (api_version >= 2) {
+                        call_plugin->call_record_ready(call);
+                    } else {
+                        call_plugin->call_data_ready(*call);
+                    }
+                    break;
+                }
+                case PluginHost::AUDIO: {
+                    uint32_t body_length = 0;
+                    if (!call_plugin || record.length < sizeof(body_length)) {
+                        break;
+                    }
+                    std::memcpy(&body_length, record.data, sizeof(body_length));
+                    if (body_length > record.length - sizeof(body_length)) {
+                        break;
+                    }
+                    const uint8_t* body = record.data + sizeof(body_length);
+                    json j = json::parse(body, body + body_length, nullptr, false);
+                    if (j.is_discarded()) {
+                        break;
+                    }
+                    Call_Data_t call;
+                    call_from_json(j, call);
+                    size_t pcm_bytes = record.length - sizeof(body_length) - body_length;
+                    // The ring only guarantees 8-byte alignment of the record start
+                    samples.resize(pcm_bytes / sizeof(int16_t));
+                    std::memcpy(samples.data(), body + body_length, samples.size() * sizeof(int16_t));
+                    call_plugin->audio_stream(&call, samples.data(), static_cast<int>(samples.size()));
+                    break;
+                }
+                case PluginHost::STOP:
+                    stopping = true;
+                    break;
+            }
+            ring.release(cursor);
+            notify_fd(space_fd);
+        }
+        if (pending) {
+            output->process_batch(batch.data(), pending);
+        }
+        ring.release(cursor);
+        notify_fd(space_fd);
+    }
+
+    if (output) {
+        output->flush();
+        output->stop();
+    } else {
+        call_plugin->stop();
+    }
+    return 0;
+}
+
+int HostedOutputPlugin::init(json config_data) {
+    config_ = config_data;
+    host_.reset(new PluginHost(name_, library_, PluginHost::Kind::OUTPUT, config_data, host_config_));
+    state_ = Plugin_State::PLUGIN_INITIALIZED;
+    return 0;
+}
+
+int HostedOutputPlugin::start() {
+    if (!host_ || !host_->start()) {
+        state_ = Plugin_State::PLUGIN_ERROR;
+        return -1;
+    }
+    state_ = Plugin_State::PLUGIN_RUNNING;
+    return 0;
+}
+
+int HostedOutputPlugin::stop() {
+    if (host_) {
+        host_->stop();
+    }
+    state_ = Plugin_State::PLUGIN_STOPPED;
+    return 0;
+}
+
+json HostedOutputPlugin::get_stats() {
+    json stats = host_ ? host_->get_stats() : json::object();
+    stats["state"] = static_cast<int>(state_);
+    stats["hosted"] = true;
+    return stats;
+}
+
+int HostedOutputPlugin::process_data(const P25_TSBK_Data& data) {
+    const P25_TSBK_Data* packet = &data;
+    return process_batch(&packet, 1) == 0 ? 0 : -1;
+}
+
+size_t HostedOutputPlugin::process_batch(const P25_TSBK_Data* const* packets, size_t count) {
+    return host_ ? host_->send_tsbk(packets, count) : count;
+}
+
+int HostedCallPlugin::init(json config_data) {
+    config_ = config_data;
+    host_.reset(new PluginHost(name_, library_, PluginHost::Kind::CALL, config_data, host_config_));
+    set_state(Plugin_State::PLUGIN_INITIALIZED);
+    return 0;
+}
+
+int HostedCallPlugin::start() {
+    if (!host_ || !host_->start()) {
+        set_state(Plugin_State::PLUGIN_ERROR);
+        return -1;
+    }
+    set_state(Plugin_State::PLUGIN_RUNNING);
+    return 0;
+}
+
+int HostedCallPlugin::stop() {
+    if (host_) {
+        host_->stop();
+    }
+    set_state(Plugin_State::PLUGIN_STOPPED);
+    return 0;
+}
+
+json HostedCallPlugin::get_stats() {
+    json stats = host_ ? host_->get_stats() : json::object();
+    stats["state"] = static_cast<int>(state_);
+    stats["hosted"] = true;
+    return stats;
+}
+
+int HostedCallPlugin::call_end(Call_Data_t call_info) {
+    return host_ && host_->send_call(PluginHost::CALL_END, call_info) ? 0 : -1;
+}
+
+int HostedCallPlugin::call_data_ready(Call_Data_t call_info) {
+    return host_ && host_->send_call(PluginHost::CALL_READY, call_info) ? 0 : -1;
+}
+
+int HostedCallPlugin::call_record_end(std::shared_ptr<const CallRecord> call) {
+    return host_ && host_->send_call(PluginHost::CALL_END, *call) ? 0 : -1;
+}
+
+int HostedCallPlugin::call_record_ready(std::shared_ptr<const CallRecord> call) {
+    return host_ && host_->send_call(PluginHost::CALL_READY, *call) ? 0 : -1;
+}
+
+int HostedCallPlugin::audio_stream(Call_Data_t* call_info, int16_t* samples, int sample_count) {
+    return host_ && host_->send_audio(*call_info, samples, sample_count) ? 0 : -1;
+}
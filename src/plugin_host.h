@@ -0,0 +1,201 @@
+/*
+ * Out-of-process plugin host for trunk-decoder
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * A plugin whose config has "host": {"enabled": true} is not loaded into
+ * the decoder. Its manager gets a proxy instead, and the proxy starts a
+ * child (this binary again, run as --plugin-host) that loads the library
+ * and calls it. Packets, call records and PCM cross to the child through a
+ * shared-memory ring (shm_ring.h) with an eventfd each way for wakeups, so
+ * a plugin that blocks on the network, leaks or crashes only takes its own
+ * process with it.
+ *
+ * When the ring is full the sender waits up to block_timeout_ms for the
+ * child to make room ("overflow": "block", the default) or drops the
+ * record straight away ("drop"); either way a decode thread is never held
+ * longer than the timeout. A child that exits is started again after
+ * restart_delay_ms, doubling up to max_restart_delay_ms while it keeps
+ * failing. Records still in the ring are delivered to the new child; the
+ * one a crashed child was working on is delivered again.
+ *
+ * The child has no TrunkingState, and encoded_audio is not carried (use
+ * the files in converted_files).
+ */
+
+#pragma once
+
+#include "plugin_api.h"
+#include "shm_ring.h"
+#include "event_notifier.h"
+#include "metrics.h"
+#include <sys/types.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+struct PluginHostConfig {
+    bool enabled = false;
+    size_t ring_bytes = 8 * 1024 * 1024;
+    bool block_when_full = true;       // "overflow": "block" or "drop"
+    int block_timeout_ms = 100;
+    int restart_delay_ms = 500;
+    int max_restart_delay_ms = 30000;
+    int stop_timeout_ms = 5000;        // before the child is killed
+
+    // The "host" value of a plugin's config; absent or false leaves it in-process
+    static PluginHostConfig from_json(const json& j) {
+        PluginHostConfig config;
+        if (j.is_boolean()) {
+            config.enabled = j.get<bool>();
+            return config;
+        }
+        if (!j.is_object()) {
+            return config;
+        }
+        config.enabled = j.value("enabled", true);
+        config.ring_bytes = j.value("ring_bytes", config.ring_bytes);
+        config.block_when_full = j.value("overflow", std::string("block")) != "drop";
+        config.block_timeout_ms = j.value("block_timeout_ms", config.block_timeout_ms);
+        config.restart_delay_ms = j.value("restart_delay_ms", config.restart_delay_ms);
+        config.max_restart_delay_ms = j.value("max_restart_delay_ms", config.max_restart_delay_ms);
+        config.stop_timeout_ms = j.value("stop_timeout_ms", config.stop_timeout_ms);
+        return config;
+    }
+};
+
+class PluginHost {
+public:
+    // First argument of a host child's command line
+    static constexpr const char* HOST_FLAG = "--plugin-host";
+
+    enum class Kind { OUTPUT, CALL };
+
+    enum RecordType : uint32_t {
+        TSBK = 1,
+        CALL_END = 2,
+        CALL_READY = 3,
+        AUDIO = 4,
+        STOP = 5
+    };
+
+    PluginHost(const std::string& name, const std::string& library, Kind kind,
+               const json& plugin_config, const PluginHostConfig& config);
+    ~PluginHost();
+
+    PluginHost(const PluginHost&) = delete;
+    PluginHost& operator=(const PluginHost&) = delete;
+
+    // Create the ring and launch the child; false if either fails
+    bool start();
+    // Ask the child to finish what is queued and exit, killing it after stop_timeout_ms
+    void stop();
+    bool running() const { return running_.load(); }
+
+    // Queue records for the child, waking it once. Safe from any thread.
+    // Return how many were dropped.
+    size_t send_tsbk(const P25_TSBK_Data* const* packets, size_t count);
+    bool send_call(RecordType type, const Call_Data_t& call);
+    bool send_audio(const Call_Data_t& call, const int16_t* samples, int sample_count);
+
+    json get_stats() const;
+
+private:
+    bool write_record(uint32_t type, const ShmRing::Piece* pieces, size_t count);
+    pid_t launch();
+    void supervise();
+
+    std::string name_;
+    std::string library_;
+    Kind kind_;
+    std::string plugin_config_;
+    PluginHostConfig config_;
+
+    ShmRing ring_;
+    EventNotifier data_ready_;    // parent -> child: records queued
+    EventNotifier space_ready_;   // child -> parent: records consumed
+    std::mutex send_mutex_;       // the ring has one producer
+
+    std::atomic<bool> running_;
+    std::atomic<pid_t> child_;
+    std::thread supervisor_;
+    std::mutex supervisor_mutex_;
+    std::condition_variable supervisor_cv_;
+
+    std::atomic<uint64_t> sent_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> blocked_;
+    std::atomic<uint64_t> restarts_;
+    MetricsRegistry::Counter& dropped_metric_;
+    MetricsRegistry::Counter& restarts_metric_;
+};
+
+// Entry point of a host child: main() hands over when argv[1] is HOST_FLAG
+int run_plugin_host(int argc, char* argv[]);
+
+// Output plugin that forwards everything to a hosted copy of the real one
+class HostedOutputPlugin : public Output_Plugin_Api {
+public:
+    HostedOutputPlugin(const std::string& name, const std::string& library, const PluginHostConfig& config)
+        : name_(name), library_(library), host_config_(config) {}
+
+    int init(json config_data) override;
+    int start() override;
+    int stop() override;
+    int get_state() override { return static_cast<int>(state_); }
+    bool is_enabled() override { return enabled_; }
+    int parse_config(json config_data) override { config_ = config_data; return 0; }
+    json get_stats() override;
+
+    std::string get_plugin_name() override { return name_; }
+    std::string get_plugin_version() override { return "hosted"; }
+    std::string get_plugin_author() override { return ""; }
+    std::string get_plugin_description() override { return "Out-of-process host for " + library_; }
+
+    int process_data(const P25_TSBK_Data& data) override;
+    size_t process_batch(const P25_TSBK_Data* const* packets, size_t count) override;
+    int flush() override { return 0; }
+    bool is_ready() override { return host_ && host_->running(); }
+
+private:
+    std::string name_;
+    std::string library_;
+    PluginHostConfig host_config_;
+    std::unique_ptr<PluginHost> host_;
+};
+
+// Call plugin that forwards calls and audio to a hosted copy of the real one
+class HostedCallPlugin : public Base_Plugin {
+public:
+    HostedCallPlugin(const std::string& name, const std::string& library, const PluginHostConfig& config)
+        : name_(name), library_(library), host_config_(config) {}
+
+    int init(json config_data) override;
+    int start() override;
+    int stop() override;
+    int parse_config(json config_data) override { config_ = config_data; return 0; }
+    json get_stats() override;
+
+    std::string get_plugin_name() override { return name_; }
+    std::string get_plugin_version() override { return "hosted"; }
+    std::string get_plugin_author() override { return ""; }
+    std::string get_plugin_description() override { return "Out-of-process host for " + library_; }
+
+    int call_end(Call_Data_t call_info) override;
+    int call_data_ready(Call_Data_t call_info) override;
+    int call_record_end(std::shared_ptr<const CallRecord> call) override;
+    int call_record_ready(std::shared_ptr<const CallRecord> call) override;
+    int audio_stream(Call_Data_t* call_info, int16_t* samples, int sample_count) override;
+
+private:
+    std::string name_;
+    std::string library_;
+    PluginHostConfig host_config_;
+    std::unique_ptr<PluginHost> host_;
+};
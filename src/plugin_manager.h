@@ -29,17 +29,35 @@ struct Plugin_Info {
     boost::dll::shared_library plugin_lib;
     boost::function<boost::shared_ptr<Plugin_Api>()> creator;
     boost::shared_ptr<Plugin_Api> api;
+    int api_version;  // TRUNK_DECODER_PLUGIN_API_VERSION the library was built with
     
     // Statistics
     int calls_processed;
     int calls_failed;
     std::chrono::system_clock::time_point last_activity;
     
-    Plugin_Info() : enabled(false), state(Plugin_State::PLUGIN_UNINITIALIZED),
+    Plugin_Info() : enabled(false), state(Plugin_State::PLUGIN_UNINITIALIZED), api_version(1),
                    calls_processed(0), calls_failed(0),
                    last_activity(std::chrono::system_clock::now()) {}
+    
+    // Deliver through the hooks the plugin's vtable actually has: a
+    // version 1 library predates call_record_end()/call_record_ready()
+    int call_end(const std::shared_ptr<const CallRecord>& call) {
+        return api_version >= 2 ? api->call_record_end(call) : api->call_end(*call);
+    }
+    int call_data_ready(const std::shared_ptr<const CallRecord>& call) {
+        return api_version >= 2 ? api->call_record_ready(call) : api->call_data_ready(*call);
+    }
 };
 
+// API version a loaded plugin library exports; 1 when it exports none
+inline int plugin_library_api_version(const boost::dll::shared_library& lib) {
+    if (!lib.has("plugin_api_version")) {
+        return 1;
+    }
+    return lib.get_alias<int()>("plugin_api_version")();
+}
+
 // Plugin Manager class
 class Plugin_Manager {
 private:
@@ -53,7 +71,7 @@ private:
     // Retry mechanism
     struct Plugin_Retry {
         std::shared_ptr<Plugin_Info> plugin;
-        Call_Data_t call_data;
+        std::shared_ptr<const CallRecord> call;
         std::string operation;
         int retry_count;
         std::chrono::system_clock::time_point next_retry;
@@ -83,8 +101,8 @@ public:
     
     // Event dispatching
     void call_start(Call_Data_t* call_info);
-    void call_end(Call_Data_t call_info);
-    void call_data_ready(Call_Data_t call_info);
+    void call_end(std::shared_ptr<const CallRecord> call);
+    void call_data_ready(std::shared_ptr<const CallRecord> call);
     void audio_stream(Call_Data_t* call_info, int16_t* samples, int sample_count);
     void system_started(System_Info system_info);
     void system_stopped(System_Info system_info);
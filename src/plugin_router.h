@@ -4,6 +4,15 @@
  * Supports 1:1, 1:many, many:1, and many:many routing configurations
  * 
  * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * The compiled rules are one immutable RoutingTable. route_data() takes the
+ * current table with a single shared_ptr load and routes the packet on it;
+ * every change builds a whole new table and swaps it in, so rules can be
+ * reloaded while inputs are delivering. A packet already being routed
+ * finishes on the table it started with. Output queues and source counters
+ * outlive every table, so a reload keeps their queued packets and counts.
+ * restart_output() replaces one output plugin with a new instance between
+ * two of its batches, without touching the others.
  */
 
 #pragma once
@@ -11,12 +20,22 @@
 #include "plugin_api.h"
 #include "input_plugin_manager.h"
 #include "output_plugin_manager.h"
+#include "mpmc_ring.h"
+#include "route_filter.h"
+#include "metrics.h"
+#include "stage_profiler.h"
 #include <vector>
+#include <algorithm>
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <string>
 #include <functional>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 
 class PluginRouter {
 public:
@@ -24,32 +43,185 @@ public:
         std::string input_plugin;      // Source plugin name or "*" for all
         std::vector<std::string> output_plugins; // Target plugin names
         std::function<bool(const P25_TSBK_Data&)> filter; // Optional data filter
+        RouteFilterIndex::Spec match;  // Declarative NAC/system/site/talkgroup filter
         bool enabled;
         
         RoutingRule(const std::string& input, const std::vector<std::string>& outputs) 
             : input_plugin(input), output_plugins(outputs), enabled(true) {}
     };
 
+    // What to do when an output's queue is full
+    enum class OverflowPolicy {
+        DROP_NEWEST,   // discard the packet being routed
+        DROP_OLDEST,   // discard the oldest queued packet to make room
+        BLOCK          // wait up to block_timeout for the worker, then drop
+    };
+
 private:
+    // Each output plugin is fed by its own bounded queue and worker thread,
+    // so a slow output only backs up its own queue
+    struct OutputQueue {
+        std::string name;
+        std::shared_ptr<Output_Plugin_Api> plugin;
+        std::mutex plugin_mutex;       // held by the worker for each batch; restart_output() swaps under it
+        std::unique_ptr<MPMCRing<P25_TSBK_Data>> ring;
+        size_t capacity;
+        size_t batch_size;             // most packets handed to one process_batch()
+        OverflowPolicy policy;
+        std::chrono::milliseconds block_timeout;
+        std::thread worker;
+        
+        std::atomic<uint64_t> enqueued;
+        std::atomic<uint64_t> delivered;
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> blocked;
+        std::atomic<uint64_t> errors;
+        
+        // The same counts for /metrics, which outlive the router
+        MetricsRegistry::Counter* dropped_metric;
+        MetricsRegistry::Counter* errors_metric;
+        MetricsRegistry::Histogram* latency_metric;
+        MetricsRegistry::Gauge* depth_metric;
+        
+        explicit OutputQueue(const std::string& n)
+            : name(n), capacity(1024), batch_size(256), policy(OverflowPolicy::DROP_NEWEST),
+              block_timeout(100), enqueued(0), delivered(0), dropped(0), blocked(0), errors(0) {
+            MetricsRegistry& registry = MetricsRegistry::global();
+            std::string label = "plugin=\"" + MetricsRegistry::escape_label(n) + "\"";
+            dropped_metric = &registry.counter("trunk_decoder_plugin_dropped_total",
+                                               "Messages dropped at a full output plugin queue", label);
+            errors_metric = &registry.counter("trunk_decoder_plugin_errors_total",
+                                              "Messages an output plugin failed to process", label);
+            latency_metric = &registry.histogram("trunk_decoder_plugin_process_seconds",
+                                                 "Time an output plugin spent on each message", label);
+            depth_metric = &registry.gauge("trunk_decoder_plugin_queue_depth",
+                                           "Messages waiting in an output plugin queue", label);
+        }
+    };
+    
+    // A rule resolved to its output queues
+    struct CompiledRoute {
+        size_t rule_index;
+        std::vector<OutputQueue*> outputs;
+    };
+    
+    // Rules as bitsets over rule index: a packet is routed by every rule set
+    // in both its source's mask and the filter index result
+    typedef std::vector<uint64_t> RuleMask;
+    
+    // Counters for one source plugin, updated without locks from any input thread
+    struct alignas(64) SourceStats {
+        std::string name;
+        std::atomic<uint64_t> routed;
+        std::atomic<uint64_t> filtered;
+        std::atomic<uint64_t> errors;
+        
+        explicit SourceStats(const std::string& n) : name(n), routed(0), filtered(0), errors(0) {}
+    };
+    
+    struct SourceRoutes {
+        SourceStats* stats;
+        RuleMask rules;
+    };
+    
+    // Precomputed source plugin -> enabled rules. Sources without an entry
+    // only match wildcard rules. Never changed once published.
+    struct RoutingTable {
+        std::vector<RoutingRule> rules;
+        std::vector<CompiledRoute> routes;  // indexed like rules
+        std::unordered_map<std::string, SourceRoutes> by_source;
+        SourceRoutes wildcard;              // also used for unregistered sources
+        RouteFilterIndex filter_index;
+    };
+    
     std::shared_ptr<InputPluginManager> input_manager_;
     std::shared_ptr<OutputPluginManager> output_manager_;
-    std::vector<RoutingRule> routing_rules_;
     bool verbose_;
     
-    // Statistics
-    std::map<std::string, uint64_t> messages_routed_;
-    std::map<std::string, uint64_t> messages_filtered_;
-    std::map<std::string, uint64_t> routing_errors_;
+    // Current table, read with std::atomic_load; writers hold config_mutex_
+    std::shared_ptr<const RoutingTable> table_;
+    std::mutex config_mutex_;
+    
+    // Output queues by plugin name. Queues are never removed, so a table's
+    // pointers stay valid; outputs_ and output_index_ change under config_mutex_.
+    std::vector<std::unique_ptr<OutputQueue>> outputs_;
+    std::unordered_map<std::string, size_t> output_index_;
+    json queue_defaults_;
+    json queue_overrides_;
+    std::atomic<bool> running_;
+    
+    // Statistics: one entry per source, entry 0 collects unregistered sources.
+    // Entries are never removed and only aggregated when read.
+    std::vector<std::unique_ptr<SourceStats>> source_stats_;
+    std::unordered_map<std::string, size_t> source_ids_;
 
 public:
     PluginRouter(std::shared_ptr<InputPluginManager> input_mgr, 
                  std::shared_ptr<OutputPluginManager> output_mgr,
                  bool verbose = false) 
-        : input_manager_(input_mgr), output_manager_(output_mgr), verbose_(verbose) {}
+        : input_manager_(input_mgr), output_manager_(output_mgr), verbose_(verbose),
+          queue_defaults_(json::object()), queue_overrides_(json::object()), running_(false) {
+        source_stats_.push_back(std::make_unique<SourceStats>("(unregistered)"));
+        publish({});
+    }
+    
+    // Give a source plugin its own routing entry and counters. Packets are
+    // matched by P25_TSBK_Data::source_name.
+    size_t register_source(const std::string& source_plugin) {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        size_t id = source_id(source_plugin);
+        publish(std::atomic_load(&table_)->rules);
+        return id;
+    }
+    
+    ~PluginRouter() {
+        stop();
+    }
+    
+    // Resolve output plugins and start one delivery worker per output.
+    // Until this is called route_data() delivers synchronously.
+    int start() {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        if (running_) {
+            return 0;
+        }
+        
+        running_ = true;
+        for (auto& output : outputs_) {
+            start_output(*output);
+        }
+        
+        if (verbose_) {
+            std::cout << "[PluginRouter] Started " << outputs_.size() << " output queue(s)" << std::endl;
+        }
+        return 0;
+    }
+    
+    // Drain queued packets to their outputs and stop the workers
+    void stop() {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        for (auto& output : outputs_) {
+            if (output->ring) {
+                output->ring->wake_all();
+            }
+        }
+        for (auto& output : outputs_) {
+            if (output->worker.joinable()) {
+                output->worker.join();
+            }
+        }
+    }
     
     // Add a routing rule
     void add_route(const std::string& input_plugin, const std::vector<std::string>& output_plugins) {
-        routing_rules_.emplace_back(input_plugin, output_plugins);
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        std::vector<RoutingRule> rules = std::atomic_load(&table_)->rules;
+        rules.emplace_back(input_plugin, output_plugins);
+        publish(std::move(rules));
         
         if (verbose_) {
             std::cout << "[PluginRouter] Added route: " << input_plugin << " -> [";
@@ -65,8 +237,11 @@ public:
     void add_route_with_filter(const std::string& input_plugin, 
                               const std::vector<std::string>& output_plugins,
                               std::function<bool(const P25_TSBK_Data&)> filter) {
-        routing_rules_.emplace_back(input_plugin, output_plugins);
-        routing_rules_.back().filter = filter;
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        std::vector<RoutingRule> rules = std::atomic_load(&table_)->rules;
+        rules.emplace_back(input_plugin, output_plugins);
+        rules.back().filter = filter;
+        publish(std::move(rules));
         
         if (verbose_) {
             std::cout << "[PluginRouter] Added filtered route: " << input_plugin << " -> [";
@@ -78,90 +253,180 @@ public:
         }
     }
     
-    // Load routing rules from configuration
+    // Add a routing rule with a declarative filter (see route_filter.h)
+    void add_route_with_match(const std::string& input_plugin,
+                              const std::vector<std::string>& output_plugins,
+                              const RouteFilterIndex::Spec& match) {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        std::vector<RoutingRule> rules = std::atomic_load(&table_)->rules;
+        rules.emplace_back(input_plugin, output_plugins);
+        rules.back().match = match;
+        publish(std::move(rules));
+        
+        if (verbose_) {
+            std::cout << "[PluginRouter] Added matched route: " << input_plugin << " -> "
+                      << output_plugins.size() << " outputs" << std::endl;
+        }
+    }
+    
+    // Load routing rules from configuration, after any already added
     int load_routes_from_config(const json& config) {
-        if (!config.contains("routing_rules")) {
-            // Default: route all inputs to all outputs
-            add_route("*", output_manager_->get_active_plugin_names());
-            return 0;
+        return apply_config(config, false);
+    }
+    
+    // Swap in the rules from configuration in place of the current ones.
+    // New output_queues settings apply to queues started from now on. On
+    // error the current rules stay.
+    int reload_routes_from_config(const json& config) {
+        return apply_config(config, true);
+    }
+    
+    // Stop an output plugin and put a new instance with config in its place
+    // (OutputPluginManager::restart_plugin). Its queue and the other outputs
+    // keep going; the batch in progress finishes on the old instance.
+    // Packets queued meanwhile go to the new one.
+    int restart_output(const std::string& name, const json& config) {
+        std::shared_ptr<Output_Plugin_Api> old_plugin;
+        std::shared_ptr<Output_Plugin_Api> plugin = output_manager_->restart_plugin(name, config, old_plugin);
+        if (!plugin) {
+            return -1;
         }
-        
-        try {
-            for (const auto& rule : config["routing_rules"]) {
-                std::string input = rule["input"];
-                std::vector<std::string> outputs = rule["outputs"];
-                bool enabled = rule.value("enabled", true);
-                
-                if (enabled) {
-                    add_route(input, outputs);
+        {
+            std::lock_guard<std::mutex> lock(config_mutex_);
+            auto it = output_index_.find(name);
+            if (it != output_index_.end()) {
+                OutputQueue& output = *outputs_[it->second];
+                std::lock_guard<std::mutex> plugin_lock(output.plugin_mutex);
+                output.plugin = plugin;
+                if (!output.ring && verbose_) {
+                    std::cout << "[PluginRouter] " << name << " had no queue at start, "
+                              << "routes to it take effect after a restart" << std::endl;
                 }
             }
-            return 0;
-        } catch (const std::exception& e) {
-            std::cerr << "[PluginRouter] Error loading routes from config: " << e.what() << std::endl;
-            return -1;
         }
+        if (old_plugin) {
+            old_plugin->stop();
+        }
+        if (verbose_) {
+            std::cout << "[PluginRouter] Restarted output plugin " << name << std::endl;
+        }
+        return 0;
     }
     
     // Route data from input plugin to appropriate output plugins
     void route_data(const P25_TSBK_Data& data, const std::string& source_plugin) {
-        for (const auto& rule : routing_rules_) {
-            if (!rule.enabled) continue;
-            
-            // Check if this rule applies to the source plugin
-            bool applies = (rule.input_plugin == "*" || rule.input_plugin == source_plugin);
-            if (!applies) continue;
-            
-            // Apply filter if present
-            if (rule.filter && !rule.filter(data)) {
-                messages_filtered_[source_plugin]++;
-                continue;
-            }
-            
-            // Route to output plugins
-            try {
-                output_manager_->send_data_to(data, rule.output_plugins);
-                messages_routed_[source_plugin]++;
+        // Held to the end, so a reload cannot free the rules in use
+        std::shared_ptr<const RoutingTable> table = std::atomic_load(&table_);
+        auto it = table->by_source.find(source_plugin);
+        const SourceRoutes& source = (it != table->by_source.end()) ? it->second : table->wildcard;
+        const RuleMask& routes = source.rules;
+        SourceStats& stats = *source.stats;
+        
+        // Declarative filters for every rule at once
+        thread_local RuleMask matched;
+        matched.assign(routes.begin(), routes.end());
+        table->filter_index.match(data, matched.data());
+        
+        size_t filtered = 0;
+        for (size_t w = 0; w < routes.size(); ++w) {
+            filtered += __builtin_popcountll(routes[w] & ~matched[w]);
+        }
+        if (filtered) {
+            stats.filtered.fetch_add(filtered, std::memory_order_relaxed);
+        }
+        
+        for (size_t w = 0; w < matched.size(); ++w) {
+            for (uint64_t bits = matched[w]; bits; bits &= bits - 1) {
+                const CompiledRoute& route = table->routes[w * 64 + __builtin_ctzll(bits)];
+                const RoutingRule& rule = table->rules[route.rule_index];
                 
-                if (verbose_) {
-                    std::cout << "[PluginRouter] Routed data from " << source_plugin 
-                              << " to " << rule.output_plugins.size() << " outputs" << std::endl;
+                // Apply filter if present
+                if (rule.filter && !rule.filter(data)) {
+                    stats.filtered.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                
+                // Route to output plugins
+                try {
+                    if (running_) {
+                        for (OutputQueue* output : route.outputs) {
+                            enqueue(*output, data);
+                        }
+                    } else {
+                        output_manager_->send_data_to(data, rule.output_plugins);
+                    }
+                    stats.routed.fetch_add(1, std::memory_order_relaxed);
+                    
+                    if (verbose_) {
+                        std::cout << "[PluginRouter] Routed data from " << source_plugin 
+                                  << " to " << rule.output_plugins.size() << " outputs" << std::endl;
+                    }
+                } catch (const std::exception& e) {
+                    stats.errors.fetch_add(1, std::memory_order_relaxed);
+                    std::cerr << "[PluginRouter] Error routing data from " << source_plugin 
+                              << ": " << e.what() << std::endl;
                 }
-            } catch (const std::exception& e) {
-                routing_errors_[source_plugin]++;
-                std::cerr << "[PluginRouter] Error routing data from " << source_plugin 
-                          << ": " << e.what() << std::endl;
             }
         }
     }
     
     // Enable/disable specific routing rules
     void enable_route(const std::string& input_plugin, const std::vector<std::string>& output_plugins, bool enabled) {
-        for (auto& rule : routing_rules_) {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        std::vector<RoutingRule> rules = std::atomic_load(&table_)->rules;
+        bool changed = false;
+        for (auto& rule : rules) {
             if (rule.input_plugin == input_plugin && rule.output_plugins == output_plugins) {
                 rule.enabled = enabled;
+                changed = true;
                 if (verbose_) {
                     std::cout << "[PluginRouter] " << (enabled ? "Enabled" : "Disabled") 
                               << " route: " << input_plugin << " -> outputs" << std::endl;
                 }
             }
         }
+        if (changed) {
+            publish(std::move(rules));
+        }
     }
     
     // Get routing statistics
     json get_routing_stats() {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        std::shared_ptr<const RoutingTable> table = std::atomic_load(&table_);
         json stats;
-        stats["messages_routed"] = messages_routed_;
-        stats["messages_filtered"] = messages_filtered_;
-        stats["routing_errors"] = routing_errors_;
+        json routed = json::object(), filtered = json::object(), errors = json::object();
+        for (const auto& source : source_stats_) {
+            if (uint64_t n = source->routed.load(std::memory_order_relaxed)) routed[source->name] = n;
+            if (uint64_t n = source->filtered.load(std::memory_order_relaxed)) filtered[source->name] = n;
+            if (uint64_t n = source->errors.load(std::memory_order_relaxed)) errors[source->name] = n;
+        }
+        stats["messages_routed"] = routed;
+        stats["messages_filtered"] = filtered;
+        stats["routing_errors"] = errors;
         stats["active_rules"] = 0;
         
-        for (const auto& rule : routing_rules_) {
+        for (const auto& rule : table->rules) {
             if (rule.enabled) {
                 stats["active_rules"] = stats["active_rules"].get<int>() + 1;
             }
         }
         
+        json outputs = json::object();
+        for (const auto& output : outputs_) {
+            json o;
+            o["enqueued"] = output->enqueued.load();
+            o["delivered"] = output->delivered.load();
+            o["dropped"] = output->dropped.load();
+            o["blocked"] = output->blocked.load();
+            o["errors"] = output->errors.load();
+            o["queue_depth"] = output->ring ? output->ring->size() : 0;
+            o["queue_capacity"] = output->capacity;
+            o["overflow_policy"] = policy_name(output->policy);
+            outputs[output->name] = o;
+        }
+        stats["outputs"] = outputs;
+        
         return stats;
     }
     
@@ -169,12 +434,12 @@ public:
     json get_routing_config() {
         json config = json::array();
         
-        for (const auto& rule : routing_rules_) {
+        for (const auto& rule : std::atomic_load(&table_)->rules) {
             json rule_config;
             rule_config["input"] = rule.input_plugin;
             rule_config["outputs"] = rule.output_plugins;
             rule_config["enabled"] = rule.enabled;
-            rule_config["has_filter"] = (rule.filter != nullptr);
+            rule_config["has_filter"] = (rule.filter != nullptr) || !rule.match.empty();
             config.push_back(rule_config);
         }
         
@@ -183,7 +448,8 @@ public:
     
     // Clear all routing rules
     void clear_routes() {
-        routing_rules_.clear();
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        publish({});
         if (verbose_) {
             std::cout << "[PluginRouter] Cleared all routing rules" << std::endl;
         }
@@ -199,7 +465,7 @@ public:
         
         bool valid = true;
         
-        for (const auto& rule : routing_rules_) {
+        for (const auto& rule : std::atomic_load(&table_)->rules) {
             if (!rule.enabled) continue;
             
             // Validate input plugin (except wildcard)
@@ -221,6 +487,279 @@ public:
     }
     
 private:
+    // Parse "output_queues" and "routing_rules"; config_mutex_ must not be held
+    int apply_config(const json& config, bool replace) {
+        std::lock_guard<std::mutex> lock(config_mutex_);
+        std::vector<RoutingRule> rules;
+        if (!replace) {
+            rules = std::atomic_load(&table_)->rules;
+        }
+        try {
+            if (!config.contains("routing_rules")) {
+                // Default: route all inputs to all outputs
+                rules.emplace_back("*", output_manager_->get_active_plugin_names());
+            } else {
+                for (const auto& rule : config["routing_rules"]) {
+                    std::string input = rule["input"];
+                    std::vector<std::string> outputs = rule["outputs"];
+                    if (!rule.value("enabled", true)) {
+                        continue;
+                    }
+                    rules.emplace_back(input, outputs);
+                    if (rule.contains("filter")) {
+                        rules.back().match = RouteFilterIndex::parse_spec(rule["filter"]);
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "[PluginRouter] Error loading routes from config: " << e.what() << std::endl;
+            return -1;
+        }
+        
+        // Optional per-output queue settings; "*" sets the defaults, e.g.
+        // "output_queues": {"*": {"queue_size": 1024, "overflow_policy": "drop_newest"},
+        //                   "trunk_player_api": {"overflow_policy": "block", "block_timeout_ms": 250}}
+        // "batch_size" caps how many queued packets one process_batch() call gets
+        if (config.contains("output_queues")) {
+            if (replace) {
+                queue_defaults_ = json::object();
+                queue_overrides_ = json::object();
+            }
+            for (const auto& [name, settings] : config["output_queues"].items()) {
+                if (name == "*") {
+                    queue_defaults_ = settings;
+                } else {
+                    queue_overrides_[name] = settings;
+                }
+            }
+        }
+        
+        if (verbose_) {
+            std::cout << "[PluginRouter] " << (replace ? "Reloaded " : "Loaded ") << rules.size()
+                      << " routing rule(s)" << std::endl;
+        }
+        publish(std::move(rules));
+        return 0;
+    }
+    
+    // Resolve every rule to output queues and per-source rule masks, compile
+    // the declarative filters of all rules into one index, and swap the
+    // result in. Called with config_mutex_ held.
+    void publish(std::vector<RoutingRule> rules) {
+        auto table = std::make_shared<RoutingTable>();
+        table->rules = std::move(rules);
+        const size_t words = (table->rules.size() + 63) / 64;
+        table->wildcard.stats = source_stats_[0].get();
+        table->wildcard.rules.assign(words, 0);
+        
+        std::vector<RouteFilterIndex::Spec> specs;
+        for (const auto& rule : table->rules) {
+            specs.push_back(rule.match);
+            if (rule.input_plugin != "*") {
+                source_id(rule.input_plugin);
+            }
+        }
+        table->filter_index.build(specs);
+        
+        // Every named or registered source gets its own entry
+        for (const auto& source : source_ids_) {
+            SourceRoutes& routes = table->by_source[source.first];
+            routes.stats = source_stats_[source.second].get();
+            routes.rules.assign(words, 0);
+        }
+        
+        for (size_t i = 0; i < table->rules.size(); ++i) {
+            const RoutingRule& rule = table->rules[i];
+            
+            CompiledRoute route;
+            route.rule_index = i;
+            for (const auto& name : rule.output_plugins) {
+                route.outputs.push_back(&output_queue(name));
+            }
+            table->routes.push_back(route);
+            
+            if (!rule.enabled) continue;
+            
+            const uint64_t bit = 1ULL << (i % 64);
+            for (auto& source : table->by_source) {
+                if (rule.input_plugin == "*" || rule.input_plugin == source.first) {
+                    source.second.rules[i / 64] |= bit;
+                }
+            }
+            if (rule.input_plugin == "*") {
+                table->wildcard.rules[i / 64] |= bit;
+            }
+        }
+        std::atomic_store(&table_, std::shared_ptr<const RoutingTable>(std::move(table)));
+    }
+    
+    size_t source_id(const std::string& name) {
+        auto it = source_ids_.find(name);
+        if (it != source_ids_.end()) {
+            return it->second;
+        }
+        source_stats_.push_back(std::make_unique<SourceStats>(name));
+        source_ids_[name] = source_stats_.size() - 1;
+        return source_stats_.size() - 1;
+    }
+    
+    // A queue first named after start() gets its worker straight away
+    OutputQueue& output_queue(const std::string& name) {
+        auto it = output_index_.find(name);
+        if (it != output_index_.end()) {
+            return *outputs_[it->second];
+        }
+        outputs_.push_back(std::make_unique<OutputQueue>(name));
+        output_index_[name] = outputs_.size() - 1;
+        if (running_) {
+            start_output(*outputs_.back());
+        }
+        return *outputs_.back();
+    }
+    
+    // Resolve the queue's plugin and start its worker; a name with no active
+    // plugin keeps a queue without a ring, which enqueue() skips. The ring
+    // must not appear once a published table points at the queue, so only
+    // start() and publish() (before the swap) call this.
+    void start_output(OutputQueue& output) {
+        if (output.worker.joinable()) {
+            return;
+        }
+        if (!output.plugin) {
+            output.plugin = output_manager_->get_plugin(output.name);
+        }
+        if (!output.plugin) {
+            if (verbose_) {
+                std::cout << "[PluginRouter] No active output plugin named " << output.name
+                          << ", its routes are ignored" << std::endl;
+            }
+            return;
+        }
+        if (!output.ring) {
+            configure_queue(output);
+            output.ring = std::make_unique<MPMCRing<P25_TSBK_Data>>(output.capacity);
+        }
+        output.worker = std::thread(&PluginRouter::output_worker, this, &output);
+    }
+    
+    void configure_queue(OutputQueue& output) {
+        json settings = queue_defaults_;
+        if (queue_overrides_.contains(output.name)) {
+            settings.update(queue_overrides_[output.name]);
+        }
+        
+        output.capacity = settings.value("queue_size", output.capacity);
+        output.batch_size = std::max<size_t>(1, settings.value("batch_size", output.batch_size));
+        output.block_timeout = std::chrono::milliseconds(settings.value("block_timeout_ms", 100));
+        
+        std::string policy = settings.value("overflow_policy", std::string("drop_newest"));
+        if (policy == "drop_oldest") {
+            output.policy = OverflowPolicy::DROP_OLDEST;
+        } else if (policy == "block") {
+            output.policy = OverflowPolicy::BLOCK;
+        } else {
+            if (policy != "drop_newest") {
+                std::cerr << "[PluginRouter] Unknown overflow_policy for " << output.name 
+                          << ": " << policy << ", using drop_newest" << std::endl;
+            }
+            output.policy = OverflowPolicy::DROP_NEWEST;
+        }
+    }
+    
+    static const char* policy_name(OverflowPolicy policy) {
+        switch (policy) {
+            case OverflowPolicy::DROP_OLDEST: return "drop_oldest";
+            case OverflowPolicy::BLOCK: return "block";
+            default: return "drop_newest";
+        }
+    }
+    
+    void enqueue(OutputQueue& output, const P25_TSBK_Data& data) {
+        if (!output.ring) {
+            return; // No such output plugin
+        }
+        
+        if (output.ring->try_push(data)) {
+            output.enqueued++;
+            return;
+        }
+        
+        switch (output.policy) {
+            case OverflowPolicy::DROP_NEWEST:
+                output.dropped++;
+                output.dropped_metric->add();
+                return;
+                
+            case OverflowPolicy::DROP_OLDEST: {
+                P25_TSBK_Data evicted;
+                while (!output.ring->try_push(data)) {
+                    if (output.ring->try_pop(evicted)) {
+                        output.dropped++;
+                        output.dropped_metric->add();
+                    }
+                }
+                output.enqueued++;
+                return;
+            }
+            
+            case OverflowPolicy::BLOCK: {
+                // Backpressure: hold the input thread until the worker catches up
+                output.blocked++;
+                auto deadline = std::chrono::steady_clock::now() + output.block_timeout;
+                while (!output.ring->try_push(data)) {
+                    if (std::chrono::steady_clock::now() >= deadline || !running_) {
+                        output.dropped++;
+                        output.dropped_metric->add();
+                        return;
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                output.enqueued++;
+                return;
+            }
+        }
+    }
+    
+    // Wait for one packet, then take whatever else is already queued (up to
+    // batch_size) so the plugin gets one call for the whole run
+    void output_worker(OutputQueue* output) {
+        std::vector<P25_TSBK_Data> batch(output->batch_size);
+        std::vector<const P25_TSBK_Data*> packets(output->batch_size);
+        for (size_t i = 0; i < batch.size(); i++) {
+            packets[i] = &batch[i];
+        }
+        while (output->ring->wait_pop(batch[0], [this] { return running_.load(); })) {
+            size_t count = 1;
+            while (count < batch.size() && output->ring->try_pop(batch[count])) {
+                count++;
+            }
+            output->depth_metric->set(static_cast<int64_t>(output->ring->size()));
+            auto start = std::chrono::steady_clock::now();
+            size_t failed = count;
+            try {
+                std::lock_guard<std::mutex> plugin_lock(output->plugin_mutex);
+                PROFILE_STAGE(ProfileStage::DISPATCH);
+                failed = std::min(count, output->plugin->process_batch(packets.data(), count));
+            } catch (const std::exception& e) {
+                std::cerr << "[PluginRouter] Output " << output->name << " failed: " << e.what() << std::endl;
+            }
+            output->delivered += count - failed;
+            if (failed) {
+                output->errors += failed;
+                output->errors_metric->add(failed);
+            }
+            // Per message, as before batching
+            auto each = (std::chrono::steady_clock::now() - start) / count;
+            for (size_t i = 0; i < count; i++) {
+                output->latency_metric->record(each);
+            }
+            // Hand pooled packet buffers back now, not when the slots are next filled
+            for (size_t i = 0; i < count; i++) {
+                batch[i].tsbk_data = PacketBuffer();
+            }
+        }
+    }
+    
     // Helper method to get input plugin names (need to add this to InputPluginManager)
     std::vector<std::string> get_active_input_names() {
         // This would need to be implemented in InputPluginManager
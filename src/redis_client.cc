@@ -0,0 +1,253 @@
+#include "redis_client.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Nested arrays deeper than this are a protocol error, not a reply
+const int MAX_REPLY_DEPTH = 16;
+
+// Bulk strings and arrays larger than this are refused instead of allocated
+const long long MAX_BULK_BYTES = 512LL * 1024 * 1024;
+
+} // namespace
+
+RedisClient::RedisClient(const std::string& host, int port, const std::string& password, int timeout_ms)
+    : host_(host), port_(port), password_(password), timeout_ms_(timeout_ms > 0 ? timeout_ms : 5000),
+      fd_(-1), read_pos_(0) {
+}
+
+RedisClient::~RedisClient() {
+    close();
+}
+
+void RedisClient::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    buffer_.clear();
+    read_pos_ = 0;
+}
+
+bool RedisClient::fail(const std::string& why) {
+    error_ = why;
+    close();
+    return false;
+}
+
+bool RedisClient::connect() {
+    close();
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    int ret = getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &addresses);
+    if (ret != 0) {
+        return fail("cannot resolve " + host_ + ": " + gai_strerror(ret));
+    }
+
+    std::string last_error = "no addresses for " + host_;
+    for (struct addrinfo* a = addresses; a && fd_ < 0; a = a->ai_next) {
+        int fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd < 0) {
+            last_error = std::strerror(errno);
+            continue;
+        }
+        // Non-blocking connect so a dead host costs timeout_ms, not the kernel's SYN retries
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) != 0 && errno != EINPROGRESS) {
+            last_error = std::strerror(errno);
+            ::close(fd);
+            continue;
+        }
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (poll(&pfd, 1, timeout_ms_) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+            last_error = error != 0 ? std::strerror(error) : "connect timed out";
+            ::close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fd_ = fd;
+    }
+    freeaddrinfo(addresses);
+    if (fd_ < 0) {
+        return fail(host_ + ":" + std::to_string(port_) + ": " + last_error);
+    }
+
+    if (!password_.empty()) {
+        Reply reply;
+        if (!command({"AUTH", password_}, reply)) {
+            return false;
+        }
+        if (reply.is_error()) {
+            return fail("AUTH failed: " + reply.str);
+        }
+    }
+    error_.clear();
+    return true;
+}
+
+bool RedisClient::send_all(const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = {fd_, POLLOUT, 0};
+            if (poll(&pfd, 1, timeout_ms_) == 1) {
+                continue;
+            }
+            return fail("send timed out");
+        }
+        return fail(std::string("send failed: ") + std::strerror(errno));
+    }
+    return true;
+}
+
+bool RedisClient::fill(int timeout_ms) {
+    if (read_pos_ > 0 && read_pos_ * 2 >= buffer_.size()) {
+        buffer_.erase(0, read_pos_);
+        read_pos_ = 0;
+    }
+    char chunk[16384];
+    while (true) {
+        ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+        if (n > 0) {
+            buffer_.append(chunk, static_cast<size_t>(n));
+            return true;
+        }
+        if (n == 0) {
+            return fail("connection closed by server");
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return fail(std::string("recv failed: ") + std::strerror(errno));
+        }
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready != 1) {
+            return fail("reply timed out");
+        }
+    }
+}
+
+bool RedisClient::read_line(std::string& line, int timeout_ms) {
+    size_t end;
+    while ((end = buffer_.find("\r\n", read_pos_)) == std::string::npos) {
+        if (!fill(timeout_ms)) {
+            return false;
+        }
+    }
+    line.assign(buffer_, read_pos_, end - read_pos_);
+    read_pos_ = end + 2;
+    return true;
+}
+
+bool RedisClient::read_reply(Reply& reply, int timeout_ms, int depth) {
+    if (depth > MAX_REPLY_DEPTH) {
+        return fail("reply nested too deeply");
+    }
+    std::string line;
+    if (!read_line(line, timeout_ms)) {
+        return false;
+    }
+    if (line.empty()) {
+        return fail("empty reply line");
+    }
+    const char kind = line[0];
+    const std::string rest = line.substr(1);
+    switch (kind) {
+        case '+':
+            reply.type = Reply::STATUS;
+            reply.str = rest;
+            return true;
+        case '-':
+            reply.type = Reply::ERROR;
+            reply.str = rest;
+            return true;
+        case ':':
+            reply.type = Reply::INTEGER;
+            reply.integer = std::strtoll(rest.c_str(), nullptr, 10);
+            return true;
+        case '$': {
+            long long length = std::strtoll(rest.c_str(), nullptr, 10);
+            if (length < 0) {
+                reply.type = Reply::NIL;
+                return true;
+            }
+            if (length > MAX_BULK_BYTES) {
+                return fail("bulk reply too large");
+            }
+            while (buffer_.size() - read_pos_ < static_cast<size_t>(length) + 2) {
+                if (!fill(timeout_ms)) {
+                    return false;
+                }
+            }
+            reply.type = Reply::STRING;
+            reply.str.assign(buffer_, read_pos_, static_cast<size_t>(length));
+            read_pos_ += static_cast<size_t>(length) + 2;
+            return true;
+        }
+        case '*': {
+            long long count = std::strtoll(rest.c_str(), nullptr, 10);
+            if (count < 0) {
+                reply.type = Reply::NIL;
+                return true;
+            }
+            if (count > MAX_BULK_BYTES) {
+                return fail("array reply too large");
+            }
+            reply.type = Reply::ARRAY;
+            reply.elements.clear();
+            reply.elements.resize(static_cast<size_t>(count));
+            for (Reply& element : reply.elements) {
+                if (!read_reply(element, timeout_ms, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            return fail(std::string("unexpected reply type '") + kind + "'");
+    }
+}
+
+bool RedisClient::command(const std::vector<std::string>& args, Reply& reply, int extra_wait_ms) {
+    if (fd_ < 0 && !connect()) {
+        return false;
+    }
+    std::string request = "*" + std::to_string(args.size()) + "\r\n";
+    for (const std::string& arg : args) {
+        request += "$" + std::to_string(arg.size()) + "\r\n";
+        request += arg;
+        request += "\r\n";
+    }
+    if (!send_all(request)) {
+        return false;
+    }
+    reply = Reply();
+    return read_reply(reply, timeout_ms_ + (extra_wait_ms > 0 ? extra_wait_ms : 0));
+}
@@ -0,0 +1,71 @@
+/*
+ * Minimal Redis client
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Just enough RESP2 over a blocking TCP socket for the cluster job queue:
+ * send one command, read its reply. There is no pipelining, pub/sub or
+ * cluster redirection, and nothing here is thread safe; give each thread
+ * its own client or hold a lock around it.
+ *
+ * A command whose connection fails drops the socket and returns false; the
+ * next command reconnects (and re-sends AUTH), so callers only decide
+ * whether to retry. A Redis error reply (-ERR ...) is a successful round
+ * trip with reply.type == ERROR.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class RedisClient {
+public:
+    struct Reply {
+        enum Type { NIL, STATUS, ERROR, INTEGER, STRING, ARRAY };
+
+        Type type = NIL;
+        std::string str;                 // STATUS, ERROR and STRING
+        int64_t integer = 0;
+        std::vector<Reply> elements;     // ARRAY
+
+        bool is_error() const { return type == ERROR; }
+        bool is_nil() const { return type == NIL; }
+    };
+
+    RedisClient(const std::string& host, int port, const std::string& password = "", int timeout_ms = 5000);
+    ~RedisClient();
+
+    RedisClient(const RedisClient&) = delete;
+    RedisClient& operator=(const RedisClient&) = delete;
+
+    // Connect (and AUTH) now rather than on the first command
+    bool connect();
+    void close();
+    bool connected() const { return fd_ >= 0; }
+
+    // extra_wait_ms is added to the read timeout, for commands that block
+    // on the server (XREADGROUP ... BLOCK)
+    bool command(const std::vector<std::string>& args, Reply& reply, int extra_wait_ms = 0);
+
+    // Why the last connect or command failed
+    const std::string& error() const { return error_; }
+
+private:
+    bool send_all(const std::string& data);
+    bool fill(int timeout_ms);
+    bool read_line(std::string& line, int timeout_ms);
+    bool read_reply(Reply& reply, int timeout_ms, int depth = 0);
+    bool fail(const std::string& why);
+
+    std::string host_;
+    int port_;
+    std::string password_;
+    int timeout_ms_;
+    int fd_;
+
+    std::string buffer_;
+    size_t read_pos_;
+    std::string error_;
+};
@@ -0,0 +1,242 @@
+/*
+ * Compiled routing filters for trunk-decoder
+ * Declarative NAC / system / site / talkgroup matching for routing rules
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Each routing rule may carry a "filter" object such as
+ *   {"nac": ["0x293", "0x2A0-0x2AF"], "site_id": [1, 2], "talkgroup": ["100-199", 4201]}
+ * Values are numbers, "N" or "LO-HI" strings (decimal or 0x hex) or
+ * {"min": LO, "max": HI} objects. A packet matches a rule when every
+ * dimension the rule constrains contains the packet's value.
+ *
+ * The filters of all rules are compiled together into one flat table per
+ * dimension that maps a value straight to the bitset of rules accepting
+ * it, so matching costs one table load and a few word ANDs per dimension
+ * no matter how many rules exist.
+ */
+
+#pragma once
+
+#include "plugin_api.h"
+#include "tsbk_message.h"
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+#include <stdexcept>
+
+class RouteFilterIndex {
+public:
+    enum Dimension {
+        DIM_NAC = 0,        // system_id & 0xFFF (the P25C header carries the NAC there)
+        DIM_SYSTEM_ID,      // 12-bit P25 system ID, full system_id field
+        DIM_SITE_ID,        // 8-bit site ID
+        DIM_TALKGROUP,      // group address from voice grant TSBKs
+        DIM_COUNT
+    };
+
+    // Inclusive value ranges per dimension; an empty list leaves it unconstrained
+    struct Spec {
+        std::vector<std::pair<uint32_t, uint32_t>> ranges[DIM_COUNT];
+
+        bool empty() const {
+            for (const auto& r : ranges) {
+                if (!r.empty()) return false;
+            }
+            return true;
+        }
+    };
+
+    // Parse a rule's "filter" object; throws std::invalid_argument on bad input
+    static Spec parse_spec(const json& filter) {
+        Spec spec;
+        static const char* keys[DIM_COUNT] = {"nac", "system_id", "site_id", "talkgroup"};
+        for (int d = 0; d < DIM_COUNT; d++) {
+            if (!filter.contains(keys[d])) continue;
+            const json& values = filter[keys[d]];
+            if (values.is_array()) {
+                for (const auto& v : values) {
+                    spec.ranges[d].push_back(parse_range(v));
+                }
+            } else {
+                spec.ranges[d].push_back(parse_range(values));
+            }
+            for (const auto& r : spec.ranges[d]) {
+                if (r.first > r.second || r.second >= domain_size(static_cast<Dimension>(d))) {
+                    throw std::invalid_argument(std::string("filter value out of range for ") + keys[d]);
+                }
+            }
+        }
+        return spec;
+    }
+
+    RouteFilterIndex() : rule_count_(0), words_(0) {}
+
+    // Compile specs for rules 0..specs.size()-1
+    void build(const std::vector<Spec>& specs) {
+        rule_count_ = specs.size();
+        words_ = (rule_count_ + 63) / 64;
+        for (int d = 0; d < DIM_COUNT; d++) {
+            build_dimension(static_cast<Dimension>(d), specs);
+        }
+    }
+
+    size_t words() const { return words_; }
+
+    // AND into mask (words() long) the rules whose filters accept data
+    void match(const P25_TSBK_Data& data, uint64_t* mask) const {
+        apply(DIM_NAC, data.system_id & 0xFFF, mask);
+        apply(DIM_SYSTEM_ID, data.system_id, mask);
+        apply(DIM_SITE_ID, data.site_id, mask);
+
+        // A packet may name several talkgroups; a rule matches if any is accepted
+        const Table& tg = tables_[DIM_TALKGROUP];
+        uint32_t groups[MAX_TALKGROUPS];
+        size_t count = extract_talkgroups(data, groups, MAX_TALKGROUPS);
+        const uint64_t* sets[MAX_TALKGROUPS];
+        for (size_t i = 0; i < count; i++) {
+            sets[i] = bitset(tg, tg.ids[groups[i]]);
+        }
+        const uint64_t* none = bitset(tg, tg.unconstrained);
+        for (size_t w = 0; w < words_; w++) {
+            uint64_t accepted = count ? 0 : none[w];
+            for (size_t i = 0; i < count; i++) {
+                accepted |= sets[i][w];
+            }
+            mask[w] &= accepted;
+        }
+    }
+
+    // Group addresses from standard voice grant TSBKs (12-byte blocks)
+    static size_t extract_talkgroups(const P25_TSBK_Data& data, uint32_t* groups, size_t max_groups) {
+        size_t count = 0;
+        const uint8_t* p = data.tsbk_data.data();
+        for (size_t off = 0; off + TsbkMessage::BLOCK_SIZE <= data.tsbk_data.size() && count < max_groups;
+             off += TsbkMessage::BLOCK_SIZE) {
+            TsbkMessage message;
+            if (!message.parse(p + off)) continue;
+            for (size_t i = 0; i < message.group_grants && count < max_groups; i++) {
+                groups[count++] = message.group[i];
+            }
+        }
+        return count;
+    }
+
+private:
+    static constexpr size_t MAX_TALKGROUPS = 8;
+
+    // value -> bitset id; bitsets are stored back to back in sets
+    struct Table {
+        std::vector<uint32_t> ids;
+        std::vector<uint64_t> sets;
+        uint32_t unconstrained;  // rules that do not filter on this dimension
+    };
+
+    size_t rule_count_;
+    size_t words_;
+    Table tables_[DIM_COUNT];
+
+    static uint32_t domain_size(Dimension d) {
+        return d == DIM_TALKGROUP ? 0x10000 : (d == DIM_SITE_ID ? 0x100 : 0x1000);
+    }
+
+    static std::pair<uint32_t, uint32_t> parse_range(const json& v) {
+        if (v.is_number_unsigned() || v.is_number_integer()) {
+            uint32_t n = v.get<uint32_t>();
+            return {n, n};
+        }
+        if (v.is_object()) {
+            return {parse_number(v.at("min")), parse_number(v.at("max"))};
+        }
+        if (v.is_string()) {
+            std::string s = v.get<std::string>();
+            size_t dash = s.find('-', 1);
+            if (dash == std::string::npos) {
+                uint32_t n = parse_number(s);
+                return {n, n};
+            }
+            return {parse_number(s.substr(0, dash)), parse_number(s.substr(dash + 1))};
+        }
+        throw std::invalid_argument("unsupported filter value: " + v.dump());
+    }
+
+    static uint32_t parse_number(const json& v) {
+        if (v.is_string()) {
+            return static_cast<uint32_t>(std::stoul(v.get<std::string>(), nullptr, 0));
+        }
+        return v.get<uint32_t>();
+    }
+
+    const uint64_t* bitset(const Table& table, uint32_t id) const {
+        return table.sets.data() + static_cast<size_t>(id) * words_;
+    }
+
+    void apply(Dimension d, uint32_t value, uint64_t* mask) const {
+        const Table& table = tables_[d];
+        uint32_t id = value < table.ids.size() ? table.ids[value] : table.unconstrained;
+        const uint64_t* set = bitset(table, id);
+        for (size_t w = 0; w < words_; w++) {
+            mask[w] &= set[w];
+        }
+    }
+
+    void build_dimension(Dimension d, const std::vector<Spec>& specs) {
+        Table& table = tables_[d];
+        const uint32_t domain = domain_size(d);
+        table.ids.assign(domain, 0);
+        table.sets.clear();
+
+        // Values only change rule membership at range boundaries, so compute
+        // one bitset per segment between boundaries and share equal ones
+        std::set<uint32_t> bounds = {0, domain};
+        for (const auto& spec : specs) {
+            for (const auto& r : spec.ranges[d]) {
+                bounds.insert(r.first);
+                bounds.insert(r.second + 1);
+            }
+        }
+
+        std::map<std::vector<uint64_t>, uint32_t> unique;
+        auto intern = [&](const std::vector<uint64_t>& bits) {
+            auto it = unique.find(bits);
+            if (it != unique.end()) return it->second;
+            uint32_t id = static_cast<uint32_t>(unique.size());
+            unique[bits] = id;
+            table.sets.insert(table.sets.end(), bits.begin(), bits.end());
+            return id;
+        };
+
+        std::vector<uint64_t> bits(words_);
+        for (size_t rule = 0; rule < specs.size(); rule++) {
+            if (specs[rule].ranges[d].empty()) {
+                bits[rule / 64] |= 1ULL << (rule % 64);
+            }
+        }
+        table.unconstrained = intern(bits);
+
+        for (auto it = bounds.begin(); it != bounds.end() && *it < domain; ++it) {
+            uint32_t lo = *it;
+            uint32_t hi = *std::next(it); // exclusive
+            std::vector<uint64_t> segment(words_);
+            for (size_t rule = 0; rule < specs.size(); rule++) {
+                bool accepted = specs[rule].ranges[d].empty();
+                for (const auto& r : specs[rule].ranges[d]) {
+                    if (lo >= r.first && lo <= r.second) {
+                        accepted = true;
+                        break;
+                    }
+                }
+                if (accepted) {
+                    segment[rule / 64] |= 1ULL << (rule % 64);
+                }
+            }
+            uint32_t id = intern(segment);
+            std::fill(table.ids.begin() + lo, table.ids.begin() + hi, id);
+        }
+    }
+};
@@ -0,0 +1,221 @@
+#include "script_executor.h"
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+std::string executor_label(const std::string& name) {
+    return "executor=\"" + MetricsRegistry::escape_label(name) + "\"";
+}
+
+// Longest the supervisor sleeps with a child it cannot poll on (no pidfd)
+constexpr int REAP_POLL_MS = 50;
+
+} // namespace
+
+ScriptExecutor::ScriptExecutor(const std::string& name, int max_concurrent, size_t queue_size)
+    : name_(name), max_concurrent_(max_concurrent > 0 ? max_concurrent : 1), capacity_(queue_size > 0 ? queue_size : 1),
+      kill_grace_(ChildProcess::DEFAULT_KILL_GRACE), stopping_(false),
+      running_count_(0), succeeded_(0), failed_(0), timed_out_(0),
+      duration_metric_(MetricsRegistry::global().histogram("trunk_decoder_script_duration_seconds",
+                                                           "Run time of external scripts", executor_label(name))),
+      queued_metric_(MetricsRegistry::global().gauge("trunk_decoder_script_queue_depth",
+                                                     "External scripts waiting to start", executor_label(name))),
+      running_metric_(MetricsRegistry::global().gauge("trunk_decoder_scripts_running",
+                                                      "External scripts running", executor_label(name))) {}
+
+ScriptExecutor::~ScriptExecutor() {
+    stop();
+}
+
+void ScriptExecutor::configure(int max_concurrent, size_t queue_size) {
+    max_concurrent_ = max_concurrent > 0 ? max_concurrent : 1;
+    capacity_ = queue_size > 0 ? queue_size : 1;
+}
+
+void ScriptExecutor::start() {
+    if (supervisor_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+    }
+    supervisor_ = std::thread(&ScriptExecutor::supervise, this);
+}
+
+void ScriptExecutor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    not_full_.notify_all();
+    wake_.notify();
+    if (supervisor_.joinable()) {
+        supervisor_.join();
+    }
+}
+
+size_t ScriptExecutor::queued() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+bool ScriptExecutor::submit(Request request, Callback done) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return stopping_ || queue_.size() < capacity_; });
+        if (stopping_) {
+            return false;
+        }
+        queue_.push_back(Pending{std::move(request), std::move(done)});
+        queued_metric_.set(static_cast<int64_t>(queue_.size()));
+    }
+    wake_.notify();
+    return true;
+}
+
+void ScriptExecutor::launch(Pending pending) {
+    Child child;
+    child.done = std::move(pending.done);
+    child.started = std::chrono::steady_clock::now();
+    child.deadline = pending.request.timeout.count() > 0 ? child.started + pending.request.timeout
+                                                         : std::chrono::steady_clock::time_point::max();
+    child.kill_at = std::chrono::steady_clock::time_point::max();
+    child.terminating = false;
+    child.pid = ChildProcess::spawn(pending.request.argv, pending.request.quiet, child.result.spawn_error);
+    if (child.pid < 0) {
+        std::cerr << "[ScriptExecutor] " << name_ << ": could not start "
+                  << (pending.request.argv.empty() ? std::string("(empty command)") : pending.request.argv[0])
+                  << ": " << std::strerror(child.result.spawn_error) << std::endl;
+        child.pidfd = -1;
+        finish(child);
+        return;
+    }
+    child.result.started = true;
+    child.pidfd = ChildProcess::open_pidfd(child.pid);
+    children_.push_back(std::move(child));
+    running_count_++;
+    running_metric_.set(running_count_.load());
+}
+
+void ScriptExecutor::finish(Child& child) {
+    child.result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - child.started);
+    if (child.pidfd >= 0) {
+        close(child.pidfd);
+        child.pidfd = -1;
+    }
+
+    MetricsRegistry& registry = MetricsRegistry::global();
+    const char* outcome;
+    if (child.result.timed_out) {
+        outcome = "timed_out";
+        timed_out_++;
+    } else if (child.result.ok()) {
+        outcome = "succeeded";
+        succeeded_++;
+    } else {
+        outcome = child.result.started ? "failed" : "spawn_failed";
+        failed_++;
+    }
+    registry.counter("trunk_decoder_scripts_total", "External scripts run, by result",
+                     executor_label(name_) + ",result=\"" + outcome + "\"").add();
+    if (child.result.started) {
+        duration_metric_.record(child.result.elapsed);
+        if (child.result.exit_code >= 0) {
+            registry.counter("trunk_decoder_script_exits_total", "External scripts that exited, by exit code",
+                             executor_label(name_) + ",code=\"" + std::to_string(child.result.exit_code) + "\"").add();
+        }
+    }
+
+    if (child.done) {
+        try {
+            child.done(child.result);
+        } catch (const std::exception& e) {
+            std::cerr << "[ScriptExecutor] " << name_ << ": completion callback failed: " << e.what() << std::endl;
+        }
+    }
+}
+
+void ScriptExecutor::supervise() {
+    std::vector<struct pollfd> fds;
+    for (;;) {
+        // Start what the limit allows
+        std::vector<Pending> starting;
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (!queue_.empty() && children_.size() + starting.size() < static_cast<size_t>(max_concurrent_)) {
+                starting.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+            }
+            queued_metric_.set(static_cast<int64_t>(queue_.size()));
+            stopping = stopping_ && queue_.empty();
+        }
+        if (!starting.empty()) {
+            not_full_.notify_all();
+        }
+        for (Pending& pending : starting) {
+            launch(std::move(pending));
+        }
+        if (stopping && children_.empty()) {
+            break;
+        }
+
+        // Sleep until a child exits, a deadline comes up or more work is queued
+        auto now = std::chrono::steady_clock::now();
+        auto wake_at = std::chrono::steady_clock::time_point::max();
+        bool blind = false;
+        fds.clear();
+        fds.push_back({wake_.fd(), POLLIN, 0});
+        for (const Child& child : children_) {
+            if (child.pidfd >= 0) {
+                fds.push_back({child.pidfd, POLLIN, 0});
+            } else {
+                blind = true;
+            }
+            wake_at = std::min(wake_at, child.terminating ? child.kill_at : child.deadline);
+        }
+        int timeout_ms = -1;
+        if (wake_at != std::chrono::steady_clock::time_point::max()) {
+            timeout_ms = static_cast<int>(std::max<int64_t>(0,
+                std::chrono::duration_cast<std::chrono::milliseconds>(wake_at - now).count() + 1));
+        }
+        if (blind && (timeout_ms < 0 || timeout_ms > REAP_POLL_MS)) {
+            timeout_ms = REAP_POLL_MS;
+        }
+        poll(fds.data(), fds.size(), timeout_ms);
+        if (fds[0].revents & POLLIN) {
+            wake_.drain();
+        }
+
+        // Reap, and enforce deadlines on what is still running
+        now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < children_.size(); ) {
+            Child& child = children_[i];
+            if (ChildProcess::try_reap(child.pid, child.result)) {
+                Child done = std::move(child);
+                children_.erase(children_.begin() + static_cast<std::ptrdiff_t>(i));
+                running_count_--;
+                running_metric_.set(running_count_.load());
+                finish(done);
+                continue;
+            }
+            if (!child.terminating && now >= child.deadline) {
+                kill(-child.pid, SIGTERM);
+                child.terminating = true;
+                child.result.timed_out = true;
+                child.kill_at = now + kill_grace_;
+            } else if (child.terminating && now >= child.kill_at) {
+                kill(-child.pid, SIGKILL);
+                child.kill_at = std::chrono::steady_clock::time_point::max();
+            }
+            ++i;
+        }
+    }
+}
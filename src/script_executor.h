@@ -0,0 +1,117 @@
+/*
+ * Bounded runner for external scripts
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Upload scripts used to run through std::system() on whichever thread
+ * reached them: a shell per call, that thread held until the script
+ * exited, and no limit on how many ran at once across threads. Here they
+ * queue instead, and one supervisor thread keeps at most max_concurrent
+ * running. Each is started with posix_spawnp() in its own process group
+ * (see child_process.h), watched through a pidfd, and killed with its
+ * group when its timeout passes: SIGTERM first, SIGKILL kill_grace later.
+ *
+ * submit() blocks while the queue is full, like a StagePool. Callbacks run
+ * on the supervisor thread as each script is reaped, so they should only
+ * hand the result on. stop() lets everything queued run first.
+ *
+ * /metrics gets trunk_decoder_scripts_total by result, exits by code,
+ * run time, and the queue depth and running count.
+ */
+
+#pragma once
+
+#include "child_process.h"
+#include "event_notifier.h"
+#include "metrics.h"
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ScriptExecutor {
+public:
+    typedef ChildProcess::Result Result;
+    typedef std::function<void(const Result&)> Callback;
+
+    struct Request {
+        std::vector<std::string> argv;
+        std::chrono::milliseconds timeout{0};   // 0 for none
+        bool quiet = false;                     // stdout and stderr to /dev/null
+    };
+
+    ScriptExecutor(const std::string& name, int max_concurrent, size_t queue_size);
+    ~ScriptExecutor();
+
+    ScriptExecutor(const ScriptExecutor&) = delete;
+    ScriptExecutor& operator=(const ScriptExecutor&) = delete;
+
+    // Only valid while stopped
+    void configure(int max_concurrent, size_t queue_size);
+    void set_kill_grace(std::chrono::milliseconds grace) { kill_grace_ = grace; }
+
+    void start();
+    // Run everything queued, wait for it, then join the supervisor
+    void stop();
+
+    // Queue a script; blocks while the queue is full, false once stopping.
+    // done is called exactly once when it returns true.
+    bool submit(Request request, Callback done);
+
+    int max_concurrent() const { return max_concurrent_; }
+    size_t queued();
+    int running() const { return running_count_.load(); }
+    uint64_t succeeded() const { return succeeded_.load(); }
+    uint64_t failed() const { return failed_.load(); }     // non-zero exit, signal or spawn failure
+    uint64_t timed_out() const { return timed_out_.load(); }
+
+private:
+    struct Pending {
+        Request request;
+        Callback done;
+    };
+
+    struct Child {
+        pid_t pid;
+        int pidfd;
+        Callback done;
+        Result result;
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point deadline;   // max() for none
+        std::chrono::steady_clock::time_point kill_at;    // SIGKILL after the grace, once terminating
+        bool terminating;
+    };
+
+    void supervise();
+    void launch(Pending pending);
+    void finish(Child& child);
+
+    std::string name_;
+    int max_concurrent_;
+    size_t capacity_;
+    std::chrono::milliseconds kill_grace_;
+
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::deque<Pending> queue_;
+    bool stopping_;
+    EventNotifier wake_;
+    std::thread supervisor_;
+
+    std::vector<Child> children_;   // supervisor thread only
+    std::atomic<int> running_count_;
+    std::atomic<uint64_t> succeeded_;
+    std::atomic<uint64_t> failed_;
+    std::atomic<uint64_t> timed_out_;
+
+    MetricsRegistry::Histogram& duration_metric_;
+    MetricsRegistry::Gauge& queued_metric_;
+    MetricsRegistry::Gauge& running_metric_;
+};
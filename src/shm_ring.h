@@ -0,0 +1,297 @@
+/*
+ * Shared-memory record ring
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Single-producer single-consumer ring of variable-length records in a
+ * memfd mapping, so two processes can share it: the creator passes fd() to
+ * the other side, which attaches to the same pages. Each record is an
+ * 8-byte header (length, type) followed by its payload, padded to 8 bytes.
+ * A record that would run past the end of the buffer is preceded by a pad
+ * record and starts again at offset 0, so every payload is contiguous and
+ * the reader hands out pointers straight into the mapping. The reader only
+ * gives space back when it calls release(), so a reader that dies part way
+ * leaves its unfinished records for the next one.
+ *
+ * The head and tail counters are the only shared state; neither side
+ * takes a lock or makes a syscall per record. Wakeups are left to the
+ * caller (an eventfd per direction works well), or, between processes
+ * that only share the ring's name, to wait_for_data() and wake_reader():
+ * a futex in the mapping that the producer only touches while the
+ * consumer is actually asleep on it.
+ *
+ * open_named() puts the ring in POSIX shared memory (shm_open) instead of
+ * a memfd, for a producer that is not our child and opens it by name.
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+class ShmRing {
+public:
+    static constexpr uint32_t PAD = 0;
+
+    struct Record {
+        uint32_t type;
+        const uint8_t* data;
+        size_t length;
+    };
+
+    ShmRing() : fd_(-1), map_(nullptr), map_bytes_(0), header_(nullptr), data_(nullptr) {}
+
+    ~ShmRing() { detach(); }
+
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    // New anonymous ring of at least capacity bytes (rounded up to a power of two)
+    bool create(size_t capacity, const char* name = "trunk-decoder-ring") {
+        detach();
+        size_t size = 4096;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        fd_ = memfd_create(name, MFD_CLOEXEC);
+        if (fd_ < 0) {
+            return false;
+        }
+        return initialize(size);
+    }
+
+    // Ring in POSIX shared memory under name ("/trunk-decoder-p25").
+    // An existing ring there is attached as it is, records and all; with
+    // create, anything else under the name is replaced by a new ring of
+    // at least capacity bytes.
+    bool open_named(const char* name, size_t capacity, bool create) {
+        detach();
+        int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+        if (fd >= 0 && attach(fd)) {
+            return true;
+        }
+        if (!create) {
+            return false;
+        }
+        size_t size = 4096;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        fd_ = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd_ < 0) {
+            return false;
+        }
+        return initialize(size);
+    }
+
+    static void unlink_named(const char* name) { shm_unlink(name); }
+
+    // Map a ring another process created; takes ownership of fd
+    bool attach(int fd) {
+        detach();
+        fd_ = fd;
+        if (!map() || header_->magic != MAGIC || map_bytes_ != sizeof(Header) + header_->capacity) {
+            detach();
+            return false;
+        }
+        data_ = reinterpret_cast<uint8_t*>(header_ + 1);
+        return true;
+    }
+
+    void detach() {
+        if (map_) {
+            munmap(map_, map_bytes_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+        fd_ = -1;
+        map_ = nullptr;
+        header_ = nullptr;
+        data_ = nullptr;
+    }
+
+    bool valid() const { return header_ != nullptr; }
+    int fd() const { return fd_; }
+    size_t capacity() const { return header_->capacity; }
+
+    // Bytes queued, padding included
+    size_t used() const {
+        return static_cast<size_t>(header_->head.load(std::memory_order_acquire) -
+                                   header_->tail.load(std::memory_order_acquire));
+    }
+
+    // Largest payload a single record can carry
+    size_t max_payload() const { return header_->capacity / 2 - sizeof(RecordHeader); }
+
+    // One contiguous part of a record being written
+    struct Piece {
+        const void* data;
+        size_t size;
+    };
+
+    // Producer: append one record, gathered from pieces (a fixed header and
+    // a body, say); false if there is not room for it right now
+    bool try_write(uint32_t type, const Piece* pieces, size_t count) {
+        size_t payload = 0;
+        for (size_t i = 0; i < count; i++) {
+            payload += pieces[i].size;
+        }
+        if (payload > max_payload()) {
+            return false;
+        }
+        size_t needed = align(sizeof(RecordHeader) + payload);
+        uint64_t head = header_->head.load(std::memory_order_relaxed);
+        uint64_t tail = header_->tail.load(std::memory_order_acquire);
+        size_t capacity = header_->capacity;
+        size_t offset = static_cast<size_t>(head & (capacity - 1));
+        size_t to_end = capacity - offset;
+        size_t pad = needed > to_end ? to_end : 0;
+        if (capacity - static_cast<size_t>(head - tail) < pad + needed) {
+            return false;
+        }
+        if (pad) {
+            RecordHeader* filler = reinterpret_cast<RecordHeader*>(data_ + offset);
+            filler->length = static_cast<uint32_t>(to_end - sizeof(RecordHeader));
+            filler->type = PAD;
+            head += pad;
+            offset = 0;
+        }
+        RecordHeader* record = reinterpret_cast<RecordHeader*>(data_ + offset);
+        record->length = static_cast<uint32_t>(payload);
+        record->type = type;
+        uint8_t* out = reinterpret_cast<uint8_t*>(record + 1);
+        for (size_t i = 0; i < count; i++) {
+            if (pieces[i].size) {
+                std::memcpy(out, pieces[i].data, pieces[i].size);
+                out += pieces[i].size;
+            }
+        }
+        header_->head.store(head + needed, std::memory_order_release);
+        return true;
+    }
+
+    bool try_write(uint32_t type, const void* data, size_t size) {
+        Piece piece = {data, size};
+        return try_write(type, &piece, 1);
+    }
+
+    // Consumer: where reading starts, for next()
+    uint64_t read_cursor() const { return header_->tail.load(std::memory_order_relaxed); }
+
+    // Consumer: read the record at cursor and step past it; false when the
+    // ring holds nothing more. Records stay in the ring, and their data
+    // stays valid, until release().
+    bool next(uint64_t& cursor, Record& out) const {
+        for (;;) {
+            if (cursor == header_->head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            const RecordHeader* record = reinterpret_cast<const RecordHeader*>(data_ + (cursor & (header_->capacity - 1)));
+            cursor += align(sizeof(RecordHeader) + record->length);
+            if (record->type == PAD) {
+                continue;
+            }
+            out.type = record->type;
+            out.data = reinterpret_cast<const uint8_t*>(record + 1);
+            out.length = record->length;
+            return true;
+        }
+    }
+
+    // Consumer: hand everything before cursor back to the producer
+    void release(uint64_t cursor) { header_->tail.store(cursor, std::memory_order_release); }
+
+    // Consumer: sleep until there is a record past cursor or timeout_ms
+    // passes; true if there is one
+    bool wait_for_data(uint64_t cursor, int timeout_ms) {
+        uint32_t seq = header_->wake_seq.load(std::memory_order_acquire);
+        header_->reader_parked.store(1, std::memory_order_seq_cst);
+        if (cursor == header_->head.load(std::memory_order_seq_cst)) {
+            struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+            syscall(SYS_futex, &header_->wake_seq, FUTEX_WAIT, seq, &timeout, nullptr, 0);
+        }
+        header_->reader_parked.store(0, std::memory_order_relaxed);
+        return cursor != header_->head.load(std::memory_order_acquire);
+    }
+
+    // Producer: after writing, wake a consumer in wait_for_data(); no
+    // syscall unless one is asleep
+    void wake_reader() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header_->reader_parked.load(std::memory_order_seq_cst)) {
+            header_->wake_seq.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, &header_->wake_seq, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+        }
+    }
+
+private:
+    static constexpr uint64_t MAGIC = 0x50323552494E4731ULL;  // "P25RING1"
+
+    struct Header {
+        uint64_t magic;
+        uint64_t capacity;
+        alignas(64) std::atomic<uint64_t> head;  // written by the producer
+        alignas(64) std::atomic<uint64_t> tail;  // written by the consumer
+        alignas(64) std::atomic<uint32_t> reader_parked;  // consumer is in wait_for_data()
+        std::atomic<uint32_t> wake_seq;                   // the futex it sleeps on
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters must be lock-free to share between processes");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "ring counters must be lock-free to share between processes");
+
+    struct RecordHeader {
+        uint32_t length;
+        uint32_t type;
+    };
+
+    static size_t align(size_t n) { return (n + 7) & ~static_cast<size_t>(7); }
+
+    // Size fd_ for a ring of size bytes and lay out an empty one; the magic
+    // goes in last so a producer opening it by name never sees half of it
+    bool initialize(size_t size) {
+        if (ftruncate(fd_, static_cast<off_t>(sizeof(Header) + size)) != 0 || !map()) {
+            detach();
+            return false;
+        }
+        header_->magic = 0;
+        header_->capacity = size;
+        header_->head.store(0, std::memory_order_relaxed);
+        header_->tail.store(0, std::memory_order_relaxed);
+        header_->reader_parked.store(0, std::memory_order_relaxed);
+        header_->wake_seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        header_->magic = MAGIC;
+        data_ = reinterpret_cast<uint8_t*>(header_ + 1);
+        return true;
+    }
+
+    bool map() {
+        off_t end = lseek(fd_, 0, SEEK_END);
+        if (end < static_cast<off_t>(sizeof(Header))) {
+            return false;
+        }
+        void* p = mmap(nullptr, static_cast<size_t>(end), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        map_ = p;
+        map_bytes_ = static_cast<size_t>(end);
+        header_ = static_cast<Header*>(p);
+        return true;
+    }
+
+    int fd_;
+    void* map_;
+    size_t map_bytes_;
+    Header* header_;
+    uint8_t* data_;
+};
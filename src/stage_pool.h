@@ -0,0 +1,164 @@
+/*
+ * Bounded worker pool for one pipeline stage
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Each stage after decode (encode, plugin dispatch, upload) gets its own
+ * threads and its own bounded queue, so slow uploads only ever hold up the
+ * upload stage. When a queue is full submit() blocks the previous stage
+ * until there is room; that backpressure keeps memory bounded instead of
+ * dropping finished work.
+ */
+
+#pragma once
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+template <typename T>
+class StagePool {
+public:
+    typedef std::function<void(T)> Handler;
+
+    StagePool(const std::string& name, int threads, size_t capacity)
+        : name_(name), threads_(threads > 0 ? threads : 1), capacity_(capacity > 0 ? capacity : 1),
+          stopping_(false), processed_(0), stalls_(0), busy_(0) {}
+
+    ~StagePool() {
+        stop();
+    }
+
+    StagePool(const StagePool&) = delete;
+    StagePool& operator=(const StagePool&) = delete;
+
+    // Only valid while stopped
+    void configure(int threads, size_t capacity) {
+        threads_ = threads > 0 ? threads : 1;
+        capacity_ = capacity > 0 ? capacity : 1;
+    }
+
+    // Run by each worker as it starts, with its index (for CPU pinning);
+    // only valid while stopped
+    void set_thread_start(std::function<void(size_t)> hook) { thread_start_ = std::move(hook); }
+
+    void start(Handler handler) {
+        if (!workers_.empty()) {
+            return;
+        }
+        handler_ = std::move(handler);
+        stopping_ = false;
+        for (int i = 0; i < threads_; i++) {
+            workers_.emplace_back(&StagePool::worker_main, this, static_cast<size_t>(i));
+        }
+    }
+
+    // Finish everything already queued, then join the workers
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+        for (auto& worker : workers_) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+        workers_.clear();
+    }
+
+    // Blocks while the queue is full; false once the stage is stopping
+    bool submit(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.size() >= capacity_) {
+            stalls_++;
+            not_full_.wait(lock, [this] { return queue_.size() < capacity_ || stopping_; });
+        }
+        if (stopping_) {
+            return false;
+        }
+        queue_.push_back(std::move(item));
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Never blocks; false when the queue is full or the stage is stopping
+    bool try_submit(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stopping_ || queue_.size() >= capacity_) {
+            return false;
+        }
+        queue_.push_back(std::move(item));
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    const std::string& name() const { return name_; }
+    int threads() const { return threads_; }
+    size_t capacity() const { return capacity_; }
+    uint64_t processed() const { return processed_.load(); }
+    uint64_t stalls() const { return stalls_.load(); }     // submits that had to wait for room
+    int busy() const { return busy_.load(); }
+
+    size_t queue_size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+private:
+    void worker_main(size_t index) {
+        if (thread_start_) {
+            thread_start_(index);
+        }
+        while (true) {
+            T item;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_empty_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if (queue_.empty()) {
+                    break;  // stopping and drained
+                }
+                item = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            not_full_.notify_one();
+
+            busy_++;
+            try {
+                handler_(std::move(item));
+            } catch (const std::exception& e) {
+                std::cerr << "[" << name_ << "] Stage handler failed: " << e.what() << std::endl;
+            }
+            busy_--;
+            processed_++;
+        }
+    }
+
+    const std::string name_;
+    int threads_;
+    size_t capacity_;
+    Handler handler_;
+    std::function<void(size_t)> thread_start_;
+
+    std::deque<T> queue_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    bool stopping_;
+    std::vector<std::thread> workers_;
+
+    std::atomic<uint64_t> processed_;
+    std::atomic<uint64_t> stalls_;
+    std::atomic<int> busy_;
+};
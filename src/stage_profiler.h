@@ -0,0 +1,286 @@
+/*
+ * Cycle-level hot-path stage profiler
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Times the stages every call goes through, frame by frame: read_frame,
+ * deinterleave and FEC (one pass since the packed LDU decoder, so one
+ * stage), decrypt, IMBE synthesis, WAV write, encode and plugin dispatch.
+ * Each thread adds into its own slot, so recording takes no lock and
+ * shares no cache line. A snapshot gives each stage's totals and also
+ * lists every thread with its own stages, so ops can see where each
+ * core's time goes without attaching perf to a live service.
+ *
+ * Two switches. Built without -DTRUNK_DECODER_PROFILE=ON the PROFILE_STAGE
+ * sites compile to nothing. Built with it, the profiler is still off until
+ * set_enabled(true) (?enable=1 on /api/v1/profile), costing one relaxed
+ * load per site. On x86-64 stages are timed with rdtsc, converted to ns
+ * with a rate calibrated against the monotonic clock since start; other
+ * machines use clock_gettime(CLOCK_MONOTONIC) directly.
+ *
+ * reset() does not write other threads' counters: it records a baseline
+ * that snapshots subtract, and bumps an epoch that makes each thread
+ * restart its own per-stage maximum the next time it records.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <nlohmann/json.hpp>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+enum class ProfileStage {
+    READ_FRAME = 0,
+    FEC,             // deinterleave and Golay/Hamming decode of an LDU's codewords
+    DECRYPT,
+    IMBE_DECODE,
+    WAV_WRITE,
+    ENCODE,
+    DISPATCH,        // call plugins and routed output plugin batches
+    COUNT
+};
+
+inline const char* profile_stage_name(ProfileStage stage) {
+    switch (stage) {
+        case ProfileStage::READ_FRAME: return "read_frame";
+        case ProfileStage::FEC: return "fec";
+        case ProfileStage::DECRYPT: return "decrypt";
+        case ProfileStage::IMBE_DECODE: return "imbe_decode";
+        case ProfileStage::WAV_WRITE: return "wav_write";
+        case ProfileStage::ENCODE: return "encode";
+        case ProfileStage::DISPATCH: return "dispatch";
+        default: return "unknown";
+    }
+}
+
+class StageProfiler {
+public:
+    static constexpr int STAGES = static_cast<int>(ProfileStage::COUNT);
+
+    static StageProfiler& instance() {
+        static StageProfiler profiler;
+        return profiler;
+    }
+
+    static constexpr bool compiled() {
+#ifdef TRUNK_DECODER_PROFILE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void set_enabled(bool enabled) { enabled_.store(enabled && compiled(), std::memory_order_relaxed); }
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    static uint64_t ticks() {
+#if defined(__x86_64__)
+        return __rdtsc();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+    }
+
+    void record(ProfileStage stage, uint64_t elapsed) {
+        ThreadSlot& slot = thread_slot();
+        uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+        Counter& counter = slot.stages[static_cast<int>(stage)];
+        if (slot.epoch.load(std::memory_order_relaxed) != epoch) {
+            slot.epoch.store(epoch, std::memory_order_relaxed);
+            for (Counter& c : slot.stages) {
+                c.max.store(0, std::memory_order_relaxed);
+            }
+        }
+        // Only this thread writes its slot; snapshots read with relaxed loads
+        counter.calls.store(counter.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        counter.ticks.store(counter.ticks.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+        if (elapsed > counter.max.load(std::memory_order_relaxed)) {
+            counter.max.store(elapsed, std::memory_order_relaxed);
+        }
+    }
+
+    // Times a block when the profiler is on
+    class Scope {
+    public:
+        explicit Scope(ProfileStage stage)
+            : stage_(stage), start_(StageProfiler::instance().enabled() ? ticks() : 0) {}
+        ~Scope() {
+            if (start_) {
+                StageProfiler::instance().record(stage_, ticks() - start_);
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        ProfileStage stage_;
+        uint64_t start_;
+    };
+
+    // Start every thread's counts from zero
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& slot : slots_) {
+            for (int i = 0; i < STAGES; i++) {
+                slot->baseline[i].calls = slot->stages[i].calls.load(std::memory_order_relaxed);
+                slot->baseline[i].ticks = slot->stages[i].ticks.load(std::memory_order_relaxed);
+            }
+        }
+        epoch_.fetch_add(1, std::memory_order_relaxed);
+        reset_ticks_ = ticks();
+    }
+
+    // {"enabled", "clock", "ns_per_tick", "threads": [{"thread", "name",
+    //  "stages": {"fec": {"calls", "total_ns", "avg_ns", "max_ns"}, ...}}],
+    //  "stages": the same summed over threads}
+    nlohmann::json snapshot_json() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const double ns_per_tick = tick_ns();
+        const uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+        nlohmann::json result;
+        result["compiled"] = compiled();
+        result["enabled"] = enabled();
+#if defined(__x86_64__)
+        result["clock"] = "rdtsc";
+#else
+        result["clock"] = "clock_monotonic";
+#endif
+        result["ns_per_tick"] = ns_per_tick;
+        result["window_s"] = static_cast<double>(ticks() - reset_ticks_) * ns_per_tick / 1e9;
+
+        uint64_t total_calls[STAGES] = {};
+        uint64_t total_ticks[STAGES] = {};
+        uint64_t total_max[STAGES] = {};
+        nlohmann::json threads = nlohmann::json::array();
+        for (const auto& slot : slots_) {
+            nlohmann::json stages = nlohmann::json::object();
+            // The owner resets its maxima on its next record; until then they are stale
+            const bool fresh = slot->epoch.load(std::memory_order_relaxed) == epoch;
+            for (int i = 0; i < STAGES; i++) {
+                uint64_t calls = slot->stages[i].calls.load(std::memory_order_relaxed) - slot->baseline[i].calls;
+                uint64_t elapsed = slot->stages[i].ticks.load(std::memory_order_relaxed) - slot->baseline[i].ticks;
+                uint64_t max = fresh ? slot->stages[i].max.load(std::memory_order_relaxed) : 0;
+                if (calls == 0) {
+                    continue;
+                }
+                stages[profile_stage_name(static_cast<ProfileStage>(i))] = stage_json(calls, elapsed, max, ns_per_tick);
+                total_calls[i] += calls;
+                total_ticks[i] += elapsed;
+                total_max[i] = std::max(total_max[i], max);
+            }
+            if (stages.empty()) {
+                continue;
+            }
+            nlohmann::json thread;
+            thread["thread"] = slot->thread;
+            thread["name"] = slot->name;
+            thread["stages"] = std::move(stages);
+            threads.push_back(std::move(thread));
+        }
+        nlohmann::json totals = nlohmann::json::object();
+        for (int i = 0; i < STAGES; i++) {
+            if (total_calls[i]) {
+                totals[profile_stage_name(static_cast<ProfileStage>(i))] =
+                    stage_json(total_calls[i], total_ticks[i], total_max[i], ns_per_tick);
+            }
+        }
+        result["stages"] = std::move(totals);
+        result["threads"] = std::move(threads);
+        return result;
+    }
+
+private:
+    struct Counter {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> ticks{0};
+        std::atomic<uint64_t> max{0};
+    };
+
+    struct Baseline {
+        uint64_t calls = 0;
+        uint64_t ticks = 0;
+    };
+
+    struct alignas(64) ThreadSlot {
+        Counter stages[STAGES];
+        std::atomic<uint64_t> epoch{0};   // written by the owner only
+        Baseline baseline[STAGES];    // under mutex_
+        uint32_t thread = 0;
+        std::string name;
+    };
+
+    StageProfiler() : enabled_(false), epoch_(0) {
+        start_ticks_ = ticks();
+        reset_ticks_ = start_ticks_;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        start_ns_ = static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    // ns per tick: 1 for the monotonic clock, else the TSC rate measured
+    // over the whole uptime, which leaves no calibration delay at start
+    double tick_ns() const {
+#if defined(__x86_64__)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+        uint64_t elapsed = ticks() - start_ticks_;
+        return elapsed ? static_cast<double>(now_ns - start_ns_) / static_cast<double>(elapsed) : 0.0;
+#else
+        return 1.0;
+#endif
+    }
+
+    static nlohmann::json stage_json(uint64_t calls, uint64_t elapsed, uint64_t max, double ns_per_tick) {
+        nlohmann::json stage;
+        stage["calls"] = calls;
+        stage["total_ns"] = static_cast<uint64_t>(static_cast<double>(elapsed) * ns_per_tick);
+        stage["avg_ns"] = static_cast<double>(elapsed) * ns_per_tick / static_cast<double>(calls);
+        stage["max_ns"] = static_cast<uint64_t>(static_cast<double>(max) * ns_per_tick);
+        return stage;
+    }
+
+    ThreadSlot& thread_slot() {
+        thread_local std::shared_ptr<ThreadSlot> slot;
+        if (!slot) {
+            slot = std::make_shared<ThreadSlot>();
+            char name[16] = {};
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot->thread = static_cast<uint32_t>(slots_.size() + 1);
+            slot->name = name;
+            slot->epoch.store(epoch_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            slots_.push_back(slot);
+        }
+        return *slot;
+    }
+
+    std::atomic<bool> enabled_;
+    std::atomic<uint64_t> epoch_;
+    uint64_t start_ticks_;
+    uint64_t start_ns_;
+    uint64_t reset_ticks_;     // under mutex_
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<ThreadSlot>> slots_;
+};
+
+// Times the rest of the enclosing block as stage; nothing unless built with TRUNK_DECODER_PROFILE
+#ifdef TRUNK_DECODER_PROFILE
+#define PROFILE_STAGE_CONCAT2(a, b) a##b
+#define PROFILE_STAGE_CONCAT(a, b) PROFILE_STAGE_CONCAT2(a, b)
+#define PROFILE_STAGE(stage) StageProfiler::Scope PROFILE_STAGE_CONCAT(profile_scope_, __LINE__)(stage)
+#else
+#define PROFILE_STAGE(stage) ((void)0)
+#endif
@@ -0,0 +1,278 @@
+#include "temp_store.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char MEMFD_PREFIX[] = "/proc/self/fd/";
+const long TMPFS_MAGIC_NUMBER = 0x01021994;
+
+// Both halves of a memfd path work: the fd exists and reopens through /proc
+bool memfd_usable() {
+#ifdef MFD_CLOEXEC
+    int fd = memfd_create("trunk_decoder_probe", MFD_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool usable = access((MEMFD_PREFIX + std::to_string(fd)).c_str(), R_OK | W_OK) == 0;
+    close(fd);
+    return usable;
+#else
+    return false;
+#endif
+}
+
+bool on_tmpfs(const std::string& dir) {
+    struct statfs fs;
+    return statfs(dir.c_str(), &fs) == 0 && static_cast<long>(fs.f_type) == TMPFS_MAGIC_NUMBER;
+}
+
+bool writable_dir(const std::string& dir) {
+    struct stat st;
+    return !dir.empty() && stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && access(dir.c_str(), W_OK | X_OK) == 0;
+}
+
+MetricsRegistry::Counter& created_metric(TempStore::Backend backend) {
+    return MetricsRegistry::global().counter("trunk_decoder_temp_files_created_total", "Temp job files created, by backend",
+                                             std::string("backend=\"") + TempStore::backend_name(backend) + "\"");
+}
+
+} // namespace
+
+TempStore::TempStore()
+    : backend_(DISK), dir_fd_(-1), sequence_(0), stopping_(false), created_(0), reaped_(0),
+      reaped_metric_(MetricsRegistry::global().counter("trunk_decoder_temp_files_reaped_total",
+                                                       "Temp job files freed by the reaper")),
+      pending_metric_(MetricsRegistry::global().gauge("trunk_decoder_temp_files_pending",
+                                                      "Temp job files waiting for the reaper")) {
+    configure(policy_);
+}
+
+TempStore::~TempStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    if (reaper_.joinable()) {
+        reaper_.join();
+    }
+    flush();
+    for (int fd : memfds_) {
+        close(fd);
+    }
+    if (dir_fd_ >= 0) {
+        close(dir_fd_);
+    }
+}
+
+const char* TempStore::backend_name(Backend backend) {
+    switch (backend) {
+        case MEMFD: return "memfd";
+        case TMPFS: return "tmpfs";
+        default: return "disk";
+    }
+}
+
+void TempStore::configure(const TempPolicy& policy) {
+    const std::string& wanted = policy.backend;
+    if (wanted != "auto" && wanted != "memfd" && wanted != "tmpfs" && wanted != "disk") {
+        std::cerr << "[TempStore] Unknown temp file backend \"" << wanted << "\", using auto" << std::endl;
+    }
+    bool known = wanted == "memfd" || wanted == "tmpfs" || wanted == "disk";
+    bool try_memfd = !known || wanted == "memfd";
+    bool try_tmpfs = wanted != "disk";
+
+    // An explicitly chosen tmpfs_dir is used as long as it is writable;
+    // auto only takes it when it really is tmpfs
+    Backend backend = DISK;
+    std::string dir = policy.disk_dir.empty() ? "/tmp" : policy.disk_dir;
+    if (try_tmpfs && writable_dir(policy.tmpfs_dir) && (wanted == "tmpfs" || on_tmpfs(policy.tmpfs_dir))) {
+        backend = TMPFS;
+        dir = policy.tmpfs_dir;
+    }
+    if (try_memfd && memfd_usable()) {
+        backend = MEMFD;   // dir_ stays as the fallback should memfd_create() fail later
+    }
+    if (known && wanted != backend_name(backend)) {
+        std::cerr << "[TempStore] " << wanted << " temp files are not available here, using "
+                  << (backend == MEMFD ? "memfd" : dir) << std::endl;
+    }
+
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        policy_ = policy;
+        backend_ = backend;
+        // Files still pending in the old directory fall back to unlink()
+        if (dir_fd_ >= 0 && dir != dir_) {
+            close(dir_fd_);
+            dir_fd_ = -1;
+        }
+        if (dir_fd_ < 0) {
+            dir_fd_ = dir_fd;
+        } else if (dir_fd >= 0) {
+            close(dir_fd);
+        }
+        dir_ = dir;
+    }
+    wake_.notify_all();
+}
+
+TempStore::Backend TempStore::backend() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return backend_;
+}
+
+size_t TempStore::pending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+std::string TempStore::create(const std::string& name) {
+    size_t slash = name.find_last_of("/\\");
+    std::string base = slash == std::string::npos ? name : name.substr(slash + 1);
+    if (base.empty() || base == "." || base == "..") {
+        base = "upload";
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+#ifdef MFD_CLOEXEC
+    if (backend_ == MEMFD) {
+        int fd = memfd_create(("trunk_decoder_" + base).c_str(), MFD_CLOEXEC);
+        if (fd >= 0) {
+            memfds_.insert(fd);
+            created_++;
+            created_metric(MEMFD).add();
+            return MEMFD_PREFIX + std::to_string(fd);
+        }
+    }
+#endif
+    std::string path = dir_ + "/trunk_decoder_" + std::to_string(getpid()) + "_" + std::to_string(++sequence_) + "_" + base;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        std::cerr << "[TempStore] Failed to create " << path << ": " << std::strerror(errno) << std::endl;
+        return "";
+    }
+    close(fd);
+    created_++;
+    created_metric(backend_ == TMPFS ? TMPFS : DISK).add();
+    return path;
+}
+
+void TempStore::release(const std::string& path) {
+    if (path.empty()) {
+        return;
+    }
+    std::vector<std::string> now;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            now.push_back(path);   // shutting down: nobody left to hand it to
+        } else {
+            pending_.push_back(path);
+            pending_metric_.set(static_cast<int64_t>(pending_.size()));
+            if (!reaper_.joinable()) {
+                reaper_ = std::thread(&TempStore::reap_main, this);
+            }
+            if (pending_.size() != 1 && pending_.size() < policy_.reap_batch) {
+                return;
+            }
+        }
+    }
+    if (now.empty()) {
+        wake_.notify_one();
+    } else {
+        reap(now);
+    }
+}
+
+void TempStore::flush() {
+    std::vector<std::string> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch.swap(pending_);
+        pending_metric_.set(0);
+    }
+    reap(batch);
+}
+
+void TempStore::reap_main() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<std::string> batch;
+    while (!stopping_) {
+        if (pending_.empty()) {
+            wake_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            continue;
+        }
+        // Give a batch reap_interval_ms to build up, unless it already has
+        wake_.wait_for(lock, std::chrono::milliseconds(policy_.reap_interval_ms),
+                       [this] { return stopping_ || pending_.size() >= policy_.reap_batch; });
+        batch.swap(pending_);
+        pending_metric_.set(0);
+        lock.unlock();
+        reap(batch);
+        batch.clear();
+        lock.lock();
+    }
+}
+
+int TempStore::memfd_of(const std::string& path) {
+    if (path.compare(0, sizeof(MEMFD_PREFIX) - 1, MEMFD_PREFIX) != 0) {
+        return -1;
+    }
+    int fd = std::atoi(path.c_str() + sizeof(MEMFD_PREFIX) - 1);
+    return memfds_.erase(fd) ? fd : -1;
+}
+
+void TempStore::reap(std::vector<std::string>& paths) {
+    if (paths.empty()) {
+        return;
+    }
+    // Sort out the memfds and the directory this batch unlinks against in
+    // one pass under the lock; a dup of dir_fd_ keeps it valid across a
+    // configure() while the batch is freed
+    std::vector<int> fds(paths.size(), -1);
+    std::string dir_prefix;
+    int dir_fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < paths.size(); i++) {
+            fds[i] = memfd_of(paths[i]);
+        }
+        if (dir_fd_ >= 0) {
+            dir_fd = fcntl(dir_fd_, F_DUPFD_CLOEXEC, 0);
+            dir_prefix = dir_ + "/";
+        }
+    }
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        const std::string& path = paths[i];
+        if (fds[i] >= 0) {
+            close(fds[i]);
+            continue;
+        }
+        int ret;
+        if (dir_fd >= 0 && path.size() > dir_prefix.size() && path.compare(0, dir_prefix.size(), dir_prefix) == 0 &&
+            path.find('/', dir_prefix.size()) == std::string::npos) {
+            ret = unlinkat(dir_fd, path.c_str() + dir_prefix.size(), 0);
+        } else {
+            ret = unlink(path.c_str());
+        }
+        if (ret != 0 && errno != ENOENT) {
+            std::cerr << "[TempStore] Warning: Failed to remove temp file " << path << ": " << std::strerror(errno) << std::endl;
+        }
+    }
+    if (dir_fd >= 0) {
+        close(dir_fd);
+    }
+    reaped_ += paths.size();
+    reaped_metric_.add(paths.size());
+}
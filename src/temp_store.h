@@ -0,0 +1,124 @@
+/*
+ * Ephemeral job files
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Uploads too large to keep in memory are spooled to a temp file that lives
+ * until the job that decodes it finishes. Where those files go is chosen
+ * here: an anonymous memfd where the kernel has memfd_create() (no
+ * directory entry at all; its path is /proc/self/fd/N, which opens like any
+ * file), a tmpfs directory such as /dev/shm, or a plain directory on disk.
+ * "auto" tries them in that order.
+ *
+ * Removing a temp file is a filesystem metadata update, and used to be done
+ * inline on the worker that finished the job. release() instead hands the
+ * file to a reaper thread that frees it in batches, every reap_interval_ms
+ * or once reap_batch are pending, with unlinkat() against the directory it
+ * already holds open. A memfd is freed by closing it.
+ *
+ * One store serves the process (HttpService, ApiService and JobManager all
+ * create and release through it); /metrics gets
+ * trunk_decoder_temp_files_created_total by backend,
+ * trunk_decoder_temp_files_reaped_total and the pending count.
+ */
+
+#pragma once
+
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+struct TempPolicy {
+    std::string backend = "auto";   // auto, memfd, tmpfs or disk
+    std::string tmpfs_dir = "/dev/shm";
+    std::string disk_dir = "/tmp";
+    size_t reap_batch = 64;         // wake the reaper once this many are pending
+    int reap_interval_ms = 200;     // otherwise free what is pending this often
+
+    // {"backend": "tmpfs", "tmpfs_dir": "/run/trunk-decoder", "reap_interval_ms": 200}
+    static TempPolicy from_json(const nlohmann::json& config) {
+        TempPolicy policy;
+        if (config.is_string()) {
+            policy.backend = config.get<std::string>();
+            return policy;
+        }
+        if (!config.is_object()) {
+            return policy;
+        }
+        policy.backend = config.value("backend", policy.backend);
+        policy.tmpfs_dir = config.value("tmpfs_dir", policy.tmpfs_dir);
+        policy.disk_dir = config.value("disk_dir", policy.disk_dir);
+        policy.reap_batch = std::max<size_t>(1, config.value("reap_batch", policy.reap_batch));
+        policy.reap_interval_ms = std::max(1, config.value("reap_interval_ms", policy.reap_interval_ms));
+        return policy;
+    }
+};
+
+class TempStore {
+public:
+    enum Backend { MEMFD, TMPFS, DISK };
+
+    static TempStore& global() {
+        static TempStore store;
+        return store;
+    }
+
+    ~TempStore();
+
+    TempStore(const TempStore&) = delete;
+    TempStore& operator=(const TempStore&) = delete;
+
+    // Applies to files created from now on; falls back down the list
+    // (memfd, tmpfs, disk) when the chosen backend is not available
+    void configure(const TempPolicy& policy);
+
+    // A new, empty temp file named after name (a label only; it never picks
+    // the directory); "" if none could be made. Open the path to fill it.
+    std::string create(const std::string& name);
+
+    // Free path, created here or not, from the reaper thread
+    void release(const std::string& path);
+
+    // Free everything pending now, on the caller's thread
+    void flush();
+
+    Backend backend();
+    static const char* backend_name(Backend backend);
+    uint64_t created() const { return created_.load(); }
+    uint64_t reaped() const { return reaped_.load(); }
+    size_t pending();
+
+private:
+    TempStore();
+
+    void reap_main();
+    void reap(std::vector<std::string>& paths);
+    bool open_dir(const std::string& dir);
+    int memfd_of(const std::string& path);
+
+    std::mutex mutex_;
+    TempPolicy policy_;
+    Backend backend_;
+    std::string dir_;          // TMPFS and DISK
+    int dir_fd_;               // dir_, for unlinkat()
+    std::set<int> memfds_;     // created and not yet freed
+    uint64_t sequence_;
+
+    std::condition_variable wake_;
+    std::vector<std::string> pending_;
+    bool stopping_;
+    std::thread reaper_;       // started by the first release()
+
+    std::atomic<uint64_t> created_;
+    std::atomic<uint64_t> reaped_;
+    MetricsRegistry::Counter& reaped_metric_;
+    MetricsRegistry::Gauge& pending_metric_;
+};
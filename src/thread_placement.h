@@ -0,0 +1,338 @@
+/*
+ * CPU and NUMA placement for thread pools
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * The "threading" config section names a placement per pool ("decode",
+ * "encode", "dispatch", "upload", "http"):
+ *
+ *   "threading": {
+ *     "numa_local_memory": true,
+ *     "decode": {"cpus": "0-15,32-47"},
+ *     "http":   {"numa_node": 1},
+ *     "upload": {"nic": "eth0", "spread": true}
+ *   }
+ *
+ * "cpus" is a sysfs-style list (or an array of CPU numbers). "numa_node"
+ * takes every CPU of that node, and "nic" takes the node the interface's
+ * PCI device is attached to. "spread" pins each thread to one CPU of the
+ * set in turn instead of letting it float over the whole set. With
+ * numa_local_memory each pinned thread asks the kernel to prefer its own
+ * node for new pages, so decoders and buffers a worker builds after
+ * starting are local to it.
+ *
+ * Each placed thread records where it actually ended up (its affinity
+ * mask as the kernel reports it and the CPU and node it was running on),
+ * which the service status reports. Header-only so input and output
+ * plugins can use the same helpers for their own threads.
+ */
+
+#pragma once
+
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace placement {
+
+// Parse a sysfs CPU list such as "0-3,8-11"
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        try {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception&) {
+            // Ignore malformed entries
+        }
+    }
+    return cpus;
+}
+
+// The reverse, collapsing runs: {0,1,2,3,8} -> "0-3,8"
+inline std::string format_cpu_list(const std::vector<int>& cpus) {
+    std::string out;
+    for (size_t i = 0; i < cpus.size(); ) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        if (!out.empty()) {
+            out += ",";
+        }
+        out += std::to_string(cpus[i]);
+        if (j > i) {
+            out += "-" + std::to_string(cpus[j]);
+        }
+        i = j + 1;
+    }
+    return out;
+}
+
+// CPUs of each online NUMA node; empty if the topology is not exposed
+inline std::vector<std::vector<int>> numa_topology() {
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0; ; ++node) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file.is_open()) {
+            break;
+        }
+        std::string list;
+        std::getline(file, list);
+        nodes.push_back(parse_cpu_list(list));
+    }
+    return nodes;
+}
+
+// Node a network interface's device hangs off; -1 if unknown (virtual
+// interfaces, single-node machines)
+inline int nic_numa_node(const std::string& interface) {
+    std::ifstream file("/sys/class/net/" + interface + "/device/numa_node");
+    int node = -1;
+    if (!(file >> node)) {
+        return -1;
+    }
+    return node;
+}
+
+inline int node_of_cpu(int cpu, const std::vector<std::vector<int>>& topology) {
+    for (size_t node = 0; node < topology.size(); ++node) {
+        for (int c : topology[node]) {
+            if (c == cpu) {
+                return static_cast<int>(node);
+            }
+        }
+    }
+    return -1;
+}
+
+// Restrict the calling thread to cpus; 0 or an errno value
+inline int pin_current_thread(const std::vector<int>& cpus) {
+    if (cpus.empty()) {
+        return 0;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpuset);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+}
+
+inline std::vector<int> current_affinity() {
+    std::vector<int> cpus;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpuset)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+// Prefer node for the calling thread's new pages (MPOL_PREFERRED, without
+// needing libnuma); falls back to other nodes when it is full
+inline bool prefer_node_memory(int node) {
+    if (node < 0 || node >= 64) {
+        return false;
+    }
+    const int MPOL_PREFERRED_MODE = 1;
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, &mask, sizeof(mask) * 8 + 1) == 0;
+}
+
+// Back to the default (local) policy after prefer_node_memory()
+inline void reset_memory_policy() {
+    const int MPOL_DEFAULT_MODE = 0;
+    syscall(SYS_set_mempolicy, MPOL_DEFAULT_MODE, nullptr, 0);
+}
+
+} // namespace placement
+
+// Where one pool's threads may run
+struct PoolPlacement {
+    std::vector<int> cpus;   // empty: not pinned
+    int numa_node = -1;      // node the CPUs belong to, -1 if mixed or unknown
+    bool spread = false;     // one CPU per thread instead of the whole set
+
+    bool pinned() const { return !cpus.empty(); }
+
+    // CPUs for the pool's index-th thread
+    std::vector<int> cpus_for(size_t index) const {
+        if (!spread || cpus.empty()) {
+            return cpus;
+        }
+        return std::vector<int>(1, cpus[index % cpus.size()]);
+    }
+
+    static PoolPlacement from_json(const nlohmann::json& j, const std::vector<std::vector<int>>& topology) {
+        PoolPlacement pool;
+        if (!j.is_object()) {
+            return pool;
+        }
+        pool.spread = j.value("spread", false);
+        int node = j.value("numa_node", -1);
+        if (j.contains("nic") && j["nic"].is_string()) {
+            node = placement::nic_numa_node(j["nic"].get<std::string>());
+        }
+        if (j.contains("cpus")) {
+            const nlohmann::json& cpus = j["cpus"];
+            if (cpus.is_string()) {
+                pool.cpus = placement::parse_cpu_list(cpus.get<std::string>());
+            } else if (cpus.is_array()) {
+                pool.cpus = cpus.get<std::vector<int>>();
+            }
+        } else if (node >= 0 && node < static_cast<int>(topology.size())) {
+            pool.cpus = topology[node];
+        }
+        // A CPU list chosen by hand is on one node only if all of it is
+        pool.numa_node = -1;
+        for (size_t i = 0; i < pool.cpus.size(); ++i) {
+            int cpu_node = placement::node_of_cpu(pool.cpus[i], topology);
+            if (i == 0) {
+                pool.numa_node = cpu_node;
+            } else if (cpu_node != pool.numa_node) {
+                pool.numa_node = -1;
+                break;
+            }
+        }
+        return pool;
+    }
+};
+
+class ThreadPlacement {
+public:
+    // Where one thread ended up
+    struct Placed {
+        std::string pool;
+        size_t index = 0;
+        long tid = 0;
+        std::vector<int> affinity;  // as the kernel reports it after pinning
+        int cpu = -1;               // running on when it was placed
+        int numa_node = -1;         // node of that CPU
+        int memory_node = -1;       // preferred for its allocations, -1 for the default
+        int error = 0;              // pthread_setaffinity_np failure, 0 if none
+    };
+
+    static ThreadPlacement& global() {
+        static ThreadPlacement placement;
+        return placement;
+    }
+
+    ThreadPlacement() : topology_(placement::numa_topology()), local_memory_(true) {}
+
+    // Read the "threading" config section; call before any pool starts
+    void configure(const nlohmann::json& threading) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pools_.clear();
+        if (!threading.is_object()) {
+            return;
+        }
+        local_memory_ = threading.value("numa_local_memory", true);
+        for (auto it = threading.begin(); it != threading.end(); ++it) {
+            if (it.value().is_object()) {
+                pools_[it.key()] = PoolPlacement::from_json(it.value(), topology_);
+            }
+        }
+    }
+
+    // The configured placement for pool, or nullptr to leave it to the caller
+    const PoolPlacement* pool(const std::string& name) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pools_.find(name);
+        return it == pools_.end() || !it->second.pinned() ? nullptr : &it->second;
+    }
+
+    const std::vector<std::vector<int>>& topology() const { return topology_; }
+    size_t numa_nodes() const { return topology_.empty() ? 1 : topology_.size(); }
+
+    // Pin the calling thread as pool's index-th (to its configured CPUs, or
+    // to cpus when the pool is not configured) and record where it landed
+    Placed place(const std::string& pool_name, size_t index, const std::vector<int>& default_cpus = std::vector<int>()) {
+        std::vector<int> cpus = default_cpus;
+        if (const PoolPlacement* configured = pool(pool_name)) {
+            cpus = configured->cpus_for(index);
+        }
+        Placed placed;
+        placed.pool = pool_name;
+        placed.index = index;
+        placed.tid = static_cast<long>(syscall(SYS_gettid));
+        placed.error = placement::pin_current_thread(cpus);
+        placed.affinity = placement::current_affinity();
+        placed.cpu = sched_getcpu();
+        placed.numa_node = placement::node_of_cpu(placed.cpu, topology_);
+
+        // Only worth steering memory when the thread cannot leave its node
+        int node = -1;
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            int cpu_node = placement::node_of_cpu(cpus[i], topology_);
+            node = i == 0 ? cpu_node : (cpu_node == node ? node : -1);
+        }
+        if (local_memory_ && placed.error == 0 && node >= 0 && topology_.size() > 1 &&
+            placement::prefer_node_memory(node)) {
+            placed.memory_node = node;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        placed_[std::make_pair(pool_name, index)] = placed;
+        return placed;
+    }
+
+    static nlohmann::json to_json(const Placed& placed) {
+        nlohmann::json j;
+        j["pool"] = placed.pool;
+        j["index"] = placed.index;
+        j["tid"] = placed.tid;
+        j["cpus"] = placement::format_cpu_list(placed.affinity);
+        j["cpu"] = placed.cpu;
+        j["numa_node"] = placed.numa_node;
+        j["memory_node"] = placed.memory_node;
+        if (placed.error) {
+            j["error"] = placed.error;
+        }
+        return j;
+    }
+
+    nlohmann::json status() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nlohmann::json j;
+        j["numa_nodes"] = topology_.empty() ? 1 : topology_.size();
+        j["numa_local_memory"] = local_memory_;
+        nlohmann::json threads = nlohmann::json::array();
+        for (const auto& entry : placed_) {
+            threads.push_back(to_json(entry.second));
+        }
+        j["threads"] = threads;
+        return j;
+    }
+
+private:
+    const std::vector<std::vector<int>> topology_;
+    mutable std::mutex mutex_;
+    bool local_memory_;
+    std::map<std::string, PoolPlacement> pools_;
+    std::map<std::pair<std::string, size_t>, Placed> placed_;
+};
@@ -0,0 +1,284 @@
+/*
+ * Sampling tracer for per-call pipeline spans
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * One call in every N (set_sample_every) gets a trace ID when its request
+ * arrives; every stage that handles the call records a span against that
+ * ID: HTTP receive, multipart parse, temp file write, queue wait, frame
+ * parse, vocoder, then each stage after decode. Calls without an ID cost
+ * one branch per span site.
+ *
+ * Spans go to a fixed ring owned by the recording thread, so recording
+ * never takes a lock: the writer bumps a slot's sequence number to odd,
+ * fills it in and bumps it to even; export copies a slot only when it
+ * saw the same even sequence before and after. Old spans are overwritten
+ * once a ring wraps. Work done in many small pieces (multipart parsing,
+ * frame parsing, synthesis) is summed into one span that starts with its
+ * parent.
+ *
+ * Exported on demand as Chrome trace event JSON (chrome://tracing,
+ * Perfetto) or OTLP/JSON for an OpenTelemetry collector.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class Tracer {
+public:
+    static constexpr size_t RING_SIZE = 4096;
+
+    struct Span {
+        uint64_t trace_id;
+        uint64_t span_id;
+        const char* name;      // static or intern()ed
+        const char* detail;    // e.g. the plugin name; may be nullptr
+        int64_t start_ns;      // system clock, ns since the epoch
+        int64_t duration_ns;
+        uint32_t thread;
+    };
+
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // 0 turns tracing off, 1 traces every call
+    void set_sample_every(uint32_t n) { sample_every_.store(n, std::memory_order_relaxed); }
+    uint32_t sample_every() const { return sample_every_.load(std::memory_order_relaxed); }
+
+    // A new trace ID if this call is sampled, else 0
+    uint64_t sample() {
+        uint32_t every = sample_every();
+        if (every == 0 || calls_.fetch_add(1, std::memory_order_relaxed) % every != 0) {
+            return 0;
+        }
+        // splitmix64 over a counter seeded from the clock: unique and never 0
+        uint64_t z = seed_ + 0x9e3779b97f4a7c15ULL * next_trace_.fetch_add(1, std::memory_order_relaxed);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        return z ? z : 1;
+    }
+
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static int64_t to_ns(std::chrono::system_clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    // A stable copy of a runtime name (plugin, stage) to record spans under
+    const char* intern(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return interned_.insert(name).first->c_str();
+    }
+
+    void record(uint64_t trace_id, const char* name, int64_t start_ns, int64_t duration_ns,
+                const char* detail = nullptr) {
+        if (trace_id == 0) {
+            return;
+        }
+        ThreadRing& ring = thread_ring();
+        uint64_t index = ring.next++;
+        Slot& slot = ring.slots[index % RING_SIZE];
+        uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.trace_id.store(trace_id, std::memory_order_relaxed);
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.detail.store(detail, std::memory_order_relaxed);
+        slot.start_ns.store(start_ns, std::memory_order_relaxed);
+        slot.duration_ns.store(duration_ns > 0 ? duration_ns : 0, std::memory_order_relaxed);
+        slot.span_id.store(static_cast<uint64_t>(ring.thread) << 40 | (index & 0xffffffffffULL),
+                           std::memory_order_relaxed);
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Times a block; does nothing unless trace_id is set
+    class Scope {
+    public:
+        Scope(uint64_t trace_id, const char* name, const char* detail = nullptr)
+            : trace_id_(trace_id), name_(name), detail_(detail), start_ns_(trace_id ? now_ns() : 0) {}
+        ~Scope() {
+            if (trace_id_) {
+                Tracer::instance().record(trace_id_, name_, start_ns_, now_ns() - start_ns_, detail_);
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        uint64_t trace_id_;
+        const char* name_;
+        const char* detail_;
+        int64_t start_ns_;
+    };
+
+    // Every span still held in any ring, optionally for one trace only
+    std::vector<Span> collect(uint64_t trace_id = 0) const {
+        std::vector<std::shared_ptr<ThreadRing>> rings;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rings = rings_;
+        }
+        std::vector<Span> spans;
+        for (const auto& ring : rings) {
+            for (const Slot& slot : ring->slots) {
+                uint64_t seq = slot.seq.load(std::memory_order_acquire);
+                if (seq == 0 || (seq & 1)) {
+                    continue;
+                }
+                Span span;
+                span.trace_id = slot.trace_id.load(std::memory_order_relaxed);
+                span.span_id = slot.span_id.load(std::memory_order_relaxed);
+                span.name = slot.name.load(std::memory_order_relaxed);
+                span.detail = slot.detail.load(std::memory_order_relaxed);
+                span.start_ns = slot.start_ns.load(std::memory_order_relaxed);
+                span.duration_ns = slot.duration_ns.load(std::memory_order_relaxed);
+                span.thread = ring->thread;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) != seq) {
+                    continue;
+                }
+                if (trace_id == 0 || span.trace_id == trace_id) {
+                    spans.push_back(span);
+                }
+            }
+        }
+        return spans;
+    }
+
+    // {"traceEvents": [...]} with one complete ("X") event per span
+    std::string chrome_trace_json(uint64_t trace_id = 0) const {
+        std::ostringstream out;
+        out << "{\"traceEvents\": [";
+        bool first = true;
+        for (const Span& span : collect(trace_id)) {
+            out << (first ? "" : ",") << "\n{\"name\": \"" << span_name(span) << "\","
+                << "\"cat\": \"trunk-decoder\",\"ph\": \"X\","
+                << "\"ts\": " << span.start_ns / 1000 << "." << pad3(span.start_ns % 1000) << ","
+                << "\"dur\": " << span.duration_ns / 1000 << "." << pad3(span.duration_ns % 1000) << ","
+                << "\"pid\": 1,\"tid\": " << span.thread << ","
+                << "\"args\": {\"trace_id\": \"" << hex64(span.trace_id) << "\"}}";
+            first = false;
+        }
+        out << "\n],\"displayTimeUnit\": \"ms\"}";
+        return out.str();
+    }
+
+    // OTLP/JSON ExportTraceServiceRequest; spans are children of the
+    // trace's "call" span, whose span ID is the trace ID
+    std::string otlp_json(uint64_t trace_id = 0) const {
+        std::ostringstream out;
+        out << "{\"resourceSpans\": [{\"resource\": {\"attributes\": [{\"key\": \"service.name\","
+            << "\"value\": {\"stringValue\": \"trunk-decoder\"}}]},"
+            << "\"scopeSpans\": [{\"scope\": {\"name\": \"trunk-decoder\"},\"spans\": [";
+        bool first = true;
+        for (const Span& span : collect(trace_id)) {
+            bool root = std::string(span.name) == ROOT_SPAN;
+            out << (first ? "" : ",") << "\n{\"traceId\": \"" << hex64(0) << hex64(span.trace_id) << "\","
+                << "\"spanId\": \"" << hex64(root ? span.trace_id : span.span_id) << "\",";
+            if (!root) {
+                out << "\"parentSpanId\": \"" << hex64(span.trace_id) << "\",";
+            }
+            out << "\"name\": \"" << span_name(span) << "\",\"kind\": 1,"
+                << "\"startTimeUnixNano\": \"" << span.start_ns << "\","
+                << "\"endTimeUnixNano\": \"" << span.start_ns + span.duration_ns << "\"}";
+            first = false;
+        }
+        out << "\n]}]}]}";
+        return out.str();
+    }
+
+    // Name of the span covering a whole call, receive to completion
+    static constexpr const char* ROOT_SPAN = "call";
+
+    static std::string hex64(uint64_t value) {
+        char buffer[17];
+        snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+        return buffer;
+    }
+
+    // 0 if the text is not a trace ID
+    static uint64_t parse_trace_id(const std::string& text) {
+        if (text.empty() || text.size() > 16 || text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+            return 0;
+        }
+        return std::stoull(text, nullptr, 16);
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<uint64_t> trace_id{0};
+        std::atomic<uint64_t> span_id{0};
+        std::atomic<const char*> name{nullptr};
+        std::atomic<const char*> detail{nullptr};
+        std::atomic<int64_t> start_ns{0};
+        std::atomic<int64_t> duration_ns{0};
+    };
+
+    // Written only by its thread; kept after the thread exits so its spans
+    // can still be exported
+    struct ThreadRing {
+        uint32_t thread;
+        uint64_t next = 0;
+        Slot slots[RING_SIZE];
+    };
+
+    Tracer() : sample_every_(0), calls_(0), next_trace_(1),
+               seed_(static_cast<uint64_t>(now_ns())) {}
+
+    ThreadRing& thread_ring() {
+        thread_local std::shared_ptr<ThreadRing> ring;
+        if (!ring) {
+            ring = std::make_shared<ThreadRing>();
+            std::lock_guard<std::mutex> lock(mutex_);
+            ring->thread = static_cast<uint32_t>(rings_.size() + 1);
+            rings_.push_back(ring);
+        }
+        return *ring;
+    }
+
+    static std::string span_name(const Span& span) {
+        std::string name = span.name ? span.name : "";
+        if (span.detail) {
+            name += ":";
+            name += span.detail;
+        }
+        // Names come from code and plugin config; keep them valid JSON strings
+        std::string escaped;
+        for (char c : name) {
+            if (c == '"' || c == '\\') escaped += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20) escaped += c;
+        }
+        return escaped;
+    }
+
+    static std::string pad3(int64_t value) {
+        char buffer[4];
+        snprintf(buffer, sizeof(buffer), "%03d", static_cast<int>(value < 0 ? 0 : value));
+        return buffer;
+    }
+
+    std::atomic<uint32_t> sample_every_;
+    std::atomic<uint64_t> calls_;
+    std::atomic<uint64_t> next_trace_;
+    uint64_t seed_;
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<ThreadRing>> rings_;
+    std::set<std::string> interned_;
+};
@@ -0,0 +1,545 @@
+/*
+ * Control channel call state for trunk-decoder
+ * Talkgroup and unit tables built from the TSBK stream
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Every routed TSBK is decoded (tsbk_message.h) and folded into two tables
+ * keyed by (NAC, id): talkgroups, with the unit and channel of their last
+ * voice grant and how many units are affiliated to them, and units, with
+ * their registration and affiliation. Channel identifier updates are kept
+ * per NAC so grants carry a frequency.
+ *
+ * The tables are fixed-size and open-addressed, and entries are never
+ * removed, so a probe sequence never changes under a reader. Each slot is
+ * a seqlock: readers take no lock and retry if a write overlapped them,
+ * which keeps lookups from output plugins and call enrichment off the
+ * control channel's path. Writers lock one of SHARDS mutexes picked by the
+ * key, so two feeds updating different talkgroups do not wait on each
+ * other; empty slots are claimed with a compare-and-swap because probe
+ * sequences from different shards share them. A full table stops taking
+ * new keys (counted in get_stats()) and keeps updating the ones it has.
+ *
+ * The NAC is the low 12 bits of P25_TSBK_Data::system_id, as the routing
+ * filters use it, and matches the NAC the decoder reads from a call's
+ * voice frames.
+ */
+
+#pragma once
+
+#include "plugin_api.h"
+#include "tsbk_message.h"
+#include "metrics.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+struct TrunkingStateConfig {
+    bool enabled = true;
+    size_t talkgroups = 16384;     // distinct (NAC, talkgroup) pairs tracked
+    size_t units = 65536;          // distinct (NAC, unit) pairs tracked
+    int max_grant_age_s = 120;     // grants older than this, when a call is reported, are not used for it
+
+    // {"enabled": true, "talkgroups": 16384, "units": 65536, "max_grant_age_s": 120}
+    static TrunkingStateConfig from_json(const json& config) {
+        TrunkingStateConfig c;
+        if (!config.is_object()) {
+            return c;
+        }
+        c.enabled = config.value("enabled", c.enabled);
+        c.talkgroups = std::max<size_t>(16, config.value("talkgroups", c.talkgroups));
+        c.units = std::max<size_t>(16, config.value("units", c.units));
+        c.max_grant_age_s = std::max(0, config.value("max_grant_age_s", c.max_grant_age_s));
+        return c;
+    }
+};
+
+// Fixed-capacity map from a nonzero 64-bit key to WORDS atomic words,
+// with lock-free reads and writes serialised per shard
+template <size_t WORDS>
+class SeqlockTable {
+public:
+    typedef std::array<uint64_t, WORDS> Value;
+    static constexpr size_t SHARDS = 16;
+
+    // Room for capacity keys at no more than half full
+    explicit SeqlockTable(size_t capacity)
+        : capacity_(capacity), mask_(round_up(capacity * 2) - 1), slots_(new Slot[mask_ + 1]),
+          size_(0), full_(0) {}
+
+    bool read(uint64_t key, Value& out) const {
+        const Slot* slot = find(key);
+        return slot && read_slot(*slot, out);
+    }
+
+    // Apply update(Value&) to key's value, starting from zeros for a new key;
+    // false if the key is new and the table is full
+    template <class Update>
+    bool update(uint64_t key, Update&& update) {
+        std::lock_guard<std::mutex> lock(shards_[hash(key) % SHARDS].mutex);
+        Slot* slot = claim(key);
+        if (!slot) {
+            full_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Value value;
+        for (size_t i = 0; i < WORDS; i++) {
+            value[i] = slot->words[i].load(std::memory_order_relaxed);
+        }
+        update(value);
+
+        uint32_t version = slot->version.load(std::memory_order_relaxed);
+        slot->version.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            slot->words[i].store(value[i], std::memory_order_relaxed);
+        }
+        slot->version.store(version + 2, std::memory_order_release);
+        return true;
+    }
+
+    // fn(key, value) for every entry, each read consistently on its own
+    template <class Fn>
+    void for_each(Fn&& fn) const {
+        Value value;
+        for (size_t i = 0; i <= mask_; i++) {
+            uint64_t key = slots_[i].key.load(std::memory_order_acquire);
+            if (key != 0 && read_slot(slots_[i], value)) {
+                fn(key, value);
+            }
+        }
+    }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    size_t capacity() const { return capacity_; }
+    uint64_t full() const { return full_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint32_t> version{0};  // odd while a write is in progress, 0 until the first one
+        std::atomic<uint64_t> words[WORDS] = {};
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+    };
+
+    static size_t round_up(size_t n) {
+        size_t size = 1;
+        while (size < n) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    static uint64_t hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    const Slot* find(uint64_t key) const {
+        for (size_t i = hash(key) & mask_;; i = (i + 1) & mask_) {
+            uint64_t current = slots_[i].key.load(std::memory_order_acquire);
+            if (current == key) {
+                return &slots_[i];
+            }
+            if (current == 0) {
+                return nullptr;
+            }
+        }
+    }
+
+    // Called under key's shard lock, so no one else can be inserting key
+    Slot* claim(uint64_t key) {
+        for (size_t i = hash(key) & mask_;; i = (i + 1) & mask_) {
+            uint64_t current = slots_[i].key.load(std::memory_order_acquire);
+            if (current == key) {
+                return &slots_[i];
+            }
+            if (current != 0) {
+                continue;
+            }
+            if (size_.load(std::memory_order_relaxed) >= capacity_) {
+                return nullptr;
+            }
+            // Another shard may take this slot first; then keep probing
+            if (slots_[i].key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                size_.fetch_add(1, std::memory_order_relaxed);
+                return &slots_[i];
+            }
+            if (current == key) {
+                return &slots_[i];
+            }
+        }
+    }
+
+    static bool read_slot(const Slot& slot, Value& out) {
+        for (;;) {
+            uint32_t before = slot.version.load(std::memory_order_acquire);
+            if (before == 0) {
+                return false;  // claimed, first write still to come
+            }
+            if (before & 1) {
+                continue;
+            }
+            for (size_t i = 0; i < WORDS; i++) {
+                out[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.version.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+    }
+
+    size_t capacity_;
+    size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic<size_t> size_;
+    std::atomic<uint64_t> full_;
+    Shard shards_[SHARDS];
+};
+
+struct TalkgroupState {
+    uint32_t nac = 0;
+    uint32_t talkgroup = 0;
+    uint32_t source_id = 0;        // unit in the last GRP_V_CH_GRANT, 0 if none seen
+    uint16_t channel = 0;
+    uint64_t frequency_hz = 0;     // 0 until the channel's IDEN_UP has been seen
+    bool emergency = false;
+    bool encrypted = false;
+    uint64_t last_grant_us = 0;    // last grant or grant update, microseconds since the epoch
+    uint32_t grants = 0;           // GRP_V_CH_GRANTs, not counting updates
+    uint32_t affiliated_units = 0;
+};
+
+struct UnitState {
+    uint32_t nac = 0;
+    uint32_t unit_id = 0;
+    bool registered = false;
+    uint32_t talkgroup = 0;        // current affiliation, 0 for none
+    uint64_t last_seen_us = 0;
+    uint32_t last_grant_talkgroup = 0;  // 0 after a unit-to-unit grant
+    uint16_t last_grant_channel = 0;
+    uint32_t grants = 0;
+};
+
+class TrunkingState {
+public:
+    struct Stats {
+        uint64_t messages;             // decoded TSBKs
+        uint64_t grants;
+        uint64_t grant_updates;
+        uint64_t unit_grants;
+        uint64_t affiliations;
+        uint64_t registrations;
+        uint64_t deregistrations;
+        uint64_t channel_idens;
+        size_t talkgroups;
+        size_t units;
+        uint64_t table_full;           // updates refused for a new key because its table was full
+    };
+
+    explicit TrunkingState(const TrunkingStateConfig& config = TrunkingStateConfig())
+        : config_(config), talkgroups_(config.talkgroups), units_(config.units), idens_(IDEN_CAPACITY) {
+        static const char* kinds[KIND_COUNT] = {"grant", "grant_update", "unit_grant", "affiliation",
+                                                "registration", "deregistration", "iden_up"};
+        MetricsRegistry& registry = MetricsRegistry::global();
+        for (int k = 0; k < KIND_COUNT; k++) {
+            counts_[k].store(0, std::memory_order_relaxed);
+            metrics_[k] = &registry.counter("trunk_decoder_trunking_messages_total",
+                                            "Control channel messages applied to the call-state tables",
+                                            std::string("type=\"") + kinds[k] + "\"");
+        }
+    }
+
+    TrunkingState(const TrunkingState&) = delete;
+    TrunkingState& operator=(const TrunkingState&) = delete;
+
+    // Fold every standard TSBK in data into the tables
+    void process(const P25_TSBK_Data& data) {
+        uint32_t nac = data.system_id & 0xFFF;
+        uint64_t at_us = data.received_time ? data.received_time : now_us();
+        const uint8_t* p = data.tsbk_data.data();
+        for (size_t off = 0; off + TsbkMessage::BLOCK_SIZE <= data.tsbk_data.size(); off += TsbkMessage::BLOCK_SIZE) {
+            TsbkMessage message;
+            if (message.parse(p + off)) {
+                apply(nac, at_us, message);
+            }
+        }
+    }
+
+    bool talkgroup(uint32_t nac, uint32_t talkgroup, TalkgroupState& out) const {
+        TalkgroupTable::Value value;
+        if (!talkgroups_.read(make_key(nac, talkgroup), value)) {
+            return false;
+        }
+        unpack_talkgroup(nac, talkgroup, value, out);
+        return true;
+    }
+
+    bool unit(uint32_t nac, uint32_t unit_id, UnitState& out) const {
+        UnitTable::Value value;
+        if (!units_.read(make_key(nac, unit_id), value)) {
+            return false;
+        }
+        unpack_unit(nac, unit_id, value, out);
+        return true;
+    }
+
+    // fn(const TalkgroupState&) for every talkgroup seen
+    template <class Fn>
+    void for_each_talkgroup(Fn&& fn) const {
+        talkgroups_.for_each([&fn](uint64_t key, const TalkgroupTable::Value& value) {
+            TalkgroupState state;
+            unpack_talkgroup(key_nac(key), key_id(key), value, state);
+            fn(static_cast<const TalkgroupState&>(state));
+        });
+    }
+
+    // Frequency of a 16-bit channel field, 0 if its identifier is unknown
+    uint64_t channel_frequency(uint32_t nac, uint16_t channel) const {
+        IdenTable::Value value;
+        if (!idens_.read(make_key(nac & 0xFFF, channel >> 12), value)) {
+            return 0;
+        }
+        return value[0] + static_cast<uint64_t>(channel & 0xFFF) * value[1];
+    }
+
+    // Fill in what the control channel knew about call's talkgroup and its
+    // uploader did not: source unit, frequency, emergency. Grants older than
+    // max_grant_age_s at reported_at belong to an earlier call.
+    void enrich(Call_Data_t& call, std::chrono::system_clock::time_point reported_at) const {
+        TalkgroupState state;
+        if (!config_.enabled || call.nac == 0 || call.talkgroup <= 0 ||
+            !talkgroup(call.nac, static_cast<uint32_t>(call.talkgroup), state) || state.last_grant_us == 0) {
+            return;
+        }
+        uint64_t reported_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            reported_at.time_since_epoch()).count();
+        if (reported_us > state.last_grant_us &&
+            reported_us - state.last_grant_us > static_cast<uint64_t>(config_.max_grant_age_s) * 1000000ULL) {
+            return;
+        }
+        if (call.source_id == 0) {
+            call.source_id = state.source_id;
+        }
+        if (call.freq == 0.0) {
+            call.freq = static_cast<double>(state.frequency_hz);
+        }
+        call.emergency = call.emergency || state.emergency;
+    }
+
+    Stats get_stats() const {
+        Stats stats;
+        stats.grants = counts_[GRANT].load(std::memory_order_relaxed);
+        stats.grant_updates = counts_[GRANT_UPDATE].load(std::memory_order_relaxed);
+        stats.unit_grants = counts_[UNIT_GRANT].load(std::memory_order_relaxed);
+        stats.affiliations = counts_[AFFILIATION].load(std::memory_order_relaxed);
+        stats.registrations = counts_[REGISTRATION].load(std::memory_order_relaxed);
+        stats.deregistrations = counts_[DEREGISTRATION].load(std::memory_order_relaxed);
+        stats.channel_idens = counts_[IDEN].load(std::memory_order_relaxed);
+        stats.messages = stats.grants + stats.grant_updates + stats.unit_grants + stats.affiliations +
+                         stats.registrations + stats.deregistrations + stats.channel_idens;
+        stats.talkgroups = talkgroups_.size();
+        stats.units = units_.size();
+        stats.table_full = talkgroups_.full() + units_.full() + idens_.full();
+        return stats;
+    }
+
+    json get_stats_json() const {
+        Stats stats = get_stats();
+        json j;
+        j["messages"] = stats.messages;
+        j["grants"] = stats.grants;
+        j["grant_updates"] = stats.grant_updates;
+        j["unit_grants"] = stats.unit_grants;
+        j["affiliations"] = stats.affiliations;
+        j["registrations"] = stats.registrations;
+        j["deregistrations"] = stats.deregistrations;
+        j["channel_idens"] = stats.channel_idens;
+        j["talkgroups"] = stats.talkgroups;
+        j["talkgroup_capacity"] = talkgroups_.capacity();
+        j["units"] = stats.units;
+        j["unit_capacity"] = units_.capacity();
+        j["table_full"] = stats.table_full;
+        return j;
+    }
+
+private:
+    // Talkgroup words: source | channel << 24 | emergency << 40 | encrypted << 41,
+    // frequency, last grant time, grants | affiliated units << 32
+    typedef SeqlockTable<4> TalkgroupTable;
+    // Unit words: talkgroup | registered << 32, last seen,
+    // last grant talkgroup | channel << 32, grants
+    typedef SeqlockTable<4> UnitTable;
+    // Channel identifier words: base frequency, channel spacing
+    typedef SeqlockTable<2> IdenTable;
+
+    // 16 identifiers each for 64 NACs, far more than one decoder hears
+    static constexpr size_t IDEN_CAPACITY = 1024;
+
+    enum Kind { GRANT, GRANT_UPDATE, UNIT_GRANT, AFFILIATION, REGISTRATION, DEREGISTRATION, IDEN, KIND_COUNT };
+
+    // (NAC, id) with a top bit so no key is 0, the table's empty marker
+    static uint64_t make_key(uint32_t nac, uint32_t id) { return (1ULL << 63) | (static_cast<uint64_t>(nac) << 32) | id; }
+    static uint32_t key_nac(uint64_t key) { return static_cast<uint32_t>(key >> 32) & 0xFFF; }
+    static uint32_t key_id(uint64_t key) { return static_cast<uint32_t>(key); }
+
+    static uint64_t now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static void unpack_talkgroup(uint32_t nac, uint32_t talkgroup, const TalkgroupTable::Value& v, TalkgroupState& out) {
+        out.nac = nac;
+        out.talkgroup = talkgroup;
+        out.source_id = static_cast<uint32_t>(v[0] & 0xFFFFFF);
+        out.channel = static_cast<uint16_t>(v[0] >> 24);
+        out.emergency = (v[0] >> 40) & 1;
+        out.encrypted = (v[0] >> 41) & 1;
+        out.frequency_hz = v[1];
+        out.last_grant_us = v[2];
+        out.grants = static_cast<uint32_t>(v[3]);
+        out.affiliated_units = static_cast<uint32_t>(v[3] >> 32);
+    }
+
+    static void unpack_unit(uint32_t nac, uint32_t unit_id, const UnitTable::Value& v, UnitState& out) {
+        out.nac = nac;
+        out.unit_id = unit_id;
+        out.talkgroup = static_cast<uint32_t>(v[0]);
+        out.registered = (v[0] >> 32) & 1;
+        out.last_seen_us = v[1];
+        out.last_grant_talkgroup = static_cast<uint32_t>(v[2]);
+        out.last_grant_channel = static_cast<uint16_t>(v[2] >> 32);
+        out.grants = static_cast<uint32_t>(v[3]);
+    }
+
+    void count(Kind kind) {
+        counts_[kind].fetch_add(1, std::memory_order_relaxed);
+        metrics_[kind]->add(1);
+    }
+
+    void grant(uint32_t nac, uint64_t at_us, const TsbkMessage& m, size_t i, bool update) {
+        uint64_t frequency = channel_frequency(nac, m.channel[i]);
+        bool has_options = m.opcode != TsbkMessage::GRP_V_CH_GRANT_UPDT;
+        talkgroups_.update(make_key(nac, m.group[i]), [&](TalkgroupTable::Value& v) {
+            uint64_t flags = v[0] & (3ULL << 40);
+            if (has_options) {
+                flags = (m.emergency ? 1ULL << 40 : 0) | (m.encrypted ? 1ULL << 41 : 0);
+            }
+            uint64_t source = update ? (v[0] & 0xFFFFFF) : m.source;
+            v[0] = source | (static_cast<uint64_t>(m.channel[i]) << 24) | flags;
+            v[1] = frequency ? frequency : v[1];
+            v[2] = at_us;
+            if (!update) {
+                v[3] = (v[3] & ~0xFFFFFFFFULL) | ((v[3] + 1) & 0xFFFFFFFFULL);
+            }
+        });
+    }
+
+    void unit_seen(uint32_t nac, uint32_t unit_id, uint64_t at_us, uint32_t grant_talkgroup, uint16_t channel) {
+        units_.update(make_key(nac, unit_id), [&](UnitTable::Value& v) {
+            v[1] = at_us;
+            v[2] = grant_talkgroup | (static_cast<uint64_t>(channel) << 32);
+            v[3]++;
+        });
+    }
+
+    // Move unit's affiliation to talkgroup (0: none), keeping per-group counts;
+    // only a registered unit can affiliate
+    void affiliate(uint32_t nac, uint32_t unit_id, uint64_t at_us, uint32_t talkgroup, bool registered) {
+        uint32_t previous = 0;
+        units_.update(make_key(nac, unit_id), [&](UnitTable::Value& v) {
+            previous = static_cast<uint32_t>(v[0]);
+            v[0] = talkgroup | (registered ? 1ULL << 32 : 0);
+            v[1] = at_us;
+        });
+        if (previous == talkgroup) {
+            return;
+        }
+        if (previous != 0) {
+            talkgroups_.update(make_key(nac, previous), [](TalkgroupTable::Value& v) {
+                if (v[3] >> 32) {
+                    v[3] -= 1ULL << 32;
+                }
+            });
+        }
+        if (talkgroup != 0) {
+            talkgroups_.update(make_key(nac, talkgroup), [](TalkgroupTable::Value& v) {
+                v[3] += 1ULL << 32;
+            });
+        }
+    }
+
+    void apply(uint32_t nac, uint64_t at_us, const TsbkMessage& m) {
+        switch (m.opcode) {
+            case TsbkMessage::GRP_V_CH_GRANT:
+                count(GRANT);
+                grant(nac, at_us, m, 0, false);
+                if (m.source) {
+                    unit_seen(nac, m.source, at_us, m.group[0], m.channel[0]);
+                }
+                break;
+            case TsbkMessage::GRP_V_CH_GRANT_UPDT:
+            case TsbkMessage::GRP_V_CH_GRANT_UPDT_EXP:
+                count(GRANT_UPDATE);
+                for (size_t i = 0; i < m.group_grants; i++) {
+                    grant(nac, at_us, m, i, true);
+                }
+                break;
+            case TsbkMessage::UU_V_CH_GRANT:
+                count(UNIT_GRANT);
+                unit_seen(nac, m.source, at_us, 0, m.channel[0]);
+                unit_seen(nac, m.target, at_us, 0, m.channel[0]);
+                break;
+            case TsbkMessage::GRP_AFF_RSP: {
+                count(AFFILIATION);
+                if (!m.accepted) {
+                    break;
+                }
+                affiliate(nac, m.target, at_us, m.group[0], true);
+                break;
+            }
+            case TsbkMessage::U_REG_RSP:
+                count(REGISTRATION);
+                if (m.accepted) {
+                    units_.update(make_key(nac, m.source), [&](UnitTable::Value& v) {
+                        v[0] |= 1ULL << 32;
+                        v[1] = at_us;
+                    });
+                }
+                break;
+            case TsbkMessage::U_DE_REG_ACK:
+                count(DEREGISTRATION);
+                affiliate(nac, m.source, at_us, 0, false);
+                break;
+            case TsbkMessage::IDEN_UP:
+            case TsbkMessage::IDEN_UP_VU:
+                count(IDEN);
+                idens_.update(make_key(nac, m.iden), [&](IdenTable::Value& v) {
+                    v[0] = m.base_hz;
+                    v[1] = m.spacing_hz;
+                });
+                break;
+            default:
+                break;
+        }
+    }
+
+    TrunkingStateConfig config_;
+    TalkgroupTable talkgroups_;
+    UnitTable units_;
+    IdenTable idens_;
+    std::atomic<uint64_t> counts_[KIND_COUNT];
+    MetricsRegistry::Counter* metrics_[KIND_COUNT];
+};
@@ -0,0 +1,116 @@
+/*
+ * P25 trunking signalling block (TSBK) decoding for trunk-decoder
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Decodes the standard (MFID 0) outbound control channel messages the rest
+ * of the tree cares about out of one 12-byte TSBK: voice channel grants and
+ * their updates, affiliation and registration responses, and the channel
+ * identifier updates needed to turn a channel number into a frequency.
+ * Field positions follow TIA-102.AABC; the CRC is not checked here, the
+ * input plugin only forwards blocks that passed it.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct TsbkMessage {
+    static constexpr size_t BLOCK_SIZE = 12;
+
+    enum Opcode : uint8_t {
+        GRP_V_CH_GRANT = 0x00,
+        GRP_V_CH_GRANT_UPDT = 0x02,
+        GRP_V_CH_GRANT_UPDT_EXP = 0x03,
+        UU_V_CH_GRANT = 0x04,
+        GRP_AFF_RSP = 0x28,
+        U_REG_RSP = 0x2C,
+        U_DE_REG_ACK = 0x2F,
+        IDEN_UP_VU = 0x34,
+        IDEN_UP = 0x3D
+    };
+
+    uint8_t opcode = 0;
+
+    // Voice grants: group_grants (channel, group) pairs; UU_V_CH_GRANT sets
+    // channel[0] only. GRP_AFF_RSP puts the affiliated group in group[0].
+    size_t group_grants = 0;
+    uint16_t channel[2] = {0, 0};  // 4-bit channel identifier, 12-bit channel number
+    uint32_t group[2] = {0, 0};
+    bool emergency = false;        // service options
+    bool encrypted = false;
+
+    uint32_t source = 0;           // requesting / registering unit
+    uint32_t target = 0;           // called unit, or the unit an affiliation is for
+    bool accepted = false;         // GRP_AFF_RSP, U_REG_RSP
+
+    // IDEN_UP, IDEN_UP_VU
+    uint8_t iden = 0;
+    uint64_t base_hz = 0;
+    uint32_t spacing_hz = 0;
+
+    // Decode one block; false for manufacturer-specific and unhandled opcodes
+    bool parse(const uint8_t* b) {
+        if (b[1] != 0x00) {
+            return false;
+        }
+        opcode = b[0] & 0x3F;
+        switch (opcode) {
+            case GRP_V_CH_GRANT:
+                service_options(b[2]);
+                group_grants = 1;
+                channel[0] = be16(b + 3);
+                group[0] = be16(b + 5);
+                source = be24(b + 7);
+                return true;
+            case GRP_V_CH_GRANT_UPDT:  // two channel/group pairs
+                group_grants = 2;
+                channel[0] = be16(b + 2);
+                group[0] = be16(b + 4);
+                channel[1] = be16(b + 6);
+                group[1] = be16(b + 8);
+                return true;
+            case GRP_V_CH_GRANT_UPDT_EXP:  // explicit transmit and receive channels
+                service_options(b[2]);
+                group_grants = 1;
+                channel[0] = be16(b + 4);
+                group[0] = be16(b + 8);
+                return true;
+            case UU_V_CH_GRANT:
+                channel[0] = be16(b + 2);
+                target = be24(b + 4);
+                source = be24(b + 7);
+                return true;
+            case GRP_AFF_RSP:
+                accepted = (b[2] & 0x03) == 0;
+                group[0] = be16(b + 5);
+                target = be24(b + 7);
+                return true;
+            case U_REG_RSP:
+                accepted = ((b[2] >> 4) & 0x03) == 0;
+                source = be24(b + 7);
+                return true;
+            case U_DE_REG_ACK:
+                source = be24(b + 7);
+                return true;
+            case IDEN_UP_VU:
+            case IDEN_UP:
+                iden = b[2] >> 4;
+                spacing_hz = (((b[4] & 0x03) << 8) | b[5]) * 125u;
+                base_hz = static_cast<uint64_t>((static_cast<uint32_t>(b[6]) << 24) | (b[7] << 16) | (b[8] << 8) | b[9]) * 5u;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+private:
+    void service_options(uint8_t options) {
+        emergency = (options & 0x80) != 0;
+        encrypted = (options & 0x40) != 0;
+    }
+
+    static uint16_t be16(const uint8_t* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+    static uint32_t be24(const uint8_t* p) { return (static_cast<uint32_t>(p[0]) << 16) | (p[1] << 8) | p[2]; }
+};
@@ -0,0 +1,406 @@
+/*
+ * TSBK reorder buffer and duplicate filter for trunk-decoder
+ * Sits between the input plugins and the PluginRouter
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Packets are sequenced per (source plugin, system_id, site_id) stream by
+ * sequence_number. Each stream holds early packets in a small ring indexed
+ * by sequence number and releases them in order as the gap before them
+ * fills, or once the first held packet has waited window_ms, in which case
+ * the missing numbers are given up on. Repeats of a number already held or
+ * recently released are dropped; a jump further than the ring reaches,
+ * either way, is taken as the sender restarting and resyncs the stream.
+ *
+ * Several feeds of one control channel deliver the same TSBKs under their
+ * own sequence numbers. Released packets are checked against a compact set
+ * of (content hash, stream) fingerprints from the last dedupe_window_ms:
+ * a packet whose bytes another stream already delivered is dropped. The
+ * same bytes again from the same stream are the site repeating itself and
+ * go through. The set is two open-addressed generations of 64-bit slots;
+ * the older one is cleared every window, so memory is fixed and nothing is
+ * ever deleted slot by slot.
+ *
+ * Outputs therefore see each TSBK once, in order per stream. Packets
+ * without a sequence number (0) skip the reorder buffer.
+ */
+
+#pragma once
+
+#include "plugin_api.h"
+#include "content_hash.h"
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+struct TsbkSequencerConfig {
+    bool enabled = true;
+    int window_ms = 50;            // longest an early packet waits for the ones before it
+    size_t reorder_slots = 256;    // sequence numbers a stream can hold ahead, rounded up to a power of two
+    int dedupe_window_ms = 250;    // how long a delivered TSBK suppresses copies from other feeds
+    size_t dedupe_capacity = 16384; // fingerprints per generation
+
+    // {"enabled": true, "window_ms": 50, "reorder_slots": 256,
+    //  "dedupe_window_ms": 250, "dedupe_capacity": 16384}
+    static TsbkSequencerConfig from_json(const json& config) {
+        TsbkSequencerConfig c;
+        if (!config.is_object()) {
+            return c;
+        }
+        c.enabled = config.value("enabled", c.enabled);
+        c.window_ms = std::max(1, config.value("window_ms", c.window_ms));
+        c.reorder_slots = std::max<size_t>(2, config.value("reorder_slots", c.reorder_slots));
+        c.dedupe_window_ms = std::max(0, config.value("dedupe_window_ms", c.dedupe_window_ms));
+        c.dedupe_capacity = std::max<size_t>(64, config.value("dedupe_capacity", c.dedupe_capacity));
+        return c;
+    }
+};
+
+class TsbkSequencer {
+public:
+    typedef std::function<void(const P25_TSBK_Data&)> Sink;
+    typedef std::chrono::steady_clock Clock;
+
+
+    struct Stats {
+        uint64_t released;
+        uint64_t reordered;            // arrived ahead of a lower sequence number and waited for it
+        uint64_t repeated;             // same stream, same sequence number again
+        uint64_t late;                 // older than what the stream already released
+        uint64_t gaps;                 // sequence numbers given up on
+        uint64_t overlaps;             // same TSBK from another feed
+        uint64_t resyncs;
+        size_t streams;
+    };
+
+    TsbkSequencer(Sink sink, const TsbkSequencerConfig& config = TsbkSequencerConfig())
+        : sink_(std::move(sink)), config_(config), slot_mask_(round_up(config.reorder_slots) - 1),
+          fingerprints_(config.dedupe_capacity), running_(false),
+          released_(0), reordered_(0), repeated_(0), late_(0), gaps_(0), overlaps_(0), resyncs_(0) {
+        MetricsRegistry& registry = MetricsRegistry::global();
+        repeated_metric_ = &registry.counter("trunk_decoder_tsbk_dropped_total",
+                                             "TSBK packets dropped before routing", "reason=\"repeat\"");
+        late_metric_ = &registry.counter("trunk_decoder_tsbk_dropped_total",
+                                         "TSBK packets dropped before routing", "reason=\"late\"");
+        overlap_metric_ = &registry.counter("trunk_decoder_tsbk_dropped_total",
+                                            "TSBK packets dropped before routing", "reason=\"overlap\"");
+        gap_metric_ = &registry.counter("trunk_decoder_tsbk_gaps_total",
+                                        "TSBK sequence numbers that never arrived within the reorder window");
+        reordered_metric_ = &registry.counter("trunk_decoder_tsbk_reordered_total",
+                                              "TSBK packets released in sequence after arriving out of order");
+    }
+
+    ~TsbkSequencer() {
+        stop();
+    }
+
+    TsbkSequencer(const TsbkSequencer&) = delete;
+    TsbkSequencer& operator=(const TsbkSequencer&) = delete;
+
+    // Release held packets on a timer; without this they only move when
+    // more packets arrive
+    void start() {
+        if (!config_.enabled || running_.exchange(true)) {
+            return;
+        }
+        timer_ = std::thread([this] {
+            std::unique_lock<std::mutex> lock(timer_mutex_);
+            auto tick = std::chrono::milliseconds(std::max(1, config_.window_ms / 2));
+            while (running_) {
+                timer_wake_.wait_for(lock, tick);
+                lock.unlock();
+                flush_expired(Clock::now());
+                lock.lock();
+            }
+        });
+    }
+
+    // Stops the timer and delivers everything still held
+    void stop() {
+        if (running_.exchange(false)) {
+            timer_wake_.notify_all();
+            timer_.join();
+        }
+        flush_expired(Clock::time_point::max());
+    }
+
+    // From any input thread
+    void push(const P25_TSBK_Data& data) {
+        if (!config_.enabled) {
+            sink_(data);
+            return;
+        }
+        Clock::time_point now = Clock::now();
+        Stream& stream = stream_for(data);
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        if (data.sequence_number == 0) {
+            release(stream, data, now);
+            return;
+        }
+        if (!stream.synced) {
+            stream.next = data.sequence_number;
+            stream.synced = true;
+        }
+
+        uint32_t ahead = data.sequence_number - stream.next;
+        uint32_t behind = stream.next - data.sequence_number;
+        if (static_cast<int32_t>(ahead) < 0 && behind <= slot_mask_ + 1) {
+            late_.fetch_add(1, std::memory_order_relaxed);
+            late_metric_->add();
+            return;
+        }
+        if (ahead > slot_mask_) {
+            // Restarted sender or a long outage: deliver what we have and follow the new numbers
+            drain(stream, now);
+            stream.next = data.sequence_number;
+            resyncs_.fetch_add(1, std::memory_order_relaxed);
+            ahead = 0;
+        }
+
+        Slot& slot = stream.slots[data.sequence_number & slot_mask_];
+        if (slot.full) {
+            repeated_.fetch_add(1, std::memory_order_relaxed);
+            repeated_metric_->add();
+            return;
+        }
+        slot.full = true;
+        slot.packet = data;
+        slot.arrived = now;
+        stream.held++;
+        if (ahead > 0) {
+            reordered_.fetch_add(1, std::memory_order_relaxed);
+            reordered_metric_->add();
+        }
+        advance(stream, now);
+    }
+
+    // Give up on gaps whose first held packet has waited window_ms (all of
+    // them when now is max())
+    void flush_expired(Clock::time_point now) {
+        std::vector<Stream*> streams;
+        {
+            std::lock_guard<std::mutex> lock(streams_mutex_);
+            for (auto& entry : streams_) {
+                streams.push_back(entry.second.get());
+            }
+        }
+        const bool everything = now == Clock::time_point::max();
+        const Clock::time_point stamp = everything ? Clock::now() : now;
+        auto window = std::chrono::milliseconds(config_.window_ms);
+        for (Stream* stream : streams) {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            while (stream->held > 0) {
+                uint32_t skipped = 0;
+                while (!stream->slots[(stream->next + skipped) & slot_mask_].full) {
+                    skipped++;
+                }
+                const Slot& first = stream->slots[(stream->next + skipped) & slot_mask_];
+                if (!everything && now - first.arrived < window) {
+                    break;
+                }
+                gaps_.fetch_add(skipped, std::memory_order_relaxed);
+                gap_metric_->add(skipped);
+                stream->next += skipped;
+                advance(*stream, stamp);
+            }
+        }
+    }
+
+    Stats get_stats() {
+        Stats stats;
+        stats.released = released_.load();
+        stats.reordered = reordered_.load();
+        stats.repeated = repeated_.load();
+        stats.late = late_.load();
+        stats.gaps = gaps_.load();
+        stats.overlaps = overlaps_.load();
+        stats.resyncs = resyncs_.load();
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        stats.streams = streams_.size();
+        return stats;
+    }
+
+    json get_stats_json() {
+        Stats stats = get_stats();
+        json out;
+        out["released"] = stats.released;
+        out["reordered"] = stats.reordered;
+        out["repeated"] = stats.repeated;
+        out["late"] = stats.late;
+        out["gaps"] = stats.gaps;
+        out["overlaps"] = stats.overlaps;
+        out["resyncs"] = stats.resyncs;
+        out["streams"] = stats.streams;
+        return out;
+    }
+
+private:
+    struct Slot {
+        bool full = false;
+        P25_TSBK_Data packet;
+        Clock::time_point arrived;
+    };
+
+    struct Stream {
+        std::mutex mutex;
+        uint16_t id;                   // tag in the fingerprint set
+        bool synced = false;
+        uint32_t next = 0;             // lowest sequence number not yet released
+        size_t held = 0;
+        std::vector<Slot> slots;
+    };
+
+    // Fingerprints of recently released TSBKs: high 48 bits of the content
+    // hash, low 16 bits the stream that delivered it; 0 is an empty slot
+    class FingerprintSet {
+    public:
+        explicit FingerprintSet(size_t capacity) : mask_(round_up(capacity * 2) - 1), current_(0) {
+            generations_[0].assign(mask_ + 1, 0);
+            generations_[1].assign(mask_ + 1, 0);
+        }
+
+        // True if another stream delivered hash; records it for this one either way.
+        // A full probe run just leaves the hash unrecorded.
+        bool seen_elsewhere(uint64_t hash, uint16_t stream, Clock::time_point now, Clock::duration window) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (now - rotated_ >= window) {
+                current_ ^= 1;
+                std::fill(generations_[current_].begin(), generations_[current_].end(), 0);
+                rotated_ = now;
+            }
+            const uint64_t key = hash & ~0xFFFFull;
+            bool other = false;
+            for (auto& generation : generations_) {
+                for (size_t probe = 0, i = hash & mask_; probe < MAX_PROBES; probe++, i = (i + 1) & mask_) {
+                    uint64_t entry = generation[i];
+                    if (entry == 0) {
+                        break;
+                    }
+                    if ((entry & ~0xFFFFull) == key && static_cast<uint16_t>(entry) != stream) {
+                        other = true;
+                    }
+                }
+            }
+            std::vector<uint64_t>& generation = generations_[current_];
+            uint64_t entry = key | stream;   // never 0: stream IDs start at 1
+            for (size_t probe = 0, i = hash & mask_; probe < MAX_PROBES; probe++, i = (i + 1) & mask_) {
+                if (generation[i] == 0 || generation[i] == entry) {
+                    generation[i] = entry;
+                    break;
+                }
+            }
+            return other;
+        }
+
+    private:
+        static constexpr size_t MAX_PROBES = 8;
+        std::mutex mutex_;
+        size_t mask_;
+        std::vector<uint64_t> generations_[2];
+        int current_;
+        Clock::time_point rotated_;
+    };
+
+    static size_t round_up(size_t n) {
+        size_t size = 1;
+        while (size < n) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    Stream& stream_for(const P25_TSBK_Data& data) {
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        auto key = std::make_tuple(data.source_name, data.system_id, data.site_id);
+        auto it = streams_.find(key);
+        if (it == streams_.end()) {
+            auto stream = std::make_unique<Stream>();
+            // Stream 0 never appears in a fingerprint, so every stream differs from an empty slot's tag
+            stream->id = static_cast<uint16_t>(streams_.size() % 0xFFFF + 1);
+            stream->slots.resize(slot_mask_ + 1);
+            it = streams_.emplace(key, std::move(stream)).first;
+        }
+        return *it->second;
+    }
+
+    // Release consecutive packets from stream.next on; stream.mutex held
+    void advance(Stream& stream, Clock::time_point now) {
+        for (;;) {
+            Slot& slot = stream.slots[stream.next & slot_mask_];
+            if (!slot.full) {
+                break;
+            }
+            release(stream, slot.packet, now);
+            slot.full = false;
+            slot.packet = P25_TSBK_Data();
+            stream.held--;
+            stream.next++;
+        }
+    }
+
+    // Everything held, in order, skipping gaps; stream.mutex held
+    void drain(Stream& stream, Clock::time_point now) {
+        while (stream.held > 0) {
+            while (!stream.slots[stream.next & slot_mask_].full) {
+                stream.next++;
+                gaps_.fetch_add(1, std::memory_order_relaxed);
+                gap_metric_->add();
+            }
+            advance(stream, now);
+        }
+    }
+
+    void release(Stream& stream, const P25_TSBK_Data& data, Clock::time_point now) {
+        if (config_.dedupe_window_ms > 0) {
+            ContentHash hash(data.system_id);
+            hash.update(&data.site_id, sizeof(data.site_id));
+            hash.update(data.tsbk_data.data(), data.tsbk_data.size());
+            if (fingerprints_.seen_elsewhere(hash.digest(), stream.id, now,
+                                             std::chrono::milliseconds(config_.dedupe_window_ms))) {
+                overlaps_.fetch_add(1, std::memory_order_relaxed);
+                overlap_metric_->add();
+                return;
+            }
+        }
+        released_.fetch_add(1, std::memory_order_relaxed);
+        sink_(data);
+    }
+
+    Sink sink_;
+    const TsbkSequencerConfig config_;
+    const uint32_t slot_mask_;
+
+    std::mutex streams_mutex_;
+    std::map<std::tuple<std::string, uint32_t, uint32_t>, std::unique_ptr<Stream>> streams_;
+    FingerprintSet fingerprints_;
+
+    std::atomic<bool> running_;
+    std::thread timer_;
+    std::mutex timer_mutex_;
+    std::condition_variable timer_wake_;
+
+    std::atomic<uint64_t> released_;
+    std::atomic<uint64_t> reordered_;
+    std::atomic<uint64_t> repeated_;
+    std::atomic<uint64_t> late_;
+    std::atomic<uint64_t> gaps_;
+    std::atomic<uint64_t> overlaps_;
+    std::atomic<uint64_t> resyncs_;
+
+    MetricsRegistry::Counter* repeated_metric_;
+    MetricsRegistry::Counter* late_metric_;
+    MetricsRegistry::Counter* overlap_metric_;
+    MetricsRegistry::Counter* gap_metric_;
+    MetricsRegistry::Counter* reordered_metric_;
+};
@@ -0,0 +1,91 @@
+/*
+ * IMBE voice frame quality
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Tracks the FEC results of every IMBE codeword in a call and makes the
+ * TIA-102.BABA frame repeat (7.7) and muting (7.8) decisions from them, the
+ * same way the float software_imbe_decoder does: a running error rate
+ * ER = 0.95 ER + 0.000365 ET mutes above 0.0875; a codeword with E0 >= 2,
+ * ET >= 10 + 40 ER or an invalid pitch (b0 > 207) repeats the previous
+ * one, and more than max_repeats (three by default) repeats in a row mute.
+ *
+ * Everything here is a few integer adds per codeword so it can sit in the
+ * decode hot path; the totals go into CallMetadata and the call JSON.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+class VoiceQuality {
+public:
+    enum Decision {
+        VOICE,
+        REPEAT,
+        MUTE
+    };
+
+    static constexpr int HISTOGRAM_BINS = 16;   // ET is at most 15 (4 Golay x 3 + 3 Hamming x 1)
+    static constexpr int CODEWORD_BITS = 144;
+    static constexpr int DEFAULT_MAX_REPEATS = 3;
+
+    VoiceQuality() : codewords_(0), corrected_bits_(0), repeats_(0), mutes_(0),
+                     error_rate_(0.0), peak_error_rate_(0.0), repeat_run_(0), histogram_{0} {}
+
+    // u0 and u7 as returned by imbe_header_decode (u7 still shifted left by one)
+    Decision add_codeword(uint32_t E0, uint32_t ET, uint32_t u0, uint32_t u7,
+                          int max_repeats = DEFAULT_MAX_REPEATS) {
+        codewords_++;
+        corrected_bits_ += ET;
+        histogram_[ET < HISTOGRAM_BINS ? ET : HISTOGRAM_BINS - 1]++;
+
+        error_rate_ = 0.95 * error_rate_ + 0.000365 * ET;
+        if (error_rate_ > peak_error_rate_) {
+            peak_error_rate_ = error_rate_;
+        }
+
+        Decision decision = VOICE;
+        uint32_t b0 = ((u0 >> 4) & 0xfc) | ((u7 >> 1) & 0x3);
+        if (error_rate_ > 0.0875) {
+            decision = MUTE;
+        } else if (b0 > 207 || E0 >= 2 || ET >= 10 + 40 * error_rate_) {
+            decision = ++repeat_run_ > max_repeats ? MUTE : REPEAT;
+        }
+        if (decision == VOICE) {
+            repeat_run_ = 0;
+        } else if (decision == REPEAT) {
+            repeats_++;
+        } else {
+            mutes_++;
+        }
+        return decision;
+    }
+
+    uint64_t codewords() const { return codewords_; }
+    uint64_t corrected_bits() const { return corrected_bits_; }
+    uint64_t repeats() const { return repeats_; }
+    uint64_t mutes() const { return mutes_; }
+    uint64_t bad_frames() const { return repeats_ + mutes_; }
+    // Frames since the last good one that were repeated or muted
+    int repeat_run() const { return repeat_run_; }
+    const uint64_t* histogram() const { return histogram_; }
+
+    double average_errors() const { return codewords_ ? double(corrected_bits_) / codewords_ : 0.0; }
+    double bad_frame_rate() const { return codewords_ ? double(bad_frames()) / codewords_ : 0.0; }
+    // Corrected bits over channel bits; a lower bound, errors beyond the
+    // codes' reach go uncounted
+    double bit_error_rate() const { return codewords_ ? double(corrected_bits_) / (codewords_ * CODEWORD_BITS) : 0.0; }
+    double error_rate() const { return error_rate_; }
+    double peak_error_rate() const { return peak_error_rate_; }
+
+private:
+    uint64_t codewords_;
+    uint64_t corrected_bits_;
+    uint64_t repeats_;
+    uint64_t mutes_;
+    double error_rate_;
+    double peak_error_rate_;
+    int repeat_run_;
+    uint64_t histogram_[HISTOGRAM_BINS];
+};
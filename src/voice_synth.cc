@@ -0,0 +1,106 @@
+/*
+ * IMBE voice synthesis backends
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ */
+
+#include "voice_synth.h"
+#include "imbe_vocoder/imbe_vocoder.h"
+#include "software_imbe_decoder.h"
+
+#include <algorithm>
+
+namespace {
+
+static const int SAMPLES_PER_FRAME = 160;
+
+// Spectral amplitude floor for silence skipping; a frame pair at or below
+// it peaks at about 30 (-61 dBFS) when synthesised
+static const int16_t SILENCE_FLOOR = 6;
+
+class FixedPointSynth : public VoiceSynth {
+public:
+    FixedPointSynth() : vocoder_(new imbe_vocoder()) {}
+
+    Backend backend() const override { return FIXED_POINT; }
+
+    void reset() override { vocoder_->clear(); }
+    
+    void set_silence_skip(bool enable) override { vocoder_->set_silence_floor(enable ? SILENCE_FLOOR : 0); }
+
+    void decode(const uint32_t (*u)[8], const uint32_t* E0, const uint32_t* ET,
+                size_t n, int16_t* out) override {
+        // imbe_vocoder runs its own FEC bookkeeping on the frame vector
+        // alone, so the error counts are not needed here
+        (void)E0;
+        (void)ET;
+        int16_t frames[BATCH][8];
+        for (size_t done = 0; done < n; done += BATCH) {
+            size_t count = std::min(n - done, static_cast<size_t>(BATCH));
+            for (size_t i = 0; i < count; i++) {
+                for (int j = 0; j < 8; j++) {
+                    frames[i][j] = u[done + i][j];
+                }
+                frames[i][7] >>= 1;
+            }
+            vocoder_->imbe_decode_batch(frames, count, out + done * SAMPLES_PER_FRAME);
+        }
+    }
+
+private:
+    static const int BATCH = 9;
+    std::unique_ptr<imbe_vocoder> vocoder_;
+};
+
+class FloatSynth : public VoiceSynth {
+public:
+    FloatSynth() : decoder_(new software_imbe_decoder()) {}
+
+    Backend backend() const override { return FLOAT; }
+
+    // software_imbe_decoder has no way to clear its state short of a new one
+    void reset() override { decoder_.reset(new software_imbe_decoder()); }
+
+    void decode(const uint32_t (*u)[8], const uint32_t* E0, const uint32_t* ET,
+                size_t n, int16_t* out) override {
+        audio_samples* samples = decoder_->audio();
+        for (size_t i = 0; i < n; i++) {
+            // The low bit of u7 carries the BOT flag the decoder expects set
+            decoder_->decode_fullrate(u[i][0], u[i][1], u[i][2], u[i][3], u[i][4], u[i][5], u[i][6],
+                                      u[i][7] | 1, E0[i], ET[i]);
+        }
+        // Samples come out already clamped to the int16 range
+        size_t count = std::min(samples->size(), n * SAMPLES_PER_FRAME);
+        std::copy(samples->begin(), samples->begin() + count, out);
+        std::fill(out + count, out + n * SAMPLES_PER_FRAME, 0);
+        samples->clear();
+    }
+
+private:
+    std::unique_ptr<software_imbe_decoder> decoder_;
+};
+
+} // namespace
+
+std::unique_ptr<VoiceSynth> VoiceSynth::create(Backend backend) {
+    if (backend == FLOAT) {
+        return std::unique_ptr<VoiceSynth>(new FloatSynth());
+    }
+    return std::unique_ptr<VoiceSynth>(new FixedPointSynth());
+}
+
+bool VoiceSynth::parse_backend(const std::string& name, Backend& backend) {
+    if (name == "fixed" || name == "fixed-point" || name == "fixed_point") {
+        backend = FIXED_POINT;
+        return true;
+    }
+    if (name == "float") {
+        backend = FLOAT;
+        return true;
+    }
+    return false;
+}
+
+const char* VoiceSynth::backend_name(Backend backend) {
+    return backend == FLOAT ? "float" : "fixed";
+}
@@ -0,0 +1,56 @@
+/*
+ * IMBE voice synthesis backends
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Turns FEC-decoded IMBE codewords into 8 kHz PCM. Two backends:
+ *
+ * - FIXED_POINT: the imbe_vocoder port of the TIA reference decoder,
+ *   bit-exact and the default.
+ * - FLOAT: OP25's software_imbe_decoder, a floating point synthesizer with
+ *   its own TIA-102.BABA repeat/mute handling; several times faster than
+ *   the fixed-point one on hosts with a decent FPU.
+ *
+ * The backend is picked per decoder (and so per stream or per batch run);
+ * a decoder's synthesis history is only meaningful to its own backend, so
+ * switching resets it.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class VoiceSynth {
+public:
+    enum Backend {
+        FIXED_POINT,
+        FLOAT
+    };
+
+    static std::unique_ptr<VoiceSynth> create(Backend backend);
+    // "fixed" / "fixed-point" or "float"; false for anything else
+    static bool parse_backend(const std::string& name, Backend& backend);
+    static const char* backend_name(Backend backend);
+
+    virtual ~VoiceSynth() {}
+
+    virtual Backend backend() const = 0;
+
+    // Forget all history, as for a new call
+    virtual void reset() = 0;
+    
+    // Decode frames too quiet to hear as zeros without synthesising them:
+    // those whose amplitudes, and the previous frame's, would peak under
+    // about -60 dBFS. Kept by reset(). Only the fixed-point backend does
+    // this; the float one synthesises every frame.
+    virtual void set_silence_skip(bool enable) { (void)enable; }
+
+    // Synthesize n codewords into n * 160 samples. u[i] are the codeword's
+    // information vectors as imbe_ldu_decode_packed returns them (u7 still
+    // shifted left by one); E0/ET its Golay/total corrected error counts.
+    virtual void decode(const uint32_t (*u)[8], const uint32_t* E0, const uint32_t* ET,
+                        size_t n, int16_t* out) = 0;
+};
@@ -0,0 +1,244 @@
+/*
+ * Single-write WAV output
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * The decoder keeps a call's PCM in one preallocated buffer; WavWriter
+ * creates the file when decoding starts (so a bad output path still fails
+ * early) and, once the call is complete, writes the final header and all
+ * of the samples in a single pwritev(). There is no placeholder header to
+ * seek back and patch, and no per-frame write.
+ *
+ * Options for archive disks, where written calls are rarely read back:
+ * preallocate reserves the file's extent up front so long calls are not
+ * fragmented; drop_cache flushes the file and tells the kernel its pages
+ * are not needed, so a batch run does not push everything else out of the
+ * page cache; direct_io opens with O_DIRECT and writes through a small
+ * aligned staging buffer instead, padding the last block and truncating
+ * the padding off. Filesystems without O_DIRECT (tmpfs) fall back to the
+ * buffered write.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+class WavWriter {
+public:
+    static constexpr size_t HEADER_SIZE = 44;
+
+    struct Options {
+        bool preallocate;   // reserve the whole file before writing it
+        bool drop_cache;    // fdatasync, then POSIX_FADV_DONTNEED
+        bool direct_io;     // O_DIRECT through an aligned staging buffer
+
+        Options() : preallocate(true), drop_cache(false), direct_io(false) {}
+    };
+
+    WavWriter() : fd_(-1), direct_(false) {}
+    ~WavWriter() { close(); }
+
+    WavWriter(const WavWriter&) = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+
+    // Create (or truncate) path; nothing is written until write()
+    bool open(const std::string& path, const Options& options) {
+        close();
+        options_ = options;
+        path_ = path;
+        direct_ = false;
+#ifdef O_DIRECT
+        if (options_.direct_io) {
+            fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+            direct_ = fd_ >= 0;
+        }
+#endif
+        if (fd_ < 0) {
+            fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+        return fd_ >= 0;
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+    const std::string& path() const { return path_; }
+
+    // Header and samples in one go, then close. 16-bit mono at sample_rate.
+    bool write(const int16_t* samples, size_t count, int sample_rate) {
+        if (fd_ < 0) {
+            return false;
+        }
+        uint8_t header[HEADER_SIZE];
+        make_header(header, count * sizeof(int16_t), sample_rate);
+        const size_t total = HEADER_SIZE + count * sizeof(int16_t);
+
+#ifdef __linux__
+        if (options_.preallocate && total > 0) {
+            // Best effort: EOPNOTSUPP and friends just mean no reservation
+            (void)fallocate(fd_, 0, 0, static_cast<off_t>(total));
+        }
+#endif
+
+        bool ok = direct_ ? write_direct(header, samples, count)
+                          : write_buffered(header, samples, count);
+#ifdef O_DIRECT
+        if (!ok && direct_ && errno == EINVAL) {
+            // Opened with O_DIRECT but the filesystem refuses the I/O itself
+            fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+            ok = write_buffered(header, samples, count) && ftruncate(fd_, static_cast<off_t>(total)) == 0;
+        }
+#endif
+        if (ok && options_.drop_cache) {
+            fdatasync(fd_);
+#ifdef POSIX_FADV_DONTNEED
+            posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+        }
+        if (!ok) {
+            std::cerr << "Error: Failed to write WAV file " << path_ << ": " << strerror(errno) << std::endl;
+        }
+        close();
+        return ok;
+    }
+
+    // Leave the file as it is (empty if write() never ran)
+    void close() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    // Canonical 44-byte PCM header, little-endian
+    static void make_header(uint8_t* out, size_t data_bytes, int sample_rate) {
+        const uint16_t channels = 1;
+        const uint16_t bits_per_sample = 16;
+        const uint16_t block_align = channels * bits_per_sample / 8;
+        size_t offset = 0;
+        auto tag = [&](const char* text) { memcpy(out + offset, text, 4); offset += 4; };
+        auto u16 = [&](uint32_t value) {
+            out[offset++] = value & 0xFF; out[offset++] = (value >> 8) & 0xFF;
+        };
+        auto u32 = [&](uint32_t value) { u16(value & 0xFFFF); u16(value >> 16); };
+        tag("RIFF");
+        u32(static_cast<uint32_t>(36 + data_bytes));
+        tag("WAVE");
+        tag("fmt ");
+        u32(16);
+        u16(1);     // PCM
+        u16(channels);
+        u32(static_cast<uint32_t>(sample_rate));
+        u32(static_cast<uint32_t>(sample_rate) * block_align);
+        u16(block_align);
+        u16(bits_per_sample);
+        tag("data");
+        u32(static_cast<uint32_t>(data_bytes));
+    }
+
+private:
+    static constexpr size_t DIRECT_ALIGN = 4096;
+    static constexpr size_t DIRECT_CHUNK = 1 << 20;
+
+    bool write_buffered(const uint8_t* header, const int16_t* samples, size_t count) {
+        struct iovec iov[2];
+        iov[0].iov_base = const_cast<uint8_t*>(header);
+        iov[0].iov_len = HEADER_SIZE;
+        iov[1].iov_base = const_cast<int16_t*>(samples);
+        iov[1].iov_len = count * sizeof(int16_t);
+        const size_t total = iov[0].iov_len + iov[1].iov_len;
+
+        size_t done = 0;
+        while (done < total) {
+            // Only a short write (signal, full disk) needs a second call
+            struct iovec rest[2];
+            int parts = 0;
+            size_t skip = done;
+            for (const auto& part : iov) {
+                if (skip >= part.iov_len) {
+                    skip -= part.iov_len;
+                    continue;
+                }
+                rest[parts].iov_base = static_cast<uint8_t*>(part.iov_base) + skip;
+                rest[parts].iov_len = part.iov_len - skip;
+                skip = 0;
+                parts++;
+            }
+            ssize_t n = pwritev(fd_, rest, parts, static_cast<off_t>(done));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            if (n == 0) {
+                errno = EIO;
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool write_direct(const uint8_t* header, const int16_t* samples, size_t count) {
+        void* memory = nullptr;
+        if (posix_memalign(&memory, DIRECT_ALIGN, DIRECT_CHUNK) != 0) {
+            errno = ENOMEM;
+            return false;
+        }
+        uint8_t* staging = static_cast<uint8_t*>(memory);
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(samples);
+        const size_t data_bytes = count * sizeof(int16_t);
+        const size_t total = HEADER_SIZE + data_bytes;
+
+        bool ok = true;
+        size_t file_offset = 0;
+        size_t data_offset = 0;
+        while (ok && file_offset < total) {
+            size_t fill = 0;
+            if (file_offset == 0) {
+                memcpy(staging, header, HEADER_SIZE);
+                fill = HEADER_SIZE;
+            }
+            size_t take = std::min(DIRECT_CHUNK - fill, data_bytes - data_offset);
+            memcpy(staging + fill, data + data_offset, take);
+            fill += take;
+            data_offset += take;
+
+            // O_DIRECT wants whole blocks; the tail is zero padded and truncated below
+            size_t length = (fill + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+            memset(staging + fill, 0, length - fill);
+            size_t written = 0;
+            while (written < length) {
+                ssize_t n = pwrite(fd_, staging + written, length - written,
+                                   static_cast<off_t>(file_offset + written));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    if (n == 0) {
+                        errno = EIO;
+                    }
+                    ok = false;
+                    break;
+                }
+                written += static_cast<size_t>(n);
+            }
+            file_offset += fill;
+        }
+        free(memory);
+        return ok && ftruncate(fd_, static_cast<off_t>(total)) == 0;
+    }
+
+    int fd_;
+    bool direct_;
+    Options options_;
+    std::string path_;
+};
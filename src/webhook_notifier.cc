@@ -0,0 +1,188 @@
+#include "webhook_notifier.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+
+WebhookNotifier::WebhookNotifier(int threads, size_t queue_size, bool verbose)
+    : pool_("WebhookNotifier", threads, queue_size), attempts_(3), timeout_s_(5), verbose_(verbose),
+      delivered_(0), failed_(0), dropped_(0) {}
+
+WebhookNotifier::~WebhookNotifier() {
+    stop();
+}
+
+void WebhookNotifier::start() {
+    pool_.start([this](Delivery delivery) {
+        deliver(delivery);
+    });
+}
+
+void WebhookNotifier::stop() {
+    pool_.stop();
+}
+
+bool WebhookNotifier::valid_url(const std::string& url) {
+    std::string host, port, path;
+    return parse_url(url, host, port, path);
+}
+
+bool WebhookNotifier::notify(const std::string& url, const std::string& body) {
+    if (!pool_.try_submit(Delivery{url, body})) {
+        dropped_++;
+        if (verbose_) {
+            std::cerr << "[Webhook] Queue full, dropping notification to " << url << std::endl;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool WebhookNotifier::parse_url(const std::string& url, std::string& host, std::string& port, std::string& path) {
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0) {
+        return false;
+    }
+    size_t authority_end = url.find('/', scheme.size());
+    std::string authority = url.substr(scheme.size(), authority_end == std::string::npos
+                                                          ? std::string::npos : authority_end - scheme.size());
+    path = authority_end == std::string::npos ? "/" : url.substr(authority_end);
+    if (authority.empty() || authority.find('@') != std::string::npos ||
+        path.find_first_of("\r\n ") != std::string::npos) {
+        return false;
+    }
+
+    // [v6addr]:port, host:port or host
+    size_t colon;
+    if (authority[0] == '[') {
+        size_t close = authority.find(']');
+        if (close == std::string::npos) {
+            return false;
+        }
+        host = authority.substr(1, close - 1);
+        colon = authority.size() > close + 1 && authority[close + 1] == ':' ? close + 1 : std::string::npos;
+    } else {
+        colon = authority.find(':');
+        host = authority.substr(0, colon);
+    }
+    port = colon == std::string::npos ? "80" : authority.substr(colon + 1);
+    if (host.empty() || port.empty() || port.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    return true;
+}
+
+void WebhookNotifier::deliver(const Delivery& delivery) {
+    for (int attempt = 1; attempt <= attempts_; attempt++) {
+        int status_code = 0;
+        if (post(delivery, status_code) && status_code >= 200 && status_code < 300) {
+            delivered_++;
+            return;
+        }
+        // A receiver that rejects the request outright will not change its mind
+        if (status_code >= 400 && status_code < 500 && status_code != 408 && status_code != 429) {
+            break;
+        }
+        if (attempt < attempts_) {
+            std::this_thread::sleep_for(std::chrono::seconds(1 << (attempt - 1)));
+        }
+    }
+    failed_++;
+    if (verbose_) {
+        std::cerr << "[Webhook] Failed to deliver notification to " << delivery.url << std::endl;
+    }
+}
+
+bool WebhookNotifier::post(const Delivery& delivery, int& status_code) {
+    std::string host, port, path;
+    if (!parse_url(delivery.url, host, port, path)) {
+        return false;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return false;
+    }
+
+    // Timeouts also bound connect() on Linux
+    struct timeval timeout;
+    timeout.tv_sec = timeout_s_;
+    timeout.tv_usec = 0;
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::ostringstream request;
+    request << "POST " << path << " HTTP/1.1\r\n"
+            << "Host: " << host << (port == "80" ? "" : ":" + port) << "\r\n"
+            << "User-Agent: trunk-decoder\r\n"
+            << "Content-Type: application/json\r\n"
+            << "Content-Length: " << delivery.body.size() << "\r\n"
+            << "Connection: close\r\n\r\n"
+            << delivery.body;
+    const std::string data = request.str();
+
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            close(fd);
+            return false;
+        }
+        sent += n;
+    }
+
+    // Only the status line matters
+    std::string response;
+    char buffer[512];
+    while (response.find("\r\n") == std::string::npos && response.size() < 4096) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        response.append(buffer, n);
+    }
+    close(fd);
+
+    if (response.compare(0, 5, "HTTP/") != 0) {
+        return false;
+    }
+    size_t space = response.find(' ');
+    if (space == std::string::npos) {
+        return false;
+    }
+    status_code = std::atoi(response.c_str() + space + 1);
+    return true;
+}
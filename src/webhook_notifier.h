@@ -0,0 +1,61 @@
+/*
+ * Job completion webhooks
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * POSTs a JSON document to a client-supplied http:// URL when a job
+ * finishes. Deliveries run on their own small pool so a slow or dead
+ * receiver never holds up a pipeline stage; when that pool's queue is full
+ * new notifications are dropped (the job status endpoint still has them).
+ * Each delivery is retried a few times with a growing delay.
+ */
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include "stage_pool.h"
+
+class WebhookNotifier {
+public:
+    WebhookNotifier(int threads = 2, size_t queue_size = 1000, bool verbose = false);
+    ~WebhookNotifier();
+
+    void start();
+    void stop();
+
+    // Only plain http:// URLs with a host are accepted
+    static bool valid_url(const std::string& url);
+
+    // Queue a POST of body to url; false if the queue is full or stopped
+    bool notify(const std::string& url, const std::string& body);
+
+    void configure(int attempts, int timeout_s) {
+        attempts_ = attempts > 0 ? attempts : 1;
+        timeout_s_ = timeout_s > 0 ? timeout_s : 1;
+    }
+
+    uint64_t delivered() const { return delivered_.load(); }
+    uint64_t failed() const { return failed_.load(); }
+    uint64_t dropped() const { return dropped_.load(); }
+
+private:
+    struct Delivery {
+        std::string url;
+        std::string body;
+    };
+
+    static bool parse_url(const std::string& url, std::string& host, std::string& port, std::string& path);
+    void deliver(const Delivery& delivery);
+    bool post(const Delivery& delivery, int& status_code);
+
+    StagePool<Delivery> pool_;
+    int attempts_;
+    int timeout_s_;
+    bool verbose_;
+
+    std::atomic<uint64_t> delivered_;
+    std::atomic<uint64_t> failed_;
+    std::atomic<uint64_t> dropped_;
+};
@@ -0,0 +1,178 @@
+/*
+ * Decode worker autoscaling
+ *
+ * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * Picks how many decode workers should run, between min_workers and the
+ * JobManager's maximum, from what the pool is doing: the queue depth, the
+ * recent per-job decode time and how much CPU the machine has left. The
+ * backlog is turned into seconds of work per worker; when that stays over
+ * target_queue_delay_s for scale_up_samples samples in a row the pool grows
+ * straight to the size that would drain it in time, unless the machine is
+ * already short of idle CPU, where more threads would only compete for the
+ * same cores. It shrinks by one worker at a time, and only after the queue
+ * has stayed empty and workers mostly idle for scale_down_delay_s, so a
+ * short lull between bursts does not throw away decoders that are about to
+ * be needed again.
+ *
+ * The decision is kept apart from the threads so the rules are easy to
+ * follow; JobManager samples, asks and applies the answer.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <nlohmann/json.hpp>
+
+struct AutoscalePolicy {
+    bool enabled = false;
+    int min_workers = 1;
+    double target_queue_delay_s = 2.0;  // backlog per worker, in seconds of decode, before growing
+    int scale_up_samples = 2;           // consecutive samples over target before growing
+    double scale_down_delay_s = 60.0;   // sustained quiet before dropping a worker
+    double idle_utilization = 0.5;      // busy share of the workers below which the pool counts as quiet
+    double min_cpu_idle = 0.1;          // machine-wide idle CPU share below which the pool does not grow
+    int interval_ms = 1000;
+
+    // {"enabled": true, "min_workers": 2, "target_queue_delay_s": 2, ...}
+    static AutoscalePolicy from_json(const nlohmann::json& config) {
+        AutoscalePolicy policy;
+        if (config.is_boolean()) {
+            policy.enabled = config.get<bool>();
+            return policy;
+        }
+        if (!config.is_object()) {
+            return policy;
+        }
+        policy.enabled = config.value("enabled", true);
+        policy.min_workers = std::max(1, config.value("min_workers", policy.min_workers));
+        policy.target_queue_delay_s = config.value("target_queue_delay_s", policy.target_queue_delay_s);
+        policy.scale_up_samples = std::max(1, config.value("scale_up_samples", policy.scale_up_samples));
+        policy.scale_down_delay_s = config.value("scale_down_delay_s", policy.scale_down_delay_s);
+        policy.idle_utilization = config.value("idle_utilization", policy.idle_utilization);
+        policy.min_cpu_idle = config.value("min_cpu_idle", policy.min_cpu_idle);
+        policy.interval_ms = std::max(100, config.value("interval_ms", policy.interval_ms));
+        return policy;
+    }
+};
+
+// Machine-wide idle CPU share between two calls, from /proc/stat
+class CpuIdleMeter {
+public:
+    CpuIdleMeter() : idle_(0), total_(0) { read(idle_, total_); }
+
+    // Share of CPU time spent idle since the last call; -1 if unknown
+    double sample() {
+        uint64_t idle = 0;
+        uint64_t total = 0;
+        if (!read(idle, total) || total <= total_) {
+            return -1.0;
+        }
+        double share = static_cast<double>(idle - idle_) / static_cast<double>(total - total_);
+        idle_ = idle;
+        total_ = total;
+        return share;
+    }
+
+private:
+    static bool read(uint64_t& idle, uint64_t& total) {
+        std::ifstream file("/proc/stat");
+        std::string line;
+        if (!std::getline(file, line) || line.compare(0, 4, "cpu ") != 0) {
+            return false;
+        }
+        std::istringstream fields(line.substr(4));
+        uint64_t value = 0;
+        idle = 0;
+        total = 0;
+        // user nice system idle iowait irq softirq steal; iowait counts as idle
+        for (int i = 0; i < 8 && fields >> value; ++i) {
+            total += value;
+            if (i == 3 || i == 4) {
+                idle += value;
+            }
+        }
+        return total > 0;
+    }
+
+    uint64_t idle_;
+    uint64_t total_;
+};
+
+class WorkerAutoscaler {
+public:
+    struct Sample {
+        int workers = 0;           // running now
+        int max_workers = 1;
+        int busy = 0;              // decoding a job
+        int queued = 0;            // jobs waiting for a worker
+        double decode_time_s = 0;  // recent mean per job, 0 before any
+        double cpu_idle = -1;      // from CpuIdleMeter, -1 if unknown
+        double elapsed_s = 0;      // since the previous sample
+    };
+
+    WorkerAutoscaler() : over_target_(0), quiet_s_(0.0), cpu_limited_(0) {}
+
+    void set_policy(const AutoscalePolicy& policy) { policy_ = policy; }
+    const AutoscalePolicy& policy() const { return policy_; }
+
+    int min_workers(int max_workers) const { return std::min(policy_.min_workers, max_workers); }
+
+    // Workers there should be after this sample
+    int decide(const Sample& sample) {
+        int low = min_workers(sample.max_workers);
+        int workers = std::max(1, sample.workers);
+
+        // Before any job has finished, a queue longer than the pool is the
+        // only sign of a backlog
+        double backlog_s = sample.decode_time_s > 0.0
+            ? sample.queued * sample.decode_time_s / workers
+            : (sample.queued > workers ? policy_.target_queue_delay_s * 2 : 0.0);
+
+        if (sample.queued > 0 && backlog_s > policy_.target_queue_delay_s) {
+            quiet_s_ = 0.0;
+            if (++over_target_ < policy_.scale_up_samples || workers >= sample.max_workers) {
+                return clamp(workers, low, sample.max_workers);
+            }
+            if (sample.cpu_idle >= 0.0 && sample.cpu_idle < policy_.min_cpu_idle) {
+                cpu_limited_++;
+                return clamp(workers, low, sample.max_workers);
+            }
+            over_target_ = 0;
+            int wanted = workers + 1;
+            if (sample.decode_time_s > 0.0 && policy_.target_queue_delay_s > 0.0) {
+                wanted = std::max(wanted, static_cast<int>(std::ceil(
+                    sample.queued * sample.decode_time_s / policy_.target_queue_delay_s)));
+            }
+            return clamp(wanted, low, sample.max_workers);
+        }
+        over_target_ = 0;
+
+        if (sample.queued == 0 && sample.busy < workers * policy_.idle_utilization) {
+            quiet_s_ += sample.elapsed_s;
+            if (quiet_s_ >= policy_.scale_down_delay_s && workers > low) {
+                quiet_s_ = 0.0;
+                return clamp(workers - 1, low, sample.max_workers);
+            }
+        } else {
+            quiet_s_ = 0.0;
+        }
+        return clamp(workers, low, sample.max_workers);
+    }
+
+    // Growth held back by a busy machine
+    uint64_t cpu_limited() const { return cpu_limited_; }
+
+private:
+    static int clamp(int value, int low, int high) { return std::max(low, std::min(value, high)); }
+
+    AutoscalePolicy policy_;
+    int over_target_;
+    double quiet_s_;
+    uint64_t cpu_limited_;
+};
@@ -3,195 +3,92 @@
  */
 
 #include "worker_pool.h"
-#include "p25_decoder.h"
-#include <iostream>
 #include <sstream>
 #include <random>
-#include <iomanip>
+#include <stdexcept>
 
 WorkerPool::WorkerPool(size_t num_workers, size_t max_queue_size, size_t batch_size, 
                        std::chrono::milliseconds timeout)
-    : max_queue_size_(max_queue_size), batch_size_(batch_size), timeout_(timeout),
-      stop_workers_(false), active_jobs_(0), completed_jobs_(0), failed_jobs_(0) {
-    
-    // Start worker threads
-    for (size_t i = 0; i < num_workers; ++i) {
-        workers_.emplace_back(&WorkerPool::worker_thread, this);
-    }
+    : engine_(new JobManager(static_cast<int>(num_workers), static_cast<int>(max_queue_size),
+                             static_cast<int>(timeout.count()))),
+      running_(false), max_queue_size_(max_queue_size), batch_size_(batch_size), timeout_(timeout) {
 }
 
 WorkerPool::~WorkerPool() {
     stop();
 }
 
-void WorkerPool::start() {
-    stop_workers_ = false;
+void WorkerPool::set_call_handler(std::function<void(const Call_Data_t&)> handler) {
+    engine_->set_call_handler(std::move(handler));
 }
 
-void WorkerPool::stop() {
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        stop_workers_ = true;
-    }
-    queue_condition_.notify_all();
-    
-    for (auto& worker : workers_) {
-        if (worker.joinable()) {
-            worker.join();
-        }
-    }
+void WorkerPool::set_call_record_handler(std::function<void(std::shared_ptr<const CallRecord>)> handler) {
+    engine_->set_call_record_handler(std::move(handler));
 }
 
-bool WorkerPool::enqueue_job(std::shared_ptr<ProcessingJob> job) {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
-    
-    if (job_queue_.size() >= max_queue_size_) {
-        return false; // Queue full
-    }
-    
-    // Generate unique job ID
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(1000, 9999);
-    
-    std::ostringstream job_id;
-    job_id << job->stream_name << "-" << dis(gen);
-    job->job_id = job_id.str();
-    
-    job_queue_.push(job);
-    queue_condition_.notify_one();
-    return true;
+void WorkerPool::set_scheduling_policy(const SchedulingPolicy& policy) {
+    engine_->set_scheduling_policy(policy);
 }
 
-void WorkerPool::worker_thread() {
-    while (!stop_workers_) {
-        std::shared_ptr<ProcessingJob> job;
-        
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            queue_condition_.wait(lock, [this] { 
-                return stop_workers_ || !job_queue_.empty(); 
-            });
-            
-            if (stop_workers_ && job_queue_.empty()) {
-                break;
-            }
-            
-            if (!job_queue_.empty()) {
-                job = job_queue_.front();
-                job_queue_.pop();
-                job->started_at = std::chrono::system_clock::now();
-                active_jobs_++;
-            }
-        }
-        
-        if (job) {
-            bool success = false;
-            
-            // Process based on job type
-            switch (job->type) {
-                case JobType::DECODE:
-                    success = process_decode_job(job);
-                    break;
-                case JobType::CONVERT:
-                    success = process_convert_job(job);
-                    break;
-                case JobType::UPLOAD:
-                    success = process_upload_job(job);
-                    break;
-            }
-            
-            // Update statistics
-            active_jobs_--;
-            if (success) {
-                completed_jobs_++;
-            } else {
-                failed_jobs_++;
-            }
-            
-            std::cout << "[WORKER] Processed job " << job->job_id 
-                      << " for stream " << job->stream_name 
-                      << " - " << (success ? "SUCCESS" : "FAILED") << std::endl;
-        }
-    }
+void WorkerPool::set_autoscale_policy(const AutoscalePolicy& policy) {
+    engine_->set_autoscale_policy(policy);
 }
 
-bool WorkerPool::process_decode_job(std::shared_ptr<ProcessingJob> job) {
-    try {
-        P25Decoder decoder;
-        
-        // Configure decoder for each enabled format
-        for (const auto& format_pair : job->output_formats) {
-            if (!format_pair.second) continue; // Skip disabled formats
-            
-            std::string format = format_pair.first;
-            int bitrate = 0;
-            
-            auto bitrate_it = job->format_bitrates.find(format);
-            if (bitrate_it != job->format_bitrates.end()) {
-                bitrate = bitrate_it->second;
-            }
-            
-            decoder.set_audio_format(format);
-            decoder.set_audio_bitrate(bitrate);
-            
-            if (!decoder.open_p25_file(job->input_file)) {
-                std::cerr << "[WORKER] Failed to open P25 file: " << job->input_file << std::endl;
-                return false;
-            }
-            
-            // Generate output filename
-            std::string output_base = job->output_dir + "/" + job->job_id;
-            
-            if (!decoder.decode_to_audio(output_base)) {
-                std::cerr << "[WORKER] Failed to decode P25 file" << std::endl;
-                return false;
-            }
-            
-            // Execute upload script if configured
-            if (!job->upload_script.empty()) {
-                std::ostringstream cmd;
-                cmd << job->upload_script << " \"" << output_base << "." << format << "\" "
-                    << "\"" << output_base << ".json\" \"1\"";
-                
-                int result = std::system(cmd.str().c_str());
-                if (result != 0) {
-                    std::cerr << "[WORKER] Upload script failed: " << result << std::endl;
-                }
-            }
-        }
-        
-        return true;
-        
-    } catch (const std::exception& e) {
-        std::cerr << "[WORKER] Decode job exception: " << e.what() << std::endl;
-        return false;
-    }
+void WorkerPool::configure_stage(PipelineStage stage, int threads, int queue_size) {
+    engine_->configure_stage(stage, threads, queue_size);
 }
 
-bool WorkerPool::process_convert_job(std::shared_ptr<ProcessingJob> job) {
-    // Placeholder for future async conversion jobs
-    return true;
+void WorkerPool::configure_scripts(int max_concurrent, int queue_size) {
+    engine_->configure_scripts(max_concurrent, queue_size);
 }
 
-bool WorkerPool::process_upload_job(std::shared_ptr<ProcessingJob> job) {
-    // Placeholder for future async upload jobs
-    return true;
+void WorkerPool::set_output_write_policy(const OutputWritePolicy& policy) {
+    engine_->set_output_write_policy(policy);
+}
+
+void WorkerPool::start() {
+    running_ = engine_->start();
+}
+
+void WorkerPool::stop() {
+    // Drains every stage before returning
+    engine_->stop();
+    running_ = false;
+}
+
+bool WorkerPool::enqueue_job(std::shared_ptr<ProcessingJob> job) {
+    // Generate unique job ID
+    if (job->job_id.empty()) {
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_int_distribution<> dis(1000, 9999);
+        
+        std::ostringstream job_id;
+        job_id << job->stream_name << "-" << dis(gen);
+        job->job_id = job_id.str();
+    }
+    
+    return !engine_->submit_job(job).empty();
 }
 
 WorkerPool::Stats WorkerPool::get_stats() const {
+    JobManager::JobStats pipeline = engine_->get_stats();
     Stats stats;
-    stats.active_jobs = active_jobs_.load();
-    stats.completed_jobs = completed_jobs_.load();
-    stats.failed_jobs = failed_jobs_.load();
-    stats.queue_depth = queue_size();
-    stats.avg_processing_time_ms = 0.0; // TODO: Implement timing
+    stats.active_jobs = pipeline.active_workers;
+    stats.completed_jobs = pipeline.completed;
+    stats.failed_jobs = pipeline.failed;
+    stats.queue_depth = static_cast<size_t>(pipeline.queue_size);
+    stats.deadline_misses = pipeline.deadline_misses;
+    stats.avg_processing_time_ms = pipeline.avg_processing_time_ms;
     return stats;
 }
 
+JobManager::JobStats WorkerPool::get_pipeline_stats() const {
+    return engine_->get_stats();
+}
+
 size_t WorkerPool::queue_size() const {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
-    return job_queue_.size();
+    return static_cast<size_t>(engine_->get_stats().queue_size);
 }
 
 bool WorkerPool::is_queue_full() const {
@@ -199,9 +96,91 @@ bool WorkerPool::is_queue_full() const {
 }
 
 bool WorkerPool::is_running() const {
-    return !stop_workers_;
+    return running_ && engine_->is_running();
 }
 
 bool WorkerPool::is_healthy() const {
     return is_running() && !is_queue_full();
-}
\ No newline at end of file
+}
+
+StreamApiService::StreamApiService(const std::vector<ProcessingJob>& stream_configs,
+                                   size_t num_workers, size_t queue_size)
+    : worker_pool_(new WorkerPool(num_workers, queue_size, 1, std::chrono::milliseconds(300000))) {
+    replace_streams(stream_configs);
+    worker_pool_->start();
+}
+
+StreamApiService::~StreamApiService() {
+    worker_pool_->stop();
+}
+
+void StreamApiService::handle_decode_request(const std::string& stream_name,
+                                             const std::string& p25_data,
+                                             const std::string& metadata_json) {
+    std::shared_ptr<const StreamTable> streams = std::atomic_load(&stream_configs_);
+    auto it = streams->find(stream_name);
+    if (it == streams->end()) {
+        throw std::runtime_error("Unknown stream: " + stream_name);
+    }
+    
+    auto job = std::make_shared<ProcessingJob>(it->second);
+    job->job_id.clear();
+    job->stream_name = stream_name;
+    job->p25_data = std::make_shared<const std::vector<uint8_t>>(p25_data.begin(), p25_data.end());
+    job->metadata_json = metadata_json;
+    job->received_time = std::chrono::system_clock::now();
+    if (!worker_pool_->enqueue_job(job)) {
+        throw std::runtime_error("Queue full for stream: " + stream_name);
+    }
+}
+
+bool StreamApiService::add_stream(const ProcessingJob& stream_config) {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    std::shared_ptr<const StreamTable> current = std::atomic_load(&stream_configs_);
+    if (current->count(stream_config.stream_name)) {
+        return false;
+    }
+    auto streams = std::make_shared<StreamTable>(*current);
+    streams->emplace(stream_config.stream_name, stream_config);
+    std::atomic_store(&stream_configs_, std::shared_ptr<const StreamTable>(std::move(streams)));
+    return true;
+}
+
+bool StreamApiService::remove_stream(const std::string& stream_name) {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    std::shared_ptr<const StreamTable> current = std::atomic_load(&stream_configs_);
+    if (!current->count(stream_name)) {
+        return false;
+    }
+    auto streams = std::make_shared<StreamTable>(*current);
+    streams->erase(stream_name);
+    std::atomic_store(&stream_configs_, std::shared_ptr<const StreamTable>(std::move(streams)));
+    return true;
+}
+
+// Whole-table swap for a config reload: streams not listed go away, the
+// rest take their new templates with the next request
+void StreamApiService::replace_streams(const std::vector<ProcessingJob>& stream_configs) {
+    auto streams = std::make_shared<StreamTable>();
+    for (const auto& stream_config : stream_configs) {
+        (*streams)[stream_config.stream_name] = stream_config;
+    }
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    std::atomic_store(&stream_configs_, std::shared_ptr<const StreamTable>(std::move(streams)));
+}
+
+std::vector<std::string> StreamApiService::get_stream_names() const {
+    std::vector<std::string> names;
+    for (const auto& stream : *std::atomic_load(&stream_configs_)) {
+        names.push_back(stream.first);
+    }
+    return names;
+}
+
+WorkerPool::Stats StreamApiService::get_worker_stats() const {
+    return worker_pool_->get_stats();
+}
+
+bool StreamApiService::is_healthy() const {
+    return worker_pool_->is_healthy();
+}
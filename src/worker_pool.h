@@ -2,88 +2,65 @@
  * Worker Pool Header for Scalable P25 Processing
  * 
  * Copyright (C) 2024 David Kierzkowski (K9DPD)
+ *
+ * WorkerPool is the stream-oriented front end of the JobManager pipeline:
+ * jobs carry their own output formats, bitrates and upload script, and go
+ * through the same decode -> encode -> dispatch -> upload stages.
  */
 
 #pragma once
 
-#include <queue>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <atomic>
 #include <vector>
 #include <functional>
 #include <memory>
-
-// Job types for the worker pool
-enum class JobType {
-    DECODE,      // P25 → WAV decode
-    CONVERT,     // WAV → modern format conversion  
-    UPLOAD       // Upload script execution
-};
-
-// Job data structure
-struct ProcessingJob {
-    JobType type;
-    std::string stream_name;
-    std::string system_name;
-    int priority;
-    
-    // Input data
-    std::string input_file;
-    std::string metadata_json;
-    
-    // Output configuration per stream
-    std::string output_dir;
-    std::map<std::string, bool> output_formats;
-    std::map<std::string, int> format_bitrates;
-    std::string upload_script;
-    
-    // Processing state
-    std::string job_id;
-    std::chrono::system_clock::time_point created_at;
-    std::chrono::system_clock::time_point started_at;
-    
-    ProcessingJob() : type(JobType::DECODE), priority(1), created_at(std::chrono::system_clock::now()) {}
-};
+#include <mutex>
+#include <map>
+#include <string>
+#include <chrono>
+#include "job_manager.h"
 
 // Worker pool class for async P25 processing
 class WorkerPool {
 private:
-    std::queue<std::shared_ptr<ProcessingJob>> job_queue_;
-    std::vector<std::thread> workers_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_condition_;
-    std::atomic<bool> stop_workers_;
+    std::unique_ptr<JobManager> engine_;
+    std::atomic<bool> running_;
     
     // Configuration
     size_t max_queue_size_;
     size_t batch_size_;
     std::chrono::milliseconds timeout_;
     
-    // Worker statistics
-    std::atomic<int> active_jobs_;
-    std::atomic<int> completed_jobs_;
-    std::atomic<int> failed_jobs_;
-    
-    // Worker thread function
-    void worker_thread();
-    
-    // Job processing functions
-    bool process_decode_job(std::shared_ptr<ProcessingJob> job);
-    bool process_convert_job(std::shared_ptr<ProcessingJob> job);
-    bool process_upload_job(std::shared_ptr<ProcessingJob> job);
-    
 public:
     WorkerPool(size_t num_workers, size_t max_queue_size, size_t batch_size, 
                std::chrono::milliseconds timeout);
     ~WorkerPool();
     
-    // Job management
+    // Job management; set p25_file_path, output_base_path and output_formats
     bool enqueue_job(std::shared_ptr<ProcessingJob> job);
     bool is_queue_full() const;
     size_t queue_size() const;
     
+    // Called from the dispatch stage once all formats of a call are written;
+    // set before start()
+    void set_call_handler(std::function<void(const Call_Data_t&)> handler);
+    void set_call_record_handler(std::function<void(std::shared_ptr<const CallRecord>)> handler);
+    
+    // Talkgroup priorities and per-class slack for queued jobs
+    void set_scheduling_policy(const SchedulingPolicy& policy);
+    
+    // Decode workers between policy.min_workers and num_workers, following the load
+    void set_autoscale_policy(const AutoscalePolicy& policy);
+    
+    // Threads and queue depth of the encode, dispatch and upload stages
+    void configure_stage(PipelineStage stage, int threads, int queue_size);
+    
+    // Upload scripts running at once, and how many may wait for a slot
+    void configure_scripts(int max_concurrent, int queue_size);
+    
+    // Write output files from an io_uring writer thread; set before start()
+    void set_output_write_policy(const OutputWritePolicy& policy);
+    
     // Worker management
     void start();
     void stop();
@@ -95,19 +72,30 @@ public:
         int completed_jobs;
         int failed_jobs;
         size_t queue_depth;
+        uint64_t deadline_misses;
         double avg_processing_time_ms;
     };
     Stats get_stats() const;
     
+    // Full pipeline statistics, including every stage
+    JobManager::JobStats get_pipeline_stats() const;
+    
     // Health check
     bool is_healthy() const;
 };
 
-// Stream-aware API service that uses worker pool
+// Stream-aware API service that uses worker pool. The stream table is an
+// immutable snapshot: requests read it with one std::atomic_load and copy
+// their stream's template into the new job, while add_stream(),
+// remove_stream() and replace_streams() build a new table and swap it in.
+// Jobs already submitted keep the config they were made with.
 class StreamApiService {
 private:
+    typedef std::map<std::string, ProcessingJob> StreamTable; // stream_name -> config template
+    
     std::unique_ptr<WorkerPool> worker_pool_;
-    std::map<std::string, ProcessingJob> stream_configs_; // stream_name -> config template
+    std::shared_ptr<const StreamTable> stream_configs_;
+    std::mutex config_mutex_;  // serializes writers only
     
 public:
     StreamApiService(const std::vector<ProcessingJob>& stream_configs, 
@@ -122,6 +110,7 @@ public:
     // Stream management
     bool add_stream(const ProcessingJob& stream_config);
     bool remove_stream(const std::string& stream_name);
+    void replace_streams(const std::vector<ProcessingJob>& stream_configs);
     std::vector<std::string> get_stream_names() const;
     
     // Monitoring